@@ -6,6 +6,7 @@ Option "display" "string shadow" ["${display_DISPLAYLIB}"]
 Option "display" "string tiff" ["${display_DISPLAYLIB}"]
 Option "display" "string xpm" ["${d_xpm_DISPLAYLIB}"]
 Option "display" "string exr" ["${d_exr_DISPLAYLIB}"]
+Option "display" "string deepexr" ["${d_deepexr_DISPLAYLIB}"]
 Option "display" "string bmp" ["${d_bmp_DISPLAYLIB}"]
 Option "display" "string debugdd" ["debugdd"]
 Option "display" "string piqsl" ["${piqsl_DISPLAYLIB}"]
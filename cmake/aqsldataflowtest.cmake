@@ -0,0 +1,127 @@
+# Regression test for the constant folding and dataflow optimisations in aqsl.
+#
+# Each shader in SHADER_DIRS is compiled twice, with and without
+# -nodataflow.  Both must compile, both must load into the shader VM, and
+# aqsltell must report the same interface (shader type, parameters and their
+# default values, which are computed by running the init code) for each.
+#
+# If AQSIS and BMP_DISPLAY are also given, each shader is then used to render
+# a small image with each of the two sets of compiled shaders, and the images
+# must be identical.  Shaders which call random() are left out, since their
+# results depend on the order the shading points are run in.
+#
+# Expects AQSL, AQSLTELL, SHADER_SOURCE_DIR, SHADER_DIRS and OUTPUT_DIR to be
+# defined on the command line.
+
+set(failures)
+set(rendered_shaders)
+foreach(dir ${SHADER_DIRS})
+	file(GLOB rsl_src "${SHADER_SOURCE_DIR}/${dir}/*.sl")
+	foreach(src ${rsl_src})
+		get_filename_component(name ${src} NAME_WE)
+		foreach(mode optimised unoptimised)
+			set(mode_dir "${OUTPUT_DIR}/${mode}")
+			file(MAKE_DIRECTORY ${mode_dir})
+			set(flags "-I${SHADER_SOURCE_DIR}/include")
+			if(mode STREQUAL "unoptimised")
+				list(APPEND flags -nodataflow)
+			endif()
+			file(REMOVE "${mode_dir}/${name}.slx")
+			execute_process(COMMAND ${AQSL} ${flags} -o ${mode_dir}/${name}.slx ${src}
+				RESULT_VARIABLE compile_result
+				OUTPUT_VARIABLE compile_output
+				ERROR_VARIABLE compile_output)
+			if(compile_result OR NOT EXISTS "${mode_dir}/${name}.slx")
+				message("${name} (${mode}): compile failed\n${compile_output}")
+				list(APPEND failures ${name})
+			endif()
+			execute_process(COMMAND ${AQSLTELL} -shaders=${mode_dir} ${name}
+				RESULT_VARIABLE tell_result
+				OUTPUT_VARIABLE tell_${mode}
+				ERROR_VARIABLE tell_${mode})
+			if(tell_result OR tell_${mode} MATCHES "ERROR")
+				message("${name} (${mode}): could not load compiled shader\n${tell_${mode}}")
+				list(APPEND failures ${name})
+			endif()
+		endforeach()
+		if(NOT tell_optimised STREQUAL tell_unoptimised)
+			message("${name}: interface differs with the dataflow optimisations\n"
+				"optimised:\n${tell_optimised}\nunoptimised:\n${tell_unoptimised}")
+			list(APPEND failures ${name})
+		endif()
+		file(READ ${src} shader_text)
+		if(NOT shader_text MATCHES "random[ \t]*\\(")
+			list(APPEND rendered_shaders "${dir}/${name}")
+		endif()
+	endforeach()
+endforeach()
+
+# Render each shader in a scene suited to its type.  The scene only uses the
+# shaders compiled above, so the optimised and unoptimised images have no
+# shaders in common.
+if(AQSIS AND BMP_DISPLAY)
+	foreach(shader ${rendered_shaders})
+		get_filename_component(dir ${shader} PATH)
+		get_filename_component(name ${shader} NAME)
+		set(imager_rib "")
+		set(light_rib "LightSource \"pointlight\" 1 \"from\" [-2 2 0] \"intensity\" [20]")
+		set(shaders_rib "Surface \"plastic\"")
+		if(dir STREQUAL "surface")
+			set(shaders_rib "Surface \"${name}\"")
+		elseif(dir STREQUAL "displacement")
+			set(shaders_rib "Attribute \"displacementbound\" \"sphere\" [0.5]\nDisplacement \"${name}\"\nSurface \"plastic\"")
+		elseif(dir STREQUAL "light")
+			set(light_rib "LightSource \"${name}\" 1")
+		elseif(dir STREQUAL "volume")
+			set(shaders_rib "Atmosphere \"${name}\"\nSurface \"plastic\"")
+		elseif(dir STREQUAL "imager")
+			set(imager_rib "Imager \"${name}\"")
+		endif()
+		foreach(mode optimised unoptimised)
+			set(mode_dir "${OUTPUT_DIR}/${mode}")
+			file(REMOVE "${mode_dir}/${name}.bmp")
+			file(WRITE "${mode_dir}/${name}.rib"
+				"Option \"searchpath\" \"string shader\" [\"${mode_dir}\"]\n"
+				"Option \"display\" \"string bmp\" [\"${BMP_DISPLAY}\"]\n"
+				"Option \"limits\" \"integer threads\" [1]\n"
+				"Display \"${mode_dir}/${name}.bmp\" \"bmp\" \"rgb\"\n"
+				"Format 64 64 1\n"
+				"PixelSamples 2 2\n"
+				"Hider \"hidden\" \"jitter\" [0]\n"
+				"Projection \"perspective\" \"fov\" [40]\n"
+				"${imager_rib}\n"
+				"WorldBegin\n"
+				"${light_rib}\n"
+				"LightSource \"ambientlight\" 2 \"intensity\" [0.2]\n"
+				"Translate 0 0 4\n"
+				"${shaders_rib}\n"
+				"Sphere 1 -1 1 360\n"
+				"WorldEnd\n")
+			execute_process(COMMAND ${AQSIS} ${mode_dir}/${name}.rib
+				WORKING_DIRECTORY ${mode_dir}
+				OUTPUT_VARIABLE render_${mode}
+				ERROR_VARIABLE render_${mode})
+		endforeach()
+		set(optimised_image "${OUTPUT_DIR}/optimised/${name}.bmp")
+		set(unoptimised_image "${OUTPUT_DIR}/unoptimised/${name}.bmp")
+		if(NOT EXISTS ${optimised_image} AND NOT EXISTS ${unoptimised_image})
+			# Not the fault of the optimisations; the scene may need textures
+			# or other data which isn't available.
+			message("${name}: could not be rendered\n${render_optimised}")
+		else()
+			execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files
+				${optimised_image} ${unoptimised_image}
+				RESULT_VARIABLE compare_result)
+			if(compare_result)
+				message("${name}: image differs with the dataflow optimisations\n"
+					"optimised:\n${render_optimised}\nunoptimised:\n${render_unoptimised}")
+				list(APPEND failures ${name})
+			endif()
+		endif()
+	endforeach()
+endif()
+
+if(failures)
+	list(REMOVE_DUPLICATES failures)
+	message(FATAL_ERROR "Dataflow optimisation regressions in: ${failures}")
+endif()
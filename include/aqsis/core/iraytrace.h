@@ -0,0 +1,102 @@
+//------------------------------------------------------------------------------
+/**
+ *	@file	iraytrace.h
+ *	@author	Paul Gregory
+ *	@brief	Declare the interface class for common raytracer access.
+ *
+ *	Last change by:		$Author$
+ *	Last change date:	$Date$
+ */
+//------------------------------------------------------------------------------
+
+
+#ifndef	___iraytrace_Loaded___
+#define	___iraytrace_Loaded___
+
+#include	<aqsis/aqsis.h>
+#include	<boost/shared_ptr.hpp>
+#include	<aqsis/math/vector3d.h>
+
+namespace Aqsis {
+
+class IqSurface;
+
+/** \brief Information about the closest intersection along a ray.
+ */
+struct SqRayHit
+{
+	/// Ray parameter of the hit; the hit point is org + t*dir.
+	TqFloat t;
+	/// Barycentric coordinates of the hit in the intersected triangle.
+	TqFloat u;
+	TqFloat v;
+	/// Geometric normal of the intersected triangle (not normalised).
+	CqVector3D Ng;
+	/// Index of the primitive hit, in the order primitives were added.
+	TqInt primitive;
+};
+
+class IqRaytrace
+{
+public:
+	virtual ~IqRaytrace()
+	{}
+
+
+	/** Initialise the raytracing subsystem.
+	 */
+	virtual	void	Initialise()=0;
+
+	/** Add a primitive to the raytracing space subdivision structure.
+	 */
+	virtual	void	AddPrimitive(const boost::shared_ptr<IqSurface>& pSurface)=0;
+
+	/** Prepare the structure for raytrace queries.
+	 */
+	virtual void	Finalise()=0;
+
+	/** Find the closest intersection along a ray.
+	 *
+	 * All positions are in camera space.  Only hits with tMin < t < tMax
+	 * are considered.
+	 *
+	 * \param org - ray origin
+	 * \param dir - ray direction; needn't be normalised.
+	 * \param tMin, tMax - range of the ray parameter to search.
+	 * \param hit - filled in with the closest hit, if any.
+	 * \return true if the ray hit something.
+	 */
+	virtual bool	Intersect(const CqVector3D& org, const CqVector3D& dir,
+			TqFloat tMin, TqFloat tMax, SqRayHit& hit) const=0;
+
+	/** Determine whether anything blocks a ray.
+	 *
+	 * This is cheaper than Intersect() since the search may stop at the first
+	 * hit found.
+	 */
+	virtual bool	Occluded(const CqVector3D& org, const CqVector3D& dir,
+			TqFloat tMin, TqFloat tMax) const=0;
+
+	/** Determine occlusion for a whole set of rays at once.
+	 *
+	 * Rays are traced together in small packets, which is considerably
+	 * faster than calling Occluded() for each ray when the rays are coherent,
+	 * as for the samples from a single shading point.
+	 *
+	 * \param org, dir - arrays of ray origins and directions.
+	 * \param tMin - start of the ray parameter range, shared by all rays.
+	 * \param tMax - array of ends of the ray parameter range.
+	 * \param count - number of rays.
+	 * \param occluded - output array; set to true for blocked rays.
+	 */
+	virtual void	OccludedStream(const CqVector3D* org, const CqVector3D* dir,
+			TqFloat tMin, const TqFloat* tMax, TqInt count,
+			bool* occluded) const=0;
+};
+
+
+//-----------------------------------------------------------------------
+
+} // namespace Aqsis
+
+#endif	//	___iraytrace_Loaded___
@@ -25,6 +25,22 @@ namespace Aqsis {
 
 struct IqTextureMapOld;
 struct IqTextureCache;
+class IqRaytrace;
+class IqLightsource;
+
+/** \brief Handles of the coordinate systems which always exist.
+ *
+ * Other named spaces are given handles by IqRenderer::spaceHandle().
+ */
+enum EqSpaceHandle
+{
+	Space_Object = 0,	///< "object"
+	Space_Shader,		///< "shader"
+	Space_Camera,		///< "camera", which is also "current"
+	Space_World,		///< "world"
+
+	Space_Last
+};
 
 class IqRenderer
 {
@@ -38,6 +54,25 @@ public:
 	virtual	bool	matVSpaceToSpace	( const char* strFrom, const char* strTo, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result) = 0;
 	virtual	bool	matNSpaceToSpace	( const char* strFrom, const char* strTo, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result ) = 0;
 
+	/** \brief Get the handle for a named coordinate system.
+	 *
+	 * Handles stay valid for the life of the renderer, even across changes
+	 * to the coordinate system itself, so may be resolved once up front (eg,
+	 * when a shader is loaded) rather than hashing the name on every
+	 * transformation request.  Names which aren't yet defined as coordinate
+	 * systems still get a handle, though transformations involving it will
+	 * fail until the system is defined.
+	 */
+	virtual	TqInt	spaceHandle( const char* strName ) = 0;
+	/** \brief Versions of the space to space transformations taking handles.
+	 *
+	 * Matrices between spaces other than "object" and "shader" are cached
+	 * for the rest of the frame.
+	 */
+	virtual	bool	matSpaceToSpace	( TqInt from, TqInt to, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result ) = 0;
+	virtual	bool	matVSpaceToSpace	( TqInt from, TqInt to, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result ) = 0;
+	virtual	bool	matNSpaceToSpace	( TqInt from, TqInt to, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result ) = 0;
+
 	virtual	const	TqFloat*	GetFloatOption( const char* strName, const char* strParam ) const = 0;
 	virtual	const	TqInt*	GetIntegerOption( const char* strName, const char* strParam ) const = 0;
 	virtual	const	CqString* GetStringOption( const char* strName, const char* strParam ) const = 0;
@@ -78,6 +113,22 @@ public:
 	virtual	IqTextureMapOld* GetLatLongMap( const CqString& fileName ) = 0;
 	//@}
 
+	/** \brief Get the raytracing subsystem.
+	 *
+	 * \return the raytracer, or null if there isn't one.
+	 */
+	virtual	IqRaytrace*	pRaytracer() const = 0;
+
+	/** \brief Remove lights which can't illuminate a region of space.
+	 *
+	 * \param boxMin, boxMax - corners of a box in "current" space.
+	 * \param lights - lights to test; entries for lights which can't reach
+	 *                 any point in the box are set to null.
+	 * \param count - length of the lights array.
+	 * \return the number of lights removed.
+	 */
+	virtual	TqInt	cullLights( const CqVector3D& boxMin, const CqVector3D& boxMax, const IqLightsource** lights, TqInt count ) const = 0;
+
 	virtual	bool	GetBasisMatrix( CqMatrix& matBasis, const CqString& name ) = 0;
 
 	virtual TqInt	RegisterOutputData( const char* name ) = 0;
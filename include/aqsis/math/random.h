@@ -35,6 +35,8 @@
 
 #include	<aqsis/aqsis.h>
 
+#include	<boost/shared_ptr.hpp>
+
 
 namespace Aqsis {
 /*
@@ -80,9 +82,15 @@ namespace Aqsis {
    email: m-mat @ math.sci.hiroshima-u.ac.jp (remove space)
 */
 
+struct SqRandomState;
+
 //----------------------------------------------------------------------
 /** \class CqRandom
  * A random number generator class.
+ *
+ * Generators created by the constructors all draw from a single sequence
+ * shared by the whole process.  Use independent() to get a generator with a
+ * private sequence, for instance one per shading context.
  */
 
 class AQSIS_MATH_SHARE CqRandom
@@ -92,6 +100,16 @@ class AQSIS_MATH_SHARE CqRandom
 
 		CqRandom( TqUint Seed );
 
+		/** \brief Create a generator with its own private sequence.
+		 *
+		 * The returned generator never touches the shared state, so it may
+		 * be used without locking while other generators are used
+		 * elsewhere.  Copies of it share its sequence.
+		 *
+		 * \param Seed Seed for the private sequence.
+		 */
+		static CqRandom independent( TqUint Seed );
+
 		/** Get a random integer in the range (0 <= value < 2^32).
 		 */
 		TqUint RandomInt();
@@ -115,6 +133,12 @@ class AQSIS_MATH_SHARE CqRandom
 		void    Reseed(TqUint Seek);
 	protected:
 		void NextState();
+
+	private:
+		SqRandomState& state();
+
+		/// Private state, or null to draw from the shared sequence.
+		boost::shared_ptr<SqRandomState> m_state;
 };
 
 //-----------------------------------------------------------------------
@@ -132,6 +132,16 @@ typedef enum
 #define PkDspyFlagsWantsScanLineOrder 1
 #define PkDspyFlagsWantsEmptyBuckets 2
 #define PkDspyFlagsWantsNullEmptyBuckets 4
+/* Aqsis extension: the display writes deep images.  Deep displays receive
+ * variable length pixels through DspyImageData(): the data starts with one
+ * PtDspyUnsigned32 fragment count for each pixel of the region in row order,
+ * followed by the fragments of all the pixels in the same order, nearest
+ * first.  Each fragment holds one PtDspyFloat32 for each format, and
+ * entrysize is the size of a fragment in bytes.  Colour and opacity values
+ * are premultiplied by coverage, so the fragments of a pixel composite
+ * front to back with "over".
+ */
+#define PkDspyFlagsWantsDeepData 8
 typedef struct
 {
 	int flags;
@@ -177,10 +177,35 @@ AQSIS_SHADERVM_SHARE boost::shared_ptr<IqShader> createShaderVM(IqRenderer* rend
 										   const std::string& dsoPath);
 //@}
 
+/** \brief Create a CqShaderVM instance from a compiled shader file.
+ *
+ * Parsed programs are cached for the lifetime of the process, so each shader
+ * file is only read once unless it changes on disk.  The file may hold either
+ * the ascii or the binary slx format.
+ *
+ * \param renderContext - Context within which the shader will operate
+ * \param programPath - path to the compiled shader.
+ * \param dsoPath - search path for DSO shadeops.
+ * \param cacheDir - if not empty, a directory in which to keep binary
+ *                   translations of ascii shader programs between runs.
+ */
+AQSIS_SHADERVM_SHARE boost::shared_ptr<IqShader> createShaderVM(IqRenderer* renderContext,
+										   const std::string& programPath,
+										   const std::string& dsoPath,
+										   const std::string& cacheDir = "");
+
+/** \brief Translate a compiled shader from the ascii to the binary slx format.
+ *
+ * \throw XqBadShader if the ascii program can't be parsed.
+ */
+AQSIS_SHADERVM_SHARE void writeBinaryShaderProgram(std::istream& asciiProgram,
+										   std::ostream& binaryProgram);
+
 /** \brief Reset ShaderVM static variables
  *
- * The shaderVM keeps a pool of shader variables handy to avoid reallocation;
- * this function erases those to free up memory.
+ * Shader variable pools now belong to each shader instance, and parsed
+ * programs are cached for the lifetime of the process, so there's currently
+ * nothing to reset.
  *
  * \todo Move this elsewhere, perhaps into a class managing the current
  * instances of CqShaderVM?
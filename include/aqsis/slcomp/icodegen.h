@@ -58,6 +58,15 @@ class AQSIS_SLCOMP_SHARE CqCodeGenVM : public IqCodeGen
 {
 	public:
 		virtual void OutputTree( IqParseNode* pNode, std::string strOutName );
+
+		/// Name of the file written by the last call to OutputTree().
+		const std::string& outputFileName() const
+		{
+			return m_outputFileName;
+		}
+
+	private:
+		std::string m_outputFileName;
 };
 
 
@@ -40,6 +40,10 @@ struct IqParseNode;
 AQSIS_SLCOMP_SHARE bool Parse(std::istream& InputStream, const std::string& StreamName,
 		   std::ostream& ErrorStream );
 
+/// Enable or disable constant folding and the dataflow optimisations run
+/// on each parsed shader.  They are enabled by default.
+AQSIS_SLCOMP_SHARE void SetOptimiseDataflow( bool enable );
+
 /// Resets the state of the parser, clearing any symbol tables, etc.
 AQSIS_SLCOMP_SHARE void ResetParser();
 
@@ -48,9 +48,9 @@
 #include <boost/scoped_array.hpp>
 #include <boost/noncopyable.hpp>
 
-//#include <aqsis/util/memorysentry.h>
 #include <aqsis/tex/io/itiledtexinputfile.h>
 #include <aqsis/tex/buffers/texturebuffer.h>
+#include <aqsis/tex/buffers/tilecache.h>
 #include "randomtable.h"
 #include <aqsis/util/smartptr.h>
 
@@ -83,9 +83,14 @@ class CqTextureTile;
  * iterator mechanism for traversing all pixels within a given region.  This
  * allows for efficient filtering to be performed over the texture, without
  * worrying about the underlying tiled structure.
+ *
+ * Tiles are read from file on demand and registered with the global
+ * CqTileCache, which may evict them again when the texture memory limit is
+ * reached.  The pixel iterators hold a reference to the tile they're
+ * traversing, which pins the tile in memory.
  */
 template<typename T>
-class CqTileArray : boost::noncopyable //, public CqMemoryMonitored
+class CqTileArray : boost::noncopyable, private IqTileCacheOwner
 {
 	private:
 		typedef CqTextureTile<CqTextureBuffer<T> > TqTile;
@@ -105,6 +110,8 @@ class CqTileArray : boost::noncopyable //, public CqMemoryMonitored
 		 */
 		CqTileArray(const boost::shared_ptr<IqTiledTexInputFile>& inFile,
 				TqInt subImageIdx);
+		/// Remove any loaded tiles from the tile cache.
+		~CqTileArray();
 
 		//--------------------------------------------------
 		/// \name Access to buffer dimensions & metadata
@@ -127,7 +134,8 @@ class CqTileArray : boost::noncopyable //, public CqMemoryMonitored
 		 *
 		 * Note that this function is not be very efficient, since the correct
 		 * tile has to be deduced for each invocation, which involves two
-		 * integer divisions.
+		 * integer divisions.  The returned vector doesn't pin the tile, so it
+		 * should not be held across further accesses to the array.
 		 *
 		 * \param x - pixel index in width direction (column index)
 		 * \param y - pixel index in height direction (row index)
@@ -160,6 +168,8 @@ class CqTileArray : boost::noncopyable //, public CqMemoryMonitored
 		 * \return The tile holding the underlying data at the given indices.
 		 */
 		boost::intrusive_ptr<TqTile> getTile(const TqInt x, const TqInt y) const;
+		// Inherited from IqTileCacheOwner
+		virtual void evictTile(TqInt slot);
 
 		/// Underlying texture file.
 		boost::shared_ptr<IqTiledTexInputFile> m_inFile;
@@ -243,6 +253,8 @@ class CqTileArray<T>::CqIterator
 		/// Current tile y-coordinate
 		TqInt m_tileY;
 
+		/// Tile currently being iterated over; holding it pins the tile.
+		boost::intrusive_ptr<TqTile> m_currTile;
 		/// Current position in the underlying tiles.
 		TqBaseIter m_currPos;
 
@@ -321,6 +333,8 @@ class CqTileArray<T>::CqStochasticIterator
 		TqFloat m_remainingArea;
 		/// Number of samples remaining for tiles yet to be filtered over.
 		TqInt m_remainingSamples;
+		/// Tile currently being iterated over; holding it pins the tile.
+		boost::intrusive_ptr<TqTile> m_currTile;
 		/// Current position in the underlying tiles.
 		TqBaseIter m_currPos;
 
@@ -340,11 +354,10 @@ class CqTileArray<T>::CqStochasticIterator
  * The wrapper adds two things to the underlying array:
  *   - Adjust the origin of the array to some point (x0, y0)
  *   - Facilities to enable being held by a tiled array (intrusive reference
- *     counting, and support for determining recent usage for tile cache
- *     rejection (FIXME coming soon) )
+ *     counting, and the recent usage tracking of CqTileCache)
  */
 template<typename ArrayT>
-class CqTextureTile : public CqIntrusivePtrCounted
+class CqTextureTile : public CqCachedTile
 {
 	private:
 		/// Underlying array of pixels
@@ -490,6 +503,18 @@ CqTileArray<T>::CqTileArray(const boost::shared_ptr<IqTiledTexInputFile>& inFile
 	m_tiles(new boost::intrusive_ptr<TqTile>[m_widthInTiles*m_heightInTiles])
 { }
 
+template<typename T>
+CqTileArray<T>::~CqTileArray()
+{
+	CqTileCache& cache = CqTileCache::instance();
+	boost::mutex::scoped_lock lock(cache.mutex());
+	for(TqInt i = 0, numTiles = m_widthInTiles*m_heightInTiles; i < numTiles; ++i)
+	{
+		if(m_tiles[i])
+			cache.remove(m_tiles[i].get());
+	}
+}
+
 template<typename T>
 inline TqInt CqTileArray<T>::width() const
 {
@@ -537,16 +562,36 @@ boost::intrusive_ptr<typename CqTileArray<T>::TqTile> CqTileArray<T>::getTile(
 {
 	assert(x < m_widthInTiles);
 	assert(y < m_heightInTiles);
-	boost::intrusive_ptr<TqTile>& tilePtr = m_tiles[y*m_widthInTiles + x];
-	if(!tilePtr)
+	const TqInt slot = y*m_widthInTiles + x;
+	CqTileCache& cache = CqTileCache::instance();
+	// The lock is held while the tile is read, so that each tile is only
+	// read once, and is kept until the reference for the caller is taken.
+	boost::mutex::scoped_lock lock(cache.mutex());
+	boost::intrusive_ptr<TqTile>& tilePtr = m_tiles[slot];
+	if(tilePtr)
+		cache.touch(tilePtr.get());
+	else
 	{
 		tilePtr = boost::intrusive_ptr<TqTile>(
 				new TqTile(x*m_tileWidth, y*m_tileHeight));
 		m_inFile->readTile(tilePtr->pixels(), x, y, m_subImageIdx);
+		const CqTextureBuffer<T>& pixels = tilePtr->pixels();
+		std::size_t memSize = std::size_t(pixels.width())*pixels.height()
+			*pixels.numChannels()*sizeof(T);
+		// The const_cast is safe here; the cache only uses it to call
+		// evictTile(), which doesn't change the logical array contents.
+		cache.insert(tilePtr.get(), const_cast<CqTileArray<T>*>(this),
+				slot, memSize);
 	}
 	return tilePtr;
 }
 
+template<typename T>
+void CqTileArray<T>::evictTile(TqInt slot)
+{
+	m_tiles[slot].reset();
+}
+
 
 //------------------------------------------------------------------------------
 // CqTileArray::CqIterator implementation
@@ -578,7 +623,8 @@ void CqTileArray<T>::CqIterator::nextTile()
 	{
 		// Grab the next tile as long as we're within the overall
 		// filter support.
-		m_currPos = m_tileArray->getTile(m_tileX,m_tileY)->begin(m_support);
+		m_currTile = m_tileArray->getTile(m_tileX,m_tileY);
+		m_currPos = m_currTile->begin(m_support);
 	}
 }
 
@@ -619,8 +665,9 @@ CqTileArray<T>::CqIterator::CqIterator(const CqTileArray<T>& tileArray,
 	m_tileY(support.sy.start/tileArray.m_tileHeight),
 	// Check support.sx.empty() etc in order to make sure the tile
 	// index is still valid when the support is outside the buffer
-	m_currPos(m_tileArray->getTile(support.sx.isEmpty() ? 0 : m_tileX,
-				support.sy.isEmpty() ? 0 : m_tileY)->begin(m_support))
+	m_currTile(m_tileArray->getTile(support.sx.isEmpty() ? 0 : m_tileX,
+				support.sy.isEmpty() ? 0 : m_tileY)),
+	m_currPos(m_currTile->begin(m_support))
 {
 	// Make sure that inSupport() works correctly when the support is empty.
 	if(support.isEmpty())
@@ -689,8 +736,8 @@ void CqTileArray<T>::CqStochasticIterator::nextTile()
 		m_remainingArea -= area;
 	}
 	// Grab the underlying iterator for the next tile
-	m_currPos = m_tileArray->getTile(m_tileX,m_tileY)->beginStochastic(m_support,
-			numSamples);
+	m_currTile = m_tileArray->getTile(m_tileX,m_tileY);
+	m_currPos = m_currTile->beginStochastic(m_support, numSamples);
 	m_remainingSamples -= numSamples;
 }
 
@@ -731,6 +778,7 @@ CqTileArray<T>::CqStochasticIterator::CqStochasticIterator(const CqTileArray<T>&
 	m_tileY(support.sy.start/tileArray.m_tileHeight),
 	m_remainingArea(support.area()),
 	m_remainingSamples(numSamps),
+	m_currTile(),
 	m_currPos()
 {
 	// Make sure that inSupport() works correctly when the support region is
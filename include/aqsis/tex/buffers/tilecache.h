@@ -0,0 +1,302 @@
+// Aqsis
+// Copyright (C) 2001, Paul C. Gregory and the other authors and contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the software's owners nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// (This is the New BSD license)
+
+/**
+ * \file
+ *
+ * \brief A process-wide, memory limited cache of texture tiles.
+ */
+
+#ifndef TILECACHE_H_INCLUDED
+#define TILECACHE_H_INCLUDED
+
+#include <aqsis/aqsis.h>
+
+#include <cstddef>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace Aqsis {
+
+class CqTileCache;
+class CqCachedTile;
+
+/// Increase the reference count of a tile; required for boost::intrusive_ptr
+AQSIS_TEX_SHARE void intrusive_ptr_add_ref(const CqCachedTile* tile);
+/// Decrease the reference count of a tile; required for boost::intrusive_ptr
+AQSIS_TEX_SHARE void intrusive_ptr_release(const CqCachedTile* tile);
+
+//------------------------------------------------------------------------------
+/** \brief Interface for a container of tiles which are managed by CqTileCache.
+ *
+ * When the tile cache decides to throw a tile away, it asks the owner to drop
+ * its reference to the tile.
+ */
+class AQSIS_TEX_SHARE IqTileCacheOwner
+{
+	public:
+		/** \brief Drop the reference to the tile at the given slot.
+		 *
+		 * \param slot - slot index provided when the tile was added to the
+		 *               cache.
+		 */
+		virtual void evictTile(TqInt slot) = 0;
+		virtual ~IqTileCacheOwner() {}
+};
+
+
+//------------------------------------------------------------------------------
+/** \brief Base class for tiles which can be held in a CqTileCache.
+ *
+ * Holds the bookkeeping needed by the cache: links for the least recently
+ * used list, the memory used by the tile, and where to find the tile in its
+ * owner.
+ *
+ * Tiles are shared between threads, so the intrusive reference count is
+ * guarded by a mutex.  The count only changes when a tile is handed out or
+ * dropped, not for each pixel read.
+ */
+class AQSIS_TEX_SHARE CqCachedTile
+{
+	public:
+		/// Return true if the tile is currently held in the tile cache.
+		bool isCached() const;
+		/// Get the number of references to the tile.
+		TqUint refCount() const;
+		virtual ~CqCachedTile();
+	protected:
+		CqCachedTile();
+	private:
+		friend class CqTileCache;
+		friend void intrusive_ptr_add_ref(const CqCachedTile* tile);
+		friend void intrusive_ptr_release(const CqCachedTile* tile);
+
+		/// Number of references to the tile.
+		mutable TqUint m_refCount;
+
+		/// Previous (more recently used) tile in the LRU list.
+		CqCachedTile* m_lruPrev;
+		/// Next (less recently used) tile in the LRU list.
+		CqCachedTile* m_lruNext;
+		/// Memory used by the tile pixel data, in bytes.
+		std::size_t m_memSize;
+		/// Owner of the tile, or null if the tile isn't cached.
+		IqTileCacheOwner* m_owner;
+		/// Index of the tile within the owner.
+		TqInt m_slot;
+};
+
+
+//------------------------------------------------------------------------------
+/// Usage counters for the tile cache.
+struct SqTileCacheStats
+{
+	/// Number of tile requests satisfied by a tile already in memory.
+	std::size_t hits;
+	/// Number of tile requests which needed a tile to be read from file.
+	std::size_t misses;
+	/// Number of tiles thrown away to keep memory under the limit.
+	std::size_t evictions;
+	/// Memory currently used by cached tiles, in bytes.
+	std::size_t memoryUsed;
+	/// Largest value seen for memoryUsed.
+	std::size_t peakMemoryUsed;
+
+	SqTileCacheStats();
+};
+
+
+//------------------------------------------------------------------------------
+/** \brief A process-wide cache of texture tiles with a memory limit.
+ *
+ * All tiled texture arrays register the tiles they load with the global tile
+ * cache, which keeps the tiles in least recently used order.  When the memory
+ * used by the cached tiles grows past the limit, the least recently used
+ * tiles are evicted from their owners and freed.
+ *
+ * A tile is pinned while anything other than its owner holds a reference to
+ * it (for example, a pixel iterator which is traversing the tile).  Pinned
+ * tiles are never evicted, so the memory limit may be exceeded temporarily if
+ * a lot of tiles are in use at once.
+ *
+ * Textures are sampled from several threads at once.  Since an eviction
+ * reaches into the owner of the evicted tile, a single mutex guards both the
+ * cache and the tile slots of every owner; see mutex().
+ */
+class AQSIS_TEX_SHARE CqTileCache : boost::noncopyable
+{
+	public:
+		/// Return the global tile cache.
+		static CqTileCache& instance();
+
+		/// Construct an empty cache with the default memory limit.
+		CqTileCache();
+
+		/** \brief Set the maximum memory for cached tiles.
+		 *
+		 * If the cache is over the new limit, tiles are evicted straight away.
+		 *
+		 * \param maxMemory - memory limit in bytes.
+		 */
+		void setMaxMemory(std::size_t maxMemory);
+		/// Get the maximum memory for cached tiles in bytes.
+		std::size_t maxMemory() const;
+
+		/** \brief Get the mutex guarding the cache.
+		 *
+		 * Owners must hold the mutex while looking up or changing their tile
+		 * slots, and around calls to insert(), touch() and remove(), so that
+		 * a tile can't be evicted between being found and being referenced.
+		 * The other member functions take the mutex themselves.
+		 */
+		boost::mutex& mutex() const;
+
+		/** \brief Add a newly loaded tile to the cache.
+		 *
+		 * The tile becomes the most recently used tile.  Other tiles may be
+		 * evicted to make room for it.  The caller must hold mutex().
+		 *
+		 * \param tile - tile to add.  The owner should hold a reference.
+		 * \param owner - container holding the tile.
+		 * \param slot - index of the tile within the owner.
+		 * \param memSize - memory used by the tile in bytes.
+		 */
+		void insert(CqCachedTile* tile, IqTileCacheOwner* owner, TqInt slot,
+				std::size_t memSize);
+		/// Mark a cached tile as the most recently used; the caller must
+		/// hold mutex().
+		void touch(CqCachedTile* tile);
+		/** \brief Remove a tile from the cache without evicting it.
+		 *
+		 * This is used when the owner is destroyed.  The caller must hold
+		 * mutex().
+		 */
+		void remove(CqCachedTile* tile);
+
+		/// Get a copy of the usage counters.
+		SqTileCacheStats stats() const;
+		/// Reset the hit, miss and eviction counters.
+		void resetStats();
+
+		/// Memory limit used when none has been set, in bytes.
+		static const std::size_t defaultMaxMemory;
+	private:
+		/// Unlink a tile from the LRU list.
+		void unlink(CqCachedTile* tile);
+		/// Link a tile at the front of the LRU list.
+		void linkFront(CqCachedTile* tile);
+		/// Evict unpinned tiles, oldest first, until under the memory limit.
+		void evictToLimit(const CqCachedTile* keep);
+
+		/// Most recently used tile.
+		CqCachedTile* m_head;
+		/// Least recently used tile.
+		CqCachedTile* m_tail;
+		/// Memory limit in bytes.
+		std::size_t m_maxMemory;
+		/// Usage counters.
+		SqTileCacheStats m_stats;
+		/// Guards the whole cache, and the tile slots of the owners.
+		mutable boost::mutex m_mutex;
+};
+
+
+//==============================================================================
+// Implementation details
+//==============================================================================
+inline CqCachedTile::CqCachedTile()
+	: m_refCount(0),
+	m_lruPrev(0),
+	m_lruNext(0),
+	m_memSize(0),
+	m_owner(0),
+	m_slot(0)
+{ }
+
+inline bool CqCachedTile::isCached() const
+{
+	return m_owner != 0;
+}
+
+//------------------------------------------------------------------------------
+inline SqTileCacheStats::SqTileCacheStats()
+	: hits(0),
+	misses(0),
+	evictions(0),
+	memoryUsed(0),
+	peakMemoryUsed(0)
+{ }
+
+//------------------------------------------------------------------------------
+inline void CqTileCache::touch(CqCachedTile* tile)
+{
+	assert(tile->isCached());
+	++m_stats.hits;
+	if(tile != m_head)
+	{
+		unlink(tile);
+		linkFront(tile);
+	}
+}
+
+inline boost::mutex& CqTileCache::mutex() const
+{
+	return m_mutex;
+}
+
+inline void CqTileCache::unlink(CqCachedTile* tile)
+{
+	if(tile->m_lruPrev)
+		tile->m_lruPrev->m_lruNext = tile->m_lruNext;
+	else
+		m_head = tile->m_lruNext;
+	if(tile->m_lruNext)
+		tile->m_lruNext->m_lruPrev = tile->m_lruPrev;
+	else
+		m_tail = tile->m_lruPrev;
+	tile->m_lruPrev = 0;
+	tile->m_lruNext = 0;
+}
+
+inline void CqTileCache::linkFront(CqCachedTile* tile)
+{
+	tile->m_lruPrev = 0;
+	tile->m_lruNext = m_head;
+	if(m_head)
+		m_head->m_lruPrev = tile;
+	else
+		m_tail = tile;
+	m_head = tile;
+}
+
+} // namespace Aqsis
+
+#endif // TILECACHE_H_INCLUDED
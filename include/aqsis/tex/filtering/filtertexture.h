@@ -96,6 +96,34 @@ template<typename SampleAccumT, typename ArrayT>
 void filterTextureNowrap(SampleAccumT& sampleAccum, const ArrayT& buffer,
 		const SqFilterSupport& support);
 
+/** \brief Filter a texture by whole rows of precomputed filter weights.
+ *
+ * This works like filterTextureNowrap(), except that the filter weights are
+ * computed up front for each row of the support rather than once per pixel as
+ * the samples are accumulated.  Filters which are zero over much of their
+ * rectangular support (such as EWA filters) can then skip the zero parts
+ * without evaluating them, and evaluate the rest incrementally along the row.
+ *
+ * FilterWeightT - filter weight type with the methods
+ *   bool rowSpan(TqInt y, TqInt& startX, TqInt& endX) const;
+ *   void rowWeights(TqInt y, TqInt startX, TqInt endX, TqFloat* weights) const;
+ *   See CqEwaFilter for a model.
+ * SampleAccumT - A model of the SampleAccumulatorConcept which additionally
+ *   has an accumulateWeighted(weight, samples) method.
+ *
+ * \see filterTexture() for more details.
+ *
+ * \param sampleAccum - pixel samples from the support are accumulated into here.
+ * \param filterWeights - filter used by the accumulator.
+ * \param buffer - texture buffer from which the samples will be obtained.
+ * \param support - rectangular filter support region from which to accumulate
+ *                  pixel samples.  This should lie inside the buffer.
+ */
+template<typename SampleAccumT, typename FilterWeightT, typename ArrayT>
+void filterTextureRows(SampleAccumT& sampleAccum,
+		const FilterWeightT& filterWeights, const ArrayT& buffer,
+		const SqFilterSupport& support);
+
 /** \brief Filter a texture stochastically without wrapping.
  *
  * Stochastic filtering of a texture is like normal filtering, except that not
@@ -276,6 +304,44 @@ void filterTextureNowrap(SampleAccumT& sampleAccum, const ArrayT& buffer,
 		sampleAccum.accumulate(i.x(), i.y(), *i);
 }
 
+template<typename SampleAccumT, typename FilterWeightT, typename ArrayT>
+void filterTextureRows(SampleAccumT& sampleAccum,
+		const FilterWeightT& filterWeights, const ArrayT& buffer,
+		const SqFilterSupport& support)
+{
+	if(!sampleAccum.setSampleVectorLength(buffer.numChannels()) || support.isEmpty())
+		return;
+	// Compute the weights for the whole support first.  Each row is zero
+	// outside the span returned by rowSpan(), and rows with no span at all
+	// are skipped when accumulating.
+	const TqInt rowLen = support.sx.range();
+	CqAutoBuffer<TqFloat, 256> weights(support.area(), 0);
+	TqInt yStart = support.sy.end;
+	TqInt yEnd = support.sy.start;
+	for(TqInt y = support.sy.start; y < support.sy.end; ++y)
+	{
+		TqInt startX = support.sx.start;
+		TqInt endX = support.sx.end;
+		if(!filterWeights.rowSpan(y, startX, endX))
+			continue;
+		filterWeights.rowWeights(y, startX, endX,
+				weights.get() + (y - support.sy.start)*rowLen
+				+ (startX - support.sx.start));
+		if(yEnd <= yStart)
+			yStart = y;
+		yEnd = y + 1;
+	}
+	if(yStart >= yEnd)
+		return;
+	// Accumulate samples across the rows which have nonzero weights.
+	for(typename ArrayT::TqIterator i = buffer.begin(SqFilterSupport(
+				support.sx, SqFilterSupport1D(yStart, yEnd))); i.inSupport(); ++i)
+	{
+		sampleAccum.accumulateWeighted(weights[(i.y() - support.sy.start)*rowLen
+				+ (i.x() - support.sx.start)], *i);
+	}
+}
+
 template<typename SampleAccumT, typename ArrayT>
 void filterTextureNowrapStochastic(SampleAccumT& sampleAccum, const ArrayT& buffer,
 		const SqFilterSupport& support, TqInt numSamples)
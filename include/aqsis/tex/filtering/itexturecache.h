@@ -91,6 +91,14 @@ struct AQSIS_TEX_SHARE IqTextureCache
 	//--------------------------------------------------
 	/// Delete all textures from the cache
 	virtual void flush() = 0;
+	/** \brief Delete a single texture from the cache.
+	 *
+	 * This should be called when the file has been rewritten, so that the
+	 * new contents are picked up the next time the texture is used.
+	 *
+	 * \param name - the texture file name.
+	 */
+	virtual void invalidate(const char* name) = 0;
 
 	/** \brief Return the texture file attributes for the named file.
 	 *
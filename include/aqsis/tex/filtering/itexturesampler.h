@@ -91,6 +91,24 @@ class AQSIS_TEX_SHARE IqTextureSampler
 		virtual void sample(const SqSamplePllgram& samplePllgram,
 				const CqTextureSampleOptions& sampleOpts, TqFloat* outSamps) const = 0;
 
+		/** \brief Filter the texture over a batch of parallelogram regions.
+		 *
+		 * This is equivalent to calling sample() for each region in turn
+		 * with the same sample options, and the default implementation does
+		 * exactly that.  Samplers can override it to share filter setup
+		 * between regions, and to order the filtering so that regions
+		 * falling on the same part of the texture are filtered together.
+		 *
+		 * \param samplePllgrams - array of parallelograms to sample over
+		 * \param numPllgrams - length of the samplePllgrams array
+		 * \param sampleOpts - options to the sampler, shared by all regions.
+		 * \param outSamps - the samples will be placed here; the results for
+		 *                   region i start at outSamps[i*sampleOpts.numChannels()]
+		 */
+		virtual void sampleGrid(const SqSamplePllgram* samplePllgrams,
+				TqInt numPllgrams, const CqTextureSampleOptions& sampleOpts,
+				TqFloat* outSamps) const;
+
 		/** \brief Get the default sample options for this texture.
 		 *
 		 * The default implementation returns texture sample options
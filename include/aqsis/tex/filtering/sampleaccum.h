@@ -153,6 +153,19 @@ class CqSampleAccum
 		template<typename SampleVectorT>
 		inline void accumulate(TqInt x, TqInt y, const SampleVectorT& inSamples);
 
+		/** \brief Accumulate a sample with a filter weight computed elsewhere.
+		 *
+		 * This allows filters which can compute many weights at once to
+		 * bypass the per-sample weight evaluation in accumulate().  The
+		 * weight must be the one the filter would give at the sample
+		 * position.
+		 *
+		 * \param weight - filter weight for the sample
+		 * \param inSamples - input sample data to be accumulated
+		 */
+		template<typename SampleVectorT>
+		inline void accumulateWeighted(TqFloat weight, const SampleVectorT& inSamples);
+
 		/// Cleanup; renormalize the accumulated data if necessary.
 		inline ~CqSampleAccum();
 	private:
@@ -307,8 +320,14 @@ template<typename SampleVectorT>
 inline void CqSampleAccum<FilterWeightT>::accumulate(TqInt x, TqInt y,
 		const SampleVectorT& inSamples)
 {
-	TqFloat weight = m_filterWeights(x,y);
+	accumulateWeighted(m_filterWeights(x,y), inSamples);
+}
 
+template<typename FilterWeightT>
+template<typename SampleVectorT>
+inline void CqSampleAccum<FilterWeightT>::accumulateWeighted(TqFloat weight,
+		const SampleVectorT& inSamples)
+{
 	// Some filters are likely to return a lot of zeros (eg, sinc, EWA), so we
 	// check that the weight is nonzero before doing any filtering.
 	if(weight != 0)
@@ -0,0 +1,223 @@
+// Aqsis
+// Copyright (C) 2001, Paul C. Gregory and the other authors and contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the software's owners nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// (This is the New BSD license)
+
+/**
+ * \file
+ *
+ * \brief A process-wide limit on the number of open texture files.
+ */
+
+#ifndef FILEHANDLEPOOL_H_INCLUDED
+#define FILEHANDLEPOOL_H_INCLUDED
+
+#include <aqsis/aqsis.h>
+
+#include <list>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace Aqsis {
+
+class CqFileHandlePool;
+
+//------------------------------------------------------------------------------
+/** \brief Base class for input files whose OS file handle can be closed and
+ * reopened on demand.
+ *
+ * Child classes should keep all the metadata they need in memory, so that
+ * closing the underlying file only costs a reopen when data is next read.
+ */
+class AQSIS_TEX_SHARE CqPooledFile
+{
+	public:
+		/// Return true if the underlying file is currently open.
+		bool isOpen() const;
+	protected:
+		CqPooledFile();
+		/// Removes the file from the pool if it's open.
+		virtual ~CqPooledFile();
+
+		/** \brief Close the underlying file.
+		 *
+		 * Called by the pool when too many files are open.  The file should
+		 * be reopened, and fileOpened() called again, when it's next needed.
+		 */
+		virtual void closeFile() = 0;
+	private:
+		friend class CqFileHandlePool;
+
+		/// Position of the file in the pool LRU list.
+		std::list<CqPooledFile*>::iterator m_lruPos;
+		/// True if the file is counted as open by the pool.
+		bool m_isOpen;
+		/// True if the file has been opened before.
+		bool m_hasBeenOpened;
+};
+
+
+//------------------------------------------------------------------------------
+/// Counters for the file handle pool.
+struct SqFileHandlePoolStats
+{
+	/// Total number of file opens, including reopens.
+	TqInt opens;
+	/// Number of opens of a file which was closed earlier by the pool.
+	TqInt reopens;
+	/// Number of files closed by the pool to stay within the limit.
+	TqInt closes;
+	/// Number of files currently open.
+	TqInt numOpen;
+	/// Largest value seen for numOpen.
+	TqInt peakOpen;
+
+	SqFileHandlePoolStats();
+};
+
+
+//------------------------------------------------------------------------------
+/** \brief A process-wide pool limiting the number of open texture files.
+ *
+ * Texture files register with the pool each time they open their underlying
+ * file, and touch it each time they read from it.  When the number of open
+ * files goes over the limit, the least recently used files are asked to
+ * close.  Closing a file doesn't affect any tiles which have been read from
+ * it already.
+ *
+ * Files are read from several threads, so the pool has a mutex which is held
+ * for the whole of each read; see mutex().
+ */
+class AQSIS_TEX_SHARE CqFileHandlePool : boost::noncopyable
+{
+	public:
+		/// Return the global file handle pool.
+		static CqFileHandlePool& instance();
+
+		/// Construct an empty pool with the default limit.
+		CqFileHandlePool();
+
+		/** \brief Set the maximum number of open files.
+		 *
+		 * Files are closed straight away if more than this are open.
+		 *
+		 * \param maxOpenFiles - limit on open files; values less than one are
+		 *                       treated as one.
+		 */
+		void setMaxOpenFiles(TqInt maxOpenFiles);
+		/// Get the maximum number of open files.
+		TqInt maxOpenFiles() const;
+
+		/** \brief Get the mutex guarding the pool.
+		 *
+		 * Files must hold the mutex while they read from their underlying
+		 * file, so that the pool can't close it part way through, and around
+		 * calls to fileOpened() and touch().  The other member functions take
+		 * the mutex themselves.
+		 */
+		boost::mutex& mutex() const;
+
+		/** \brief Record that a file has just been opened.
+		 *
+		 * The file becomes the most recently used.  Other files may be
+		 * closed to stay within the limit.  The caller must hold mutex().
+		 */
+		void fileOpened(CqPooledFile* file);
+		/// Mark an open file as the most recently used; the caller must hold
+		/// mutex().
+		void touch(CqPooledFile* file);
+		/** \brief Record that a file has been closed by its owner.
+		 *
+		 * This doesn't count toward the closes done by the pool.
+		 */
+		void fileClosed(CqPooledFile* file);
+
+		/// Get a copy of the pool counters.
+		SqFileHandlePoolStats stats() const;
+		/// Reset the open, reopen and close counters.
+		void resetStats();
+
+		/// Limit on open files used when none has been set.
+		static const TqInt defaultMaxOpenFiles;
+	private:
+		/// Close the least recently used files until within the limit.
+		void closeToLimit();
+		/// Remove a file from the pool, with the mutex held.
+		void removeFile(CqPooledFile* file);
+
+		/// Open files, most recently used first.
+		std::list<CqPooledFile*> m_lru;
+		/// Limit on open files.
+		TqInt m_maxOpenFiles;
+		/// Pool counters.
+		SqFileHandlePoolStats m_stats;
+		/// Guards the pool, and reads from the pooled files.
+		mutable boost::mutex m_mutex;
+};
+
+
+//==============================================================================
+// Implementation details
+//==============================================================================
+inline CqPooledFile::CqPooledFile()
+	: m_lruPos(),
+	m_isOpen(false),
+	m_hasBeenOpened(false)
+{ }
+
+inline bool CqPooledFile::isOpen() const
+{
+	return m_isOpen;
+}
+
+//------------------------------------------------------------------------------
+inline SqFileHandlePoolStats::SqFileHandlePoolStats()
+	: opens(0),
+	reopens(0),
+	closes(0),
+	numOpen(0),
+	peakOpen(0)
+{ }
+
+//------------------------------------------------------------------------------
+inline void CqFileHandlePool::touch(CqPooledFile* file)
+{
+	assert(file->m_isOpen);
+	if(file->m_lruPos != m_lru.begin())
+		m_lru.splice(m_lru.begin(), m_lru, file->m_lruPos);
+}
+
+inline boost::mutex& CqFileHandlePool::mutex() const
+{
+	return m_mutex;
+}
+
+} // namespace Aqsis
+
+#endif // FILEHANDLEPOOL_H_INCLUDED
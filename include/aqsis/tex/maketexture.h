@@ -79,6 +79,10 @@ struct SqFilterInfo
  * input file, so stuff like transformation matrices will be preserved where
  * possible.
  *
+ * Textures too large for the "float memorylimit" parameter (in megabytes,
+ * default 1024) are mipmapped a band of rows at a time, with intermediate
+ * levels kept in temporary files.
+ *
  * \param inFileName - full path to the input texture file.
  * \param outFileName - full path to the output texture map file.
  * \param filterInfo - information about which filter type and size to use
@@ -147,7 +151,7 @@ AQSIS_TEX_SHARE void makeCubeFaceEnvironment(
  *
  * The output file contains a duplicate of the recognized metadata from the
  * input file, so stuff like transformation matrices will be preserved where
- * possible.
+ * possible.  Large textures are mipmapped in bands as for makeTexture().
  *
  * \param inFileName - full path to the input texture file.
  * \param outFileName - full path to the output texture map file.
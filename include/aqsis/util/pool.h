@@ -31,6 +31,55 @@
 
 namespace Aqsis {
 
+/** \brief Counters describing the behaviour of an object pool.
+ *
+ * These are intended to help choose sensible slab sizes; they're cheap enough
+ * to be maintained unconditionally.
+ */
+struct SqPoolStats
+{
+	TqInt slabs;          ///< Number of slabs currently owned by the pool.
+	TqInt peakSlabs;      ///< Maximum number of slabs in use at once.
+	TqInt reusedSlabs;    ///< Times a slab was reused after a bulk reset.
+	TqInt allocations;    ///< Total number of objects allocated.
+	TqInt reusedObjects;  ///< Allocations satisfied by a previously freed object.
+	TqInt resets;         ///< Number of bulk resets.
+	TqInt live;           ///< Number of objects currently allocated.
+
+	SqPoolStats()
+		: slabs(0),
+		peakSlabs(0),
+		reusedSlabs(0),
+		allocations(0),
+		reusedObjects(0),
+		resets(0),
+		live(0)
+	{ }
+
+	SqPoolStats& operator+=(const SqPoolStats& rhs)
+	{
+		slabs += rhs.slabs;
+		peakSlabs += rhs.peakSlabs;
+		reusedSlabs += rhs.reusedSlabs;
+		allocations += rhs.allocations;
+		reusedObjects += rhs.reusedObjects;
+		resets += rhs.resets;
+		live += rhs.live;
+		return *this;
+	}
+};
+
+
+/** \brief Slab allocator for objects of a single type.
+ *
+ * Objects are carved from fixed size slabs by bumping a pointer, and freed
+ * objects are kept on a free list for reuse.  When no objects are live the
+ * whole pool may be rewound in one go with reset(), which keeps the slabs for
+ * reuse but forgets the free list.
+ *
+ * The pool isn't synchronised; see CqThreadLocalPool in the core library for
+ * a per-thread wrapper.
+ */
 template <class T, TqInt CS=8>
 class /*AQSIS_UTIL_SHARE*/ CqObjectPool
 {
@@ -44,33 +93,53 @@ class /*AQSIS_UTIL_SHARE*/ CqObjectPool
 			SqChunk* m_next;
 			char m_mem[size];
 		};
+		/// All slabs, in allocation order.
 		SqChunk* m_chunks;
+		/// Slab which new objects are currently being carved from.
+		SqChunk* m_current;
+		/// Offset of the next free byte in m_current.
+		TqInt m_offset;
+		/// Number of slabs in use since the last reset.
+		TqInt m_slabsInUse;
 
 		const unsigned int m_esize;
 		SqLink* m_head;
 
-		void grow()	// Allocate new 'chunk', organize it as a linked list of elements of size 'm_esize'
+		SqPoolStats m_stats;
+
+		void grow()	// Move on to the next spare slab, or allocate a new one.
 		{
-			SqChunk* n = new SqChunk;
-			n->m_next = m_chunks;
-			m_chunks = n;
-
-			const int nelem = SqChunk::size/m_esize;
-			char* start = n->m_mem;
-			char* last = &start[(nelem-1)*m_esize];
-			for (char* p = start; p<last; p+=m_esize)	// assume sizeof(SqLink)<=m_esize
-				reinterpret_cast<SqLink*>(p)->m_next = reinterpret_cast<SqLink*>(p+m_esize);
-			reinterpret_cast<SqLink*>(last)->m_next = 0;
-			m_head = reinterpret_cast<SqLink*>(start);
+			SqChunk* next = m_current ? m_current->m_next : m_chunks;
+			if(next)
+			{
+				++m_stats.reusedSlabs;
+			}
+			else
+			{
+				next = new SqChunk;
+				next->m_next = 0;
+				if(m_current)
+					m_current->m_next = next;
+				else
+					m_chunks = next;
+				++m_stats.slabs;
+			}
+			m_current = next;
+			m_offset = 0;
+			if(++m_slabsInUse > m_stats.peakSlabs)
+				m_stats.peakSlabs = m_slabsInUse;
 		}
 
 	public:
 		CqObjectPool()
-				: m_esize(sizeof(T)<sizeof(SqLink*)?sizeof(SqLink*):sizeof(T))
-		{
-			m_head = 0;
-			m_chunks = 0;
-		}
+				: m_chunks(0),
+				m_current(0),
+				m_offset(0),
+				m_slabsInUse(0),
+				m_esize(sizeof(T)<sizeof(SqLink*)?sizeof(SqLink*):sizeof(T)),
+				m_head(0),
+				m_stats()
+		{ }
 
 		~CqObjectPool() // free all chunks
 		{
@@ -107,10 +176,19 @@ class /*AQSIS_UTIL_SHARE*/ CqObjectPool
 #		endif
 		void* alloc()
 		{
-			if (m_head==0)
+			++m_stats.allocations;
+			++m_stats.live;
+			if (m_head)
+			{
+				++m_stats.reusedObjects;
+				SqLink* p = m_head;
+				m_head = p->m_next;
+				return(p);
+			}
+			if (!m_current || m_offset + m_esize > static_cast<unsigned int>(SqChunk::size))
 				grow();
-			SqLink* p = m_head;
-			m_head = p->m_next;
+			void* p = m_current->m_mem + m_offset;
+			m_offset += m_esize;
 			return(p);
 		}
 
@@ -119,8 +197,34 @@ class /*AQSIS_UTIL_SHARE*/ CqObjectPool
 			SqLink* p = static_cast<SqLink*>(b);
 			p->m_next = m_head;
 			m_head = p;
+			--m_stats.live;
+		}
+
+		/** \brief Rewind all slabs in bulk.
+		 *
+		 * This only happens when there are no live objects; the slabs are kept
+		 * and handed out again before any new ones are allocated.
+		 *
+		 * \return true if the pool was reset.
+		 */
+		bool reset()
+		{
+			if(m_stats.live != 0)
+				return false;
+			m_head = 0;
+			m_current = 0;
+			m_offset = 0;
+			m_slabsInUse = 0;
+			if(m_chunks)
+				++m_stats.resets;
+			return true;
 		}
 
+		/// Get the allocation counters for this pool.
+		const SqPoolStats& stats() const
+		{
+			return m_stats;
+		}
 };
 
 
@@ -309,6 +309,11 @@ void CqMotionModeBlock::EndMotionModeBlock()
 	{
 		QGetRenderContext()->StorePrimitive( m_pDeformingSurface );
 		STATS_INC( GPR_created );
+
+		// The raytracer doesn't handle motion, so give it the first key.
+		if(QGetRenderContext()->pRaytracer())
+			QGetRenderContext()->pRaytracer()->AddPrimitive(
+				m_pDeformingSurface->GetMotionObject(m_pDeformingSurface->Time(0)));
 	}
 }
 
@@ -61,6 +61,8 @@
 #include	<aqsis/util/logging_streambufs.h>
 #include	<aqsis/util/smartptr.h>
 #include	<aqsis/tex/maketexture.h>
+#include	<aqsis/tex/buffers/tilecache.h>
+#include	<aqsis/tex/io/filehandlepool.h>
 #include	"stats.h"
 #include	<aqsis/math/random.h>
 #include	"../../riutil/errorhandlerimpl.h"
@@ -626,6 +628,19 @@ RtVoid RiCxxCore::WorldBegin()
 	CqMatrix currToWorldMat;
 	QGetRenderContext()->matSpaceToSpace("current", "world", NULL, NULL, 0, currToWorldMat);
 	QGetRenderContext()->textureCache().setCurrToWorldMatrix(currToWorldMat);
+	// Limit the memory used by texture tiles.  "texturememory" is in kilobytes.
+	std::size_t texMemory = CqTileCache::defaultMaxMemory;
+	if(const TqInt* poptTexMem = QGetRenderContext()->poptCurrent()->GetIntegerOption( "limits", "texturememory" ))
+		texMemory = std::size_t(max(poptTexMem[0], 1))*1024;
+	CqTileCache::instance().setMaxMemory(texMemory);
+	// Limit the number of texture files held open at once.
+	TqInt texFiles = CqFileHandlePool::defaultMaxOpenFiles;
+	if(const TqInt* poptTexFiles = QGetRenderContext()->poptCurrent()->GetIntegerOption( "limits", "texturefiles" ))
+		texFiles = poptTexFiles[0];
+	CqFileHandlePool::instance().setMaxOpenFiles(texFiles);
+	// Start a fresh raytracing database for this world block.
+	if(QGetRenderContext()->pRaytracer())
+		QGetRenderContext()->pRaytracer()->Initialise();
 
 	// Reset the current transformation to identity, this now represents the object-->world transform.
 	QGetRenderContext() ->ptransSetTime( CqMatrix() );
@@ -667,6 +682,11 @@ RtVoid RiCxxCore::WorldBegin()
 
 RtVoid RiCxxCore::WorldEnd()
 {
+	// Finalise the raytracer database now that all primitives are in, so
+	// that traced shadows in the automatic shadow passes can use it too.
+	if(QGetRenderContext()->pRaytracer())
+		QGetRenderContext()->pRaytracer()->Finalise();
+
 	QGetRenderContext()->RenderAutoShadows();
 
 	bool fFailed = false;
@@ -681,10 +701,6 @@ RtVoid RiCxxCore::WorldEnd()
 	if( NULL != poptGridSize )
 		QGetRenderContext() ->poptWriteCurrent()->GetFloatOptionWrite( "System", "SqrtGridSize" )[0] = sqrt( static_cast<float>(poptGridSize[0]) );
 
-	// Finalise the raytracer database now that all primitives are in.
-	if(QGetRenderContext()->pRaytracer())
-		QGetRenderContext()->pRaytracer()->Finalise();
-
 	// Render the world
 	try
 	{
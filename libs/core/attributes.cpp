@@ -169,6 +169,7 @@ CqAttributes::~CqAttributes()
 
 CqAttributes& CqAttributes::operator=( const CqAttributes& From )
 {
+	m_keyCache.clear();
 	// Copy the system attributes.
 	//	m_aAttributes.resize( From.m_aAttributes.size() );
 	//	TqInt i = From.m_aAttributes.size();
@@ -423,6 +424,54 @@ const CqString* CqAttributes::GetStringAttribute( const char* strName, const cha
 }
 
 
+//---------------------------------------------------------------------
+/** Get a float system attribute parameter by key.
+ * \param key The interned attribute and parameter names.
+ * \return Float pointer 0 if not found.
+ */
+
+const TqFloat* CqAttributes::GetFloatAttribute( const CqParamKey& key ) const
+{
+	const CqParameter * pParam = pParameter( key );
+	if ( pParam != 0 && pParam->Type() == type_float )
+		return ( static_cast<const CqParameterTyped<TqFloat, TqFloat>*>( pParam ) ->pValue() );
+	else
+		return ( 0 );
+}
+
+
+//---------------------------------------------------------------------
+/** Get an integer system attribute parameter by key.
+ * \param key The interned attribute and parameter names.
+ * \return Integer pointer 0 if not found.
+ */
+
+const TqInt* CqAttributes::GetIntegerAttribute( const CqParamKey& key ) const
+{
+	const CqParameter * pParam = pParameter( key );
+	if ( pParam != 0 && pParam->Type() == type_integer )
+		return ( static_cast<const CqParameterTyped<TqInt, TqFloat>*>( pParam ) ->pValue() );
+	else
+		return ( 0 );
+}
+
+
+//---------------------------------------------------------------------
+/** Get a string system attribute parameter by key.
+ * \param key The interned attribute and parameter names.
+ * \return CqString pointer 0 if not found.
+ */
+
+const CqString* CqAttributes::GetStringAttribute( const CqParamKey& key ) const
+{
+	const CqParameter * pParam = pParameter( key );
+	if ( pParam != 0 && pParam->Type() == type_string )
+		return ( static_cast<const CqParameterTyped<CqString, CqString>*>( pParam ) ->pValue() );
+	else
+		return ( 0 );
+}
+
+
 //---------------------------------------------------------------------
 /** Get a point system attribute parameter.
  * \param strName The name of the attribute.
@@ -86,6 +86,7 @@ class CqAttributes : public IqAttributes, public boost::enable_shared_from_this<
 		 */
 		void	AddAttribute( const boost::shared_ptr<CqNamedParameterList>& pAttribute )
 		{
+			m_keyCache.clear();
 			m_aAttributes.Add( pAttribute );
 		}
 		/** Get a pointer to a named user defined attribute.
@@ -104,6 +105,8 @@ class CqAttributes : public IqAttributes, public boost::enable_shared_from_this<
 		 */
 		boost::shared_ptr<CqNamedParameterList> pAttributeWrite( const char* strName )
 		{
+			// The list may be copied or added to, so cached parameters can't be trusted.
+			m_keyCache.clear();
 			boost::shared_ptr<CqNamedParameterList> pAttr = m_aAttributes.Find( strName );
 			if ( pAttr )
 			{
@@ -258,6 +261,19 @@ class CqAttributes : public IqAttributes, public boost::enable_shared_from_this<
 
 		virtual const	TqInt	GetIntegerAttributeDef( const char* strName, const char* strParam, TqInt defaultVal) const;
 
+		/** \brief Get an attribute parameter by interned key.
+		 *
+		 * These are equivalent to the lookups by name, but much faster when
+		 * the same key is looked up repeatedly.
+		 */
+		//@{
+		const	CqParameter* pParameter( const CqParamKey& key ) const;
+		const	TqFloat*	GetFloatAttribute( const CqParamKey& key ) const;
+		const	TqInt*	GetIntegerAttribute( const CqParamKey& key ) const;
+		const	CqString* GetStringAttribute( const CqParamKey& key ) const;
+		TqInt	GetIntegerAttributeDef( const CqParamKey& key, TqInt defaultVal ) const;
+		//@}
+
 		virtual TqFloat*	GetFloatAttributeWrite( const char* strName, const char* strParam );
 		virtual TqInt*	GetIntegerAttributeWrite( const char* strName, const char* strParam );
 		virtual CqString* GetStringAttributeWrite( const char* strName, const char* strParam );
@@ -478,6 +494,7 @@ class CqAttributes : public IqAttributes, public boost::enable_shared_from_this<
 		std::vector<boost::weak_ptr<CqLightsource> > m_apLightsources;	///< a set of currently available lightsources.
 
 		std::list<CqAttributes*>::iterator	m_StackIterator;	///< the index of this attribute state in the global stack, used for destroying when last reference is removed.
+		mutable CqParamKeyCache	m_keyCache;	///< parameters found by key lookups.
 }
 ;
 
@@ -494,6 +511,25 @@ inline IqParameter* CqAttributes::GetAttributeWrite( const char* strName, const
 	return pParameterWrite(strName, strParam);
 }
 
+inline const CqParameter* CqAttributes::pParameter( const CqParamKey& key ) const
+{
+	const CqParameter* param = 0;
+	if ( !m_keyCache.find( key, param ) )
+	{
+		param = pParameter( key.listName(), key.paramName() );
+		m_keyCache.insert( key, param );
+	}
+	return ( param );
+}
+
+inline TqInt CqAttributes::GetIntegerAttributeDef( const CqParamKey& key, TqInt defaultVal ) const
+{
+	const TqInt* attr = GetIntegerAttribute( key );
+	if ( attr )
+		return ( *attr );
+	return ( defaultVal );
+}
+
 
 /// Global attribute stack.
 extern std::list<CqAttributes*>	Attribute_stack;
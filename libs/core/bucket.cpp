@@ -62,6 +62,7 @@ CqBucket::CqBucket()
 	m_xSize(0),
 	m_ySize(0),
 	m_micropolygons(),
+	m_grids(),
 	m_gPrims()
 { }
 
@@ -102,6 +103,7 @@ void CqBucket::SetProcessed( bool bProc )
 		// anything else, this seems to help avoid persistent small pieces of
 		// memory which fragment the heap.
 		TqPolyStorage().swap(m_micropolygons);
+		TqGridStorage().swap(m_grids);
 		TqSurfaceQueue().swap(m_gPrims);
 	}
 }
@@ -44,6 +44,8 @@
 
 namespace Aqsis {
 
+class CqRasterGrid;
+
 struct SqBucketCacheSegment
 {
 	enum	EqBucketCacheSide
@@ -155,6 +157,12 @@ class CqBucket
 
 		std::vector<boost::shared_ptr<CqMicroPolygon> >& micropolygons();
 
+		/** Add a shaded grid to the list of deferred grids.
+		 */
+		void	AddGrid( boost::shared_ptr<CqRasterGrid>& pGrid );
+
+		std::vector<boost::shared_ptr<CqRasterGrid> >& grids();
+
 		const TqCache& cacheSegments() const;
 		void setCacheSegment(SqBucketCacheSegment::EqBucketCacheSide side, boost::shared_ptr<SqBucketCacheSegment>& seg);
 		void clearCache();
@@ -194,6 +202,9 @@ class CqBucket
 		/// Vector of vectors of waiting micropolygons in this bucket
 		typedef std::vector<boost::shared_ptr<CqMicroPolygon> > TqPolyStorage;
 		TqPolyStorage m_micropolygons;
+		/// Waiting shaded grids which are sampled without busting them
+		typedef std::vector<boost::shared_ptr<CqRasterGrid> > TqGridStorage;
+		TqGridStorage m_grids;
 
 		/// A sorted list of primitives for this bucket
 		///
@@ -217,6 +228,16 @@ inline std::vector<boost::shared_ptr<CqMicroPolygon> >& CqBucket::micropolygons(
 	return m_micropolygons;
 }
 
+inline std::vector<boost::shared_ptr<CqRasterGrid> >& CqBucket::grids()
+{
+	return m_grids;
+}
+
+inline void CqBucket::AddGrid( boost::shared_ptr<CqRasterGrid>& pGrid )
+{
+	m_grids.push_back( pGrid );
+}
+
 inline void CqBucket::setCacheSegment(SqBucketCacheSegment::EqBucketCacheSide side, boost::shared_ptr<SqBucketCacheSegment>& seg)
 {
 	// Check there isn't already a cache segment for the position.
@@ -18,16 +18,81 @@
 
 #include	"bucketprocessor.h"
 
+#include	<algorithm>
+#include	<map>
 #include	<valarray>
 
+#include	<boost/bind.hpp>
+#include	<boost/function.hpp>
+
 #include	<aqsis/math/math.h>
 #include	"bucket.h"
+#include	"csgtree.h"
 #include	"imagebuffer.h"
+#include	"micropolygon.h"
+#include	"renderer.h"
+#include	"threadscheduler.h"
 #include	<aqsis/util/timer.h>
 
 
 namespace Aqsis {
 
+namespace {
+
+// Attributes read for every surface.
+const CqParamKey keyCullHidden("cull", "hidden");
+const CqParamKey keyDiceRasterOrient("dice", "rasterorient");
+
+/// Fragments of a deep pixel closer than this fraction of their depth are merged.
+const TqFloat deepMergeTolerance = 1e-3f;
+
+/// Get the attributes of a surface, for lookups by key.
+inline const CqAttributes& surfaceAttributes(const CqSurface& surface)
+{
+	return *static_cast<const CqAttributes*>(surface.pAttributes().get());
+}
+
+/** Run rowFunc over bands of the rows [yBegin, yEnd), one band for each
+ * thread of the scheduler, and wait for them all to finish.
+ *
+ * Without a scheduler all rows are done on the calling thread.
+ */
+void forEachRowBand(CqThreadScheduler* scheduler, TqInt yBegin, TqInt yEnd,
+		const boost::function2<void, TqInt, TqInt>& rowFunc)
+{
+	TqInt numBands = scheduler ? scheduler->numThreads() : 1;
+	if(numBands <= 1 || yEnd - yBegin < 2)
+	{
+		rowFunc(yBegin, yEnd);
+		return;
+	}
+	TqInt bandSize = (yEnd - yBegin + numBands - 1)/numBands;
+	for(TqInt y = yBegin; y < yEnd; y += bandSize)
+		scheduler->addWorkUnit(boost::bind(rowFunc, y, std::min(yEnd, y + bandSize)));
+	scheduler->joinAll();
+}
+
+} // unnamed namespace
+
+/// Data shared by the bands of rows filtered by FilterRows().
+struct CqBucketProcessor::SqFilterChannels
+{
+	SqFilterChannels(const std::map<TqInt, CqRenderer::SqOutputDataEntry>& channelMap,
+			TqInt depthIndex, TqInt datasize, std::vector<TqFloat>& coverages)
+		: channelMap(channelMap),
+		depthIndex(depthIndex),
+		datasize(datasize),
+		coverages(coverages)
+	{ }
+	/// Offsets of the sample data for each channel of the channel buffer.
+	const std::map<TqInt, CqRenderer::SqOutputDataEntry>& channelMap;
+	TqInt depthIndex;
+	/// Size of the data of each sample.
+	TqInt datasize;
+	/// Coverage of each display pixel, in row order.
+	std::vector<TqFloat>& coverages;
+};
+
 CqBucketProcessor::CqBucketProcessor(CqImageBuffer& imageBuf,
                                      const SqOptionCache& optCache)
 	: m_bucket(0),
@@ -46,7 +111,8 @@ CqBucketProcessor::CqBucketProcessor(CqImageBuffer& imageBuf,
 	m_SampleRegion(),
 	m_DisplayRegion(),
 	m_hasValidSamples(false),
-	m_channelBuffer()
+	m_channelBuffer(),
+	m_deepBuffer()
 {
 	setupCacheInformation();
 }
@@ -173,7 +239,8 @@ void CqBucketProcessor::preProcess(IqSampler* sampler)
 				which = ((y-originY+m_DiscreteShiftY)*stride)+x-originX+m_DiscreteShiftX;
 				CqVector2D bPos2 = CqVector2D(x, y);
 				m_aieImage[which]->clear();
-				m_aieImage[which]->setSamples(sampler, bPos2);
+				m_aieImage[which]->setSamples(sampler, bPos2,
+						m_optCache.shutterOpen, m_optCache.shutterClose);
 			}
 		}
 		InitialiseFilterValues();
@@ -236,9 +303,12 @@ void CqBucketProcessor::process()
 		AQSIS_TIME_SCOPE(Render_MPGs);
 		RenderWaitingMPs();
 	}
+
+	// Make the counters from this bucket visible to the rest of the renderer.
+	CqStats::mergeThreadCounters();
 }
 
-void CqBucketProcessor::postProcess()
+void CqBucketProcessor::postProcess(CqThreadScheduler* scheduler)
 {
 	if (!m_bucket)
 		return;
@@ -247,12 +317,12 @@ void CqBucketProcessor::postProcess()
 	// micropolygons rendered to that pixel.
 	{
 		AQSIS_TIME_SCOPE(Combine_samples);
-		CombineElements();
+		CombineElements(scheduler);
 	}
 
 	{
 		AQSIS_TIME_SCOPE(Filter_samples);
-		FilterBucket();
+		FilterBucket(scheduler);
 		ExposeBucket();
 	}
 
@@ -362,14 +432,57 @@ void CqBucketProcessor::postProcess()
 /** Combine the subsamples into single pixel samples and coverage information.
  */
 
-void CqBucketProcessor::CombineElements()
+void CqBucketProcessor::CombineElements(CqThreadScheduler* scheduler)
+{
+	// Deep displays need the hits of each pixel, which must be gathered
+	// before Combine() collapses them.
+	bool gatherDeep = QGetRenderContext()->pDDmanager()->fDisplayNeedsDeepData();
+	// Each pixel is combined independently, except that CSG trees are
+	// shared between the samples of many pixels.
+	if(CqCSGTreeNode::IsRequired())
+		scheduler = 0;
+	forEachRowBand(scheduler,
+			m_SampleRegion.yMin() - m_DisplayRegion.yMin() + m_DiscreteShiftY,
+			m_SampleRegion.yMax() - m_DisplayRegion.yMin() + m_DiscreteShiftY,
+			boost::bind(&CqBucketProcessor::CombineRows, this, _1, _2, gatherDeep));
+
+	if(!gatherDeep)
+	{
+		m_deepBuffer.clear();
+		return;
+	}
+	// Collect the fragments of the display pixels.  Pixels from the cache
+	// segments were combined by the neighbouring buckets, but still hold
+	// their fragments.
+	m_deepBuffer.allocate(m_DisplayRegion.width(), m_DisplayRegion.height(),
+			deepMergeTolerance);
+	std::vector<SqDeepFragment> fragments;
+	CqImagePixelPtr* pie;
+	for(TqInt y = m_DisplayRegion.yMin(); y < m_DisplayRegion.yMax(); ++y)
+	{
+		ImageElement(m_DisplayRegion.xMin(), y, pie);
+		for(TqInt x = m_DisplayRegion.xMin(); x < m_DisplayRegion.xMax(); ++x, ++pie)
+		{
+			fragments = (*pie)->deepFragments();
+			m_deepBuffer.addPixel(fragments);
+		}
+	}
+}
+
+//----------------------------------------------------------------------
+/** Combine the samples of the rows [yBegin, yEnd) of the sample region,
+ * given as rows of the pixel array.
+ */
+
+void CqBucketProcessor::CombineRows(TqInt yBegin, TqInt yEnd, bool gatherDeep)
 {
-	for(TqInt y = m_SampleRegion.yMin() - m_DisplayRegion.yMin() + m_DiscreteShiftY, endY = m_SampleRegion.yMax() - m_DisplayRegion.yMin() + m_DiscreteShiftY; y < endY; ++y)
+	for(TqInt y = yBegin; y < yEnd; ++y)
 	{
 		for(TqInt x = m_SampleRegion.xMin() - m_DisplayRegion.xMin() + m_DiscreteShiftX, endX = m_SampleRegion.xMax() - m_DisplayRegion.xMin() + m_DiscreteShiftX; x < endX; ++x)
 		{
 			m_aieImage[(y*m_DataRegion.width())+x]->Combine(m_optCache.depthFilter,
-			                                                m_optCache.zThreshold);
+			                                                m_optCache.zThreshold,
+			                                                gatherDeep);
 		}
 	}
 }
@@ -378,7 +491,7 @@ void CqBucketProcessor::CombineElements()
 /** Filter the samples in this bucket according to type and filter widths.
  */
 
-void CqBucketProcessor::FilterBucket()
+void CqBucketProcessor::FilterBucket(CqThreadScheduler* scheduler)
 {
 	CqImagePixelPtr * pie;
 
@@ -474,10 +587,9 @@ void CqBucketProcessor::FilterBucket()
 
 							for ( TqInt sx = 0; sx < m_optCache.xSamps; sx++ )
 							{
-								SqSampleData const& sampleData = (*pie2)->SampleData( sampleIndex );
-								CqVector2D vecS = sampleData.position;
-								vecS -= CqVector2D( xcent, ycent );
-								if ( vecS.x() >= -xfwo2 && vecS.y() >= -yfwo2 && vecS.x() <= xfwo2 && vecS.y() <= yfwo2 )
+								TqFloat sampX = (*pie2)->samplePosX()[sampleIndex] - xcent;
+								TqFloat sampY = (*pie2)->samplePosY()[sampleIndex] - ycent;
+								if ( sampX >= -xfwo2 && sampY >= -yfwo2 && sampX <= xfwo2 && sampY <= yfwo2 )
 								{
 									TqFloat g = m_aFilterValues[index + sampleIndex];
 									gTot += g;
@@ -532,10 +644,9 @@ void CqBucketProcessor::FilterBucket()
 
 						for ( sy = 0; sy < m_optCache.ySamps; sy++ )
 						{
-							SqSampleData const& sampleData = (*pie2)->SampleData( sampleIndex );
-							CqVector2D vecS = sampleData.position;
-							vecS -= CqVector2D( xcent, ycent );
-							if ( vecS.x() >= -xfwo2 && vecS.y() >= -yfwo2 && vecS.x() <= xfwo2 && vecS.y() <= yfwo2 )
+							TqFloat sampX = (*pie2)->samplePosX()[sampleIndex] - xcent;
+							TqFloat sampY = (*pie2)->samplePosY()[sampleIndex] - ycent;
+							if ( sampX >= -xfwo2 && sampY >= -yfwo2 && sampX <= xfwo2 && sampY <= yfwo2 )
 							{
 								TqFloat g = m_aFilterValues[index + sampleIndex];
 								gTot += g;
@@ -581,86 +692,12 @@ void CqBucketProcessor::FilterBucket()
 		}
 		else
 		{
-			// non-seperable filter
-			for ( y = DisplayRegion().yMin(); y < endy ; y++ )
-			{
-				TqFloat ycent = y + 0.5f;
-				for ( x = DisplayRegion().xMin(); x < endx ; x++ )
-				{
-					TqFloat xcent = x + 0.5f;
-					TqFloat gTot = 0.0;
-					SampleCount = 0;
-					std::valarray<TqFloat> samples( 0.0f, datasize);
-
-					// Get the element at the upper left corner of the filter area.
-					ImageElement( x - xmax, y - ymax, pie );
-					for (TqInt fy = -ymax; fy <= ymax; fy++, pie += xlen )
-					{
-						CqImagePixelPtr* pie2 = pie;
-						for (TqInt fx = -xmax; fx <= xmax; fx++, ++pie2 )
-						{
-							TqInt index = ((fy + ymax)*(2*xmax+1) + fx + xmax) * numSubPixels;
-							// Now go over each subsample within the pixel
-							TqInt sampleIndex = 0;
-							for (TqInt sy = 0; sy < m_optCache.ySamps; sy++ )
-							{
-								for (TqInt sx = 0; sx < m_optCache.xSamps; sx++ )
-								{
-									SqSampleData const& sampleData = (*pie2)->SampleData( sampleIndex );
-									CqVector2D vecS = sampleData.position;
-									vecS -= CqVector2D( xcent, ycent );
-									if ( vecS.x() >= -xfwo2 && vecS.y() >= -yfwo2 && vecS.x() <= xfwo2 && vecS.y() <= yfwo2 )
-									{
-										TqFloat g = m_aFilterValues[index+sampleIndex];
-										gTot += g;
-										SqImageSample& opv = (*pie2)->occludingHit(sampleIndex);
-										if ( opv.flags & SqImageSample::Flag_Valid )
-										{
-											TqFloat* data = (*pie2)->sampleHitData(opv);
-											for ( TqInt k = 0; k < datasize; ++k )
-												samples[k] += data[k] * g;
-											SampleCount++;
-										}
-									}
-									sampleIndex++;
-								}
-							}
-						}
-					}
-
-
-					// Set depth to infinity if no samples.
-					if ( SampleCount == 0 )
-					{
-						for( std::map<TqInt, CqRenderer::SqOutputDataEntry>::iterator channel_i = channelMap.begin(); channel_i != channelMap.end(); ++channel_i )
-						{
-							for(TqInt i = 0; i < channel_i->second.m_NumSamples; ++i)
-								m_channelBuffer(x-DisplayRegion().xMin(), y-DisplayRegion().yMin(), channel_i->first)[i] = 0.0f;
-						}
-						// Set the depth to infinity.
-						m_channelBuffer(x-DisplayRegion().xMin(), y-DisplayRegion().yMin(), depthIndex)[0] = FLT_MAX;
-						aCoverages[i] = 0.0;
-					}
-					else
-					{
-						float oneOverGTot = 1.0 / gTot;
-						
-						// Copy the filtered sample data into the channel buffer.
-						for( std::map<TqInt, CqRenderer::SqOutputDataEntry>::iterator channel_i = channelMap.begin(); channel_i != channelMap.end(); ++channel_i )
-						{
-							for(TqInt i = 0; i < channel_i->second.m_NumSamples; ++i)
-								m_channelBuffer(x-DisplayRegion().xMin(), y-DisplayRegion().yMin(), channel_i->first)[i] = samples[channel_i->second.m_Offset + i] * oneOverGTot;
-						}
-
-						if ( SampleCount >= numSubPixels)
-							aCoverages[ i ] = 1.0;
-						else
-							aCoverages[ i ] = ( TqFloat ) SampleCount / ( TqFloat ) (numSubPixels );
-					}
-
-					i++;
-				}
-			}
+			// non-seperable filter.  Each output pixel only reads the
+			// samples, so bands of rows can be filtered in parallel.
+			SqFilterChannels channels(channelMap, depthIndex, datasize, aCoverages);
+			forEachRowBand(scheduler, DisplayRegion().yMin(), endy,
+					boost::bind(&CqBucketProcessor::FilterRows, this, _1, _2,
+						boost::ref(channels)));
 		}
 	}
 	else
@@ -743,6 +780,106 @@ void CqBucketProcessor::FilterBucket()
 	}
 }
 
+//----------------------------------------------------------------------
+/** Filter the rows [yBegin, yEnd) of the display region with a
+ * non-separable filter.
+ */
+
+void CqBucketProcessor::FilterRows(TqInt yBegin, TqInt yEnd, SqFilterChannels& channels)
+{
+	CqImagePixelPtr * pie;
+
+	TqInt xmax = m_DiscreteShiftX;
+	TqInt ymax = m_DiscreteShiftY;
+	TqFloat xfwo2 = std::ceil(m_optCache.xFiltSize) * 0.5f;
+	TqFloat yfwo2 = std::ceil(m_optCache.yFiltSize) * 0.5f;
+	TqInt numSubPixels = ( m_optCache.xSamps * m_optCache.ySamps );
+	TqInt xlen = DataRegion().width();
+	TqInt datasize = channels.datasize;
+	TqInt endx = DisplayRegion().xMax();
+
+	const std::map<TqInt, CqRenderer::SqOutputDataEntry>& channelMap = channels.channelMap;
+	std::vector<TqFloat>& aCoverages = channels.coverages;
+	TqInt i = (yBegin - DisplayRegion().yMin()) * DisplayRegion().width();
+	for ( TqInt y = yBegin; y < yEnd ; y++ )
+	{
+		TqFloat ycent = y + 0.5f;
+		for ( TqInt x = DisplayRegion().xMin(); x < endx ; x++ )
+		{
+			TqFloat xcent = x + 0.5f;
+			TqFloat gTot = 0.0;
+			TqInt SampleCount = 0;
+			std::valarray<TqFloat> samples( 0.0f, datasize);
+
+			// Get the element at the upper left corner of the filter area.
+			ImageElement( x - xmax, y - ymax, pie );
+			for (TqInt fy = -ymax; fy <= ymax; fy++, pie += xlen )
+			{
+				CqImagePixelPtr* pie2 = pie;
+				for (TqInt fx = -xmax; fx <= xmax; fx++, ++pie2 )
+				{
+					TqInt index = ((fy + ymax)*(2*xmax+1) + fx + xmax) * numSubPixels;
+					// Now go over each subsample within the pixel,
+					// using the packed sample positions.
+					CqImagePixel* pixel = pie2->get();
+					const TqFloat* posX = pixel->samplePosX();
+					const TqFloat* posY = pixel->samplePosY();
+					for (TqInt sampleIndex = 0; sampleIndex < numSubPixels; sampleIndex++ )
+					{
+						TqFloat sx = posX[sampleIndex] - xcent;
+						TqFloat sy = posY[sampleIndex] - ycent;
+						if ( sx >= -xfwo2 && sy >= -yfwo2 && sx <= xfwo2 && sy <= yfwo2 )
+						{
+							TqFloat g = m_aFilterValues[index+sampleIndex];
+							gTot += g;
+							SqImageSample& opv = pixel->occludingHit(sampleIndex);
+							if ( opv.flags & SqImageSample::Flag_Valid )
+							{
+								TqFloat* data = pixel->sampleHitData(opv);
+								for ( TqInt k = 0; k < datasize; ++k )
+									samples[k] += data[k] * g;
+								SampleCount++;
+							}
+						}
+					}
+				}
+			}
+
+
+			// Set depth to infinity if no samples.
+			if ( SampleCount == 0 )
+			{
+				for( std::map<TqInt, CqRenderer::SqOutputDataEntry>::const_iterator channel_i = channelMap.begin(); channel_i != channelMap.end(); ++channel_i )
+				{
+					for(TqInt i = 0; i < channel_i->second.m_NumSamples; ++i)
+						m_channelBuffer(x-DisplayRegion().xMin(), y-DisplayRegion().yMin(), channel_i->first)[i] = 0.0f;
+				}
+				// Set the depth to infinity.
+				m_channelBuffer(x-DisplayRegion().xMin(), y-DisplayRegion().yMin(), channels.depthIndex)[0] = FLT_MAX;
+				aCoverages[i] = 0.0;
+			}
+			else
+			{
+				float oneOverGTot = 1.0 / gTot;
+				
+				// Copy the filtered sample data into the channel buffer.
+				for( std::map<TqInt, CqRenderer::SqOutputDataEntry>::const_iterator channel_i = channelMap.begin(); channel_i != channelMap.end(); ++channel_i )
+				{
+					for(TqInt i = 0; i < channel_i->second.m_NumSamples; ++i)
+						m_channelBuffer(x-DisplayRegion().xMin(), y-DisplayRegion().yMin(), channel_i->first)[i] = samples[channel_i->second.m_Offset + i] * oneOverGTot;
+				}
+
+				if ( SampleCount >= numSubPixels)
+					aCoverages[ i ] = 1.0;
+				else
+					aCoverages[ i ] = ( TqFloat ) SampleCount / ( TqFloat ) (numSubPixels );
+			}
+
+			i++;
+		}
+	}
+}
+
 void CqBucketProcessor::ImageElement( TqInt iXPos, TqInt iYPos, CqImagePixelPtr*& pie )
 {
 	iXPos -= DisplayRegion().xMin();
@@ -769,8 +906,8 @@ void CqBucketProcessor::ExposeBucket()
 	if(!m_hasValidSamples && !QGetRenderContext()->poptCurrent()->pshadImager())
 		return;
 
-	TqFloat exposegain = QGetRenderContext() ->poptCurrent()->GetFloatOption( "System", "Exposure" ) [ 0 ];
-	TqFloat exposegamma = QGetRenderContext() ->poptCurrent()->GetFloatOption( "System", "Exposure" ) [ 1 ];
+	TqFloat exposegain = m_optCache.exposeGain;
+	TqFloat exposegamma = m_optCache.exposeGamma;
 	// Early exit if the exposure & gain are trivial
 	if ( exposegain == 1.0 && exposegamma == 1.0 )
 		return;
@@ -923,6 +1060,14 @@ void CqBucketProcessor::CalculateDofBounds()
 
 void CqBucketProcessor::RenderWaitingMPs()
 {
+	for ( std::vector<boost::shared_ptr<CqRasterGrid> >::iterator itGrid = m_bucket->grids().begin();
+			itGrid != m_bucket->grids().end();
+			itGrid++ )
+	{
+		RenderGrid( **itGrid );
+	}
+	m_bucket->grids().clear();
+
 	for ( std::vector<boost::shared_ptr<CqMicroPolygon> >::iterator itMP = m_bucket->micropolygons().begin();
 			itMP != m_bucket->micropolygons().end();
 			itMP++ )
@@ -948,7 +1093,7 @@ void CqBucketProcessor::RenderSurface( boost::shared_ptr<CqSurface>& surface )
 	{
 		AQSIS_TIME_SCOPE(Occlusion_culling);
 		if ( surface->fCachedBound() &&
-			 ( surface->pAttributes()->GetIntegerAttributeDef( "cull", "hidden", 1 ) == 1 ) &&
+			 ( surfaceAttributes(*surface).GetIntegerAttributeDef( keyCullHidden, 1 ) == 1 ) &&
 		     m_OcclusionTree.canCull(surface->GetCachedRasterBound()) )
 		{
 			m_imageBuf.RepostSurface(*m_bucket, surface);
@@ -965,8 +1110,8 @@ void CqBucketProcessor::RenderSurface( boost::shared_ptr<CqSurface>& surface )
 		QGetRenderContext()->matSpaceToSpace("camera", "raster", NULL, NULL,
 											 QGetRenderContextI()->Time(),
 											 diceCoords);
-		const TqInt* rasterOrient = surface->pAttributes()->
-								GetIntegerAttribute("dice", "rasterorient");
+		const TqInt* rasterOrient = surfaceAttributes(*surface).
+								GetIntegerAttribute(keyDiceRasterOrient);
 		if(rasterOrient && *rasterOrient == 0)
 		{
 			// Non raster-oriented dicing: dice the object as if all parts of
@@ -1069,16 +1214,7 @@ void CqBucketProcessor::RenderMicroPoly( CqMicroPolygon* pMP )
 	bool UsingDof = QGetRenderContext()->UsingDepthOfField();
 	bool IsMoving = pMP->IsMoving();
 
-	m_CurrentMpgSampleInfo.smoothInterpolation =
-		pMP->pGrid()->GetCachedGridInfo().useSmoothShading;
-
-	// Samples hitting the micropoly are occlusion cullable if
-	// 1) The micropoly is not part of a CSG
-	// 2) We don't need the entire set of samples for depth filtering.
-	m_CurrentMpgSampleInfo.isCullable = !pMP->pGrid()->usesCSG() &&
-	                  !( (m_optCache.displayMode & DMode_Z) &&
-	                     (m_optCache.depthFilter == Filter_Max ||
-	                      m_optCache.depthFilter == Filter_Average) );
+	CacheGridSampleInfo( pMP->pGrid() );
 
 	// Cache output sample info for this mpg so we don't have to keep fetching
 	// it for each sample.
@@ -1092,6 +1228,60 @@ void CqBucketProcessor::RenderMicroPoly( CqMicroPolygon* pMP )
 
 
 
+//----------------------------------------------------------------------
+/** Render the quads of a static grid which touch this bucket.
+ */
+void CqBucketProcessor::RenderGrid( const CqRasterGrid& grid )
+{
+	CqMicroPolyGridBase* pGrid = grid.pGrid();
+	CacheGridSampleInfo( pGrid );
+
+	TqFloat xmin = SampleRegion().xMin();
+	TqFloat xmax = SampleRegion().xMax();
+	TqFloat ymin = SampleRegion().yMin();
+	TqFloat ymax = SampleRegion().yMax();
+	TqInt numSampled = 0;
+	TqInt numMissed = 0;
+	for ( TqInt q = 0, numQuads = grid.numQuads(); q < numQuads; ++q )
+	{
+		if ( !grid.quadTouches( q, xmin, xmax, ymin, ymax ) )
+			continue;
+		// The quad is sampled through a transient micropolygon on the stack,
+		// which reads the vertices and shading outputs straight from the
+		// grid.  The raster grid holds the grid for the whole loop, so the
+		// micropolygon takes no reference and touches no shared counters.
+		CqMicroPolygon mp( pGrid, grid.gridIndex( q ), true );
+		if ( grid.quadFlags( q ) & CqRasterGrid::Quad_Trimmed )
+			mp.MarkTrimmed();
+		mp.Initialise();
+		mp.CacheOutputInterpCoeffs( m_CurrentMpgSampleInfo );
+		RenderMPG_Static( &mp );
+		++numSampled;
+		if ( !mp.IsHit() )
+			++numMissed;
+	}
+	// Count the quads as micropolygons, once for the whole grid.
+	CqStats::addI( CqStats::MPG_allocated, numSampled );
+	CqStats::addI( CqStats::MPG_deallocated, numSampled );
+	CqStats::addI( CqStats::MPG_missed, numMissed );
+}
+
+
+void CqBucketProcessor::CacheGridSampleInfo( CqMicroPolyGridBase* pGrid )
+{
+	m_CurrentMpgSampleInfo.smoothInterpolation =
+		pGrid->GetCachedGridInfo().useSmoothShading;
+
+	// Samples hitting the micropoly are occlusion cullable if
+	// 1) The micropoly is not part of a CSG
+	// 2) We don't need the entire set of samples for depth filtering.
+	m_CurrentMpgSampleInfo.isCullable = !pGrid->usesCSG() &&
+	                  !( (m_optCache.displayMode & DMode_Z) &&
+	                     (m_optCache.depthFilter == Filter_Max ||
+	                      m_optCache.depthFilter == Filter_Average) );
+}
+
+
 // this function assumes that neither dof or mb are being used. it is much
 // simpler than the general case dealt with above.
 void CqBucketProcessor::RenderMPG_Static( CqMicroPolygon* pMPG)
@@ -1102,6 +1292,8 @@ void CqBucketProcessor::RenderMPG_Static( CqMicroPolygon* pMPG)
 	bool isCullable = m_CurrentMpgSampleInfo.isCullable;
 
     TqInt sample_hits = 0;
+	CqSampleStatsCounter sampleCount(CqStats::SPL_count);
+	CqSampleStatsCounter boundHits(CqStats::SPL_bound_hits);
 
 	CqHitTestCache hitTestCache;
 	pMPG->CacheHitTestValues(hitTestCache, false);
@@ -1112,7 +1304,11 @@ void CqBucketProcessor::RenderMPG_Static( CqMicroPolygon* pMPG)
 	TqFloat bmaxx = Bound.vecMax().x();
 	TqFloat bminy = Bound.vecMin().y();
 	TqFloat bmaxy = Bound.vecMax().y();
-	//TqFloat bminz = Bound.vecMin().z();
+	// Samples with an occluding depth closer than cullZ are occlusion culled,
+	// and samples outside [lodMin, lodMax) are culled by the level of detail.
+	TqFloat cullZ = isCullable ? Bound.vecMin().z() : -FLT_MAX;
+	TqFloat lodMin = UsingLevelOfDetail ? LodBounds[0] : -FLT_MAX;
+	TqFloat lodMax = UsingLevelOfDetail ? LodBounds[1] : FLT_MAX;
 
 	// Now go across all pixels touched by the micropolygon bound.
 	// The first pixel position is at (sX, sY), the last one
@@ -1160,52 +1356,58 @@ void CqBucketProcessor::RenderMPG_Static( CqMicroPolygon* pMPG)
 			int end_m = ( iX == ( eX - 1 ) ) ? em : iXSamples;
 			int index_start = n*iXSamples + start_m;
 
+			// Subsamples which pass the cheap rejection tests are gathered
+			// here and hit tested against the micropolygon together.
+			TqFloat batchX[CqMicroPolygon::MaxBatchSamples];
+			TqFloat batchY[CqMicroPolygon::MaxBatchSamples];
+			TqInt batchIndex[CqMicroPolygon::MaxBatchSamples];
+			TqInt batchSize = 0;
+
+			CqImagePixel* pixel = pie2->get();
+			const TqFloat* posX = pixel->samplePosX();
+			const TqFloat* posY = pixel->samplePosY();
+			const TqFloat* detailLevels = pixel->sampleDetailLevels();
+			const TqFloat* occlZ = pixel->sampleOcclZ();
+
 			for ( ; n < end_n; n++ )
 			{
-				int index = index_start;
-				for ( m = start_m; m < end_m; m++, index++ )
+				// The rejection tests are branch free, with candidate samples
+				// appended to the batch by advancing batchSize only when they
+				// pass.  This keeps the loop over the packed sample arrays
+				// tight and unit stride.
+				for ( m = index_start; m < index_start + end_m - start_m; m++ )
 				{
-					SqSampleData const& sampleData = (*pie2)->SampleData( index );
-					const CqVector2D& vecP = sampleData.position;
-					const TqFloat time = 0.0;
-
-					CqStats::IncI( CqStats::SPL_count );
-
-					if(!Bound.Contains2D( vecP ))
-						continue;
-
-					// Occlusion cull the micropoly bound against the current
-					// opaque sample hit.
-					if(isCullable && Bound.vecMin().z() > sampleData.occlZ)
-						continue;
-
-					// Check to see if the sample is within the sample's level of detail
-					if ( UsingLevelOfDetail)
-					{
-						TqFloat LevelOfDetail = sampleData.detailLevel;
-						if ( LodBounds[ 0 ] > LevelOfDetail || LevelOfDetail >= LodBounds[ 1 ] )
-						{
-							continue;
-						}
-					}
-
-					CqStats::IncI( CqStats::SPL_bound_hits );
-
-					// Now check if the subsample hits the micropoly
-					bool SampleHit;
-					TqFloat D;
-					CqVector2D uv;
-
-					SampleHit = pMPG->Sample( hitTestCache, sampleData, D, uv, time );
-
-					if ( SampleHit )
+					TqFloat x = posX[m];
+					TqFloat y = posY[m];
+					TqFloat lod = detailLevels[m];
+					TqInt pass = (x >= bminx) & (x <= bmaxx) & (y >= bminy) & (y <= bmaxy)
+						// Occlusion cull the micropoly bound against the
+						// current opaque sample hit.
+						& (occlZ[m] >= cullZ)
+						// Check to see if the sample is within the sample's
+						// level of detail
+						& (lod >= lodMin) & (lod < lodMax);
+					batchX[batchSize] = x;
+					batchY[batchSize] = y;
+					batchIndex[batchSize] = m;
+					batchSize += pass;
+					if(batchSize == CqMicroPolygon::MaxBatchSamples)
 					{
-						sample_hits++;
-						StoreSample( pMPG, pie2->get(), index, D, uv );
+						boundHits.add(batchSize);
+						sample_hits += SampleBatch_Static(pMPG, hitTestCache,
+								pixel, batchX, batchY, batchIndex, batchSize);
+						batchSize = 0;
 					}
 				}
+				sampleCount.add(end_m - start_m);
 				index_start += iXSamples;
 			}
+			if(batchSize > 0)
+			{
+				boundHits.add(batchSize);
+				sample_hits += SampleBatch_Static(pMPG, hitTestCache, pixel,
+						batchX, batchY, batchIndex, batchSize);
+			}
 			/*
 			// Now compute the % of samples that hit...
 			TqInt scount = iXSamples * iYSamples;
@@ -1217,6 +1419,25 @@ void CqBucketProcessor::RenderMPG_Static( CqMicroPolygon* pMPG)
 	}
 }
 
+TqInt CqBucketProcessor::SampleBatch_Static( CqMicroPolygon* pMPG,
+		CqHitTestCache& hitTestCache, CqImagePixel* pie2, const TqFloat* x,
+		const TqFloat* y, const TqInt* indices, TqInt count )
+{
+	TqFloat D[CqMicroPolygon::MaxBatchSamples];
+	CqVector2D uv[CqMicroPolygon::MaxBatchSamples];
+	TqUint hitMask = pMPG->SampleBatch(hitTestCache, x, y, count, D, uv);
+	TqInt hits = 0;
+	for(TqInt i = 0; hitMask != 0; ++i, hitMask >>= 1)
+	{
+		if(hitMask & 1)
+		{
+			++hits;
+			StoreSample( pMPG, pie2, indices[i], D[i], uv[i] );
+		}
+	}
+	return hits;
+}
+
 // this function assumes that either dof or mb or both are being used.
 void CqBucketProcessor::RenderMPG_MBOrDof( CqMicroPolygon* pMPG, bool IsMoving, bool UsingDof )
 {
@@ -1227,6 +1448,8 @@ void CqBucketProcessor::RenderMPG_MBOrDof( CqMicroPolygon* pMPG, bool IsMoving,
 	bool isCullable = m_CurrentMpgSampleInfo.isCullable;
 
     TqInt sample_hits = 0;
+	CqSampleStatsCounter sampleCount(CqStats::SPL_count);
+	CqSampleStatsCounter boundHits(CqStats::SPL_bound_hits);
 
 	CqHitTestCache hitTestCache;
 	pMPG->CacheHitTestValues(hitTestCache, UsingDof);
@@ -1382,7 +1605,7 @@ void CqBucketProcessor::RenderMPG_MBOrDof( CqMicroPolygon* pMPG, bool IsMoving,
 
 						index++;
 
-						CqStats::IncI( CqStats::SPL_count );
+						sampleCount.inc();
 
 						if(IsMoving && (time < time0 || time > time1))
 						{
@@ -1398,7 +1621,7 @@ void CqBucketProcessor::RenderMPG_MBOrDof( CqMicroPolygon* pMPG, bool IsMoving,
 								continue;
 							// Occlusion cull the micropoly bound against the
 							// current opaque sample hit.
-							if(isCullable && Bound.vecMin().z() > sampleData.occlZ)
+							if(isCullable && Bound.vecMin().z() > (*pie2)->sampleOcclZ()[index])
 								continue;
 
 							// Check to see if the sample is within the sample's level of detail
@@ -1412,7 +1635,7 @@ void CqBucketProcessor::RenderMPG_MBOrDof( CqMicroPolygon* pMPG, bool IsMoving,
 							}
 
 
-							CqStats::IncI( CqStats::SPL_bound_hits );
+							boundHits.inc();
 
 							// Now check if the subsample hits the micropoly
 							bool SampleHit;
@@ -1433,7 +1656,7 @@ void CqBucketProcessor::RenderMPG_MBOrDof( CqMicroPolygon* pMPG, bool IsMoving,
 								continue;
 							// Occlusion cull the micropoly bound against the
 							// current opaque sample hit.
-							if(isCullable && Bound.vecMin().z() > sampleData.occlZ)
+							if(isCullable && Bound.vecMin().z() > (*pie2)->sampleOcclZ()[index])
 								continue;
 
 							// Check to see if the sample is within the sample's level of detail
@@ -1446,7 +1669,7 @@ void CqBucketProcessor::RenderMPG_MBOrDof( CqMicroPolygon* pMPG, bool IsMoving,
 								}
 							}
 
-							CqStats::IncI( CqStats::SPL_bound_hits );
+							boundHits.inc();
 
 							// Now check if the subsample hits the micropoly
 							bool SampleHit;
@@ -1472,14 +1695,15 @@ void CqBucketProcessor::StoreSample( CqMicroPolygon* pMPG, CqImagePixel* pie2, T
 {
 	bool isCullable = m_CurrentMpgSampleInfo.isCullable;
 	SqSampleData& sampleData = pie2->SampleData( index );
-	if(isCullable && sampleData.occlZ <= D)
+	TqFloat& occlZ = pie2->sampleOcclZ()[index];
+	if(isCullable && occlZ <= D)
 	{
 		// If the sample hit is occluded and can be culled then we return early
 		// without storing the hit data at all.
 		return;
 	}
 	// Record the sample hit in the stats.
-	CqStats::IncI( CqStats::SPL_hits );
+	STATS_INC_SAMPLE( SPL_hits );
 	pMPG->MarkHit();
 	// Record the fact that we have valid samples in the bucket.
 	m_hasValidSamples = true;
@@ -1511,8 +1735,8 @@ void CqBucketProcessor::StoreSample( CqMicroPolygon* pMPG, CqImagePixel* pie2, T
 			if(hitPrevZ < D)
 			{
 				// view -->      |          |          |
-				// direc      hitPrevZ      D     sampleData.occlZ
-				sampleData.occlZ = D;
+				// direc      hitPrevZ      D     occlZ
+				occlZ = D;
 				m_OcclusionTree.setSampleDepth(D, sampleData.occlusionIndex);
 				// In this special case, we don't actually have to store the
 				// hit since the depth is greater than the occluding surface,
@@ -1522,14 +1746,14 @@ void CqBucketProcessor::StoreSample( CqMicroPolygon* pMPG, CqImagePixel* pie2, T
 			else
 			{
 				// view -->      |          |          |
-				// direc         D      hitPrevZ    sampleData.occlZ
-				sampleData.occlZ = hitPrevZ;
+				// direc         D      hitPrevZ    occlZ
+				occlZ = hitPrevZ;
 				m_OcclusionTree.setSampleDepth(hitPrevZ, sampleData.occlusionIndex);
 			}
 		}
 		else
 		{
-			sampleData.occlZ = D;
+			occlZ = D;
 			m_OcclusionTree.setSampleDepth(D, sampleData.occlusionIndex);
 		}
 		hit->flags = SqImageSample::Flag_Valid;
@@ -32,6 +32,7 @@
 
 #include	"bucket.h"
 #include	"channelbuffer.h"
+#include	"deepbuffer.h"
 #include	"imagepixel.h"
 #include	"isampler.h"
 #include	"occlusion.h"
@@ -43,6 +44,7 @@ namespace Aqsis {
 class CqSampleIterator;
 class CqRenderer;
 class CqImageBuffer;
+class CqThreadScheduler;
 
 /** \brief Reyes processor for geometry covering a bucket.
  *
@@ -78,12 +80,18 @@ class CqBucketProcessor
 
 		/** Post-process the bucket, which involves the operations
 		 * Combine and Filter
+		 *
+		 * \param scheduler - pool to share the combining and filtering out
+		 *                    over, by bands of rows.  If null it's all done
+		 *                    on the calling thread.
 		 */
-		void postProcess();
+		void postProcess(CqThreadScheduler* scheduler = 0);
 
 		//-------------- Reorganise -------------------------
 		
 		CqChannelBuffer& getChannelBuffer();
+		/// Get the fragment lists of the display region, if they were requested.
+		const CqDeepBuffer& getDeepBuffer() const;
 
 		const SqOptionCache& optCache() const;
 
@@ -104,8 +112,12 @@ class CqBucketProcessor
 
 		void	InitialiseFilterValues();
 		void	CalculateDofBounds();
-		void	CombineElements();
-		void	FilterBucket();
+		struct SqFilterChannels;
+
+		void	CombineElements(CqThreadScheduler* scheduler);
+		void	CombineRows(TqInt yBegin, TqInt yEnd, bool gatherDeep);
+		void	FilterBucket(CqThreadScheduler* scheduler);
+		void	FilterRows(TqInt yBegin, TqInt yEnd, SqFilterChannels& channels);
 		void	ExposeBucket();
 
 		void	buildCacheSegment(SqBucketCacheSegment::EqBucketCacheSide side, boost::shared_ptr<SqBucketCacheSegment>& seg);
@@ -126,6 +138,14 @@ class CqBucketProcessor
 		 * \see CqBucket, CqImagePixel
 		 */
 		void	RenderMicroPoly( CqMicroPolygon* pMP );
+		/** Render the quads of a shaded static grid which touch the bucket,
+		 * directly from the grid data.
+		 */
+		void	RenderGrid( const CqRasterGrid& grid );
+		/** Cache the sampling info shared by all micropolygons of a grid
+		 * in m_CurrentMpgSampleInfo.
+		 */
+		void	CacheGridSampleInfo( CqMicroPolyGridBase* pGrid );
 		/** This function assumes that either dof or mb or
 		 * both are being used. */
 		void	RenderMPG_MBOrDof( CqMicroPolygon* pMP, bool IsMoving, bool UsingDof );
@@ -133,6 +153,14 @@ class CqBucketProcessor
 		 * being used. It is much simpler than the general
 		 * case dealt with above. */
 		void	RenderMPG_Static( CqMicroPolygon* pMPG);
+		/** Hit test a batch of subsamples from one pixel against a static
+		 * micropolygon, storing the hits.
+		 *
+		 * \return The number of samples which hit the micropolygon.
+		 */
+		TqInt	SampleBatch_Static( CqMicroPolygon* pMPG, CqHitTestCache& hitTestCache,
+							CqImagePixel* pie2, const TqFloat* x, const TqFloat* y,
+							const TqInt* indices, TqInt count );
 		void	StoreSample(CqMicroPolygon* pMPG, CqImagePixel* pie2, TqInt index,
 							TqFloat D, const CqVector2D& uv);
 		void	StoreExtraData( CqMicroPolygon* pMPG, TqFloat* hitData);
@@ -177,6 +205,7 @@ class CqBucketProcessor
 		bool	m_hasValidSamples;
 
 		CqChannelBuffer	m_channelBuffer;
+		CqDeepBuffer	m_deepBuffer;
 
 		boost::array<CqRegion, SqBucketCacheSegment::last> m_cacheRegions;
 };
@@ -278,6 +307,11 @@ inline CqChannelBuffer& CqBucketProcessor::getChannelBuffer()
 	return m_channelBuffer;
 }
 
+inline const CqDeepBuffer& CqBucketProcessor::getDeepBuffer() const
+{
+	return m_deepBuffer;
+}
+
 inline const CqBound& CqBucketProcessor::DofSubBound(TqInt index) const
 {
 	assert(index < m_NumDofBounds);
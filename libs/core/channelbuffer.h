@@ -62,6 +62,7 @@ class CqChannelBuffer : public IqChannelBuffer
 		virtual TqInt width() const;
 		virtual TqInt height() const;
 		virtual TqInt getChannelIndex(const std::string& name) const;
+		virtual TqInt elementSize() const;
 		virtual TqConstChannelPtr operator()(TqInt x, TqInt y, TqInt index) const;
 	
 	private:
@@ -155,6 +156,11 @@ inline TqInt CqChannelBuffer::height() const
 	return m_height;
 }
 
+inline TqInt CqChannelBuffer::elementSize() const
+{
+	return m_elementSize;
+}
+
 inline TqInt CqChannelBuffer::indexOffset(TqInt x, TqInt y, TqInt index) const
 {
 	assert(index >= 0 && index < static_cast<TqInt>(m_elementSize));
@@ -30,7 +30,14 @@
 #include	"winsock2.h"
 #endif
 
+#include	<algorithm>
+#include	<cmath>
 #include	<cstring>
+#include	<limits>
+
+#ifdef __SSE2__
+#include	<emmintrin.h>
+#endif
 
 #include	<boost/static_assert.hpp>
 #include	<boost/format.hpp>
@@ -48,6 +55,128 @@
 namespace Aqsis {
 
 
+namespace {
+
+/// Quantization settings for a display, as given to RiQuantize.
+struct SqQuantizer
+{
+	double zero;
+	double one;
+	double minVal;
+	double maxVal;
+	/// True if minVal and maxVal are whole numbers in the range of an int.
+	bool wholeLimits;
+	SqQuantizer(double zero, double one, double minVal, double maxVal)
+		: zero(zero), one(one), minVal(minVal), maxVal(maxVal),
+		wholeLimits(minVal == std::floor(minVal) && maxVal == std::floor(maxVal)
+				&& minVal >= std::numeric_limits<TqInt>::min()
+				&& maxVal <= std::numeric_limits<TqInt>::max())
+	{ }
+};
+
+/// Convert a channel value to the type expected by the display.
+template<typename T>
+inline T toDisplayType(double value)
+{
+	return static_cast<T>(value);
+}
+
+/** \note: We need to do this extra clamp as the quantisation values are stored
+    single precision floats, as mandated by the spec.,
+    but single precision floats cannot accurately represent the maximum
+    PtDspyUnsigned32 value of 4294967295. Doing this ensures that the
+    PtDspyUnsigned32 value is clamped before being cast, and the clamp is
+    performed in double precision math to retain accuracy.
+*/
+template<>
+inline PtDspyUnsigned32 toDisplayType<PtDspyUnsigned32>(double value)
+{
+	return static_cast<PtDspyUnsigned32>( clamp<double>(value, 0,
+				std::numeric_limits<PtDspyUnsigned32>::max()) );
+}
+
+template<>
+inline PtDspySigned32 toDisplayType<PtDspySigned32>(double value)
+{
+	return static_cast<PtDspySigned32>( clamp<double>(value,
+				std::numeric_limits<PtDspySigned32>::min(),
+				std::numeric_limits<PtDspySigned32>::max()) );
+}
+
+/** \brief Convert one channel of a bucket into interleaved display data.
+ *
+ * \param src - first value of the channel in the channel buffer
+ * \param srcStride - distance between values of successive pixels in src
+ * \param numPixels - number of pixels to convert
+ * \param dest - location of the channel for the first pixel in the display data
+ * \param destStride - size in bytes of one pixel of display data
+ * \param quantizer - quantization settings, or null for no quantization
+ * \param dither - per pixel dither amounts, or null for no dithering
+ */
+template<typename T>
+void formatChannel(const TqFloat* src, TqInt srcStride, TqInt numPixels,
+		unsigned char* dest, TqInt destStride, const SqQuantizer* quantizer,
+		const TqFloat* dither)
+{
+	if(!quantizer)
+	{
+		for(TqInt i = 0; i < numPixels; ++i, src += srcStride, dest += destStride)
+			*reinterpret_cast<T*>(dest) = toDisplayType<T>(*src);
+		return;
+	}
+	double scale = quantizer->one - quantizer->zero;
+	TqInt i = 0;
+#ifdef __SSE2__
+	if(quantizer->wholeLimits)
+	{
+		// Quantize two values at a time.  Clamping before rounding gives the
+		// same result as clamping afterward since the limits are whole
+		// numbers, and keeps the values in range of the integer conversion.
+		// lround() is then done by truncating, and stepping away from zero
+		// when the part truncated is at least a half.
+		const __m128d zero2 = _mm_set1_pd(quantizer->zero);
+		const __m128d scale2 = _mm_set1_pd(scale);
+		const __m128d minVal2 = _mm_set1_pd(quantizer->minVal);
+		const __m128d maxVal2 = _mm_set1_pd(quantizer->maxVal);
+		const __m128d one2 = _mm_set1_pd(1);
+		const __m128d half2 = _mm_set1_pd(0.5);
+		const __m128d minusHalf2 = _mm_set1_pd(-0.5);
+		for(; i + 2 <= numPixels; i += 2, src += 2*srcStride, dest += 2*destStride)
+		{
+			__m128d value = _mm_add_pd(zero2,
+					_mm_mul_pd(_mm_setr_pd(src[0], src[srcStride]), scale2));
+			if(dither)
+				value = _mm_add_pd(value, _mm_setr_pd(dither[i], dither[i+1]));
+			// NaNs are clamped to minVal, as lround() followed by clamp() does.
+			value = _mm_min_pd(_mm_max_pd(value, minVal2), maxVal2);
+			__m128d truncated = _mm_cvtepi32_pd(_mm_cvttpd_epi32(value));
+			__m128d remainder = _mm_sub_pd(value, truncated);
+			__m128d rounded = _mm_add_pd(truncated, _mm_sub_pd(
+						_mm_and_pd(_mm_cmpge_pd(remainder, half2), one2),
+						_mm_and_pd(_mm_cmple_pd(remainder, minusHalf2), one2)));
+			double values[2];
+			_mm_storeu_pd(values, rounded);
+			*reinterpret_cast<T*>(dest) = toDisplayType<T>(values[0]);
+			*reinterpret_cast<T*>(dest + destStride) = toDisplayType<T>(values[1]);
+		}
+	}
+#endif
+	for(; i < numPixels; ++i, src += srcStride, dest += destStride)
+	{
+		double value = quantizer->zero + *src * scale;
+		if(dither)
+			value += dither[i];
+		// Clamp loosely before rounding too, since lround() is undefined
+		// outside the range of a long.
+		value = clamp<double>(value, quantizer->minVal - 1, quantizer->maxVal + 1);
+		value = clamp<double>(lround(value), quantizer->minVal, quantizer->maxVal);
+		*reinterpret_cast<T*>(dest) = toDisplayType<T>(value);
+	}
+}
+
+} // unnamed namespace
+
+
 /// Required function that implements Class Factory design pattern for DDManager libraries
 IqDDManager* CreateDisplayDriverManager()
 {
@@ -68,11 +197,11 @@ TqInt CqDDManager::AddDisplay( const TqChar* name, const TqChar* type, const TqC
 	/// \todo The shared_ptr should be declared before the if-else block and initialized inside,
 	// then the last 2 lines in the if-else blocks should follow afterward. I couldn't figure out
 	// how to declare the boost pointer separately from its initialization.
-	//if (std::string(type) == "dsm")
-	if (false)  // Removed until DSM is integrated after aqsis-1.4
+	if (std::string(type) == "deepexr")
 	{
+		// Deep data is never quantized.
 		boost::shared_ptr<CqDisplayRequest> req(new CqDeepDisplayRequest(false, name, type, mode, CqString::hash( mode ), modeID,
-		                                        dataOffset,	dataSize, 0.0f, 255.0f, 0.0f, 0.0f, 0.0f, false, false));
+		                                        dataOffset,	dataSize, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, true, true));
 		// Create the array of UserParameter structures for all the unrecognised extra parameters,
 		// while extracting information for the recognised ones.
 		req->PrepareCustomParameters(mapOfArguments);
@@ -143,7 +272,7 @@ TqInt CqDDManager::CloseDisplays()
 	return ( 0 );
 }
 
-TqInt CqDDManager::DisplayBucket( const CqRegion& DRegion, const IqChannelBuffer* pBuffer )
+TqInt CqDDManager::DisplayBucket( const CqRegion& DRegion, const IqChannelBuffer* pBuffer, const IqDeepBuffer* pDeepBuffer )
 {
 	static CqRandom random( 61 );
 
@@ -164,7 +293,7 @@ TqInt CqDDManager::DisplayBucket( const CqRegion& DRegion, const IqChannelBuffer
 	std::vector< boost::shared_ptr<CqDisplayRequest> >::iterator i;
 	for ( i = m_displayRequests.begin(); i != m_displayRequests.end(); ++i )
 	{
-		(*i)->DisplayBucket(DRegion, pBuffer);
+		(*i)->DisplayBucket(DRegion, pBuffer, pDeepBuffer);
 	}
 	return ( 0 );
 
@@ -194,6 +323,17 @@ bool CqDDManager::fDisplayNeeds( const TqChar* var )
 	return ( false);
 }
 
+bool CqDDManager::fDisplayNeedsDeepData()
+{
+	std::vector< boost::shared_ptr<CqDisplayRequest> >::iterator i;
+	for (i = m_displayRequests.begin(); i!= m_displayRequests.end(); ++i)
+	{
+		if ( (*i)->ThisDisplayNeedsDeepData() )
+			return true;
+	}
+	return false;
+}
+
 TqInt CqDDManager::Uses()
 {
 	if (m_Uses) return m_Uses;
@@ -420,8 +560,12 @@ void CqDisplayRequest::LoadDisplayLibrary( SqDDMemberData& ddMemberData, CqSimpl
 	}
 
 	// Nullified the data part
-	m_DataRow = 0;
 	m_DataBucket = 0;
+	// Displays cover the crop window, so bands start at its top.
+	m_scanlineBands.reset(CqRegion(QGetRenderContext()->cropWindowXMin(),
+				QGetRenderContext()->cropWindowYMin(),
+				QGetRenderContext()->cropWindowXMin() + m_width,
+				QGetRenderContext()->cropWindowYMin() + m_height));
 
 	if ( NULL != m_OpenMethod )
 	{
@@ -591,6 +735,16 @@ void CqDisplayRequest::LoadDisplayLibrary( SqDDMemberData& ddMemberData, CqSimpl
 			CloseDisplayLibrary();
 			return;
 		}
+		else if ( ((m_flags.flags & PkDspyFlagsWantsDeepData) != 0) != ThisDisplayNeedsDeepData() )
+		{
+			// Deep and flat pixels have different layouts, so the display
+			// must agree with the request about which it takes.
+			Aqsis::log() << error << "Cannot open display \"" << m_name << "\" : "
+				<< ( ThisDisplayNeedsDeepData() ? "Display doesn't take deep data" : "Display only takes deep data" )
+				<< std::endl;
+			CloseDisplayLibrary();
+			return;
+		}
 		else
 			m_valid = true;
 
@@ -598,12 +752,21 @@ void CqDisplayRequest::LoadDisplayLibrary( SqDDMemberData& ddMemberData, CqSimpl
 		// order, we use the name and the m_bufferMap to map back to the data in the
 		// ChannelBuffer when passing the data to the display.
 
-		// Determine how big each pixel is by summing the format type sizes.
+		// Determine how big each pixel is by summing the format type sizes,
+		// and record where each format comes from in the channel buffer so
+		// that the lookup isn't done for every bucket.
 		m_elementSize = 0;
+		m_formatPlan.clear();
 		std::vector<PtDspyDevFormat>::iterator iformat;
 		for (iformat = m_formats.begin(); iformat != m_formats.end(); iformat++)
 		{
 			TqInt type = iformat->type & PkDspyMaskType;
+			SqFormatPlanEntry entry;
+			entry.bufferChannel = m_bufferMap[iformat->name].first;
+			entry.channelOffset = m_bufferMap[iformat->name].second;
+			entry.type = type;
+			entry.dataOffset = m_elementSize;
+			m_formatPlan.push_back(entry);
 			switch ( type )
 			{
 				case PkDspyFloat32:
@@ -638,6 +801,11 @@ void CqDisplayRequest::LoadDisplayLibrary( SqDDMemberData& ddMemberData, CqSimpl
 
 void CqDisplayRequest::CloseDisplayLibrary()
 {
+	// Flush out any complete bands which were held back waiting for
+	// earlier ones.
+	if ( m_DataMethod )
+		SendCompletedBands(true);
+
 	// Call the DspyImageClose method on the display to shut things down.
 	// If there is a delayed close method, call it in preference.
 	if ( m_DelayCloseMethod)
@@ -650,11 +818,7 @@ void CqDisplayRequest::CloseDisplayLibrary()
 		delete [] m_DataBucket;
 		m_DataBucket = 0;
 	}
-	if (m_DataRow != 0)
-	{
-		delete [] m_DataRow;
-		m_DataRow = 0;
-	}
+	m_scanlineBands.clear();
 
 	// Empty out the display request data
 	m_CloseMethod = NULL;
@@ -981,7 +1145,7 @@ void CqDisplayRequest::PrepareSystemParameters()
 	m_customParams.push_back(parameter);
 }
 
-void CqDisplayRequest::DisplayBucket( const CqRegion& DRegion, const IqChannelBuffer* pBuffer )
+void CqDisplayRequest::DisplayBucket( const CqRegion& DRegion, const IqChannelBuffer* pBuffer, const IqDeepBuffer* pDeepBuffer )
 {
 	// If the display is not validated, don't send it data.
 	// Or if a DspyImageData function was not found for
@@ -998,7 +1162,7 @@ void CqDisplayRequest::DisplayBucket( const CqRegion& DRegion, const IqChannelBu
 	// Dispatch to display sub-type methods
 	// Copy relevant data from the bucket and store locally,
 	// while quantizing and/or compressing
-	FormatBucketForDisplay( DRegion, pBuffer );
+	FormatBucketForDisplay( DRegion, pBuffer, pDeepBuffer );
 	// Now that the bucket data has been constructed, send it to the display
 	// either lines by lines or bucket by bucket.
 	// Check if the display needs scanlines, and if so, accumulate bucket data
@@ -1008,7 +1172,7 @@ void CqDisplayRequest::DisplayBucket( const CqRegion& DRegion, const IqChannelBu
 		if (CollapseBucketsToScanlines( DRegion ))
 		{
 			// Filled a scan line: time to send complete rows to display
-			SendToDisplay(ymin, ymaxplus1);
+			SendCompletedBands();
 		}
 	}
 	else
@@ -1019,164 +1183,341 @@ void CqDisplayRequest::DisplayBucket( const CqRegion& DRegion, const IqChannelBu
 
 }
 
-void CqDisplayRequest::FormatBucketForDisplay( const CqRegion& DRegion, const IqChannelBuffer* pBuffer )
+void CqDisplayRequest::FormatBucketForDisplay( const CqRegion& DRegion, const IqChannelBuffer* pBuffer, const IqDeepBuffer* /*pDeepBuffer*/ )
 {
 	static CqRandom random( 61 );
 
 	if (m_DataBucket == 0)
 		m_DataBucket = new unsigned char[m_elementSize * static_cast<int>(DRegion.area())];
-	if ((m_flags.flags & PkDspyFlagsWantsScanLineOrder) && m_DataRow == 0)
-	{
-		m_DataRow = new unsigned char[m_elementSize * m_width * m_height];
-	}
 
-	// Fill in the bucket data for each channel in each element, honoring the requested order and formats.
-	unsigned char* pdata = m_DataBucket;
+	// The channel buffer holds the pixels of the bucket contiguously, so each
+	// display channel can be converted with a single strided loop.
+	TqInt numPixels = pBuffer->width() * pBuffer->height();
+	if(numPixels == 0)
+		return;
+	TqInt srcStride = pBuffer->elementSize();
 
-	std::vector<std::pair<TqInt, TqInt> > offsets;
-	std::vector<PtDspyDevFormat>::iterator iformat;
-	// Get and cache the offsets, so that the lookup isn't done for every pixel.
-	for (iformat = m_formats.begin(); iformat != m_formats.end(); ++iformat)
+	SqQuantizer quantizer(m_QuantizeZeroVal, m_QuantizeOneVal,
+			m_QuantizeMinVal, m_QuantizeMaxVal);
+	const SqQuantizer* pQuantizer = 0;
+	const TqFloat* dither = 0;
+	if ( m_QuantizeOneVal != 0 )
 	{
-		std::string bufferChannelName = m_bufferMap[iformat->name].first;
-		TqInt offset = m_bufferMap[iformat->name].second;
-		offsets.push_back(std::make_pair(pBuffer->getChannelIndex(bufferChannelName), offset));
+		pQuantizer = &quantizer;
+		if ( m_QuantizeDitherVal != 0 )
+		{
+			// One dither value per pixel, shared between the channels.
+			m_ditherValues.resize(numPixels);
+			for (TqInt i = 0; i < numPixels; ++i)
+				m_ditherValues[i] = m_QuantizeDitherVal * random.RandomFloat();
+			dither = &m_ditherValues[0];
+		}
 	}
 
-	for ( TqInt y = 0, endy = pBuffer->height(); y < endy; ++y )
+	// Fill in the bucket data for each channel in each element, honoring the requested order and formats.
+	for (std::vector<SqFormatPlanEntry>::const_iterator entry = m_formatPlan.begin();
+			entry != m_formatPlan.end(); ++entry)
 	{
-		for ( TqInt x = 0, endx = pBuffer->width(); x < endx; ++x )
+		const TqFloat* src = (*pBuffer)(0, 0, pBuffer->getChannelIndex(entry->bufferChannel))
+			+ entry->channelOffset;
+		unsigned char* dest = m_DataBucket + entry->dataOffset;
+		switch (entry->type)
 		{
-			double s = random.RandomFloat();
-			TqInt index = 0;
-			for (iformat = m_formats.begin(); iformat != m_formats.end(); ++iformat, ++index)
-			{
-				// NOTE: This needs to be optimised, the lookup is expensive.
-				std::string bufferChannelName = m_bufferMap[iformat->name].first;
-				double value = 0.0;
-				try
-				{
-					value = (*pBuffer)(x, y, offsets[index].first)[offsets[index].second];
-				}
-				catch(std::string v)
-				{
-					std::cout << "Invalid channel name " << iformat->name << std::endl;
-				}
-				if ( m_QuantizeOneVal != 0 )
-				{
-					// Perform the quantization
-					value = lround(m_QuantizeZeroVal + value * (m_QuantizeOneVal - m_QuantizeZeroVal) + ( m_QuantizeDitherVal * s ) );
-					value = clamp<double>(value, m_QuantizeMinVal, m_QuantizeMaxVal) ;
-				}
-				TqInt type = iformat->type & PkDspyMaskType;
-				switch (type)
-				{
-					case PkDspyFloat32:
-						reinterpret_cast<PtDspyFloat32*>(pdata)[0] = value;
-						pdata += sizeof(PtDspyFloat32);
-						break;
-					case PkDspyUnsigned32:
-						/** \note: We need to do this extra clamp as the quantisation values are stored
-						    single precision floats, as mandated by the spec.,
-						    but single precision floats cannot accurately represent the maximum
-						    PtDspyUnsigned32 value of 4294967295. Doing this ensures that the
-						    PtDspyUnsigned32 value is clamped before being cast, and the clamp is
-						    performed in double precision math to retain accuracy.
-						*/
-						value = clamp<double>(value, 0,
-								std::numeric_limits<PtDspyUnsigned32>::max());
-						reinterpret_cast<PtDspyUnsigned32*>(pdata)[0] = static_cast<PtDspyUnsigned32>( value );
-						pdata += sizeof(PtDspyUnsigned32);
-						break;
-					case PkDspySigned32:
-						value = clamp<double>(value,
-								std::numeric_limits<PtDspySigned32>::min(),
-								std::numeric_limits<PtDspySigned32>::max());
-						reinterpret_cast<PtDspySigned32*>(pdata)[0] = static_cast<PtDspySigned32>( value );
-						pdata += sizeof(PtDspySigned32);
-						break;
-					case PkDspyUnsigned16:
-						reinterpret_cast<PtDspyUnsigned16*>(pdata)[0] = static_cast<PtDspyUnsigned16>( value );
-						pdata += sizeof(PtDspyUnsigned16);
-						break;
-					case PkDspySigned16:
-						reinterpret_cast<PtDspySigned16*>(pdata)[0] = static_cast<PtDspySigned16>( value );
-						pdata += sizeof(PtDspySigned16);
-						break;
-					case PkDspyUnsigned8:
-						reinterpret_cast<PtDspyUnsigned8*>(pdata)[0] = static_cast<PtDspyUnsigned8>( value );
-						pdata += sizeof(PtDspyUnsigned8);
-						break;
-					case PkDspySigned8:
-						reinterpret_cast<PtDspySigned8*>(pdata)[0] = static_cast<PtDspySigned8>( value );
-						pdata += sizeof(PtDspySigned8);
-						break;
-				}
-			}
+			case PkDspyFloat32:
+				formatChannel<PtDspyFloat32>(src, srcStride, numPixels, dest, m_elementSize, pQuantizer, dither);
+				break;
+			case PkDspyUnsigned32:
+				formatChannel<PtDspyUnsigned32>(src, srcStride, numPixels, dest, m_elementSize, pQuantizer, dither);
+				break;
+			case PkDspySigned32:
+				formatChannel<PtDspySigned32>(src, srcStride, numPixels, dest, m_elementSize, pQuantizer, dither);
+				break;
+			case PkDspyUnsigned16:
+				formatChannel<PtDspyUnsigned16>(src, srcStride, numPixels, dest, m_elementSize, pQuantizer, dither);
+				break;
+			case PkDspySigned16:
+				formatChannel<PtDspySigned16>(src, srcStride, numPixels, dest, m_elementSize, pQuantizer, dither);
+				break;
+			case PkDspyUnsigned8:
+				formatChannel<PtDspyUnsigned8>(src, srcStride, numPixels, dest, m_elementSize, pQuantizer, dither);
+				break;
+			case PkDspySigned8:
+				formatChannel<PtDspySigned8>(src, srcStride, numPixels, dest, m_elementSize, pQuantizer, dither);
+				break;
 		}
 	}
 }
 
 
-void CqDeepDisplayRequest::FormatBucketForDisplay( const CqRegion& DRegion, const IqChannelBuffer* pBuffer )
-{
-
-}
-
 //-----------------------------------------------------------------------------
 // Return true if a scanline of buckets has been accumulated, false otherwise.
 //-----------------------------------------------------------------------------
 bool CqDisplayRequest::CollapseBucketsToScanlines( const CqRegion& DRegion )
 {
+	return m_scanlineBands.addBucket(DRegion, m_DataBucket, m_elementSize);
+}
 
-	unsigned char* pdata = m_DataBucket;
-	TqInt	xmin = DRegion.xMin();
-	TqInt	ymin = DRegion.yMin();
-	TqInt	xmaxplus1 = DRegion.xMax();
-	TqInt	ymaxplus1 = DRegion.yMax();
-	TqInt x, y;
+void CqDisplayRequest::SendToDisplay(TqInt ymin, TqInt ymaxplus1)
+{
+	//Aqsis::log() << debug << "CqDisplayRequest::SendToDisplay()" << std::endl;
+	const unsigned char* pdata = m_scanlineBands.firstBandData();
+	if (!pdata)
+		return;
+	PtDspyError err;
 
-	for (y = ymin; y < ymaxplus1; y++)
+	// send to the display one line at a time.  Scanline order displays
+	// expect columns relative to the crop window.
+	for (TqInt y = ymin; y < ymaxplus1; y++)
 	{
-		for (x = xmin; x < xmaxplus1; x++)
-		{
-			memcpy(&(m_DataRow[m_width * m_elementSize * (y - ymin) + m_elementSize * x]), pdata, m_elementSize);
-			pdata += m_elementSize;
-		}
+		err = (m_DataMethod)(m_imageHandle, 0, m_width, y, y+1, m_elementSize, pdata);
+		pdata += m_elementSize * m_width;
 	}
+}
 
-	if (xmaxplus1 >= m_width)
+void CqDisplayRequest::SendCompletedBands(bool skipGaps)
+{
+	TqInt ymin = 0;
+	TqInt ymaxplus1 = 0;
+	while (m_scanlineBands.firstBand(skipGaps, ymin, ymaxplus1))
 	{
-		// Filled a scan line
 		Aqsis::log() << debug << "filled a scanline" << std::endl;
-		return true;
+		SendToDisplay(ymin, ymaxplus1);
+		m_scanlineBands.popFirstBand();
 	}
-	return false;
 }
 
-bool CqDeepDisplayRequest::CollapseBucketsToScanlines( const CqRegion& DRegion )
+//-----------------------------------------------------------------------------
+// CqDeepDisplayRequest
+
+namespace {
+
+/// Fragment values which can be sent to a deep display.
+enum EqDeepField
 {
-	return false;
+	DeepField_None,
+	DeepField_Red,
+	DeepField_Green,
+	DeepField_Blue,
+	DeepField_ORed,
+	DeepField_OGreen,
+	DeepField_OBlue,
+	DeepField_Alpha,
+	DeepField_Depth
+};
+
+/// Work out which fragment value fills a channel from the channel buffer.
+EqDeepField deepFieldForChannel(const std::string& channel, TqInt offset)
+{
+	if (channel == "Ci" && offset < 3)
+		return static_cast<EqDeepField>(DeepField_Red + offset);
+	else if (channel == "Oi" && offset < 3)
+		return static_cast<EqDeepField>(DeepField_ORed + offset);
+	else if (channel == "a")
+		return DeepField_Alpha;
+	else if (channel == "z")
+		return DeepField_Depth;
+	return DeepField_None;
 }
 
-void CqDisplayRequest::SendToDisplay(TqInt ymin, TqInt ymaxplus1)
+inline TqFloat deepFieldValue(const SqDeepFragment& frag, TqInt field)
 {
-	//Aqsis::log() << debug << "CqDisplayRequest::SendToDisplay()" << std::endl;
-	TqInt y;
-	PtDspyError err;
-	unsigned char* pdata = m_DataRow;
+	switch (field)
+	{
+		case DeepField_Red:
+		case DeepField_Green:
+		case DeepField_Blue:
+			return frag.color[field - DeepField_Red];
+		case DeepField_ORed:
+		case DeepField_OGreen:
+		case DeepField_OBlue:
+			return frag.opacity[field - DeepField_ORed];
+		case DeepField_Alpha:
+			return (frag.opacity[0] + frag.opacity[1] + frag.opacity[2]) / 3.0f;
+		case DeepField_Depth:
+			return frag.depth;
+		default:
+			return 0;
+	}
+}
 
-	// send to the display one line at a time
-	for (y = ymin; y < ymaxplus1; y++)
+/// Order buckets along a row.
+struct SqDeepBucketXLess
+{
+	template<typename T>
+	bool operator()(const T& a, const T& b) const
 	{
-		err = (m_DataMethod)(m_imageHandle, 0, m_width, y, y+1, m_elementSize, pdata);
-		pdata += m_elementSize * m_width;
+		return a.xmin < b.xmin;
+	}
+};
+
+} // unnamed namespace
+
+bool CqDeepDisplayRequest::ThisDisplayNeedsDeepData() const
+{
+	return true;
+}
+
+void CqDeepDisplayRequest::DisplayBucket( const CqRegion& DRegion, const IqChannelBuffer* pBuffer, const IqDeepBuffer* pDeepBuffer )
+{
+	if ( !m_valid || !m_DataMethod )
+		return;
+
+	FormatBucketForDisplay( DRegion, pBuffer, pDeepBuffer );
+	if (m_flags.flags & PkDspyFlagsWantsScanLineOrder)
+	{
+		if (CollapseBucketsToScanlines( DRegion ))
+			SendCompletedBands();
+	}
+	else
+	{
+		SendDeepData(DRegion.xMin(), DRegion.xMax(), DRegion.yMin(), DRegion.yMax(),
+				m_deepBucket.counts, m_deepBucket.values);
 	}
 }
 
+void CqDeepDisplayRequest::FormatBucketForDisplay( const CqRegion& DRegion, const IqChannelBuffer* pBuffer, const IqDeepBuffer* pDeepBuffer )
+{
+	// Work out where each format comes from the first time through.
+	if (m_deepFields.size() != m_formatPlan.size())
+	{
+		m_deepFields.clear();
+		for (std::vector<SqFormatPlanEntry>::const_iterator entry = m_formatPlan.begin();
+				entry != m_formatPlan.end(); ++entry)
+		{
+			EqDeepField field = deepFieldForChannel(entry->bufferChannel, entry->channelOffset);
+			if (field == DeepField_None)
+				Aqsis::log() << warning << "Deep display \"" << m_name << "\" can't output \""
+					<< entry->bufferChannel << "\", sending zero" << std::endl;
+			m_deepFields.push_back(field);
+		}
+	}
+
+	m_deepBucket.xmin = DRegion.xMin();
+	m_deepBucket.xmaxplus1 = DRegion.xMax();
+	m_deepBucket.counts.clear();
+	m_deepBucket.values.clear();
+	if (!pDeepBuffer || pDeepBuffer->width() != DRegion.width()
+		|| pDeepBuffer->height() != DRegion.height())
+	{
+		m_deepBucket.counts.resize(DRegion.area(), 0);
+		return;
+	}
+
+	TqInt numFields = m_deepFields.size();
+	m_deepBucket.counts.reserve(DRegion.area());
+	for (TqInt y = 0; y < DRegion.height(); ++y)
+	{
+		for (TqInt x = 0; x < DRegion.width(); ++x)
+		{
+			TqInt numFragments = pDeepBuffer->numFragments(x, y);
+			const SqDeepFragment* frags = pDeepBuffer->fragments(x, y);
+			m_deepBucket.counts.push_back(numFragments);
+			for (TqInt i = 0; i < numFragments; ++i)
+			{
+				for (TqInt j = 0; j < numFields; ++j)
+					m_deepBucket.values.push_back(deepFieldValue(frags[i], m_deepFields[j]));
+			}
+		}
+	}
+}
+
+bool CqDeepDisplayRequest::CollapseBucketsToScanlines( const CqRegion& DRegion )
+{
+	// The length of a band's data isn't known until it's complete, so the
+	// packed buckets are kept, cut down to the crop window, and interleaved
+	// when sent.
+	CqRegion region = m_scanlineBands.clip(DRegion);
+	if (region.width() > 0 && region.height() > 0)
+	{
+		std::vector<SqDeepBucket>& buckets = m_deepBands[region.yMin()];
+		buckets.push_back(SqDeepBucket());
+		SqDeepBucket& bucket = buckets.back();
+		bucket.xmin = region.xMin();
+		bucket.xmaxplus1 = region.xMax();
+		if (region.area() == DRegion.area())
+		{
+			bucket.counts.swap(m_deepBucket.counts);
+			bucket.values.swap(m_deepBucket.values);
+		}
+		else
+		{
+			TqInt numFields = m_deepFields.size();
+			bucket.counts.reserve(region.area());
+			std::vector<PtDspyFloat32>::const_iterator values = m_deepBucket.values.begin();
+			for (TqInt y = DRegion.yMin(); y < DRegion.yMax(); ++y)
+			{
+				for (TqInt x = DRegion.xMin(); x < DRegion.xMax(); ++x)
+				{
+					PtDspyUnsigned32 count = m_deepBucket.counts[
+						(y - DRegion.yMin()) * DRegion.width() + x - DRegion.xMin()];
+					TqInt numValues = count * numFields;
+					if (y >= region.yMin() && y < region.yMax()
+						&& x >= region.xMin() && x < region.xMax())
+					{
+						bucket.counts.push_back(count);
+						bucket.values.insert(bucket.values.end(), values, values + numValues);
+					}
+					values += numValues;
+				}
+			}
+		}
+	}
+	return m_scanlineBands.addBucket(DRegion, 0, 0);
+}
+
 void CqDeepDisplayRequest::SendToDisplay(TqInt ymin, TqInt ymaxplus1)
 {
+	std::map<TqInt, std::vector<SqDeepBucket> >::iterator iband = m_deepBands.find(ymin);
+	if (iband == m_deepBands.end())
+		return;
+	// Columns are sent relative to the crop window.
+	TqInt cropXMin = m_scanlineBands.crop().xMin();
+	std::vector<SqDeepBucket>& buckets = iband->second;
+	std::sort(buckets.begin(), buckets.end(), SqDeepBucketXLess());
+
+	// Where each bucket is up to in its values.
+	std::vector<TqInt> valuePos(buckets.size(), 0);
+	TqInt numFields = m_deepFields.size();
+	for (TqInt y = ymin; y < ymaxplus1; ++y)
+	{
+		// Interleave the rows of the buckets into a full scanline.  Any
+		// pixels outside the buckets (eg, outside the crop window) are
+		// left empty.
+		m_sendCounts.assign(m_width, 0);
+		m_sendValues.clear();
+		for (TqInt b = 0, numBuckets = buckets.size(); b < numBuckets; ++b)
+		{
+			const SqDeepBucket& bucket = buckets[b];
+			TqInt bucketWidth = bucket.xmaxplus1 - bucket.xmin;
+			const PtDspyUnsigned32* counts = &bucket.counts[(y - ymin) * bucketWidth];
+			TqInt numValues = 0;
+			for (TqInt x = 0; x < bucketWidth; ++x)
+			{
+				m_sendCounts[bucket.xmin - cropXMin + x] = counts[x];
+				numValues += counts[x] * numFields;
+			}
+			m_sendValues.insert(m_sendValues.end(), bucket.values.begin() + valuePos[b],
+					bucket.values.begin() + valuePos[b] + numValues);
+			valuePos[b] += numValues;
+		}
+		SendDeepData(0, m_width, y, y+1, m_sendCounts, m_sendValues);
+	}
+	m_deepBands.erase(iband);
+}
 
+void CqDeepDisplayRequest::SendDeepData(TqInt xmin, TqInt xmaxplus1, TqInt ymin, TqInt ymaxplus1,
+		const std::vector<PtDspyUnsigned32>& counts, const std::vector<PtDspyFloat32>& values)
+{
+	TqInt countsSize = counts.size() * sizeof(PtDspyUnsigned32);
+	TqInt valuesSize = values.size() * sizeof(PtDspyFloat32);
+	m_sendData.resize(countsSize + valuesSize);
+	if (countsSize > 0)
+		memcpy(&m_sendData[0], &counts[0], countsSize);
+	if (valuesSize > 0)
+		memcpy(&m_sendData[countsSize], &values[0], valuesSize);
+	(m_DataMethod)(m_imageHandle, xmin, xmaxplus1, ymin, ymaxplus1,
+			m_deepFields.size() * sizeof(PtDspyFloat32),
+			m_sendData.empty() ? 0 : &m_sendData[0]);
 }
 
 bool CqDisplayRequest::ThisDisplayNeeds( const TqUlong& htoken, const TqUlong& rgb, const TqUlong& rgba,
@@ -1205,5 +1546,10 @@ void CqDisplayRequest::ThisDisplayUses( TqInt& Uses )
 
 }
 
+bool CqDisplayRequest::ThisDisplayNeedsDeepData() const
+{
+	return false;
+}
+
 } // namespace Aqsis
 
@@ -33,6 +33,7 @@
 #include	<aqsis/math/matrix.h>
 #include	<aqsis/ri/ri.h>
 #include	"iddmanager.h"
+#include	"scanlinebands.h"
 #include	<aqsis/util/plugins.h>
 #define		DSPY_INTERNAL
 #include	<aqsis/ri/ndspy.h>
@@ -114,6 +115,10 @@ class CqDisplayRequest : public IqDisplayRequest
 		 * by querying this display's mode hash.
 		 */
 		virtual	void ThisDisplayUses( TqInt& Uses );
+		/* Query if this display takes per pixel fragment lists rather than
+		 * flat pixels.
+		 */
+		virtual bool ThisDisplayNeedsDeepData() const;
 
 		void LoadDisplayLibrary( SqDDMemberData& ddMemberData, CqSimplePlugin& dspyPlugin, TqInt dspNo, TqInt width, TqInt height );
 		void CloseDisplayLibrary();
@@ -128,7 +133,7 @@ class CqDisplayRequest : public IqDisplayRequest
 		 * We implement the standard functionality, but allow child classes
 		 * to override.
 		 */
-		virtual void DisplayBucket( const CqRegion& DRegion, const IqChannelBuffer* pBuffer);
+		virtual void DisplayBucket( const CqRegion& DRegion, const IqChannelBuffer* pBuffer, const IqDeepBuffer* pDeepBuffer);
 
 		//----------------------------------------------
 		// Pure virtual functions
@@ -139,7 +144,7 @@ class CqDisplayRequest : public IqDisplayRequest
 		virtual bool isLoaded() const;
 		/* Does quantization, or in the case of DSM does the compression.
 		 */
-		virtual void FormatBucketForDisplay( const CqRegion& DRegion, const IqChannelBuffer* pBuffer);
+		virtual void FormatBucketForDisplay( const CqRegion& DRegion, const IqChannelBuffer* pBuffer, const IqDeepBuffer* pDeepBuffer);
 		/* Collapses a row of buckets into a scanline by copying the
 		 * quantized data into a format readable by the display.
 		 * Used when the display wants scanline order.
@@ -151,6 +156,12 @@ class CqDisplayRequest : public IqDisplayRequest
 		virtual void SendToDisplay(TqInt ymin, TqInt ymaxplus1);
 
 	protected:
+		/* Send completed bands of scanlines to the display in order, and
+		 * recycle their storage.  If skipGaps is true, bands are sent even
+		 * if the bands above them never arrived.
+		 */
+		void SendCompletedBands(bool skipGaps = false);
+
 		bool			m_valid;
 		std::string 	m_name;
 		std::string 	m_type;
@@ -168,6 +179,18 @@ class CqDisplayRequest : public IqDisplayRequest
 		std::vector<PtDspyDevFormat> m_formats;
 		std::map<std::string, std::pair<std::string, TqInt> > m_bufferMap;
 		TqInt			m_elementSize;
+		/// How to fill in one channel of the formatted display data.
+		struct SqFormatPlanEntry
+		{
+			std::string	bufferChannel;	///< Name of the channel in the channel buffer
+			TqInt		channelOffset;	///< Offset of the value within that channel
+			TqInt		type;			///< PkDspy* type expected by the display
+			TqInt		dataOffset;		///< Byte offset of the value within a display element
+		};
+		/// Conversion plan for m_formats, built when the display is loaded.
+		std::vector<SqFormatPlanEntry> m_formatPlan;
+		/// Per pixel dither values for the current bucket.
+		std::vector<TqFloat> m_ditherValues;
 		TqFloat			m_QuantizeZeroVal;
 		TqFloat			m_QuantizeOneVal;
 		TqFloat			m_QuantizeMinVal;
@@ -187,14 +210,20 @@ class CqDisplayRequest : public IqDisplayRequest
 		//  SqFormattedBucketData.
 		//  Specifically, the stuff which deals with holding the data
 		//  which has been copied out of the bucket and quantized:
-		unsigned char  *m_DataRow;    // A row of bucket's data
 		unsigned char  *m_DataBucket; // A bucket's data
 
+		/// Rows of buckets being collapsed into scanlines.
+		CqScanlineBands m_scanlineBands;
+
 };
 
 //---------------------------------------------------------------------
 /** \class CqDeepDisplayRequest
- * Class representing a DSM display request
+ * Class representing a deep display request.
+ *
+ * Rather than flat pixels, the display is sent the depth sorted fragment
+ * list of each pixel, in the layout described for PkDspyFlagsWantsDeepData.
+ * Values are always sent unquantized.
  */
 class CqDeepDisplayRequest : virtual public CqDisplayRequest
 {
@@ -211,11 +240,13 @@ class CqDeepDisplayRequest : virtual public CqDisplayRequest
 				                 quantizeMinVal, quantizeMaxVal, quantizeDitherVal, quantizeSpecified, quantizeDitherSpecified)
 		{}
 
-		/* Does quantization, or in the case of DSM does the compression.
+		virtual bool ThisDisplayNeedsDeepData() const;
+		virtual void DisplayBucket( const CqRegion& DRegion, const IqChannelBuffer* pBuffer, const IqDeepBuffer* pDeepBuffer);
+		/* Packs the fragments of the bucket's pixels.
 		 */
-		virtual void FormatBucketForDisplay( const CqRegion& DRegion, const IqChannelBuffer* pBuffer);
-		/* Collapses a row of buckets into a scanline by copying the
-		 * quantized data into a format readable by the display.
+		virtual void FormatBucketForDisplay( const CqRegion& DRegion, const IqChannelBuffer* pBuffer, const IqDeepBuffer* pDeepBuffer);
+		/* Holds on to the packed bucket until the row of buckets it
+		 * belongs to is complete.
 		 * Used when the display wants scanline order.
 		 * Return true if a full row is ready, false otherwise.
 		 */
@@ -226,7 +257,30 @@ class CqDeepDisplayRequest : virtual public CqDisplayRequest
 		virtual void SendToDisplay(TqInt ymin, TqInt ymaxplus1);
 
 	private:
+		/// The packed fragments of a bucket.
+		struct SqDeepBucket
+		{
+			TqInt xmin;			///< First column of the bucket
+			TqInt xmaxplus1;	///< One past the last column of the bucket
+			std::vector<PtDspyUnsigned32> counts;	///< Number of fragments in each pixel
+			std::vector<PtDspyFloat32> values;		///< Fragment values, a run of m_deepFields.size() per fragment
+		};
 
+		/* Send the packed pixels of a region to the display.
+		 */
+		void SendDeepData(TqInt xmin, TqInt xmaxplus1, TqInt ymin, TqInt ymaxplus1,
+				const std::vector<PtDspyUnsigned32>& counts, const std::vector<PtDspyFloat32>& values);
+
+		/// The fragment value to send for each format, in order.
+		std::vector<TqInt> m_deepFields;
+		/// The bucket being displayed.
+		SqDeepBucket m_deepBucket;
+		/// Buckets of the bands not yet sent, keyed on the band's first scanline.
+		std::map<TqInt, std::vector<SqDeepBucket> > m_deepBands;
+		/// Scratch space for the pixels being sent.
+		std::vector<PtDspyUnsigned32> m_sendCounts;
+		std::vector<PtDspyFloat32> m_sendValues;
+		std::vector<unsigned char> m_sendData;
 };
 
 //---------------------------------------------------------------------
@@ -260,8 +314,9 @@ class CqDDManager : public IqDDManager
 		virtual	TqInt	ClearDisplays();
 		virtual	TqInt	OpenDisplays(TqInt width, TqInt height);
 		virtual	TqInt	CloseDisplays();
-		virtual	TqInt	DisplayBucket( const CqRegion& DRegion, const IqChannelBuffer* pBucket );
+		virtual	TqInt	DisplayBucket( const CqRegion& DRegion, const IqChannelBuffer* pBucket, const IqDeepBuffer* pDeepBuffer );
 		virtual	bool	fDisplayNeeds( const TqChar* var );
+		virtual	bool	fDisplayNeedsDeepData();
 		virtual	TqInt	Uses();
 
 	private:
@@ -48,6 +48,13 @@ class IqChannelBuffer
 		virtual TqInt width() const = 0;
 		virtual TqInt height() const = 0;
 		virtual TqInt getChannelIndex(const std::string& name) const = 0;
+		/** \brief Get the number of values stored for each pixel.
+		 *
+		 * Pixels are stored contiguously in row order, so the value at a
+		 * given index for pixel i+1 follows the one for pixel i by this many
+		 * values.
+		 */
+		virtual TqInt elementSize() const = 0;
 
 		typedef TqFloat TqChannelValues;
 		typedef TqFloat* TqChannelPtr;
@@ -57,6 +64,37 @@ class IqChannelBuffer
 };
 
 
+/** \brief A single layer of a deep pixel.
+ *
+ * Colour and opacity are premultiplied by the fraction of the pixel covered
+ * by the layer, so the layers of a pixel can be composited front to back
+ * with "over" to give the flat pixel value.
+ */
+struct SqDeepFragment
+{
+	TqFloat	depth;		///< Camera space depth of the layer
+	TqFloat	color[3];	///< Coverage weighted colour
+	TqFloat	opacity[3];	///< Coverage weighted opacity
+};
+
+/** \brief Access to the deep pixel data for a bucket.
+ *
+ * Each pixel holds a list of fragments sorted by increasing depth.
+ */
+class IqDeepBuffer
+{
+	public:
+		virtual ~IqDeepBuffer() {}
+
+		virtual TqInt width() const = 0;
+		virtual TqInt height() const = 0;
+		/// Get the number of fragments in the pixel at (x,y)
+		virtual TqInt numFragments(TqInt x, TqInt y) const = 0;
+		/// Get the fragments of the pixel at (x,y), or null if there are none.
+		virtual const SqDeepFragment* fragments(TqInt x, TqInt y) const = 0;
+};
+
+
 class IqDisplayRequest
 {
 	public:
@@ -94,12 +132,16 @@ public:
 	/** Close all displays in the managers list, rendering is finished.
 	 */
 	virtual	TqInt	CloseDisplays() = 0;
-	/** Display a bucket.
+	/** Display a bucket.  pDeepBuffer holds the fragments of the bucket's
+	 *  pixels, and may be empty unless fDisplayNeedsDeepData() is true.
 	 */
-	virtual	TqInt	DisplayBucket( const CqRegion& DRegion, const IqChannelBuffer* pBuffer ) = 0;
+	virtual	TqInt	DisplayBucket( const CqRegion& DRegion, const IqChannelBuffer* pBuffer, const IqDeepBuffer* pDeepBuffer ) = 0;
 	/** Determine if any of the displays need the named shader variable.
 	 */
 	virtual bool	fDisplayNeeds( const TqChar* var) = 0;
+	/** Determine if any of the displays need per pixel fragment lists.
+	 */
+	virtual bool	fDisplayNeedsDeepData() = 0;
 	/** Determine if any of the displays need the named shader variable.
 	 */
 	virtual TqInt	Uses( ) = 0;
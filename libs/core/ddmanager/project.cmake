@@ -1,6 +1,7 @@
 set(ddmanager_srcs
 	ddmanager.cpp
 	debugdd.cpp
+	scanlinebands.cpp
 )
 make_absolute(ddmanager_srcs ${ddmanager_SOURCE_DIR})
 
@@ -8,8 +9,14 @@ set(ddmanager_hdrs
 	ddmanager.h
 	debugdd.h
 	iddmanager.h
+	scanlinebands.h
 )
 make_absolute(ddmanager_hdrs ${ddmanager_SOURCE_DIR})
 
+set(ddmanager_test_srcs
+	scanlinebands_test.cpp
+)
+make_absolute(ddmanager_test_srcs ${ddmanager_SOURCE_DIR})
+
 include_directories(${ddmanager_SOURCE_DIR})
 
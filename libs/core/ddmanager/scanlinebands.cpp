@@ -0,0 +1,141 @@
+// Aqsis
+// Copyright (C) 1997 - 2010, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+/** \file
+		\brief Implements CqScanlineBands.
+*/
+
+#include	"scanlinebands.h"
+
+#include	<cstring>
+
+namespace Aqsis {
+
+CqScanlineBands::CqScanlineBands()
+	: m_crop(),
+	m_bands(),
+	m_freeData(),
+	m_nextScanline(0)
+{ }
+
+void CqScanlineBands::reset(const CqRegion& crop)
+{
+	m_crop = crop;
+	// Keep the storage of any leftover bands for reuse.
+	while(!m_bands.empty())
+		popFirstBand();
+	m_nextScanline = crop.yMin();
+}
+
+void CqScanlineBands::clear()
+{
+	m_bands.clear();
+	m_freeData.clear();
+	m_nextScanline = m_crop.yMin();
+}
+
+bool CqScanlineBands::addBucket(const CqRegion& bucket, const unsigned char* data,
+		TqInt elementSize)
+{
+	TqInt ymin = 0;
+	TqInt ymaxplus1 = 0;
+	CqRegion region = clip(bucket);
+	if(region.width() <= 0 || region.height() <= 0)
+		return firstBand(false, ymin, ymaxplus1);
+
+	// Buckets in the same row share a band, which is started by whichever
+	// of them arrives first.
+	std::map<TqInt, SqBand>::iterator iband = m_bands.find(region.yMin());
+	if(iband == m_bands.end())
+	{
+		iband = m_bands.insert(std::make_pair(region.yMin(), SqBand())).first;
+		iband->second.ymaxplus1 = region.yMax();
+		iband->second.pixelsRemaining = m_crop.width() * region.height();
+	}
+	SqBand& band = iband->second;
+
+	if(data)
+	{
+		TqInt rowSize = elementSize * m_crop.width();
+		if(band.data.empty())
+		{
+			if(!m_freeData.empty())
+			{
+				band.data.swap(m_freeData.back());
+				m_freeData.pop_back();
+			}
+			band.data.resize(rowSize * region.height());
+		}
+		// Copy the part of each bucket row inside the crop window into the
+		// band, where columns are relative to the left of the crop window.
+		TqInt bucketRowSize = elementSize * bucket.width();
+		const unsigned char* src = data
+			+ bucketRowSize * (region.yMin() - bucket.yMin())
+			+ elementSize * (region.xMin() - bucket.xMin());
+		unsigned char* dest = &band.data[elementSize * (region.xMin() - m_crop.xMin())];
+		for(TqInt y = region.yMin(); y < region.yMax(); ++y)
+		{
+			std::memcpy(dest, src, elementSize * region.width());
+			src += bucketRowSize;
+			dest += rowSize;
+		}
+	}
+	band.pixelsRemaining -= region.area();
+
+	return firstBand(false, ymin, ymaxplus1);
+}
+
+bool CqScanlineBands::firstBand(bool skipGaps, TqInt& ymin, TqInt& ymaxplus1) const
+{
+	// Buckets may be displayed out of order, so a band is only ready once
+	// it's complete and all the bands above it have been sent.
+	if(m_bands.empty())
+		return false;
+	std::map<TqInt, SqBand>::const_iterator iband = m_bands.begin();
+	if(iband->second.pixelsRemaining > 0
+		|| (iband->first != m_nextScanline && !skipGaps))
+		return false;
+	ymin = iband->first;
+	ymaxplus1 = iband->second.ymaxplus1;
+	return true;
+}
+
+const unsigned char* CqScanlineBands::firstBandData() const
+{
+	if(m_bands.empty() || m_bands.begin()->second.data.empty())
+		return 0;
+	return &m_bands.begin()->second.data[0];
+}
+
+void CqScanlineBands::popFirstBand()
+{
+	if(m_bands.empty())
+		return;
+	std::map<TqInt, SqBand>::iterator iband = m_bands.begin();
+	m_nextScanline = iband->second.ymaxplus1;
+	if(!iband->second.data.empty())
+	{
+		m_freeData.push_back(std::vector<unsigned char>());
+		m_freeData.back().swap(iband->second.data);
+	}
+	m_bands.erase(iband);
+}
+
+} // namespace Aqsis
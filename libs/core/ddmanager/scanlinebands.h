@@ -0,0 +1,126 @@
+// Aqsis
+// Copyright (C) 1997 - 2010, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+/** \file
+		\brief Declares CqScanlineBands, which collects buckets into bands of
+		complete scanlines for displays wanting scanline order.
+*/
+
+//? Is scanlinebands.h included already?
+#ifndef SCANLINEBANDS_H_INCLUDED
+#define SCANLINEBANDS_H_INCLUDED 1
+
+#include	<map>
+#include	<vector>
+
+#include	<aqsis/aqsis.h>
+#include	<aqsis/math/math.h>
+#include	<aqsis/math/region.h>
+
+namespace Aqsis {
+
+//---------------------------------------------------------------------
+/** \class CqScanlineBands
+ * Collects buckets into bands of complete scanlines.
+ *
+ * Each row of buckets makes up one band.  Bands cover only the part of the
+ * buckets inside the crop window, and store their pixels in rows the width of
+ * the crop window, starting at its left edge.  A band can be sent once all
+ * its pixels have arrived, and all the bands above it have been sent.
+ */
+class CqScanlineBands
+{
+	public:
+		CqScanlineBands();
+
+		/** \brief Start collecting a new image.
+		 *
+		 * \param crop - region of raster space covered by the display.
+		 */
+		void reset(const CqRegion& crop);
+		/// Release all bands and their storage.
+		void clear();
+
+		/// Return the region of raster space covered by the display.
+		const CqRegion& crop() const;
+		/// Clip a bucket to the crop window.  The result may be empty.
+		CqRegion clip(const CqRegion& bucket) const;
+
+		/** \brief Add the pixels of a bucket to its band.
+		 *
+		 * \param bucket - raster space region of the bucket.
+		 * \param data - pixels of the whole bucket, row by row, or null to
+		 *               only keep track of which pixels have arrived.
+		 * \param elementSize - size of a pixel in data, in bytes.
+		 * \return true if the first band is ready to send.
+		 */
+		bool addBucket(const CqRegion& bucket, const unsigned char* data,
+				TqInt elementSize);
+
+		/** \brief Get the first band, if it can be sent.
+		 *
+		 * \param skipGaps - if true, a complete band is sendable even if the
+		 *                   bands above it never arrived.
+		 * \param ymin, ymaxplus1 - set to the raster space rows of the band.
+		 * \return true if there's a band to send.
+		 */
+		bool firstBand(bool skipGaps, TqInt& ymin, TqInt& ymaxplus1) const;
+		/// Pixel data of the first band, or null if none was stored.
+		const unsigned char* firstBandData() const;
+		/// Drop the first band once it's sent, keeping its storage.
+		void popFirstBand();
+
+	private:
+		/// A row of buckets being collapsed into scanlines.
+		struct SqBand
+		{
+			TqInt ymaxplus1;		///< One past the last scanline in the band
+			TqInt pixelsRemaining;	///< Number of pixels yet to arrive
+			std::vector<unsigned char> data;	///< The band's scanline data
+		};
+
+		/// Region of raster space covered by the display.
+		CqRegion m_crop;
+		/// Bands not yet sent, keyed on their first scanline.
+		std::map<TqInt, SqBand> m_bands;
+		/// Storage from bands which have been sent, for reuse.
+		std::vector<std::vector<unsigned char> > m_freeData;
+		/// First scanline not yet sent.
+		TqInt m_nextScanline;
+};
+
+//==============================================================================
+// Implementation details
+//==============================================================================
+
+inline const CqRegion& CqScanlineBands::crop() const
+{
+	return m_crop;
+}
+
+inline CqRegion CqScanlineBands::clip(const CqRegion& bucket) const
+{
+	return CqRegion(max(bucket.xMin(), m_crop.xMin()), max(bucket.yMin(), m_crop.yMin()),
+			min(bucket.xMax(), m_crop.xMax()), min(bucket.yMax(), m_crop.yMax()));
+}
+
+} // namespace Aqsis
+
+#endif	// !SCANLINEBANDS_H_INCLUDED
@@ -0,0 +1,139 @@
+// Aqsis
+// Copyright (C) 1997 - 2010, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+/** \file
+ *
+ * \brief Unit tests for collecting buckets into scanline bands
+ */
+
+#include "scanlinebands.h"
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/auto_unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(scanlinebands_tests)
+
+using namespace Aqsis;
+
+namespace {
+
+// A crop window which doesn't line up with the 16x16 bucket grid, or start
+// at the raster origin.
+const CqRegion crop(5, 7, 21, 30);
+
+// Make the pixels of a bucket, each holding its own raster position.
+std::vector<TqInt> bucketData(const CqRegion& bucket)
+{
+	std::vector<TqInt> data;
+	for(TqInt y = bucket.yMin(); y < bucket.yMax(); ++y)
+		for(TqInt x = bucket.xMin(); x < bucket.xMax(); ++x)
+			data.push_back(1000*y + x);
+	return data;
+}
+
+bool addBucket(CqScanlineBands& bands, const CqRegion& bucket)
+{
+	std::vector<TqInt> data = bucketData(bucket);
+	return bands.addBucket(bucket,
+			reinterpret_cast<const unsigned char*>(&data[0]), sizeof(TqInt));
+}
+
+// Check the first band holds the crop window part of rows ymin to ymaxplus1.
+void checkFirstBand(const CqScanlineBands& bands, TqInt ymin, TqInt ymaxplus1)
+{
+	TqInt bandMin = -1;
+	TqInt bandMaxPlus1 = -1;
+	BOOST_REQUIRE(bands.firstBand(false, bandMin, bandMaxPlus1));
+	BOOST_CHECK_EQUAL(bandMin, ymin);
+	BOOST_CHECK_EQUAL(bandMaxPlus1, ymaxplus1);
+	const TqInt* data = reinterpret_cast<const TqInt*>(bands.firstBandData());
+	BOOST_REQUIRE(data);
+	for(TqInt y = ymin; y < ymaxplus1; ++y)
+		for(TqInt x = crop.xMin(); x < crop.xMax(); ++x)
+			BOOST_CHECK_EQUAL(*data++, 1000*y + x);
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(CqScanlineBands_cropped_in_order)
+{
+	CqScanlineBands bands;
+	bands.reset(crop);
+	BOOST_CHECK(!addBucket(bands, CqRegion(0, 0, 16, 16)));
+	BOOST_CHECK(addBucket(bands, CqRegion(16, 0, 32, 16)));
+	checkFirstBand(bands, 7, 16);
+	bands.popFirstBand();
+
+	BOOST_CHECK(!addBucket(bands, CqRegion(0, 16, 16, 32)));
+	BOOST_CHECK(addBucket(bands, CqRegion(16, 16, 32, 32)));
+	checkFirstBand(bands, 16, 30);
+	bands.popFirstBand();
+
+	TqInt ymin = 0;
+	TqInt ymaxplus1 = 0;
+	BOOST_CHECK(!bands.firstBand(true, ymin, ymaxplus1));
+}
+
+BOOST_AUTO_TEST_CASE(CqScanlineBands_cropped_out_of_order)
+{
+	CqScanlineBands bands;
+	bands.reset(crop);
+	// A complete band below the crop window's first band must wait for it.
+	BOOST_CHECK(!addBucket(bands, CqRegion(16, 16, 32, 32)));
+	BOOST_CHECK(!addBucket(bands, CqRegion(0, 16, 16, 32)));
+	BOOST_CHECK(!addBucket(bands, CqRegion(16, 0, 32, 16)));
+	// Buckets outside the crop window don't affect the bands.
+	BOOST_CHECK(!addBucket(bands, CqRegion(32, 0, 48, 16)));
+	BOOST_CHECK(addBucket(bands, CqRegion(0, 0, 16, 16)));
+	checkFirstBand(bands, 7, 16);
+	bands.popFirstBand();
+	checkFirstBand(bands, 16, 30);
+}
+
+BOOST_AUTO_TEST_CASE(CqScanlineBands_skip_gaps)
+{
+	CqScanlineBands bands;
+	bands.reset(crop);
+	addBucket(bands, CqRegion(0, 16, 16, 32));
+	addBucket(bands, CqRegion(16, 16, 32, 32));
+	TqInt ymin = 0;
+	TqInt ymaxplus1 = 0;
+	BOOST_CHECK(!bands.firstBand(false, ymin, ymaxplus1));
+	BOOST_CHECK(bands.firstBand(true, ymin, ymaxplus1));
+	BOOST_CHECK_EQUAL(ymin, 16);
+	BOOST_CHECK_EQUAL(ymaxplus1, 30);
+}
+
+BOOST_AUTO_TEST_CASE(CqScanlineBands_reset_to_new_crop)
+{
+	CqScanlineBands bands;
+	bands.reset(CqRegion(0, 0, 16, 16));
+	addBucket(bands, CqRegion(0, 0, 16, 16));
+	// Starting a new image drops unsent bands from the last one.
+	bands.reset(crop);
+	TqInt ymin = 0;
+	TqInt ymaxplus1 = 0;
+	BOOST_CHECK(!bands.firstBand(true, ymin, ymaxplus1));
+	addBucket(bands, CqRegion(0, 0, 16, 16));
+	addBucket(bands, CqRegion(16, 0, 32, 16));
+	checkFirstBand(bands, 7, 16);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
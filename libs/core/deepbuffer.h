@@ -0,0 +1,212 @@
+// Aqsis
+// Copyright (C) 1997 - 2001, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+/** \file
+		\brief Declares a class to hold the depth sorted fragment lists of a
+		2D region of pixels.
+*/
+
+//? Is deepbuffer.h included already?
+#ifndef DEEPBUFFER_H_INCLUDED
+//{
+#define DEEPBUFFER_H_INCLUDED 1
+
+#include <aqsis/aqsis.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#include <aqsis/math/math.h>
+
+#include "iddmanager.h"
+
+namespace Aqsis {
+
+//-----------------------------------------------------------------------
+/** \class CqDeepBuffer
+ * Class to store the fragment lists of a 2D region of pixels.
+ *
+ * The pixels are filled in row order with addPixel(), which sorts the
+ * fragments and merges those lying at nearly the same depth.  Fragments of
+ * all pixels are packed into a single array.
+ */
+
+class CqDeepBuffer : public IqDeepBuffer
+{
+	public:
+		CqDeepBuffer();
+		virtual ~CqDeepBuffer() {}
+
+		/** \brief Discard all pixels and prepare for a region of the given size.
+		 *
+		 * \param mergeTolerance - fragments are merged when the depth between
+		 *                         them is less than this fraction of their depth.
+		 */
+		void allocate(TqInt width, TqInt height, TqFloat mergeTolerance);
+		/// Discard all pixels, leaving an empty region.
+		void clear();
+		/** \brief Add the fragments of the next pixel in row order.
+		 *
+		 * The fragments are sorted into depth order, those which lie within
+		 * the merge tolerance of the front of a run of fragments are summed
+		 * into one, and those which are entirely transparent are dropped.
+		 *
+		 * \param fragments - unsorted fragments for the pixel.  The vector is
+		 *                    used as scratch space and is left sorted.
+		 */
+		void addPixel(std::vector<SqDeepFragment>& fragments);
+
+		// Overidden from IqDeepBuffer
+		virtual TqInt width() const;
+		virtual TqInt height() const;
+		virtual TqInt numFragments(TqInt x, TqInt y) const;
+		virtual const SqDeepFragment* fragments(TqInt x, TqInt y) const;
+
+	private:
+		TqInt pixelIndex(TqInt x, TqInt y) const;
+
+		TqInt	m_width;
+		TqInt	m_height;
+		TqFloat	m_mergeTolerance;
+		/// Start of the fragments of each pixel in m_fragments, plus one past the end.
+		std::vector<TqInt> m_offsets;
+		std::vector<SqDeepFragment> m_fragments;
+};
+
+
+//==============================================================================
+// Implementation details
+//==============================================================================
+
+namespace detail {
+
+/// Ascending depth sorting functor for fragments.
+struct SqFragmentDepthLess
+{
+	bool operator()(const SqDeepFragment& a, const SqDeepFragment& b) const
+	{
+		return a.depth < b.depth;
+	}
+};
+
+inline bool isTransparent(const SqDeepFragment& frag)
+{
+	return frag.opacity[0] <= 0 && frag.opacity[1] <= 0 && frag.opacity[2] <= 0
+		&& frag.color[0] == 0 && frag.color[1] == 0 && frag.color[2] == 0;
+}
+
+} // namespace detail
+
+inline CqDeepBuffer::CqDeepBuffer()
+	: m_width(0),
+	m_height(0),
+	m_mergeTolerance(0),
+	m_offsets(1, 0),
+	m_fragments()
+{ }
+
+inline void CqDeepBuffer::allocate(TqInt width, TqInt height, TqFloat mergeTolerance)
+{
+	m_width = width;
+	m_height = height;
+	m_mergeTolerance = mergeTolerance;
+	m_offsets.clear();
+	m_offsets.reserve(width*height + 1);
+	m_offsets.push_back(0);
+	m_fragments.clear();
+}
+
+inline void CqDeepBuffer::clear()
+{
+	allocate(0, 0, m_mergeTolerance);
+}
+
+inline void CqDeepBuffer::addPixel(std::vector<SqDeepFragment>& fragments)
+{
+	assert(static_cast<TqInt>(m_offsets.size()) <= m_width*m_height);
+	std::sort(fragments.begin(), fragments.end(), detail::SqFragmentDepthLess());
+	TqInt runStart = -1;
+	for(std::vector<SqDeepFragment>::const_iterator frag = fragments.begin(),
+			end = fragments.end(); frag != end; ++frag)
+	{
+		if(detail::isTransparent(*frag))
+			continue;
+		if(runStart >= 0)
+		{
+			SqDeepFragment& run = m_fragments[runStart];
+			if(frag->depth - run.depth <= m_mergeTolerance*std::fabs(run.depth))
+			{
+				// Fragments from different samples at the same depth cover
+				// different parts of the pixel, so their contributions add.
+				for(TqInt i = 0; i < 3; ++i)
+				{
+					run.color[i] += frag->color[i];
+					run.opacity[i] = min(run.opacity[i] + frag->opacity[i], 1.0f);
+				}
+				continue;
+			}
+		}
+		runStart = m_fragments.size();
+		m_fragments.push_back(*frag);
+	}
+	m_offsets.push_back(m_fragments.size());
+}
+
+inline TqInt CqDeepBuffer::width() const
+{
+	return m_width;
+}
+
+inline TqInt CqDeepBuffer::height() const
+{
+	return m_height;
+}
+
+inline TqInt CqDeepBuffer::numFragments(TqInt x, TqInt y) const
+{
+	TqInt i = pixelIndex(x, y);
+	return m_offsets[i+1] - m_offsets[i];
+}
+
+inline const SqDeepFragment* CqDeepBuffer::fragments(TqInt x, TqInt y) const
+{
+	TqInt i = pixelIndex(x, y);
+	if(m_offsets[i+1] == m_offsets[i])
+		return 0;
+	return &m_fragments[m_offsets[i]];
+}
+
+inline TqInt CqDeepBuffer::pixelIndex(TqInt x, TqInt y) const
+{
+	assert(x >= 0 && x < m_width);
+	assert(y >= 0 && y < m_height);
+	TqInt i = y*m_width + x;
+	assert(i + 1 < static_cast<TqInt>(m_offsets.size()));
+	return i;
+}
+
+//-----------------------------------------------------------------------
+
+} // namespace Aqsis
+
+//}  // End of #ifdef DEEPBUFFER_H_INCLUDED
+#endif
@@ -0,0 +1,96 @@
+// Aqsis
+// Copyright (C) 1997 - 2007, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+/** \file
+ *
+ * \brief Unit tests for the deep pixel buffer
+ */
+
+#include "deepbuffer.h"
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/auto_unit_test.hpp>
+#include <boost/test/floating_point_comparison.hpp>
+
+BOOST_AUTO_TEST_SUITE(deepbuffer_tests)
+
+using namespace Aqsis;
+
+namespace {
+
+SqDeepFragment fragment(TqFloat depth, TqFloat color, TqFloat opacity)
+{
+	SqDeepFragment frag;
+	frag.depth = depth;
+	for(TqInt i = 0; i < 3; ++i)
+	{
+		frag.color[i] = color;
+		frag.opacity[i] = opacity;
+	}
+	return frag;
+}
+
+} // unnamed namespace
+
+BOOST_AUTO_TEST_CASE(deepbuffer_sort_merge_test)
+{
+	CqDeepBuffer buf;
+	buf.allocate(2, 1, 1e-3f);
+
+	std::vector<SqDeepFragment> frags;
+	frags.push_back(fragment(10, 0.25, 0.25));
+	frags.push_back(fragment(2, 0.5, 0.5));
+	// Merged with the fragment at depth 10.
+	frags.push_back(fragment(10.005, 0.25, 0.25));
+	// Transparent fragments are dropped.
+	frags.push_back(fragment(5, 0, 0));
+	buf.addPixel(frags);
+	frags.clear();
+	buf.addPixel(frags);
+
+	BOOST_CHECK_EQUAL(buf.width(), 2);
+	BOOST_CHECK_EQUAL(buf.height(), 1);
+	BOOST_REQUIRE_EQUAL(buf.numFragments(0, 0), 2);
+	const SqDeepFragment* pixel = buf.fragments(0, 0);
+	BOOST_CHECK_CLOSE(pixel[0].depth, 2.0f, 1e-4);
+	BOOST_CHECK_CLOSE(pixel[0].color[0], 0.5f, 1e-4);
+	BOOST_CHECK_CLOSE(pixel[1].depth, 10.0f, 1e-4);
+	BOOST_CHECK_CLOSE(pixel[1].color[1], 0.5f, 1e-4);
+	BOOST_CHECK_CLOSE(pixel[1].opacity[2], 0.5f, 1e-4);
+
+	BOOST_CHECK_EQUAL(buf.numFragments(1, 0), 0);
+	BOOST_CHECK(buf.fragments(1, 0) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(deepbuffer_merge_opacity_clamp_test)
+{
+	CqDeepBuffer buf;
+	buf.allocate(1, 1, 1e-3f);
+
+	std::vector<SqDeepFragment> frags;
+	frags.push_back(fragment(1, 0.75, 0.75));
+	frags.push_back(fragment(1, 0.75, 0.75));
+	buf.addPixel(frags);
+
+	BOOST_REQUIRE_EQUAL(buf.numFragments(0, 0), 1);
+	BOOST_CHECK_CLOSE(buf.fragments(0, 0)->opacity[0], 1.0f, 1e-4);
+	BOOST_CHECK_CLOSE(buf.fragments(0, 0)->color[0], 1.5f, 1e-4);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
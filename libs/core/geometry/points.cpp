@@ -39,9 +39,9 @@
 
 namespace Aqsis {
 
-CqObjectPool<CqMovingMicroPolygonKeyPoints>	CqMovingMicroPolygonKeyPoints::m_thePool;
-CqObjectPool<CqMicroPolygonPoints>	CqMicroPolygonPoints::m_thePool;
-CqObjectPool<CqMicroPolygonMotionPoints>	CqMicroPolygonMotionPoints::m_thePool;
+CqThreadLocalPool<CqMovingMicroPolygonKeyPoints>	CqMovingMicroPolygonKeyPoints::m_thePool;
+CqThreadLocalPool<CqMicroPolygonPoints>	CqMicroPolygonPoints::m_thePool;
+CqThreadLocalPool<CqMicroPolygonMotionPoints>	CqMicroPolygonMotionPoints::m_thePool;
 
 class CqPointsKDTreeData::CqPointsKDTreeDataComparator
 {
@@ -663,6 +663,22 @@ bool CqMicroPolygonPoints::Sample( CqHitTestCache& cache, SqSampleData const& sa
 	return false;
 }
 
+TqUint CqMicroPolygonPoints::SampleBatch( CqHitTestCache& cache, const TqFloat* x, const TqFloat* y, TqInt count, TqFloat* D, CqVector2D* uv ) const
+{
+	CqVector2D center = vectorCast<CqVector2D>(cache.P[0]);
+	TqFloat radius2 = m_radius*m_radius;
+	TqUint mask = 0;
+	for(TqInt i = 0; i < count; ++i)
+	{
+		if((center - CqVector2D(x[i], y[i])).Magnitude2() < radius2)
+		{
+			D[i] = cache.P[0].z();
+			mask |= 1U << i;
+		}
+	}
+	return mask;
+}
+
 void CqMicroPolygonPoints::CacheHitTestValues(CqHitTestCache& cache, bool usingDof) const
 {
 	pGrid()->pVar(EnvVars_P)->GetPoint(cache.P[0], m_Index);
@@ -358,6 +358,7 @@ class CqMicroPolygonPoints : public CqMicroPolygon
 			m_Bound.vecMax() = pos + CqVector3D(m_radius, m_radius, 0);
 		}
 		virtual	bool	Sample( CqHitTestCache& hitTestCache, SqSampleData const& sample, TqFloat& D, CqVector2D& uv, TqFloat time, bool UsingDof = false ) const;
+		virtual TqUint	SampleBatch( CqHitTestCache& hitTestCache, const TqFloat* x, const TqFloat* y, TqInt count, TqFloat* D, CqVector2D* uv ) const;
 		virtual void CacheHitTestValues(CqHitTestCache& cache, bool usingDof) const;
 
 		virtual void CacheOutputInterpCoeffs(SqMpgSampleInfo& cache) const;
@@ -367,7 +368,8 @@ class CqMicroPolygonPoints : public CqMicroPolygon
 	private:
 		TqFloat	m_radius;
 
-		static	CqObjectPool<CqMicroPolygonPoints>	m_thePool;
+		friend class CqMicroPolygon;
+		static	CqThreadLocalPool<CqMicroPolygonPoints>	m_thePool;
 }
 ;
 
@@ -423,7 +425,8 @@ class CqMovingMicroPolygonKeyPoints
 		CqVector3D	m_Point0;
 		TqFloat		m_radius;
 
-		static	CqObjectPool<CqMovingMicroPolygonKeyPoints>	m_thePool;
+		friend class CqMicroPolygon;
+		static	CqThreadLocalPool<CqMovingMicroPolygonKeyPoints>	m_thePool;
 }
 ;
 
@@ -499,7 +502,8 @@ class CqMicroPolygonMotionPoints : public CqMicroPolygon
 		std::vector<TqFloat> m_Times;
 		std::vector<CqMovingMicroPolygonKeyPoints*>	m_Keys;
 
-		static	CqObjectPool<CqMicroPolygonMotionPoints>	m_thePool;
+		friend class CqMicroPolygon;
+		static	CqThreadLocalPool<CqMicroPolygonMotionPoints>	m_thePool;
 
 };
 
@@ -32,6 +32,17 @@
 
 namespace Aqsis {
 
+namespace {
+
+// Attributes and options read for every surface.
+const CqParamKey keyTextureCoordinates( "System", "TextureCoordinates" );
+const CqParamKey keyShadingRate( "System", "ShadingRate" );
+const CqParamKey keyGeometricFocusFactor( "System", "GeometricFocusFactor" );
+const CqParamKey keyGeometricMotionFactor( "System", "GeometricMotionFactor" );
+const CqParamKey keyShutter( "System", "Shutter" );
+
+} // unnamed namespace
+
 //TqFloat CqSurface::m_fGridSize = sqrt(256.0);
 
 
@@ -188,10 +199,7 @@ CqSurface::CqSurface()
 		m_aiStdPrimitiveVars[ i ] = -1;
 
 	STATS_INC( GPR_allocated );
-	STATS_INC( GPR_current );
-	TqInt cGprim = STATS_GETI( GPR_current );
-	TqInt cPeak = STATS_GETI( GPR_peak );
-	STATS_SETI( GPR_peak, cGprim > cPeak ? cGprim : cPeak );
+	STATS_INC_PEAK( GPR_current, GPR_peak );
 }
 
 
@@ -254,7 +262,7 @@ void CqSurface::SetDefaultPrimitiveVariables( bool bUseDef_st )
 		s() ->SetSize( 4 );
 		TqInt i;
 		for ( i = 0; i < 4; i++ )
-			s() ->pValue() [ i ] = m_pAttributes->GetFloatAttribute( "System", "TextureCoordinates" ) [ i * 2 ];
+			s() ->pValue() [ i ] = m_pAttributes->GetFloatAttribute( keyTextureCoordinates ) [ i * 2 ];
 	}
 
 	if ( USES( bUses, EnvVars_t ) && bUseDef_st && !bHasVar(EnvVars_t))
@@ -263,7 +271,7 @@ void CqSurface::SetDefaultPrimitiveVariables( bool bUseDef_st )
 		t() ->SetSize( 4 );
 		TqInt i;
 		for ( i = 0; i < 4; i++ )
-			t() ->pValue() [ i ] = m_pAttributes->GetFloatAttribute( "System", "TextureCoordinates" ) [ ( i * 2 ) + 1 ];
+			t() ->pValue() [ i ] = m_pAttributes->GetFloatAttribute( keyTextureCoordinates ) [ ( i * 2 ) + 1 ];
 	}
 
 	if ( USES( bUses, EnvVars_u ) )
@@ -690,7 +698,7 @@ static void transformCuboid(CqVector3D out[8], const CqVector3D in[8],
 TqFloat CqSurface::AdjustedShadingRate() const
 {
 	TqFloat shadingRate =
-		m_pAttributes->GetFloatAttribute("System", "ShadingRate")[0];
+		m_pAttributes->GetFloatAttribute(keyShadingRate)[0];
 	CqRenderer* context = QGetRenderContext();
 	if(context->UsingDepthOfField())
 	{
@@ -702,7 +710,7 @@ TqFloat CqSurface::AdjustedShadingRate() const
 		// If this isn't included then render time increases roughly
 		// quadratically with number of pixels which makes things very slow.
 		const TqFloat focusFactor =
-			m_pAttributes->GetFloatAttribute("System", "GeometricFocusFactor")[0];
+			m_pAttributes->GetFloatAttribute(keyGeometricFocusFactor)[0];
 		const TqFloat minCoC = context->MinCoCForBound(m_Bound);
 
 		// We need a factor which decides the desired ratio of the area of the
@@ -729,14 +737,15 @@ TqFloat CqSurface::AdjustedShadingRate() const
 	// Adjust shadingRate based on motionfactor
 
 	//get motionfactor variable from rib, camera transform
-	const TqFloat* motionFactor = m_pAttributes->GetFloatAttribute("System", "GeometricMotionFactor");
+	const TqFloat* motionFactor = m_pAttributes->GetFloatAttribute(keyGeometricMotionFactor);
 	TqFloat motionFac = motionFactor[0];
 	CqTransformPtr cameraTransform = context->GetCameraTransform();
 
 	if (motionFac > 0.0 && (isMoving() || cameraTransform->isMoving() ) )
 	{
 		// get the exposure-time (Time of shutter close - Time of shutter open)
-		const TqFloat* shutterTimes = context->GetFloatOption( "System", "Shutter" );
+		const TqFloat* shutterTimes = static_cast<const CqOptions&>(
+				*context->poptCurrent()).GetFloatOption( keyShutter );
 		assert(shutterTimes);
 		TqFloat exposureTime = shutterTimes[1] - shutterTimes[0];
 
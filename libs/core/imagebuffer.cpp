@@ -37,9 +37,18 @@
 #include	"surface.h"
 #include	"micropolygon.h"
 #include	"bucketprocessor.h"
-#include	"threadscheduler.h"
 #include	"multijitter.h"
 #include	"grid.h"
+#include	"threadscheduler.h"
+
+#ifdef	ENABLE_THREADING
+#include	<deque>
+#include	<boost/bind.hpp>
+#include	<boost/scoped_ptr.hpp>
+#include	<boost/thread/condition.hpp>
+#include	<boost/thread/mutex.hpp>
+#include	<boost/thread/thread.hpp>
+#endif
 
 
 namespace Aqsis {
@@ -47,113 +56,192 @@ namespace Aqsis {
 static TqInt bucketmodulo = -1;
 //static TqInt bucketdirection = -1;
 
-#define MULTIPROCESSING_NBUCKETS 1
-/** Implementing a work unit for a boost::thread (the operator()()
- * method), that is, a piece of code that will run in parallel.
+/** \brief Display stage, which sends finished buckets to the displays.
+ *
+ * Buckets have to be rendered in raster order: surfaces and micropolygons are
+ * forwarded from each bucket into the following ones, and the filter overlap
+ * samples are handed on via cache segments during post processing.  Once a
+ * bucket has been post-processed though, the only remaining work is to send
+ * its channel buffer to the displays.  That's done by a single display thread
+ * so that the render thread can carry straight on with the next bucket.
+ * (Within each bucket, the combining and filtering are shared out over the
+ * renderer's worker pool; see CqBucketProcessor::postProcess().)
+ *
+ * There are two bucket processors: one being rendered into while the other is
+ * displayed.  The display thread takes buckets in the order they were
+ * submitted, so the displays see them in the same order as without threading.
+ *
+ * Without ENABLE_THREADING there's one processor, and buckets are displayed
+ * as soon as they're submitted.
  */
-class CqThreadProcessor
+class CqBucketDisplayStage
 {
 public:
-	CqThreadProcessor(CqBucketProcessor* bucketProcessor) :
-		m_bucketProcessor(bucketProcessor) { }
-	void operator()()
-	{
-		// printf("%p > start\n", m_bucketProcessor);
-		m_bucketProcessor->process();
-		// printf("%p < stop\n", m_bucketProcessor);
-	}
+	CqBucketDisplayStage(CqImageBuffer& imageBuf, const SqOptionCache& optCache);
+	/// Wait for all submitted buckets to be displayed and stop the thread.
+	~CqBucketDisplayStage();
+
+	/// Get a free processor, waiting for the display thread if necessary.
+	CqBucketProcessor* acquire();
+	/// Queue the finished bucket in a processor to be displayed.
+	void submit(CqBucketProcessor* processor);
+	/// Wait until all submitted buckets have been displayed.
+	void finish();
 
 private:
-	CqBucketProcessor* m_bucketProcessor;
+	/// Send a bucket to the displays and make its processor free again.
+	void display(CqBucketProcessor* processor);
+#ifdef	ENABLE_THREADING
+	/// Main loop of the display thread.
+	void displayLoop();
+#endif
+
+	std::vector<boost::shared_ptr<CqBucketProcessor> > m_processors;
+	/// Processors which aren't rendering or waiting to be displayed.
+	std::vector<CqBucketProcessor*> m_free;
+	/// Checked for an aborted render; queued buckets are then dropped.
+	const CqImageBuffer& m_imageBuf;
+#ifdef	ENABLE_THREADING
+	/// Processors waiting to be displayed, in bucket order.
+	std::deque<CqBucketProcessor*> m_queue;
+	/// True while the display thread is displaying a bucket.
+	bool m_displaying;
+	/// Set when the display thread should exit.
+	bool m_stopping;
+	/// Protects the state above.
+	boost::mutex m_mutex;
+	/// Signalled when a processor is queued, or when stopping.
+	boost::condition m_queued;
+	/// Signalled when a processor has been displayed.
+	boost::condition m_displayed;
+	/// Started last, so that everything else is ready.
+	boost::scoped_ptr<boost::thread> m_thread;
+#endif
 };
 
+CqBucketDisplayStage::CqBucketDisplayStage(CqImageBuffer& imageBuf,
+		const SqOptionCache& optCache)
+	: m_processors(),
+	m_free(),
+	m_imageBuf(imageBuf)
+#ifdef	ENABLE_THREADING
+	,
+	m_queue(),
+	m_displaying(false),
+	m_stopping(false),
+	m_mutex(),
+	m_queued(),
+	m_displayed(),
+	m_thread()
+#endif
+{
+	TqInt numProcessors = 1;
+#ifdef	ENABLE_THREADING
+	numProcessors = 2;
+#endif
+	for(TqInt i = 0; i < numProcessors; ++i)
+	{
+		m_processors.push_back(boost::shared_ptr<CqBucketProcessor>(
+					new CqBucketProcessor(imageBuf, optCache)));
+		m_free.push_back(m_processors.back().get());
+	}
+#ifdef	ENABLE_THREADING
+	m_thread.reset(new boost::thread(
+				boost::bind(&CqBucketDisplayStage::displayLoop, this)));
+#endif
+}
 
-/* mafm: implementation of a processor (work unit for a boost::thread)
- * where it takes buckets ready to process and does so continuously.
- * One simple addition would be to wait for new available buckets
- * which are provided dynamically.  This is not applicable at the
- * moment though, it would need RenderSurfaces() to process all of the
- * surfaces of the buckets before assigning them as ready; but at the
- * moment RenderSurfaces() can't run before assigning the bucket to
- * the bucket processor, and it doesn't seem possible to break this
- * interdependency.
+CqBucketDisplayStage::~CqBucketDisplayStage()
+{
+#ifdef	ENABLE_THREADING
+	finish();
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_stopping = true;
+	}
+	m_queued.notify_one();
+	m_thread->join();
+#endif
+}
 
-boost::mutex displayMutex;
+CqBucketProcessor* CqBucketDisplayStage::acquire()
+{
+#ifdef	ENABLE_THREADING
+	boost::mutex::scoped_lock lock(m_mutex);
+	while(m_free.empty())
+		m_displayed.wait(lock);
+#endif
+	assert(!m_free.empty());
+	CqBucketProcessor* processor = m_free.back();
+	m_free.pop_back();
+	return processor;
+}
 
-class CqThreadProcessor2
+void CqBucketDisplayStage::submit(CqBucketProcessor* processor)
 {
-public:
-	CqThreadProcessor2(const CqImageBuffer* imageBuffer,
-			   std::vector<CqBucket*>& bucketList,
-			   bool fImager,
-			   const CqColor& zThreshold,
-			   EqDepthFilter depthfilter,
-			   const CqVector2D& bHalf) :
-		m_imageBuffer(imageBuffer),
-		m_bucketList(bucketList),
-		m_fImager(fImager),
-		m_zThreshold(zThreshold),
-		m_depthfilter(depthfilter),
-		m_bHalf(bHalf) { }
-
-	void operator()()
-	{
-		while ( !m_bucketList.empty() )
-		{
-			CqBucket* bucket = m_bucketList.front();
-			m_bucketList.erase( m_bucketList.begin() );
-
-			m_bucketProcessor.setBucket( bucket );
-			if ( m_fImager )
-				m_bucketProcessor.setInitiallyEmpty(false);
-			
-			// Set up some bounds for the bucket.
-			const CqVector2D bPos = m_imageBuffer->BucketPosition( bucket->getCol(),
-									       bucket->getRow() );
-			const CqVector2D bSize = m_imageBuffer->BucketSize( bucket->getCol(),
-									    bucket->getRow() );
-			const CqVector2D vecMin = bPos - m_bHalf;
-			const CqVector2D vecMax = bPos + bSize + m_bHalf;
-
-			TqInt xmin = static_cast<TqInt>( vecMin.x() );
-			TqInt ymin = static_cast<TqInt>( vecMin.y() );
-			TqInt xmax = static_cast<TqInt>( vecMax.x() );
-			TqInt ymax = static_cast<TqInt>( vecMax.y() );
-			if ( xmin < m_imageBuffer->CropWindowXMin() - m_imageBuffer->FilterXWidth() / 2 )
-				xmin = static_cast<TqInt>(m_imageBuffer->CropWindowXMin() - m_imageBuffer->FilterXWidth() / 2.0f);
-			if ( ymin < m_imageBuffer->CropWindowYMin() - m_imageBuffer->FilterYWidth() / 2 )
-				ymin = static_cast<TqInt>(m_imageBuffer->CropWindowYMin() - m_imageBuffer->FilterYWidth() / 2.0f);
-			if ( xmax > m_imageBuffer->CropWindowXMax() + m_imageBuffer->FilterXWidth() / 2 )
-				xmax = static_cast<TqInt>(m_imageBuffer->CropWindowXMax() + m_imageBuffer->FilterXWidth() / 2.0f);
-			if ( ymax > m_imageBuffer->CropWindowYMax() + m_imageBuffer->FilterYWidth() / 2 )
-				ymax = static_cast<TqInt>(m_imageBuffer->CropWindowYMax() + m_imageBuffer->FilterYWidth() / 2.0f);
-
-			m_bucketProcessor.preProcess( bPos, bSize,
-						      m_imageBuffer->PixelXSamples(), m_imageBuffer->PixelYSamples(), m_imageBuffer->FilterXWidth(), m_imageBuffer->FilterYWidth(),
-						      xmin, xmax, ymin, ymax,
-						      m_imageBuffer->ClippingNear(), m_imageBuffer->ClippingFar() );
-			m_bucketProcessor.process();
-			m_bucketProcessor.postProcess( m_fImager, m_depthfilter, m_zThreshold );
-			{
-				TIME_SCOPE("Display bucket");
-				boost::mutex::scoped_lock lock(displayMutex);
-				QGetRenderContext() ->pDDmanager() ->DisplayBucket( bucket );
-			}
-			m_bucketProcessor.reset();
-		}
+#ifdef	ENABLE_THREADING
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_queue.push_back(processor);
 	}
+	m_queued.notify_one();
+#else
+	display(processor);
+#endif
+}
 
-private:
-	CqBucketProcessor m_bucketProcessor;
-	const CqImageBuffer* m_imageBuffer;
-	std::vector<CqBucket*> m_bucketList;
-	bool m_fImager;
-	CqColor m_zThreshold;
-	EqDepthFilter m_depthfilter;
-	CqVector2D m_bHalf;
-};
+void CqBucketDisplayStage::finish()
+{
+#ifdef	ENABLE_THREADING
+	boost::mutex::scoped_lock lock(m_mutex);
+	while(!m_queue.empty() || m_displaying)
+		m_displayed.wait(lock);
+#endif
+}
 
-*/
+void CqBucketDisplayStage::display(CqBucketProcessor* processor)
+{
+	// After an abort the bucket is dropped, but the processor must still be
+	// made free again.
+	if(!m_imageBuf.isQuitting() && processor->getBucket())
+	{
+		AQSIS_TIME_SCOPE(Display_bucket);
+		QGetRenderContext() ->pDDmanager() ->DisplayBucket( processor->DisplayRegion(),
+				&(processor->getChannelBuffer()),
+				&(processor->getDeepBuffer()) );
+	}
+	processor->reset();
+#ifdef	ENABLE_THREADING
+	boost::mutex::scoped_lock lock(m_mutex);
+#endif
+	m_free.push_back(processor);
+}
+
+#ifdef	ENABLE_THREADING
+void CqBucketDisplayStage::displayLoop()
+{
+	while(true)
+	{
+		CqBucketProcessor* processor = 0;
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			while(m_queue.empty() && !m_stopping)
+				m_queued.wait(lock);
+			if(m_queue.empty())
+				return;
+			processor = m_queue.front();
+			m_queue.pop_front();
+			m_displaying = true;
+		}
+		display(processor);
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			m_displaying = false;
+		}
+		m_displayed.notify_all();
+	}
+}
+#endif
 
 
 //----------------------------------------------------------------------
@@ -507,14 +595,14 @@ void CqImageBuffer::RepostSurface(const CqBucket& oldBucket,
 }
 
 //----------------------------------------------------------------------
-/** Add a new micro polygon to the list of waiting ones.
- * \param pmpgNew Pointer to a CqMicroPolygon derived class.
+/** Find the range of buckets touched by a micropolygon or grid bound.
  */
 
-void CqImageBuffer::AddMPG( boost::shared_ptr<CqMicroPolygon>& pmpgNew )
+bool CqImageBuffer::BucketRange( const CqBound& rasterBound, TqInt& iXBa,
+		TqInt& iXBb, TqInt& iYBa, TqInt& iYBb ) const
 {
 	CqRenderer* renderContext = QGetRenderContext();
-	CqBound B = pmpgNew->GetBound();
+	CqBound B = rasterBound;
 
 	// Expand the micropolygon bound for DoF if necessary.
 	if(renderContext->UsingDepthOfField())
@@ -535,17 +623,9 @@ void CqImageBuffer::AddMPG( boost::shared_ptr<CqMicroPolygon>& pmpgNew )
 	     B.vecMin().x() > renderContext->cropWindowXMax() + m_optCache.xFiltSize / 2.0f ||
 	     B.vecMin().y() > renderContext->cropWindowYMax() + m_optCache.yFiltSize / 2.0f )
 	{
-		return;
+		return false;
 	}
 
-	////////// Dump the micro polygon into a dump file //////////
-#if ENABLE_MPDUMP
-	if(m_mpdump.IsOpen())
-		m_mpdump.dump(*pmpgNew);
-#endif
-	/////////////////////////////////////////////////////////////
-
-
 	// Find out the minimum bucket touched by the micropoly bound.
 
 	B.vecMin().x( B.vecMin().x() - (lfloor(m_optCache.xFiltSize / 2.0f)) );
@@ -553,15 +633,15 @@ void CqImageBuffer::AddMPG( boost::shared_ptr<CqMicroPolygon>& pmpgNew )
 	B.vecMax().x( B.vecMax().x() + (lfloor(m_optCache.xFiltSize / 2.0f)) );
 	B.vecMax().y( B.vecMax().y() + (lfloor(m_optCache.yFiltSize / 2.0f)) );
 
-	TqInt iXBa = static_cast<TqInt>( B.vecMin().x() / m_optCache.xBucketSize );
-	TqInt iYBa = static_cast<TqInt>( B.vecMin().y() / m_optCache.yBucketSize );
-	TqInt iXBb = static_cast<TqInt>( B.vecMax().x() / m_optCache.xBucketSize );
-	TqInt iYBb = static_cast<TqInt>( B.vecMax().y() / m_optCache.yBucketSize );
+	iXBa = static_cast<TqInt>( B.vecMin().x() / m_optCache.xBucketSize );
+	iYBa = static_cast<TqInt>( B.vecMin().y() / m_optCache.yBucketSize );
+	iXBb = static_cast<TqInt>( B.vecMax().x() / m_optCache.xBucketSize );
+	iYBb = static_cast<TqInt>( B.vecMax().y() / m_optCache.yBucketSize );
 
 	if ( ( iXBb < m_bucketRegion.xMin() ) || ( iYBb < m_bucketRegion.yMin() ) ||
 	        ( iXBa >= m_bucketRegion.xMax() ) || ( iYBa >= m_bucketRegion.yMax() ) )
 	{
-		return ;
+		return false;
 	}
 
 	// Use sane values -- otherwise sometimes crashes, probably
@@ -570,6 +650,26 @@ void CqImageBuffer::AddMPG( boost::shared_ptr<CqMicroPolygon>& pmpgNew )
 	if ( iYBa < m_bucketRegion.yMin() )  iYBa = m_bucketRegion.yMin();
 	if ( iXBb >= m_bucketRegion.xMax() )  iXBb = m_bucketRegion.xMax() - 1;
 	if ( iYBb >= m_bucketRegion.yMax() )  iYBb = m_bucketRegion.yMax() - 1;
+	return true;
+}
+
+//----------------------------------------------------------------------
+/** Add a new micro polygon to the list of waiting ones.
+ * \param pmpgNew Pointer to a CqMicroPolygon derived class.
+ */
+
+void CqImageBuffer::AddMPG( boost::shared_ptr<CqMicroPolygon>& pmpgNew )
+{
+	TqInt iXBa, iXBb, iYBa, iYBb;
+	if ( !BucketRange( pmpgNew->GetBound(), iXBa, iXBb, iYBa, iYBb ) )
+		return;
+
+	////////// Dump the micro polygon into a dump file //////////
+#if ENABLE_MPDUMP
+	if(m_mpdump.IsOpen())
+		m_mpdump.dump(*pmpgNew);
+#endif
+	/////////////////////////////////////////////////////////////
 
 	// Add the MP to all the Buckets that it touches
 	for ( TqInt i = iXBa; i <= iXBb; i++ )
@@ -591,6 +691,53 @@ void CqImageBuffer::AddMPG( boost::shared_ptr<CqMicroPolygon>& pmpgNew )
 }
 
 
+//----------------------------------------------------------------------
+/** Add a shaded static grid to the list of waiting ones.
+ * \param pGrid The grid, with quad bounds precomputed.
+ */
+
+void CqImageBuffer::AddGrid( boost::shared_ptr<CqRasterGrid>& pGrid )
+{
+	// Nothing to do when every quad was culled.
+	const CqBound& B = pGrid->GetBound();
+	if ( B.vecMin().x() > B.vecMax().x() )
+		return;
+
+	TqInt iXBa, iXBb, iYBa, iYBb;
+	if ( !BucketRange( B, iXBa, iXBb, iYBa, iYBb ) )
+		return;
+
+	////////// Dump the micro polygons into a dump file //////////
+#if ENABLE_MPDUMP
+	if(m_mpdump.IsOpen())
+	{
+		for ( TqInt q = 0, numQuads = pGrid->numQuads(); q < numQuads; ++q )
+		{
+			if ( pGrid->quadFlags( q ) & CqRasterGrid::Quad_Skip )
+				continue;
+			CqMicroPolygon mp( pGrid->pGrid(), pGrid->gridIndex( q ) );
+			mp.Initialise();
+			m_mpdump.dump(mp);
+		}
+	}
+#endif
+	/////////////////////////////////////////////////////////////
+
+	for ( TqInt i = iXBa; i <= iXBb; i++ )
+	{
+		for ( TqInt j = iYBa; j <= iYBb; j++ )
+		{
+			CqBucket* bucket = &Bucket( i, j );
+			// As for AddMPG(), processed buckets are skipped.
+			if ( !bucket->IsProcessed() )
+			{
+				bucket->AddGrid( pGrid );
+			}
+		}
+	}
+}
+
+
 //----------------------------------------------------------------------
 /** Render any waiting Surfaces
  
@@ -659,38 +806,11 @@ void CqImageBuffer::RenderImage()
 	// A counter for the number of processed buckets (used for progress reporting)
 	TqInt iBucket = 0;
 
-	std::vector<boost::shared_ptr<CqBucketProcessor> > bucketProcessors;
-	TqInt numConcurrentBuckets = 1;
-
-/* mafm: Sample code to use with the CqThreadProcessor2 alternative
- * approach.
-
-	std::vector<std::vector<CqBucket*> > bucketLists;
-	bucketLists.resize(MULTIPROCESSING_NBUCKETS);
-	int index = 0;
-	do
-	{
-		bucketLists[index % MULTIPROCESSING_NBUCKETS].push_back( &(CurrentBucket()) );
-		++index;
-	} while ( NextBucket(order) );
-	boost::thread_group threadGroup;
-	for (int i = 0; i < MULTIPROCESSING_NBUCKETS; ++i)
-	{
-		threadGroup.create_thread( CqThreadProcessor2(this, bucketLists[i], fImager, zThreshold, depthfilter, bHalf) );
-	}
-	threadGroup.join_all();
-	return;
-*/
+	// Finished buckets are displayed while the next one is rendered.
+	CqBucketDisplayStage displayStage(*this, m_optCache);
+	// Worker pool for post-processing each bucket.
+	CqThreadScheduler& scheduler = QGetRenderContext()->threadScheduler();
 
-#ifdef		ENABLE_THREADING
-	numConcurrentBuckets = MULTIPROCESSING_NBUCKETS;
-#endif
-
-	for(int i = 0; i < numConcurrentBuckets; ++i)
-	{
-		bucketProcessors.push_back(boost::shared_ptr<CqBucketProcessor>(
-					new CqBucketProcessor(*this, m_optCache)));
-	}
 	CqMultiJitteredSampler jitteredSampler(m_optCache.xSamps, m_optCache.ySamps);
 	CqGridSampler gridSampler(m_optCache.xSamps, m_optCache.ySamps);
 
@@ -705,65 +825,51 @@ void CqImageBuffer::RenderImage()
 
 	// Iterate over all buckets...
 	bool pendingBuckets = true;
-	while ( pendingBuckets && !m_fQuit )
+	while ( pendingBuckets && !isQuitting() )
 	{
-		CqThreadScheduler threadScheduler(numConcurrentBuckets);
-		std::vector<CqThreadProcessor> threadProcessors;
-
-		for (int i = 0; pendingBuckets && i < numConcurrentBuckets; ++i)
-		{
-			bucketProcessors[i]->setBucket(&CurrentBucket());
+		CqBucketProcessor* bucketProcessor = displayStage.acquire();
+		bucketProcessor->setBucket(&CurrentBucket());
 
-			// Prepare the bucket processor
-			bucketProcessors[i]->preProcess(sampler);
+		// Prepare the bucket processor
+		bucketProcessor->preProcess(sampler);
 
 #if ENABLE_MPDUMP
-			// Dump the pixel sample positions into a dump file
-			if(m_mpdump.IsOpen())
-				m_mpdump.dumpPixelSamples(*bucketProcessors[i]);
+		// Dump the pixel sample positions into a dump file
+		if(m_mpdump.IsOpen())
+			m_mpdump.dumpPixelSamples(*bucketProcessor);
 #endif
 
-			// Kick off a thread to process this bucket.
-			threadProcessors.push_back( CqThreadProcessor( bucketProcessors[i].get() ) );
-			threadScheduler.addWorkUnit( threadProcessors.back() );
+		bucketProcessor->process();
+		bucketProcessor->postProcess(&scheduler);
 
-			// Advance to next bucket, quit if nothing left
-			iBucket += 1;
-			pendingBuckets = NextBucket(order);
-		}
+		// Hand the finished bucket over to the display stage; the processor
+		// becomes free again once the bucket has been displayed.
+		displayStage.submit(bucketProcessor);
 
-		// Wait for all current buckets to complete before allocating more to the available threads.
-		threadScheduler.joinAll();
-		threadProcessors.clear();
+		// Advance to next bucket, quit if nothing left
+		iBucket += 1;
+		pendingBuckets = NextBucket(order);
 
-		for (int i = 0; !m_fQuit && i < numConcurrentBuckets; ++i)
+		if ( pProgressHandler )
 		{
-			bucketProcessors[i]->postProcess();
-			{
-				AQSIS_TIME_SCOPE(Display_bucket);
-				const CqBucket* bucket = bucketProcessors[i]->getBucket();
-				if (bucket)
-				{
-					QGetRenderContext() ->pDDmanager() ->DisplayBucket( bucketProcessors[i]->DisplayRegion(), &(bucketProcessors[i]->getChannelBuffer()) );
-				}
-			}
-			bucketProcessors[i]->reset();
-
-			if ( pProgressHandler )
-			{
-				// Inform the status class how far we have got, and update UI.
-				float Complete = (100.0f * iBucket) / static_cast<float> ( m_bucketRegion.area() );
-				QGetRenderContext() ->Stats().SetComplete( Complete );
-				( *pProgressHandler ) ( Complete, QGetRenderContext() ->CurrentFrame() );
-			}
+			// Inform the status class how far we have got, and update UI.
+			float Complete = (100.0f * iBucket) / static_cast<float> ( m_bucketRegion.area() );
+			QGetRenderContext() ->Stats().SetComplete( Complete );
+			( *pProgressHandler ) ( Complete, QGetRenderContext() ->CurrentFrame() );
+		}
 
 #ifdef WIN32
-			if ( !( iBucket % bucketmodulo ) )
-				SetProcessWorkingSetSize( GetCurrentProcess(), 0xffffffff, 0xffffffff );
+		if ( !( iBucket % bucketmodulo ) )
+			SetProcessWorkingSetSize( GetCurrentProcess(), 0xffffffff, 0xffffffff );
 #endif
-		}
 	}
 
+	// Wait for the display stage to catch up before the displays are closed.
+	displayStage.finish();
+
+	// No micropolygons should be left now, so rewind the pools' slabs.
+	CqMicroPolygon::ReleaseUnusedPools();
+
 	// Pass >100 through to progress to allow it to indicate completion.
 	if ( pProgressHandler )
 	{
@@ -778,9 +884,20 @@ void CqImageBuffer::RenderImage()
 
 void CqImageBuffer::Quit()
 {
+#ifdef ENABLE_THREADING
+	boost::mutex::scoped_lock lock(m_quitMutex);
+#endif
 	m_fQuit = true;
 }
 
+bool CqImageBuffer::isQuitting() const
+{
+#ifdef ENABLE_THREADING
+	boost::mutex::scoped_lock lock(m_quitMutex);
+#endif
+	return m_fQuit;
+}
+
 //----------------------------------------------------------------------
 /** Move to the next bucket to process.
 
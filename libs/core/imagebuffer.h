@@ -38,10 +38,15 @@
 #include	"mpdump.h"
 #include	"optioncache.h"
 
+#ifdef ENABLE_THREADING
+#include	<boost/thread/mutex.hpp>
+#endif
+
 namespace Aqsis {
 
 
 class CqMicroPolygon;
+class CqRasterGrid;
 
 
 // Enumeration of the type of rendering order of the buckets (experimental)
@@ -81,6 +86,9 @@ class CqImageBuffer
 	public:
 		CqImageBuffer() :
 				m_fQuit( false ),
+#ifdef ENABLE_THREADING
+				m_quitMutex(),
+#endif
 				m_cXBuckets( 0 ),
 				m_cYBuckets( 0 ),
 				m_CurrentBucketCol( 0 ),
@@ -89,6 +97,12 @@ class CqImageBuffer
 		~CqImageBuffer();
 
 		void AddMPG( boost::shared_ptr<CqMicroPolygon>& pmpgNew );
+		/** \brief Add a shaded static grid to the buckets it touches.
+		 *
+		 * The grid is queued whole, to be sampled by CqBucketProcessor
+		 * without busting it into individual micropolygons.
+		 */
+		void AddGrid( boost::shared_ptr<CqRasterGrid>& pGrid );
 		void PostSurface( const boost::shared_ptr<CqSurface>& pSurface );
 		/** \brief Repost a previously posted surface into the next unfinished bucket.
 		 *
@@ -106,6 +120,8 @@ class CqImageBuffer
 
 		void SetImage();
 		void Quit();
+		/// Check whether a quit has been requested; safe from any thread.
+		bool isQuitting() const;
 		void Release();
 
 		enum EqNeighbourLocation
@@ -130,6 +146,9 @@ class CqImageBuffer
 		}
 
 		bool	m_fQuit;			///< Set by system if a quit has been requested.
+#ifdef ENABLE_THREADING
+		mutable boost::mutex	m_quitMutex;	///< Protects m_fQuit.
+#endif
 
 		/** m_bucketRegion defines the set of non-cropped buckets.  The set of
 		 * valid buckets is from m_bucketRegion.xMin() to m_bucketRegion.xMax()-1
@@ -148,6 +167,14 @@ class CqImageBuffer
 		CqMPDump	m_mpdump;
 #endif
 
+		/** \brief Find the range of unfinished buckets touched by a raster bound.
+		 *
+		 * The bound is expanded by the filter width and for depth of field.
+		 * \return false if the bound lies outside the crop window or the
+		 *         bucket region, leaving the range undefined.
+		 */
+		bool	BucketRange( const CqBound& rasterBound, TqInt& iXBa, TqInt& iXBb,
+		                     TqInt& iYBa, TqInt& iYBb ) const;
 		bool	CullSurface( CqBound& Bound, const boost::shared_ptr<CqSurface>& pSurface );
 		void	DeleteImage();
 
@@ -48,7 +48,9 @@ CqImagePixel::CqImagePixel(TqInt xSamples, TqInt ySamples)
 		: m_XSamples(xSamples),
 		m_YSamples(ySamples),
 		m_samples(new SqSampleData[xSamples*ySamples]),
+		m_packedSamples(new TqFloat[4*xSamples*ySamples]),
 		m_hitSamples(),
+		m_deepFragments(),
 		m_DofOffsetIndices(new TqInt[xSamples*ySamples]),
 		m_refCount(0),
 		m_hasValidSamples(false)
@@ -62,6 +64,10 @@ CqImagePixel::CqImagePixel(TqInt xSamples, TqInt ySamples)
 	m_hitSamples.resize(nSamples*sampSize);
 	for(TqInt i = 0; i < nSamples; ++i)
 		m_samples[i].occludingHit.index = i*sampSize;
+	// Zero the packed positions and detail levels, and set the occluding
+	// depths to the maximum.
+	std::fill(&m_packedSamples[0], &m_packedSamples[3*nSamples], 0.0f);
+	std::fill(&m_packedSamples[3*nSamples], &m_packedSamples[4*nSamples], FLT_MAX);
 }
 
 void CqImagePixel::swap(CqImagePixel& other)
@@ -70,7 +76,9 @@ void CqImagePixel::swap(CqImagePixel& other)
 	assert(m_YSamples == other.m_YSamples);
 
 	m_hitSamples.swap(other.m_hitSamples);
+	m_deepFragments.swap(other.m_deepFragments);
 	m_samples.swap(other.m_samples);
+	m_packedSamples.swap(other.m_packedSamples);
 	m_DofOffsetIndices.swap(other.m_DofOffsetIndices);
 	m_hasValidSamples = other.m_hasValidSamples;
 }
@@ -90,14 +98,23 @@ void CqImagePixel::setupGridPattern(CqVector2D& offset, TqFloat opentime,
 				offset + CqVector2D(xScale*(i+0.5), yScale*(j+0.5));
 		}
 	}
+	TqFloat* posX = &m_packedSamples[0];
+	TqFloat* posY = &m_packedSamples[nSamples];
+	for(TqInt i = 0; i < nSamples; ++i)
+	{
+		posX[i] = m_samples[i].position.x();
+		posY[i] = m_samples[i].position.y();
+	}
 
 	// Fill in motion blur and LoD with the same regular grid
 	TqFloat dt = 1/nSamples;
 	TqFloat time = dt*0.5;
+	TqFloat* lods = &m_packedSamples[2*nSamples];
 	for(TqInt i = 0; i < nSamples; ++i)
 	{
 		m_samples[i].time = time;
 		m_samples[i].detailLevel = time;
+		lods[i] = time;
 		time += dt;
 	}
 }
@@ -107,6 +124,7 @@ void CqImagePixel::clear()
 	TqInt nSamples = numSamples();
 	TqInt sampSize = SqImageSample::sampleSize;
 	m_hitSamples.resize(nSamples*sampSize);
+	m_deepFragments.clear();
 	m_hasValidSamples = false;
 	for(TqInt i = 0; i < nSamples; ++i)
 	{
@@ -116,9 +134,9 @@ void CqImagePixel::clear()
 		// Reallocate the occluding samples, as their storage indices may have
 		// changed during the Combine() stage.
 		m_samples[i].occludingHit.index = i*sampSize;
-		// Reset the occluding depth to the maximum.
-		m_samples[i].occlZ = FLT_MAX;
 	}
+	// Reset the occluding depths to the maximum.
+	std::fill(sampleOcclZ(), sampleOcclZ() + nSamples, FLT_MAX);
 }
 
 
@@ -141,11 +159,30 @@ class CqAscendingDepthSort
 		}
 };
 
-void CqImagePixel::Combine( enum EqDepthFilter depthfilter, CqColor zThreshold )
+void CqImagePixel::addDeepFragment(const SqImageSample& hit, TqFloat weight)
+{
+	const TqFloat* data = sampleHitData(hit);
+	SqDeepFragment frag;
+	frag.depth = data[Sample_Depth];
+	for(TqInt i = 0; i < 3; ++i)
+	{
+		// Matte objects hold out whatever is behind them, so they are kept
+		// as black fragments with the opacity of the surface.
+		frag.color[i] = (hit.flags & SqImageSample::Flag_Matte) ? 0 : weight*data[Sample_Red + i];
+		frag.opacity[i] = weight*clamp(data[Sample_ORed + i], 0.0f, 1.0f);
+	}
+	m_deepFragments.push_back(frag);
+}
+
+void CqImagePixel::Combine( enum EqDepthFilter depthfilter, CqColor zThreshold,
+		bool gatherDeep )
 {
 	TqUint samplecount = 0;
 	TqInt sampleIndex = 0;
 	TqInt nSamples = numSamples();
+	TqFloat deepWeight = 1.0f/nSamples;
+	m_deepFragments.clear();
+	const TqFloat* occlZ = sampleOcclZ();
 	for(TqInt sampIdx = 0; sampIdx < nSamples; ++sampIdx)
 	{
 		SqSampleData& sampleData = m_samples[sampIdx];
@@ -188,10 +225,19 @@ void CqImagePixel::Combine( enum EqDepthFilter depthfilter, CqColor zThreshold )
 				while ( bProcessed );
 			}
 
+			// Record the hits before they're collapsed into the occluding
+			// entry, which overwrites the data of the front hit.
+			if(gatherDeep)
+			{
+				for ( std::vector<SqImageSample>::const_iterator sample = sampleData.data.begin();
+				        sample != sampleData.data.end(); ++sample )
+					addDeepFragment(*sample, deepWeight);
+			}
+
 			CqColor samplecolor;
 			CqColor sampleopacity;
 			bool samplehit = false;
-			TqFloat opaqueDepths[2] = { sampleData.occlZ, FLT_MAX };
+			TqFloat opaqueDepths[2] = { occlZ[sampIdx], FLT_MAX };
 			TqFloat maxOpaqueDepth = FLT_MAX;
 
 			for ( std::vector<SqImageSample>::reverse_iterator sample = sampleData.data.rbegin();
@@ -304,6 +350,8 @@ void CqImagePixel::Combine( enum EqDepthFilter depthfilter, CqColor zThreshold )
 		{
 			if (occlHit.flags & SqImageSample::Flag_Valid)
 			{
+				if(gatherDeep)
+					addDeepFragment(occlHit, deepWeight);
 				TqFloat* occlData = sampleHitData(occlHit);
 				if(occlHit.flags & SqImageSample::Flag_Matte)
 				{
@@ -323,7 +371,7 @@ void CqImagePixel::Combine( enum EqDepthFilter depthfilter, CqColor zThreshold )
 					// represents one surface *behind* the opaque depth in this
 					// case.
 					occlData[Sample_Depth] = 0.5*(occlData[Sample_Depth]
-					                              + sampleData.occlZ);
+					                              + occlZ[sampIdx]);
 				}
 				samplecount++;
 			}
@@ -331,7 +379,8 @@ void CqImagePixel::Combine( enum EqDepthFilter depthfilter, CqColor zThreshold )
 	}
 }
 
-void CqImagePixel::setSamples(IqSampler* sampler, CqVector2D& offset)
+void CqImagePixel::setSamples(IqSampler* sampler, CqVector2D& offset,
+		TqFloat opentime, TqFloat closetime)
 {
 	TqInt nSamps = numSamples();
 
@@ -346,15 +395,18 @@ void CqImagePixel::setSamples(IqSampler* sampler, CqVector2D& offset)
 	const TqFloat* times = sampler->get1DSamples();
 	const TqFloat* lods = sampler->get1DSamples();
 
-	TqFloat opentime = QGetRenderContext() ->poptCurrent()->GetFloatOption( "System", "Shutter" ) [ 0 ];
-	TqFloat closetime = QGetRenderContext() ->poptCurrent()->GetFloatOption( "System", "Shutter" ) [ 1 ];
-
+	TqFloat* posX = &m_packedSamples[0];
+	TqFloat* posY = &m_packedSamples[nSamps];
+	TqFloat* detailLevels = &m_packedSamples[2*nSamps];
 	for(TqInt i = 0; i < nSamps; ++i)
 	{
 		m_samples[i].position = offset + positions[i];
 		m_samples[i].time = ( closetime - opentime ) * times[i] + opentime;
 		m_samples[i].detailLevel = lods[i];
 		m_samples[m_DofOffsetIndices[i]].dofOffset = projectToCircle( -1 + 2 * (dofOffsets[i]) );
+		posX[i] = m_samples[i].position.x();
+		posY[i] = m_samples[i].position.y();
+		detailLevels[i] = lods[i];
 	}
 }
 
@@ -38,6 +38,7 @@
 #include	<aqsis/math/color.h>
 #include	<aqsis/math/vector2d.h>
 #include	"csgtree.h"
+#include	"iddmanager.h"
 #include	"optioncache.h"
 #include	"isampler.h"
 
@@ -138,15 +139,8 @@ struct SqSampleData : private boost::noncopyable
 	 * 3) The z depthfilter is "min" or "midpoint" (midpoint uses special case code).
 	 */
 	SqImageSample occludingHit;
-	/** \brief Occluding depth.
-	 *
-	 * This should be the same as the depth in occludingHit, *except* when a
-	 * depth filter mode not equal to "min" is enabled.  (ie, the "midpoint"
-	 * or other more exotic depth filters)
-	 */
-	TqFloat occlZ;
 
-	/// Default construct members & set numeric members to 0 except occlZ=FLT_MAX.
+	/// Default construct members & set numeric members to 0.
 	SqSampleData();
 };
 
@@ -249,8 +243,19 @@ class CqImagePixel : private boost::noncopyable
 		 *  \param eDepthFilter - The filter to use to combine depth values.
 		 *  \param zThreshold - The color value at which to consider a sample opaque
 		 *  					when sampling depth.
+		 *  \param gatherDeep - If true, a fragment for each sample hit is
+		 *  					recorded before the hits are combined; see
+		 *  					deepFragments().
 		 */
-		void	Combine( EqDepthFilter eDepthFilter, CqColor zThreshold );
+		void	Combine( EqDepthFilter eDepthFilter, CqColor zThreshold,
+				bool gatherDeep = false );
+		/** \brief Get the fragments recorded by the last call to Combine().
+		 *
+		 * There is one fragment for each sample hit, in no particular order,
+		 * weighted by the fraction of the pixel covered by its sample.  The
+		 * list is empty unless Combine() was asked to gather them.
+		 */
+		const std::vector<SqDeepFragment>& deepFragments() const;
 
 		/** \brief Get the sample data for the specified sample index.
 		 *
@@ -266,6 +271,31 @@ class CqImagePixel : private boost::noncopyable
 		 */
 		SqSampleData& SampleData( TqInt index );
 
+		//@{
+		/** \brief Get the sample positions as separate x and y arrays.
+		 *
+		 * These hold the same positions as SampleData(i).position, packed
+		 * into contiguous arrays so that loops over the samples of a pixel
+		 * can run with unit stride.
+		 */
+		const TqFloat* samplePosX() const;
+		const TqFloat* samplePosY() const;
+		//@}
+		/// Get the level of detail values of all samples as an array.
+		const TqFloat* sampleDetailLevels() const;
+
+		//@{
+		/** \brief Get the occluding depths of all samples as an array.
+		 *
+		 * The occluding depth for a sample should be the same as the depth in
+		 * its occludingHit, *except* when a depth filter mode not equal to
+		 * "min" is enabled.  (ie, the "midpoint" or other more exotic depth
+		 * filters)
+		 */
+		const TqFloat* sampleOcclZ() const;
+		TqFloat* sampleOcclZ();
+		//@}
+
 		/// Get the number of samples in the contained within the pixel.
 		TqInt numSamples() const;
 
@@ -299,8 +329,11 @@ class CqImagePixel : private boost::noncopyable
 		 *
 		 *  \param sampler - A pointer to an object that provides a sample distribution
 		 *					 via the IqSampler interface.
+		 *  \param opentime - The motion blur shutter open time.
+		 *  \param closetime - The motion blur shutter close time.
 		 */
-		void setSamples(IqSampler* sampler, CqVector2D& offset);
+		void setSamples(IqSampler* sampler, CqVector2D& offset,
+				TqFloat opentime, TqFloat closetime);
 
 	private:
 		/// boost::intrusive_ptr required function, to increment the reference count.
@@ -309,14 +342,23 @@ class CqImagePixel : private boost::noncopyable
 		/// and delete if necessary.
 		friend		void intrusive_ptr_release(CqImagePixel* p);
 
+		/// Record the fragment for a sample hit, weighted by weight.
+		void addDeepFragment(const SqImageSample& hit, TqFloat weight);
+
 		/// The number of samples in the horizontal direction.
 		TqInt m_XSamples;
 		/// The number of samples in the vertical direction.
 		TqInt m_YSamples;
 		/// Array of sample positions within this pixel
 		boost::scoped_array<SqSampleData> m_samples;
+		/** Packed per-sample arrays, laid out as numSamples() x positions, then
+		 * y positions, detail levels and occluding depths.
+		 */
+		boost::scoped_array<TqFloat> m_packedSamples;
 		/// Vector storing sample data for the sample hits within the pixel.
 		std::vector<TqFloat> m_hitSamples;
+		/// Fragments for the sample hits, gathered by Combine() for deep output.
+		std::vector<SqDeepFragment> m_deepFragments;
 		/// A mapping from dof bounding-box index to the sample that contains a
 		/// dof offset in that bb.
 		boost::scoped_array<TqInt> m_DofOffsetIndices;
@@ -399,8 +441,7 @@ inline SqSampleData::SqSampleData()
 	time(0),
 	detailLevel(0),
 	data(),
-	occludingHit(),
-	occlZ(FLT_MAX)
+	occludingHit()
 { }
 
 
@@ -478,6 +519,36 @@ inline void CqImagePixel::allocateHitData(SqImageSample& hit)
 	m_hitSamples.resize(m_hitSamples.size() + SqImageSample::sampleSize);
 }
 
+inline const TqFloat* CqImagePixel::samplePosX() const
+{
+	return &m_packedSamples[0];
+}
+
+inline const TqFloat* CqImagePixel::samplePosY() const
+{
+	return &m_packedSamples[numSamples()];
+}
+
+inline const TqFloat* CqImagePixel::sampleDetailLevels() const
+{
+	return &m_packedSamples[2*numSamples()];
+}
+
+inline const TqFloat* CqImagePixel::sampleOcclZ() const
+{
+	return &m_packedSamples[3*numSamples()];
+}
+
+inline TqFloat* CqImagePixel::sampleOcclZ()
+{
+	return &m_packedSamples[3*numSamples()];
+}
+
+inline const std::vector<SqDeepFragment>& CqImagePixel::deepFragments() const
+{
+	return m_deepFragments;
+}
+
 inline SqSampleData const& CqImagePixel::SampleData( TqInt index ) const
 {
 	assert(index < numSamples());
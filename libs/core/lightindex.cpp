@@ -0,0 +1,270 @@
+// Aqsis
+// Copyright (C) 1997 - 2001, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+/** \file
+		\brief Spatial index of lightsource influence volumes.
+*/
+
+#include	"lightindex.h"
+
+#include	<algorithm>
+#include	<cfloat>
+#include	<cmath>
+
+#include	<aqsis/math/math.h>
+
+namespace Aqsis {
+
+namespace {
+
+/// Nodes with at most this many lights are leaves.
+const TqInt maxLeafSize = 4;
+/// Size of the traversal stack; the tree is balanced so this is plenty.
+const TqInt stackSize = 64;
+
+/// Determine whether the boxes [amin,amax] and [bmin,bmax] overlap.
+inline bool boxesOverlap(const TqFloat amin[3], const TqFloat amax[3],
+		const CqVector3D& bmin, const CqVector3D& bmax)
+{
+	return amin[0] <= bmax.x() && amax[0] >= bmin.x()
+		&& amin[1] <= bmax.y() && amax[1] >= bmin.y()
+		&& amin[2] <= bmax.z() && amax[2] >= bmin.z();
+}
+
+/// Order lights by the position of their sphere along an axis.
+struct SqCentreLess
+{
+	TqInt axis;
+	SqCentreLess(TqInt axis) : axis(axis) {}
+	template<typename EntryT>
+	bool operator()(const EntryT& a, const EntryT& b) const
+	{
+		return a.volume.centre[axis] < b.volume.centre[axis];
+	}
+};
+
+} // unnamed namespace
+
+
+//------------------------------------------------------------------------------
+// SqLightVolume
+
+SqLightVolume::SqLightVolume()
+	: centre(0, 0, 0),
+	radius(-1),
+	coneApex(0, 0, 0),
+	coneAxis(0, 0, 1),
+	coneAngle(-1)
+{ }
+
+bool SqLightVolume::touches(const CqVector3D& boxMin,
+		const CqVector3D& boxMax) const
+{
+	if(radius >= 0)
+	{
+		// Squared distance from the centre to the closest point of the box.
+		TqFloat dist2 = 0;
+		for(TqInt i = 0; i < 3; ++i)
+		{
+			TqFloat d = max(boxMin[i] - centre[i], centre[i] - boxMax[i]);
+			if(d > 0)
+				dist2 += d*d;
+		}
+		if(dist2 > radius*radius)
+			return false;
+	}
+	if(coneAngle >= 0 && coneAngle < M_PI)
+	{
+		// Test the bounding sphere of the box against the cone: the sphere is
+		// outside if the angle from the axis to the sphere centre, less the
+		// angle subtended by the sphere, exceeds the cone angle.
+		CqVector3D boxCentre = 0.5f*(boxMin + boxMax);
+		TqFloat boxRadius = 0.5f*(boxMax - boxMin).Magnitude();
+		CqVector3D toBox = boxCentre - coneApex;
+		TqFloat dist = toBox.Magnitude();
+		if(dist > boxRadius)
+		{
+			TqFloat cosAxis = clamp((toBox*coneAxis)/dist, -1.0f, 1.0f);
+			TqFloat axisAngle = std::acos(cosAxis);
+			TqFloat sphereAngle = std::asin(boxRadius/dist);
+			if(axisAngle - sphereAngle > coneAngle)
+				return false;
+		}
+	}
+	return true;
+}
+
+
+//------------------------------------------------------------------------------
+// CqLightIndex
+
+CqLightIndex::CqLightIndex()
+	: m_spheres(),
+	m_cones(),
+	m_nodes(),
+	m_lights()
+{ }
+
+void CqLightIndex::clear()
+{
+	m_spheres.clear();
+	m_cones.clear();
+	m_nodes.clear();
+	m_lights.clear();
+}
+
+void CqLightIndex::addLight(const IqLightsource* light,
+		const SqLightVolume& volume)
+{
+	SqEntry entry;
+	entry.light = light;
+	entry.volume = volume;
+	if(volume.radius >= 0)
+		m_spheres.push_back(entry);
+	else if(volume.coneAngle >= 0 && volume.coneAngle < M_PI)
+		m_cones.push_back(entry);
+	else
+		return;
+	m_lights.push_back(light);
+}
+
+void CqLightIndex::build()
+{
+	std::sort(m_lights.begin(), m_lights.end());
+	m_nodes.clear();
+	TqInt numSpheres = m_spheres.size();
+	if(numSpheres == 0)
+		return;
+	// A tree over n lights has at most 2n-1 nodes.
+	m_nodes.reserve(2*numSpheres);
+	m_nodes.resize(1);
+	buildNode(0, 0, numSpheres);
+	std::vector<SqNode>(m_nodes).swap(m_nodes);
+}
+
+void CqLightIndex::buildNode(TqInt nodeIndex, TqInt begin, TqInt end)
+{
+	// Bound the spheres, and their centres.
+	TqFloat bmin[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+	TqFloat bmax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+	TqFloat cmin[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+	TqFloat cmax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+	for(TqInt i = begin; i < end; ++i)
+	{
+		const SqLightVolume& vol = m_spheres[i].volume;
+		for(TqInt j = 0; j < 3; ++j)
+		{
+			bmin[j] = min(bmin[j], vol.centre[j] - vol.radius);
+			bmax[j] = max(bmax[j], vol.centre[j] + vol.radius);
+			cmin[j] = min(cmin[j], vol.centre[j]);
+			cmax[j] = max(cmax[j], vol.centre[j]);
+		}
+	}
+	SqNode& node = m_nodes[nodeIndex];
+	for(TqInt j = 0; j < 3; ++j)
+	{
+		node.bmin[j] = bmin[j];
+		node.bmax[j] = bmax[j];
+	}
+	if(end - begin <= maxLeafSize)
+	{
+		node.offset = begin;
+		node.count = end - begin;
+		return;
+	}
+
+	// Split at the median along the widest axis of the centres.
+	TqInt axis = 0;
+	for(TqInt j = 1; j < 3; ++j)
+	{
+		if(cmax[j] - cmin[j] > cmax[axis] - cmin[axis])
+			axis = j;
+	}
+	TqInt mid = (begin + end)/2;
+	std::nth_element(m_spheres.begin() + begin, m_spheres.begin() + mid,
+			m_spheres.begin() + end, SqCentreLess(axis));
+
+	TqInt firstChild = m_nodes.size();
+	node.offset = firstChild;
+	node.count = 0;
+	// Note that node is invalidated by the resize when the vector grows.
+	m_nodes.resize(firstChild + 2);
+	buildNode(firstChild, begin, mid);
+	buildNode(firstChild + 1, mid, end);
+}
+
+TqInt CqLightIndex::cullLights(const CqVector3D& boxMin,
+		const CqVector3D& boxMax, const IqLightsource** lights,
+		TqInt count) const
+{
+	if(m_lights.empty())
+		return 0;
+
+	// Collect the held lights which may reach the box.
+	std::vector<const IqLightsource*> reached;
+	if(!m_nodes.empty())
+	{
+		TqInt stack[stackSize];
+		TqInt stackTop = 0;
+		stack[stackTop++] = 0;
+		while(stackTop > 0)
+		{
+			const SqNode& node = m_nodes[stack[--stackTop]];
+			if(!boxesOverlap(node.bmin, node.bmax, boxMin, boxMax))
+				continue;
+			if(node.count > 0)
+			{
+				for(TqInt i = node.offset, end = node.offset + node.count;
+						i < end; ++i)
+				{
+					if(m_spheres[i].volume.touches(boxMin, boxMax))
+						reached.push_back(m_spheres[i].light);
+				}
+			}
+			else
+			{
+				stack[stackTop++] = node.offset;
+				stack[stackTop++] = node.offset + 1;
+			}
+		}
+	}
+	for(std::vector<SqEntry>::const_iterator i = m_cones.begin(),
+			end = m_cones.end(); i != end; ++i)
+	{
+		if(i->volume.touches(boxMin, boxMax))
+			reached.push_back(i->light);
+	}
+	std::sort(reached.begin(), reached.end());
+
+	TqInt numCulled = 0;
+	for(TqInt i = 0; i < count; ++i)
+	{
+		if(lights[i]
+			&& std::binary_search(m_lights.begin(), m_lights.end(), lights[i])
+			&& !std::binary_search(reached.begin(), reached.end(), lights[i]))
+		{
+			lights[i] = 0;
+			++numCulled;
+		}
+	}
+	return numCulled;
+}
+
+} // namespace Aqsis
@@ -0,0 +1,157 @@
+// Aqsis
+// Copyright (C) 1997 - 2001, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+/** \file
+		\brief Spatial index of lightsource influence volumes, used to cull
+		lights which can't reach a grid.
+*/
+
+#ifndef LIGHTINDEX_H_INCLUDED
+#define LIGHTINDEX_H_INCLUDED
+
+#include	<aqsis/aqsis.h>
+
+#include	<vector>
+
+#include	<aqsis/math/vector3d.h>
+
+namespace Aqsis {
+
+class IqLightsource;
+
+/** \brief The region of space which a lightsource can illuminate.
+ *
+ * The region is the intersection of an optional sphere and an optional
+ * infinite cone; a volume with neither is unbounded.  All positions are in
+ * "current" space.
+ */
+struct SqLightVolume
+{
+	/// Centre of the sphere of influence.
+	CqVector3D centre;
+	/// Radius of the sphere of influence, or negative if there's no sphere.
+	TqFloat radius;
+	/// Apex of the cone of influence.
+	CqVector3D coneApex;
+	/// Unit axis of the cone.
+	CqVector3D coneAxis;
+	/// Half angle of the cone in radians, or negative if there's no cone.
+	TqFloat coneAngle;
+
+	/// Construct an unbounded volume.
+	SqLightVolume();
+
+	/// Determine whether the volume is limited at all.
+	bool isBounded() const;
+	/** \brief Determine whether the volume might touch a box.
+	 *
+	 * The test is conservative: it may return true for boxes just outside
+	 * the volume, but never false for a box which overlaps it.
+	 */
+	bool touches(const CqVector3D& boxMin, const CqVector3D& boxMax) const;
+};
+
+
+/** \brief Index of lightsource influence volumes.
+ *
+ * Lights with a bounded sphere of influence are held in a bounding volume
+ * hierarchy over their spheres, so that the lights near a grid may be found
+ * without visiting every light in the scene.  Lights limited only by a cone
+ * have no finite bound and are tested one by one.  Lights with unbounded
+ * volumes are never culled and needn't be added at all.
+ */
+class CqLightIndex
+{
+	public:
+		CqLightIndex();
+
+		/// Remove all lights.
+		void clear();
+		/// Add a light with the given influence volume.
+		void addLight(const IqLightsource* light, const SqLightVolume& volume);
+		/// Build the index over all lights added so far.
+		void build();
+
+		/// Number of lights which may be culled.
+		TqInt numLights() const;
+
+		/** \brief Remove lights which can't illuminate a box.
+		 *
+		 * Entries of lights which can't reach any point in the box are set
+		 * to null.  Lights which weren't added to the index are left alone.
+		 *
+		 * \param boxMin, boxMax - corners of the box, in "current" space.
+		 * \param lights - lights to test.
+		 * \param count - length of the lights array.
+		 * \return the number of lights culled.
+		 */
+		TqInt cullLights(const CqVector3D& boxMin, const CqVector3D& boxMax,
+				const IqLightsource** lights, TqInt count) const;
+
+	private:
+		/// A light and its volume.
+		struct SqEntry
+		{
+			const IqLightsource* light;
+			SqLightVolume volume;
+		};
+		/** \brief Tree node.
+		 *
+		 * For interior nodes count is zero and offset is the index of the
+		 * first child; the second child follows it.  For leaves offset is the
+		 * index of the first entry and count the number of entries.
+		 */
+		struct SqNode
+		{
+			TqFloat bmin[3];
+			TqInt offset;
+			TqFloat bmax[3];
+			TqInt count;
+		};
+
+		void buildNode(TqInt nodeIndex, TqInt begin, TqInt end);
+
+		/// Lights bounded by a sphere, in leaf order once built.
+		std::vector<SqEntry> m_spheres;
+		/// Lights bounded only by a cone.
+		std::vector<SqEntry> m_cones;
+		/// Tree nodes over m_spheres; the root is node zero.
+		std::vector<SqNode> m_nodes;
+		/// All lights held, sorted by address.
+		std::vector<const IqLightsource*> m_lights;
+};
+
+
+//==============================================================================
+// Implementation details
+//==============================================================================
+inline bool SqLightVolume::isBounded() const
+{
+	return radius >= 0 || coneAngle >= 0;
+}
+
+inline TqInt CqLightIndex::numLights() const
+{
+	return m_lights.size();
+}
+
+} // namespace Aqsis
+
+#endif // LIGHTINDEX_H_INCLUDED
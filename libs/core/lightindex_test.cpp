@@ -0,0 +1,122 @@
+// Aqsis
+// Copyright (C) 1997 - 2007, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+/** \file
+ *
+ * \brief Unit tests for the light influence index
+ */
+
+#include "lightindex.h"
+
+#include <cmath>
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/auto_unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(lightindex_tests)
+
+using namespace Aqsis;
+
+namespace {
+
+// The index only compares light addresses, so any distinct addresses will do.
+const IqLightsource* fakeLight(const char* storage, TqInt i)
+{
+	return reinterpret_cast<const IqLightsource*>(storage + i);
+}
+
+SqLightVolume sphereVolume(const CqVector3D& centre, TqFloat radius)
+{
+	SqLightVolume vol;
+	vol.centre = centre;
+	vol.radius = radius;
+	return vol;
+}
+
+} // unnamed namespace
+
+BOOST_AUTO_TEST_CASE(lightvolume_touches_test)
+{
+	SqLightVolume unbounded;
+	BOOST_CHECK(!unbounded.isBounded());
+	BOOST_CHECK(unbounded.touches(CqVector3D(100,100,100), CqVector3D(101,101,101)));
+
+	SqLightVolume sphere = sphereVolume(CqVector3D(0,0,0), 2);
+	BOOST_CHECK(sphere.isBounded());
+	BOOST_CHECK(sphere.touches(CqVector3D(1,1,1), CqVector3D(3,3,3)));
+	BOOST_CHECK(!sphere.touches(CqVector3D(1.5,1.5,1.5), CqVector3D(3,3,3)));
+	BOOST_CHECK(sphere.touches(CqVector3D(-5,-1,-1), CqVector3D(5,1,1)));
+
+	// A 30 degree cone looking down +z.
+	SqLightVolume cone;
+	cone.coneApex = CqVector3D(0,0,0);
+	cone.coneAxis = CqVector3D(0,0,1);
+	cone.coneAngle = M_PI/6;
+	BOOST_CHECK(cone.isBounded());
+	BOOST_CHECK(cone.touches(CqVector3D(-1,-1,10), CqVector3D(1,1,11)));
+	BOOST_CHECK(!cone.touches(CqVector3D(-1,-1,-11), CqVector3D(1,1,-10)));
+	BOOST_CHECK(!cone.touches(CqVector3D(10,-1,1), CqVector3D(11,1,2)));
+	// Boxes containing the apex always touch.
+	BOOST_CHECK(cone.touches(CqVector3D(-1,-1,-1), CqVector3D(1,1,1)));
+}
+
+BOOST_AUTO_TEST_CASE(lightindex_cull_test)
+{
+	// A row of lights along x with radius 1, spaced 4 apart.
+	const TqInt numLights = 50;
+	char storage[numLights + 2];
+	CqLightIndex index;
+	for(TqInt i = 0; i < numLights; ++i)
+		index.addLight(fakeLight(storage, i), sphereVolume(CqVector3D(4*i, 0, 0), 1));
+	// An unbounded light isn't held, so is never culled.
+	const IqLightsource* unboundedLight = fakeLight(storage, numLights);
+	index.addLight(unboundedLight, SqLightVolume());
+	// Nor is a light which was never added.
+	const IqLightsource* otherLight = fakeLight(storage, numLights + 1);
+	index.build();
+	BOOST_CHECK_EQUAL(index.numLights(), numLights);
+
+	std::vector<const IqLightsource*> lights;
+	for(TqInt i = 0; i < numLights; ++i)
+		lights.push_back(fakeLight(storage, i));
+	lights.push_back(unboundedLight);
+	lights.push_back(otherLight);
+
+	// A box around the lights at x = 20 and x = 24.
+	TqInt numCulled = index.cullLights(CqVector3D(19.5, -0.5, -0.5),
+			CqVector3D(24.5, 0.5, 0.5), &lights[0], lights.size());
+	BOOST_CHECK_EQUAL(numCulled, numLights - 2);
+	for(TqInt i = 0; i < numLights; ++i)
+		BOOST_CHECK_EQUAL(lights[i] != 0, i == 5 || i == 6);
+	BOOST_CHECK(lights[numLights] == unboundedLight);
+	BOOST_CHECK(lights[numLights + 1] == otherLight);
+}
+
+BOOST_AUTO_TEST_CASE(lightindex_empty_test)
+{
+	CqLightIndex index;
+	index.build();
+	char storage[1];
+	const IqLightsource* lights[1] = {fakeLight(storage, 0)};
+	BOOST_CHECK_EQUAL(index.cullLights(CqVector3D(0,0,0), CqVector3D(1,1,1),
+				lights, 1), 0);
+	BOOST_CHECK(lights[0] != 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
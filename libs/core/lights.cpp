@@ -25,6 +25,7 @@
 
 #include	<aqsis/aqsis.h>
 #include	"lights.h"
+#include	<cmath>
 #include	<aqsis/util/file.h>
 #include	"renderer.h"
 
@@ -83,7 +84,7 @@ void CqLightsource::Initialise( TqInt uGridRes, TqInt vGridRes, TqInt microPolyg
 	if ( USES( Uses, EnvVars_P ) )
 	{
 		CqMatrix mat;
-		QGetRenderContext() ->matSpaceToSpace( "shader", "current", m_pShader->getTransform(), NULL, QGetRenderContextI()->Time(), mat );
+		QGetRenderContext() ->matSpaceToSpace( Space_Shader, Space_Camera, m_pShader->getTransform(), NULL, QGetRenderContextI()->Time(), mat );
 		P() ->SetPoint( mat * CqVector3D( 0.0f, 0.0f, 0.0f ) );
 	}
 	if ( USES( Uses, EnvVars_u ) )
@@ -104,6 +105,69 @@ void CqLightsource::Initialise( TqInt uGridRes, TqInt vGridRes, TqInt microPolyg
 
 
 
+//---------------------------------------------------------------------
+/** Compute the region of space the light can illuminate.
+ *
+ * The sphere of influence comes from the "light" "influenceradius" attribute,
+ * measured in shader space about the "from" shader parameter, or about the
+ * shader space origin if there's no such parameter.  When the "light"
+ * "conecull" attribute is nonzero, shaders with the "from", "to" and
+ * "coneangle" parameters of the standard spotlight are also taken to
+ * illuminate only within that cone.  Ambient and moving lights are always
+ * unbounded.
+ */
+SqLightVolume CqLightsource::influenceVolume() const
+{
+	SqLightVolume volume;
+	if ( !m_pShader || m_pShader->fAmbient() )
+		return ( volume );
+	const IqTransform* shaderTrans = m_pShader->getTransform();
+	if ( shaderTrans && shaderTrans->cTimes() > 1 )
+		return ( volume );
+
+	CqMatrix mat;
+	QGetRenderContext() ->matSpaceToSpace( Space_Shader, Space_Camera, shaderTrans, NULL, QGetRenderContextI()->Time(), mat );
+	CqVector3D from = mat * CqVector3D( 0.0f, 0.0f, 0.0f );
+	IqShaderData* fromArg = m_pShader->FindArgument( "from" );
+	bool hasFrom = fromArg && fromArg->Type() == type_point && fromArg->ArrayLength() == 0;
+	if ( hasFrom )
+		fromArg->GetPoint( from, 0 );
+
+	const TqFloat* radius = m_pAttributes->GetFloatAttribute( "light", "influenceradius" );
+	if ( radius && radius[ 0 ] >= 0 )
+	{
+		// The norm of the matrix bounds how far it can stretch the radius.
+		TqFloat scale2 = 0;
+		for ( TqInt i = 0; i < 3; ++i )
+			for ( TqInt j = 0; j < 3; ++j )
+				scale2 += mat[ i ][ j ] * mat[ i ][ j ];
+		volume.centre = from;
+		volume.radius = radius[ 0 ] * std::sqrt( scale2 );
+	}
+
+	const TqInt* coneCull = m_pAttributes->GetIntegerAttribute( "light", "conecull" );
+	IqShaderData* toArg = m_pShader->FindArgument( "to" );
+	IqShaderData* angleArg = m_pShader->FindArgument( "coneangle" );
+	if ( hasFrom && coneCull && coneCull[ 0 ] != 0
+		&& toArg && toArg->Type() == type_point && toArg->ArrayLength() == 0
+		&& angleArg && angleArg->Type() == type_float && angleArg->ArrayLength() == 0 )
+	{
+		CqVector3D to;
+		toArg->GetPoint( to, 0 );
+		TqFloat angle;
+		angleArg->GetFloat( angle, 0 );
+		CqVector3D axis = to - from;
+		if ( axis.Magnitude() > 0 && angle >= 0 )
+		{
+			axis.Unit();
+			volume.coneApex = from;
+			volume.coneAxis = axis;
+			volume.coneAngle = angle;
+		}
+	}
+	return ( volume );
+}
+
 //---------------------------------------------------------------------
 //---------------------------------------------------------------------
 //---------------------------------------------------------------------
@@ -44,6 +44,7 @@
 #include <aqsis/version.h>
 #include <aqsis/core/ilightsource.h>
 #include "attributes.h"
+#include "lightindex.h"
 #include "transform.h"
 
 namespace Aqsis {
@@ -100,6 +101,12 @@ class CqLightsource : public IqLightsource, public boost::enable_shared_from_thi
 		{
 			return ( m_pAttributes );
 		}
+		/** \brief Get the region of space which the light can illuminate.
+		 *
+		 * The volume is in "current" space, so may only be computed once the
+		 * shader parameters have been initialised for rendering.
+		 */
+		SqLightVolume	influenceVolume() const;
 
 		/** Get a pointer to the transformation state associated with this GPrim.
 		 * \return A pointer to a CqTransform class.
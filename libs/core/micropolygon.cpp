@@ -36,18 +36,70 @@
 #include	"bucketprocessor.h"
 
 #include	"mpdump.h"
+#include	"points.h"
+
+#ifdef __SSE__
+#include	<xmmintrin.h>
+#endif
 
 namespace Aqsis {
 
+namespace {
+
+// Attributes and options read for every grid or micropolygon.
+const CqParamKey keyMatte( "System", "Matte" );
+const CqParamKey keyShadingInterpolation( "System", "ShadingInterpolation" );
+const CqParamKey keyLevelOfDetailBounds( "System", "LevelOfDetailBounds" );
+const CqParamKey keyOrientation( "System", "Orientation" );
+const CqParamKey keySides( "System", "Sides" );
+const CqParamKey keyExpandGrids( "aqsis", "expandgrids" );
+const CqParamKey keyCullBackfacing( "cull", "backfacing" );
+const CqParamKey keyTrimSense( "trimcurve", "sense" );
+const CqParamKey keyProjection( "System", "Projection" );
+const CqParamKey keyShutter( "System", "Shutter" );
+
+/// Get the attributes of a grid, for lookups by key.
+inline const CqAttributes& keyAttributes( const IqConstAttributesPtr& attrs )
+{
+	return *static_cast<const CqAttributes*>( attrs.get() );
+}
+
+/// Get the current options, for lookups by key.
+inline const CqOptions& keyOptions()
+{
+	return static_cast<const CqOptions&>( *QGetRenderContext()->poptCurrent() );
+}
+
+} // unnamed namespace
 
-CqObjectPool<CqMicroPolygon> CqMicroPolygon::m_thePool;
-CqObjectPool<CqMovingMicroPolygonKey>	CqMovingMicroPolygonKey::m_thePool;
+
+CqThreadLocalPool<CqMicroPolygon> CqMicroPolygon::m_thePool;
+CqThreadLocalPool<CqMovingMicroPolygonKey>	CqMovingMicroPolygonKey::m_thePool;
+
+void CqMicroPolygon::ReleaseUnusedPools()
+{
+	m_thePool.releaseUnused();
+	CqMovingMicroPolygonKey::m_thePool.releaseUnused();
+	CqMicroPolygonPoints::m_thePool.releaseUnused();
+	CqMovingMicroPolygonKeyPoints::m_thePool.releaseUnused();
+	CqMicroPolygonMotionPoints::m_thePool.releaseUnused();
+}
+
+SqPoolStats CqMicroPolygon::PoolStats()
+{
+	SqPoolStats stats = m_thePool.stats();
+	stats += CqMovingMicroPolygonKey::m_thePool.stats();
+	stats += CqMicroPolygonPoints::m_thePool.stats();
+	stats += CqMovingMicroPolygonKeyPoints::m_thePool.stats();
+	stats += CqMicroPolygonMotionPoints::m_thePool.stats();
+	return stats;
+}
 
 void CqMicroPolyGridBase::CacheGridInfo(const boost::shared_ptr<const CqSurface>& surface)
 {
-	const IqAttributes& attrs = *pAttributes();
+	const CqAttributes& attrs = keyAttributes(pAttributes());
 	// Determine the matte flag type.
-	switch(attrs.GetIntegerAttribute("System", "Matte")[0])
+	switch(attrs.GetIntegerAttribute(keyMatte)[0])
 	{
 		case 0:  m_CurrentGridInfo.matteFlag = 0;                              break;
 		default: m_CurrentGridInfo.matteFlag = SqImageSample::Flag_Matte;      break;
@@ -55,14 +107,14 @@ void CqMicroPolyGridBase::CacheGridInfo(const boost::shared_ptr<const CqSurface>
 	}
 
 	// Cache the shading interpolation type.
-	m_CurrentGridInfo.useSmoothShading = attrs.GetIntegerAttribute("System",
-			"ShadingInterpolation")[0] == ShadingInterp_Smooth;
+	m_CurrentGridInfo.useSmoothShading = attrs.GetIntegerAttribute(
+			keyShadingInterpolation)[0] == ShadingInterp_Smooth;
 
 	m_CurrentGridInfo.usesDataMap
 		= !(QGetRenderContext() ->GetMapOfOutputDataEntries().empty());
 
 	m_CurrentGridInfo.lodBounds
-		= attrs.GetFloatAttribute("System", "LevelOfDetailBounds");
+		= attrs.GetFloatAttribute(keyLevelOfDetailBounds);
 }
 
 
@@ -76,11 +128,8 @@ CqMicroPolyGrid::CqMicroPolyGrid() : CqMicroPolyGridBase(),
 		m_pShaderExecEnv(IqShaderExecEnv::create(QGetRenderContextI()))
 {
 	STATS_INC( GRD_allocated );
-	STATS_INC( GRD_current );
+	STATS_INC_PEAK( GRD_current, GRD_peak );
 	STATS_INC( GRD_allocated );
-	TqInt cGRD = STATS_GETI( GRD_current );
-	TqInt cPeak = STATS_GETI( GRD_peak );
-	STATS_SETI( GRD_peak, cGRD > cPeak ? cGRD : cPeak );
 }
 
 
@@ -178,7 +227,7 @@ void CqMicroPolyGrid::CalcNormals()
 	// of the cross product must be reversed if the formula is to give the
 	// correct normal after RiScale(1,1,-1) or similar transformations.
 	bool CSO = this->pSurface()->pTransform()->GetHandedness(this->pSurface()->pTransform()->Time(0));
-	bool O = pAttributes() ->GetIntegerAttribute( "System", "Orientation" ) [ 0 ] != 0;
+	bool O = keyAttributes( pAttributes() ).GetIntegerAttribute( keyOrientation ) [ 0 ] != 0;
 	bool flipNormals = O ^ CSO;
 
 	const CqVector3D* pP = 0;
@@ -353,7 +402,7 @@ void CqMicroPolyGrid::Shade( bool canCullGrid )
 	TqInt gsmin1 = gs - 1;
 
 	// Expand grids to prevent grid cracking if enabled
-	const TqFloat* gridExpand = pAttributes()->GetFloatAttribute("aqsis", "expandgrids");
+	const TqFloat* gridExpand = keyAttributes(pAttributes()).GetFloatAttribute(keyExpandGrids);
 	if(gridExpand && *gridExpand > 0)
 		ExpandGridBoundaries(*gridExpand);
 
@@ -378,7 +427,7 @@ void CqMicroPolyGrid::Shade( bool canCullGrid )
 		setDv();
 
 	// Set I, the incident ray direction.
-	switch(QGetRenderContext()->GetIntegerOption("System", "Projection")[0])
+	switch(keyOptions().GetIntegerOption(keyProjection)[0])
 	{
 		case ProjectionOrthographic:
 			{
@@ -429,8 +478,8 @@ void CqMicroPolyGrid::Shade( bool canCullGrid )
 	}
 
 	// Now try and cull any hidden MPs if Sides==1
-	if ( ( pAttributes() ->GetIntegerAttribute( "System", "Sides" ) [ 0 ] == 1 ) && !m_pCSGNode &&
-		 ( pAttributes() ->GetIntegerAttributeDef( "cull", "backfacing", 1 ) == 1 ) )
+	if ( ( keyAttributes( pAttributes() ).GetIntegerAttribute( keySides ) [ 0 ] == 1 ) && !m_pCSGNode &&
+		 ( keyAttributes( pAttributes() ).GetIntegerAttributeDef( keyCullBackfacing, 1 ) == 1 ) )
 	{
 		AQSIS_TIME_SCOPE(Backface_culling);
 
@@ -752,7 +801,7 @@ void CqMicroPolyGrid::Split( long xmin, long xmax, long ymin, long ymax )
 
 	AQSIS_TIMER_START(Bust_grids);
 	// Get the required trim curve sense, if specified, defaults to "inside".
-	const CqString* pattrTrimSense = pAttributes() ->GetStringAttribute( "trimcurve", "sense" );
+	const CqString* pattrTrimSense = keyAttributes( pAttributes() ).GetStringAttribute( keyTrimSense );
 	CqString strTrimSense( "inside" );
 	if ( pattrTrimSense != 0 )
 		strTrimSense = pattrTrimSense[ 0 ];
@@ -763,6 +812,14 @@ void CqMicroPolyGrid::Split( long xmin, long xmax, long ymin, long ymax )
 
 	ADDREF( this );
 
+	// Static grids are queued whole in the buckets rather than being busted
+	// into micropolygons.  Quads are skipped unless the loop below decides
+	// otherwise.
+	bool useRasterGrid = tTime == 1 && !QGetRenderContext()->UsingDepthOfField();
+	std::vector<TqUchar> quadFlags;
+	if ( useRasterGrid )
+		quadFlags.assign( cu * cv, CqRasterGrid::Quad_Skip );
+
 	TqInt iv;
 //	bool tooSmall_ = false;
 //	TqFloat smallArea = 1.0;
@@ -834,7 +891,11 @@ void CqMicroPolyGrid::Split( long xmin, long xmax, long ymin, long ymax )
 					fTrimmed = true;
 			}
 
-			if ( tTime > 1 )
+			if ( useRasterGrid )
+			{
+				quadFlags[ iv * cu + iu ] = fTrimmed ? CqRasterGrid::Quad_Trimmed : 0;
+			}
+			else if ( tTime > 1 )
 			{
 				boost::shared_ptr<CqMicroPolygonMotion> pNew(new CqMicroPolygonMotion(this, iIndex));
 				if ( fTrimmed )
@@ -878,6 +939,11 @@ void CqMicroPolyGrid::Split( long xmin, long xmax, long ymin, long ymax )
 		//	}
 		}
 	}
+	if ( useRasterGrid )
+	{
+		boost::shared_ptr<CqRasterGrid> pRasterGrid(new CqRasterGrid(this, quadFlags));
+		QGetRenderContext()->pImage()->AddGrid( pRasterGrid );
+	}
 	AQSIS_TIMER_STOP(Bust_grids);
 //	if(tooSmall_)
 //	{
@@ -892,6 +958,62 @@ void CqMicroPolyGrid::Split( long xmin, long xmax, long ymin, long ymax )
 }
 
 
+//---------------------------------------------------------------------
+/** Constructor, computing the raster bounds of all the quads.
+ */
+
+CqRasterGrid::CqRasterGrid(CqMicroPolyGridBase* pGrid, std::vector<TqUchar>& quadFlags)
+	: m_pGrid( pGrid ),
+	m_uRes( pGrid->uGridRes() ),
+	m_Bound(),
+	m_quadFlags(),
+	m_quadBounds()
+{
+	ADDREF( m_pGrid );
+	m_quadFlags.swap( quadFlags );
+
+	const CqVector3D* pP;
+	m_pGrid->pVar(EnvVars_P) ->GetPointPtr( pP );
+	TqInt numQuads = m_quadFlags.size();
+	m_quadBounds.resize( 4 * numQuads );
+	TqFloat zMin = FLT_MAX;
+	TqFloat zMax = -FLT_MAX;
+	// Quad bounds are computed from two rows of vertices at a time; the
+	// bottom edge of one row of quads is the top edge of the next.
+	TqInt rowLen = m_uRes + 1;
+	for ( TqInt q = 0; q < numQuads; ++q )
+	{
+		const CqVector3D* A = pP + gridIndex( q );
+		const CqVector3D* B = A + rowLen;
+		TqFloat* b = &m_quadBounds[ 4 * q ];
+		b[0] = std::min( std::min( A[0].x(), A[1].x() ), std::min( B[0].x(), B[1].x() ) );
+		b[1] = std::max( std::max( A[0].x(), A[1].x() ), std::max( B[0].x(), B[1].x() ) );
+		b[2] = std::min( std::min( A[0].y(), A[1].y() ), std::min( B[0].y(), B[1].y() ) );
+		b[3] = std::max( std::max( A[0].y(), A[1].y() ), std::max( B[0].y(), B[1].y() ) );
+		if ( m_quadFlags[ q ] & Quad_Skip )
+			continue;
+		m_Bound.vecMin().x( std::min( m_Bound.vecMin().x(), b[0] ) );
+		m_Bound.vecMax().x( std::max( m_Bound.vecMax().x(), b[1] ) );
+		m_Bound.vecMin().y( std::min( m_Bound.vecMin().y(), b[2] ) );
+		m_Bound.vecMax().y( std::max( m_Bound.vecMax().y(), b[3] ) );
+		zMin = std::min( zMin, std::min( std::min( A[0].z(), A[1].z() ), std::min( B[0].z(), B[1].z() ) ) );
+		zMax = std::max( zMax, std::max( std::max( A[0].z(), A[1].z() ), std::max( B[0].z(), B[1].z() ) ) );
+	}
+	m_Bound.vecMin().z( zMin );
+	m_Bound.vecMax().z( zMax );
+}
+
+
+//---------------------------------------------------------------------
+/** Destructor
+ */
+
+CqRasterGrid::~CqRasterGrid()
+{
+	RELEASEREF( m_pGrid );
+}
+
+
 void CqMicroPolyGridBase::TriangleSplitPoints(CqVector3D& v1, CqVector3D& v2, TqFloat Time)
 {
 	// Workout where in the keyframe sequence the requested point is.
@@ -956,8 +1078,8 @@ void CqMotionMicroPolyGrid::Split( long xmin, long xmax, long ymin, long ymax )
 	CqMatrix matCameraToRaster;
 	QGetRenderContext() ->matSpaceToSpace( "camera", "raster", NULL, NULL, QGetRenderContext()->Time(), matCameraToRaster );
 	// Check to see if this surface is single sided, if so, we can do backface culling.
-	bool canBeBFCulled = ( pAttributes() ->GetIntegerAttribute( "System", "Sides" ) [ 0 ] == 1 ) && !pGridA->usesCSG() &&
-						 ( pAttributes() ->GetIntegerAttributeDef( "cull", "backfacing", 1 ) == 1 );
+	bool canBeBFCulled = ( keyAttributes( pAttributes() ).GetIntegerAttribute( keySides ) [ 0 ] == 1 ) && !pGridA->usesCSG() &&
+						 ( keyAttributes( pAttributes() ).GetIntegerAttributeDef( keyCullBackfacing, 1 ) == 1 );
 
 	ADDREF( pGridA );
 
@@ -1054,7 +1176,7 @@ void CqMotionMicroPolyGrid::Split( long xmin, long xmax, long ymin, long ymax )
 
 	AQSIS_TIMER_START(Bust_grids);
 	// Get the required trim curve sense, if specified, defaults to "inside".
-	const CqString* pattrTrimSense = pAttributes() ->GetStringAttribute( "trimcurve", "sense" );
+	const CqString* pattrTrimSense = keyAttributes( pAttributes() ).GetStringAttribute( keyTrimSense );
 	CqString strTrimSense( "inside" );
 	if ( pattrTrimSense != 0 )
 		strTrimSense = pattrTrimSense[ 0 ];
@@ -1163,20 +1285,30 @@ void CqMotionMicroPolyGrid::Split( long xmin, long xmax, long ymin, long ymax )
 CqMicroPolygon::CqMicroPolygon(CqMicroPolyGridBase* pGrid, TqInt Index ) : m_pGrid( pGrid ), m_Index(Index), m_Flags( 0 )
 {
 	STATS_INC( MPG_allocated );
-	STATS_INC( MPG_current );
-	TqInt cMPG = STATS_GETI( MPG_current );
-	TqInt cPeak = STATS_GETI( MPG_peak );
-	STATS_SETI( MPG_peak, cMPG > cPeak ? cMPG : cPeak );
+	STATS_INC_PEAK( MPG_current, MPG_peak );
 	ADDREF(pGrid);
 }
 
 
+//---------------------------------------------------------------------
+/** Transient constructor
+ */
+
+CqMicroPolygon::CqMicroPolygon(CqMicroPolyGridBase* pGrid, TqInt Index, bool transient )
+	: m_pGrid( pGrid ), m_Index(Index), m_Flags( MicroPolyFlags_Transient )
+{
+	assert( transient );
+}
+
+
 //---------------------------------------------------------------------
 /** Destructor
  */
 
 CqMicroPolygon::~CqMicroPolygon()
 {
+	if ( m_Flags & MicroPolyFlags_Transient )
+		return;
 	if ( m_pGrid )
 		RELEASEREF( m_pGrid );
 	STATS_INC( MPG_deallocated );
@@ -1588,75 +1720,166 @@ bool CqMicroPolygon::Sample( CqHitTestCache& hitTestCache, SqSampleData const& s
 		cachePointInPolyTest(hitTestCache, points);
 	}
 
-	if ( fContains( hitTestCache, vecSample, D, uv, time ) )
+	if ( !fContains( hitTestCache, vecSample, D, uv, time ) )
+		return ( false );
+
+	if ( IsTrimmed() || pGrid() ->fTriangular() )
 	{
-		// Now check if it is trimmed.
-		if ( IsTrimmed() )
+		CqVector2D hitPos = vecSample;
+		if(UsingDof && pGrid() ->fTriangular())
 		{
-			// Get the required trim curve sense, if specified, defaults to "inside".
-			const CqString * pattrTrimSense = pGrid() ->pAttributes() ->GetStringAttribute( "trimcurve", "sense" );
-			CqString strTrimSense( "inside" );
-			if ( pattrTrimSense != 0 )
-				strTrimSense = pattrTrimSense[ 0 ];
-			bool bOutside = strTrimSense == "outside";
+			// DoF interacts with the triangle split line computation: the
+			// micropolygon verts have been moved during the hit
+			// calculation, so we need to move the apparent position of the
+			// hit in the opposite direction before determining which side
+			// of the triangle split line the hit lies on.
+			CqVector2D cocMult = QGetRenderContext()->GetCircleOfConfusion(D);
+			hitPos += compMul(cocMult, sample.dofOffset);
+		}
+		return trimAndSplitTest(hitPos, uv, time);
+	}
 
-			TqFloat u, v;
+	return ( true );
+}
 
-			pGrid() ->pVar(EnvVars_u) ->GetFloat( u, m_Index );
-			pGrid() ->pVar(EnvVars_v) ->GetFloat( v, m_Index );
-			CqVector2D uvA( u, v );
+//---------------------------------------------------------------------
+bool CqMicroPolygon::trimAndSplitTest(const CqVector2D& hitPos,
+		const CqVector2D& uv, TqFloat time) const
+{
+	// Now check if it is trimmed.
+	if ( IsTrimmed() )
+	{
+		// Get the required trim curve sense, if specified, defaults to "inside".
+		const CqString * pattrTrimSense = keyAttributes( pGrid() ->pAttributes() ).GetStringAttribute( keyTrimSense );
+		CqString strTrimSense( "inside" );
+		if ( pattrTrimSense != 0 )
+			strTrimSense = pattrTrimSense[ 0 ];
+		bool bOutside = strTrimSense == "outside";
 
-			pGrid() ->pVar(EnvVars_u) ->GetFloat( u, m_Index + 1 );
-			pGrid() ->pVar(EnvVars_v) ->GetFloat( v, m_Index + 1 );
-			CqVector2D uvB( u, v );
+		TqFloat u, v;
 
-			pGrid() ->pVar(EnvVars_u) ->GetFloat( u, m_Index + pGrid() ->uGridRes() + 1 );
-			pGrid() ->pVar(EnvVars_v) ->GetFloat( v, m_Index + pGrid() ->uGridRes() + 1 );
-			CqVector2D uvC( u, v );
+		pGrid() ->pVar(EnvVars_u) ->GetFloat( u, m_Index );
+		pGrid() ->pVar(EnvVars_v) ->GetFloat( v, m_Index );
+		CqVector2D uvA( u, v );
 
-			pGrid() ->pVar(EnvVars_u) ->GetFloat( u, m_Index + pGrid() ->uGridRes() + 2 );
-			pGrid() ->pVar(EnvVars_v) ->GetFloat( v, m_Index + pGrid() ->uGridRes() + 2 );
-			CqVector2D uvD( u, v );
+		pGrid() ->pVar(EnvVars_u) ->GetFloat( u, m_Index + 1 );
+		pGrid() ->pVar(EnvVars_v) ->GetFloat( v, m_Index + 1 );
+		CqVector2D uvB( u, v );
 
-			CqVector2D vR = BilinearEvaluate( uvA, uvB, uvC, uvD, uv.x(), uv.y() );
+		pGrid() ->pVar(EnvVars_u) ->GetFloat( u, m_Index + pGrid() ->uGridRes() + 1 );
+		pGrid() ->pVar(EnvVars_v) ->GetFloat( v, m_Index + pGrid() ->uGridRes() + 1 );
+		CqVector2D uvC( u, v );
 
-			if ( pGrid() ->pSurface() ->bCanBeTrimmed() && pGrid() ->pSurface() ->bIsPointTrimmed( vR ) && !bOutside )
-			{
-				STATS_INC( MPG_trimmed );
-				return ( false );
-			}
-		}
+		pGrid() ->pVar(EnvVars_u) ->GetFloat( u, m_Index + pGrid() ->uGridRes() + 2 );
+		pGrid() ->pVar(EnvVars_v) ->GetFloat( v, m_Index + pGrid() ->uGridRes() + 2 );
+		CqVector2D uvD( u, v );
 
-		if ( pGrid() ->fTriangular() )
+		CqVector2D vR = BilinearEvaluate( uvA, uvB, uvC, uvD, uv.x(), uv.y() );
+
+		if ( pGrid() ->pSurface() ->bCanBeTrimmed() && pGrid() ->pSurface() ->bIsPointTrimmed( vR ) && !bOutside )
 		{
-			CqVector3D vA, vB;
-			pGrid()->TriangleSplitPoints( vA, vB, time );
-			TqFloat Ax = vA.x();
-			TqFloat Ay = vA.y();
-			TqFloat Bx = vB.x();
-			TqFloat By = vB.y();
+			STATS_INC( MPG_trimmed );
+			return ( false );
+		}
+	}
 
-			CqVector2D hitPos = vecSample;
-			if(UsingDof)
-			{
-				// DoF interacts with the triangle split line computation: the
-				// micropolygon verts have been moved during the hit
-				// calculation, so we need to move the apparent position of the
-				// hit in the opposite direction before determining which side
-				// of the triangle split line the hit lies on.
-				CqVector2D cocMult = QGetRenderContext()->GetCircleOfConfusion(D);
-				hitPos += compMul(cocMult, sample.dofOffset);
-			}
+	if ( pGrid() ->fTriangular() )
+	{
+		CqVector3D vA, vB;
+		pGrid()->TriangleSplitPoints( vA, vB, time );
+		TqFloat Ax = vA.x();
+		TqFloat Ay = vA.y();
+		TqFloat Bx = vB.x();
+		TqFloat By = vB.y();
+
+		TqFloat v = (Ay - By)*hitPos.x() + (Bx - Ax)*hitPos.y() + (Ax*By - Bx*Ay);
+		if ( v <= 0 )
+			return ( false );
+	}
 
-			TqFloat v = (Ay - By)*hitPos.x() + (Bx - Ax)*hitPos.y() + (Ax*By - Bx*Ay);
-			if ( v <= 0 )
-				return ( false );
+	return ( true );
+}
+
+//---------------------------------------------------------------------
+/** Compute the mask of samples which are inside all four edges of the
+ * micropolygon.
+ *
+ * The edge functions and the tie breaking rules are exactly those of
+ * CqMicroPolygon::fContains(): samples must be strictly inside the first two
+ * edges, and may lie on the second two.
+ */
+static TqUint edgeTestMask(const CqHitTestCache& cache, const TqFloat* x,
+		const TqFloat* y, TqInt count)
+{
+	TqUint mask = 0;
+	TqInt i = 0;
+#ifdef __SSE__
+	const __m128 zero = _mm_setzero_ps();
+	__m128 X[4], Y[4], XMult[4], YMult[4];
+	for(TqInt e = 0; e < 4; ++e)
+	{
+		X[e] = _mm_set1_ps(cache.m_X[e]);
+		Y[e] = _mm_set1_ps(cache.m_Y[e]);
+		XMult[e] = _mm_set1_ps(cache.m_XMultiplier[e]);
+		YMult[e] = _mm_set1_ps(cache.m_YMultiplier[e]);
+	}
+	for(; i + 4 <= count; i += 4)
+	{
+		__m128 px = _mm_loadu_ps(x + i);
+		__m128 py = _mm_loadu_ps(y + i);
+		__m128 inside = _mm_cmpgt_ps(
+				_mm_sub_ps(_mm_mul_ps(_mm_sub_ps(py, Y[0]), YMult[0]),
+						   _mm_mul_ps(_mm_sub_ps(px, X[0]), XMult[0])), zero);
+		inside = _mm_and_ps(inside, _mm_cmpgt_ps(
+				_mm_sub_ps(_mm_mul_ps(_mm_sub_ps(py, Y[1]), YMult[1]),
+						   _mm_mul_ps(_mm_sub_ps(px, X[1]), XMult[1])), zero));
+		inside = _mm_and_ps(inside, _mm_cmpge_ps(
+				_mm_sub_ps(_mm_mul_ps(_mm_sub_ps(py, Y[2]), YMult[2]),
+						   _mm_mul_ps(_mm_sub_ps(px, X[2]), XMult[2])), zero));
+		inside = _mm_and_ps(inside, _mm_cmpge_ps(
+				_mm_sub_ps(_mm_mul_ps(_mm_sub_ps(py, Y[3]), YMult[3]),
+						   _mm_mul_ps(_mm_sub_ps(px, X[3]), XMult[3])), zero));
+		mask |= static_cast<TqUint>(_mm_movemask_ps(inside)) << i;
+	}
+#endif
+	// Scalar version for the remaining samples.
+	for(; i < count; ++i)
+	{
+		bool inside = true;
+		for(TqInt e = 0; e < 4 && inside; ++e)
+		{
+			TqFloat f = (( y[i] - cache.m_Y[e]) * cache.m_YMultiplier[e] ) -
+			            (( x[i] - cache.m_X[e]) * cache.m_XMultiplier[e] );
+			inside = (e & 2) ? f >= 0 : f > 0;
 		}
+		if(inside)
+			mask |= 1U << i;
+	}
+	return mask;
+}
 
-		return ( true );
+TqUint CqMicroPolygon::SampleBatch( CqHitTestCache& hitTestCache,
+		const TqFloat* x, const TqFloat* y, TqInt count, TqFloat* D,
+		CqVector2D* uv ) const
+{
+	assert(count <= MaxBatchSamples);
+	TqUint mask = edgeTestMask(hitTestCache, x, y, count);
+	if(!mask)
+		return 0;
+
+	bool needsTrimOrSplit = IsTrimmed() || pGrid() ->fTriangular();
+	const TqFloat* z = hitTestCache.z;
+	for(TqInt i = 0; i < count; ++i)
+	{
+		if(!(mask & (1U << i)))
+			continue;
+		CqVector2D pos(x[i], y[i]);
+		uv[i] = hitTestCache.xyToUV(pos);
+		D[i] = bilerp(z[0], z[1], z[2], z[3], uv[i]);
+		if(needsTrimOrSplit && !trimAndSplitTest(pos, uv[i], 0.0f))
+			mask &= ~(1U << i);
 	}
-	else
-		return ( false );
+	return mask;
 }
 
 //---------------------------------------------------------------------
@@ -1688,8 +1911,9 @@ void CqMicroPolygonMotion::Initialise()
  */
 void CqMicroPolygonMotion::BuildBoundList(TqUint timeRanges)
 {
-	TqFloat opentime = QGetRenderContext() ->poptCurrent()->GetFloatOption( "System", "Shutter" ) [ 0 ];
-	TqFloat closetime = QGetRenderContext() ->poptCurrent()->GetFloatOption( "System", "Shutter" ) [ 1 ];
+	const TqFloat* shutter = keyOptions().GetFloatOption( keyShutter );
+	TqFloat opentime = shutter[ 0 ];
+	TqFloat closetime = shutter[ 1 ];
 
 	m_BoundList.Clear();
 
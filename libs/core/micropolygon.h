@@ -29,10 +29,12 @@
 
 #include	<aqsis/aqsis.h>
 
+#include	<vector>
+
 #include	<boost/utility.hpp>
 
 #include	"bilinear.h"
-#include	<aqsis/util/pool.h>
+#include	"threadlocalpool.h"
 #include	<aqsis/math/color.h>
 #include	<aqsis/util/list.h>
 #include	"bound.h"
@@ -567,6 +569,18 @@ class CqMicroPolygon : boost::noncopyable
 		 * \param Index Integer grid index.
 		 */
 		CqMicroPolygon( CqMicroPolyGridBase* pGrid, TqInt Index );
+		/** Constructor for a transient micropolygon, used to sample a single
+		 * quad of a grid while the caller keeps the grid alive.
+		 *
+		 * No reference to the grid is taken, and the micropolygon isn't
+		 * counted in the statistics, so it's cheap enough to create for
+		 * every quad.
+		 *
+		 * \param pGrid CqMicroPolyGrid pointer.
+		 * \param Index Integer grid index.
+		 * \param transient Must be true.
+		 */
+		CqMicroPolygon( CqMicroPolyGridBase* pGrid, TqInt Index, bool transient );
 		virtual	~CqMicroPolygon();
 
 		/** Overridden operator new to allocate micropolys from a pool.
@@ -597,6 +611,7 @@ class CqMicroPolygon : boost::noncopyable
 			MicroPolyFlags_Trimmed		= 0x0001,
 			MicroPolyFlags_Hit		= 0x0002,
 			MicroPolyFlags_PushedForward	= 0x0004,
+			MicroPolyFlags_Transient	= 0x0008,
 		};
 
 	public:
@@ -705,6 +720,31 @@ class CqMicroPolygon : boost::noncopyable
 		virtual	bool	Sample( CqHitTestCache& hitTestCache, SqSampleData const& sample, TqFloat& D, CqVector2D& uv, TqFloat time, bool UsingDof = false ) const;
 
 		virtual bool	fContains( CqHitTestCache& hitTestCache, const CqVector2D& vecP, TqFloat& D, CqVector2D& uv, TqFloat time ) const;
+
+		/// Maximum number of samples which SampleBatch() can test at once.
+		static const TqInt MaxBatchSamples = 32;
+		/** \brief Test a batch of samples against a static micropolygon.
+		 *
+		 * This is the batched equivalent of Sample() for micropolygons with
+		 * neither motion blur nor depth of field.  The edge tests for all the
+		 * samples are done together, four at a time when SSE is available.
+		 * The depth and (u,v) coordinates are then interpolated for the
+		 * samples which are inside, and any trimming or triangle split line
+		 * tests are applied to those.
+		 *
+		 * CacheHitTestValues(hitTestCache, false) must have been called first.
+		 *
+		 * \param hitTestCache - cached point-in-poly coefficients.
+		 * \param x - sample x positions.
+		 * \param y - sample y positions.
+		 * \param count - number of samples, at most MaxBatchSamples.
+		 * \param D - output depths; only written for samples which hit.
+		 * \param uv - output parametric coordinates; only written for hits.
+		 * \return A mask with bit i set when sample i hits the micropolygon.
+		 */
+		virtual TqUint SampleBatch( CqHitTestCache& hitTestCache,
+				const TqFloat* x, const TqFloat* y, TqInt count, TqFloat* D,
+				CqVector2D* uv ) const;
 		/** \brief Cache any values which can be reused for all point-in-poly tests.
 		 *
 		 * Child classes should override this function in order to cache any
@@ -810,9 +850,31 @@ class CqMicroPolygon : boost::noncopyable
 		 *                 test coefficients.
 		 */
 		void cachePointInPolyTest(CqHitTestCache& cache, CqVector3D* points) const;
+		/** \brief Apply the trim curve and triangle split line tests to a hit.
+		 *
+		 * \param hitPos - position of the hit, in the frame of the (possibly
+		 *                 DoF displaced) micropolygon vertices.
+		 * \param uv - parametric coordinates of the hit.
+		 * \param time - shutter time of the sample.
+		 * \return false if the hit is trimmed away or on the wrong side of the
+		 *         triangle split line.
+		 */
+		bool trimAndSplitTest(const CqVector2D& hitPos, const CqVector2D& uv,
+				TqFloat time) const;
+
+	public:
+		/** \brief Rewind the micropolygon pools of all threads in bulk.
+		 *
+		 * This is called once the image has been rendered and no other
+		 * thread is using the pools.  Pools which still have live
+		 * micropolygons (eg, after the render was aborted) are left alone.
+		 */
+		static void ReleaseUnusedPools();
+		/// Get the combined allocation counters of the micropolygon pools.
+		static SqPoolStats PoolStats();
 
 	private:
-		static	CqObjectPool<CqMicroPolygon> m_thePool;
+		static	CqThreadLocalPool<CqMicroPolygon> m_thePool;
 }
 ;
 
@@ -863,7 +925,8 @@ class CqMovingMicroPolygonKey
 		CqBound m_Bound;
 		bool	m_BoundReady;
 
-		static	CqObjectPool<CqMovingMicroPolygonKey>	m_thePool;
+		friend class CqMicroPolygon;
+		static	CqThreadLocalPool<CqMovingMicroPolygonKey>	m_thePool;
 }
 ;
 
@@ -967,6 +1030,64 @@ class CqMicroPolygonMotion : public CqMicroPolygon
 }
 ;
 
+
+//----------------------------------------------------------------------
+/** \class CqRasterGrid
+ * A shaded static grid, waiting in the buckets to be sampled as a whole.
+ *
+ * Rather than busting a shaded grid into a CqMicroPolygon per quad which
+ * must be allocated and queued in every bucket it touches, static grids
+ * (without motion blur or depth of field) are queued whole.  The raster
+ * bounds of all the quads are computed together when the grid is created,
+ * so that a bucket can reject the quads which don't touch it in a single
+ * tight loop, and the surviving quads are sampled directly from the grid's
+ * P, Ci and Oi arrays.
+ */
+class CqRasterGrid : boost::noncopyable
+{
+	public:
+		/// Per-quad flags.
+		enum EqQuadFlags
+		{
+			Quad_Skip	= 0x01,		///< Quad is culled or trimmed away.
+			Quad_Trimmed	= 0x02,		///< Quad spans a trim curve.
+		};
+
+		/** \brief Construct a raster grid from a grid projected to raster space.
+		 *
+		 * \param pGrid - the shaded grid, with P in hybrid camera/raster space.
+		 * \param quadFlags - EqQuadFlags for each quad, in u-major order.  The
+		 *                    contents are taken by swapping.
+		 */
+		CqRasterGrid(CqMicroPolyGridBase* pGrid, std::vector<TqUchar>& quadFlags);
+		~CqRasterGrid();
+
+		/// Get the donor grid.
+		CqMicroPolyGridBase* pGrid() const;
+		/// Get the bound of all the unskipped quads.
+		const CqBound& GetBound() const;
+		/// Get the number of quads.
+		TqInt numQuads() const;
+		/// Get the flags for quad q.
+		TqUchar quadFlags(TqInt q) const;
+		/// Get the index of the shading point at the first corner of quad q.
+		TqInt gridIndex(TqInt q) const;
+		/** \brief Check whether quad q may touch a raster region.
+		 *
+		 * Skipped quads never touch any region.
+		 */
+		bool quadTouches(TqInt q, TqFloat xmin, TqFloat xmax, TqFloat ymin,
+				TqFloat ymax) const;
+
+	private:
+		CqMicroPolyGridBase* m_pGrid;	///< Donor grid.
+		TqInt m_uRes;			///< Number of quads in the u direction.
+		CqBound m_Bound;		///< Bound of all unskipped quads.
+		std::vector<TqUchar> m_quadFlags;
+		/// Raster bound of each quad as xmin, xmax, ymin, ymax.
+		std::vector<TqFloat> m_quadBounds;
+};
+
 //==============================================================================
 // Implementation details
 //==============================================================================
@@ -988,6 +1109,41 @@ inline void CqMicroPolyGrid::setDv()
 	pVar(EnvVars_dv)->SetFloat(f1 - f0);
 }
 
+//-----------------------------------------------------------------------
+inline CqMicroPolyGridBase* CqRasterGrid::pGrid() const
+{
+	return m_pGrid;
+}
+
+inline const CqBound& CqRasterGrid::GetBound() const
+{
+	return m_Bound;
+}
+
+inline TqInt CqRasterGrid::numQuads() const
+{
+	return m_quadFlags.size();
+}
+
+inline TqUchar CqRasterGrid::quadFlags(TqInt q) const
+{
+	return m_quadFlags[q];
+}
+
+inline TqInt CqRasterGrid::gridIndex(TqInt q) const
+{
+	// There's one more shading point than quads along each row.
+	return q + q/m_uRes;
+}
+
+inline bool CqRasterGrid::quadTouches(TqInt q, TqFloat xmin, TqFloat xmax,
+		TqFloat ymin, TqFloat ymax) const
+{
+	const TqFloat* b = &m_quadBounds[4*q];
+	return !(m_quadFlags[q] & Quad_Skip) && b[0] <= xmax && b[1] >= xmin
+		&& b[2] <= ymax && b[3] >= ymin;
+}
+
 //-----------------------------------------------------------------------
 
 } // namespace Aqsis
@@ -0,0 +1,262 @@
+// Aqsis
+// Copyright (C) 1997 - 2001, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+/** \file
+ *
+ * \brief Unit tests for micropolygon sampling.
+ */
+
+#include "micropolygon.h"
+
+#include <cstdlib>
+#include <vector>
+
+#include <aqsis/shadervm/ishader.h>
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/auto_unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(micropolygon_tests)
+
+using namespace Aqsis;
+
+namespace {
+
+// A grid holding a single micropolygon, with just enough implemented to
+// sample it.
+class TestGrid : public CqMicroPolyGridBase
+{
+	public:
+		// The vertices are given in grid order: (u,v) = (0,0), (1,0), (0,1),
+		// (1,1).
+		TestGrid(const CqVector3D P[4])
+			: m_shader(createShaderVM(0)),
+			m_P(m_shader->CreateVariable(type_point, class_varying, "P"))
+		{
+			m_P->Initialise(4);
+			for(TqInt i = 0; i < 4; ++i)
+				m_P->SetPoint(P[i], i);
+		}
+		virtual ~TestGrid()
+		{
+			delete m_P;
+		}
+		void setSplitLine(const CqVector3D& a, const CqVector3D& b)
+		{
+			m_fTriangular = true;
+			m_splitA = a;
+			m_splitB = b;
+		}
+
+		virtual void TriangleSplitPoints(CqVector3D& v1, CqVector3D& v2, TqFloat)
+		{
+			v1 = m_splitA;
+			v2 = m_splitB;
+		}
+		virtual IqShaderData* pVar(TqInt index)
+		{
+			return index == EnvVars_P ? m_P : 0;
+		}
+		virtual TqInt uGridRes() const { return 1; }
+		virtual TqInt vGridRes() const { return 1; }
+
+		virtual void Split(long, long, long, long) { }
+		virtual void Shade(bool) { }
+		virtual void TransferOutputVariables() { }
+		virtual void DeleteVariables(bool) { }
+		virtual CqSurface* pSurface() const { return 0; }
+		virtual const IqConstAttributesPtr pAttributes() const
+		{
+			return IqConstAttributesPtr();
+		}
+		virtual bool usesCSG() const { return false; }
+		virtual boost::shared_ptr<CqCSGTreeNode> pCSGNode() const
+		{
+			return boost::shared_ptr<CqCSGTreeNode>();
+		}
+		virtual TqUint numMicroPolygons(TqInt cu, TqInt cv) const { return cu*cv; }
+		virtual TqUint numShadingPoints(TqInt cu, TqInt cv) const
+		{
+			return (cu+1)*(cv+1);
+		}
+		virtual bool hasValidDerivatives() const { return true; }
+		virtual IqShaderData* FindStandardVar(const char*) { return 0; }
+		virtual boost::shared_ptr<IqShaderExecEnv> pShaderExecEnv()
+		{
+			return boost::shared_ptr<IqShaderExecEnv>();
+		}
+
+	private:
+		boost::shared_ptr<IqShader> m_shader;
+		IqShaderData* m_P;
+		CqVector3D m_splitA;
+		CqVector3D m_splitB;
+};
+
+// Sample points covering the micropolygon with vertices P: the vertices,
+// the edge midpoints, a regular lattice which includes the vertices and
+// edges of axis-aligned micropolygons, and random points.
+void makeSamplePoints(const CqVector3D P[4], std::vector<TqFloat>& x,
+		std::vector<TqFloat>& y)
+{
+	const TqInt edges[4][2] = { {0,1}, {1,3}, {3,2}, {2,0} };
+	for(TqInt i = 0; i < 4; ++i)
+	{
+		x.push_back(P[i].x());
+		y.push_back(P[i].y());
+		const CqVector3D& a = P[edges[i][0]];
+		const CqVector3D& b = P[edges[i][1]];
+		x.push_back(0.5f*(a.x() + b.x()));
+		y.push_back(0.5f*(a.y() + b.y()));
+	}
+	for(TqInt i = 0; i <= 16; ++i)
+	{
+		for(TqInt j = 0; j <= 16; ++j)
+		{
+			x.push_back(0.25f*i);
+			y.push_back(0.25f*j);
+		}
+	}
+	std::srand(1);
+	for(TqInt i = 0; i < 1000; ++i)
+	{
+		x.push_back(4.0f*std::rand()/RAND_MAX);
+		y.push_back(4.0f*std::rand()/RAND_MAX);
+	}
+}
+
+// Check that SampleBatch() gives the same hits, depths and (u,v)
+// coordinates as sampling each point separately with Sample().
+void checkSampleBatch(TestGrid* grid)
+{
+	CqVector3D* P = 0;
+	grid->pVar(EnvVars_P)->GetPointPtr(P);
+	std::vector<TqFloat> x;
+	std::vector<TqFloat> y;
+	makeSamplePoints(P, x, y);
+
+	CqMicroPolygon mpg(grid, 0);
+	mpg.Initialise();
+	CqHitTestCache hitTestCache;
+	mpg.CacheHitTestValues(hitTestCache, false);
+
+	TqInt numSamples = x.size();
+	TqInt numHits = 0;
+	// Vary the batch size, so that the SIMD tests and the scalar tail both
+	// see every kind of point.
+	for(TqInt start = 0, count = 1; start < numSamples; start += count,
+			count = count % CqMicroPolygon::MaxBatchSamples + 1)
+	{
+		count = std::min(count, numSamples - start);
+		TqFloat D[CqMicroPolygon::MaxBatchSamples];
+		CqVector2D uv[CqMicroPolygon::MaxBatchSamples];
+		TqUint mask = mpg.SampleBatch(hitTestCache, &x[start], &y[start],
+				count, D, uv);
+		for(TqInt i = 0; i < count; ++i)
+		{
+			SqSampleData sample;
+			sample.position = CqVector2D(x[start+i], y[start+i]);
+			TqFloat sampleD = 0;
+			CqVector2D sampleUv;
+			bool hit = mpg.Sample(hitTestCache, sample, sampleD, sampleUv, 0);
+			BOOST_CHECK_EQUAL(((mask >> i) & 1) != 0, hit);
+			if(hit && (mask & (1U << i)))
+			{
+				BOOST_CHECK_EQUAL(D[i], sampleD);
+				BOOST_CHECK_EQUAL(uv[i].x(), sampleUv.x());
+				BOOST_CHECK_EQUAL(uv[i].y(), sampleUv.y());
+				++numHits;
+			}
+		}
+	}
+	// Make sure the test isn't vacuous.
+	BOOST_CHECK(numHits > 0);
+	BOOST_CHECK(numHits < numSamples);
+}
+
+// Make a grid, holding a reference to it for the duration of the test.
+TestGrid* makeGrid(const CqVector3D P[4])
+{
+	TestGrid* grid = new TestGrid(P);
+	ADDREF(grid);
+	return grid;
+}
+
+} // unnamed namespace
+
+BOOST_AUTO_TEST_CASE(CqMicroPolygon_SampleBatch_square_test)
+{
+	const CqVector3D P[4] = {
+		CqVector3D(1, 1, 1), CqVector3D(3, 1, 2),
+		CqVector3D(1, 3, 3), CqVector3D(3, 3, 5)
+	};
+	TestGrid* grid = makeGrid(P);
+	checkSampleBatch(grid);
+	RELEASEREF(grid);
+}
+
+BOOST_AUTO_TEST_CASE(CqMicroPolygon_SampleBatch_mirrored_test)
+{
+	// Opposite orientation to the square test.
+	const CqVector3D P[4] = {
+		CqVector3D(3, 1, 1), CqVector3D(1, 1, 2),
+		CqVector3D(3, 3, 3), CqVector3D(1, 3, 5)
+	};
+	TestGrid* grid = makeGrid(P);
+	checkSampleBatch(grid);
+	RELEASEREF(grid);
+}
+
+BOOST_AUTO_TEST_CASE(CqMicroPolygon_SampleBatch_quad_test)
+{
+	const CqVector3D P[4] = {
+		CqVector3D(0.5, 0.25, 1), CqVector3D(3.75, 1, 1.5),
+		CqVector3D(0.25, 3.5, 2), CqVector3D(3, 3.25, 4)
+	};
+	TestGrid* grid = makeGrid(P);
+	checkSampleBatch(grid);
+	RELEASEREF(grid);
+}
+
+BOOST_AUTO_TEST_CASE(CqMicroPolygon_SampleBatch_degenerate_test)
+{
+	// Two coincident vertices, leaving a triangle.
+	const CqVector3D P[4] = {
+		CqVector3D(1, 1, 1), CqVector3D(3, 1, 2),
+		CqVector3D(1, 3, 3), CqVector3D(3, 1, 2)
+	};
+	TestGrid* grid = makeGrid(P);
+	checkSampleBatch(grid);
+	RELEASEREF(grid);
+}
+
+BOOST_AUTO_TEST_CASE(CqMicroPolygon_SampleBatch_triangular_test)
+{
+	// Half of the square is cut away by the triangle split line.
+	const CqVector3D P[4] = {
+		CqVector3D(1, 1, 1), CqVector3D(3, 1, 2),
+		CqVector3D(1, 3, 3), CqVector3D(3, 3, 5)
+	};
+	TestGrid* grid = makeGrid(P);
+	grid->setSplitLine(CqVector3D(3, 1, 0), CqVector3D(1, 3, 0));
+	checkSampleBatch(grid);
+	RELEASEREF(grid);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
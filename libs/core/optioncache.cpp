@@ -37,6 +37,8 @@ SqOptionCache::SqOptionCache()
 	projectionType(ProjectionPerspective),
 	shutterOpen(0),
 	shutterClose(0),
+	exposeGain(1),
+	exposeGamma(1),
 	xBucketSize(16),
 	yBucketSize(16),
 	maxEyeSplits(1),
@@ -74,6 +76,12 @@ void SqOptionCache::cacheOptions(const IqOptions& opts)
 	shutterOpen = shutterTimes[0];
 	shutterClose = shutterTimes[1];
 
+	// Exposure.
+	const TqFloat* exposure = opts.GetFloatOption("System", "Exposure");
+	assert(exposure);
+	exposeGain = exposure[0];
+	exposeGamma = exposure[1];
+
 	// Bucket size.
 	xBucketSize = 16;
 	yBucketSize = 16;
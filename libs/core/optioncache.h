@@ -43,7 +43,9 @@ enum EqDepthFilter
 /** \brief Cache for RiOptions for fast access during rendering.
  *
  * The generic mechanism for storing RiOptions is too slow for accesses which
- * happen very very frequently, so we store them here.
+ * happen very very frequently, so we store them here.  Options read per
+ * bucket or per pixel belong here; code without access to the cache should
+ * look options up with a CqParamKey instead.
  */
 struct SqOptionCache
 {
@@ -59,6 +61,9 @@ struct SqOptionCache
 	TqFloat shutterOpen;  ///< Camera shutter open time
 	TqFloat shutterClose; ///< Camera shutter close time
 
+	TqFloat exposeGain;   ///< Gain applied to pixel colours
+	TqFloat exposeGamma;  ///< Gamma applied to pixel colours
+
 	TqInt xBucketSize;  ///< Bucket size in the x-direction
 	TqInt yBucketSize;  ///< Bucket size in the y-direction
 	TqInt maxEyeSplits; ///< Maximum allowed number of eye splits
@@ -185,6 +185,22 @@ void CqOptions::InitialiseCamera()
 }
 
 
+//---------------------------------------------------------------------
+/** Intern a parameter name, giving it the next free slot.
+ */
+
+CqParamKey::CqParamKey( const char* listName, const char* paramName )
+	: m_listName( listName ),
+	m_paramName( paramName ),
+	m_slot( 0 )
+{
+	// Keys are normally static constants, so the counter is a function local
+	// static to be safe from static initialisation order problems.
+	static TqInt nextSlot = 0;
+	m_slot = nextSlot++;
+}
+
+
 //---------------------------------------------------------------------
 /** Default constructor.
  */
@@ -225,6 +241,7 @@ CqOptions::~CqOptions()
 
 CqOptions& CqOptions::operator=( const CqOptions& From )
 {
+	m_keyCache.clear();
 	m_funcFilter = From.m_funcFilter;
 	m_pshadImager = From.m_pshadImager;
 
@@ -327,6 +344,8 @@ boost::shared_ptr<const CqNamedParameterList> CqOptions::pOption( const char* st
 
 boost::shared_ptr<CqNamedParameterList> CqOptions::pOptionWrite( const char* strName )
 {
+	// The list may be copied or added to, so cached parameters can't be trusted.
+	m_keyCache.clear();
 	const TqUlong hash = CqString::hash( strName );
 	std::vector<boost::shared_ptr<CqNamedParameterList> >::iterator
 	i = m_aOptions.begin(), end = m_aOptions.end();
@@ -634,6 +653,54 @@ const CqColor* CqOptions::GetColorOption( const char* strName, const char* strPa
 		return ( 0 );
 }
 
+
+//---------------------------------------------------------------------
+/** Get a float system option parameter by key.
+ * \param key The interned option and parameter names.
+ * \return Float pointer 0 if not found.
+ */
+
+const TqFloat* CqOptions::GetFloatOption( const CqParamKey& key ) const
+{
+	const CqParameter * pParam = pParameter( key );
+	if ( pParam != 0 )
+		return ( static_cast<const CqParameterTyped<TqFloat, TqFloat>*>( pParam ) ->pValue() );
+	else
+		return ( 0 );
+}
+
+
+//---------------------------------------------------------------------
+/** Get an integer system option parameter by key.
+ * \param key The interned option and parameter names.
+ * \return Integer pointer 0 if not found.
+ */
+
+const TqInt* CqOptions::GetIntegerOption( const CqParamKey& key ) const
+{
+	const CqParameter * pParam = pParameter( key );
+	if ( pParam != 0 )
+		return ( static_cast<const CqParameterTyped<TqInt, TqFloat>*>( pParam ) ->pValue() );
+	else
+		return ( 0 );
+}
+
+
+//---------------------------------------------------------------------
+/** Get a string system option parameter by key.
+ * \param key The interned option and parameter names.
+ * \return CqString pointer 0 if not found.
+ */
+
+const CqString* CqOptions::GetStringOption( const CqParamKey& key ) const
+{
+	const CqParameter * pParam = pParameter( key );
+	if ( pParam != 0 )
+		return ( static_cast<const CqParameterTyped<CqString, CqString>*>( pParam ) ->pValue() );
+	else
+		return ( 0 );
+}
+
 EqVariableType CqOptions::getParameterType(const char* strName, const char* strParam) const
 {
 	const CqParameter* pParam = pParameter(strName, strParam);
@@ -30,6 +30,7 @@
 
 #include <aqsis/aqsis.h>
 
+#include <string>
 #include <vector>
 
 #include <aqsis/math/color.h>
@@ -46,6 +47,66 @@ namespace Aqsis {
 
 class CqImagersource;
 
+
+//----------------------------------------------------------------------
+/** \brief Interned name of a parameter of an option or attribute.
+ *
+ * Each key is given its own small integer slot when it's constructed.
+ * CqOptions and CqAttributes remember the parameter they found for each
+ * slot, so repeated lookups with a key avoid the string comparisons which
+ * lookups by name need.  Keys are intended to be static constants in the
+ * code which uses them.
+ */
+class CqParamKey
+{
+	public:
+		CqParamKey( const char* listName, const char* paramName );
+
+		/// Name of the option or attribute.
+		const char* listName() const;
+		/// Name of the parameter within the option or attribute.
+		const char* paramName() const;
+		/// Slot index of the key.
+		TqInt slot() const;
+
+	private:
+		std::string m_listName;
+		std::string m_paramName;
+		TqInt m_slot;
+};
+
+
+//----------------------------------------------------------------------
+/** \brief Cache of the parameters found by CqParamKey lookups.
+ *
+ * The cache holds raw parameter pointers, so must be cleared whenever the
+ * parameter lists it was filled from could change.
+ */
+class CqParamKeyCache
+{
+	public:
+		CqParamKeyCache();
+
+		/** Find the parameter cached for a key.
+		 * \param key The key to look for.
+		 * \param param Set to the cached parameter, which may be null.
+		 * \return true if the key has been looked up since the last clear().
+		 */
+		bool find( const CqParamKey& key, const CqParameter*& param ) const;
+		/// Cache the parameter found for a key.
+		void insert( const CqParamKey& key, const CqParameter* param );
+		/// Forget all cached parameters.
+		void clear();
+
+	private:
+		struct SqEntry
+		{
+			const CqParameter* param;
+			bool valid;
+		};
+		std::vector<SqEntry> m_entries;
+};
+
 class CqOptions;
 typedef boost::shared_ptr<CqOptions> CqOptionsPtr;
 
@@ -67,12 +128,14 @@ class CqOptions : public IqOptions
 		 */
 		void	AddOption( const boost::shared_ptr<CqNamedParameterList>& pOption )
 		{
+			m_keyCache.clear();
 			m_aOptions.push_back( pOption );
 		}
 		/** Clear all user options from the state.
 		 */
 		void	ClearOptions()
 		{
+			m_keyCache.clear();
 			m_aOptions.clear();
 			InitialiseDefaultOptions();
 		}
@@ -97,6 +160,18 @@ class CqOptions : public IqOptions
 		virtual const	CqVector3D*	GetPointOption( const char* strName, const char* strParam ) const;
 		virtual const	CqColor*	GetColorOption( const char* strName, const char* strParam ) const;
 
+		/** \brief Get a parameter by interned key.
+		 *
+		 * These are equivalent to the lookups by name, but much faster when
+		 * the same key is looked up repeatedly.
+		 */
+		//@{
+		const	CqParameter* pParameter( const CqParamKey& key ) const;
+		const	TqFloat*	GetFloatOption( const CqParamKey& key ) const;
+		const	TqInt*	GetIntegerOption( const CqParamKey& key ) const;
+		const	CqString* GetStringOption( const CqParamKey& key ) const;
+		//@}
+
 		virtual TqFloat*	GetFloatOptionWrite( const char* strName, const char* strParam, TqInt arraySize = 1 );
 		virtual TqInt*	GetIntegerOptionWrite( const char* strName, const char* strParam, TqInt arraySize = 1 );
 		virtual CqString* GetStringOptionWrite( const char* strName, const char* strParam, TqInt arraySize = 1 );
@@ -159,10 +234,71 @@ class CqOptions : public IqOptions
 
 		RtFilterFunc m_funcFilter;						///< Pointer to the pixel filter function.
 		CqImagersource* m_pshadImager;		///< Pointer to the imager shader.
+		mutable CqParamKeyCache m_keyCache;	///< Parameters found by key lookups.
 }
 ;
 
 
+//----------------------------------------------------------------------
+// Implementation details.
+
+inline const char* CqParamKey::listName() const
+{
+	return m_listName.c_str();
+}
+
+inline const char* CqParamKey::paramName() const
+{
+	return m_paramName.c_str();
+}
+
+inline TqInt CqParamKey::slot() const
+{
+	return m_slot;
+}
+
+inline CqParamKeyCache::CqParamKeyCache()
+	: m_entries()
+{ }
+
+inline bool CqParamKeyCache::find( const CqParamKey& key, const CqParameter*& param ) const
+{
+	TqInt slot = key.slot();
+	if ( slot >= static_cast<TqInt>( m_entries.size() ) || !m_entries[ slot ].valid )
+		return ( false );
+	param = m_entries[ slot ].param;
+	return ( true );
+}
+
+inline void CqParamKeyCache::insert( const CqParamKey& key, const CqParameter* param )
+{
+	TqInt slot = key.slot();
+	if ( slot >= static_cast<TqInt>( m_entries.size() ) )
+	{
+		SqEntry empty = { 0, false };
+		m_entries.resize( slot + 1, empty );
+	}
+	m_entries[ slot ].param = param;
+	m_entries[ slot ].valid = true;
+}
+
+inline void CqParamKeyCache::clear()
+{
+	m_entries.clear();
+}
+
+inline const CqParameter* CqOptions::pParameter( const CqParamKey& key ) const
+{
+	const CqParameter* param = 0;
+	if ( !m_keyCache.find( key, param ) )
+	{
+		param = pParameter( key.listName(), key.paramName() );
+		m_keyCache.insert( key, param );
+	}
+	return ( param );
+}
+
+
 } // namespace Aqsis
 
 //-----------------------------------------------------------------------
@@ -0,0 +1,68 @@
+// Aqsis
+// Copyright (C) 1997 - 2007, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+/** \file
+ *
+ * \brief Unit tests for option lookups by interned key
+ */
+
+#include "options.h"
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/auto_unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(options_tests)
+
+using namespace Aqsis;
+
+BOOST_AUTO_TEST_CASE(paramkey_slot_test)
+{
+	CqParamKey key1("limits", "bucketsize");
+	CqParamKey key2("limits", "bucketsize");
+	BOOST_CHECK(key1.slot() != key2.slot());
+	BOOST_CHECK_EQUAL(std::string(key1.listName()), "limits");
+	BOOST_CHECK_EQUAL(std::string(key1.paramName()), "bucketsize");
+}
+
+BOOST_AUTO_TEST_CASE(options_key_lookup_test)
+{
+	CqParamKey resKey("System", "Resolution");
+	CqParamKey missingKey("limits", "gridsize");
+
+	CqOptions opts;
+	const TqInt* res = opts.GetIntegerOption(resKey);
+	BOOST_REQUIRE(res);
+	BOOST_CHECK_EQUAL(res, opts.GetIntegerOption("System", "Resolution"));
+	BOOST_CHECK_EQUAL(res[0], 640);
+	BOOST_CHECK(!opts.GetIntegerOption(missingKey));
+
+	// Writing to the options must make the missing option visible.
+	opts.GetIntegerOptionWrite("limits", "gridsize")[0] = 256;
+	const TqInt* gridSize = opts.GetIntegerOption(missingKey);
+	BOOST_REQUIRE(gridSize);
+	BOOST_CHECK_EQUAL(gridSize[0], 256);
+
+	// Copies see their own parameters after a write, not the original's.
+	CqOptions copy(opts);
+	copy.GetIntegerOptionWrite("limits", "gridsize")[0] = 64;
+	BOOST_CHECK_EQUAL(copy.GetIntegerOption(missingKey)[0], 64);
+	BOOST_CHECK_EQUAL(opts.GetIntegerOption(missingKey)[0], 256);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -50,11 +50,7 @@ CqParameter::CqParameter( const char* strName, TqInt Count ) :
 	assert( Count >= 1 );
 
 	STATS_INC( PRM_created );
-	STATS_INC( PRM_current );
-	TqInt cPRM = STATS_GETI( PRM_current );
-	TqInt cPeak = STATS_GETI( PRM_peak );
-
-	STATS_SETI( PRM_peak, cPRM > cPeak ? cPRM : cPeak );
+	STATS_INC_PEAK( PRM_current, PRM_peak );
 	m_hash = CqString::hash(strName);
 }
 
@@ -69,11 +65,7 @@ CqParameter::CqParameter( const CqParameter& From ) :
 	///		  renderer context isn't ready yet.
 	//	QGetRenderContext() ->Stats().IncParametersAllocated();
 	STATS_INC( PRM_created );
-	STATS_INC( PRM_current );
-	TqInt cPRM = STATS_GETI( PRM_current );
-	TqInt cPeak = STATS_GETI( PRM_peak );
-
-	STATS_SETI( PRM_peak, cPRM > cPeak ? cPRM : cPeak );
+	STATS_INC_PEAK( PRM_current, PRM_peak );
 }
 
 CqParameter::~CqParameter()
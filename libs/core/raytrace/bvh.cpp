@@ -0,0 +1,709 @@
+// Aqsis
+// Copyright (C) 1997 - 2001, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+/** \file
+		\brief Bounding volume hierarchy over triangles for ray queries.
+*/
+
+#include	"bvh.h"
+
+#include	<algorithm>
+#include	<cfloat>
+#include	<cmath>
+
+#include	<boost/bind.hpp>
+#include	<boost/ref.hpp>
+
+#ifdef __SSE__
+#include	<xmmintrin.h>
+#endif
+
+#include	"threadscheduler.h"
+
+namespace Aqsis {
+
+namespace {
+
+/// Number of SAH bins along each axis.
+const TqInt numBins = 16;
+/// Nodes with at most this many triangles are always leaves.
+const TqInt minLeafSize = 2;
+/// Nodes with more than this many triangles are split even if the SAH says not to.
+const TqInt maxLeafSize = 8;
+/// Maximum tree depth; deeper nodes become leaves regardless of size.
+const TqInt maxDepth = 60;
+/// Size of the traversal stacks, which must exceed maxDepth.
+const TqInt stackSize = 64;
+/// Nodes with at least this many triangles are binned in parallel.
+const TqInt parallelBinThreshold = 32768;
+/// Cost of traversing a node relative to intersecting a triangle.
+const TqFloat traversalCost = 1.0f;
+
+/// Reciprocal of a ray direction component, avoiding infinities.
+inline TqFloat safeInverse(TqFloat d)
+{
+	if(std::fabs(d) < 1e-30f)
+		d = d < 0 ? -1e-30f : 1e-30f;
+	return 1.0f/d;
+}
+
+} // unnamed namespace
+
+
+//------------------------------------------------------------------------------
+// Build state
+
+struct CqBvh::SqBins
+{
+	SqBox bounds[3][numBins];
+	TqInt counts[3][numBins];
+	SqBins()
+	{
+		std::fill(&counts[0][0], &counts[0][0] + 3*numBins, 0);
+	}
+};
+
+struct CqBvh::SqBuildRef
+{
+	SqBox bound;
+	TqFloat centroid[3];
+	TqInt triangle;
+};
+
+CqBvh::SqBox::SqBox()
+{
+	for(TqInt i = 0; i < 3; ++i)
+	{
+		min[i] = FLT_MAX;
+		max[i] = -FLT_MAX;
+	}
+}
+
+inline void CqBvh::SqBox::extend(const SqBox& b)
+{
+	for(TqInt i = 0; i < 3; ++i)
+	{
+		min[i] = std::min(min[i], b.min[i]);
+		max[i] = std::max(max[i], b.max[i]);
+	}
+}
+
+inline void CqBvh::SqBox::extend(const TqFloat p[3])
+{
+	for(TqInt i = 0; i < 3; ++i)
+	{
+		min[i] = std::min(min[i], p[i]);
+		max[i] = std::max(max[i], p[i]);
+	}
+}
+
+inline TqFloat CqBvh::SqBox::halfArea() const
+{
+	TqFloat dx = max[0] - min[0];
+	TqFloat dy = max[1] - min[1];
+	TqFloat dz = max[2] - min[2];
+	if(dx < 0 || dy < 0 || dz < 0)
+		return 0;
+	return dx*dy + dy*dz + dz*dx;
+}
+
+namespace {
+
+/// Bin of a centroid along an axis of the centroid bound.
+inline TqInt binIndex(const TqFloat centroid[3], TqInt axis,
+		const TqFloat min[3], const TqFloat scale[3])
+{
+	TqInt bin = static_cast<TqInt>((centroid[axis] - min[axis])*scale[axis]);
+	return std::max(0, std::min(numBins-1, bin));
+}
+
+/// Per-axis scale factors taking a centroid offset to a bin number.
+inline void binScales(const TqFloat min[3], const TqFloat max[3], TqFloat scale[3])
+{
+	for(TqInt i = 0; i < 3; ++i)
+	{
+		TqFloat extent = max[i] - min[i];
+		scale[i] = extent > 0 ? numBins*(1 - 1e-5f)/extent : 0;
+	}
+}
+
+/// Partition predicate for the chosen SAH split plane.
+template<typename RefT>
+struct SqSplitPred
+{
+	TqInt axis;
+	TqInt split;
+	const TqFloat* min;
+	const TqFloat* scale;
+	bool operator()(const RefT& ref) const
+	{
+		return binIndex(ref.centroid, axis, min, scale) <= split;
+	}
+};
+
+/// Ordering of refs by centroid along an axis for the median fallback.
+template<typename RefT>
+struct SqCentroidLess
+{
+	TqInt axis;
+	bool operator()(const RefT& a, const RefT& b) const
+	{
+		return a.centroid[axis] < b.centroid[axis];
+	}
+};
+
+} // unnamed namespace
+
+
+//------------------------------------------------------------------------------
+// CqBvh implementation
+
+CqBvh::CqBvh()
+	: m_triangles(),
+	m_nodes()
+{ }
+
+void CqBvh::clear()
+{
+	std::vector<SqTriangle>().swap(m_triangles);
+	std::vector<SqNode>().swap(m_nodes);
+}
+
+void CqBvh::addTriangle(const CqVector3D& a, const CqVector3D& b,
+		const CqVector3D& c, TqInt primitive)
+{
+	SqTriangle tri;
+	CqVector3D e1 = b - a;
+	CqVector3D e2 = c - a;
+	for(TqInt i = 0; i < 3; ++i)
+	{
+		tri.v0[i] = a[i];
+		tri.e1[i] = e1[i];
+		tri.e2[i] = e2[i];
+	}
+	tri.primitive = primitive;
+	m_triangles.push_back(tri);
+}
+
+void CqBvh::build(CqThreadScheduler* scheduler)
+{
+	m_nodes.clear();
+	TqInt numTris = m_triangles.size();
+	if(numTris == 0)
+		return;
+
+	std::vector<SqBuildRef> refs(numTris);
+	for(TqInt i = 0; i < numTris; ++i)
+	{
+		const SqTriangle& tri = m_triangles[i];
+		SqBuildRef& ref = refs[i];
+		TqFloat p[3];
+		ref.bound.extend(tri.v0);
+		for(TqInt j = 0; j < 3; ++j)
+			p[j] = tri.v0[j] + tri.e1[j];
+		ref.bound.extend(p);
+		for(TqInt j = 0; j < 3; ++j)
+			p[j] = tri.v0[j] + tri.e2[j];
+		ref.bound.extend(p);
+		for(TqInt j = 0; j < 3; ++j)
+			ref.centroid[j] = 0.5f*(ref.bound.min[j] + ref.bound.max[j]);
+		ref.triangle = i;
+	}
+
+	// A tree over n triangles has at most 2n-1 nodes.
+	m_nodes.reserve(2*numTris);
+	m_nodes.resize(1);
+	buildNode(0, 0, numTris, refs, scheduler, 0);
+
+	// Put the triangles into leaf order.
+	std::vector<SqTriangle> sorted(numTris);
+	for(TqInt i = 0; i < numTris; ++i)
+		sorted[i] = m_triangles[refs[i].triangle];
+	m_triangles.swap(sorted);
+	std::vector<SqNode>(m_nodes).swap(m_nodes);
+}
+
+void CqBvh::binRefs(const SqBuildRef* refs, TqInt count,
+		const SqBox& centroidBound, SqBins* bins)
+{
+	TqFloat scale[3];
+	binScales(centroidBound.min, centroidBound.max, scale);
+	for(TqInt i = 0; i < count; ++i)
+	{
+		const SqBuildRef& ref = refs[i];
+		for(TqInt axis = 0; axis < 3; ++axis)
+		{
+			TqInt bin = binIndex(ref.centroid, axis, centroidBound.min, scale);
+			bins->bounds[axis][bin].extend(ref.bound);
+			++bins->counts[axis][bin];
+		}
+	}
+}
+
+void CqBvh::makeLeaf(SqNode& node, TqInt begin, TqInt end)
+{
+	node.offset = begin;
+	node.count = end - begin;
+}
+
+void CqBvh::buildNode(TqInt nodeIndex, TqInt begin, TqInt end,
+		std::vector<SqBuildRef>& refs, CqThreadScheduler* scheduler,
+		TqInt depth)
+{
+	TqInt count = end - begin;
+	SqBox bound;
+	SqBox centroidBound;
+	for(TqInt i = begin; i < end; ++i)
+	{
+		bound.extend(refs[i].bound);
+		centroidBound.extend(refs[i].centroid);
+	}
+	{
+		SqNode& node = m_nodes[nodeIndex];
+		for(TqInt i = 0; i < 3; ++i)
+		{
+			node.bmin[i] = bound.min[i];
+			node.bmax[i] = bound.max[i];
+		}
+	}
+	if(count <= minLeafSize || depth >= maxDepth)
+	{
+		makeLeaf(m_nodes[nodeIndex], begin, end);
+		return;
+	}
+
+	// Bin the centroids along each axis.  Large nodes near the top of the
+	// tree are binned in chunks on the worker threads.
+	SqBins bins;
+	if(scheduler && scheduler->numThreads() > 1 && count >= parallelBinThreshold)
+	{
+		TqInt numChunks = scheduler->numThreads();
+		TqInt chunkSize = (count + numChunks - 1)/numChunks;
+		std::vector<SqBins> chunkBins(numChunks);
+		for(TqInt c = 0; c < numChunks; ++c)
+		{
+			TqInt chunkBegin = begin + c*chunkSize;
+			TqInt chunkEnd = std::min(end, chunkBegin + chunkSize);
+			if(chunkBegin >= chunkEnd)
+				break;
+			scheduler->addWorkUnit(boost::bind(&CqBvh::binRefs,
+					&refs[chunkBegin], chunkEnd - chunkBegin,
+					boost::cref(centroidBound), &chunkBins[c]));
+		}
+		scheduler->joinAll();
+		for(TqInt c = 0; c < numChunks; ++c)
+		{
+			for(TqInt axis = 0; axis < 3; ++axis)
+			{
+				for(TqInt b = 0; b < numBins; ++b)
+				{
+					bins.bounds[axis][b].extend(chunkBins[c].bounds[axis][b]);
+					bins.counts[axis][b] += chunkBins[c].counts[axis][b];
+				}
+			}
+		}
+	}
+	else
+		binRefs(&refs[begin], count, centroidBound, &bins);
+
+	// Evaluate the SAH for the planes between the bins.
+	TqFloat bestCost = FLT_MAX;
+	TqInt bestAxis = -1;
+	TqInt bestSplit = 0;
+	for(TqInt axis = 0; axis < 3; ++axis)
+	{
+		if(centroidBound.max[axis] <= centroidBound.min[axis])
+			continue;
+		TqFloat rightCost[numBins];
+		SqBox rightBox;
+		TqInt rightCount = 0;
+		for(TqInt b = numBins-1; b > 0; --b)
+		{
+			rightBox.extend(bins.bounds[axis][b]);
+			rightCount += bins.counts[axis][b];
+			rightCost[b] = rightCount*rightBox.halfArea();
+		}
+		SqBox leftBox;
+		TqInt leftCount = 0;
+		for(TqInt b = 0; b < numBins-1; ++b)
+		{
+			leftBox.extend(bins.bounds[axis][b]);
+			leftCount += bins.counts[axis][b];
+			if(leftCount == 0 || leftCount == count)
+				continue;
+			TqFloat cost = leftCount*leftBox.halfArea() + rightCost[b+1];
+			if(cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b;
+			}
+		}
+	}
+
+	TqInt mid = begin;
+	if(bestAxis >= 0)
+	{
+		TqFloat area = bound.halfArea();
+		TqFloat splitCost = area > 0 ? traversalCost + bestCost/area : count;
+		if(splitCost >= count && count <= maxLeafSize)
+		{
+			makeLeaf(m_nodes[nodeIndex], begin, end);
+			return;
+		}
+		TqFloat scale[3];
+		binScales(centroidBound.min, centroidBound.max, scale);
+		SqSplitPred<SqBuildRef> pred = {bestAxis, bestSplit, centroidBound.min, scale};
+		mid = std::partition(refs.begin() + begin, refs.begin() + end, pred)
+			- refs.begin();
+	}
+	if(mid == begin || mid == end)
+	{
+		// The centroids couldn't be separated by the bins, which only happens
+		// for coincident or extremely clustered triangles.  Split at the
+		// median along the longest axis.
+		if(count <= maxLeafSize)
+		{
+			makeLeaf(m_nodes[nodeIndex], begin, end);
+			return;
+		}
+		TqInt axis = 0;
+		for(TqInt i = 1; i < 3; ++i)
+		{
+			if(bound.max[i] - bound.min[i] > bound.max[axis] - bound.min[axis])
+				axis = i;
+		}
+		mid = begin + count/2;
+		SqCentroidLess<SqBuildRef> less = {axis};
+		std::nth_element(refs.begin() + begin, refs.begin() + mid,
+				refs.begin() + end, less);
+	}
+
+	TqInt left = m_nodes.size();
+	m_nodes.resize(left + 2);
+	m_nodes[nodeIndex].offset = left;
+	m_nodes[nodeIndex].count = 0;
+	buildNode(left, begin, mid, refs, scheduler, depth + 1);
+	buildNode(left + 1, mid, end, refs, scheduler, depth + 1);
+}
+
+
+//------------------------------------------------------------------------------
+// Single ray traversal
+
+namespace {
+
+/// Slab test of a ray against a node box, narrowing [tMin,tMax].
+template<typename NodeT>
+inline bool hitBox(const NodeT& node, const TqFloat org[3],
+		const TqFloat invDir[3], TqFloat tMin, TqFloat tMax)
+{
+	for(TqInt i = 0; i < 3; ++i)
+	{
+		TqFloat t0 = (node.bmin[i] - org[i])*invDir[i];
+		TqFloat t1 = (node.bmax[i] - org[i])*invDir[i];
+		if(t0 > t1)
+			std::swap(t0, t1);
+		tMin = std::max(tMin, t0);
+		tMax = std::min(tMax, t1);
+	}
+	return tMin <= tMax;
+}
+
+} // unnamed namespace
+
+inline bool CqBvh::intersectTriangle(const SqTriangle& tri, const TqFloat org[3],
+		const TqFloat dir[3], TqFloat tMin, TqFloat& t,
+		TqFloat& u, TqFloat& v) const
+{
+	// Moller-Trumbore, two sided.
+	TqFloat p[3] = {
+		dir[1]*tri.e2[2] - dir[2]*tri.e2[1],
+		dir[2]*tri.e2[0] - dir[0]*tri.e2[2],
+		dir[0]*tri.e2[1] - dir[1]*tri.e2[0]
+	};
+	TqFloat det = tri.e1[0]*p[0] + tri.e1[1]*p[1] + tri.e1[2]*p[2];
+	if(std::fabs(det) < 1e-20f)
+		return false;
+	TqFloat invDet = 1.0f/det;
+	TqFloat s[3] = {org[0] - tri.v0[0], org[1] - tri.v0[1], org[2] - tri.v0[2]};
+	u = (s[0]*p[0] + s[1]*p[1] + s[2]*p[2])*invDet;
+	if(u < 0 || u > 1)
+		return false;
+	TqFloat q[3] = {
+		s[1]*tri.e1[2] - s[2]*tri.e1[1],
+		s[2]*tri.e1[0] - s[0]*tri.e1[2],
+		s[0]*tri.e1[1] - s[1]*tri.e1[0]
+	};
+	v = (dir[0]*q[0] + dir[1]*q[1] + dir[2]*q[2])*invDet;
+	if(v < 0 || u + v > 1)
+		return false;
+	t = (tri.e2[0]*q[0] + tri.e2[1]*q[1] + tri.e2[2]*q[2])*invDet;
+	return t > tMin;
+}
+
+bool CqBvh::intersect(const CqVector3D& orgV, const CqVector3D& dirV,
+		TqFloat tMin, TqFloat tMax, SqRayHit& hit) const
+{
+	if(m_nodes.empty())
+		return false;
+	TqFloat org[3] = {orgV.x(), orgV.y(), orgV.z()};
+	TqFloat dir[3] = {dirV.x(), dirV.y(), dirV.z()};
+	TqFloat invDir[3] = {safeInverse(dir[0]), safeInverse(dir[1]), safeInverse(dir[2])};
+
+	const SqTriangle* hitTri = 0;
+	TqInt stack[stackSize];
+	TqInt top = 0;
+	stack[top++] = 0;
+	while(top > 0)
+	{
+		const SqNode& node = m_nodes[stack[--top]];
+		if(!hitBox(node, org, invDir, tMin, tMax))
+			continue;
+		if(node.count > 0)
+		{
+			for(TqInt i = node.offset, end = node.offset + node.count; i < end; ++i)
+			{
+				TqFloat t, u, v;
+				if(intersectTriangle(m_triangles[i], org, dir, tMin, t, u, v)
+					&& t < tMax)
+				{
+					tMax = t;
+					hit.t = t;
+					hit.u = u;
+					hit.v = v;
+					hitTri = &m_triangles[i];
+				}
+			}
+		}
+		else
+		{
+			// Visit the child nearest along the ray first; it's pushed last.
+			TqInt first = node.offset;
+			TqInt second = node.offset + 1;
+			const SqNode& a = m_nodes[first];
+			const SqNode& b = m_nodes[second];
+			TqFloat da = 0, db = 0;
+			for(TqInt i = 0; i < 3; ++i)
+			{
+				da += (a.bmin[i] + a.bmax[i] - 2*org[i])*dir[i];
+				db += (b.bmin[i] + b.bmax[i] - 2*org[i])*dir[i];
+			}
+			if(db < da)
+				std::swap(first, second);
+			stack[top++] = second;
+			stack[top++] = first;
+		}
+	}
+	if(!hitTri)
+		return false;
+	CqVector3D e1(hitTri->e1[0], hitTri->e1[1], hitTri->e1[2]);
+	CqVector3D e2(hitTri->e2[0], hitTri->e2[1], hitTri->e2[2]);
+	hit.Ng = e1 % e2;
+	hit.primitive = hitTri->primitive;
+	return true;
+}
+
+bool CqBvh::occluded(const CqVector3D& orgV, const CqVector3D& dirV,
+		TqFloat tMin, TqFloat tMax) const
+{
+	if(m_nodes.empty())
+		return false;
+	TqFloat org[3] = {orgV.x(), orgV.y(), orgV.z()};
+	TqFloat dir[3] = {dirV.x(), dirV.y(), dirV.z()};
+	TqFloat invDir[3] = {safeInverse(dir[0]), safeInverse(dir[1]), safeInverse(dir[2])};
+
+	TqInt stack[stackSize];
+	TqInt top = 0;
+	stack[top++] = 0;
+	while(top > 0)
+	{
+		const SqNode& node = m_nodes[stack[--top]];
+		if(!hitBox(node, org, invDir, tMin, tMax))
+			continue;
+		if(node.count > 0)
+		{
+			for(TqInt i = node.offset, end = node.offset + node.count; i < end; ++i)
+			{
+				TqFloat t, u, v;
+				if(intersectTriangle(m_triangles[i], org, dir, tMin, t, u, v)
+					&& t < tMax)
+					return true;
+			}
+		}
+		else
+		{
+			stack[top++] = node.offset + 1;
+			stack[top++] = node.offset;
+		}
+	}
+	return false;
+}
+
+
+//------------------------------------------------------------------------------
+// Packet traversal
+
+void CqBvh::occludedStream(const CqVector3D* org, const CqVector3D* dir,
+		TqFloat tMin, const TqFloat* tMax, TqInt count, bool* occluded) const
+{
+	if(m_nodes.empty())
+	{
+		std::fill(occluded, occluded + count, false);
+		return;
+	}
+#ifdef __SSE__
+	TqInt i = 0;
+	for(; i + 4 <= count; i += 4)
+		occludedPacket(org + i, dir + i, tMin, tMax + i, occluded + i);
+	if(i < count)
+	{
+		// Pad the last packet by repeating its final ray.
+		CqVector3D padOrg[4];
+		CqVector3D padDir[4];
+		TqFloat padTMax[4];
+		bool padOccluded[4];
+		for(TqInt j = 0; j < 4; ++j)
+		{
+			TqInt k = std::min(i + j, count - 1);
+			padOrg[j] = org[k];
+			padDir[j] = dir[k];
+			padTMax[j] = tMax[k];
+		}
+		occludedPacket(padOrg, padDir, tMin, padTMax, padOccluded);
+		for(TqInt j = 0; i + j < count; ++j)
+			occluded[i + j] = padOccluded[j];
+	}
+#else
+	for(TqInt i = 0; i < count; ++i)
+		occluded[i] = this->occluded(org[i], dir[i], tMin, tMax[i]);
+#endif
+}
+
+#ifdef __SSE__
+
+void CqBvh::occludedPacket(const CqVector3D* org, const CqVector3D* dir,
+		TqFloat tMin, const TqFloat* tMax, bool* occluded) const
+{
+	const __m128 ox = _mm_setr_ps(org[0].x(), org[1].x(), org[2].x(), org[3].x());
+	const __m128 oy = _mm_setr_ps(org[0].y(), org[1].y(), org[2].y(), org[3].y());
+	const __m128 oz = _mm_setr_ps(org[0].z(), org[1].z(), org[2].z(), org[3].z());
+	const __m128 dx = _mm_setr_ps(dir[0].x(), dir[1].x(), dir[2].x(), dir[3].x());
+	const __m128 dy = _mm_setr_ps(dir[0].y(), dir[1].y(), dir[2].y(), dir[3].y());
+	const __m128 dz = _mm_setr_ps(dir[0].z(), dir[1].z(), dir[2].z(), dir[3].z());
+	const __m128 ix = _mm_setr_ps(safeInverse(dir[0].x()), safeInverse(dir[1].x()),
+			safeInverse(dir[2].x()), safeInverse(dir[3].x()));
+	const __m128 iy = _mm_setr_ps(safeInverse(dir[0].y()), safeInverse(dir[1].y()),
+			safeInverse(dir[2].y()), safeInverse(dir[3].y()));
+	const __m128 iz = _mm_setr_ps(safeInverse(dir[0].z()), safeInverse(dir[1].z()),
+			safeInverse(dir[2].z()), safeInverse(dir[3].z()));
+	const __m128 tmin = _mm_set1_ps(tMin);
+	const __m128 tmax = _mm_setr_ps(tMax[0], tMax[1], tMax[2], tMax[3]);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 detEps = _mm_set1_ps(1e-20f);
+
+	// Bit i of done is set once ray i is known to be occluded.
+	TqInt done = 0;
+	TqInt stack[stackSize];
+	TqInt top = 0;
+	stack[top++] = 0;
+	while(top > 0)
+	{
+		const SqNode& node = m_nodes[stack[--top]];
+		// Slab test of all four rays against the node box.
+		__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bmin[0]), ox), ix);
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bmax[0]), ox), ix);
+		__m128 tNear = _mm_max_ps(tmin, _mm_min_ps(t0, t1));
+		__m128 tFar = _mm_min_ps(tmax, _mm_max_ps(t0, t1));
+		t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bmin[1]), oy), iy);
+		t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bmax[1]), oy), iy);
+		tNear = _mm_max_ps(tNear, _mm_min_ps(t0, t1));
+		tFar = _mm_min_ps(tFar, _mm_max_ps(t0, t1));
+		t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bmin[2]), oz), iz);
+		t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bmax[2]), oz), iz);
+		tNear = _mm_max_ps(tNear, _mm_min_ps(t0, t1));
+		tFar = _mm_min_ps(tFar, _mm_max_ps(t0, t1));
+		if((_mm_movemask_ps(_mm_cmple_ps(tNear, tFar)) & ~done) == 0)
+			continue;
+
+		if(node.count == 0)
+		{
+			stack[top++] = node.offset + 1;
+			stack[top++] = node.offset;
+			continue;
+		}
+		for(TqInt i = node.offset, end = node.offset + node.count; i < end; ++i)
+		{
+			const SqTriangle& tri = m_triangles[i];
+			const __m128 e1x = _mm_set1_ps(tri.e1[0]);
+			const __m128 e1y = _mm_set1_ps(tri.e1[1]);
+			const __m128 e1z = _mm_set1_ps(tri.e1[2]);
+			const __m128 e2x = _mm_set1_ps(tri.e2[0]);
+			const __m128 e2y = _mm_set1_ps(tri.e2[1]);
+			const __m128 e2z = _mm_set1_ps(tri.e2[2]);
+			// p = dir x e2
+			__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+			__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+			__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+			__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px),
+						_mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+			__m128 invDet = _mm_div_ps(one, det);
+			// s = org - v0
+			__m128 sx = _mm_sub_ps(ox, _mm_set1_ps(tri.v0[0]));
+			__m128 sy = _mm_sub_ps(oy, _mm_set1_ps(tri.v0[1]));
+			__m128 sz = _mm_sub_ps(oz, _mm_set1_ps(tri.v0[2]));
+			__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px),
+						_mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+			// q = s x e1
+			__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+			__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+			__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+			__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx),
+						_mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+			__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx),
+						_mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+			__m128 hit = _mm_cmpgt_ps(_mm_max_ps(det, _mm_sub_ps(zero, det)), detEps);
+			hit = _mm_and_ps(hit, _mm_cmpge_ps(u, zero));
+			hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+			hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), one));
+			hit = _mm_and_ps(hit, _mm_cmpgt_ps(t, tmin));
+			hit = _mm_and_ps(hit, _mm_cmplt_ps(t, tmax));
+			done |= _mm_movemask_ps(hit);
+		}
+		if(done == 0xf)
+			break;
+	}
+	for(TqInt i = 0; i < 4; ++i)
+		occluded[i] = (done & (1 << i)) != 0;
+}
+
+#else
+
+void CqBvh::occludedPacket(const CqVector3D* org, const CqVector3D* dir,
+		TqFloat tMin, const TqFloat* tMax, bool* occluded) const
+{
+	for(TqInt i = 0; i < 4; ++i)
+		occluded[i] = this->occluded(org[i], dir[i], tMin, tMax[i]);
+}
+
+#endif // __SSE__
+
+} // namespace Aqsis
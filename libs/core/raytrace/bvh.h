@@ -0,0 +1,162 @@
+// Aqsis
+// Copyright (C) 1997 - 2001, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+/** \file
+		\brief Bounding volume hierarchy over triangles for ray queries.
+*/
+
+#ifndef BVH_H_INCLUDED
+#define BVH_H_INCLUDED
+
+#include	<aqsis/aqsis.h>
+
+#include	<vector>
+
+#include	<aqsis/core/iraytrace.h>
+#include	<aqsis/math/vector3d.h>
+
+namespace Aqsis {
+
+class CqThreadScheduler;
+
+/** \brief A bounding volume hierarchy over a set of triangles.
+ *
+ * The tree is built top down with the surface area heuristic, evaluated over
+ * a fixed number of bins along each axis.  For large nodes the binning is
+ * split over the primitives and run on the threads of a CqThreadScheduler.
+ *
+ * Nodes are stored depth first in a single array, with the two children of
+ * an interior node next to each other, and the triangles of each leaf
+ * contiguous in the triangle array, so that traversal touches memory in a
+ * mostly linear order.
+ *
+ * Occlusion queries for several rays may be made together with
+ * occludedStream(), which traces packets of four rays through the tree using
+ * SSE where it's available.
+ */
+class CqBvh
+{
+	public:
+		CqBvh();
+
+		/// Remove all triangles and the tree.
+		void clear();
+		/** \brief Add a triangle.
+		 *
+		 * \param primitive - index of the primitive the triangle came from,
+		 *                    reported back in ray hits.
+		 */
+		void addTriangle(const CqVector3D& a, const CqVector3D& b,
+				const CqVector3D& c, TqInt primitive);
+		/** \brief Build the tree over all triangles added so far.
+		 *
+		 * \param scheduler - threads used for the binning of large nodes; may
+		 *                    be null to build on the calling thread only.
+		 */
+		void build(CqThreadScheduler* scheduler = 0);
+
+		/// Number of triangles held.
+		TqInt numTriangles() const;
+		/// Number of tree nodes.
+		TqInt numNodes() const;
+
+		/// Find the closest hit along a ray; see IqRaytrace::Intersect().
+		bool intersect(const CqVector3D& org, const CqVector3D& dir,
+				TqFloat tMin, TqFloat tMax, SqRayHit& hit) const;
+		/// Determine whether anything blocks a ray.
+		bool occluded(const CqVector3D& org, const CqVector3D& dir,
+				TqFloat tMin, TqFloat tMax) const;
+		/// Occlusion for a set of rays; see IqRaytrace::OccludedStream().
+		void occludedStream(const CqVector3D* org, const CqVector3D* dir,
+				TqFloat tMin, const TqFloat* tMax, TqInt count,
+				bool* occluded) const;
+
+	private:
+		/// Triangle stored as a vertex and two edges, ready for intersection.
+		struct SqTriangle
+		{
+			TqFloat v0[3];
+			TqFloat e1[3];
+			TqFloat e2[3];
+			TqInt primitive;
+		};
+		/** \brief Tree node, 32 bytes.
+		 *
+		 * For interior nodes count is zero and offset is the index of the
+		 * first child; the second child follows it.  For leaves offset is the
+		 * index of the first triangle and count the number of triangles.
+		 */
+		struct SqNode
+		{
+			TqFloat bmin[3];
+			TqInt offset;
+			TqFloat bmax[3];
+			TqInt count;
+		};
+		/// Axis aligned box used during the build.
+		struct SqBox
+		{
+			TqFloat min[3];
+			TqFloat max[3];
+			SqBox();
+			void extend(const SqBox& b);
+			void extend(const TqFloat p[3]);
+			TqFloat halfArea() const;
+		};
+		/// Bins along all three axes for the SAH evaluation.
+		struct SqBins;
+		struct SqBuildRef;
+
+		void buildNode(TqInt nodeIndex, TqInt begin, TqInt end,
+				std::vector<SqBuildRef>& refs, CqThreadScheduler* scheduler,
+				TqInt depth);
+		static void binRefs(const SqBuildRef* refs, TqInt count,
+				const SqBox& centroidBound, SqBins* bins);
+		void makeLeaf(SqNode& node, TqInt begin, TqInt end);
+
+		bool intersectTriangle(const SqTriangle& tri, const TqFloat org[3],
+				const TqFloat dir[3], TqFloat tMin, TqFloat& t,
+				TqFloat& u, TqFloat& v) const;
+		void occludedPacket(const CqVector3D* org, const CqVector3D* dir,
+				TqFloat tMin, const TqFloat* tMax, bool* occluded) const;
+
+		/// Triangles, in leaf order once built.
+		std::vector<SqTriangle> m_triangles;
+		/// Tree nodes; the root is node zero.
+		std::vector<SqNode> m_nodes;
+};
+
+
+//==============================================================================
+// Implementation details
+//==============================================================================
+inline TqInt CqBvh::numTriangles() const
+{
+	return m_triangles.size();
+}
+
+inline TqInt CqBvh::numNodes() const
+{
+	return m_nodes.size();
+}
+
+} // namespace Aqsis
+
+#endif // BVH_H_INCLUDED
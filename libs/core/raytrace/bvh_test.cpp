@@ -0,0 +1,124 @@
+// Aqsis
+// Copyright (C) 1997 - 2007, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+/** \file
+ *
+ * \brief Unit tests for the ray tracing BVH
+ */
+
+#include "bvh.h"
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/auto_unit_test.hpp>
+#include <boost/test/floating_point_comparison.hpp>
+
+BOOST_AUTO_TEST_SUITE(bvh_tests)
+
+using namespace Aqsis;
+
+namespace {
+
+// Fill the bvh with an n*n grid of unit quads in the plane z = depth, each
+// split into two triangles.  The quads of row j belong to primitive j.
+void addQuadGrid(CqBvh& bvh, TqInt n, TqFloat depth)
+{
+	for(TqInt j = 0; j < n; ++j)
+	{
+		for(TqInt i = 0; i < n; ++i)
+		{
+			CqVector3D a(i, j, depth);
+			CqVector3D b(i+1, j, depth);
+			CqVector3D c(i+1, j+1, depth);
+			CqVector3D d(i, j+1, depth);
+			bvh.addTriangle(a, b, c, j);
+			bvh.addTriangle(a, c, d, j);
+		}
+	}
+}
+
+} // unnamed namespace
+
+BOOST_AUTO_TEST_CASE(bvh_intersect_test)
+{
+	CqBvh bvh;
+	addQuadGrid(bvh, 20, 5);
+	// A second, nearer layer covering only part of the first.
+	bvh.addTriangle(CqVector3D(0,0,2), CqVector3D(4,0,2), CqVector3D(0,4,2), 100);
+	bvh.build();
+	BOOST_CHECK_EQUAL(bvh.numTriangles(), 20*20*2 + 1);
+
+	SqRayHit hit;
+	BOOST_REQUIRE(bvh.intersect(CqVector3D(10.5, 3.5, 0), CqVector3D(0,0,1),
+				0, 100, hit));
+	BOOST_CHECK_CLOSE(hit.t, 5.0f, 1e-4f);
+	BOOST_CHECK_EQUAL(hit.primitive, 3);
+
+	// The nearer triangle must win over the grid behind it.
+	BOOST_REQUIRE(bvh.intersect(CqVector3D(1, 1, 0), CqVector3D(0,0,1),
+				0, 100, hit));
+	BOOST_CHECK_CLOSE(hit.t, 2.0f, 1e-4f);
+	BOOST_CHECK_EQUAL(hit.primitive, 100);
+
+	// Limited ray extent and misses.
+	BOOST_CHECK(!bvh.intersect(CqVector3D(10.5, 3.5, 0), CqVector3D(0,0,1),
+				0, 4, hit));
+	BOOST_CHECK(!bvh.intersect(CqVector3D(10.5, 3.5, 0), CqVector3D(0,0,-1),
+				0, 100, hit));
+	BOOST_CHECK(!bvh.intersect(CqVector3D(-1, 3.5, 0), CqVector3D(0,0,1),
+				0, 100, hit));
+}
+
+BOOST_AUTO_TEST_CASE(bvh_occluded_stream_test)
+{
+	CqBvh bvh;
+	addQuadGrid(bvh, 16, 5);
+	bvh.build();
+
+	// Rays straddling the edge of the grid, in a count which isn't a multiple
+	// of the packet size.
+	const TqInt numRays = 11;
+	CqVector3D org[numRays];
+	CqVector3D dir[numRays];
+	TqFloat tMax[numRays];
+	bool occluded[numRays];
+	for(TqInt i = 0; i < numRays; ++i)
+	{
+		org[i] = CqVector3D(10 + i + 0.5f, 8.5, 0);
+		dir[i] = CqVector3D(0, 0, 1);
+		tMax[i] = (i == 2) ? 3 : 100;
+	}
+	bvh.occludedStream(org, dir, 0, tMax, numRays, occluded);
+	for(TqInt i = 0; i < numRays; ++i)
+	{
+		bool expected = org[i].x() < 16 && i != 2;
+		BOOST_CHECK_EQUAL(occluded[i], expected);
+		BOOST_CHECK_EQUAL(bvh.occluded(org[i], dir[i], 0, tMax[i]), expected);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(bvh_empty_test)
+{
+	CqBvh bvh;
+	bvh.build();
+	SqRayHit hit;
+	BOOST_CHECK(!bvh.intersect(CqVector3D(0,0,0), CqVector3D(0,0,1), 0, 100, hit));
+	BOOST_CHECK(!bvh.occluded(CqVector3D(0,0,0), CqVector3D(0,0,1), 0, 100));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,13 +1,19 @@
 set(raytrace_srcs
+	bvh.cpp
 	raytrace.cpp
-	raytrace.h
 )
 make_absolute(raytrace_srcs ${raytrace_SOURCE_DIR})
 
 set(raytrace_hdrs
-	iraytrace.h
+	bvh.h
+	raytrace.h
 )
 make_absolute(raytrace_hdrs ${raytrace_SOURCE_DIR})
 
+set(raytrace_test_srcs
+	bvh_test.cpp
+)
+make_absolute(raytrace_test_srcs ${raytrace_SOURCE_DIR})
+
 include_directories(${raytrace_SOURCE_DIR})
 
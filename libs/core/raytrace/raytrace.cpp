@@ -26,6 +26,15 @@
 #include	<aqsis/aqsis.h>
 #include	"raytrace.h"
 
+#include	<cmath>
+
+#include	<aqsis/util/logging.h>
+#include	"curves.h"
+#include	"points.h"
+#include	"procedural.h"
+#include	"renderer.h"
+#include	"surface.h"
+
 namespace Aqsis {
 
 
@@ -36,14 +45,146 @@ IqRaytrace* CreateRaytracer()
 }
 
 
-void CqRaytrace::Initialise()
+namespace {
+
+/// Number of micropolygons along the longest side of a primitive when tessellating.
+const TqFloat traceResolution = 32;
+/// Maximum number of splits before a primitive is given up on.
+const TqInt maxSplitDepth = 20;
+
+} // unnamed namespace
+
+CqRaytrace::CqRaytrace()
+	: m_bvh(),
+	m_numPrimitives(0),
+	m_finalised(false)
 {}
 
+void CqRaytrace::Initialise()
+{
+	m_bvh.clear();
+	m_numPrimitives = 0;
+	m_finalised = false;
+}
+
 void CqRaytrace::AddPrimitive(const boost::shared_ptr<IqSurface>& pSurface)
-{}
+{
+	boost::shared_ptr<CqSurface> surface =
+		boost::dynamic_pointer_cast<CqSurface>(pSurface);
+	if(!surface)
+		return;
+	const TqInt* trace = surface->pAttributes()->GetIntegerAttribute("visibility", "trace");
+	if(!trace || trace[0] == 0)
+		return;
+	// Procedurals would have to be expanded during parsing, and points and
+	// curves don't dice to a surface.
+	if(dynamic_cast<CqProcedural*>(surface.get())
+		|| dynamic_cast<CqPoints*>(surface.get())
+		|| dynamic_cast<CqCurve*>(surface.get()))
+		return;
+
+	// Work on a copy, since dicing and splitting change the surface state
+	// which the main pipeline relies on.
+	boost::shared_ptr<CqSurface> copy(surface->Clone());
+	const TqInt* multipass = QGetRenderContext()->GetIntegerOption("Render", "multipass");
+	if(multipass && multipass[0])
+	{
+		// In multipass mode the primitive isn't moved to camera space until
+		// the world is rendered, so do the same transformation here.
+		CqMatrix matWtoC, matNWtoC, matVWtoC;
+		QGetRenderContext()->matSpaceToSpace("world", "camera", NULL, copy->pTransform().get(), 0, matWtoC);
+		QGetRenderContext()->matNSpaceToSpace("world", "camera", NULL, copy->pTransform().get(), 0, matNWtoC);
+		QGetRenderContext()->matVSpaceToSpace("world", "camera", NULL, copy->pTransform().get(), 0, matVWtoC);
+		copy->Transform(matWtoC, matNWtoC, matVWtoC);
+	}
+
+	// Dice in a scaled camera space, chosen so that the whole primitive
+	// comes out at about traceResolution micropolygons across, independent of
+	// the shading rate.
+	CqBound bound;
+	copy->Bound(&bound);
+	CqVector3D extent = bound.vecMax() - bound.vecMin();
+	TqFloat size = max(extent.x(), max(extent.y(), extent.z()));
+	if(!(size > 0))
+		return;
+	TqFloat scale = traceResolution*std::sqrt(copy->AdjustedShadingRate())/size;
+	Tessellate(copy, CqMatrix(scale, scale, scale), 0);
+	++m_numPrimitives;
+	m_finalised = false;
+}
+
+void CqRaytrace::Tessellate(const boost::shared_ptr<CqSurface>& pSurface,
+		const CqMatrix& diceCoords, TqInt splitDepth)
+{
+	if(pSurface->Diceable(diceCoords))
+	{
+		CqMicroPolyGridBase* pGrid = pSurface->Dice();
+		if(!pGrid)
+			return;
+		ADDREF(pGrid);
+		const CqVector3D* P = 0;
+		if(IqShaderData* pVarP = pGrid->pVar(EnvVars_P))
+			pVarP->GetPointPtr(P);
+		if(P)
+		{
+			TqInt uRes = pGrid->uGridRes();
+			TqInt vRes = pGrid->vGridRes();
+			TqInt rowLen = uRes + 1;
+			for(TqInt v = 0; v < vRes; ++v)
+			{
+				for(TqInt u = 0; u < uRes; ++u)
+				{
+					const CqVector3D& a = P[v*rowLen + u];
+					const CqVector3D& b = P[v*rowLen + u + 1];
+					const CqVector3D& c = P[(v+1)*rowLen + u + 1];
+					const CqVector3D& d = P[(v+1)*rowLen + u];
+					m_bvh.addTriangle(a, b, c, m_numPrimitives);
+					m_bvh.addTriangle(a, c, d, m_numPrimitives);
+				}
+			}
+		}
+		RELEASEREF(pGrid);
+	}
+	else if(!pSurface->fDiscard() && splitDepth < maxSplitDepth)
+	{
+		std::vector<boost::shared_ptr<CqSurface> > aSplits;
+		TqInt cSplits = pSurface->Split(aSplits);
+		for(TqInt i = 0; i < cSplits; ++i)
+			Tessellate(aSplits[i], diceCoords, splitDepth + 1);
+	}
+}
 
 void CqRaytrace::Finalise()
-{}
+{
+	if(m_finalised)
+		return;
+	m_bvh.build(&QGetRenderContext()->threadScheduler());
+	m_finalised = true;
+	if(m_numPrimitives > 0)
+	{
+		Aqsis::log() << debug << "Raytracing " << m_numPrimitives << " primitives as "
+			<< m_bvh.numTriangles() << " triangles, " << m_bvh.numNodes()
+			<< " BVH nodes" << std::endl;
+	}
+}
+
+bool CqRaytrace::Intersect(const CqVector3D& org, const CqVector3D& dir,
+		TqFloat tMin, TqFloat tMax, SqRayHit& hit) const
+{
+	return m_bvh.intersect(org, dir, tMin, tMax, hit);
+}
+
+bool CqRaytrace::Occluded(const CqVector3D& org, const CqVector3D& dir,
+		TqFloat tMin, TqFloat tMax) const
+{
+	return m_bvh.occluded(org, dir, tMin, tMax);
+}
+
+void CqRaytrace::OccludedStream(const CqVector3D* org, const CqVector3D* dir,
+		TqFloat tMin, const TqFloat* tMax, TqInt count, bool* occluded) const
+{
+	m_bvh.occludedStream(org, dir, tMin, tMax, count, occluded);
+}
 
 
 //---------------------------------------------------------------------
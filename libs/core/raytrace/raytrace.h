@@ -14,15 +14,28 @@
 #define	___raytrace_Loaded___
 
 #include	<aqsis/aqsis.h>
-#include	"iraytrace.h"
+
+#include	<boost/shared_ptr.hpp>
+
+#include	<aqsis/core/iraytrace.h>
+#include	<aqsis/math/matrix.h>
+#include	"bvh.h"
 
 namespace Aqsis {
 
 
+class CqSurface;
+
+/** \brief Raytracer holding tessellated scene geometry in a BVH.
+ *
+ * Primitives with Attribute "visibility" "trace" set are diced into grids in
+ * camera space as they're added, and the grids are broken into triangles
+ * which are held in a CqBvh.  The tree is built by Finalise(), after which
+ * ray queries may be made until the next Initialise().
+ */
 struct CqRaytrace : public IqRaytrace
 {
-	CqRaytrace()
-	{}
+	CqRaytrace();
 	virtual ~CqRaytrace()
 	{}
 
@@ -31,6 +44,24 @@ struct CqRaytrace : public IqRaytrace
 	virtual	void	Initialise();
 	virtual	void	AddPrimitive(const boost::shared_ptr<IqSurface>& pSurface);
 	virtual void	Finalise();
+	virtual bool	Intersect(const CqVector3D& org, const CqVector3D& dir,
+			TqFloat tMin, TqFloat tMax, SqRayHit& hit) const;
+	virtual bool	Occluded(const CqVector3D& org, const CqVector3D& dir,
+			TqFloat tMin, TqFloat tMax) const;
+	virtual void	OccludedStream(const CqVector3D* org, const CqVector3D* dir,
+			TqFloat tMin, const TqFloat* tMax, TqInt count,
+			bool* occluded) const;
+
+private:
+	void	Tessellate(const boost::shared_ptr<CqSurface>& pSurface,
+			const CqMatrix& diceCoords, TqInt splitDepth);
+
+	/// Acceleration structure over the tessellated primitives.
+	CqBvh	m_bvh;
+	/// Number of primitives added since Initialise().
+	TqInt	m_numPrimitives;
+	/// True once Finalise() has built the tree.
+	bool	m_finalised;
 };
 
 
@@ -39,6 +39,7 @@
 #include	"lath.h"
 #include	"transform.h"
 #include	"texturemap_old.h"
+#include	"threadscheduler.h"
 #include	<aqsis/shadervm/ishader.h>
 #include	"tiffio.h"
 
@@ -58,13 +59,6 @@ void TIFF_ErrorHandler(const char*, const char*, va_list);
 void TIFF_WarnHandler(const char*, const char*, va_list);
 
 
-static const TqUlong ohash = CqString::hash( "object" ); //< == "object"
-static const TqUlong shash = CqString::hash( "shader" ); //< == "shader"
-static const TqUlong chash = CqString::hash( "camera" ); //< == "camera"
-static const TqUlong cuhash = CqString::hash( "current" ); //< == "current"
-
-static CqMatrix oldkey[2];  //< to eliminate Inverse(), Transpose() matrix ops.
-static CqMatrix oldresult[2];
 
 //---------------------------------------------------------------------
 /** Default constructor for the main renderer class. Initialises current state.
@@ -82,6 +76,7 @@ CqRenderer::CqRenderer()
 	m_Shaders(),
 	m_InstancedShaders(),
 	m_lights(),
+	m_lightIndex(),
 	m_textureCache(),
 	m_fSaveGPrims(false),
 	m_pTransCamera(new CqTransform()),
@@ -99,13 +94,18 @@ CqRenderer::CqRenderer()
 	m_pErrorHandler(&RiErrorPrint),
 	m_pProgressHandler(0),
 	m_pRaytracer(CreateRaytracer()),
+	m_threadScheduler(),
+	m_threadSchedulerThreads(0),
 	m_clippingVolume(),
 	m_aWorld(),
 	m_cropWindowXMin(0),
 	m_cropWindowXMax(0),
 	m_cropWindowYMin(0),
 	m_cropWindowYMax(0),
-	m_aCoordSystems(CoordSystem_Last)
+	m_aCoordSystems(CoordSystem_Last),
+	m_spaceHashes(),
+	m_spaceHandles(),
+	m_spaceCache()
 {
 	m_pDDManager->Initialise();
 
@@ -129,6 +129,16 @@ CqRenderer::CqRenderer()
 	m_aCoordSystems[ CoordSystem_NDC ].m_hash = CqString::hash( "NDC" );
 	m_aCoordSystems[ CoordSystem_Raster ].m_hash = CqString::hash( "raster" );
 
+	// Set up the handles of the special spaces; "current" is the same as "camera".
+	m_spaceHashes.resize( Space_Last );
+	m_spaceHashes[ Space_Object ] = CqString::hash( "object" );
+	m_spaceHashes[ Space_Shader ] = CqString::hash( "shader" );
+	m_spaceHashes[ Space_Camera ] = CqString::hash( "camera" );
+	m_spaceHashes[ Space_World ] = CqString::hash( "world" );
+	for ( TqInt i = 0; i < Space_Last; ++i )
+		m_spaceHandles[ m_spaceHashes[ i ] ] = i;
+	m_spaceHandles[ CqString::hash( "current" ) ] = Space_Camera;
+
 	// Set the TIFF Error/Warn handler
 	TIFFSetErrorHandler( &TIFF_ErrorHandler );
 	TIFFSetWarningHandler( &TIFF_WarnHandler );
@@ -681,12 +691,14 @@ void CqRenderer::RenderWorld(bool clone)
 	}
 
 	initialiseCropWindow();
+	invalidateSpaceCache();
 
 	// Ensure that the camera and projection matrices are initialised.
 	poptCurrent()->InitialiseCamera();
 	pImage()->SetImage();
 
 	PrepareShaders();
+	buildLightIndex();
 
 	if(clone)
 		PostCloneOfWorld();
@@ -704,95 +716,118 @@ void CqRenderer::RenderWorld(bool clone)
 
 //----------------------------------------------------------------------
 /** Render any automatic shadow passes.
+ *
+ * Each light with an "autoshadows" "shadowmapname" attribute gets a depth map
+ * rendered from its point of view.  The passes run one after another, each
+ * rendering its own copy of the world, since the image buffer, display
+ * manager and option stack are global to the renderer, and shader instances
+ * can't be run by two views at once.  Diced or displaced geometry can't be
+ * shared between the passes either, as dicing depends on the view and
+ * displacement runs on the diced grids.
+ *
+ * What is shared is the texture cache, where only the map just written is
+ * dropped after each pass, and the worker pool from threadScheduler(), which
+ * each pass uses for its bucket post-processing.
  */
 
 void CqRenderer::RenderAutoShadows()
 {
 	// Check if multipass rendering is switched on.
 	const TqInt* pMultipass = GetIntegerOption("Render", "multipass");
-	if(pMultipass && pMultipass[0])
+	if(!pMultipass || !pMultipass[0])
+		return;
+
+	// Find all the lightsources with an attribute indicating autoshadows.
+	std::vector<CqLightsourcePtr> shadowLights;
+	for(TqLightMap::iterator ilight = m_lights.begin(),
+		lend = m_lights.end(); ilight != lend; ++ilight)
 	{
-		// Check all the lightsources for any with an attribute indicating autoshadows.
-		for(TqLightMap::iterator ilight = m_lights.begin(),
-			lend = m_lights.end(); ilight != lend; ++ilight)
-		{
-			CqLightsourcePtr light = ilight->second;
-			const CqString* pMapName = light->pAttributes()->GetStringAttribute("autoshadows", "shadowmapname");
-			const CqString* pattrName = light->pAttributes()->GetStringAttribute( "identifier", "name" );
-			if(NULL != pMapName)
-			{
-				if(NULL != pattrName)
-					Aqsis::log() << info << "Rendering automatic shadow pass for lightsource : \"" << pattrName[0].c_str() << "\" to shadow map file \"" << pMapName[0].c_str() << "\"" << std::endl;
-				else
-					Aqsis::log() << info << "Rendering automatic shadow pass for lightsource : \"unnamed\" to shadow map file \"" << pMapName[0].c_str() << "\"" << std::endl;
-
-				const TqInt* pRes = light->pAttributes()->GetIntegerAttribute("autoshadows", "res");
-				TqInt res = 300;
-				if(NULL != pRes)
-					res = pRes[0];
-				// Setup a new set of options based on the current ones.
-				IqOptionsPtr opts = pushOptions();
-				opts->GetIntegerOptionWrite( "System", "Resolution" ) [ 0 ] = res;
-				opts->GetIntegerOptionWrite( "System", "Resolution" ) [ 1 ] = res;
-				opts->GetFloatOptionWrite( "System", "PixelAspectRatio" ) [ 0 ] = 1.0f;
-
-				// Now that the options have all been set, setup any undefined camera parameters.
-				opts->GetFloatOptionWrite( "System", "FrameAspectRatio" ) [ 0 ] = 1.0;
-				opts->GetFloatOptionWrite( "System", "ScreenWindow" ) [ 0 ] = -1.0 ;
-				opts->GetFloatOptionWrite( "System", "ScreenWindow" ) [ 1 ] = 1.0;
-				opts->GetFloatOptionWrite( "System", "ScreenWindow" ) [ 2 ] = 1.0;
-				opts->GetFloatOptionWrite( "System", "ScreenWindow" ) [ 3 ] = -1.0;
-				opts->GetIntegerOptionWrite( "System", "DisplayMode" ) [ 0 ] = DMode_Z;
-
-				// Set the pixel samples to 1,1 for shadow rendering.
-				opts->GetIntegerOptionWrite( "System", "PixelSamples" ) [ 0 ] = 1;
-				opts->GetIntegerOptionWrite( "System", "PixelSamples" ) [ 1 ] = 1;
-
-				// Set the pixel filter to box, 1,1 for shadow rendering.
-				opts->SetfuncFilter( RiBoxFilter );
-				opts->GetFloatOptionWrite( "System", "FilterWidth" ) [ 0 ] = 1;
-				opts->GetFloatOptionWrite( "System", "FilterWidth" ) [ 1 ] = 1;
-
-				// Turn off jitter for shadow rendering.
-				opts->GetIntegerOptionWrite("Hider", "jitter")[0] = 0;
-
-				// Make sure the depthFilter is set to "midpoint".
-				opts->GetStringOptionWrite( "Hider", "depthfilter" ) [ 0 ] = CqString("midpoint");
-
-				// Don't bother doing lighting calcualations.
-				opts->GetIntegerOptionWrite( "EnableShaders", "lighting" ) [ 0 ] = 0;
-
-				// Now set the camera transform the to light transform (inverse because the camera transform is transforming the world into camera space).
-				CqTransformPtr lightTrans(light->pTransform()->Inverse());
-
-				// Cache the current DDManager, and replace it for the purposes of our shadow render.
-				IqDDManager* realDDManager = m_pDDManager;
-				m_pDDManager = CreateDisplayDriverManager();
-				m_pDDManager->Initialise();
-				std::map<std::string, void*> args;
-				AddDisplayRequest(pMapName[0].c_str(), "shadow", "z", DMode_Z, 0, 1, args);
-
-				// Store the current camera transform for later.
-				CqTransformPtr defaultCamera;
-				defaultCamera = GetCameraTransform();
-				SetCameraTransform(lightTrans);
-				
-				// Render the world
-				RenderWorld(true);
-
-				popOptions();
-				SetCameraTransform(defaultCamera);
-
-				m_pDDManager->Shutdown();
-				delete(m_pDDManager);
-				m_pDDManager = realDDManager;
-
-				CqTextureMapOld::FlushCache();
-				m_textureCache->flush();
-				clippingVolume().clear();
-			}
-		}
+		if(ilight->second->pAttributes()->GetStringAttribute("autoshadows", "shadowmapname"))
+			shadowLights.push_back(ilight->second);
 	}
+	if(shadowLights.empty())
+		return;
+
+	// Setup a new set of options based on the current ones.  These are shared
+	// by all the shadow passes; only the resolution differs between lights.
+	IqOptionsPtr opts = pushOptions();
+	opts->GetFloatOptionWrite( "System", "PixelAspectRatio" ) [ 0 ] = 1.0f;
+
+	// Now that the options have all been set, setup any undefined camera parameters.
+	opts->GetFloatOptionWrite( "System", "FrameAspectRatio" ) [ 0 ] = 1.0;
+	opts->GetFloatOptionWrite( "System", "ScreenWindow" ) [ 0 ] = -1.0 ;
+	opts->GetFloatOptionWrite( "System", "ScreenWindow" ) [ 1 ] = 1.0;
+	opts->GetFloatOptionWrite( "System", "ScreenWindow" ) [ 2 ] = 1.0;
+	opts->GetFloatOptionWrite( "System", "ScreenWindow" ) [ 3 ] = -1.0;
+	opts->GetIntegerOptionWrite( "System", "DisplayMode" ) [ 0 ] = DMode_Z;
+
+	// Set the pixel samples to 1,1 for shadow rendering.
+	opts->GetIntegerOptionWrite( "System", "PixelSamples" ) [ 0 ] = 1;
+	opts->GetIntegerOptionWrite( "System", "PixelSamples" ) [ 1 ] = 1;
+
+	// Set the pixel filter to box, 1,1 for shadow rendering.
+	opts->SetfuncFilter( RiBoxFilter );
+	opts->GetFloatOptionWrite( "System", "FilterWidth" ) [ 0 ] = 1;
+	opts->GetFloatOptionWrite( "System", "FilterWidth" ) [ 1 ] = 1;
+
+	// Turn off jitter for shadow rendering.
+	opts->GetIntegerOptionWrite("Hider", "jitter")[0] = 0;
+
+	// Make sure the depthFilter is set to "midpoint".
+	opts->GetStringOptionWrite( "Hider", "depthfilter" ) [ 0 ] = CqString("midpoint");
+
+	// Don't bother doing lighting calcualations.
+	opts->GetIntegerOptionWrite( "EnableShaders", "lighting" ) [ 0 ] = 0;
+
+	// Store the current camera transform for later.
+	CqTransformPtr defaultCamera = GetCameraTransform();
+
+	for(std::vector<CqLightsourcePtr>::iterator ilight = shadowLights.begin(),
+		lend = shadowLights.end(); ilight != lend; ++ilight)
+	{
+		const CqLightsourcePtr& light = *ilight;
+		const CqString* pMapName = light->pAttributes()->GetStringAttribute("autoshadows", "shadowmapname");
+		const CqString* pattrName = light->pAttributes()->GetStringAttribute( "identifier", "name" );
+		if(NULL != pattrName)
+			Aqsis::log() << info << "Rendering automatic shadow pass for lightsource : \"" << pattrName[0].c_str() << "\" to shadow map file \"" << pMapName[0].c_str() << "\"" << std::endl;
+		else
+			Aqsis::log() << info << "Rendering automatic shadow pass for lightsource : \"unnamed\" to shadow map file \"" << pMapName[0].c_str() << "\"" << std::endl;
+
+		const TqInt* pRes = light->pAttributes()->GetIntegerAttribute("autoshadows", "res");
+		TqInt res = 300;
+		if(NULL != pRes)
+			res = pRes[0];
+		opts->GetIntegerOptionWrite( "System", "Resolution" ) [ 0 ] = res;
+		opts->GetIntegerOptionWrite( "System", "Resolution" ) [ 1 ] = res;
+
+		// Now set the camera transform the to light transform (inverse because the camera transform is transforming the world into camera space).
+		CqTransformPtr lightTrans(light->pTransform()->Inverse());
+
+		// Cache the current DDManager, and replace it for the purposes of our shadow render.
+		IqDDManager* realDDManager = m_pDDManager;
+		m_pDDManager = CreateDisplayDriverManager();
+		m_pDDManager->Initialise();
+		std::map<std::string, void*> args;
+		AddDisplayRequest(pMapName[0].c_str(), "shadow", "z", DMode_Z, 0, 1, args);
+
+		SetCameraTransform(lightTrans);
+
+		// Render the world
+		RenderWorld(true);
+
+		m_pDDManager->Shutdown();
+		delete(m_pDDManager);
+		m_pDDManager = realDDManager;
+
+		// Only the map which was just written is out of date; other
+		// textures stay cached for the remaining passes and the main render.
+		CqTextureMapOld::FlushCache( pMapName[0] );
+		m_textureCache->invalidate( pMapName[0].c_str() );
+		clippingVolume().clear();
+	}
+
+	popOptions();
+	SetCameraTransform(defaultCamera);
 }
 
 
@@ -810,6 +845,26 @@ void CqRenderer::Quit()
 }
 
 
+//----------------------------------------------------------------------
+/** Get the worker thread pool, making it on first use.
+ */
+
+CqThreadScheduler& CqRenderer::threadScheduler()
+{
+	TqInt numThreads = 0;
+	if(const TqInt* threads = poptCurrent()->GetIntegerOption("limits", "threads"))
+		numThreads = threads[0];
+	if(!m_threadScheduler || numThreads != m_threadSchedulerThreads)
+	{
+		// Stop the old workers before starting the new ones.
+		m_threadScheduler.reset();
+		m_threadScheduler.reset(new CqThreadScheduler(numThreads));
+		m_threadSchedulerThreads = numThreads;
+	}
+	return *m_threadScheduler;
+}
+
+
 //----------------------------------------------------------------------
 /** Initialise the renderer.
  */
@@ -820,6 +875,7 @@ void CqRenderer::Initialise()
 
 	// Truncate the array of named coordinate systems to just the standard ones.
 	m_aCoordSystems.resize( CoordSystem_Last );
+	invalidateSpaceCache();
 
 	// Clear the output data entries
 	m_OutputDataEntries.clear();
@@ -834,200 +890,224 @@ void CqRenderer::Initialise()
 /** Get the matrix to convert between the specified coordinate systems.
  */
 
-
 bool	CqRenderer::matSpaceToSpace( const char* strFrom, const char* strTo, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result )
 {
-	CqMatrix	matA, matB;
+	return ( spaceToSpace( spaceHandle( strFrom ), spaceHandle( strTo ), transShaderToWorld, transObjectToWorld, time, Transform_Point, result ) );
+}
 
-	// Get the hash keys for From,To spaces
-	const TqUlong fhash = CqString::hash( strFrom );
-	const TqUlong thash = CqString::hash( strTo );
 
-	// Get the two component matrices.
-	// First check for special cases.
-	if ( fhash == ohash )
-	{
-		if (transObjectToWorld) 
-			matA = transObjectToWorld->matObjectToWorld(time);
-	} else if ( fhash == shash )
-	{
-		if (transShaderToWorld) 
-			matA = transShaderToWorld->matObjectToWorld(time);
-	} else if ( ( fhash == chash ) || ( fhash == cuhash ) )
-	{
-		if (m_pTransCamera) 
-			matA = m_pTransCamera->matObjectToWorld( time ).Inverse();
-	}
-	else
-	{
-		if(!WhichMatToWorld( matA, fhash ))
-			return(false);
-	}
+//----------------------------------------------------------------------
+/** Get the matrix to convert vectors between the specified coordinate systems.
+ */
 
+bool	CqRenderer::matVSpaceToSpace( const char* strFrom, const char* strTo, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result )
+{
+	return ( spaceToSpace( spaceHandle( strFrom ), spaceHandle( strTo ), transShaderToWorld, transObjectToWorld, time, Transform_Vector, result ) );
+}
 
-	if ( thash == ohash )
-	{
-		if (transObjectToWorld)
-			matB = transObjectToWorld->matObjectToWorld(time).Inverse();
-	} else if ( thash == shash )
-	{
-		if (transShaderToWorld)
-			matB = transShaderToWorld->matObjectToWorld(time).Inverse();
-	} else if ( ( thash == chash ) || ( thash == cuhash ) )
-	{
-		if (m_pTransCamera)
-			matB = m_pTransCamera->matObjectToWorld( time );
-	} else
-	{
-		if(!WhichMatWorldTo( matB, thash ))
-			return(false);
-	}
 
-	result = matB * matA;
+//----------------------------------------------------------------------
+/** Get the matrix to convert normals between the specified coordinate systems.
+ */
 
-	return ( true );
+bool	CqRenderer::matNSpaceToSpace( const char* strFrom, const char* strTo, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result )
+{
+	return ( spaceToSpace( spaceHandle( strFrom ), spaceHandle( strTo ), transShaderToWorld, transObjectToWorld, time, Transform_Normal, result ) );
+}
+
+
+bool	CqRenderer::matSpaceToSpace( TqInt from, TqInt to, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result )
+{
+	return ( spaceToSpace( from, to, transShaderToWorld, transObjectToWorld, time, Transform_Point, result ) );
+}
+
+bool	CqRenderer::matVSpaceToSpace( TqInt from, TqInt to, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result )
+{
+	return ( spaceToSpace( from, to, transShaderToWorld, transObjectToWorld, time, Transform_Vector, result ) );
 }
 
+bool	CqRenderer::matNSpaceToSpace( TqInt from, TqInt to, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result )
+{
+	return ( spaceToSpace( from, to, transShaderToWorld, transObjectToWorld, time, Transform_Normal, result ) );
+}
 
 
 //----------------------------------------------------------------------
-/** Get the matrix to convert vectors between the specified coordinate systems.
+/** Get the handle for a named space, creating one if necessary.
  */
 
-bool	CqRenderer::matVSpaceToSpace( const char* strFrom, const char* strTo, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result )
+TqInt	CqRenderer::spaceHandle( const char* strName )
 {
-	CqMatrix	matA, matB;
+	const TqUlong hash = CqString::hash( strName );
+#ifdef ENABLE_THREADING
+	boost::mutex::scoped_lock lock( m_spaceMutex );
+#endif
+	std::map<TqUlong, TqInt>::const_iterator i = m_spaceHandles.find( hash );
+	if ( i != m_spaceHandles.end() )
+		return ( i->second );
+	TqInt handle = m_spaceHashes.size();
+	m_spaceHashes.push_back( hash );
+	m_spaceHandles[ hash ] = handle;
+	return ( handle );
+}
 
-	// Get the hash keys for From,To spaces
-	const TqUlong fhash = CqString::hash( strFrom );
-	const TqUlong thash = CqString::hash( strTo );
 
-	// Get the two component matrices.
-	// First check for special cases.
-	if ( fhash == ohash )
-	{
-		if (transObjectToWorld)
-			matA = transObjectToWorld->matObjectToWorld(time);
-	} else if ( fhash == shash )
-	{
-		if (transShaderToWorld)
-			matA = transShaderToWorld->matObjectToWorld(time);
-	} else if ( ( fhash == chash ) || ( fhash == cuhash ) )
-	{
-		if (m_pTransCamera)
-			matA = m_pTransCamera->matObjectToWorld( time ).Inverse();
-	} else
-	{
-		if(!WhichMatToWorld ( matA, fhash ))
-			return(false);
-	}
+//----------------------------------------------------------------------
+/** Get the matrix to convert some kind of quantity between two spaces.
+ *
+ * The "object" and "shader" spaces depend on the transforms passed in, so
+ * can't be cached.  For these the named side of the transformation is taken
+ * from the cache instead, leaving only the object or shader matrix (and its
+ * inverse if it's the destination) to compute.
+ */
 
-	if ( thash == ohash )
+bool	CqRenderer::spaceToSpace( TqInt from, TqInt to, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, EqTransformKind kind, CqMatrix& result )
+{
+	bool fromNamed = from != Space_Object && from != Space_Shader;
+	bool toNamed = to != Space_Object && to != Space_Shader;
+	if ( fromNamed && toNamed )
+		return ( cachedSpaceToSpace( from, to, time, kind, result ) );
+
+	CqMatrix	matA, matB;
+	if ( fromNamed )
 	{
-		if (transObjectToWorld)
-			matB = transObjectToWorld->matObjectToWorld(time).Inverse();
-	} else if ( thash == shash )
+		if ( !cachedSpaceToSpace( from, Space_World, time, Transform_Point, matA ) )
+			return ( false );
+	}
+	else
 	{
-		if (transShaderToWorld)
-			matB = transShaderToWorld->matObjectToWorld(time).Inverse();
+		const IqTransform* trans = ( from == Space_Object ) ? transObjectToWorld : transShaderToWorld;
+		if ( trans )
+			matA = trans->matObjectToWorld( time );
 	}
-	else if ( ( thash == chash ) || ( thash == cuhash ) )
+	if ( toNamed )
 	{
-		if (m_pTransCamera)
-			matB = m_pTransCamera->matObjectToWorld( time );
-	} else
+		if ( !cachedSpaceToSpace( Space_World, to, time, Transform_Point, matB ) )
+			return ( false );
+	}
+	else
 	{
-		if(!WhichMatWorldTo ( matB, thash ))
-			return(false);
+		const IqTransform* trans = ( to == Space_Object ) ? transObjectToWorld : transShaderToWorld;
+		if ( trans )
+			matB = trans->matObjectToWorld( time ).Inverse();
 	}
 
 	result = matB * matA;
-
-
-
-	if (memcmp((void *) oldkey[0].pElements(), (void *) result.pElements(), sizeof(TqFloat) * 16) != 0)
+	if ( kind != Transform_Point )
 	{
-		oldkey[0] = result;
 		result[ 3 ][ 0 ] = result[ 3 ][ 1 ] = result[ 3 ][ 2 ] = result[ 0 ][ 3 ] = result[ 1 ][ 3 ] = result[ 2 ][ 3 ] = 0.0;
 		result[ 3 ][ 3 ] = 1.0;
-		oldresult[0] = result;
-
-	}
-	else
-	{
-		result = oldresult[0];
+		if ( kind == Transform_Normal )
+			result = result.Inverse().Transpose();
 	}
 	return ( true );
 }
 
 
 //----------------------------------------------------------------------
-/** Get the matrix to convert normals between the specified coordinate systems.
+/** Get a matrix between two named spaces from the cache, computing all
+ * three kinds of matrix the first time the pair is seen at a given time.
  */
 
-bool	CqRenderer::matNSpaceToSpace( const char* strFrom, const char* strTo, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result )
+bool	CqRenderer::cachedSpaceToSpace( TqInt from, TqInt to, TqFloat time, EqTransformKind kind, CqMatrix& result )
 {
-	CqMatrix	matA, matB;
+#ifdef ENABLE_THREADING
+	boost::mutex::scoped_lock lock( m_spaceMutex );
+#endif
+	SqSpaceKey key( from, to, time );
+	TqSpaceCache::const_iterator i = m_spaceCache.find( key );
+	if ( i == m_spaceCache.end() )
+	{
+		CqMatrix	matA, matB;
+		if ( !namedToWorld( from, time, matA ) || !worldToNamed( to, time, matB ) )
+			return ( false );
+		SqSpaceTransform trans;
+		trans.matPoint = matB * matA;
+		trans.matVector = trans.matPoint;
+		CqMatrix& v = trans.matVector;
+		v[ 3 ][ 0 ] = v[ 3 ][ 1 ] = v[ 3 ][ 2 ] = v[ 0 ][ 3 ] = v[ 1 ][ 3 ] = v[ 2 ][ 3 ] = 0.0;
+		v[ 3 ][ 3 ] = 1.0;
+		trans.matNormal = v.Inverse().Transpose();
+		i = m_spaceCache.insert( std::make_pair( key, trans ) ).first;
+	}
+	switch ( kind )
+	{
+		case Transform_Point:
+			result = i->second.matPoint;
+			break;
+		case Transform_Vector:
+			result = i->second.matVector;
+			break;
+		case Transform_Normal:
+			result = i->second.matNormal;
+			break;
+	}
+	return ( true );
+}
 
-	// Get the hash keys for From,To spaces
-	const TqUlong fhash = CqString::hash( strFrom );
-	const TqUlong thash = CqString::hash( strTo );
 
-	// Get the two component matrices.
-	// First check for special cases.
-	if ( fhash == ohash )
-	{
-		if (transObjectToWorld)
-			matA = transObjectToWorld->matObjectToWorld(time);
-	} else if ( fhash == shash )
-	{
-		if (transShaderToWorld)
-			matA = transShaderToWorld->matObjectToWorld(time);
-	} else if ( ( fhash == chash ) || ( fhash == cuhash ) )
+//----------------------------------------------------------------------
+/** Get the matrix from a named space to world space.
+ */
+
+bool	CqRenderer::namedToWorld( TqInt space, TqFloat time, CqMatrix& result ) const
+{
+	if ( space == Space_Camera )
 	{
-		if (m_pTransCamera)
-			matA = m_pTransCamera->matObjectToWorld( time ).Inverse();
-	} else
+		result = m_pTransCamera ? m_pTransCamera->matObjectToWorld( time ).Inverse() : CqMatrix();
+		return ( true );
+	}
+	if ( const SqCoordSys* coordSys = findCoordSystem( m_spaceHashes[ space ] ) )
 	{
-		if(!WhichMatToWorld ( matA, fhash ))
-			return(false);
+		result = coordSys->m_matToWorld;
+		return ( true );
 	}
+	return ( false );
+}
 
-	if ( thash == ohash )
-	{
-		if (transObjectToWorld)
-			matB = transObjectToWorld->matObjectToWorld(time).Inverse();
-	} else if ( thash == shash )
-	{
-		if (transShaderToWorld)
-			matB = transShaderToWorld->matObjectToWorld(time).Inverse();
-	} else if ( ( thash == chash ) || ( thash == cuhash ) )
+
+//----------------------------------------------------------------------
+/** Get the matrix from world space to a named space.
+ */
+
+bool	CqRenderer::worldToNamed( TqInt space, TqFloat time, CqMatrix& result ) const
+{
+	if ( space == Space_Camera )
 	{
-		if (m_pTransCamera)
-			matB = m_pTransCamera->matObjectToWorld( time );
-	} else
+		result = m_pTransCamera ? m_pTransCamera->matObjectToWorld( time ) : CqMatrix();
+		return ( true );
+	}
+	if ( const SqCoordSys* coordSys = findCoordSystem( m_spaceHashes[ space ] ) )
 	{
-		if(!WhichMatWorldTo ( matB, thash ))
-			return(false);
+		result = coordSys->m_matWorldTo;
+		return ( true );
 	}
+	return ( false );
+}
 
 
-	result = matB * matA;
-	if (memcmp((void *) oldkey[1].pElements(), (void *) result.pElements(), sizeof(TqFloat) * 16) != 0)
-	{
-		oldkey[1] = result;
-		result[ 3 ][ 0 ] = result[ 3 ][ 1 ] = result[ 3 ][ 2 ] = result[ 0 ][ 3 ] = result[ 1 ][ 3 ] = result[ 2 ][ 3 ] = 0.0;
-		result[ 3 ][ 3 ] = 1.0;
-		result = result.Inverse().Transpose();
-		oldresult[1] = result;
+//----------------------------------------------------------------------
+/** Find a registered coordinate system by the hash of its name.
+ */
 
-	}
-	else
+const SqCoordSys* CqRenderer::findCoordSystem( TqUlong hash ) const
+{
+	for ( std::vector<SqCoordSys>::const_iterator i = m_aCoordSystems.begin(),
+			end = m_aCoordSystems.end(); i != end; ++i )
 	{
-		result = oldresult[1];
+		if ( i->m_hash == hash )
+			return ( &*i );
 	}
+	return ( 0 );
+}
 
-	return ( true );
+
+void	CqRenderer::invalidateSpaceCache()
+{
+#ifdef ENABLE_THREADING
+	boost::mutex::scoped_lock lock( m_spaceMutex );
+#endif
+	m_spaceCache.clear();
 }
 
 
@@ -1098,12 +1178,14 @@ bool	CqRenderer::SetCoordSystem( const char* strName, const CqMatrix& matToWorld
 		{
 			m_aCoordSystems[ i ].m_matToWorld = matToWorld;
 			m_aCoordSystems[ i ].m_matWorldTo = matToWorld.Inverse();
+			invalidateSpaceCache();
 			return ( true );
 		}
 	}
 
 	// If we got here, it didn't exists.
 	m_aCoordSystems.push_back( SqCoordSys( strName, matToWorld, matToWorld.Inverse() ) );
+	invalidateSpaceCache();
 	return ( false );
 }
 
@@ -1176,8 +1258,7 @@ boost::shared_ptr<IqShader> CqRenderer::CreateShader(
 	fileName += RI_SHADER_EXTENSION;
 	boost::filesystem::path shaderPath
 		= poptCurrent()->findRiFileNothrow(fileName, "shader");
-	boost::filesystem::ifstream shaderFile(shaderPath);
-	if(shaderFile)
+	if(!shaderPath.empty())
 	{
 		Aqsis::log() << info << "Loading shader \"" << strName
 			<< "\" from file \"" << native(shaderPath)
@@ -1192,11 +1273,16 @@ boost::shared_ptr<IqShader> CqRenderer::CreateShader(
 			Aqsis::log() << info << "DSO lib path set to \"" << dsoPath
 				<< "\"" << std::endl;
 		}
+		std::string cacheDir;
+		const CqString* poptCacheDir = QGetRenderContext()->poptCurrent()
+			->GetStringOption( "shading", "cachedir" );
+		if(poptCacheDir)
+			cacheDir = poptCacheDir->c_str();
 
 		boost::shared_ptr<IqShader> pShader;
 		try
 		{
-			pShader = createShaderVM(this, shaderFile, dsoPath);
+			pShader = createShaderVM(this, native(shaderPath), dsoPath, cacheDir);
 		}
 		catch(XqBadShader& e)
 		{
@@ -1382,6 +1468,30 @@ CqLightsourcePtr CqRenderer::findLight(const char* name)
 	return i->second;
 }
 
+void CqRenderer::buildLightIndex()
+{
+	m_lightIndex.clear();
+	for(TqLightMap::const_iterator ilight = m_lights.begin(),
+		lend = m_lights.end(); ilight != lend; ++ilight)
+	{
+		m_lightIndex.addLight(ilight->second.get(),
+				ilight->second->influenceVolume());
+	}
+	m_lightIndex.build();
+	if(m_lightIndex.numLights() > 0)
+		Aqsis::log() << debug << "Light index holds " << m_lightIndex.numLights()
+			<< " of " << m_lights.size() << " lights" << std::endl;
+}
+
+TqInt CqRenderer::cullLights(const CqVector3D& boxMin, const CqVector3D& boxMax,
+		const IqLightsource** lights, TqInt count) const
+{
+	TqInt numCulled = m_lightIndex.cullLights(boxMin, boxMax, lights, count);
+	CqStats::addI( CqStats::LGT_tested, count );
+	CqStats::addI( CqStats::LGT_culled, numCulled );
+	return numCulled;
+}
+
 //---------------------------------------------------------------------
 /** Add a new requested display driver to the list.
  */
@@ -1455,68 +1565,6 @@ bool	CqRenderer::GetBasisMatrix( CqMatrix& matBasis, const CqString& name )
 		return ( false );
 }
 
-//---------------------------------------------------------------------
-/** Which matrix will be used in ToWorld
- */
-bool CqRenderer::WhichMatToWorld( CqMatrix &matA, TqUlong thash )
-{
-	static TqInt awhich = 0;
-	TqInt tmp = awhich;
-
-
-	for ( ; awhich >= 0; awhich-- )
-	{
-		if ( m_aCoordSystems[ awhich ].m_hash == thash )
-		{
-			matA = m_aCoordSystems[ awhich ].m_matToWorld;
-			return(true);
-		}
-	}
-
-	TqInt size = m_aCoordSystems.size() - 1;
-	for ( awhich = size; awhich > tmp; awhich-- )
-	{
-		if ( m_aCoordSystems[ awhich ].m_hash == thash )
-		{
-			matA = m_aCoordSystems[ awhich ].m_matToWorld;
-			return(true);
-		}
-	}
-	return(false);
-}
-
-//---------------------------------------------------------------------
-/** Which matrix will be used in WorldTo
- */
-
-bool CqRenderer::WhichMatWorldTo( CqMatrix &matB, TqUlong thash )
-{
-	static TqInt bwhich = 0;
-	TqInt tmp = bwhich;
-
-
-	for ( ; bwhich >= 0; bwhich-- )
-	{
-		if ( m_aCoordSystems[ bwhich ].m_hash == thash )
-		{
-			matB = m_aCoordSystems[ bwhich ].m_matWorldTo;
-			return(true);
-		}
-	}
-
-	TqInt size = m_aCoordSystems.size() - 1;
-	for ( bwhich = size; bwhich > tmp; bwhich-- )
-	{
-		if ( m_aCoordSystems[ bwhich ].m_hash == thash )
-		{
-			matB = m_aCoordSystems[ bwhich ].m_matWorldTo;
-			return(true);
-		}
-	}
-	return(false);
-}
-
-
 TqInt CqRenderer::RegisterOutputData( const char* name )
 {
 	TqInt offset;
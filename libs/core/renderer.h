@@ -32,6 +32,10 @@
 #include	<iostream>
 #include	<time.h>
 
+#ifdef ENABLE_THREADING
+#include	<boost/thread/mutex.hpp>
+#endif
+
 #include	<aqsis/aqsis.h>
 
 #include	<aqsis/ri/ri.h>
@@ -43,8 +47,7 @@
 #include	<aqsis/riutil/tokendictionary.h>
 #include	"iddmanager.h"
 #include	<aqsis/core/irenderer.h>
-#include	"iraytrace.h"
-#include	"iraytrace.h"
+#include	<aqsis/core/iraytrace.h>
 #include	<aqsis/tex/filtering/itexturecache.h>
 #include	"lights.h"
 
@@ -54,6 +57,7 @@ namespace Aqsis {
 
 class CqImageBuffer;
 class CqModeBlock;
+class CqThreadScheduler;
 
 struct SqCoordSys
 {
@@ -184,6 +188,10 @@ class CqRenderer : public IqRenderer
 		virtual	bool	matSpaceToSpace	( const char* strFrom, const char* strTo, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result );
 		virtual	bool	matVSpaceToSpace	( const char* strFrom, const char* strTo, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result );
 		virtual	bool	matNSpaceToSpace	( const char* strFrom, const char* strTo, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result );
+		virtual	TqInt	spaceHandle( const char* strName );
+		virtual	bool	matSpaceToSpace	( TqInt from, TqInt to, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result );
+		virtual	bool	matVSpaceToSpace	( TqInt from, TqInt to, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result );
+		virtual	bool	matNSpaceToSpace	( TqInt from, TqInt to, const IqTransform* transShaderToWorld, const IqTransform* transObjectToWorld, TqFloat time, CqMatrix& result );
 
 		virtual	const	TqFloat*	GetFloatOption( const char* strName, const char* strParam ) const;
 		virtual	const	TqInt*	GetIntegerOption( const char* strName, const char* strParam ) const;
@@ -277,6 +285,9 @@ class CqRenderer : public IqRenderer
 		void registerLight(const char* name, CqLightsourcePtr light);
 		/// Find the light associated with the given name
 		CqLightsourcePtr findLight(const char* name);
+		/// Build the index of light influence volumes used by cullLights().
+		void buildLightIndex();
+		virtual	TqInt	cullLights( const CqVector3D& boxMin, const CqVector3D& boxMax, const IqLightsource** lights, TqInt count ) const;
 
 		void	PostSurface( const boost::shared_ptr<CqSurface>& pSurface );
 		void	StorePrimitive( const boost::shared_ptr<CqSurface>& pSurface );
@@ -293,6 +304,7 @@ class CqRenderer : public IqRenderer
 				m_aCoordSystems[ CoordSystem_Screen ].m_matToWorld = mat.Inverse();
 			else
 				m_aCoordSystems[ CoordSystem_Screen ].m_matToWorld = CqMatrix();
+			invalidateSpaceCache();
 		}
 		/** Set the world to NDC matrix.
 		 * \param mat The new matrix to use as the world to NDC transformation.
@@ -304,6 +316,7 @@ class CqRenderer : public IqRenderer
 				m_aCoordSystems[ CoordSystem_NDC ].m_matToWorld = mat.Inverse();
 			else
 				m_aCoordSystems[ CoordSystem_NDC ].m_matToWorld = CqMatrix();
+			invalidateSpaceCache();
 		}
 		/** Set the world to raster matrix.
 		 * \param mat The new matrix to use as the world to raster transformation.
@@ -315,6 +328,7 @@ class CqRenderer : public IqRenderer
 				m_aCoordSystems[ CoordSystem_Raster ].m_matToWorld = mat.Inverse();
 			else
 				m_aCoordSystems[ CoordSystem_Raster ].m_matToWorld = CqMatrix();
+			invalidateSpaceCache();
 		}
 		/** Set the world to camera transform.
 		 * \param ptrans A pointer to the transformation object which represents the world to camera transform.
@@ -322,6 +336,7 @@ class CqRenderer : public IqRenderer
 		virtual	void	SetCameraTransform( const CqTransformPtr& ptrans )
 		{
 			m_pTransCamera = ptrans;
+			invalidateSpaceCache();
 		}
 		/** Get the world to camera tramsform.
 		 * \return A pointer to the transformation object which represents the world to camera transform.
@@ -482,6 +497,13 @@ class CqRenderer : public IqRenderer
 			return( m_pRaytracer );
 		}
 
+		/** Get the worker thread pool shared by the rendering stages.
+		 *
+		 * The pool lives across frames, and is only rebuilt when
+		 * Option "limits" "threads" asks for a different number of threads.
+		 */
+		CqThreadScheduler&	threadScheduler();
+
 		bool	IsWorldBegin() const
 		{
 			return(m_fWorldBegin);
@@ -541,6 +563,7 @@ class CqRenderer : public IqRenderer
 
 		typedef std::map<std::string, CqLightsourcePtr> TqLightMap;
 		TqLightMap m_lights;
+		CqLightIndex m_lightIndex;	///< Influence volumes of the lights in m_lights.
 
 		boost::shared_ptr<IqTextureCache> m_textureCache; ///< Cache for aqsistex texture access.
 		 
@@ -559,8 +582,49 @@ class CqRenderer : public IqRenderer
 		bool			m_UsingDepthOfField;
 		CqVector2D		m_DepthOfFieldScale;
 
-		bool WhichMatWorldTo(CqMatrix &a, TqUlong thash);
-		bool WhichMatToWorld(CqMatrix &b, TqUlong thash);
+		/// Kinds of quantity a space to space matrix may be applied to.
+		enum EqTransformKind
+		{
+			Transform_Point,
+			Transform_Vector,
+			Transform_Normal
+		};
+		/// Matrices for each kind of quantity between a pair of spaces.
+		struct SqSpaceTransform
+		{
+			CqMatrix	matPoint;
+			CqMatrix	matVector;
+			CqMatrix	matNormal;
+		};
+		/// Key for the space transform cache.
+		struct SqSpaceKey
+		{
+			TqInt	from;
+			TqInt	to;
+			TqFloat	time;
+			SqSpaceKey(TqInt from, TqInt to, TqFloat time)
+				: from(from), to(to), time(time) {}
+			bool operator<(const SqSpaceKey& rhs) const
+			{
+				if(from != rhs.from)
+					return from < rhs.from;
+				if(to != rhs.to)
+					return to < rhs.to;
+				return time < rhs.time;
+			}
+		};
+		typedef std::map<SqSpaceKey, SqSpaceTransform> TqSpaceCache;
+
+		bool spaceToSpace(TqInt from, TqInt to, const IqTransform* transShaderToWorld,
+				const IqTransform* transObjectToWorld, TqFloat time,
+				EqTransformKind kind, CqMatrix& result);
+		bool cachedSpaceToSpace(TqInt from, TqInt to, TqFloat time,
+				EqTransformKind kind, CqMatrix& result);
+		bool namedToWorld(TqInt space, TqFloat time, CqMatrix& result) const;
+		bool worldToNamed(TqInt space, TqFloat time, CqMatrix& result) const;
+		const SqCoordSys* findCoordSystem(TqUlong hash) const;
+		/// Forget all cached space transforms, after any space changes.
+		void invalidateSpaceCache();
 
 		std::map<std::string, SqOutputDataEntry>	m_OutputDataEntries;
 		TqInt	m_OutputDataOffset;
@@ -577,6 +641,9 @@ class CqRenderer : public IqRenderer
 
 		IqRaytrace*	m_pRaytracer;		///< Pointer to the raytracing subsystem interface.
 
+		boost::shared_ptr<CqThreadScheduler>	m_threadScheduler;	///< Persistent worker thread pool.
+		TqInt	m_threadSchedulerThreads;	///< Value of "limits" "threads" the pool was made for.
+
 		CqClippingVolume	m_clippingVolume;
 
 		std::deque<boost::shared_ptr<CqSurface> >	m_aWorld;
@@ -588,6 +655,12 @@ class CqRenderer : public IqRenderer
 		TqInt				m_cropWindowYMax;
 
 		std::vector<SqCoordSys>	m_aCoordSystems; ///< List of registered coordinate systems.
+		std::vector<TqUlong>	m_spaceHashes;	///< Name hash of each space handle.
+		std::map<TqUlong, TqInt>	m_spaceHandles;	///< Space handle for each name hash.
+		TqSpaceCache	m_spaceCache;	///< Matrices between named spaces, for the current frame.
+#ifdef ENABLE_THREADING
+		boost::mutex	m_spaceMutex;	///< Protects the space handles and cache.
+#endif
 }
 ;
 
@@ -23,16 +23,24 @@
 
 #include "stats.h"
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <cstring>
 #include <string>
 
+#ifdef ENABLE_THREADING
+#include <boost/thread/mutex.hpp>
+#endif
+
 #include "attributes.h"
 #include "imagebuffer.h"
+#include "micropolygon.h"
 #include "renderer.h"
 #include "transform.h"
 #include <aqsis/math/math.h>
+#include <aqsis/tex/buffers/tilecache.h>
+#include <aqsis/tex/io/filehandlepool.h>
 
 namespace Aqsis {
 
@@ -53,6 +61,10 @@ void gStats_DecI( TqInt index )
 {
 	CqStats::DecI( index );
 }
+void gStats_IncPeakI( TqInt index, TqInt peakIndex )
+{
+	CqStats::IncPeakI( index, peakIndex );
+}
 TqInt gStats_getI( TqInt index )
 {
 	return( CqStats::getI( index ) );
@@ -71,6 +83,92 @@ void gStats_setF( TqInt index, TqFloat value )
 }
 TqFloat	 CqStats::m_floatVars[ CqStats::_Last_float ];		///< Float variables
 TqInt	 CqStats::m_intVars[ CqStats::_Last_int ];			///< Int variables
+
+#ifdef ENABLE_THREADING
+
+/// Mutex protecting the merge of per-thread counters into m_intVars.
+static boost::mutex g_statsMergeMutex;
+
+boost::thread_specific_ptr<CqStats::SqThreadCounters>
+	CqStats::m_threadCounters(&CqStats::mergeAndDelete);
+
+void CqStats::mergeLocked( SqThreadCounters* counters )
+{
+	// Counts of live objects which are kept with IncPeakI(), and their
+	// peaks.  The thread's peak is relative to the global count.
+	static const TqInt peakCounters[][2] = {
+		{ GPR_current, GPR_peak },
+		{ GRD_current, GRD_peak },
+		{ MPG_current, MPG_peak },
+		{ PRM_current, PRM_peak },
+	};
+	TqInt* vars = counters->intVars;
+	for ( TqInt i = 0; i < TqInt(sizeof(peakCounters)/sizeof(peakCounters[0])); i++ )
+	{
+		TqInt current = peakCounters[ i ][ 0 ];
+		TqInt peak = peakCounters[ i ][ 1 ];
+		m_intVars[ peak ] = std::max( m_intVars[ peak ], m_intVars[ current ] + vars[ peak ] );
+		vars[ peak ] = 0;
+	}
+	for ( TqInt i = _First_int; i < _Last_int; i++ )
+	{
+		m_intVars[ i ] += vars[ i ];
+		vars[ i ] = 0;
+	}
+}
+
+void CqStats::mergeAndDelete( SqThreadCounters* counters )
+{
+	{
+		boost::mutex::scoped_lock lock( g_statsMergeMutex );
+		mergeLocked( counters );
+	}
+	delete counters;
+}
+
+void CqStats::mergeThreadCounters()
+{
+	if( SqThreadCounters* counters = m_threadCounters.get() )
+	{
+		boost::mutex::scoped_lock lock( g_statsMergeMutex );
+		mergeLocked( counters );
+	}
+}
+
+void CqStats::setI( const TqInt index, const TqInt value )
+{
+	localIntVars()[ index ] = 0;
+	boost::mutex::scoped_lock lock( g_statsMergeMutex );
+	m_intVars[ index ] = value;
+}
+
+TqInt CqStats::getI( const TqInt index )
+{
+	// Merge first, since a thread's peaks can't simply be added on.
+	SqThreadCounters* counters = m_threadCounters.get();
+	boost::mutex::scoped_lock lock( g_statsMergeMutex );
+	if( counters )
+		mergeLocked( counters );
+	return m_intVars[ index ];
+}
+
+#else // ENABLE_THREADING
+
+void CqStats::mergeThreadCounters()
+{ }
+
+void CqStats::setI( const TqInt index, const TqInt value )
+{
+	m_intVars[ index ] = value;
+}
+
+TqInt CqStats::getI( const TqInt index )
+{
+	return m_intVars[ index ];
+}
+
+#endif // ENABLE_THREADING
+
 /**
    Initialise every variable.
  
@@ -85,6 +183,7 @@ void CqStats::Initialise()
 {
 	TqInt i;
 	m_Complete = 0.0f;
+	mergeThreadCounters();
 	for (i = _First_int; i < _Last_int; i++)
 		m_intVars[i] = 0;
 	for (i = _First_float; i < _Last_float; i++)
@@ -106,6 +205,8 @@ void CqStats::InitialiseFrame()
 	m_cTextureMemory = 0;
 	memset( m_cTextureMisses, '\0', sizeof( m_cTextureMisses ) );
 	memset( m_cTextureHits, '\0', sizeof( m_cTextureHits ) );
+	CqTileCache::instance().resetStats();
+	CqFileHandlePool::instance().resetStats();
 }
 //----------------------------------------------------------------------
 /** Output rendering stats if required.
@@ -117,6 +218,9 @@ void CqStats::PrintStats( TqInt level ) const
 #	define STATS_INT_GETI( index )	getI( index )
 #	define STATS_INT_GETF( index )	getF( index )
 
+	// Pick up any counts from the calling thread which haven't been merged.
+	mergeThreadCounters();
+
 	std::ostream& MSG = std::cout;
 	/*! Levels
 		Minimum := 0
@@ -372,6 +476,11 @@ void CqStats::PrintStats( TqInt level ) const
 		<< STATS_INT_GETI( MPG_pushed_down )		<< " down ("		<< _mpg_p_d	 << "%),\n\t\t"
 		<< STATS_INT_GETI( MPG_pushed_far_down )	<< " far down ("	<< _mpg_p_fd << "%)\n"
 		<< std::endl;
+		const SqPoolStats _mpg_pools = CqMicroPolygon::PoolStats();
+		MSG << "\tPools:\t" << _mpg_pools.slabs << " slabs (" << _mpg_pools.peakSlabs << " peak), "
+		<< _mpg_pools.reusedSlabs << " slabs reused, " << _mpg_pools.resets << " bulk resets,\n\t\t"
+		<< _mpg_pools.reusedObjects << " of " << _mpg_pools.allocations << " allocations reused\n"
+		<< std::endl;
 		/*
 			MPG stats - End
 			-------------------------------------------------------------------
@@ -402,6 +511,21 @@ void CqStats::PrintStats( TqInt level ) const
 			Sampling - End
 			-------------------------------------------------------------------
 		*/
+		/*
+			-------------------------------------------------------------------
+			Light culling
+		*/
+		TqFloat _lgt_c = 0.0f;
+		if (STATS_INT_GETI( LGT_tested ))
+			_lgt_c = 100.0f * STATS_INT_GETI( LGT_culled ) / STATS_INT_GETI( LGT_tested );
+		MSG << "Lights:\n\t"
+		<< STATS_INT_GETI( LGT_tested ) << " grid lightings, "
+		<< STATS_INT_GETI( LGT_culled ) << " culled by influence (" << _lgt_c << "%)\n"
+		<< std::endl;
+		/*
+			Light culling - End
+			-------------------------------------------------------------------
+		*/
 		/*
 			Shading stats
 			-------------------------------------------------------------------
@@ -414,6 +538,20 @@ void CqStats::PrintStats( TqInt level ) const
 	}
 	if ( level == 3 )
 	{
+		const SqTileCacheStats& tileStats = CqTileCache::instance().stats();
+		MSG << "Texture tiles       : " << tileStats.memoryUsed << " bytes used, "
+			<< tileStats.peakMemoryUsed << " peak, limit "
+			<< CqTileCache::instance().maxMemory() << std::endl;
+		MSG << "Texture tile cache  : " << tileStats.hits << " hits, "
+			<< tileStats.misses << " misses, "
+			<< tileStats.evictions << " evictions" << std::endl;
+		const SqFileHandlePoolStats& fileStats = CqFileHandlePool::instance().stats();
+		MSG << "Texture files       : " << fileStats.numOpen << " open, "
+			<< fileStats.peakOpen << " peak, limit "
+			<< CqFileHandlePool::instance().maxOpenFiles() << std::endl;
+		MSG << "Texture file handles: " << fileStats.opens << " opens ("
+			<< fileStats.reopens << " reopens), "
+			<< fileStats.closes << " closed by limit" << std::endl;
 		MSG << "Textures            : " << m_cTextureMemory << " bytes used." << std::endl;
 		MSG << "Textures hits       : " << std::endl;
 		for ( TqInt i = 0; i < 5; i++ )
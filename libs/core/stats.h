@@ -36,10 +36,15 @@
 #include <aqsis/ri/ri.h>
 #include <aqsis/util/enum.h>
 
+#ifdef ENABLE_THREADING
+#include <boost/thread/tss.hpp>
+#endif
+
 namespace Aqsis {
 
 extern void gStats_IncI( TqInt index );
 extern void gStats_DecI( TqInt index );
+extern void gStats_IncPeakI( TqInt index, TqInt peakIndex );
 extern TqInt gStats_getI( TqInt index );
 extern void gStats_setI( TqInt index, TqInt value );
 extern TqFloat gStats_getF( TqInt index );
@@ -47,11 +52,21 @@ extern void gStats_setF( TqInt index, TqFloat value );
 
 #define STATS_INC( index )				gStats_IncI( CqStats::index )
 #define STATS_DEC( index )				gStats_DecI( CqStats::index )
+#define STATS_INC_PEAK( index, peakIndex )	gStats_IncPeakI( CqStats::index, CqStats::peakIndex )
 #define	STATS_GETI( index )				gStats_getI( CqStats::index )
 #define	STATS_SETI( index , value )		gStats_setI( CqStats::index , value )
 #define	STATS_GETF( index )				gStats_getF( CqStats::index )
 #define	STATS_SETF( index , value )		gStats_setF( CqStats::index , value )
 
+/** Increment a counter from the innermost sampling loops.  These counters are
+ * compiled out entirely unless ENABLE_SAMPLE_STATS is defined.
+ */
+#ifdef ENABLE_SAMPLE_STATS
+#	define STATS_INC_SAMPLE( index )	CqStats::IncI( CqStats::index )
+#else
+#	define STATS_INC_SAMPLE( index )
+#endif
+
 
 //----------------------------------------------------------------------
 // Timer stuff.
@@ -199,27 +214,51 @@ class CqStats
 		//! Increase an integer specified by an EqIntIndex value by one
 		static void IncI( const TqInt index )
 		{
-			m_intVars[ index ]++;
+			localIntVars()[ index ]++;
 		}
 
 		//! Decrease an integer specified by an EqIntIndex value by one
 		static void DecI( const TqInt index )
 		{
-			m_intVars[ index ]--;
+			localIntVars()[ index ]--;
 		}
 
-		//! Set an integer specified by an EqIntIndex value to value
-		static void setI( const TqInt index, const TqInt value )
+		/** \brief Increase a count of live objects by one, keeping its peak.
+		 *
+		 * With threading enabled the peak is kept per thread, relative to
+		 * the count when the thread's counters were last merged, and is
+		 * added to the global count at the merge.  Objects created by other
+		 * threads in the meantime aren't seen, so the peak is then a lower
+		 * bound.
+		 */
+		static void IncPeakI( const TqInt index, const TqInt peakIndex )
 		{
-			m_intVars[ index ] = value;
+			TqInt* vars = localIntVars();
+			if( ++vars[ index ] > vars[ peakIndex ] )
+				vars[ peakIndex ] = vars[ index ];
 		}
 
-		//! Get an integer specified by an EqIntIndex value
-		static TqInt getI( const TqInt index )
+		//! Add value to an integer specified by an EqIntIndex value
+		static void addI( const TqInt index, const TqInt value )
 		{
-			return m_intVars[ index ];
+			localIntVars()[ index ] += value;
 		}
 
+		//! Set an integer specified by an EqIntIndex value to value
+		static void setI( const TqInt index, const TqInt value );
+
+		//! Get an integer specified by an EqIntIndex value
+		static TqInt getI( const TqInt index );
+
+		/** \brief Merge the calling thread's counters into the global ones.
+		 *
+		 * When threading is enabled, integer counters are incremented in a
+		 * block private to each thread, so that the hot paths don't need any
+		 * synchronisation.  The blocks are merged whenever a bucket completes
+		 * and when a thread exits.  Without threading this does nothing.
+		 */
+		static void mergeThreadCounters();
+
 		//! Set a float specified by an EqfloatIndex value to value
 		static void setF( const TqInt index, const TqFloat value )
 		{
@@ -375,6 +414,9 @@ class CqStats
 
 		       // Shading stats
 
+		       LGT_tested,
+		       LGT_culled,
+
 		       // Sampling stats
 
 		       SPL_count,
@@ -426,8 +468,23 @@ class CqStats
 
 		TqFloat	m_Complete;						///< Current percentage complete.
 
+		/// Get the integer counters which the calling thread should update.
+		static TqInt* localIntVars();
+
 		static TqFloat	 m_floatVars[ _Last_float ];		///< Float variables
 		static TqInt		m_intVars[ _Last_int ];			///< Int variables
+#ifdef ENABLE_THREADING
+		/// Block of integer counters owned by a single thread.
+		struct SqThreadCounters
+		{
+			TqInt intVars[ _Last_int ];
+		};
+		static void mergeAndDelete( SqThreadCounters* counters );
+		/// Merge and clear a thread's counters; the caller holds the lock.
+		static void mergeLocked( SqThreadCounters* counters );
+		/// Counters for the calling thread, merged when the thread exits.
+		static boost::thread_specific_ptr<SqThreadCounters> m_threadCounters;
+#endif
 
 		TqInt m_cTextureMemory;     ///< Count of the memory used by texturemap.cpp
 		TqInt m_cTextureHits[ 2 ][ 5 ];     ///< Count of the hits encountered used by texturemap.cpp
@@ -435,6 +492,67 @@ class CqStats
 };
 
 
+//-----------------------------------------------------------------------
+/** \brief Accumulator for counters in the innermost sampling loops.
+ *
+ * Counts are kept in a local variable and added to the statistics in one go
+ * when the accumulator goes out of scope.  When ENABLE_SAMPLE_STATS isn't
+ * defined the whole thing compiles away.
+ */
+class CqSampleStatsCounter
+{
+	public:
+#ifdef ENABLE_SAMPLE_STATS
+		CqSampleStatsCounter( TqInt index )
+			: m_index( index ),
+			m_count( 0 )
+		{ }
+		~CqSampleStatsCounter()
+		{
+			CqStats::addI( m_index, m_count );
+		}
+		void inc()
+		{
+			++m_count;
+		}
+		void add( TqInt n )
+		{
+			m_count += n;
+		}
+	private:
+		TqInt m_index;
+		TqInt m_count;
+#else
+		CqSampleStatsCounter( TqInt /*index*/ )
+		{ }
+		void inc()
+		{ }
+		void add( TqInt /*n*/ )
+		{ }
+#endif
+};
+
+
+//-----------------------------------------------------------------------
+// Implementation details
+
+inline TqInt* CqStats::localIntVars()
+{
+#ifdef ENABLE_THREADING
+	SqThreadCounters* counters = m_threadCounters.get();
+	if( !counters )
+	{
+		counters = new SqThreadCounters();
+		for ( TqInt i = _First_int; i < _Last_int; i++ )
+			counters->intVars[ i ] = 0;
+		m_threadCounters.reset( counters );
+	}
+	return counters->intVars;
+#else
+	return m_intVars;
+#endif
+}
+
 //-----------------------------------------------------------------------
 
 } // namespace Aqsis
@@ -646,6 +646,9 @@ class CqTextureMapOld : public IqTextureMapOld
 		/** Clear the cache of texture maps.
 		 */
 		static void FlushCache();
+		/** Remove the texture maps with the given name from the cache.
+		 */
+		static void FlushCache( const CqString& strName );
 
 		void CriticalMeasure();
 
@@ -0,0 +1,275 @@
+// Aqsis
+// Copyright (C) 1997 - 2001, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+/** \file
+ * \brief Per-thread slab pools for small, frequently allocated objects.
+ */
+
+#ifndef THREADLOCALPOOL_H_INCLUDED
+#define THREADLOCALPOOL_H_INCLUDED
+
+#include <aqsis/aqsis.h>
+
+#include <cstddef>
+
+#include <aqsis/util/pool.h>
+
+#ifdef ENABLE_THREADING
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <boost/type_traits/aligned_storage.hpp>
+#endif
+
+namespace Aqsis {
+
+/** \brief An object pool with one set of slabs for each thread.
+ *
+ * Each thread allocates from its own CqObjectPool, so no locking is needed on
+ * the allocation path.  An object may be freed by a different thread from
+ * the one which allocated it (micropolygons are shared between buckets); in
+ * that case it's handed back to the owning thread's pool via a small locked
+ * list, which the owner drains once every drainInterval allocations.
+ *
+ * Micropolygons are shared between neighbouring buckets, so a thread's pool
+ * is rarely empty while the image is being rendered.  The slabs are instead
+ * rewound in bulk by releaseUnused() once the whole image is finished.
+ *
+ * Without ENABLE_THREADING this is a thin wrapper around a single pool.
+ */
+template<typename T>
+class CqThreadLocalPool
+{
+	public:
+		CqThreadLocalPool();
+
+		/// Allocate storage for a T from the calling thread's pool.
+		void* alloc();
+		/// Free storage previously obtained from alloc().
+		void free(void* p);
+		/** \brief Rewind the slabs of every thread which has nothing live.
+		 *
+		 * No other thread may be using the pool during the call.  This also
+		 * brings the counters returned by stats() up to date.
+		 *
+		 * \return true if the slabs of all threads were reset.
+		 */
+		bool releaseUnused();
+		/** \brief Get the allocation counters, summed over all threads.
+		 *
+		 * The counters are those as of the last call to releaseUnused().
+		 */
+		SqPoolStats stats() const;
+
+	private:
+#ifdef ENABLE_THREADING
+		struct SqThreadPool;
+		/// Allocation unit: the owning pool followed by storage for the object.
+		struct SqBlock
+		{
+			SqThreadPool* owner;
+			typename boost::aligned_storage<sizeof(T),
+				boost::alignment_of<T>::value>::type storage;
+		};
+		struct SqFreeLink
+		{
+			SqFreeLink* next;
+		};
+		struct SqThreadPool
+		{
+			/// Only touched by the owning thread, or while no other thread
+			/// is using the CqThreadLocalPool.
+			CqObjectPool<SqBlock> pool;
+			/// Protects remoteHead and publishedStats.
+			boost::mutex mutex;
+			/// Objects freed by other threads, waiting to go back into pool.
+			SqFreeLink* remoteHead;
+			/// Copy of pool.stats() for other threads to read.
+			SqPoolStats publishedStats;
+			/// Allocations since the remote list was last drained; only
+			/// touched by the owning thread.
+			TqInt numSinceDrain;
+			SqThreadPool() : pool(), mutex(), remoteHead(0), publishedStats(), numSinceDrain(0) {}
+		};
+		/// Number of allocations between checks of the remote list, so that
+		/// the owner only takes its lock occasionally.
+		static const TqInt drainInterval = 256;
+
+		static void noCleanup(SqThreadPool*) {}
+		SqThreadPool& localPool();
+		void drainRemote(SqThreadPool& local);
+
+		/// Pool for the current thread; owned by m_allPools.
+		boost::thread_specific_ptr<SqThreadPool> m_localPool;
+		/// Pools for all threads, kept alive as long as this object.
+		std::vector<boost::shared_ptr<SqThreadPool> > m_allPools;
+		mutable boost::mutex m_allPoolsMutex;
+#else
+		CqObjectPool<T> m_pool;
+#endif
+};
+
+
+//==============================================================================
+// Implementation details
+//==============================================================================
+#ifdef ENABLE_THREADING
+
+template<typename T>
+inline CqThreadLocalPool<T>::CqThreadLocalPool()
+	: m_localPool(&CqThreadLocalPool<T>::noCleanup),
+	m_allPools(),
+	m_allPoolsMutex()
+{ }
+
+template<typename T>
+inline typename CqThreadLocalPool<T>::SqThreadPool& CqThreadLocalPool<T>::localPool()
+{
+	SqThreadPool* local = m_localPool.get();
+	if(!local)
+	{
+		boost::shared_ptr<SqThreadPool> newPool(new SqThreadPool());
+		{
+			boost::mutex::scoped_lock lock(m_allPoolsMutex);
+			m_allPools.push_back(newPool);
+		}
+		local = newPool.get();
+		m_localPool.reset(local);
+	}
+	return *local;
+}
+
+template<typename T>
+inline void CqThreadLocalPool<T>::drainRemote(SqThreadPool& local)
+{
+	SqFreeLink* head = 0;
+	{
+		boost::mutex::scoped_lock lock(local.mutex);
+		head = local.remoteHead;
+		local.remoteHead = 0;
+	}
+	while(head)
+	{
+		SqFreeLink* next = head->next;
+		local.pool.free(reinterpret_cast<SqBlock*>(head));
+		head = next;
+	}
+}
+
+template<typename T>
+inline void* CqThreadLocalPool<T>::alloc()
+{
+	SqThreadPool& local = localPool();
+	if(++local.numSinceDrain >= drainInterval)
+	{
+		local.numSinceDrain = 0;
+		drainRemote(local);
+	}
+	SqBlock* block = static_cast<SqBlock*>(local.pool.alloc());
+	block->owner = &local;
+	return &block->storage;
+}
+
+template<typename T>
+inline void CqThreadLocalPool<T>::free(void* p)
+{
+	if(!p)
+		return;
+	SqBlock* block = reinterpret_cast<SqBlock*>(
+			static_cast<char*>(p) - offsetof(SqBlock, storage));
+	SqThreadPool* owner = block->owner;
+	if(owner == m_localPool.get())
+		owner->pool.free(block);
+	else
+	{
+		SqFreeLink* link = reinterpret_cast<SqFreeLink*>(block);
+		boost::mutex::scoped_lock lock(owner->mutex);
+		link->next = owner->remoteHead;
+		owner->remoteHead = link;
+	}
+}
+
+template<typename T>
+inline bool CqThreadLocalPool<T>::releaseUnused()
+{
+	boost::mutex::scoped_lock lock(m_allPoolsMutex);
+	bool allReset = true;
+	for(TqInt i = 0, end = m_allPools.size(); i < end; ++i)
+	{
+		SqThreadPool& pool = *m_allPools[i];
+		drainRemote(pool);
+		allReset &= pool.pool.reset();
+		boost::mutex::scoped_lock poolLock(pool.mutex);
+		pool.publishedStats = pool.pool.stats();
+	}
+	return allReset;
+}
+
+template<typename T>
+inline SqPoolStats CqThreadLocalPool<T>::stats() const
+{
+	SqPoolStats total;
+	boost::mutex::scoped_lock lock(m_allPoolsMutex);
+	for(TqInt i = 0, end = m_allPools.size(); i < end; ++i)
+	{
+		boost::mutex::scoped_lock poolLock(m_allPools[i]->mutex);
+		total += m_allPools[i]->publishedStats;
+	}
+	return total;
+}
+
+#else // ENABLE_THREADING
+
+template<typename T>
+inline CqThreadLocalPool<T>::CqThreadLocalPool()
+	: m_pool()
+{ }
+
+template<typename T>
+inline void* CqThreadLocalPool<T>::alloc()
+{
+	return m_pool.alloc();
+}
+
+template<typename T>
+inline void CqThreadLocalPool<T>::free(void* p)
+{
+	if(p)
+		m_pool.free(p);
+}
+
+template<typename T>
+inline bool CqThreadLocalPool<T>::releaseUnused()
+{
+	return m_pool.reset();
+}
+
+template<typename T>
+inline SqPoolStats CqThreadLocalPool<T>::stats() const
+{
+	return m_pool.stats();
+}
+
+#endif // ENABLE_THREADING
+
+} // namespace Aqsis
+
+#endif // THREADLOCALPOOL_H_INCLUDED
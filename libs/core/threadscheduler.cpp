@@ -20,87 +20,173 @@
 
 #include	"threadscheduler.h"
 
-
-namespace Aqsis {
-
-/**
- * \brief Wrapper class for a unit to be processed by a thread.
- *
- * It adds a notifying call to the scheduler to know when the thread
- * finished.
- */
-class CqUnitWrapper
-{
-public:
-	CqUnitWrapper(CqThreadScheduler* threadScheduler, const boost::function0<void>& unit) :
-		m_threadScheduler(threadScheduler), m_unit(unit)
-	{
-	}
-
-	void operator()()
-	{
-		m_unit();
-		m_threadScheduler->notifyWorkUnitFinished();
-	}
-
-private:
-	CqThreadScheduler* m_threadScheduler;
-	const boost::function0<void> m_unit;
-};
+#ifdef	ENABLE_THREADING
+#include	<boost/bind.hpp>
+#endif
 
 
+namespace Aqsis {
 
 CqThreadScheduler::CqThreadScheduler(TqInt maxThreads) :
-	m_maxThreads(maxThreads), m_activeThreads(0)
+	m_maxThreads(maxThreads)
+#ifdef	ENABLE_THREADING
+	,
+	m_queues(),
+	m_threadGroup(),
+	m_workerIndex(),
+	m_queuedUnits(0),
+	m_pendingUnits(0),
+	m_nextQueue(0),
+	m_stopping(false)
+#endif
 {
+#ifdef	ENABLE_THREADING
+	if(m_maxThreads < 1)
+		m_maxThreads = boost::thread::hardware_concurrency();
+	if(m_maxThreads < 1)
+		m_maxThreads = 1;
+	for(TqInt i = 0; i < m_maxThreads; ++i)
+		m_queues.push_back(boost::shared_ptr<SqWorkQueue>(new SqWorkQueue()));
+	for(TqInt i = 0; i < m_maxThreads; ++i)
+		m_threadGroup.create_thread(boost::bind(&CqThreadScheduler::workerLoop, this, i));
+#else
+	m_maxThreads = 1;
+#endif
 }
 
 
 CqThreadScheduler::~CqThreadScheduler()
 {
+#ifdef	ENABLE_THREADING
+	joinAll();
+	{
+		boost::mutex::scoped_lock lock(m_mutexCondition);
+		m_stopping = true;
+	}
+	m_workAvailable.notify_all();
+	m_threadGroup.join_all();
+#endif
 }
 
 
 void CqThreadScheduler::addWorkUnit(const boost::function0<void>& unit)
 {
 #ifdef	ENABLE_THREADING
-	boost::mutex::scoped_lock lock(m_mutexCondition);
-	if (m_activeThreads >= m_maxThreads)
+	TqInt queue = 0;
 	{
-		m_threadsAvailable.wait(lock);
+		boost::mutex::scoped_lock lock(m_mutexCondition);
+		++m_pendingUnits;
+		if(m_workerIndex.get())
+			queue = *m_workerIndex;
+		else
+		{
+			queue = m_nextQueue;
+			m_nextQueue = (m_nextQueue + 1) % m_maxThreads;
+		}
 	}
-
-	{ 
-		boost::mutex::scoped_lock lock(m_mutexActiveThreads);
-		++m_activeThreads;
+	{
+		// Lock order is always deque first, then counters, as in
+		// popWorkUnit().
+		boost::mutex::scoped_lock lock(m_queues[queue]->mutex);
+		m_queues[queue]->units.push_back(unit);
+		boost::mutex::scoped_lock countLock(m_mutexCondition);
+		++m_queuedUnits;
 	}
-
-	m_threadGroup.create_thread( CqUnitWrapper(this, unit) );
+	m_workAvailable.notify_one();
 #else // ENABLE_THREADING
-	// If not threading, just run the process asynchronously.
+	// If not threading, just run the process synchronously.
 	unit();
 #endif
 }
 
 
-void CqThreadScheduler::notifyWorkUnitFinished()
+void CqThreadScheduler::joinAll()
 {
 #ifdef	ENABLE_THREADING
-	{
-		boost::mutex::scoped_lock lock(m_mutexActiveThreads);
-		--m_activeThreads;
-	}
-	m_threadsAvailable.notify_one();
+	boost::mutex::scoped_lock lock(m_mutexCondition);
+	while(m_pendingUnits > 0)
+		m_allDone.wait(lock);
 #endif
 }
 
 
-void CqThreadScheduler::joinAll()
+TqInt CqThreadScheduler::numThreads() const
 {
+	return m_maxThreads;
+}
+
+
 #ifdef	ENABLE_THREADING
-	m_threadGroup.join_all();
-#endif
+
+void CqThreadScheduler::workerLoop(TqInt index)
+{
+	m_workerIndex.reset(new TqInt(index));
+	boost::function0<void> unit;
+	while(true)
+	{
+		{
+			boost::mutex::scoped_lock lock(m_mutexCondition);
+			while(m_queuedUnits == 0 && !m_stopping)
+				m_workAvailable.wait(lock);
+			if(m_queuedUnits == 0 && m_stopping)
+				return;
+		}
+		if(popWorkUnit(index, unit))
+		{
+			unit();
+			unit.clear();
+			notifyWorkUnitFinished();
+		}
+	}
 }
 
 
+bool CqThreadScheduler::popWorkUnit(TqInt index, boost::function0<void>& unit)
+{
+	// Newest work from our own deque first, for locality...
+	{
+		SqWorkQueue& own = *m_queues[index];
+		boost::mutex::scoped_lock lock(own.mutex);
+		if(!own.units.empty())
+		{
+			unit = own.units.back();
+			own.units.pop_back();
+			boost::mutex::scoped_lock countLock(m_mutexCondition);
+			--m_queuedUnits;
+			return true;
+		}
+	}
+	// ...otherwise steal the oldest unit from one of the other workers.
+	for(TqInt i = 1; i < m_maxThreads; ++i)
+	{
+		SqWorkQueue& victim = *m_queues[(index + i) % m_maxThreads];
+		boost::mutex::scoped_lock lock(victim.mutex);
+		if(!victim.units.empty())
+		{
+			unit = victim.units.front();
+			victim.units.pop_front();
+			boost::mutex::scoped_lock countLock(m_mutexCondition);
+			--m_queuedUnits;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+void CqThreadScheduler::notifyWorkUnitFinished()
+{
+	bool allDone = false;
+	{
+		boost::mutex::scoped_lock lock(m_mutexCondition);
+		--m_pendingUnits;
+		allDone = (m_pendingUnits == 0);
+	}
+	if(allDone)
+		m_allDone.notify_all();
+}
+
+#endif // ENABLE_THREADING
+
+
 } // namespace Aqsis
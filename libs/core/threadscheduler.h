@@ -32,47 +32,92 @@
 #include	<boost/function.hpp>
 
 #ifdef	ENABLE_THREADING
+#include	<deque>
+#include	<vector>
+#include	<boost/shared_ptr.hpp>
 #include	<boost/thread/thread.hpp>
 #include	<boost/thread/mutex.hpp>
 #include	<boost/thread/condition.hpp>
+#include	<boost/thread/tss.hpp>
 #endif
 
-namespace Aqsis { 
+namespace Aqsis {
 
 
 /**
  * \brief Class to schedule threads processing work units
+ *
+ * The scheduler owns a persistent pool of worker threads which live as long
+ * as the scheduler itself.  Each worker has its own deque of work units: a
+ * worker takes new work from the back of its own deque, and when that is
+ * empty it steals from the front of the deques of the other workers.  Work
+ * units added from outside the pool are distributed round-robin over the
+ * worker deques, while units added from inside a worker go to that worker's
+ * own deque.
+ *
+ * When threading is disabled at compile time, work units are simply run
+ * synchronously as they are added.
  */
 class CqThreadScheduler
 {
 public:
-	/** Default constructor */
+	/** Construct the scheduler and start the worker threads.
+	 *
+	 * \param maxThreads - number of worker threads.  A value less than one
+	 *                     means "one thread per hardware core".
+	 */
 	CqThreadScheduler(TqInt maxThreads);
-	/** Destructor */
+	/** Destructor; waits for outstanding work and stops the workers. */
 	~CqThreadScheduler();
 
 	/** Add a work unit to be processed */
 	void addWorkUnit(const boost::function0<void>& unit);
-	/** Notify that a work unit has been processed */
-	void notifyWorkUnitFinished();
-	/** Join all the threads, this is, wait for all the threads to
-	 * finish their job before continuing */
+	/** Wait until all work units added so far have been processed.
+	 *
+	 * The worker threads stay alive, so the scheduler may be reused for
+	 * further work units after this returns. */
 	void joinAll();
+	/** Number of threads which process work units. */
+	TqInt numThreads() const;
 
 private:
-	/// Maximum number of threads to run
+	/// Number of threads to run
 	TqInt m_maxThreads;
-	/// Current number of active threads running
-	TqInt m_activeThreads;
 #ifdef	ENABLE_THREADING
-	/// Hold the group of active threads
+	/// Deque of work units owned by a single worker.
+	struct SqWorkQueue
+	{
+		boost::mutex mutex;
+		std::deque<boost::function0<void> > units;
+	};
+
+	/// Main loop run by each of the worker threads.
+	void workerLoop(TqInt index);
+	/// Take a unit from the worker's own deque, or steal one from another.
+	bool popWorkUnit(TqInt index, boost::function0<void>& unit);
+	/// Notify that a work unit has been processed
+	void notifyWorkUnitFinished();
+
+	/// Work deques, one per worker thread.
+	std::vector<boost::shared_ptr<SqWorkQueue> > m_queues;
+	/// Hold the group of worker threads
 	boost::thread_group m_threadGroup;
-	/// Mutex for condition
+	/// Index of the worker deque for the current thread, if it's a worker.
+	boost::thread_specific_ptr<TqInt> m_workerIndex;
+	/// Mutex protecting the counters below
 	boost::mutex m_mutexCondition;
-	/// Mutex for active threads
-	boost::mutex m_mutexActiveThreads;
-	/// Condition to wait for available threads
-	boost::condition m_threadsAvailable;
+	/// Condition signalled when work is added or the pool is stopping.
+	boost::condition m_workAvailable;
+	/// Condition signalled when all outstanding work is finished.
+	boost::condition m_allDone;
+	/// Number of units sitting in the deques.
+	TqInt m_queuedUnits;
+	/// Number of units either queued or currently running.
+	TqInt m_pendingUnits;
+	/// Next deque to receive a unit added from outside the pool.
+	TqInt m_nextQueue;
+	/// Set when the workers should exit.
+	bool m_stopping;
 #endif
 };
 
@@ -94,13 +94,27 @@ namespace Aqsis {
 #define UPPER_MASK 0x80000000UL /* most significant w-r bits */
 #define LOWER_MASK 0x7fffffffUL /* least significant r bits */
 
+/// State of one MT19937 generator.
+struct SqRandomState
+{
+	TqUlong mt[N];   /* the array for the state vector  */
+	TqInt   mti;     /* mti==N+1 means mt[N] is not initialized */
+	TqUlong seed;    /* seed used when mt[N] is first needed */
+
+	SqRandomState(TqUlong s = 5489UL)
+		: mti(N+1),
+		seed(s)
+	{ }
+};
+
 /// \todo <b>Code Review</b> Random number state shouldn't be stored in static storage - "independent" random number classes are not really independent in this case!  This will cause problems with reproducible sample patterns and big problems with future multithreading.
-static TqUlong mt[N];   /* the array for the state vector  */
-static TqInt   mti=N+1; /* mti==N+1 means mt[N] is not initialized */
+static SqRandomState sharedState;
 
 /* initializes mt[N] with a seed */
-static void init_genrand(TqUlong s)
+static void init_genrand(SqRandomState& state, TqUlong s)
 {
+	TqUlong* mt = state.mt;
+	TqInt& mti = state.mti;
 	mt[0]= s & 0xffffffffUL;
 	for (mti=1; mti<N; mti++)
 	{
@@ -116,10 +130,12 @@ static void init_genrand(TqUlong s)
 }
 
 /* generates a random number on [0,0xffffffff]-interval */
-static TqUlong genrand_int32(void)
+static TqUlong genrand_int32(SqRandomState& state)
 {
+	TqUlong* mt = state.mt;
+	TqInt& mti = state.mti;
 	TqUlong  y;
-	static TqUlong  mag01[2]={0x0UL, MATRIX_A};
+	static const TqUlong  mag01[2]={0x0UL, MATRIX_A};
 	/* mag01[x] = x * MATRIX_A  for x=0,1 */
 
 	if (mti >= N)
@@ -127,7 +143,7 @@ static TqUlong genrand_int32(void)
 		TqInt kk;
 
 		if (mti == N+1)   /* if init_genrand() has not been called, */
-			init_genrand(5489UL); /* a default initial seed is used */
+			init_genrand(state, state.seed); /* the stored seed is used */
 
 		for (kk=0;kk<N-M;kk++)
 		{
@@ -169,15 +185,31 @@ static TqUlong genrand_int32(void)
  */
 
 CqRandom::CqRandom()
+	: m_state()
 {}
 CqRandom::CqRandom( TqUint Seed )
+	: m_state()
 {}
 
+CqRandom CqRandom::independent( TqUint Seed )
+{
+	CqRandom random;
+	random.m_state.reset(new SqRandomState(Seed));
+	return random;
+}
+
+/** Get the state which this generator draws from.
+ */
+inline SqRandomState& CqRandom::state()
+{
+	return m_state ? *m_state : sharedState;
+}
+
 /** Get a random integer in the range (0 <= value < 2^32).
  */
 TqUint CqRandom::RandomInt()
 {
-	return genrand_int32();
+	return genrand_int32(state());
 }
 
 /** Get a random integer in the specified range (0 <= value < Range).
@@ -202,7 +234,7 @@ TqFloat	CqRandom::RandomFloat()
 	// Instead we've got to add the extra 128 to the denominator to ensure that
 	// it always gets correctly rounded down when using the default IEEE
 	// rounding mode.
-	return genrand_int32()*(1.0/4294967424.0);
+	return genrand_int32(state())*(1.0/4294967424.0);
 }
 
 /** Get a random float in the specified range (0 <= value < Range).
@@ -220,7 +252,7 @@ TqFloat	CqRandom::RandomFloat( TqFloat Range )
  */
 void    CqRandom::Reseed(TqUint Seek)
 {
-	init_genrand((TqUlong) Seek);
+	init_genrand(state(), (TqUlong) Seek);
 }
 
 /** Obsolete method
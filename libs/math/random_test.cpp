@@ -0,0 +1,59 @@
+// Aqsis
+// Copyright (C) 1997 - 2007, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+/** \file
+ *
+ * \brief Unit tests for CqRandom
+ */
+
+#include <aqsis/math/random.h>
+
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/auto_unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(random_tests)
+
+BOOST_AUTO_TEST_CASE(CqRandom_independent_sequence_test)
+{
+	Aqsis::CqRandom a = Aqsis::CqRandom::independent(42);
+	Aqsis::CqRandom b = Aqsis::CqRandom::independent(42);
+	Aqsis::CqRandom shared;
+
+	TqUint first = a.RandomInt();
+	// Drawing from the shared sequence mustn't disturb independent ones.
+	shared.RandomInt();
+	shared.RandomInt();
+	TqUint second = a.RandomInt();
+
+	BOOST_CHECK_EQUAL(b.RandomInt(), first);
+	BOOST_CHECK_EQUAL(b.RandomInt(), second);
+}
+
+BOOST_AUTO_TEST_CASE(CqRandom_float_range_test)
+{
+	Aqsis::CqRandom random = Aqsis::CqRandom::independent(1);
+	for(int i = 0; i < 1000; ++i)
+	{
+		TqFloat f = random.RandomFloat();
+		BOOST_CHECK(f >= 0 && f < 1);
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
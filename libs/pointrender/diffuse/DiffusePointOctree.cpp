@@ -30,7 +30,13 @@
 
 #include <cassert>
 #include <cmath>
+#include <cstdio>
 #include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
 
 #include <Partio.h>
 
@@ -120,8 +126,60 @@ bool loadDiffusePointFile(PointArray& points, const std::string& fileName) {
 	return true;
 }
 
+bool PointFileStamp::read(const std::string& fileName) {
+	namespace fs = boost::filesystem;
+	try {
+		fs::path path(fileName);
+		if (!fs::exists(path))
+			return false;
+		size = fs::file_size(path);
+		modTime = fs::last_write_time(path);
+	} catch (fs::filesystem_error&) {
+		return false;
+	}
+	return true;
+}
+
+
+/**
+ * Header of the octree block, 64 bytes.
+ *
+ * The block is laid out as the header, followed by the nodes in depth first
+ * order with the root first, followed by the leaf point data.
+ */
+struct DiffusePointOctree::Header {
+	char magic[8];
+	boost::uint32_t version;
+	/// Check for files written on a machine of different endianness.
+	boost::uint32_t byteOrder;
+	/// sizeof(Node), which catches differences in the compiled layout.
+	boost::int32_t nodeSize;
+	/// Number of floats per point.
+	boost::int32_t dataSize;
+	boost::uint64_t numNodes;
+	boost::uint64_t numFloats;
+	/// Stamp of the point file the octree was built from.
+	boost::uint64_t sourceSize;
+	boost::int64_t sourceModTime;
+	boost::uint64_t reserved;
+};
+
+namespace {
+
+const char octreeMagic[8] = { 'A', 'Q', 'S', 'O', 'C', 'T', 'R', 'E' };
+/// Increment this whenever the layout of the header or nodes changes.
+const boost::uint32_t octreeVersion = 1;
+const boost::uint32_t octreeByteOrder = 0x01020304;
+
+} // unnamed namespace
+
+
+DiffusePointOctree::DiffusePointOctree() :
+	m_root(0), m_dataSize(0), m_buffer(), m_mapping() {
+}
+
 DiffusePointOctree::DiffusePointOctree(const PointArray& points) :
-	m_root(0), m_dataSize(points.stride) {
+	m_root(0), m_dataSize(points.stride), m_buffer(), m_mapping() {
 	size_t npoints = points.size();
 	// Super naive, recursive top-down construction.
 	//
@@ -160,19 +218,140 @@ DiffusePointOctree::DiffusePointOctree(const PointArray& points) :
 	float maxDim2 = std::max(std::max(d.x, d.y), d.z) / 2;
 	bound.min = c - V3f(maxDim2);
 	bound.max = c + V3f(maxDim2);
-	m_root = makeTree(0, &workspace[0], npoints, m_dataSize, bound);
+	std::vector<Node> nodes;
+	std::vector<float> data;
+	if (npoints > 0)
+		makeTree(0, &workspace[0], npoints, m_dataSize, bound, nodes, data);
+
+	// Lay out the header, nodes and point data in one block, converting the
+	// links from indices into offsets relative to each node.
+	const size_t nodesBegin = sizeof(Header);
+	const size_t dataBegin = nodesBegin + nodes.size() * sizeof(Node);
+	for (size_t n = 0; n < nodes.size(); ++n) {
+		Node& node = nodes[n];
+		if (node.npoints != 0) {
+			node.dataOffset = static_cast<boost::int64_t>(dataBegin
+					+ node.dataOffset * sizeof(float))
+					- static_cast<boost::int64_t>(nodesBegin + n * sizeof(Node));
+		} else {
+			for (int i = 0; i < 8; ++i)
+				if (node.childOffsets[i] != 0)
+					node.childOffsets[i] -= static_cast<boost::int32_t>(n);
+		}
+	}
+	m_buffer.resize(dataBegin + data.size() * sizeof(float));
+	Header header;
+	std::memset(&header, 0, sizeof(Header));
+	std::memcpy(header.magic, octreeMagic, sizeof(octreeMagic));
+	header.version = octreeVersion;
+	header.byteOrder = octreeByteOrder;
+	header.nodeSize = sizeof(Node);
+	header.dataSize = m_dataSize;
+	header.numNodes = nodes.size();
+	header.numFloats = data.size();
+	std::memcpy(&m_buffer[0], &header, sizeof(Header));
+	if (!nodes.empty()) {
+		std::memcpy(&m_buffer[nodesBegin], &nodes[0],
+				nodes.size() * sizeof(Node));
+		m_root = reinterpret_cast<const Node*>(&m_buffer[nodesBegin]);
+	}
+	if (!data.empty())
+		std::memcpy(&m_buffer[dataBegin], &data[0], data.size() * sizeof(float));
 }
 
-DiffusePointOctree::Node* DiffusePointOctree::makeTree(int depth, const float** points,
-		size_t npoints, int dataSize, const Box3f& bound) {
+boost::shared_ptr<DiffusePointOctree> DiffusePointOctree::load(
+		const std::string& fileName, const PointFileStamp& source) {
+	boost::shared_ptr<DiffusePointOctree> tree(new DiffusePointOctree());
+	try {
+		if (!boost::filesystem::exists(boost::filesystem::path(fileName)))
+			return boost::shared_ptr<DiffusePointOctree>();
+		tree->m_mapping.open(fileName);
+	} catch (std::exception& e) {
+		Aqsis::log() << warning << "Could not map compiled octree \""
+				<< fileName << "\": " << e.what() << "\n";
+		return boost::shared_ptr<DiffusePointOctree>();
+	}
+	// Only the header is checked here, since touching the whole file would
+	// defeat the point of mapping it.
+	const size_t size = tree->m_mapping.size();
+	if (size < sizeof(Header))
+		return boost::shared_ptr<DiffusePointOctree>();
+	const Header& header = *reinterpret_cast<const Header*>(
+			tree->m_mapping.data());
+	if (std::memcmp(header.magic, octreeMagic, sizeof(octreeMagic)) != 0
+			|| header.version != octreeVersion
+			|| header.byteOrder != octreeByteOrder
+			|| header.nodeSize != static_cast<boost::int32_t>(sizeof(Node))
+			|| header.dataSize <= 0
+			|| header.sourceSize != source.size
+			|| header.sourceModTime != source.modTime
+			|| size != sizeof(Header) + header.numNodes * sizeof(Node)
+					+ header.numFloats * sizeof(float))
+		return boost::shared_ptr<DiffusePointOctree>();
+	tree->m_dataSize = header.dataSize;
+	if (header.numNodes > 0)
+		tree->m_root = reinterpret_cast<const Node*>(tree->m_mapping.data()
+				+ sizeof(Header));
+	return tree;
+}
+
+bool DiffusePointOctree::save(const std::string& fileName,
+		const PointFileStamp& source) const {
+	Header header;
+	std::memcpy(&header, block(), sizeof(Header));
+	header.sourceSize = source.size;
+	header.sourceModTime = source.modTime;
+	std::ostringstream tmpName;
+	tmpName << fileName << ".tmp" << std::hex << std::time(0)
+			<< reinterpret_cast<size_t>(this);
+	{
+		std::ofstream out(tmpName.str().c_str(),
+				std::ios::out | std::ios::binary);
+		if (!out)
+			return false;
+		out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+		out.write(block() + sizeof(Header), blockSize() - sizeof(Header));
+		if (!out) {
+			out.close();
+			std::remove(tmpName.str().c_str());
+			return false;
+		}
+	}
+	if (std::rename(tmpName.str().c_str(), fileName.c_str()) != 0) {
+		// Renaming over an existing file fails on some platforms.
+		std::remove(fileName.c_str());
+		if (std::rename(tmpName.str().c_str(), fileName.c_str()) != 0) {
+			std::remove(tmpName.str().c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+const char* DiffusePointOctree::block() const {
+	return m_mapping.is_open() ? m_mapping.data() : &m_buffer[0];
+}
+
+size_t DiffusePointOctree::blockSize() const {
+	return m_mapping.is_open() ? m_mapping.size() : m_buffer.size();
+}
+
+size_t DiffusePointOctree::makeTree(int depth, const float** points,
+		size_t npoints, int dataSize, const Box3f& bound,
+		std::vector<Node>& nodes, std::vector<float>& data) {
 	assert(npoints != 0);
-	Node* node = new Node;
-	node->bound = bound;
+	// Zero the whole node, padding included, so saved files are
+	// deterministic.
+	Node node;
+	std::memset(static_cast<void*>(&node), 0, sizeof(Node));
+	node.bound = bound;
 	V3f c = bound.center();
-	node->center = c;
+	node.center = c;
 	V3f diag = bound.size();
-	node->boundRadius = diag.length() / 2.0f;
-	node->npoints = 0;
+	node.boundRadius = diag.length() / 2.0f;
+	node.npoints = 0;
+	size_t nodeIndex = nodes.size();
+	nodes.push_back(node);
 	size_t pointsPerLeaf = 8;
 	// Limit max depth of tree to prevent infinite recursion when
 	// greater than pointsPerLeaf points lie at the same position in
@@ -182,10 +361,9 @@ DiffusePointOctree::Node* DiffusePointOctree::makeTree(int depth, const float**
 	int maxDepth = 24;
 	if (npoints <= pointsPerLeaf || depth >= maxDepth) {
 		// Small number of child points: make this a leaf node and
-		// store the points directly in the data member.
-		node->npoints = npoints;
-		// Copy over data into node.
-		node->data.reset(new float[npoints * dataSize]);
+		// store the points directly in the data array.
+		node.npoints = npoints;
+		node.dataOffset = data.size();
 		float sumA = 0;
 		V3f sumP(0);
 		V3f sumN(0);
@@ -193,8 +371,7 @@ DiffusePointOctree::Node* DiffusePointOctree::makeTree(int depth, const float**
 		for (size_t j = 0; j < npoints; ++j) {
 			const float* p = points[j];
 			// copy extra data
-			for (int i = 0; i < dataSize; ++i)
-				node->data[j * dataSize + i] = p[i];
+			data.insert(data.end(), p, p + dataSize);
 			// compute averages (area weighted)
 			float A = p[6] * p[6] * M_PI;
 			sumA += A;
@@ -202,11 +379,12 @@ DiffusePointOctree::Node* DiffusePointOctree::makeTree(int depth, const float**
 			sumN += A * V3f(p[3], p[4], p[5]);
 			sumCol += A * C3f(p[7], p[8], p[9]);
 		}
-		node->aggP = 1.0f / sumA * sumP;
-		node->aggN = sumN.normalized();
-		node->aggR = sqrtf(sumA/M_PI);
-		node->aggCol = 1.0f / sumA * sumCol;
-		return node;
+		node.aggP = 1.0f / sumA * sumP;
+		node.aggN = sumN.normalized();
+		node.aggR = sqrtf(sumA/M_PI);
+		node.aggCol = 1.0f / sumA * sumCol;
+		nodes[nodeIndex] = node;
+		return nodeIndex;
 	}
 	// allocate extra workspace for storing child points (ugh!)
 	std::vector<const float*> workspace(8 * npoints);
@@ -236,32 +414,23 @@ DiffusePointOctree::Node* DiffusePointOctree::makeTree(int depth, const float**
 		bnd.max.x = (i % 2 == 0) ? c.x : bound.max.x;
 		bnd.max.y = ((i / 2) % 2 == 0) ? c.y : bound.max.y;
 		bnd.max.z = ((i / 4) % 2 == 0) ? c.z : bound.max.z;
-		Node* child = makeTree(depth + 1, P[i], np[i], dataSize, bnd);
-		node->children[i] = child;
+		size_t childIndex = makeTree(depth + 1, P[i], np[i], dataSize, bnd,
+				nodes, data);
+		node.childOffsets[i] = static_cast<boost::int32_t>(childIndex);
+		const Node& child = nodes[childIndex];
 		// Weighted average with weight = disk surface area.
-		float A = child->aggR * child->aggR*M_PI;
+		float A = child.aggR * child.aggR*M_PI;
 		sumA += A;
-		sumP += A * child->aggP;
-		sumN += A * child->aggN;
-		sumCol += A * child->aggCol;
+		sumP += A * child.aggP;
+		sumN += A * child.aggN;
+		sumCol += A * child.aggCol;
 	}
-	node->aggP = 1.0f / sumA * sumP;
-	node->aggN = sumN.normalized();
-	node->aggR = sqrtf(sumA/M_PI);
-	node->aggCol = 1.0f / sumA * sumCol;
-	return node;
-}
-
-void DiffusePointOctree::deleteTree(Node* n) {
-	if (!n)
-		return;
-	for (int i = 0; i < 8; ++i)
-		deleteTree(n->children[i]);
-	delete n;
-}
-
-DiffusePointOctree::~DiffusePointOctree() {
-	deleteTree( m_root);
+	node.aggP = 1.0f / sumA * sumP;
+	node.aggN = sumN.normalized();
+	node.aggR = sqrtf(sumA/M_PI);
+	node.aggCol = 1.0f / sumA * sumCol;
+	nodes[nodeIndex] = node;
+	return nodeIndex;
 }
 
 }
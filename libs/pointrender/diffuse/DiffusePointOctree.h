@@ -31,13 +31,16 @@
 #ifndef DIFFUSEPOINTOCTREE_H_
 #define DIFFUSEPOINTOCTREE_H_
 
+#include <string>
 #include <vector>
 
 #include <OpenEXR/ImathVec.h>
 #include <OpenEXR/ImathBox.h>
 #include <OpenEXR/ImathColor.h>
 
-#include <boost/scoped_array.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include "PointArray.h"
@@ -60,10 +63,47 @@ namespace Aqsis {
 bool loadDiffusePointFile(PointArray& points, const std::string& fileName);
 
 
+/**
+ * Identifies the version of a point cloud file which an octree was built
+ * from, so that compiled octree files can be checked for staleness.
+ */
+struct PointFileStamp {
+	PointFileStamp() :
+		size(0), modTime(0) {
+	}
+
+	/**
+	 * Get the stamp of a file on disk.
+	 *
+	 * @return true if the file exists, false otherwise.
+	 */
+	bool read(const std::string& fileName);
+
+	bool operator==(const PointFileStamp& rhs) const {
+		return size == rhs.size && modTime == rhs.modTime;
+	}
+	bool operator!=(const PointFileStamp& rhs) const {
+		return !(*this == rhs);
+	}
+
+	boost::uint64_t size; //< File size in bytes.
+	boost::int64_t modTime; //< Last modification time.
+};
+
+
 /**
  * This class offers a naive way of storing diffuse surfels in a point hierarchy.
+ *
+ * The nodes and leaf point data are held together in a single block of
+ * memory, with the links between them stored as offsets relative to the
+ * nodes themselves.  The block contains no pointers, so it can be written
+ * directly to a "compiled octree" file with save() and memory-mapped back
+ * in with load(), letting several frames and processes share one copy of
+ * the tree without rebuilding it.
+ *
+ * The root node points into the block, so octrees can't be copied.
  */
-class DiffusePointOctree {
+class DiffusePointOctree : boost::noncopyable {
 
 public:
 
@@ -72,15 +112,11 @@ public:
 	 *
 	 * Leaf nodes have npoints > 0, specifying the number of child points
 	 * contained.
+	 *
+	 * Nodes are plain data, and are only valid as part of the octree block
+	 * which holds them; use child() and data() to follow the links.
 	 */
 	struct Node {
-		Node() :
-			bound(), center(0), boundRadius(0), aggP(0), aggN(0), aggR(0),
-					aggCol(0), npoints(0), data() {
-			children[0] = children[1] = children[2] = children[3] = 0;
-			children[4] = children[5] = children[6] = children[7] = 0;
-		}
-
 		/// Data derived from octree bounding box
 		Imath::Box3f bound;
 		Imath::V3f center;
@@ -90,20 +126,40 @@ public:
 		Imath::V3f aggN;
 		float aggR;
 		Imath::C3f aggCol;
-		// Child nodes, to be indexed as children[z][y][x]
-		Node* children[8];
-		// bool used;
+		// Offsets to child nodes in units of nodes, relative to this node,
+		// to be indexed as childOffsets[z][y][x].  Zero means no child.
+		boost::int32_t childOffsets[8];
 		/// Number of child points for the leaf node case
-		int npoints;
-		// Collection of points in leaf.
-		boost::scoped_array<float> data;
+		boost::int32_t npoints;
+		boost::int32_t reserved;
+		// Offset to the collection of points in a leaf, in bytes relative
+		// to this node.
+		boost::int64_t dataOffset;
+
+		/// Get child node i, or null if there's no such child.
+		const Node* child(int i) const {
+			return childOffsets[i] ? this + childOffsets[i] : 0;
+		}
+
+		/// Get the point data for a leaf node.
+		const float* data() const {
+			return reinterpret_cast<const float*>(
+					reinterpret_cast<const char*>(this) + dataOffset);
+		}
 	};
 
 
 private:
 
-	Node* m_root; //< The root node of the diffuse surfel hierarchy.
+	/// Header at the start of the octree block.
+	struct Header;
+
+	const Node* m_root; //< The root node of the diffuse surfel hierarchy.
 	int m_dataSize; // The size of each surfel/point (in floats).
+	/// Storage for an octree built in memory.
+	std::vector<char> m_buffer;
+	/// Storage for an octree loaded from a file.
+	boost::iostreams::mapped_file_source m_mapping;
 
 public:
 
@@ -116,10 +172,42 @@ public:
 	 */
 	DiffusePointOctree(const PointArray& points);
 
+	/**
+	 * Memory-map a compiled octree file written by save().
+	 *
+	 * @param fileName
+	 * 			The compiled octree file.
+	 * @param source
+	 * 			Stamp of the point file the octree should have been built from.
+	 * @return
+	 * 			The octree, or null if the file doesn't exist, isn't a
+	 * 			compatible octree file, or was built from a different version
+	 * 			of the point file.
+	 */
+	static boost::shared_ptr<DiffusePointOctree> load(
+			const std::string& fileName, const PointFileStamp& source);
+
+	/**
+	 * Write the octree to a compiled octree file which can be read back with
+	 * load().
+	 *
+	 * The file is written under a temporary name and renamed into place, so
+	 * other processes never see a partially written octree.
+	 *
+	 * @param fileName
+	 * 			The compiled octree file.
+	 * @param source
+	 * 			Stamp of the point file the octree was built from.
+	 * @return
+	 * 			true on success.
+	 */
+	bool save(const std::string& fileName, const PointFileStamp& source) const;
+
 	/**
 	 * Get the root node of tree of this octree.
 	 *
-	 * @return The root node of tree of this octree.
+	 * @return The root node of tree of this octree, or null if there are no
+	 * points.
 	 */
 	const Node* root() const {
 		return m_root;
@@ -136,15 +224,29 @@ public:
 	}
 
 	/**
-	 * Destructor of the octree hierarchy of diffuse surfels.
+	 * Check whether the octree data is memory-mapped from a file.
 	 */
-	~DiffusePointOctree();
+	bool isMapped() const {
+		return m_mapping.is_open();
+	}
 
 private:
 
+	DiffusePointOctree();
+
+	/// Get the start of the octree block.
+	const char* block() const;
+	/// Get the size of the octree block in bytes.
+	size_t blockSize() const;
+
 	/**
 	 * Build an octree node from the given points
 	 *
+	 * Nodes are appended to the nodes array with child links holding
+	 * absolute node indices, and leaf dataOffset holding the index of the
+	 * first leaf float in the data array; these are converted to relative
+	 * offsets once the tree is complete.
+	 *
 	 * @param depth
 	 * 			The depth of the node to be created
 	 * @param points
@@ -155,19 +257,16 @@ private:
 	 * 			The number of floats representing each point.
 	 * @param bound
 	 * 			The bounding box that encloses all the points to be included.
+	 * @param nodes
+	 * 			Array to which the nodes are appended.
+	 * @param data
+	 * 			Array to which the leaf point data is appended.
 	 * @return
-	 * 			An octree node including all passed points.
-	 */
-	static Node* makeTree(int depth, const float** points, size_t npoints,
-			int dataSize, const Imath::Box3f& bound);
-
-	/**
-	 * Recursively delete the octree, depth first.
-	 *
-	 * @param n
-	 * 		The node to delete.
+	 * 			Index of the octree node including all passed points.
 	 */
-	static void deleteTree(Node* n);
+	static size_t makeTree(int depth, const float** points, size_t npoints,
+			int dataSize, const Imath::Box3f& bound, std::vector<Node>& nodes,
+			std::vector<float>& data);
 
 };
 
@@ -44,33 +44,47 @@
 namespace Aqsis {
 
 
+DiffusePointOctreeCache::DiffusePointOctreeCache() :
+	m_cache(), m_frame(0) {
+}
+
 DiffusePointOctree* DiffusePointOctreeCache::find(const std::string& fileName) {
 
 	// Try to get octree from the cache ...
-    MapType::const_iterator i = m_cache.find(fileName);
-    if(i == m_cache.end()) {
-
-        // Not in the cache, open the file ...
-        // TODO: Path handling
-        PointArray points;
-
-        // Convert to octree
-        boost::shared_ptr<DiffusePointOctree> tree;
-        if(loadDiffusePointFile(points, fileName)) {
-            tree.reset(new DiffusePointOctree(points));
-        } else {
-            Aqsis::log() << error << "Point cloud file \"" << fileName
-                         << "\" not found\n";
+    MapType::iterator i = m_cache.find(fileName);
+    if(i != m_cache.end()) {
+        Entry& entry = i->second;
+        if(entry.lastUsedFrame == m_frame)
+            return entry.tree.get();
+        // First use in this frame: the point file may have been rewritten
+        // since we loaded it, for instance by bake3d() in the last frame.
+        PointFileStamp stamp;
+        stamp.read(fileName);
+        if(stamp == entry.stamp) {
+            entry.lastUsedFrame = m_frame;
+            return entry.tree.get();
         }
-
-        // Insert into map.  If we couldn't load the file, we insert
-        // a null pointer to record the failure.
-        m_cache.insert(MapType::value_type(fileName, tree));
-        return tree.get();
+        m_cache.erase(i);
     }
 
-    // Return the octree.
-    return i->second.get();
+    // Not in the cache, or out of date.  If we couldn't load the file, we
+    // insert a null pointer to record the failure.
+    Entry entry;
+    entry.tree = loadTree(fileName, entry.stamp);
+    entry.lastUsedFrame = m_frame;
+    m_cache.insert(MapType::value_type(fileName, entry));
+    return entry.tree.get();
+}
+
+
+void DiffusePointOctreeCache::endFrame() {
+    for(MapType::iterator i = m_cache.begin(); i != m_cache.end();) {
+        if(i->second.lastUsedFrame != m_frame)
+            m_cache.erase(i++);
+        else
+            ++i;
+    }
+    ++m_frame;
 }
 
 
@@ -79,4 +93,48 @@ void DiffusePointOctreeCache::clear() {
 }
 
 
+std::string DiffusePointOctreeCache::compiledFileName(const std::string& fileName) {
+    return fileName + ".aqoct";
+}
+
+
+boost::shared_ptr<DiffusePointOctree> DiffusePointOctreeCache::loadTree(
+        const std::string& fileName, PointFileStamp& stamp) {
+    boost::shared_ptr<DiffusePointOctree> tree;
+    // TODO: Path handling
+    if(!stamp.read(fileName)) {
+        Aqsis::log() << error << "Point cloud file \"" << fileName
+                     << "\" not found\n";
+        return tree;
+    }
+
+    // Use the compiled octree if it's up to date ...
+    const std::string compiledName = compiledFileName(fileName);
+    tree = DiffusePointOctree::load(compiledName, stamp);
+    if(tree)
+        return tree;
+
+    // ... otherwise build it from the points.
+    PointArray points;
+    if(!loadDiffusePointFile(points, fileName)) {
+        Aqsis::log() << error << "Could not read point cloud file \""
+                     << fileName << "\"\n";
+        return tree;
+    }
+    tree.reset(new DiffusePointOctree(points));
+    if(tree->save(compiledName, stamp)) {
+        // Switch to the mapped copy, which shares its memory with any other
+        // processes using the same octree.
+        boost::shared_ptr<DiffusePointOctree> mapped =
+            DiffusePointOctree::load(compiledName, stamp);
+        if(mapped)
+            tree = mapped;
+    } else {
+        Aqsis::log() << debug << "Could not write compiled octree \""
+                     << compiledName << "\"\n";
+    }
+    return tree;
+}
+
+
 }
@@ -31,24 +31,54 @@
 #define DIFFUSEPOINTOCTREECACHE_H_
 
 #include <map>
+#include <string>
 
 #include <boost/shared_ptr.hpp>
 #include "DiffusePointOctree.h"
 
 namespace Aqsis {
 
+/**
+ * Cache of point octrees, keyed on the name of the point cloud file.
+ *
+ * The first time a point file is needed, the octree is memory-mapped from a
+ * compiled octree file next to it (see compiledFileName()) if one exists and
+ * was built from the current version of the point file.  Otherwise the
+ * octree is built from the points and written out as a compiled octree
+ * file, so that later frames and other render processes can map it rather
+ * than building it again.
+ *
+ * Octrees are retained from frame to frame, but endFrame() drops those which
+ * weren't used during the frame.
+ */
 class DiffusePointOctreeCache {
 
 private:
 
-	typedef std::map<std::string, boost::shared_ptr<DiffusePointOctree> > MapType;
+	/// A cached octree, along with the information needed to expire it.
+	struct Entry {
+		Entry() :
+			tree(), stamp(), lastUsedFrame(0) {
+		}
+		boost::shared_ptr<DiffusePointOctree> tree; //< Null if loading failed.
+		PointFileStamp stamp; //< Stamp of the point file when it was loaded.
+		int lastUsedFrame; //< Frame in which the octree was last found.
+	};
+
+	typedef std::map<std::string, Entry> MapType;
 	MapType m_cache; //< The cache
+	int m_frame; //< Count of calls to endFrame().
 
 public:
 
+	DiffusePointOctreeCache();
+
 	/**
 	 * Find a cached point octree by it's filename.
 	 *
+	 * The point file is checked for modification on the first lookup in
+	 * each frame, and the octree reloaded if it has changed.
+	 *
 	 * TODO: Search path handling.
 	 *
 	 * @param fileName
@@ -58,11 +88,38 @@ public:
 	 */
 	DiffusePointOctree* find(const std::string& fileName);
 
+	/**
+	 * Drop the octrees which weren't used since the last call, and start a
+	 * new frame.
+	 */
+	void endFrame();
+
 	/**
 	 * Clear all the octrees of the cache.
 	 */
 	void clear();
 
+	/**
+	 * Get the name of the compiled octree file for a point file.
+	 */
+	static std::string compiledFileName(const std::string& fileName);
+
+private:
+
+	/**
+	 * Map the compiled octree for a point file, or build it from the points
+	 * if there's no up to date compiled octree.
+	 *
+	 * @param fileName
+	 * 			The filename of the pointcloud file.
+	 * @param stamp
+	 * 			Set to the stamp of the point file.
+	 * @return
+	 * 			The octree, or null on failure.
+	 */
+	static boost::shared_ptr<DiffusePointOctree> loadTree(
+			const std::string& fileName, PointFileStamp& stamp);
+
 };
 
 }
@@ -0,0 +1,263 @@
+// Copyright (C) 2001, Paul C. Gregory and the other authors and contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the software's owners nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// (This is the New BSD license)
+
+/** \file
+ *
+ * \brief Unit tests for saving and memory-mapping compiled octree files.
+ */
+
+#include "DiffusePointOctree.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/auto_unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(DiffusePointOctree_tests)
+
+using namespace Aqsis;
+
+namespace {
+
+// Name of a file in the current directory which is removed on destruction.
+class TempFileName {
+public:
+	TempFileName() {
+		for (int i = 0;; ++i) {
+			std::ostringstream name;
+			name << "aqsis_octree_tmpfile_" << i << ".aqoct";
+			m_fileName = name.str();
+			if (!boost::filesystem::exists(m_fileName))
+				break;
+		}
+	}
+	~TempFileName() {
+		boost::filesystem::remove(m_fileName);
+	}
+	const std::string& str() const {
+		return m_fileName;
+	}
+private:
+	std::string m_fileName;
+};
+
+// A cloud of random points in the layout of loadDiffusePointFile(): position,
+// normal, radius and radiosity.
+void makePoints(PointArray& points, int npoints) {
+	std::srand(42);
+	points.stride = 10;
+	points.data.resize(npoints * 10);
+	for (int i = 0; i < npoints * 10; ++i)
+		points.data[i] = static_cast<float>(std::rand()) / RAND_MAX;
+}
+
+PointFileStamp makeStamp() {
+	PointFileStamp stamp;
+	stamp.size = 12345;
+	stamp.modTime = 67890;
+	return stamp;
+}
+
+// Check two octrees hold identical nodes and point data.
+void checkSameTree(const DiffusePointOctree::Node* a,
+		const DiffusePointOctree::Node* b, int dataSize) {
+	BOOST_REQUIRE_EQUAL(a == 0, b == 0);
+	if (!a)
+		return;
+	BOOST_CHECK(a->bound.min == b->bound.min);
+	BOOST_CHECK(a->bound.max == b->bound.max);
+	BOOST_CHECK(a->aggP == b->aggP);
+	BOOST_CHECK(a->aggN == b->aggN);
+	BOOST_CHECK_EQUAL(a->aggR, b->aggR);
+	BOOST_REQUIRE_EQUAL(a->npoints, b->npoints);
+	if (a->npoints > 0) {
+		BOOST_CHECK(std::memcmp(a->data(), b->data(),
+				a->npoints * dataSize * sizeof(float)) == 0);
+		return;
+	}
+	for (int i = 0; i < 8; ++i)
+		checkSameTree(a->child(i), b->child(i), dataSize);
+}
+
+// Overwrite part of a file in place.
+void patchFile(const std::string& fileName, std::streamoff offset,
+		const void* bytes, size_t size) {
+	std::fstream file(fileName.c_str(),
+			std::ios::in | std::ios::out | std::ios::binary);
+	BOOST_REQUIRE(file);
+	file.seekp(offset);
+	file.write(reinterpret_cast<const char*>(bytes), size);
+}
+
+// Read a whole file.
+std::vector<char> readFile(const std::string& fileName) {
+	std::ifstream file(fileName.c_str(), std::ios::in | std::ios::binary);
+	return std::vector<char>(std::istreambuf_iterator<char>(file),
+			std::istreambuf_iterator<char>());
+}
+
+} // unnamed namespace
+
+BOOST_AUTO_TEST_CASE(DiffusePointOctree_save_load_test)
+{
+	PointArray points;
+	makePoints(points, 2000);
+	DiffusePointOctree tree(points);
+	BOOST_REQUIRE(tree.root());
+	BOOST_CHECK(!tree.isMapped());
+
+	TempFileName fileName;
+	BOOST_REQUIRE(tree.save(fileName.str(), makeStamp()));
+
+	boost::shared_ptr<DiffusePointOctree> loaded =
+		DiffusePointOctree::load(fileName.str(), makeStamp());
+	BOOST_REQUIRE(loaded);
+	BOOST_CHECK(loaded->isMapped());
+	BOOST_CHECK_EQUAL(loaded->dataSize(), tree.dataSize());
+	checkSameTree(tree.root(), loaded->root(), tree.dataSize());
+
+	// A mapped octree can be saved again, giving an identical file.
+	TempFileName fileName2;
+	BOOST_REQUIRE(loaded->save(fileName2.str(), makeStamp()));
+	BOOST_CHECK(readFile(fileName.str()) == readFile(fileName2.str()));
+}
+
+BOOST_AUTO_TEST_CASE(DiffusePointOctree_save_replace_test)
+{
+	PointArray points;
+	makePoints(points, 100);
+	DiffusePointOctree tree(points);
+	PointArray morePoints;
+	makePoints(morePoints, 500);
+	DiffusePointOctree biggerTree(morePoints);
+
+	// Saving over an existing file replaces it.
+	TempFileName fileName;
+	BOOST_REQUIRE(tree.save(fileName.str(), makeStamp()));
+	BOOST_REQUIRE(biggerTree.save(fileName.str(), makeStamp()));
+	boost::shared_ptr<DiffusePointOctree> loaded =
+		DiffusePointOctree::load(fileName.str(), makeStamp());
+	BOOST_REQUIRE(loaded);
+	checkSameTree(biggerTree.root(), loaded->root(), biggerTree.dataSize());
+}
+
+BOOST_AUTO_TEST_CASE(DiffusePointOctree_empty_test)
+{
+	PointArray points;
+	points.stride = 10;
+	DiffusePointOctree tree(points);
+	BOOST_CHECK(!tree.root());
+
+	TempFileName fileName;
+	BOOST_REQUIRE(tree.save(fileName.str(), makeStamp()));
+	boost::shared_ptr<DiffusePointOctree> loaded =
+		DiffusePointOctree::load(fileName.str(), makeStamp());
+	BOOST_REQUIRE(loaded);
+	BOOST_CHECK(!loaded->root());
+}
+
+BOOST_AUTO_TEST_CASE(DiffusePointOctree_load_missing_test)
+{
+	TempFileName fileName;
+	BOOST_CHECK(!DiffusePointOctree::load(fileName.str(), makeStamp()));
+}
+
+BOOST_AUTO_TEST_CASE(DiffusePointOctree_load_stale_test)
+{
+	PointArray points;
+	makePoints(points, 100);
+	DiffusePointOctree tree(points);
+	TempFileName fileName;
+	BOOST_REQUIRE(tree.save(fileName.str(), makeStamp()));
+
+	// The point file has changed size or been modified since the octree
+	// was built.
+	PointFileStamp stamp = makeStamp();
+	stamp.size += 1;
+	BOOST_CHECK(!DiffusePointOctree::load(fileName.str(), stamp));
+	stamp = makeStamp();
+	stamp.modTime += 1;
+	BOOST_CHECK(!DiffusePointOctree::load(fileName.str(), stamp));
+}
+
+BOOST_AUTO_TEST_CASE(DiffusePointOctree_load_bad_header_test)
+{
+	PointArray points;
+	makePoints(points, 100);
+	DiffusePointOctree tree(points);
+	TempFileName fileName;
+
+	// Wrong magic number
+	BOOST_REQUIRE(tree.save(fileName.str(), makeStamp()));
+	patchFile(fileName.str(), 0, "NOTOCTRE", 8);
+	BOOST_CHECK(!DiffusePointOctree::load(fileName.str(), makeStamp()));
+
+	// Unknown version, which directly follows the magic number.
+	BOOST_REQUIRE(tree.save(fileName.str(), makeStamp()));
+	const boost::uint32_t badVersion = 0xffffffff;
+	patchFile(fileName.str(), 8, &badVersion, sizeof(badVersion));
+	BOOST_CHECK(!DiffusePointOctree::load(fileName.str(), makeStamp()));
+
+	// Byte order written by a machine of opposite endianness.
+	BOOST_REQUIRE(tree.save(fileName.str(), makeStamp()));
+	const boost::uint32_t swappedOrder = 0x04030201;
+	patchFile(fileName.str(), 12, &swappedOrder, sizeof(swappedOrder));
+	BOOST_CHECK(!DiffusePointOctree::load(fileName.str(), makeStamp()));
+}
+
+BOOST_AUTO_TEST_CASE(DiffusePointOctree_load_truncated_test)
+{
+	PointArray points;
+	makePoints(points, 100);
+	DiffusePointOctree tree(points);
+	TempFileName fileName;
+	BOOST_REQUIRE(tree.save(fileName.str(), makeStamp()));
+	std::vector<char> contents = readFile(fileName.str());
+	BOOST_REQUIRE(contents.size() > 64);
+
+	// Truncated within the point data, and within the header.
+	size_t sizes[] = { contents.size() - 4, 32, 0 };
+	for (int i = 0; i < 3; ++i) {
+		{
+			std::ofstream file(fileName.str().c_str(),
+					std::ios::out | std::ios::binary | std::ios::trunc);
+			file.write(&contents[0], sizes[i]);
+		}
+		BOOST_CHECK(!DiffusePointOctree::load(fileName.str(), makeStamp()));
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -540,7 +540,7 @@ static void renderNode(IntegratorT& integrator, V3f P, V3f N, float cosConeAngle
                 assert(node->npoints <= 8);
                 for(int i = 0; i < node->npoints; ++i)
                 {
-                    const float* data = &node->data[i*dataSize];
+                    const float* data = &node->data()[i*dataSize];
                     V3f p = V3f(data[0], data[1], data[2]) - P;
                     childOrder[i].first = p.length2();
                     childOrder[i].second = i;
@@ -548,7 +548,7 @@ static void renderNode(IntegratorT& integrator, V3f P, V3f N, float cosConeAngle
                 std::sort(childOrder, childOrder + node->npoints);
                 for(int i = 0; i < node->npoints; ++i)
                 {
-                    const float* data = &node->data[childOrder[i].second*dataSize];
+                    const float* data = &node->data()[childOrder[i].second*dataSize];
                     V3f p = V3f(data[0], data[1], data[2]) - P;
                     V3f n = V3f(data[3], data[4], data[5]);
                     float r = data[6];
@@ -564,7 +564,7 @@ static void renderNode(IntegratorT& integrator, V3f P, V3f N, float cosConeAngle
                 int nchildren = 0;
                 for(int i = 0; i < 8; ++i)
                 {
-                    DiffusePointOctree::Node* child = node->children[i];
+                    const DiffusePointOctree::Node* child = node->child(i);
                     if(!child)
                         continue;
                     children[nchildren].first = (child->center - P).length2();
@@ -589,6 +589,8 @@ template<typename IntegratorT>
 void microRasterize(IntegratorT& integrator, V3f P, V3f N, float coneAngle,
                     float maxSolidAngle, const DiffusePointOctree& points)
 {
+    if(!points.root())
+        return;
     float cosConeAngle = cos(coneAngle);
     float sinConeAngle = sin(coneAngle);
     renderNode(integrator, P, N, cosConeAngle, sinConeAngle,
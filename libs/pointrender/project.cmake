@@ -23,8 +23,14 @@ set(pointrender_hdrs
 )
 
 make_absolute(pointrender_hdrs ${pointrender_SOURCE_DIR})
+
+set(pointrender_test_srcs
+    diffuse/DiffusePointOctree_test.cpp
+)
+make_absolute(pointrender_test_srcs ${pointrender_SOURCE_DIR})
 source_group("Header Files" FILES ${pointrender_hdrs})
 
 include_directories(${pointrender_SOURCE_DIR})
 
-set(pointrender_libs ${partio_libs} ${math_libs})
+set(pointrender_libs ${partio_libs} ${math_libs} ${Boost_IOSTREAMS_LIBRARY}
+    ${Boost_FILESYSTEM_LIBRARY})
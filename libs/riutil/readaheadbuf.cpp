@@ -0,0 +1,218 @@
+// Aqsis
+// Copyright (C) 2001, Paul C. Gregory and the other authors and contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the software's owners nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// (This is the New BSD license)
+
+/** \file
+ * \brief A stream buffer which reads ahead of its consumer on a separate
+ * thread.
+ */
+
+#include "readaheadbuf.h"
+
+#include <algorithm>
+#include <exception>
+
+#include <boost/bind.hpp>
+
+#include <aqsis/util/exception.h>
+
+namespace Aqsis {
+
+ReadAheadBuf::ReadAheadBuf(std::streambuf& source, int blockSize,
+		int numBlocks)
+	: m_source(source),
+	m_blocks(numBlocks),
+	m_numFull(0),
+	m_fillIndex(0),
+	m_readIndex(0),
+	m_haveBlock(false),
+	m_finished(false),
+	m_stop(false),
+	m_failed(false),
+	m_error(),
+	m_mutex(),
+	m_blockFilled(),
+	m_blockReleased(),
+	m_thread()
+{
+	assert(numBlocks >= 2);
+	for(int i = 0; i < numBlocks; ++i)
+	{
+		m_blocks[i].data.resize(blockSize);
+		m_blocks[i].size = 0;
+	}
+	m_thread.reset(new boost::thread(boost::bind(&ReadAheadBuf::readSource, this)));
+}
+
+ReadAheadBuf::~ReadAheadBuf()
+{
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_stop = true;
+	}
+	m_blockReleased.notify_all();
+	m_thread->join();
+}
+
+ReadAheadBuf::int_type ReadAheadBuf::underflow()
+{
+	if(gptr() < egptr())
+		return traits_type::to_int_type(*gptr());
+	Block* block = 0;
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		if(m_haveBlock)
+		{
+			// Hand the exhausted block back to the worker.
+			m_haveBlock = false;
+			--m_numFull;
+			m_readIndex = (m_readIndex + 1) % m_blocks.size();
+			m_blockReleased.notify_one();
+		}
+		while(m_numFull == 0 && !m_finished)
+			m_blockFilled.wait(lock);
+		if(m_numFull == 0)
+		{
+			if(m_failed)
+			{
+				// Report the error once; afterward the stream just ends.
+				m_failed = false;
+				AQSIS_THROW_XQERROR(XqInvalidFile, EqE_BadFile,
+					"could not read input: " << m_error);
+			}
+			return traits_type::eof();
+		}
+		m_haveBlock = true;
+		block = &m_blocks[m_readIndex];
+	}
+	// The worker won't touch this block again until we release it, so it's
+	// safe to read without holding the lock.
+	char* begin = &block->data[0];
+	setg(begin, begin, begin + block->size);
+	return traits_type::to_int_type(*gptr());
+}
+
+void ReadAheadBuf::readSource()
+{
+	const std::streamsize blockSize = m_blocks[0].data.size();
+	while(true)
+	{
+		Block* block = 0;
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			while(m_numFull == static_cast<int>(m_blocks.size()) && !m_stop)
+				m_blockReleased.wait(lock);
+			if(m_stop)
+				return;
+			block = &m_blocks[m_fillIndex];
+		}
+		// Fill the free block without holding the lock; this is where the
+		// expensive work happens.
+		std::streamsize numRead = 0;
+		bool atEnd = false;
+		bool failed = false;
+		std::string error;
+		try
+		{
+			char* data = &block->data[0];
+			while(numRead < blockSize)
+			{
+				// Each read of the source may take a while, so give up
+				// between reads if we're being destroyed.
+				if(stopping())
+					return;
+				std::streamsize avail = m_source.in_avail();
+				// Hand over a partial block rather than wait on the source
+				// with characters in hand, so that streamed input isn't
+				// held up.
+				if(numRead > 0 && avail <= 0)
+					break;
+				if(avail <= 0)
+				{
+					// Wait for at least one character.
+					if(traits_type::eq_int_type(m_source.sgetc(), traits_type::eof()))
+					{
+						atEnd = true;
+						break;
+					}
+					avail = std::max<std::streamsize>(m_source.in_avail(), 1);
+				}
+				std::streamsize n = m_source.sgetn(data + numRead,
+						std::min(avail, blockSize - numRead));
+				if(n <= 0)
+				{
+					atEnd = true;
+					break;
+				}
+				numRead += n;
+			}
+		}
+		catch(std::exception& e)
+		{
+			// Keep the characters read before the error, and pass the error
+			// on after them.
+			atEnd = true;
+			failed = true;
+			error = e.what();
+		}
+		catch(...)
+		{
+			atEnd = true;
+			failed = true;
+			error = "unknown error";
+		}
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			if(numRead > 0)
+			{
+				block->size = numRead;
+				++m_numFull;
+				m_fillIndex = (m_fillIndex + 1) % m_blocks.size();
+			}
+			if(atEnd)
+				m_finished = true;
+			if(failed)
+			{
+				m_failed = true;
+				m_error = error;
+			}
+		}
+		m_blockFilled.notify_one();
+		if(atEnd)
+			return;
+	}
+}
+
+bool ReadAheadBuf::stopping()
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_stop;
+}
+
+} // namespace Aqsis
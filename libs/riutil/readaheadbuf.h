@@ -0,0 +1,147 @@
+// Aqsis
+// Copyright (C) 2001, Paul C. Gregory and the other authors and contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the software's owners nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// (This is the New BSD license)
+
+/** \file
+ * \brief A stream buffer which reads ahead of its consumer on a separate
+ * thread.
+ */
+
+#ifndef AQSIS_READAHEADBUF_H_INCLUDED
+#define AQSIS_READAHEADBUF_H_INCLUDED
+
+#include <aqsis/aqsis.h>
+
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace Aqsis {
+
+//------------------------------------------------------------------------------
+/** \brief Input stream buffer which reads from a source on a background thread.
+ *
+ * A worker thread pulls characters from the source stream buffer into a ring
+ * of large blocks, staying up to numBlocks blocks ahead of the consumer.  This
+ * is useful when producing the characters is expensive - gzip decompression,
+ * for instance - since that work can then overlap with parsing.
+ *
+ * The worker hands a block over once it's full, or as soon as the source
+ * has no more characters ready without blocking.  Streamed input, such as
+ * RIB arriving through a pipe, is therefore passed on as it arrives rather
+ * than held back until a whole block is available.
+ *
+ * An exception thrown while reading the source (eg, corrupt compressed data)
+ * is passed on to the consumer once it has read all the characters which came
+ * before it.  Only the message survives the trip between threads, so the
+ * consumer sees an XqInvalidFile rather than the original exception type.
+ *
+ * The worker can't be interrupted while it's inside a read of the source.
+ * It checks for shutdown between reads, so destruction waits for at most one
+ * source read.  For a pipe whose writer has stalled that read may not return
+ * until the writer sends more data or closes the pipe.
+ */
+class ReadAheadBuf : public std::streambuf, boost::noncopyable
+{
+	public:
+		/** \brief Start reading ahead from the given source.
+		 *
+		 * \param source - stream buffer to read from.  Must outlive this
+		 *                 object, and shouldn't be touched by anyone else
+		 *                 while the ReadAheadBuf exists.
+		 * \param blockSize - size of each block in the ring
+		 * \param numBlocks - number of blocks in the ring; must be >= 2.
+		 */
+		ReadAheadBuf(std::streambuf& source, int blockSize = 256*1024,
+				int numBlocks = 4);
+		/** \brief Stop the worker thread.
+		 *
+		 * Waits for any read of the source in progress to return; see the
+		 * class documentation.
+		 */
+		~ReadAheadBuf();
+
+	protected:
+		virtual int_type underflow();
+
+	private:
+		/// Main loop of the worker thread.
+		void readSource();
+		/// Check whether the worker has been asked to stop.
+		bool stopping();
+
+		/// A block of characters in the ring.
+		struct Block
+		{
+			std::vector<char> data;
+			std::streamsize size;
+		};
+
+		/// Source of characters.
+		std::streambuf& m_source;
+		/// Ring of blocks.
+		std::vector<Block> m_blocks;
+		/// Number of blocks filled by the worker and not yet released by the
+		/// consumer, including any block currently being consumed.
+		int m_numFull;
+		/// Block which the worker will fill next.
+		int m_fillIndex;
+		/// Block which the consumer will read next, or is reading.
+		int m_readIndex;
+		/// True when the consumer holds the block at m_readIndex.
+		bool m_haveBlock;
+		/// True when the worker has reached the end of the source.
+		bool m_finished;
+		/// True when the worker should stop early.
+		bool m_stop;
+		/// True when the worker finished because of an error in the source
+		/// which hasn't yet been passed on to the consumer.
+		bool m_failed;
+		/// Description of the error in the source.
+		std::string m_error;
+
+		/// Protects the ring state above.
+		boost::mutex m_mutex;
+		/// Signalled when a block is filled.
+		boost::condition_variable m_blockFilled;
+		/// Signalled when a block is released, or when stopping.
+		boost::condition_variable m_blockReleased;
+		/// Worker thread; started last so that everything else is ready.
+		boost::scoped_ptr<boost::thread> m_thread;
+};
+
+} // namespace Aqsis
+
+#endif // AQSIS_READAHEADBUF_H_INCLUDED
@@ -0,0 +1,219 @@
+// Aqsis
+// Copyright (C) 2001, Paul C. Gregory and the other authors and contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the software's owners nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// (This is the New BSD license)
+
+/** \file
+ * \brief Unit tests for the threaded read-ahead stream buffer.
+ */
+
+#include "readaheadbuf.h"
+
+#define BOOST_TEST_DYN_LINK
+
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/auto_unit_test.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <aqsis/util/exception.h>
+
+using namespace Aqsis;
+
+namespace {
+
+/** Source which produces its characters in chunks, like a pipe.
+ *
+ * Each chunk becomes available only once it's been released, and the
+ * source waits (like a read on an empty pipe) until then.  After the last
+ * chunk the source either ends or throws.
+ */
+class ChunkedSource : public std::streambuf
+{
+	public:
+		ChunkedSource(const std::vector<std::string>& chunks, bool throwAtEnd)
+			: m_chunks(chunks),
+			m_numReleased(0),
+			m_nextChunk(0),
+			m_throwAtEnd(throwAtEnd)
+		{ }
+		/// Make the next chunk available.
+		void release()
+		{
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+				++m_numReleased;
+			}
+			m_released.notify_one();
+		}
+		/// Make the next chunk available after a short wait.
+		void delayedRelease()
+		{
+			boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+			release();
+		}
+		/// Number of chunks handed out so far.
+		size_t numRead()
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			return m_nextChunk;
+		}
+	protected:
+		virtual int_type underflow()
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			while(m_nextChunk >= m_numReleased)
+				m_released.wait(lock);
+			if(m_nextChunk >= m_chunks.size())
+			{
+				if(m_throwAtEnd)
+					throw std::runtime_error("corrupt source");
+				return traits_type::eof();
+			}
+			std::string& chunk = m_chunks[m_nextChunk++];
+			setg(&chunk[0], &chunk[0], &chunk[0] + chunk.size());
+			return traits_type::to_int_type(*gptr());
+		}
+	private:
+		std::vector<std::string> m_chunks;
+		size_t m_numReleased;
+		size_t m_nextChunk;
+		bool m_throwAtEnd;
+		boost::mutex m_mutex;
+		boost::condition_variable m_released;
+};
+
+std::string readN(std::streambuf& buf, int n)
+{
+	std::string s;
+	for(int i = 0; i < n; ++i)
+		s += std::streambuf::traits_type::to_char_type(buf.sbumpc());
+	return s;
+}
+
+} // anon. namespace
+
+BOOST_AUTO_TEST_SUITE(read_ahead_buf_tests)
+
+BOOST_AUTO_TEST_CASE(ReadAheadBuf_read_test)
+{
+	// Use small blocks so that the ring wraps around many times.
+	std::string inStr;
+	for(int i = 0; i < 1000; ++i)
+		inStr += "abcdefghijklmnopqrstuvwxyz0123456789\n";
+	std::istringstream src(inStr);
+	ReadAheadBuf buf(*src.rdbuf(), 100, 3);
+	std::istream in(&buf);
+
+	std::string extractedStr((std::istreambuf_iterator<char>(in)),
+			std::istreambuf_iterator<char>());
+	BOOST_CHECK_EQUAL(extractedStr, inStr);
+}
+
+BOOST_AUTO_TEST_CASE(ReadAheadBuf_empty_test)
+{
+	std::istringstream src("");
+	ReadAheadBuf buf(*src.rdbuf(), 100, 2);
+	BOOST_CHECK(buf.sgetc() == std::streambuf::traits_type::eof());
+}
+
+BOOST_AUTO_TEST_CASE(ReadAheadBuf_early_destroy_test)
+{
+	// Destroying the buffer while the worker is waiting for a free block
+	// shouldn't hang.
+	std::string inStr(10000, 'x');
+	std::istringstream src(inStr);
+	{
+		ReadAheadBuf buf(*src.rdbuf(), 100, 2);
+		BOOST_CHECK_EQUAL(buf.sbumpc(), 'x');
+	}
+}
+
+BOOST_AUTO_TEST_CASE(ReadAheadBuf_partial_block_test)
+{
+	// Characters should be passed on as they arrive, without waiting for
+	// the source to fill a whole block.  (If they weren't, readN() would
+	// never return.)
+	std::vector<std::string> chunks;
+	chunks.push_back("WorldBegin\n");
+	chunks.push_back("WorldEnd\n");
+	ChunkedSource src(chunks, false);
+	ReadAheadBuf buf(src, 1000, 2);
+	src.release();
+	BOOST_CHECK_EQUAL(readN(buf, 11), "WorldBegin\n");
+	src.release();
+	BOOST_CHECK_EQUAL(readN(buf, 9), "WorldEnd\n");
+	src.release();
+	BOOST_CHECK(buf.sgetc() == std::streambuf::traits_type::eof());
+}
+
+BOOST_AUTO_TEST_CASE(ReadAheadBuf_source_error_test)
+{
+	// Characters read before an error in the source shouldn't be lost.
+	std::vector<std::string> chunks;
+	chunks.push_back("abc");
+	chunks.push_back("def");
+	ChunkedSource src(chunks, true);
+	for(int i = 0; i < 3; ++i)
+		src.release();
+	ReadAheadBuf buf(src, 1000, 2);
+	BOOST_CHECK_EQUAL(readN(buf, 6), "abcdef");
+	// The error is reported once, then the stream ends.
+	BOOST_CHECK_THROW(buf.sgetc(), XqInvalidFile);
+	BOOST_CHECK(buf.sgetc() == std::streambuf::traits_type::eof());
+}
+
+BOOST_AUTO_TEST_CASE(ReadAheadBuf_destroy_during_read_test)
+{
+	// Destroying the buffer while the worker is blocked reading the source
+	// waits for that read only, and no further reads are made.
+	std::vector<std::string> chunks;
+	chunks.push_back("abc");
+	chunks.push_back("def");
+	chunks.push_back("ghi");
+	ChunkedSource src(chunks, false);
+	src.release();
+	// Let the worker's next read return after a short wait.
+	boost::thread releaser;
+	{
+		ReadAheadBuf buf(src, 1000, 2);
+		BOOST_CHECK_EQUAL(readN(buf, 3), "abc");
+		releaser = boost::thread(boost::bind(&ChunkedSource::delayedRelease, &src));
+	}
+	releaser.join();
+	BOOST_CHECK(src.numRead() <= 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
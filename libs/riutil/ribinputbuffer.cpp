@@ -35,23 +35,30 @@
 
 #include "ribinputbuffer.h"
 
+#include <algorithm>
+
 #ifdef USE_GZIPPED_RIB
 #	include <boost/iostreams/filtering_stream.hpp>
 #	include <boost/iostreams/filter/gzip.hpp>
 #endif
 
+#include "readaheadbuf.h"
+
 #include <aqsis/util/exception.h>
 
 namespace Aqsis {
 
 RibInputBuffer::RibInputBuffer(std::istream& inStream, const std::string& streamName)
-	: m_inStream(&inStream),
+	: m_inBuf(inStream.rdbuf()),
 	m_streamName(streamName),
 	m_gzipStream(),
+	m_readAhead(),
 	m_bufPos(1),
 	m_bufEnd(2),
-	m_currPos(1,0),
-	m_prevPos(-1,-1)
+	m_line(1),
+	m_lineStart(1),
+	m_prevLine(1),
+	m_prevLineStart(1)
 {
 	// Zero the putback chars
 	m_buffer[0] = 0;
@@ -59,13 +66,19 @@ RibInputBuffer::RibInputBuffer(std::istream& inStream, const std::string& stream
 	if(isGzippedStream(inStream))
 	{
 #		ifdef USE_GZIPPED_RIB
-		// Initialise gzip decompressor
+		// Initialise gzip decompressor.  Larger buffers than the defaults
+		// cut down the per-call overhead of the filter chain.
 		namespace io = boost::iostreams;
+		const int zipBufSize = 64*1024;
 		io::filtering_stream<io::input>* zipStream = 0;
 		m_gzipStream.reset(zipStream = new io::filtering_stream<io::input>());
-		zipStream->push(io::gzip_decompressor());
-		zipStream->push(inStream);
-		m_inStream = m_gzipStream.get();
+		zipStream->push(io::gzip_decompressor(io::zlib::default_window_bits,
+					zipBufSize), zipBufSize);
+		zipStream->push(inStream, zipBufSize);
+		// Decompress on a separate thread, so that inflating the next few
+		// blocks overlaps with parsing the current one.
+		m_readAhead.reset(new ReadAheadBuf(*zipStream->rdbuf()));
+		m_inBuf = m_readAhead.get();
 #		else
 		AQSIS_THROW_XQERROR(XqParseError, EqE_Unimplement,
 			"gzipped RIB detected, but aqsis compiled without gzip support.");
@@ -73,13 +86,20 @@ RibInputBuffer::RibInputBuffer(std::istream& inStream, const std::string& stream
 	}
 }
 
+RibInputBuffer::~RibInputBuffer()
+{ }
+
 /** \brief Fill the internal buffer with as many characters as possible
  * (guarenteed >= 1)
  *
- * This function reads in as many characters as possible using a non-blocking
- * read on the istream.  If no characters are returned from the non-blocking
- * read, a single character is read using the blocking std::istream::get()
- * function.
+ * This function reads in as many characters as the underlying stream buffer
+ * can supply without blocking.  If none are available, we block until at
+ * least one character arrives; by then the stream buffer has usually pulled
+ * in a whole block which can be taken in one go.
+ *
+ * For files, std::filebuf reports the remaining length of the file as
+ * available, so the read is limited only by the size of our buffer.  Large
+ * reads like this typically bypass the stream's own buffer entirely.
  *
  * Postconditions: The m_bufPos index is one before the next character in the
  * input stream.  The m_bufEnd index points to one after the last valid
@@ -99,25 +119,35 @@ void RibInputBuffer::bufferNextChars()
 		// detection.
 		m_buffer[0] = m_buffer[m_bufSize-2];
 		m_buffer[1] = m_buffer[m_bufSize-1];
-		// Reset buffer position
-		m_bufPos = 1;
+		// Reset buffer position to just after the copied chars, shifting
+		// the line starts along with them.
+		const int shift = m_bufSize - 2;
+		m_bufPos -= shift;
+		m_lineStart -= shift;
+		m_prevLineStart -= shift;
 	}
-	// Now fill the buffer with as many characters as possible using a
-	// non-blocking read with readsome().
-	int numRead = m_inStream->readsome((char*)m_buffer + m_bufPos,
-									   m_bufSize - m_bufPos);
-	if(numRead > 0)
+	std::streamsize numAvail = m_inBuf->in_avail();
+	if(numAvail == 0)
 	{
-		m_bufEnd = m_bufPos + numRead;
+		// Nothing is buffered, so wait for the next character.  (Blocking
+		// here is acceptable since we need at least one char anyway.)
+		if(m_inBuf->sgetc() == std::istream::traits_type::eof())
+			numAvail = -1;
+		else
+			numAvail = std::max<std::streamsize>(m_inBuf->in_avail(), 1);
+	}
+	std::streamsize numRead = 0;
+	if(numAvail > 0)
+	{
+		numRead = m_inBuf->sgetn(reinterpret_cast<char*>(m_buffer + m_bufPos),
+				std::min<std::streamsize>(numAvail, m_bufSize - m_bufPos));
 	}
+	if(numRead > 0)
+		m_bufEnd = m_bufPos + numRead;
 	else
 	{
-		// Else ugh: We failed to read a group of characters with the
-		// non-blocking read so we have to make an inefficient read of a single
-		// charater.  (Reading a single char may block, but that's acceptable.)
-		std::istream::int_type c = m_inStream->get();
 		// translate EOFs
-		m_buffer[m_bufPos] = (c == EOF) ? eof : c;
+		m_buffer[m_bufPos] = eof;
 		m_bufEnd = m_bufPos + 1;
 	}
 }
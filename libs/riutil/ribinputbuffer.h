@@ -40,12 +40,18 @@
 
 #include <iostream>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <boost/noncopyable.hpp>
 #include <boost/scoped_ptr.hpp>
 
 namespace Aqsis
 {
 
+class ReadAheadBuf;
+
 /// A holder for source code positions.
 struct SourcePos
 {
@@ -68,6 +74,13 @@ struct SourcePos
  * stdin, the "end" of the rib stream may be encountered at any time.  This
  * class therefore makes sure that any input buffering of a requested number of
  * characters is non-blocking.
+ *
+ * For ordinary files the underlying stream buffer reports the whole remainder
+ * of the file as available, so characters are pulled in large blocks which
+ * the standard library is free to read straight into our buffer.
+ *
+ * gzipped input is decompressed on a separate thread, which keeps a few
+ * large blocks ahead of the parser.
  */
 class RibInputBuffer : boost::noncopyable
 {
@@ -85,9 +98,17 @@ class RibInputBuffer : boost::noncopyable
 		 */
 		RibInputBuffer(std::istream& inStream,
 				const std::string& streamName = "unknown");
+		~RibInputBuffer();
 
 		/// Get the next character from the input stream
 		CharType get();
+		/** \brief Get the next character which isn't whitespace.
+		 *
+		 * This is equivalent to calling get() until it returns something
+		 * other than a space, tab or line break, but runs of blanks are
+		 * skipped directly in the buffer rather than one character at a time.
+		 */
+		CharType getNonSpace();
 		/// Put the last character back into the input stream
 		void unget();
 
@@ -99,16 +120,20 @@ class RibInputBuffer : boost::noncopyable
 	private:
 		static bool isGzippedStream(std::istream& in);
 		void bufferNextChars();
+		void newLine(CharType c);
 
-		/// Stream we are reading from.
-		std::istream* m_inStream;
+		/// Stream buffer we are reading from.
+		std::streambuf* m_inBuf;
 		/// Stream name
 		const std::string m_streamName;
 		/// gzip decompressor for compressed input
 		boost::scoped_ptr<std::istream> m_gzipStream;
+		/// Background decompression of m_gzipStream.  Declared after it, so
+		/// that the decompression thread is stopped first.
+		boost::scoped_ptr<ReadAheadBuf> m_readAhead;
 
 		/// Internal buffer size.
-		static const int m_bufSize = 256;
+		static const int m_bufSize = 65536;
 		/// Internal buffer of characters.
 		CharType m_buffer[m_bufSize];
 		/// Position of current character [ie, last char returned with get() ]
@@ -116,10 +141,15 @@ class RibInputBuffer : boost::noncopyable
 		/// Position of last valid character in input buffer.
 		int m_bufEnd;
 
-		/// Current source location
-		SourcePos m_currPos;
-		/// Previous source location
-		SourcePos m_prevPos;
+		/// Current line number
+		int m_line;
+		/// Buffer index of the most recent line break character.  The column
+		/// of the current character is m_bufPos - m_lineStart, so only line
+		/// breaks need any position bookkeeping.
+		int m_lineStart;
+		/// Line state before the most recent line break, for unget()
+		int m_prevLine;
+		int m_prevLineStart;
 };
 
 
@@ -134,18 +164,61 @@ inline RibInputBuffer::CharType RibInputBuffer::get()
 	if(m_bufPos >= m_bufEnd)
 		bufferNextChars();
 	CharType c = m_buffer[m_bufPos];
+	// Keep line numbers up to date.
+	if(c == '\r' || c == '\n')
+		newLine(c);
+	return c;
+}
 
-	// Keep line and column numbers up to date.
-	m_prevPos = m_currPos;
-	++m_currPos.col;
-	if(c == '\r' || (c == '\n' && m_buffer[m_bufPos-1] != '\r'))
+inline void RibInputBuffer::newLine(CharType c)
+{
+	m_prevLine = m_line;
+	m_prevLineStart = m_lineStart;
+	if(c == '\r' || m_buffer[m_bufPos-1] != '\r')
+		++m_line;
+	m_lineStart = m_bufPos;
+}
+
+inline RibInputBuffer::CharType RibInputBuffer::getNonSpace()
+{
+	while(true)
 	{
-		++m_currPos.line;
-		m_currPos.col = 0;
+		// Skip over any blanks which are already buffered.  These don't
+		// affect the line number, so need no bookkeeping.
+#ifdef __SSE2__
+		// Long runs, such as indentation, are skipped sixteen at a time.
+		const __m128i space = _mm_set1_epi8(' ');
+		const __m128i tab = _mm_set1_epi8('\t');
+		while(m_bufPos + 16 < m_bufEnd)
+		{
+			__m128i chars = _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(m_buffer + m_bufPos + 1));
+			int blanks = _mm_movemask_epi8(_mm_or_si128(
+						_mm_cmpeq_epi8(chars, space), _mm_cmpeq_epi8(chars, tab)));
+			if(blanks != 0xffff)
+			{
+				m_bufPos += __builtin_ctz(~blanks);
+				break;
+			}
+			m_bufPos += 16;
+		}
+#endif
+		while(m_bufPos + 1 < m_bufEnd && (m_buffer[m_bufPos + 1] == ' '
+					|| m_buffer[m_bufPos + 1] == '\t'))
+			++m_bufPos;
+		// Line breaks and buffer refills are left to get().
+		CharType c = get();
+		switch(c)
+		{
+			case ' ':
+			case '\t':
+			case '\n':
+			case '\r':
+				break;
+			default:
+				return c;
+		}
 	}
-	else if(c == '\n')
-		m_currPos.col = 0;
-	return c;
 }
 
 inline void RibInputBuffer::unget()
@@ -153,13 +226,18 @@ inline void RibInputBuffer::unget()
 	// Precondition: current buffer position is at least two chars into the
 	// buffer so that lookback can work.
 	assert(m_bufPos >= 1);
+	CharType c = m_buffer[m_bufPos];
+	if(c == '\r' || c == '\n')
+	{
+		m_line = m_prevLine;
+		m_lineStart = m_prevLineStart;
+	}
 	--m_bufPos;
-	m_currPos = m_prevPos;
 }
 
 inline SourcePos RibInputBuffer::pos() const
 {
-	return m_currPos;
+	return SourcePos(m_line, m_bufPos - m_lineStart);
 }
 
 inline const std::string& RibInputBuffer::streamName() const
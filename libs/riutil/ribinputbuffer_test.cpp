@@ -99,15 +99,12 @@ BOOST_AUTO_TEST_CASE(RibInputBuffer_gzip_test)
 
 BOOST_AUTO_TEST_CASE(RibInputBuffer_bufwrap_test)
 {
-	// Test that buffer wrapping works correctly.
-	std::string inStr(
-		// 5*64 chars, which is enough to cause the buffer of 256 chars to wrap around.
-		"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijkl"
-		"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijkl"
-		"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijkl"
-		"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijkl"
-		"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijkl"
-	);
+	// Test that buffer wrapping works correctly.  Some "\r\n" line endings
+	// are included so that some of them straddle the wrap point.
+	std::string inStr;
+	const int numLines = 10000;
+	for(int i = 0; i < numLines; ++i)
+		inStr += "abcdefghijklmnopqrstuvwxyz\r\n";
 	std::istringstream in(inStr);
 	RibInputBuffer inBuf(in);
 
@@ -117,6 +114,53 @@ BOOST_AUTO_TEST_CASE(RibInputBuffer_bufwrap_test)
 		extractedStr += c;
 
 	BOOST_CHECK_EQUAL(extractedStr, inStr);
+	BOOST_CHECK_EQUAL(inBuf.pos().line, numLines + 1);
+}
+
+BOOST_AUTO_TEST_CASE(RibInputBuffer_getNonSpace_test)
+{
+	std::istringstream in("a  \t b\n \r\n  c   ");
+	RibInputBuffer inBuf(in);
+
+	BOOST_CHECK_EQUAL(inBuf.getNonSpace(), 'a');
+	BOOST_CHECK_EQUAL(inBuf.getNonSpace(), 'b');
+	SourcePos pos = inBuf.pos();
+	BOOST_CHECK_EQUAL(pos.line, 1);
+	BOOST_CHECK_EQUAL(pos.col, 6);
+	BOOST_CHECK_EQUAL(inBuf.getNonSpace(), 'c');
+	pos = inBuf.pos();
+	BOOST_CHECK_EQUAL(pos.line, 3);
+	BOOST_CHECK_EQUAL(pos.col, 3);
+	// Putting back c should leave us on the preceding blank.
+	inBuf.unget();
+	pos = inBuf.pos();
+	BOOST_CHECK_EQUAL(pos.line, 3);
+	BOOST_CHECK_EQUAL(pos.col, 2);
+	BOOST_CHECK_EQUAL(inBuf.get(), 'c');
+	BOOST_CHECK(inBuf.getNonSpace() == RibInputBuffer::eof);
+}
+
+BOOST_AUTO_TEST_CASE(RibInputBuffer_getNonSpace_long_runs_test)
+{
+	// Runs of blanks of every length up to several times the width of the
+	// SIMD skip, mixing spaces and tabs.
+	std::string inStr;
+	for(int len = 0; len < 70; ++len)
+	{
+		for(int i = 0; i < len; ++i)
+			inStr += (i % 5 == 3) ? '\t' : ' ';
+		inStr += 'a' + len % 26;
+	}
+	std::istringstream in(inStr);
+	RibInputBuffer inBuf(in);
+	int col = 0;
+	for(int len = 0; len < 70; ++len)
+	{
+		BOOST_CHECK_EQUAL(inBuf.getNonSpace(), 'a' + len % 26);
+		col += len + 1;
+		BOOST_CHECK_EQUAL(inBuf.pos().col, col);
+	}
+	BOOST_CHECK(inBuf.getNonSpace() == RibInputBuffer::eof);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -35,9 +35,9 @@
 
 #include "ribtokenizer.h"
 
-#include <cctype>
 #include <cmath>
 #include <iostream>
+#include <limits>
 #include <string>
 #include <sstream>
 
@@ -162,7 +162,7 @@ void RibTokenizer::scanNext(RibToken& tok)
 	// and comments.
 	while(true)
 	{
-		RibInputBuffer::CharType c = m_inBuf->get();
+		RibInputBuffer::CharType c = m_inBuf->getNonSpace();
 		m_nextPos = m_inBuf->pos();
 		switch(c)
 		{
@@ -173,7 +173,7 @@ void RibTokenizer::scanNext(RibToken& tok)
 			case '\t':
 			case '\n':
 			case '\r':
-				// ignore whitespace
+				// ignore whitespace (normally already skipped by getNonSpace)
 				break;
 			case '#':
 				readComment(*m_inBuf);
@@ -354,15 +354,89 @@ void RibTokenizer::scanNext(RibToken& tok)
 	}
 }
 
+namespace {
+
+inline bool isDigit(RibInputBuffer::CharType c)
+{
+	return c >= '0' && c <= '9';
+}
+
+/// Maximum number of significant digits kept when reading a float.  Any
+/// further digits are far beyond float precision and are dropped.
+const int maxFloatDigits = 40;
+
+/** \brief Convert a decimal float to the nearest representable float.
+ *
+ * The value is d1d2d3... * 10^exponent, where the digit
+ * characters d1d2d3... have no leading zeros.  mantissa holds the integer
+ * value of the digits, and is only used when there are at most 15 of them.
+ *
+ * Short mantissas with small exponents are handled exactly with a single
+ * floating point multiply or divide by a power of ten.  Everything else (or
+ * any result which could suffer from double rounding) falls back on the
+ * standard library, which is slow but correctly rounded.
+ */
+float decimalToFloat(const char* digits, int numDigits,
+		boost::uint64_t mantissa, int exponent, bool negative)
+{
+	static const double powersOfTen[] = {
+		1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21,
+		1e22
+	};
+	if(numDigits == 0)
+		return negative ? -0.0f : 0.0f;
+	if(numDigits <= 15 && exponent >= -22 && exponent <= 22)
+	{
+		float result = 0;
+		if(mantissa <= (1 << 24) && exponent >= -10 && exponent <= 10)
+		{
+			// Both the mantissa and power of ten are exact floats, so one
+			// operation gives the correctly rounded result.
+			float m = static_cast<float>(mantissa);
+			float p = static_cast<float>(powersOfTen[exponent < 0 ? -exponent : exponent]);
+			result = exponent < 0 ? m / p : m * p;
+			return negative ? -result : result;
+		}
+		// Same again in double precision, since mantissa < 10^15 < 2^53.
+		double m = static_cast<double>(mantissa);
+		double d = exponent < 0 ? m / powersOfTen[-exponent]
+			: m * powersOfTen[exponent];
+		// Rounding d to float is correct unless d lies exactly halfway
+		// between two floats, in which case the first rounding may have
+		// decided the tie.  The range of d guarantees both are normalised.
+		int e2 = 0;
+		boost::uint64_t bits = static_cast<boost::uint64_t>(
+				std::ldexp(std::frexp(d, &e2), 53));
+		const boost::uint64_t halfwayMask = (boost::uint64_t(1) << 29) - 1;
+		if((bits & halfwayMask) != (boost::uint64_t(1) << 28))
+		{
+			result = static_cast<float>(d);
+			return negative ? -result : result;
+		}
+	}
+	// Slow path.
+	std::ostringstream numStr;
+	numStr.write(digits, numDigits);
+	numStr << 'e' << exponent;
+	std::istringstream in(numStr.str());
+	float result = 0;
+	if(!(in >> result))
+	{
+		// Out of range for a float.
+		result = numDigits + exponent > 0
+			? std::numeric_limits<float>::infinity() : 0.0f;
+	}
+	return negative ? -result : result;
+}
+
+} // anonymous namespace
+
 /// Read in an ASCII number (integer or real)
 void RibTokenizer::readNumber(RibInputBuffer& inBuf, RibToken& tok)
 {
-	RibInputBuffer::CharType c = 0;
-	int sign = 1;
-	int intResult = 0;
-	float floatResult = 0;
-	bool haveReadDigit = false;
-	c = inBuf.get();
+	RibInputBuffer::CharType c = inBuf.get();
+	bool negative = false;
 	// deal with optional sign
 	switch(c)
 	{
@@ -370,95 +444,112 @@ void RibTokenizer::readNumber(RibInputBuffer& inBuf, RibToken& tok)
 			c = inBuf.get();
 			break;
 		case '-':
-			sign = -1;
+			negative = true;
 			c = inBuf.get();
 			break;
 	}
+	// Significant digits are collected with leading zeros stripped, such that
+	// the number is digits * 10^exponent.  The digits are also accumulated
+	// into an integer, which is exact while there are few of them.
+	char digits[maxFloatDigits + 1];
+	int numDigits = 0;
+	boost::uint64_t mantissa = 0;
+	int exponent = 0;
+	// Integer value; wraps on overflow, as int arithmetic always has here.
+	TqUint32 intResult = 0;
+	bool haveReadDigit = false;
 	// deal with digits before decimal point
-	if(std::isdigit(c))
-		haveReadDigit = true;
-	// \todo: Think of a better way to handle the overflow below robustly?
-	while(std::isdigit(c))
+	while(isDigit(c))
 	{
-		intResult *= 10;
-		intResult += c - '0';
-		// this duplication seems like a waste, but it's robust against overflow...
-		floatResult *= 10;
-		floatResult += c - '0';
+		haveReadDigit = true;
+		intResult = 10*intResult + (c - '0');
+		if(numDigits < maxFloatDigits)
+		{
+			if(numDigits > 0 || c != '0')
+			{
+				digits[numDigits++] = c;
+				mantissa = 10*mantissa + (c - '0');
+			}
+		}
+		else
+		{
+			// Out of space: only the magnitude of these digits matters.
+			++exponent;
+		}
 		c = inBuf.get();
 	}
-	switch(c)
+	bool isFloat = false;
+	if(c == '.')
 	{
-		case '.':
+		// deal with digits to right of decimal point
+		isFloat = true;
+		c = inBuf.get();
+		if(!haveReadDigit && !isDigit(c))
+		{
+			tok.error("Expected at least one digit in float");
+			return;
+		}
+		haveReadDigit = true;
+		while(isDigit(c))
+		{
+			if(numDigits < maxFloatDigits)
 			{
-				// deal with digits to right of decimal point
-				c = inBuf.get();
-				if(!haveReadDigit && !std::isdigit(c))
-				{
-					tok.error("Expected at least one digit in float");
-					return;
-				}
-				float thisPlaceVal = 0.1;
-				while(std::isdigit(c))
+				if(numDigits > 0 || c != '0')
 				{
-					floatResult += (c - '0') * thisPlaceVal;
-					thisPlaceVal *= 0.1;
-					c = inBuf.get();
-				}
-				floatResult *= sign;
-				if(c != 'e' && c != 'E')
-				{
-					inBuf.unget();
-					tok = floatResult;
-					return;
+					digits[numDigits++] = c;
+					mantissa = 10*mantissa + (c - '0');
 				}
+				--exponent;
 			}
-			break;
-		case 'e':
-		case 'E':
-			floatResult *= sign;
-			break;
-		default:
-			// Number is an integer
-			intResult *= sign;
-			if(!haveReadDigit)
-			{
-				tok.error("Expected a digit");
-				return;
-			}
-			inBuf.unget();
-			tok = intResult;
-			return;
-	}
-	// deal with the exponent
-	c = inBuf.get();
-	sign = 1;
-	switch(c)
-	{
-		case '+':
 			c = inBuf.get();
-			break;
-		case '-':
-			sign = -1;
-			c = inBuf.get();
-			break;
+		}
 	}
-	if(!std::isdigit(c))
+	if(!haveReadDigit)
 	{
-		tok.error("Expected digits in float exponent");
+		tok.error("Expected a digit");
 		return;
 	}
-	int exponent = 0;
-	while(std::isdigit(c))
+	if(c == 'e' || c == 'E')
 	{
-		exponent *= 10;
-		exponent += c - '0';
+		// deal with the exponent
+		isFloat = true;
 		c = inBuf.get();
+		bool negativeExp = false;
+		switch(c)
+		{
+			case '+':
+				c = inBuf.get();
+				break;
+			case '-':
+				negativeExp = true;
+				c = inBuf.get();
+				break;
+		}
+		if(!isDigit(c))
+		{
+			tok.error("Expected digits in float exponent");
+			return;
+		}
+		int exp10 = 0;
+		while(isDigit(c))
+		{
+			// Clamp silly exponents rather than overflowing; anything this
+			// size is already out of float range.
+			if(exp10 < 100000)
+				exp10 = 10*exp10 + (c - '0');
+			c = inBuf.get();
+		}
+		exponent += negativeExp ? -exp10 : exp10;
 	}
-	exponent *= sign;
 	inBuf.unget();
-	floatResult *= std::pow(10.0,exponent);
-	tok = floatResult;
+	if(isFloat)
+	{
+		tok = decimalToFloat(digits, numDigits, mantissa, exponent, negative);
+	}
+	else
+	{
+		tok = static_cast<int>(negative ? 0u - intResult : intResult);
+	}
 }
 
 /** \brief Read in a string
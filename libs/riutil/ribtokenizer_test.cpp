@@ -33,6 +33,7 @@
  * \author Chris Foster  [chris42f (at) gmail (dot) com]
  */
 
+#include <limits>
 #include <sstream>
 
 #include "ribtokenizer.h"
@@ -153,6 +154,39 @@ BOOST_AUTO_TEST_CASE(RibTokenizer_float_test)
 	CHECK_EOF(f.t);
 }
 
+BOOST_AUTO_TEST_CASE(RibTokenizer_float_rounding_test)
+{
+	// Floats should be read exactly as the compiler would round them,
+	// including long mantissas and exponents outside the simple cases.
+	TokenizerFixture f(
+		"0.1 0.333333333 3.14159265358979 1.00000005960464477539 \
+		 123456789012345678901234. 0.000000000000000000000000012345 \
+		 1e-40 1e38 -7.5e-20 0.0 -0.0 1e100 00012.5000"
+	);
+	float floats[] = {
+		0.1f, 0.333333333f, 3.14159265358979f, 1.00000005960464477539f,
+		123456789012345678901234.0f, 0.000000000000000000000000012345f,
+		1e-40f, 1e38f, -7.5e-20f, 0.0f, -0.0f,
+		std::numeric_limits<float>::infinity(), 12.5f
+	};
+	for(int i = 0; i < static_cast<int>(sizeof(floats)/sizeof(floats[0])); ++i)
+	{
+		// Compare exactly rather than with the tolerance of RibToken::operator==
+		const RibToken& tok = f.t.get();
+		BOOST_CHECK_EQUAL(tok.type(), RibToken::FLOAT);
+		BOOST_CHECK_EQUAL(tok.floatVal(), floats[i]);
+	}
+	CHECK_EOF(f.t);
+}
+
+BOOST_AUTO_TEST_CASE(RibTokenizer_bad_number_test)
+{
+	TokenizerFixture f("- . 1e 1.5e+");
+	for(int i = 0; i < 4; ++i)
+		BOOST_CHECK_EQUAL(f.t.get(), RibToken(RibToken::ERROR));
+	CHECK_EOF(f.t);
+}
+
 BOOST_AUTO_TEST_CASE(RibTokenizer_array_test)
 {
 	TokenizerFixture f("[ 1.0 -1 ]");
@@ -146,8 +146,10 @@ const CqPrimvarToken standardVarsInit[] = {
 	// Option "limits"
 	CqPrimvarToken(class_uniform,  type_integer, 1, "gridsize"),
 	CqPrimvarToken(class_uniform,  type_integer, 1, "texturememory"),
+	CqPrimvarToken(class_uniform,  type_integer, 1, "texturefiles"),
 	CqPrimvarToken(class_uniform,  type_integer, 2, "bucketsize"),
 	CqPrimvarToken(class_uniform,  type_integer, 1, "eyesplits"),
+	CqPrimvarToken(class_uniform,  type_integer, 1, "threads"),
 	CqPrimvarToken(class_uniform,  type_color,   1, "zthreshold"),
 	// Option "searchpath"
 	CqPrimvarToken(class_uniform,  type_string,  1, "shader"),
@@ -156,6 +158,9 @@ const CqPrimvarToken standardVarsInit[] = {
 	CqPrimvarToken(class_uniform,  type_string,  1, "display"),
 	CqPrimvarToken(class_uniform,  type_string,  1, "procedural"),
 	CqPrimvarToken(class_uniform,  type_string,  1, "resource"),
+	// Option "shading"
+	CqPrimvarToken(class_uniform,  type_integer, 1, "superinstructions"),
+	CqPrimvarToken(class_uniform,  type_string,  1, "cachedir"),
 	// Option "statistics"
 	CqPrimvarToken(class_uniform,  type_integer, 1, "endofframe"),
 	CqPrimvarToken(class_uniform,  type_integer, 1, "echoapi"),
@@ -192,6 +197,8 @@ const CqPrimvarToken standardVarsInit[] = {
 	CqPrimvarToken(class_uniform,  type_integer, 1, "enabled"),
 	// Attribute "derivatives"
 	CqPrimvarToken(class_uniform,  type_integer, 1, "centered"),
+	// Attribute "visibility"
+	CqPrimvarToken(class_uniform,  type_integer, 1, "trace"),
 
 	//--------------------------------------------------
 	// Aqsis-specific options / attributes
@@ -202,6 +209,9 @@ const CqPrimvarToken standardVarsInit[] = {
 	CqPrimvarToken(class_uniform,  type_integer, 1, "multipass"),
 	// Attribute "aqsis"
 	CqPrimvarToken(class_uniform,  type_float,   1, "expandgrids"),
+	// Attribute "light"
+	CqPrimvarToken(class_uniform,  type_float,   1, "influenceradius"),
+	CqPrimvarToken(class_uniform,  type_integer, 1, "conecull"),
 
 	//--------------------------------------------------
 	// Extra options not used by aqsis, but apparently commonly exported in RIB files.
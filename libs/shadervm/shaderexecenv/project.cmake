@@ -9,6 +9,7 @@ set(shaderexecenv_srcs
 	shadeops_math.cpp
 	shadeops_matrx.cpp
 	shadeops_rand.cpp
+	shadeops_raytrace.cpp
 	shadeops_text.cpp
 	shadeops_tmap.cpp
 	shaderexecenv.cpp
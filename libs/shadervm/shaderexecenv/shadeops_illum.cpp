@@ -52,7 +52,7 @@ bool CqShaderExecEnv::SO_init_illuminance()
 
 	m_li = 0;
 	while ( m_li < m_pAttributes ->cLights() &&
-	        m_pAttributes ->pLight( m_li ) ->pShader() ->fAmbient() )
+	        ( lightCulled( m_li ) || m_pAttributes ->pLight( m_li ) ->pShader() ->fAmbient() ) )
 	{
 		m_li++;
 	}
@@ -77,7 +77,7 @@ bool CqShaderExecEnv::SO_advance_illuminance()
 
 	m_li++;
 	while ( m_li < m_pAttributes ->cLights() &&
-	        m_pAttributes ->pLight( m_li ) ->pShader() ->fAmbient() )
+	        ( lightCulled( m_li ) || m_pAttributes ->pLight( m_li ) ->pShader() ->fAmbient() ) )
 	{
 		m_li++;
 	}
@@ -146,21 +146,51 @@ void CqShaderExecEnv::ValidateIlluminanceCache( IqShaderData* pP, IqShaderData*
 
 		IqShaderData* Ns = (pN != NULL )? pN : N();
 		IqShaderData* Ps = (pP != NULL )? pP : P();
+		// Skip lights which can't reach the grid, they're also passed over
+		// by the illuminance loops.
+		cullGridLights( Ps );
 		TqUint li = 0;
 		while ( li < m_pAttributes ->cLights() )
 		{
-			IqLightsource * lp = m_pAttributes ->pLight( li );
-			// Initialise the lightsource
-			lp->Initialise( uGridRes(), vGridRes(), microPolygonCount(), shadingPointCount(), m_hasValidDerivatives );
-			m_Illuminate = 0;
-			// Evaluate the lightsource
-			lp->Evaluate( Ps, Ns, m_pCurrentSurface );
+			if ( !lightCulled( li ) )
+			{
+				IqLightsource * lp = m_pAttributes ->pLight( li );
+				// Initialise the lightsource
+				lp->Initialise( uGridRes(), vGridRes(), microPolygonCount(), shadingPointCount(), m_hasValidDerivatives );
+				m_Illuminate = 0;
+				// Evaluate the lightsource
+				lp->Evaluate( Ps, Ns, m_pCurrentSurface );
+			}
 			li++;
 		}
 		m_IlluminanceCacheValid = true;
 	}
 }
 
+void CqShaderExecEnv::cullGridLights( IqShaderData* Ps )
+{
+	TqUint numLights = m_pAttributes ->cLights();
+	m_gridLights.resize( numLights );
+	for ( TqUint li = 0; li < numLights; li++ )
+		m_gridLights[ li ] = m_pAttributes ->pLight( li );
+	if ( numLights == 0 || !getRenderContext() )
+		return;
+
+	// Bound the points being lit.
+	TqInt count = ( Ps->Class() == class_varying ) ? shadingPointCount() : 1;
+	CqVector3D boxMin;
+	Ps->GetPoint( boxMin, 0 );
+	CqVector3D boxMax = boxMin;
+	for ( TqInt i = 1; i < count; i++ )
+	{
+		CqVector3D p;
+		Ps->GetPoint( p, i );
+		boxMin = min( boxMin, p );
+		boxMax = max( boxMax, p );
+	}
+	getRenderContext()->cullLights( boxMin, boxMax, &m_gridLights[ 0 ], numLights );
+}
+
 //----------------------------------------------------------------------
 // reflect(I,N)
 void CqShaderExecEnv::SO_reflect( IqShaderData* I, IqShaderData* N, IqShaderData* Result, IqShader* pShader )
@@ -400,7 +430,7 @@ void CqShaderExecEnv::SO_ambient( IqShaderData* Result, IqShader* pShader )
 			__fVarying = true;
 
 			IqLightsource* lp = m_pAttributes ->pLight( light_index );
-			if ( lp->pShader() ->fAmbient() )
+			if ( !lightCulled( light_index ) && lp->pShader() ->fAmbient() )
 			{
 				__iGrid = 0;
 				const CqBitVector& RS = RunningState();
@@ -868,6 +898,7 @@ void CqShaderExecEnv::SO_illuminate( IqShaderData* P, IqShaderData* Axis, IqShad
 	__fVarying = true;
 	if ( res )
 	{
+		m_illuminateIsSolar = false;
 		__iGrid = 0;
 		const CqBitVector& RS = RunningState();
 		do
@@ -930,6 +961,8 @@ void CqShaderExecEnv::SO_solar( IqShaderData* Axis, IqShaderData* Angle, IqShade
 		res = false;
 
 	__fVarying = true;
+	if ( res )
+		m_illuminateIsSolar = true;
 	__iGrid = 0;
 	const CqBitVector& RS = RunningState();
 	do
@@ -74,7 +74,7 @@ static DiffusePointOctreeCache g_pointOctreeCache;
 
 void clearPointCloudCache()
 {
-	g_pointOctreeCache.clear();
+	g_pointOctreeCache.endFrame();
 }
 
 
@@ -148,8 +148,8 @@ void CqShaderExecEnv::pointCloudIntegrate(IqShaderData* P, IqShaderData* N,
 		//   "falloff", "falloffmode" - falloff of occlusion with distance
 		//   ... more!
 		//
-		// Other arguments we may not bother with:
-		//   "pointbased"  - we don't support any other method...
+		// "pointbased" is handled by SO_occlusion_rt, which traces rays
+		// instead when it's turned off.
 	}
 
 	// Compute transform from current to appropriate space.
@@ -276,8 +276,35 @@ static void storeIntegratedResult(const OcclusionIntegrator& integrator,
 // occlusion(P,N,samples)
 void CqShaderExecEnv::SO_occlusion_rt( IqShaderData* P, IqShaderData* N, IqShaderData* samples, IqShaderData* Result, IqShader* pShader, int cParams, IqShaderData** apParams )
 {
-	pointCloudIntegrate<OcclusionIntegrator>(P, N, Result, cParams, apParams,
-											 pShader);
+	// Use the point cloud if one is named, unless "pointbased" is turned off;
+	// otherwise trace rays against the scene.
+	bool pointBased = false;
+	float maxDist = 0;
+	CqString paramName;
+	for(int i = 0; i < cParams; i+=2)
+	{
+		apParams[i]->GetString(paramName, 0);
+		IqShaderData* paramValue = apParams[i+1];
+		if(paramName == "filename")
+			pointBased = true;
+		else if(paramName == "maxdist" && paramValue->Type() == type_float)
+			paramValue->GetFloat(maxDist);
+	}
+	for(int i = 0; i < cParams; i+=2)
+	{
+		apParams[i]->GetString(paramName, 0);
+		if(paramName == "pointbased" && apParams[i+1]->Type() == type_float)
+		{
+			float value = 1;
+			apParams[i+1]->GetFloat(value);
+			pointBased = value != 0;
+		}
+	}
+	if(pointBased)
+		pointCloudIntegrate<OcclusionIntegrator>(P, N, Result, cParams, apParams,
+												 pShader);
+	else if(getRenderContext())
+		traceOcclusion(P, N, samples, Result, maxDist);
 }
 
 
@@ -103,7 +103,7 @@ void CqShaderExecEnv::SO_transform( IqShaderData* tospace, IqShaderData* p, IqSh
 		CqString _aq_tospace;
 		(tospace)->GetString(_aq_tospace,__iGrid);
 		CqMatrix mat;
-		getRenderContext() ->matSpaceToSpace( "current", _aq_tospace.c_str(), pShader->getTransform(), pTransform().get(), getRenderContext()->Time(), mat );
+		getRenderContext() ->matSpaceToSpace( Space_Camera, getRenderContext()->spaceHandle( _aq_tospace.c_str() ), pShader->getTransform(), pTransform().get(), getRenderContext()->Time(), mat );
 
 
 		__iGrid = 0;
@@ -238,7 +238,7 @@ void CqShaderExecEnv::SO_vtransform( IqShaderData* tospace, IqShaderData* p, IqS
 		CqString _aq_tospace;
 		(tospace)->GetString(_aq_tospace,__iGrid);
 		CqMatrix mat;
-		getRenderContext() ->matVSpaceToSpace( "current", _aq_tospace.c_str(), pShader->getTransform(), pTransform().get(), getRenderContext()->Time(), mat );
+		getRenderContext() ->matVSpaceToSpace( Space_Camera, getRenderContext()->spaceHandle( _aq_tospace.c_str() ), pShader->getTransform(), pTransform().get(), getRenderContext()->Time(), mat );
 
 
 		__iGrid = 0;
@@ -373,7 +373,7 @@ void CqShaderExecEnv::SO_ntransform( IqShaderData* tospace, IqShaderData* p, IqS
 		CqString _aq_tospace;
 		(tospace)->GetString(_aq_tospace,__iGrid);
 		CqMatrix mat;
-		getRenderContext() ->matNSpaceToSpace( "current", _aq_tospace.c_str(), pShader->getTransform(), pTransform().get(), getRenderContext()->Time(), mat );
+		getRenderContext() ->matNSpaceToSpace( Space_Camera, getRenderContext()->spaceHandle( _aq_tospace.c_str() ), pShader->getTransform(), pTransform().get(), getRenderContext()->Time(), mat );
 		__iGrid = 0;
 
 		__iGrid = 0;
@@ -873,7 +873,7 @@ void CqShaderExecEnv::SO_mtransform( IqShaderData* tospace, IqShaderData* m, IqS
 		CqString _aq_tospace;
 		(tospace)->GetString(_aq_tospace,__iGrid);
 		CqMatrix mat;
-		getRenderContext() ->matNSpaceToSpace( "current", _aq_tospace.c_str(), pShader->getTransform(), pTransform().get(), getRenderContext()->Time(), mat );
+		getRenderContext() ->matNSpaceToSpace( Space_Camera, getRenderContext()->spaceHandle( _aq_tospace.c_str() ), pShader->getTransform(), pTransform().get(), getRenderContext()->Time(), mat );
 		__iGrid = 0;
 
 		__iGrid = 0;
@@ -45,7 +45,7 @@ void	CqShaderExecEnv::SO_frandom( IqShaderData* Result, IqShader* pShader )
 	{
 		if(!__fVarying || RS.Value( __iGrid ) )
 		{
-			(Result)->SetFloat(m_random.RandomFloat(),__iGrid);
+			(Result)->SetFloat(random().RandomFloat(),__iGrid);
 		}
 	}
 	while( ( ++__iGrid < shadingPointCount() ) && __fVarying);
@@ -65,9 +65,9 @@ void	CqShaderExecEnv::SO_crandom( IqShaderData* Result, IqShader* pShader )
 		if(!__fVarying || RS.Value( __iGrid ) )
 		{
 			TqFloat a, b, c;
-			a = m_random.RandomFloat();
-			b = m_random.RandomFloat();
-			c = m_random.RandomFloat();
+			a = random().RandomFloat();
+			b = random().RandomFloat();
+			c = random().RandomFloat();
 
 			(Result)->SetColor(CqColor(a,b,c),__iGrid);
 		}
@@ -89,9 +89,9 @@ void	CqShaderExecEnv::SO_prandom( IqShaderData* Result, IqShader* pShader )
 		if(!__fVarying || RS.Value( __iGrid ) )
 		{
 			TqFloat a, b, c;
-			a = m_random.RandomFloat();
-			b = m_random.RandomFloat();
-			c = m_random.RandomFloat();
+			a = random().RandomFloat();
+			b = random().RandomFloat();
+			c = random().RandomFloat();
 
 			(Result)->SetPoint(CqVector3D(a,b,c),__iGrid);
 		}
@@ -0,0 +1,195 @@
+// Aqsis
+// Copyright (C) 1997 - 2001, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+/** \file
+		\brief Ray traced shadow and occlusion queries for the shadeops.
+*/
+
+#include	"shaderexecenv.h"
+
+#include	<algorithm>
+#include	<cfloat>
+#include	<cmath>
+
+#include	<boost/scoped_array.hpp>
+
+#include	<aqsis/core/iraytrace.h>
+
+namespace Aqsis {
+
+namespace {
+
+/// Offset along rays used when the "trace" "bias" option isn't set.
+const TqFloat defaultTraceBias = 0.01f;
+
+/// Get the distance along traced rays before which hits are ignored.
+TqFloat traceBias(const IqRenderer& context)
+{
+	if(const TqFloat* biasPtr = context.GetFloatOption("trace", "bias"))
+		return *biasPtr;
+	return defaultTraceBias;
+}
+
+} // unnamed namespace
+
+
+//----------------------------------------------------------------------
+void CqShaderExecEnv::traceShadow(IqShaderData* P, IqShaderData* Result,
+		IqShader* pShader)
+{
+	const IqRaytrace* raytracer = getRenderContext()->pRaytracer();
+	// Inside a light shader L points from the light to Ps.  Elsewhere it's
+	// taken to be the illuminance loop L, pointing from Ps to the light.
+	bool inLight = pShader->Type() == Type_Lightsource;
+	bool solar = inLight && m_illuminateIsSolar;
+
+	// Gather up the rays for all running shading points.
+	TqInt count = shadingPointCount();
+	boost::scoped_array<CqVector3D> org(new CqVector3D[count]);
+	boost::scoped_array<CqVector3D> dir(new CqVector3D[count]);
+	boost::scoped_array<TqFloat> tMax(new TqFloat[count]);
+	boost::scoped_array<TqInt> gridIdx(new TqInt[count]);
+	TqInt numRays = 0;
+	const CqBitVector& RS = RunningState();
+	for(TqInt i = 0; i < count; ++i)
+	{
+		if(!RS.Value(i))
+			continue;
+		Result->SetFloat(0.0f, i);
+		if(!raytracer || !L())
+			continue;
+		CqVector3D pos;
+		P->GetPoint(pos, i);
+		CqVector3D vecL;
+		L()->GetVector(vecL, i);
+		CqVector3D vecPs;
+		Ps()->GetPoint(vecPs, i);
+		CqVector3D toLight;
+		if(solar)
+			toLight = -vecL;
+		else if(inLight)
+			toLight = vecPs - vecL - pos;
+		else
+			toLight = vecPs + vecL - pos;
+		TqFloat dist = toLight.Magnitude();
+		if(dist <= 0)
+			continue;
+		org[numRays] = pos;
+		dir[numRays] = toLight/dist;
+		tMax[numRays] = solar ? FLT_MAX : dist;
+		gridIdx[numRays] = i;
+		++numRays;
+	}
+	if(numRays == 0)
+		return;
+
+	boost::scoped_array<bool> occluded(new bool[numRays]);
+	raytracer->OccludedStream(org.get(), dir.get(), traceBias(*getRenderContext()),
+			tMax.get(), numRays, occluded.get());
+	for(TqInt i = 0; i < numRays; ++i)
+	{
+		if(occluded[i])
+			Result->SetFloat(1.0f, gridIdx[i]);
+	}
+}
+
+
+//----------------------------------------------------------------------
+void CqShaderExecEnv::traceOcclusion(IqShaderData* P, IqShaderData* N,
+		IqShaderData* samples, IqShaderData* Result, TqFloat maxDist)
+{
+	const IqRaytrace* raytracer = getRenderContext()->pRaytracer();
+	TqFloat bias = traceBias(*getRenderContext());
+	if(maxDist <= 0)
+		maxDist = FLT_MAX;
+
+	// Storage for the rays of one shading point, which are traced together.
+	TqInt maxRays = 0;
+	boost::scoped_array<CqVector3D> org;
+	boost::scoped_array<CqVector3D> dir;
+	boost::scoped_array<TqFloat> tMax;
+	boost::scoped_array<bool> occluded;
+
+	bool varying = Result->Class() == class_varying;
+	const CqBitVector& RS = RunningState();
+	TqUint gridIdx = 0;
+	do
+	{
+		if(!varying || RS.Value(gridIdx))
+		{
+			if(!raytracer)
+			{
+				Result->SetFloat(0.0f, gridIdx);
+				continue;
+			}
+			// Stratify the hemisphere into nu*nv cells.
+			TqFloat numSamples = 16;
+			if(samples)
+				samples->GetFloat(numSamples, gridIdx);
+			TqInt nu = std::max(1, static_cast<TqInt>(std::sqrt(numSamples)));
+			TqInt nv = std::max(1, static_cast<TqInt>(numSamples)/nu);
+			TqInt numRays = nu*nv;
+			if(numRays > maxRays)
+			{
+				maxRays = numRays;
+				org.reset(new CqVector3D[maxRays]);
+				dir.reset(new CqVector3D[maxRays]);
+				tMax.reset(new TqFloat[maxRays]);
+				occluded.reset(new bool[maxRays]);
+			}
+
+			CqVector3D pos;
+			P->GetPoint(pos, gridIdx);
+			CqVector3D nrm;
+			N->GetNormal(nrm, gridIdx);
+			nrm.Unit();
+			// Tangent frame about the normal.
+			CqVector3D t1 = (std::fabs(nrm.x()) > 0.5f ? CqVector3D(0,1,0)
+					: CqVector3D(1,0,0)) % nrm;
+			t1.Unit();
+			CqVector3D t2 = nrm % t1;
+
+			// Cosine weighted directions, jittered within each cell.
+			TqInt k = 0;
+			for(TqInt v = 0; v < nv; ++v)
+			{
+				for(TqInt u = 0; u < nu; ++u, ++k)
+				{
+					TqFloat r2 = (u + random().RandomFloat())/nu;
+					TqFloat phi = 2*M_PI*(v + random().RandomFloat())/nv;
+					TqFloat r = std::sqrt(r2);
+					org[k] = pos;
+					dir[k] = r*std::cos(phi)*t1 + r*std::sin(phi)*t2
+						+ std::sqrt(std::max(0.0f, 1 - r2))*nrm;
+					tMax[k] = maxDist;
+				}
+			}
+			raytracer->OccludedStream(org.get(), dir.get(), bias, tMax.get(),
+					numRays, occluded.get());
+			TqInt numOccluded = 0;
+			for(TqInt i = 0; i < numRays; ++i)
+				numOccluded += occluded[i];
+			Result->SetFloat(static_cast<TqFloat>(numOccluded)/numRays, gridIdx);
+		}
+	}
+	while( ( ++gridIdx < shadingPointCount() ) && varying);
+}
+
+} // namespace Aqsis
@@ -31,6 +31,7 @@
 
 #include	<map>
 #include	<string>
+#include	<vector>
 #include	<cstdio>
 #include	<cstring>
 
@@ -185,6 +186,12 @@ class CqSampleOptionExtractorBase
 		/// Null destructor
 		virtual ~CqSampleOptionExtractorBase() {}
 
+		/// Determine whether any of the sample options are varying.
+		bool hasVarying() const
+		{
+			return m_sBlur || m_tBlur || m_channel;
+		}
+
 		/** \brief Extract texture sample options from cached parameters
 		 *
 		 * \param gridIdx - index into varying shader parameter data.
@@ -254,6 +261,7 @@ class CqSampleOptionExtractor
 			extractUniformAndCacheVarying(paramList, numParams, opts);
 		}
 
+		using CqSampleOptionExtractorBase<CqTextureSampleOptions>::hasVarying;
 		using CqSampleOptionExtractorBase<CqTextureSampleOptions>::extractVarying;
 };
 
@@ -352,6 +360,40 @@ void getRenderContextShadowOpts(const IqRenderer& context, CqShadowSampleOptions
 
 } // unnamed namespace.
 
+//----------------------------------------------------------------------
+void CqShaderExecEnv::sampleTextureGrid(const IqTextureSampler& texSampler,
+		const CqTextureSampleOptions& sampleOpts, IqShaderData* s,
+		IqShaderData* t, std::vector<TqInt>& indices,
+		std::vector<TqFloat>& samples)
+{
+	// The sample options are the same for every shading point, so filter
+	// the whole grid in one batch.
+	const CqBitVector& RS = RunningState();
+	std::vector<SqSamplePllgram> regions;
+	indices.reserve(shadingPointCount());
+	regions.reserve(shadingPointCount());
+	TqInt gridIdx = 0;
+	do
+	{
+		if(RS.Value(gridIdx))
+		{
+			CqVector2D diffUst(diffU<TqFloat>(s, gridIdx), diffU<TqFloat>(t, gridIdx));
+			CqVector2D diffVst(diffV<TqFloat>(s, gridIdx), diffV<TqFloat>(t, gridIdx));
+			TqFloat ss = 0;
+			TqFloat tt = 0;
+			s->GetFloat(ss,gridIdx);
+			t->GetFloat(tt,gridIdx);
+			indices.push_back(gridIdx);
+			regions.push_back(SqSamplePllgram(CqVector2D(ss,tt), diffUst, diffVst));
+		}
+	}
+	while( ++gridIdx < static_cast<TqInt>(shadingPointCount()) );
+	if(regions.empty())
+		return;
+	samples.resize(sampleOpts.numChannels()*regions.size());
+	texSampler.sampleGrid(&regions[0], regions.size(), sampleOpts, &samples[0]);
+}
+
 //----------------------------------------------------------------------
 // texture(S)
 void CqShaderExecEnv::SO_ftexture1( IqShaderData* name, IqShaderData* Result, IqShader* pShader, TqInt cParams, IqShaderData** apParams )
@@ -386,6 +428,15 @@ void CqShaderExecEnv::SO_ftexture2(IqShaderData* name, IqShaderData* s, IqShader
 	CqSampleOptionExtractor optExtractor(apParams, cParams, sampleOpts);
 
 	const CqBitVector& RS = RunningState();
+	if(!optExtractor.hasVarying())
+	{
+		std::vector<TqInt> indices;
+		std::vector<TqFloat> texSamples;
+		sampleTextureGrid(texSampler, sampleOpts, s, t, indices, texSamples);
+		for(TqInt i = 0, numSamples = indices.size(); i < numSamples; ++i)
+			Result->SetFloat(texSamples[i], indices[i]);
+		return;
+	}
 	gridIdx = 0;
 	do
 	{
@@ -501,6 +552,19 @@ void CqShaderExecEnv::SO_ctexture2( IqShaderData* name, IqShaderData* s, IqShade
 	CqSampleOptionExtractor optExtractor(apParams, cParams, sampleOpts);
 
 	const CqBitVector& RS = RunningState();
+	if(!optExtractor.hasVarying())
+	{
+		std::vector<TqInt> indices;
+		std::vector<TqFloat> texSamples;
+		sampleTextureGrid(texSampler, sampleOpts, s, t, indices, texSamples);
+		for(TqInt i = 0, numSamples = indices.size(); i < numSamples; ++i)
+		{
+			const TqFloat* texSample = &texSamples[3*i];
+			Result->SetColor(CqColor(texSample[0], texSample[1], texSample[2]),
+					indices[i]);
+		}
+		return;
+	}
 	gridIdx = 0;
 	do
 	{
@@ -862,6 +926,11 @@ void CqShaderExecEnv::SO_shadow( IqShaderData* name, IqShaderData* P, IqShaderDa
 	// Get the shadow map.
 	CqString mapName;
 	name->GetString(mapName, gridIdx);
+	if(mapName == "raytrace")
+	{
+		traceShadow(P, Result, pShader);
+		return;
+	}
 	const IqShadowSampler& shadSampler
 		= getRenderContext()->textureCache().findShadowSampler(mapName.c_str());
 
@@ -1313,6 +1382,11 @@ void CqShaderExecEnv::SO_occlusion(IqShaderData* name, IqShaderData* P, IqShader
 	// Get the occlusion map.
 	CqString mapName;
 	name->GetString(mapName, gridIdx);
+	if(mapName == "raytrace")
+	{
+		traceOcclusion(P, N, samples, Result, 0);
+		return;
+	}
 	const IqOcclusionSampler& occSampler
 		= getRenderContext()->textureCache().findOcclusionSampler(mapName.c_str());
 
@@ -1430,7 +1504,7 @@ void CqShaderExecEnv::SO_textureinfo( IqShaderData* name, IqShaderData* dataName
 		if(worldToLight)
 		{
 			CqMatrix currToWorld;
-			getRenderContext()->matSpaceToSpace("current", "world",
+			getRenderContext()->matSpaceToSpace(Space_Camera, Space_World,
 					NULL, NULL, 0, currToWorld);
 			pV->SetMatrix((*worldToLight)*currToWorld);
 			returnVal = 1;
@@ -1442,7 +1516,7 @@ void CqShaderExecEnv::SO_textureinfo( IqShaderData* name, IqShaderData* dataName
 		if(worldToLightNdc)
 		{
 			CqMatrix currToWorld;
-			getRenderContext()->matSpaceToSpace("current", "world",
+			getRenderContext()->matSpaceToSpace(Space_Camera, Space_World,
 					NULL, NULL, 0, currToWorld);
 			pV->SetMatrix((*worldToLightNdc)*currToWorld);
 			returnVal = 1;
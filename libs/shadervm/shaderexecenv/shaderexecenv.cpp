@@ -25,6 +25,8 @@
 
 #include	"shaderexecenv.h"
 
+#include	<boost/thread/mutex.hpp>
+
 namespace Aqsis {
 
 //------------------------------------------------------------------------------
@@ -37,9 +39,6 @@ boost::shared_ptr<IqShaderExecEnv> IqShaderExecEnv::create(IqRenderer* context)
 
 //------------------------------------------------------------------------------
 
-CqNoise	CqShaderExecEnv::m_noise;
-CqCellNoise	CqShaderExecEnv::m_cellnoise;
-CqRandom	CqShaderExecEnv::m_random;
 CqMatrix	CqShaderExecEnv::m_matIdentity;
 
 const char*	gVariableNames[ EnvVars_Last ] =
@@ -129,13 +128,19 @@ TqInt gDefLightUses = ( 1 << EnvVars_P ) | ( 1 << EnvVars_L ) | ( 1 << EnvVars_P
 
 CqShaderExecEnv::CqShaderExecEnv(IqRenderer* pRenderContext)
 	: m_apVariables(EnvVars_Last, 0),
+	m_noise(),
+	m_cellnoise(),
+	m_random(),
+	m_haveRandom(false),
 	m_uGridRes(0),
 	m_vGridRes(0),
 	m_microPolygonCount(0),
 	m_shadingPointCount(0),
 	m_li(0),
 	m_Illuminate(0),
+	m_illuminateIsSolar(false),
 	m_IlluminanceCacheValid(false),
+	m_gridLights(),
 	m_gatherSample(0),
 	m_pAttributes(),
 	m_pTransform(),
@@ -149,6 +154,23 @@ CqShaderExecEnv::CqShaderExecEnv(IqRenderer* pRenderContext)
 { }
 
 
+//----------------------------------------------------------------------
+void CqShaderExecEnv::seedRandom()
+{
+	// Each env gets a different sequence, seeded from a count rather than
+	// the shared random sequence so that envs on separate threads don't
+	// race on the shared state.
+	static boost::mutex seedMutex;
+	static TqUint numSeeded = 0;
+	TqUint seed = 0;
+	{
+		boost::mutex::scoped_lock lock(seedMutex);
+		seed = ++numSeeded;
+	}
+	m_random = CqRandom::independent(seed);
+	m_haveRandom = true;
+}
+
 //----------------------------------------------------------------------
 /** Destructor.
  */
@@ -188,7 +210,9 @@ void CqShaderExecEnv::Initialise( const TqInt uGridRes, const TqInt vGridRes,
 
 	m_li = 0;
 	m_Illuminate = 0;
+	m_illuminateIsSolar = false;
 	m_IlluminanceCacheValid = false;
+	m_gridLights.clear();
 
 	// Initialise the state bitvectors
 	m_CurrentState.SetSize( m_shadingPointCount );
@@ -53,6 +53,9 @@
 
 namespace Aqsis {
 
+class IqTextureSampler;
+class CqTextureSampleOptions;
+
 //----------------------------------------------------------------------
 /** \class CqShaderExecEnv
  * Standard shader execution environment. Contains standard variables, and provides SIMD functionality.
@@ -290,6 +293,15 @@ class AQSIS_SHADERVM_SHARE CqShaderExecEnv : public IqShaderExecEnv, boost::nonc
 		}
 
 	private:
+		/** \brief Get the random number generator for this env.
+		 *
+		 * Most shaders never call the random shadeops, so the generator's
+		 * private state is only created on first use.
+		 */
+		CqRandom& random();
+		/// Give m_random a private sequence.
+		void seedRandom();
+
 		/** \brief Evaluate discrete difference of a shader variable in the u-direction
 		 *
 		 * This is the discrete analogue to differentiation: for a 1D grid, "Y",
@@ -383,6 +395,40 @@ class AQSIS_SHADERVM_SHARE CqShaderExecEnv : public IqShaderExecEnv, boost::nonc
 								 IqShaderData* result, int cParams,
 								 IqShaderData** apParams, IqShader* pShader);
 
+		/// Ray traced version of shadow(), used for the map name "raytrace".
+		///
+		/// Shadow rays are traced from P towards the light position implied
+		/// by L, and the result is 1 where they're blocked.
+		void traceShadow(IqShaderData* P, IqShaderData* Result,
+						 IqShader* pShader);
+		/// Ray traced ambient occlusion over the hemisphere about N.
+		///
+		/// \param maxDist - only count hits closer than this; no limit if <= 0.
+		void traceOcclusion(IqShaderData* P, IqShaderData* N,
+							IqShaderData* samples, IqShaderData* Result,
+							TqFloat maxDist);
+
+		/// Filter the texture about (s,t) for all running shading points in
+		/// one batch, for texture() calls whose options aren't varying.
+		///
+		/// \param indices - filled with the grid index of each running point.
+		/// \param samples - filled with sampleOpts.numChannels() filtered
+		///                   channels for each entry of indices.
+		void sampleTextureGrid(const IqTextureSampler& texSampler,
+							   const CqTextureSampleOptions& sampleOpts,
+							   IqShaderData* s, IqShaderData* t,
+							   std::vector<TqInt>& indices,
+							   std::vector<TqFloat>& samples);
+
+		/// Fill m_gridLights with the lights of the grid, culling any which
+		/// can't reach the bound of the points Ps.
+		void cullGridLights(IqShaderData* Ps);
+		/// Determine whether light li was culled by cullGridLights().
+		bool lightCulled(TqUint li) const
+		{
+			return li < m_gridLights.size() && !m_gridLights[li];
+		}
+
 		/// Turn 1D iteration into 2D grid indices
 		///
 		/// u is the fast changing index; v is slow changing.
@@ -419,9 +465,10 @@ class AQSIS_SHADERVM_SHARE CqShaderExecEnv : public IqShaderExecEnv, boost::nonc
 			char*	m_strName;
 			EqEnvVars	m_Index;
 		};
-		static	CqNoise	m_noise;		///< One off noise generator, used by all envs.
-		static	CqCellNoise	m_cellnoise;	///< One off cell noise generator, used by all envs.
-		static	CqRandom	m_random;		///< One off random number generator used by all envs.
+		CqNoise	m_noise;			///< Noise generator for this env.
+		CqCellNoise	m_cellnoise;		///< Cell noise generator for this env.
+		CqRandom	m_random;			///< Private random number sequence, so envs can run on separate threads; see random().
+		bool	m_haveRandom;			///< True once m_random has its private sequence.
 		static	CqMatrix	m_matIdentity;
 
 		TqInt	m_uGridRes;				///< The resolution of the grid in u.
@@ -430,7 +477,9 @@ class AQSIS_SHADERVM_SHARE CqShaderExecEnv : public IqShaderExecEnv, boost::nonc
 		TqInt	m_shadingPointCount;			///< The resolution of the grid.
 		TqUint	m_li;					///< Light index, used during illuminance loop.
 		TqInt	m_Illuminate;
+		bool	m_illuminateIsSolar;	///< True if the current illuminate block is from solar().
 		bool	m_IlluminanceCacheValid;	///< Flag indicating whether the illuminance cache is valid.
+		std::vector<const IqLightsource*>	m_gridLights;	///< Lights of the grid, null where culled because they can't reach it.
 		TqUint	m_gatherSample;				///< Sample index, used during gather loop.
 		IqConstAttributesPtr m_pAttributes;	///< Pointer to the associated attributes.
 		IqConstTransformPtr m_pTransform;		///< Pointer to the associated transform.
@@ -657,7 +706,8 @@ class AQSIS_SHADERVM_SHARE CqShaderExecEnv : public IqShaderExecEnv, boost::nonc
 /// Flush any caches of bake3d() data to disk and clear the cache.
 void flushBake3dCache();
 
-/// Clear static caches of point cloud data ready for next frame
+/// Drop point cloud data which wasn't used in this frame from the static
+/// caches, ready for next frame
 ///
 /// TODO: Remove this - it's a bit of a hack!
 void clearPointCloudCache();
@@ -726,6 +776,13 @@ T CqShaderExecEnv::deriv(IqShaderData* y, IqShaderData* x, TqInt gridIdx)
 }
 
 
+inline CqRandom& CqShaderExecEnv::random()
+{
+	if(!m_haveRandom)
+		seedRandom();
+	return m_random;
+}
+
 template<typename T>
 inline T CqShaderExecEnv::derivU(IqShaderData* var, TqInt gridIdx, const T& undefVal)
 {
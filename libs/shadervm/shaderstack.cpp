@@ -25,6 +25,9 @@
 
 #include	<aqsis/aqsis.h>
 #include	"shaderstack.h"
+
+#include	<boost/thread/tss.hpp>
+
 #include	<aqsis/shadervm/ishaderdata.h>
 
 #undef SHADERSTACKSTATS /* define if you want to know at run-time the max. depth of stack */
@@ -33,55 +36,135 @@
 namespace Aqsis {
 
 TqUint   CqShaderStack::m_samples = 18;
-TqUint   CqShaderStack::m_maxsamples = 18;
 
-std::deque<CqShaderVariableUniformFloat*>			CqShaderStack::m_UFPool;
-std::deque<CqShaderVariableUniformPoint*>			CqShaderStack::m_UPPool;
-std::deque<CqShaderVariableUniformString*>			CqShaderStack::m_USPool;
-std::deque<CqShaderVariableUniformColor*>			CqShaderStack::m_UCPool;
-std::deque<CqShaderVariableUniformNormal*>			CqShaderStack::m_UNPool;
-std::deque<CqShaderVariableUniformVector*>			CqShaderStack::m_UVPool;
-std::deque<CqShaderVariableUniformMatrix*>			CqShaderStack::m_UMPool;
+namespace {
+
+/// Delete all the temporaries in a free list.
+template<typename T>
+void clearPool( std::deque<T*>& pool )
+{
+	while( !pool.empty() )
+	{
+		delete pool.front();
+		pool.pop_front();
+	}
+}
+
+/** Free lists of temporaries for one thread.
+ *
+ * Temporaries are only needed while a shader executes, so sharing them
+ * between all the stacks on a thread keeps their number independent of the
+ * number of shader instances.
+ */
+struct SqTempPools
+{
+	std::deque<CqShaderVariableUniformFloat*>	m_UFPool;
+	std::deque<CqShaderVariableUniformPoint*>	m_UPPool;
+	std::deque<CqShaderVariableUniformString*>	m_USPool;
+	std::deque<CqShaderVariableUniformColor*>	m_UCPool;
+	std::deque<CqShaderVariableUniformNormal*>	m_UNPool;
+	std::deque<CqShaderVariableUniformVector*>	m_UVPool;
+	std::deque<CqShaderVariableUniformMatrix*>	m_UMPool;
 
-std::deque<CqShaderVariableVaryingFloat*>			CqShaderStack::m_VFPool;
-std::deque<CqShaderVariableVaryingPoint*>			CqShaderStack::m_VPPool;
-std::deque<CqShaderVariableVaryingString*>			CqShaderStack::m_VSPool;
-std::deque<CqShaderVariableVaryingColor*>			CqShaderStack::m_VCPool;
-std::deque<CqShaderVariableVaryingNormal*>			CqShaderStack::m_VNPool;
-std::deque<CqShaderVariableVaryingVector*>			CqShaderStack::m_VVPool;
-std::deque<CqShaderVariableVaryingMatrix*>			CqShaderStack::m_VMPool;
+	std::deque<CqShaderVariableVaryingFloat*>	m_VFPool;
+	std::deque<CqShaderVariableVaryingPoint*>	m_VPPool;
+	std::deque<CqShaderVariableVaryingString*>	m_VSPool;
+	std::deque<CqShaderVariableVaryingColor*>	m_VCPool;
+	std::deque<CqShaderVariableVaryingNormal*>	m_VNPool;
+	std::deque<CqShaderVariableVaryingVector*>	m_VVPool;
+	std::deque<CqShaderVariableVaryingMatrix*>	m_VMPool;
+
+	~SqTempPools()
+	{
+		clearPool( m_UFPool );
+		clearPool( m_UPPool );
+		clearPool( m_USPool );
+		clearPool( m_UCPool );
+		clearPool( m_UNPool );
+		clearPool( m_UVPool );
+		clearPool( m_UMPool );
+
+		clearPool( m_VFPool );
+		clearPool( m_VPPool );
+		clearPool( m_VSPool );
+		clearPool( m_VCPool );
+		clearPool( m_VNPool );
+		clearPool( m_VVPool );
+		clearPool( m_VMPool );
+	}
+};
+
+/// Temporaries for each thread; freed when the thread exits.
+boost::thread_specific_ptr<SqTempPools> g_tempPools;
+
+SqTempPools& tempPools()
+{
+	SqTempPools* pools = g_tempPools.get();
+	if( !pools )
+	{
+		pools = new SqTempPools();
+		g_tempPools.reset( pools );
+	}
+	return *pools;
+}
+
+} // unnamed namespace
+
+/** Copy constructor.  Nothing on From's stack is copied; the new stack just
+ * starts out as deep as From has needed so far.
+ */
+CqShaderStack::CqShaderStack( const CqShaderStack& From )
+	: m_Stack( From.m_maxsamples ),
+	m_iTop( 0 ),
+	m_maxsamples( From.m_maxsamples )
+{ }
+
+/** Destructor.
+ */
+CqShaderStack::~CqShaderStack()
+{
+	m_Stack.clear();
+	Statistics();
+}
+
+/** Free the temporaries held for the calling thread.
+ */
+void CqShaderStack::ClearTempPools()
+{
+	g_tempPools.reset();
+}
 
 
-//----------------------------------------------------------------------
 /** Returns the next shaderstack variable and allocates more if
  *  it needs to be
  */
 
 IqShaderData* CqShaderStack::GetNextTemp( EqVariableType type, EqVariableClass _class )
 {
+	SqTempPools& pools = tempPools();
 	switch ( type )
 	{
 			case type_float:
 			{
 				if ( _class == class_uniform )
 				{
-					if( m_UFPool.empty() )
+					if( pools.m_UFPool.empty() )
 						return( new CqShaderVariableUniformFloat() );
 					else
 					{
-						IqShaderData* ret = m_UFPool.front();
-						m_UFPool.pop_front();
+						IqShaderData* ret = pools.m_UFPool.front();
+						pools.m_UFPool.pop_front();
 						return( ret );
 					}
 				}
 				else
 				{
-					if( m_VFPool.empty() )
+					if( pools.m_VFPool.empty() )
 						return( new CqShaderVariableVaryingFloat() );
 					else
 					{
-						IqShaderData* ret = m_VFPool.front();
-						m_VFPool.pop_front();
+						IqShaderData* ret = pools.m_VFPool.front();
+						pools.m_VFPool.pop_front();
 						return( ret );
 					}
 				}
@@ -91,23 +174,23 @@ IqShaderData* CqShaderStack::GetNextTemp( EqVariableType type, EqVariableClass _
 			{
 				if ( _class == class_uniform )
 				{
-					if( m_UPPool.empty() )
+					if( pools.m_UPPool.empty() )
 						return( new CqShaderVariableUniformPoint() );
 					else
 					{
-						IqShaderData* ret = m_UPPool.front();
-						m_UPPool.pop_front();
+						IqShaderData* ret = pools.m_UPPool.front();
+						pools.m_UPPool.pop_front();
 						return( ret );
 					}
 				}
 				else
 				{
-					if( m_VPPool.empty() )
+					if( pools.m_VPPool.empty() )
 						return( new CqShaderVariableVaryingPoint() );
 					else
 					{
-						IqShaderData* ret = m_VPPool.front();
-						m_VPPool.pop_front();
+						IqShaderData* ret = pools.m_VPPool.front();
+						pools.m_VPPool.pop_front();
 						return( ret );
 					}
 				}
@@ -117,23 +200,23 @@ IqShaderData* CqShaderStack::GetNextTemp( EqVariableType type, EqVariableClass _
 			{
 				if ( _class == class_uniform )
 				{
-					if( m_USPool.empty() )
+					if( pools.m_USPool.empty() )
 						return( new CqShaderVariableUniformString() );
 					else
 					{
-						IqShaderData* ret = m_USPool.front();
-						m_USPool.pop_front();
+						IqShaderData* ret = pools.m_USPool.front();
+						pools.m_USPool.pop_front();
 						return( ret );
 					}
 				}
 				else
 				{
-					if( m_VSPool.empty() )
+					if( pools.m_VSPool.empty() )
 						return( new CqShaderVariableVaryingString() );
 					else
 					{
-						IqShaderData* ret = m_VSPool.front();
-						m_VSPool.pop_front();
+						IqShaderData* ret = pools.m_VSPool.front();
+						pools.m_VSPool.pop_front();
 						return( ret );
 					}
 				}
@@ -143,23 +226,23 @@ IqShaderData* CqShaderStack::GetNextTemp( EqVariableType type, EqVariableClass _
 			{
 				if ( _class == class_uniform )
 				{
-					if( m_UCPool.empty() )
+					if( pools.m_UCPool.empty() )
 						return( new CqShaderVariableUniformColor() );
 					else
 					{
-						IqShaderData* ret = m_UCPool.front();
-						m_UCPool.pop_front();
+						IqShaderData* ret = pools.m_UCPool.front();
+						pools.m_UCPool.pop_front();
 						return( ret );
 					}
 				}
 				else
 				{
-					if( m_VCPool.empty() )
+					if( pools.m_VCPool.empty() )
 						return( new CqShaderVariableVaryingColor() );
 					else
 					{
-						IqShaderData* ret = m_VCPool.front();
-						m_VCPool.pop_front();
+						IqShaderData* ret = pools.m_VCPool.front();
+						pools.m_VCPool.pop_front();
 						return( ret );
 					}
 				}
@@ -169,23 +252,23 @@ IqShaderData* CqShaderStack::GetNextTemp( EqVariableType type, EqVariableClass _
 			{
 				if ( _class == class_uniform )
 				{
-					if( m_UNPool.empty() )
+					if( pools.m_UNPool.empty() )
 						return( new CqShaderVariableUniformNormal() );
 					else
 					{
-						IqShaderData* ret = m_UNPool.front();
-						m_UNPool.pop_front();
+						IqShaderData* ret = pools.m_UNPool.front();
+						pools.m_UNPool.pop_front();
 						return( ret );
 					}
 				}
 				else
 				{
-					if( m_VNPool.empty() )
+					if( pools.m_VNPool.empty() )
 						return( new CqShaderVariableVaryingNormal() );
 					else
 					{
-						IqShaderData* ret = m_VNPool.front();
-						m_VNPool.pop_front();
+						IqShaderData* ret = pools.m_VNPool.front();
+						pools.m_VNPool.pop_front();
 						return( ret );
 					}
 				}
@@ -195,23 +278,23 @@ IqShaderData* CqShaderStack::GetNextTemp( EqVariableType type, EqVariableClass _
 			{
 				if ( _class == class_uniform )
 				{
-					if( m_UVPool.empty() )
+					if( pools.m_UVPool.empty() )
 						return( new CqShaderVariableUniformVector() );
 					else
 					{
-						IqShaderData* ret = m_UVPool.front();
-						m_UVPool.pop_front();
+						IqShaderData* ret = pools.m_UVPool.front();
+						pools.m_UVPool.pop_front();
 						return( ret );
 					}
 				}
 				else
 				{
-					if( m_VVPool.empty() )
+					if( pools.m_VVPool.empty() )
 						return( new CqShaderVariableVaryingVector() );
 					else
 					{
-						IqShaderData* ret = m_VVPool.front();
-						m_VVPool.pop_front();
+						IqShaderData* ret = pools.m_VVPool.front();
+						pools.m_VVPool.pop_front();
 						return( ret );
 					}
 				}
@@ -221,23 +304,23 @@ IqShaderData* CqShaderStack::GetNextTemp( EqVariableType type, EqVariableClass _
 			{
 				if ( _class == class_uniform )
 				{
-					if( m_UMPool.empty() )
+					if( pools.m_UMPool.empty() )
 						return( new CqShaderVariableUniformMatrix() );
 					else
 					{
-						IqShaderData* ret = m_UMPool.front();
-						m_UMPool.pop_front();
+						IqShaderData* ret = pools.m_UMPool.front();
+						pools.m_UMPool.pop_front();
 						return( ret );
 					}
 				}
 				else
 				{
-					if( m_VMPool.empty() )
+					if( pools.m_VMPool.empty() )
 						return( new CqShaderVariableVaryingMatrix() );
 					else
 					{
-						IqShaderData* ret = m_VMPool.front();
-						m_VMPool.pop_front();
+						IqShaderData* ret = pools.m_VMPool.front();
+						pools.m_VMPool.pop_front();
 						return( ret );
 					}
 				}
@@ -258,68 +341,69 @@ void CqShaderStack::Release( SqStackEntry s )
 {
 	if( s.m_IsTemp )
 	{
+		SqTempPools& pools = tempPools();
 		switch( s.m_Data->Type() )
 		{
 				case type_float:
 				{
 					if ( s.m_Data->Class() == class_uniform )
-						m_UFPool.push_back(reinterpret_cast<CqShaderVariableUniformFloat*>(s.m_Data) );
+						pools.m_UFPool.push_back(reinterpret_cast<CqShaderVariableUniformFloat*>(s.m_Data) );
 					else
-						m_VFPool.push_back(reinterpret_cast<CqShaderVariableVaryingFloat*>(s.m_Data) );
+						pools.m_VFPool.push_back(reinterpret_cast<CqShaderVariableVaryingFloat*>(s.m_Data) );
 					break;
 				}
 
 				case type_point:
 				{
 					if ( s.m_Data->Class() == class_uniform )
-						m_UPPool.push_back(reinterpret_cast<CqShaderVariableUniformPoint*>(s.m_Data) );
+						pools.m_UPPool.push_back(reinterpret_cast<CqShaderVariableUniformPoint*>(s.m_Data) );
 					else
-						m_VPPool.push_back(reinterpret_cast<CqShaderVariableVaryingPoint*>(s.m_Data) );
+						pools.m_VPPool.push_back(reinterpret_cast<CqShaderVariableVaryingPoint*>(s.m_Data) );
 					break;
 				}
 
 				case type_string:
 				{
 					if ( s.m_Data->Class() == class_uniform )
-						m_USPool.push_back(reinterpret_cast<CqShaderVariableUniformString*>(s.m_Data) );
+						pools.m_USPool.push_back(reinterpret_cast<CqShaderVariableUniformString*>(s.m_Data) );
 					else
-						m_VSPool.push_back(reinterpret_cast<CqShaderVariableVaryingString*>(s.m_Data) );
+						pools.m_VSPool.push_back(reinterpret_cast<CqShaderVariableVaryingString*>(s.m_Data) );
 					break;
 				}
 
 				case type_color:
 				{
 					if ( s.m_Data->Class() == class_uniform )
-						m_UCPool.push_back(reinterpret_cast<CqShaderVariableUniformColor*>(s.m_Data) );
+						pools.m_UCPool.push_back(reinterpret_cast<CqShaderVariableUniformColor*>(s.m_Data) );
 					else
-						m_VCPool.push_back(reinterpret_cast<CqShaderVariableVaryingColor*>(s.m_Data) );
+						pools.m_VCPool.push_back(reinterpret_cast<CqShaderVariableVaryingColor*>(s.m_Data) );
 					break;
 				}
 
 				case type_normal:
 				{
 					if ( s.m_Data->Class() == class_uniform )
-						m_UNPool.push_back(reinterpret_cast<CqShaderVariableUniformNormal*>(s.m_Data) );
+						pools.m_UNPool.push_back(reinterpret_cast<CqShaderVariableUniformNormal*>(s.m_Data) );
 					else
-						m_VNPool.push_back(reinterpret_cast<CqShaderVariableVaryingNormal*>(s.m_Data) );
+						pools.m_VNPool.push_back(reinterpret_cast<CqShaderVariableVaryingNormal*>(s.m_Data) );
 					break;
 				}
 
 				case type_vector:
 				{
 					if ( s.m_Data->Class() == class_uniform )
-						m_UVPool.push_back(reinterpret_cast<CqShaderVariableUniformVector*>(s.m_Data) );
+						pools.m_UVPool.push_back(reinterpret_cast<CqShaderVariableUniformVector*>(s.m_Data) );
 					else
-						m_VVPool.push_back(reinterpret_cast<CqShaderVariableVaryingVector*>(s.m_Data) );
+						pools.m_VVPool.push_back(reinterpret_cast<CqShaderVariableVaryingVector*>(s.m_Data) );
 					break;
 				}
 
 				case type_matrix:
 				{
 					if ( s.m_Data->Class() == class_uniform )
-						m_UMPool.push_back(reinterpret_cast<CqShaderVariableUniformMatrix*>(s.m_Data) );
+						pools.m_UMPool.push_back(reinterpret_cast<CqShaderVariableUniformMatrix*>(s.m_Data) );
 					else
-						m_VMPool.push_back(reinterpret_cast<CqShaderVariableVaryingMatrix*>(s.m_Data) );
+						pools.m_VMPool.push_back(reinterpret_cast<CqShaderVariableVaryingMatrix*>(s.m_Data) );
 					break;
 				}
 				
@@ -46,106 +46,104 @@
 
 namespace Aqsis {
 
-#define DECLARE_SHADERSTACK_TEMPS \
-static TqFloat temp_float; \
-static CqVector3D temp_point; \
-static CqColor temp_color; \
-static CqString temp_string; \
-static CqMatrix temp_matrix; 
-
-#define	OpLSS_FF(a,b,Res,State)		OpLSS(temp_float,temp_float,temp_float,a,b,Res,State)
-#define	OpLSS_PP(a,b,Res,State)		OpLSS(temp_point,temp_point,temp_float,a,b,Res,State)
-#define	OpLSS_CC(a,b,Res,State)		OpLSS(temp_color,temp_color,temp_float,a,b,Res,State)
-
-#define	OpGRT_FF(a,b,Res,State)		OpGRT(temp_float,temp_float,temp_float,a,b,Res,State)
-#define	OpGRT_PP(a,b,Res,State)		OpGRT(temp_point,temp_point,temp_float,a,b,Res,State)
-#define	OpGRT_CC(a,b,Res,State)		OpGRT(temp_color,temp_color,temp_float,a,b,Res,State)
-
-#define	OpLE_FF(a,b,Res,State)		OpLE(temp_float,temp_float,temp_float,a,b,Res,State)
-#define	OpLE_PP(a,b,Res,State)		OpLE(temp_point,temp_point,temp_float,a,b,Res,State)
-#define	OpLE_CC(a,b,Res,State)		OpLE(temp_color,temp_color,temp_float,a,b,Res,State)
-
-#define	OpGE_FF(a,b,Res,State)		OpGE(temp_float,temp_float,temp_float,a,b,Res,State)
-#define	OpGE_PP(a,b,Res,State)		OpGE(temp_point,temp_point,temp_float,a,b,Res,State)
-#define	OpGE_CC(a,b,Res,State)		OpGE(temp_color,temp_color,temp_float,a,b,Res,State)
-
-#define	OpEQ_FF(a,b,Res,State)		OpEQ(temp_float,temp_float,temp_float,a,b,Res,State)
-#define	OpEQ_PP(a,b,Res,State)		OpEQ(temp_point,temp_point,temp_float,a,b,Res,State)
-#define	OpEQ_CC(a,b,Res,State)		OpEQ(temp_color,temp_color,temp_float,a,b,Res,State)
-#define	OpEQ_SS(a,b,Res,State)		OpEQ(temp_string,temp_string,temp_float,a,b,Res,State)
-
-#define	OpNE_FF(a,b,Res,State)		OpNE(temp_float,temp_float,temp_float,a,b,Res,State)
-#define	OpNE_PP(a,b,Res,State)		OpNE(temp_point,temp_point,temp_float,a,b,Res,State)
-#define	OpNE_CC(a,b,Res,State)		OpNE(temp_color,temp_color,temp_float,a,b,Res,State)
-#define	OpNE_SS(a,b,Res,State)		OpNE(temp_string,temp_string,temp_float,a,b,Res,State)
-
-#define	OpMUL_FF(a,b,Res,State)		OpMUL(temp_float,temp_float,temp_float,a,b,Res,State)
-#define	OpDIV_FF(a,b,Res,State)		OpDIV(temp_float,temp_float,temp_float,a,b,Res,State)
-#define	OpADD_FF(a,b,Res,State)		OpADD(temp_float,temp_float,temp_float,a,b,Res,State)
-#define	OpSUB_FF(a,b,Res,State)		OpSUB(temp_float,temp_float,temp_float,a,b,Res,State)
-#define	OpNEG_F(a,Res,State)		OpNEG(temp_float,a,Res,State)
-
-#define	OpMUL_PP(a,b,Res,State)		OpMUL(temp_point,temp_point,temp_point,a,b,Res,State)
-#define	OpDIV_PP(a,b,Res,State)		OpDIV(temp_point,temp_point,temp_point,a,b,Res,State)
-#define	OpADD_PP(a,b,Res,State)		OpADD(temp_point,temp_point,temp_point,a,b,Res,State)
-#define	OpSUB_PP(a,b,Res,State)		OpSUB(temp_point,temp_point,temp_point,a,b,Res,State)
-#define	OpCRS_PP(a,b,Res,State)		OpCRS(temp_point,temp_point,temp_point,a,b,Res,State)
-#define	OpDOT_PP(a,b,Res,State)		OpDOT(temp_point,temp_point,temp_float,a,b,Res,State)
-#define	OpNEG_P(a,Res,State)		OpNEG(temp_point,a,Res,State)
-
-#define	OpMUL_CC(a,b,Res,State)		OpMUL(temp_color,temp_color,temp_color,a,b,Res,State)
-#define	OpDIV_CC(a,b,Res,State)		OpDIV(temp_color,temp_color,temp_color,a,b,Res,State)
-#define	OpADD_CC(a,b,Res,State)		OpADD(temp_color,temp_color,temp_color,a,b,Res,State)
-#define	OpSUB_CC(a,b,Res,State)		OpSUB(temp_color,temp_color,temp_color,a,b,Res,State)
-#define	OpCRS_CC(a,b,Res,State)		OpCRS(temp_color,temp_color,temp_color,a,b,Res,State)
-#define	OpDOT_CC(a,b,Res,State)		OpDOT(temp_color,temp_color,temp_color,a,b,Res,State)
-#define	OpNEG_C(a,Res,State)		OpNEG(temp_color,a,Res,State)
-
-#define OpMUL_MM(a,b,Res,State)		OpMUL(temp_matrix,temp_matrix,temp_matrix,a,b,Res,State)
-
-#define	OpMUL_FP(a,b,Res,State)		OpMUL(temp_float,temp_point,temp_point,a,b,Res,State)
-#define	OpDIV_FP(a,b,Res,State)		OpDIV(temp_float,temp_point,temp_point,a,b,Res,State)
-#define	OpADD_FP(a,b,Res,State)		OpADD(temp_float,temp_point,temp_point,a,b,Res,State)
-#define	OpSUB_FP(a,b,Res,State)		OpSUB(temp_float,temp_point,temp_point,a,b,Res,State)
-
-#define	OpMUL_FC(a,b,Res,State)		OpMUL(temp_float,temp_color,temp_color,a,b,Res,State)
-#define	OpDIV_FC(a,b,Res,State)		OpDIV(temp_float,temp_color,temp_color,a,b,Res,State)
-#define	OpADD_FC(a,b,Res,State)		OpADD(temp_float,temp_color,temp_color,a,b,Res,State)
-#define	OpSUB_FC(a,b,Res,State)		OpSUB(temp_float,temp_color,temp_color,a,b,Res,State)
-
-#define	OpLAND_B(a,b,Res,State)		OpLAND(temp_float,temp_float,temp_float,a,b,Res,State)
-#define	OpLOR_B(a,b,Res,State)		OpLOR(temp_float,temp_float,temp_float,a,b,Res,State)
-
-#define	OpCAST_FC(a,Res,State)		OpCAST(temp_float,temp_color, a,Res,State)
-#define	OpCAST_FP(a,Res,State)		OpCAST(temp_float,temp_point, a,Res,State)
-#define	OpCAST_PC(a,Res,State)		OpCAST(temp_point,temp_color, a,Res,State)
-#define	OpCAST_CP(a,Res,State)		OpCAST(temp_color,temp_point, a,Res,State)
-#define	OpCAST_FM(a,Res,State)		OpCAST(temp_float,temp_matrix, a,Res,State)
-
-#define	OpTRIPLE_C(r,a,b,c,State)	OpTRIPLE(temp_color,r,a,b,c,State)
-#define	OpTRIPLE_P(r,a,b,c,State)	OpTRIPLE(temp_point,r,a,b,c,State)
-
-#define	OpHEXTUPLE_M(r,a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p,State)	OpHEXTUPLE(temp_matrix,r,a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p,State)
-
-#define	OpCOMP_C(a,index,Res,State)	OpCOMP(temp_color,a,index,Res,State)
-#define	OpCOMP_P(a,index,Res,State)	OpCOMP(temp_point,a,index,Res,State)
-
-#define	OpSETCOMP_C(r,index,a,State)	OpSETCOMP(temp_color,r,index,a,State)
-#define	OpSETCOMP_P(r,index,a,State)	OpSETCOMP(temp_point,r,index,a,State)
+// The operand and result types of the templated operators below are given
+// explicitly, so the operators need no shared dummy values to deduce them
+// from and can run on several stacks at once.
+
+#define	OpLSS_FF(a,b,Res,State)		OpLSS<TqFloat,TqFloat,TqFloat>(a,b,Res,State)
+#define	OpLSS_PP(a,b,Res,State)		OpLSS<CqVector3D,CqVector3D,TqFloat>(a,b,Res,State)
+#define	OpLSS_CC(a,b,Res,State)		OpLSS<CqColor,CqColor,TqFloat>(a,b,Res,State)
+
+#define	OpGRT_FF(a,b,Res,State)		OpGRT<TqFloat,TqFloat,TqFloat>(a,b,Res,State)
+#define	OpGRT_PP(a,b,Res,State)		OpGRT<CqVector3D,CqVector3D,TqFloat>(a,b,Res,State)
+#define	OpGRT_CC(a,b,Res,State)		OpGRT<CqColor,CqColor,TqFloat>(a,b,Res,State)
+
+#define	OpLE_FF(a,b,Res,State)		OpLE<TqFloat,TqFloat,TqFloat>(a,b,Res,State)
+#define	OpLE_PP(a,b,Res,State)		OpLE<CqVector3D,CqVector3D,TqFloat>(a,b,Res,State)
+#define	OpLE_CC(a,b,Res,State)		OpLE<CqColor,CqColor,TqFloat>(a,b,Res,State)
+
+#define	OpGE_FF(a,b,Res,State)		OpGE<TqFloat,TqFloat,TqFloat>(a,b,Res,State)
+#define	OpGE_PP(a,b,Res,State)		OpGE<CqVector3D,CqVector3D,TqFloat>(a,b,Res,State)
+#define	OpGE_CC(a,b,Res,State)		OpGE<CqColor,CqColor,TqFloat>(a,b,Res,State)
+
+#define	OpEQ_FF(a,b,Res,State)		OpEQ<TqFloat,TqFloat,TqFloat>(a,b,Res,State)
+#define	OpEQ_PP(a,b,Res,State)		OpEQ<CqVector3D,CqVector3D,TqFloat>(a,b,Res,State)
+#define	OpEQ_CC(a,b,Res,State)		OpEQ<CqColor,CqColor,TqFloat>(a,b,Res,State)
+#define	OpEQ_SS(a,b,Res,State)		OpEQ<CqString,CqString,TqFloat>(a,b,Res,State)
+
+#define	OpNE_FF(a,b,Res,State)		OpNE<TqFloat,TqFloat,TqFloat>(a,b,Res,State)
+#define	OpNE_PP(a,b,Res,State)		OpNE<CqVector3D,CqVector3D,TqFloat>(a,b,Res,State)
+#define	OpNE_CC(a,b,Res,State)		OpNE<CqColor,CqColor,TqFloat>(a,b,Res,State)
+#define	OpNE_SS(a,b,Res,State)		OpNE<CqString,CqString,TqFloat>(a,b,Res,State)
+
+#define	OpMUL_FF(a,b,Res,State)		OpMUL<TqFloat,TqFloat,TqFloat>(a,b,Res,State)
+#define	OpDIV_FF(a,b,Res,State)		OpDIV<TqFloat,TqFloat,TqFloat>(a,b,Res,State)
+#define	OpADD_FF(a,b,Res,State)		OpADD<TqFloat,TqFloat,TqFloat>(a,b,Res,State)
+#define	OpSUB_FF(a,b,Res,State)		OpSUB<TqFloat,TqFloat,TqFloat>(a,b,Res,State)
+#define	OpNEG_F(a,Res,State)		OpNEG<TqFloat>(a,Res,State)
+
+#define	OpMUL_PP(a,b,Res,State)		OpMUL<CqVector3D,CqVector3D,CqVector3D>(a,b,Res,State)
+#define	OpDIV_PP(a,b,Res,State)		OpDIV<CqVector3D,CqVector3D,CqVector3D>(a,b,Res,State)
+#define	OpADD_PP(a,b,Res,State)		OpADD<CqVector3D,CqVector3D,CqVector3D>(a,b,Res,State)
+#define	OpSUB_PP(a,b,Res,State)		OpSUB<CqVector3D,CqVector3D,CqVector3D>(a,b,Res,State)
+#define	OpCRS_PP(a,b,Res,State)		OpCRS<CqVector3D,CqVector3D,CqVector3D>(a,b,Res,State)
+#define	OpDOT_PP(a,b,Res,State)		OpDOT<CqVector3D,CqVector3D,TqFloat>(a,b,Res,State)
+#define	OpNEG_P(a,Res,State)		OpNEG<CqVector3D>(a,Res,State)
+
+#define	OpMUL_CC(a,b,Res,State)		OpMUL<CqColor,CqColor,CqColor>(a,b,Res,State)
+#define	OpDIV_CC(a,b,Res,State)		OpDIV<CqColor,CqColor,CqColor>(a,b,Res,State)
+#define	OpADD_CC(a,b,Res,State)		OpADD<CqColor,CqColor,CqColor>(a,b,Res,State)
+#define	OpSUB_CC(a,b,Res,State)		OpSUB<CqColor,CqColor,CqColor>(a,b,Res,State)
+#define	OpCRS_CC(a,b,Res,State)		OpCRS<CqColor,CqColor,CqColor>(a,b,Res,State)
+#define	OpDOT_CC(a,b,Res,State)		OpDOT<CqColor,CqColor,CqColor>(a,b,Res,State)
+#define	OpNEG_C(a,Res,State)		OpNEG<CqColor>(a,Res,State)
+
+#define OpMUL_MM(a,b,Res,State)		OpMUL<CqMatrix,CqMatrix,CqMatrix>(a,b,Res,State)
+
+#define	OpMUL_FP(a,b,Res,State)		OpMUL<TqFloat,CqVector3D,CqVector3D>(a,b,Res,State)
+#define	OpDIV_FP(a,b,Res,State)		OpDIV<TqFloat,CqVector3D,CqVector3D>(a,b,Res,State)
+#define	OpADD_FP(a,b,Res,State)		OpADD<TqFloat,CqVector3D,CqVector3D>(a,b,Res,State)
+#define	OpSUB_FP(a,b,Res,State)		OpSUB<TqFloat,CqVector3D,CqVector3D>(a,b,Res,State)
+
+#define	OpMUL_FC(a,b,Res,State)		OpMUL<TqFloat,CqColor,CqColor>(a,b,Res,State)
+#define	OpDIV_FC(a,b,Res,State)		OpDIV<TqFloat,CqColor,CqColor>(a,b,Res,State)
+#define	OpADD_FC(a,b,Res,State)		OpADD<TqFloat,CqColor,CqColor>(a,b,Res,State)
+#define	OpSUB_FC(a,b,Res,State)		OpSUB<TqFloat,CqColor,CqColor>(a,b,Res,State)
+
+#define	OpLAND_B(a,b,Res,State)		OpLAND<TqFloat,TqFloat,TqFloat>(a,b,Res,State)
+#define	OpLOR_B(a,b,Res,State)		OpLOR<TqFloat,TqFloat,TqFloat>(a,b,Res,State)
+
+#define	OpCAST_FC(a,Res,State)		OpCAST<TqFloat,CqColor>(a,Res,State)
+#define	OpCAST_FP(a,Res,State)		OpCAST<TqFloat,CqVector3D>(a,Res,State)
+#define	OpCAST_PC(a,Res,State)		OpCAST<CqVector3D,CqColor>(a,Res,State)
+#define	OpCAST_CP(a,Res,State)		OpCAST<CqColor,CqVector3D>(a,Res,State)
+#define	OpCAST_FM(a,Res,State)		OpCAST<TqFloat,CqMatrix>(a,Res,State)
+
+#define	OpTRIPLE_C(r,a,b,c,State)	OpTRIPLE<CqColor>(r,a,b,c,State)
+#define	OpTRIPLE_P(r,a,b,c,State)	OpTRIPLE<CqVector3D>(r,a,b,c,State)
+
+#define	OpHEXTUPLE_M(r,a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p,State)	OpHEXTUPLE<CqMatrix>(r,a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p,State)
+
+#define	OpCOMP_C(a,index,Res,State)	OpCOMP<CqColor>(a,index,Res,State)
+#define	OpCOMP_P(a,index,Res,State)	OpCOMP<CqVector3D>(a,index,Res,State)
+
+#define	OpSETCOMP_C(r,index,a,State)	OpSETCOMP<CqColor>(r,index,a,State)
+#define	OpSETCOMP_P(r,index,a,State)	OpSETCOMP<CqVector3D>(r,index,a,State)
 
 //---------------------------------------------------------------------
 //
 // Define macros for defining Opcodes efficiently
-// a The type of the first operand, used to determine templateisation, needed by VC++..
-// b The type of the second operand, used to determine templateisation, needed by VC++..
-// R The type of the result "first OP second", used to determine templateisation, needed by VC++..
-// Comp The stack entry to use as the second operand.
-// Res The stack entry to store the result in.
+// A The type of the first operand.
+// B The type of the second operand.
+// R The type of the result "first OP second".
+// pA The shader data to use as the first operand.
+// pB The shader data to use as the second operand.
+// pRes The shader data to store the result in.
 // RunningState The current SIMD state.
 
 #define OpABRS(OP, NAME) \
 		template <class A, class B, class R>	\
-		inline void	Op##NAME( A& a, B&b, R& r, IqShaderData* pA, IqShaderData* pB, IqShaderData* pRes, const CqBitVector& RunningState ) \
+		inline void	Op##NAME( IqShaderData* pA, IqShaderData* pB, IqShaderData* pRes, const CqBitVector& RunningState ) \
 		{ \
 			A vA; \
 			B vB; \
@@ -226,19 +224,22 @@ struct	SqStackEntry
 class AQSIS_SHADERVM_SHARE CqShaderStack
 {
 	public:
-		CqShaderStack() : m_iTop( 0 )
+		CqShaderStack() : m_iTop( 0 ), m_maxsamples( m_samples )
 		{
-			m_maxsamples = max(m_maxsamples, m_samples);
 			m_Stack.resize( m_maxsamples);
 		}
-		virtual ~CqShaderStack()
-		{
-			m_Stack.clear();
-			Statistics();
-		}
-
+		/** Create an empty stack, preallocated to the depth which From has
+		 * needed so far.
+		 */
+		CqShaderStack( const CqShaderStack& From );
+		virtual ~CqShaderStack();
 
+		/** Get a temporary variable.  Temporaries are pooled per thread, and
+		 * go back to the pool of the calling thread when released.
+		 */
 		IqShaderData* GetNextTemp( EqVariableType type, EqVariableClass _class );
+		/// Free the pooled temporaries of the calling thread.
+		static void ClearTempPools();
 
 		//----------------------------------------------------------------------
 		/** Push a new shader variable reference onto the stack.
@@ -321,7 +322,7 @@ class AQSIS_SHADERVM_SHARE CqShaderStack
 		/**
 		 * Print the max number of depth if compiled for it.
 		 */
-		static void Statistics();
+		void Statistics();
 
 		/** set the more efficient number of samples per type of variable at run-time.
 		 */
@@ -334,34 +335,11 @@ class AQSIS_SHADERVM_SHARE CqShaderStack
 		std::vector<SqStackEntry>	m_Stack;
 		TqUint	m_iTop;										///< Index of the top entry.
 
-		static std::deque<CqShaderVariableUniformFloat*>				m_UFPool;
-		// Integer
-		static std::deque<CqShaderVariableUniformPoint*>				m_UPPool;
-		static std::deque<CqShaderVariableUniformString*>			m_USPool;
-		static std::deque<CqShaderVariableUniformColor*>				m_UCPool;
-		// Triple
-		// hPoint
-		static std::deque<CqShaderVariableUniformNormal*>			m_UNPool;
-		static std::deque<CqShaderVariableUniformVector*>			m_UVPool;
-		// Void
-		static std::deque<CqShaderVariableUniformMatrix*>			m_UMPool;
-		// SixteenTuple
-
-		static std::deque<CqShaderVariableVaryingFloat*>				m_VFPool;
-		// Integer
-		static std::deque<CqShaderVariableVaryingPoint*>				m_VPPool;
-		static std::deque<CqShaderVariableVaryingString*>			m_VSPool;
-		static std::deque<CqShaderVariableVaryingColor*>				m_VCPool;
-		// Triple
-		// hPoint
-		static std::deque<CqShaderVariableVaryingNormal*>			m_VNPool;
-		static std::deque<CqShaderVariableVaryingVector*>			m_VVPool;
-		// Void
-		static std::deque<CqShaderVariableVaryingMatrix*>			m_VMPool;
-		// SixteenTuple
-
 		static TqUint    m_samples; // by default == 18 see shaderstack.cpp
-		static TqUint    m_maxsamples;
+		TqUint    m_maxsamples;		///< Deepest the stack has been.
+
+	private:
+		CqShaderStack& operator=( const CqShaderStack& );
 }
 ;
 
@@ -563,13 +541,12 @@ OpABRS( && , LAND )
 OpABRS( || , LOR )
 
 /* Templatised negation operator. The template classes decide the cast used, there must be an appropriate operator between the two types.
- * \param a The type of the first operand, used to determine templateisation, needed by VC++..
  * \param pA The shader data to use as the second operand.
  * \param pRes The shader data to store the result in.
  * \param RunningState The current SIMD state.
  */
 template <class A>
-inline void	OpNEG( A& a, IqShaderData* pA, IqShaderData* pRes,
+inline void	OpNEG( IqShaderData* pA, IqShaderData* pRes,
 		const CqBitVector& RunningState )
 {
 	A vA;
@@ -619,14 +596,12 @@ template<> inline CqVector3D castShaderVar(const CqColor& c)
 
 /* Templatised cast operator, cast the current stack entry to the spcified type.
  * The template classes decide the cast used, there must be an appropriate operator between the two types.
- * \param a The type of the first operand, used to determine templateisation, needed by VC++..
- * \param b The type of the second operand, used to determine templateisation, needed by VC++..
  * \param pA The shader data to use as the second operand.
  * \param pRes The shader data to store the result in.
  * \param RunningState The current SIMD state.
  */
 template <class A, class B>
-inline void	OpCAST( A& a, B& b, IqShaderData* pA, IqShaderData* pRes,
+inline void	OpCAST( IqShaderData* pA, IqShaderData* pRes,
 		const CqBitVector& RunningState )
 {
 	A vA;
@@ -656,7 +631,6 @@ inline void	OpCAST( A& a, B& b, IqShaderData* pA, IqShaderData* pRes,
 }
 
 /* Templatised cast three operands to a single triple type (vector/normal/color etc.) and store the result in this stack entry
- * \param a The type of the first operand, used to determine templateisation, needed by VC++..
  * \param pA The shader data to use as the first triple element.
  * \param pB The shader data to use as the second triple element.
  * \param pC The shader data to use as the third triple element.
@@ -664,7 +638,7 @@ inline void	OpCAST( A& a, B& b, IqShaderData* pA, IqShaderData* pRes,
  * \param RunningState The current SIMD state.
  */
 template <class A>
-inline void	OpTRIPLE( A&a, IqShaderData* pRes, IqShaderData* pA, IqShaderData* pB,
+inline void	OpTRIPLE( IqShaderData* pRes, IqShaderData* pA, IqShaderData* pB,
 		IqShaderData* pC, const CqBitVector& RunningState )
 {
 	TqFloat x, y, z;
@@ -681,7 +655,6 @@ inline void	OpTRIPLE( A&a, IqShaderData* pRes, IqShaderData* pA, IqShaderData* p
 		}
 }
 /* Templatised cast sixteen operands to a single matrix type and store the result in this stack entry
- * \param z The type of the operand, used to determine templateisation, needed by VC++..
  * \param pRes The shader data to store the result in.
  * \param pA The shader data to use as the 0,0 element.
  * \param pB The shader data to use as the 1,0 element.
@@ -702,7 +675,7 @@ inline void	OpTRIPLE( A&a, IqShaderData* pRes, IqShaderData* pA, IqShaderData* p
  * \param RunningState The current SIMD state.
  */
 template <class A>
-inline void	OpHEXTUPLE( A& z, IqShaderData* pRes,
+inline void	OpHEXTUPLE( IqShaderData* pRes,
                         IqShaderData* pA, IqShaderData* pB, IqShaderData* pC, IqShaderData* pD,
                         IqShaderData* pE, IqShaderData* pF, IqShaderData* pG, IqShaderData* pH,
                         IqShaderData* pI, IqShaderData* pJ, IqShaderData* pK, IqShaderData* pL,
@@ -750,14 +723,13 @@ inline void	OpHEXTUPLE( A& z, IqShaderData* pRes,
 	}
 }
 /* Templatised component access operator.
- * \param z The type of the operand, used to determine templatisation, needed by VC++..
  * \param pA The shader data to extract the component from.
  * \param index The index of the component to extract.
  * \param pRes The shader data to store the result in.
  * \param RunningState The current SIMD state.
  */
 template <class A>
-inline void	OpCOMP( A& z, IqShaderData* pA, int index, IqShaderData* pRes,
+inline void	OpCOMP( IqShaderData* pA, int index, IqShaderData* pRes,
 		const CqBitVector& RunningState )
 {
 	A vA;
@@ -786,14 +758,13 @@ inline void	OpCOMP( A& z, IqShaderData* pA, int index, IqShaderData* pRes,
 	}
 }
 /* Templatised component access operator.
- * \param z The type of the operand, used to determine templatisation, needed by VC++..
  * \param pA The shader data to extract the component from.
  * \param pB The shader data to use to get the index to extract.
  * \param pRes The shader data to store the result in.
  * \param RunningState The current SIMD state.
  */
 template <class A>
-inline void	OpCOMP( A& z, IqShaderData* pA, IqShaderData* pB, IqShaderData* pRes,
+inline void	OpCOMP( IqShaderData* pA, IqShaderData* pB, IqShaderData* pRes,
 		const CqBitVector& RunningState )
 {
 	A vA;
@@ -857,14 +828,13 @@ inline void	OpCOMP( A& z, IqShaderData* pA, IqShaderData* pB, IqShaderData* pRes
 	}
 }
 /* Templatised component set operator.
- * \param z The type of the operand, used to determine templatisation, needed by VC++..
  * \param pRes The shader data to store the result in.
  * \param index The index of the component to set.
  * \param pA The shader data to set the component within.
  * \param RunningState The current SIMD state.
  */
 template <class A>
-inline void	OpSETCOMP( A& z, IqShaderData* pRes, int index, IqShaderData* pA,
+inline void	OpSETCOMP( IqShaderData* pRes, int index, IqShaderData* pA,
 		const CqBitVector& RunningState )
 {
 	A vA;
@@ -884,14 +854,13 @@ inline void	OpSETCOMP( A& z, IqShaderData* pRes, int index, IqShaderData* pA,
 	}
 }
 /* Templatised component set operator.
- * \param z The type of the operand, used to determine templatisation, needed by VC++..
  * \param pRes The shader data to store the result in.
  * \param index The shader data to get the index of the component to set from.
  * \param pA The shader data to set the component within.
  * \param RunningState The current SIMD state.
  */
 template <class A>
-inline void	OpSETCOMP( A& z, IqShaderData* pRes, IqShaderData* index, IqShaderData* pA,
+inline void	OpSETCOMP( IqShaderData* pRes, IqShaderData* index, IqShaderData* pA,
 		const CqBitVector& RunningState )
 {
 	A vA;
@@ -26,13 +26,21 @@
 #include "shadervm.h"
 
 #include <cstring>
+#include <ctime>
 #include <ctype.h>
+#include <iomanip>
 #include <iostream>
+#include <map>
 #include <sstream>
 #include <stddef.h>
 
+#include <boost/cstdint.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+
 #include <aqsis/core/isurface.h>
 #include <aqsis/slcomp/icodegen.h>
+#include <aqsis/util/file.h>
 #include <aqsis/util/logging.h>
 #include "shadervariable.h"
 #include <aqsis/util/sstring.h>
@@ -59,6 +67,173 @@ boost::shared_ptr<IqShader> createShaderVM(IqRenderer* renderContext,
 	return shader;
 }
 
+namespace {
+
+/// A parsed shader program, along with the modification time of its file.
+struct SqCachedProgram
+{
+	std::time_t modTime;
+	boost::shared_ptr<const CqSlxProgram> program;
+};
+
+/** Map from shader file names to parsed programs.
+ *
+ * Shaders are only created from the RI thread, so no locking is needed.
+ */
+typedef std::map<std::string, SqCachedProgram> TqProgramCache;
+
+TqProgramCache& programCache()
+{
+	static TqProgramCache cache;
+	return cache;
+}
+
+/// Read the whole of a file into a string.
+void readFile( const boostfs::path& path, std::string& contents )
+{
+	boostfs::ifstream file( path, std::ios::in | std::ios::binary );
+	if ( !file )
+	{
+		AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader,
+			"Could not open shader file \"" << path.string() << "\"");
+	}
+	std::ostringstream buf;
+	buf << file.rdbuf();
+	contents = buf.str();
+}
+
+/// 64 bit FNV-1a hash of a block of data, for naming cached binary programs.
+std::string contentHash( const std::string& data )
+{
+	boost::uint64_t hash = 14695981039346656037ULL;
+	for ( std::string::const_iterator c = data.begin(); c != data.end(); ++c )
+	{
+		hash ^= static_cast<unsigned char>( *c );
+		hash *= 1099511628211ULL;
+	}
+	std::ostringstream name;
+	name << std::hex << std::setfill( '0' ) << std::setw( 16 ) << hash;
+	return name.str();
+}
+
+/** Parse an ascii program, keeping a binary translation in cacheDir so that
+ * later runs can skip the parsing.
+ */
+void parseAsciiProgram( const std::string& data, const std::string& cacheDir,
+		CqSlxProgram& program )
+{
+	boostfs::path binaryPath;
+	if ( !cacheDir.empty() )
+	{
+		binaryPath = boostfs::path( cacheDir ) / ( contentHash( data ) + ".slxb" );
+		if ( boostfs::exists( binaryPath ) )
+		{
+			try
+			{
+				std::string binaryData;
+				readFile( binaryPath, binaryData );
+				program.readBinary( binaryData.data(), binaryData.size() );
+				return;
+			}
+			catch ( XqBadShader& e )
+			{
+				Aqsis::log() << warning << "Ignoring cached shader \""
+					<< binaryPath.string() << "\": " << e.what() << "\n";
+				program = CqSlxProgram();
+			}
+		}
+	}
+
+	std::istringstream asciiFile( data );
+	CqShaderVM::ParseProgram( &asciiFile, program );
+
+	if ( !binaryPath.empty() )
+	{
+		// Write to a temporary file first, so that concurrent renders never
+		// see a partial program.  The temporary name is unique to this call,
+		// so renders caching the same shader at once don't write over each
+		// other's files.
+		std::ostringstream tmpName;
+		tmpName << binaryPath.string() << ".tmp" << std::hex << std::time(0)
+			<< reinterpret_cast<size_t>( &program );
+		boostfs::path tmpPath( tmpName.str() );
+		bool cached = false;
+		try
+		{
+			bool written = false;
+			{
+				boostfs::ofstream out( tmpPath, std::ios::out | std::ios::binary );
+				program.writeBinary( out );
+				written = out.good();
+			}
+			if ( written )
+			{
+				boostfs::rename( tmpPath, binaryPath );
+				cached = true;
+			}
+		}
+		catch ( boostfs::filesystem_error& /*e*/ )
+		{
+			// Renaming over an existing file fails on some platforms, in
+			// which case another render has already cached the program.
+			cached = boostfs::exists( binaryPath );
+			boostfs::remove( tmpPath );
+		}
+		if ( !cached )
+		{
+			Aqsis::log() << warning << "Could not cache shader program in \""
+				<< cacheDir << "\"\n";
+			boostfs::remove( tmpPath );
+		}
+	}
+}
+
+} // unnamed namespace
+
+boost::shared_ptr<IqShader> createShaderVM(IqRenderer* renderContext,
+                                           const std::string& programPath,
+                                           const std::string& dsoPath,
+                                           const std::string& cacheDir)
+{
+	boostfs::path path( programPath );
+	std::time_t modTime = 0;
+	try
+	{
+		modTime = boostfs::last_write_time( path );
+	}
+	catch ( boostfs::filesystem_error& e )
+	{
+		AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader, e.what());
+	}
+	SqCachedProgram& cached = programCache()[programPath];
+	if ( !cached.program || cached.modTime != modTime )
+	{
+		std::string data;
+		readFile( path, data );
+		boost::shared_ptr<CqSlxProgram> program( new CqSlxProgram() );
+		if ( CqSlxProgram::isBinary( data.data(), data.size() ) )
+			program->readBinary( data.data(), data.size() );
+		else
+			parseAsciiProgram( data, cacheDir, *program );
+		cached.program = program;
+		cached.modTime = modTime;
+	}
+
+	boost::shared_ptr<CqShaderVM> shader(new CqShaderVM(renderContext));
+	if(!dsoPath.empty())
+		shader->SetDSOPath(dsoPath.c_str());
+	shader->LoadProgram(*cached.program);
+	return shader;
+}
+
+void writeBinaryShaderProgram(std::istream& asciiProgram,
+                              std::ostream& binaryProgram)
+{
+	CqSlxProgram program;
+	CqShaderVM::ParseProgram(&asciiProgram, program);
+	program.writeBinary(binaryProgram);
+}
+
 void shutdownShaderVM()
 {
 	CqShaderVM::ShutdownShaderEngine();
@@ -527,7 +702,7 @@ CqShaderVM::CqShaderVM(IqRenderer* pRenderContext)
 }
 
 CqShaderVM::CqShaderVM(const CqShaderVM& From)
-	: CqShaderStack(),
+	: CqShaderStack(From),
 	m_Uses(0),
 	m_strName(),
 	m_Type(Type_Surface),
@@ -913,10 +1088,54 @@ void CqShaderVM::GetToken( char* token, TqInt l, std::istream* pFile )
 
 
 //---------------------------------------------------------------------
-/** Load a program from a compiled slx file.
-*/
+/** Find an opcode in the translation table by name.  Where opcodes are
+ * overloaded, the first entry is used as before.
+ */
+
+TqInt CqShaderVM::FindOpcode( const std::string& name )
+{
+	typedef std::map<std::string, TqInt> TqOpcodeMap;
+	static TqOpcodeMap opcodeMap;
+	if ( opcodeMap.empty() )
+	{
+		for ( TqInt i = 0; i < m_cTransSize; i++ )
+			opcodeMap.insert( std::make_pair( std::string( m_TransTable[ i ].m_strName ), i ) );
+	}
+	TqOpcodeMap::const_iterator pos = opcodeMap.find( name );
+	if ( pos == opcodeMap.end() )
+		return -1;
+	return pos->second;
+}
+
+
+//---------------------------------------------------------------------
+/** Load a program from a compiled slx file, in either the ascii or binary
+ * format.
+ */
 
 void CqShaderVM::LoadProgram( std::istream* pFile )
+{
+	std::ostringstream contents;
+	contents << pFile->rdbuf();
+	const std::string& data = contents.str();
+
+	CqSlxProgram program;
+	if ( CqSlxProgram::isBinary( data.data(), data.size() ) )
+		program.readBinary( data.data(), data.size() );
+	else
+	{
+		std::istringstream asciiFile( data );
+		ParseProgram( &asciiFile, program );
+	}
+	LoadProgram( program );
+}
+
+
+//---------------------------------------------------------------------
+/** Parse a program in the ascii slx format.
+*/
+
+void CqShaderVM::ParseProgram( std::istream* pFile, CqSlxProgram& program )
 {
 	enum EqSegment
 	{
@@ -926,11 +1145,9 @@ void CqShaderVM::LoadProgram( std::istream* pFile )
 	};
 	char token[ 255 ];
 	EqSegment	Segment = Seg_Data;
-	std::vector<UsProgramElement>*	pProgramArea = NULL;
-	std::vector<TqInt>	aLabels;
-	boost::shared_ptr<CqShaderExecEnv> StdEnv(new CqShaderExecEnv(m_pRenderContext));
+	SqSlxSegment*	pSegment = NULL;
 	TqInt	array_count = 0;
-	TqUlong  htoken, i;
+	TqUlong  htoken;
 
 	bool fShaderSpec = false;
 	while ( !pFile->eof() )
@@ -942,40 +1159,15 @@ void CqShaderVM::LoadProgram( std::istream* pFile )
 		// Check for type and version information.
 		if ( !fShaderSpec )
 		{
-			TqInt i;
-			static TqInt tmp = 0;
-			i = tmp;
-			for ( ; i < gcShaderTypeNames; i++ )
+			for ( TqInt i = 0; i < gcShaderTypeNames; i++ )
 			{
-				if (!gShaderTypeNames[i].hash)
+				if ( strcmp( gShaderTypeNames[i].name, token ) == 0 )
 				{
-					gShaderTypeNames[i].hash = CqString::hash(gShaderTypeNames[i].name);
-				}
-				if ( gShaderTypeNames[i].hash == htoken )
-				{
-					m_Type = gShaderTypeNames[i].type;
+					program.type = gShaderTypeNames[i].type;
 					fShaderSpec = true;
-					tmp = i;
 					break;
 				}
 			}
-			if (fShaderSpec == false)
-			{
-				for (i=0 ; i < tmp; i++ )
-				{
-					if (!gShaderTypeNames[i].hash)
-					{
-						gShaderTypeNames[i].hash = CqString::hash(gShaderTypeNames[i].name);
-					}
-					if ( gShaderTypeNames[i].hash == htoken )
-					{
-						m_Type = gShaderTypeNames[i].type;
-						fShaderSpec = true;
-						tmp = i;
-						break;
-					}
-				}
-			}
 			if ( fShaderSpec ) continue;
 		}
 
@@ -997,7 +1189,7 @@ void CqShaderVM::LoadProgram( std::istream* pFile )
 
 		if ( ushash == htoken) // == "USES"
 		{
-			( *pFile ) >> m_Uses;
+			( *pFile ) >> program.uses;
 			continue;
 		}
 
@@ -1011,14 +1203,12 @@ void CqShaderVM::LoadProgram( std::istream* pFile )
 			else if ( ihash == htoken) // == "Init"
 			{
 				Segment = Seg_Init;
-				pProgramArea = &m_ProgramInit;
-				aLabels.clear();
+				pSegment = &program.init;
 			}
 			else if (chash == htoken ) // == "Code"
 			{
 				Segment = Seg_Code;
-				pProgramArea = &m_Program;
-				aLabels.clear();
+				pSegment = &program.code;
 			}
 		}
 		else
@@ -1030,6 +1220,7 @@ void CqShaderVM::LoadProgram( std::istream* pFile )
 			switch ( Segment )
 			{
 				case Seg_Data:
+				{
 					VarType = type_invalid;
 					VarClass = class_invalid;
 					while ( VarType == type_invalid )
@@ -1073,280 +1264,424 @@ void CqShaderVM::LoadProgram( std::istream* pFile )
 					        VarClass == class_invalid )
 						continue;
 
-					if ( fVarArray )
-						AddLocalVariable( CreateVariableArray( VarType, VarClass, token, array_count, varStorage ) );
-					else
-						AddLocalVariable( CreateVariable( VarType, VarClass, token, varStorage ) );
+					SqSlxVariable var;
+					var.type = VarType;
+					var.varClass = VarClass;
+					var.storage = varStorage;
+					var.arrayLength = fVarArray ? array_count : -1;
+					var.name = program.addString( token );
+					program.variables.push_back( var );
 					break;
+				}
 
 				case Seg_Init:
 				case Seg_Code:
+				{
+					SqSlxInstruction instr;
+					instr.firstOperand = pSegment->operands.size();
+					instr.numOperands = 0;
 					// Check if it is a label
 					if ( strcmp( token, ":" ) == 0 )
 					{
 						( *pFile ) >> std::ws;
 						TqFloat f;
 						( *pFile ) >> f;
-						if ( aLabels.size() < ( f + 1 ) )
-							aLabels.resize( static_cast<TqInt>( f ) + 1 );
-						aLabels[ static_cast<TqInt>( f ) ] = pProgramArea->size();
-						AddCommand( &CqShaderVM::SO_nop, pProgramArea );
+						instr.kind = SqSlxInstruction::Label;
+						instr.index = static_cast<TqInt>( f );
+						pSegment->instructions.push_back( instr );
+						break;
+					}
+					if ( ehash == htoken ) // == "external"
+					{
+						std::string strFunc, strRetType, strArgTypes;
+						*pFile >> strFunc >> strRetType >> strArgTypes;
+						SqSlxExternal ext;
+						ext.name = program.addString( strFunc.substr( 1, strFunc.length() - 2 ) );
+						ext.returnType = program.addString( strRetType );
+						ext.argTypes = program.addString( strArgTypes );
+						instr.kind = SqSlxInstruction::External;
+						instr.index = program.externals.size();
+						program.externals.push_back( ext );
+						pSegment->instructions.push_back( instr );
 						break;
 					}
 					// Find the opcode in the translation table.
-					TqInt i;
-					for ( i = 0; i < m_cTransSize; i++ )
+					TqInt iOpcode = FindOpcode( token );
+					if ( iOpcode < 0 )
 					{
-						if ( !m_TransTable[ i ].m_hash )
-						{
-							m_TransTable[ i ].m_hash = CqString::hash(m_TransTable[ i ].m_strName);
-						}
+						// If we have not found the opcode, throw an error.
+						AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader,
+							"Invalid opcode found: " << token);
+					}
+					const SqOpCodeTrans& trans = m_TransTable[ iOpcode ];
+					instr.kind = SqSlxInstruction::Opcode;
+					instr.index = program.addOpcode( token );
+					instr.numOperands = trans.m_cParams;
 
-						if ( ehash == htoken )
+					// Process this opcodes parameters.
+					for ( TqInt p = 0; p < trans.m_cParams; p++ )
+					{
+						SqSlxOperand operand;
+						switch ( trans.m_aParamTypes[ p ] )
 						{
-							CqString strFunc, strRetType, strArgTypes ;
-							EqVariableType RetType;
-							std::list<EqVariableType> ArgTypes;
-
-							*pFile >> strFunc;
-							strFunc = strFunc.substr(1,strFunc.length() - 2);
-							std::list<SqDSOExternalCall*> *candidates = NULL;
-							m_itActiveDSOMap = m_ActiveDSOMap.find( strFunc );
-							if( m_itActiveDSOMap != m_ActiveDSOMap.end() )
-							{
-								candidates = ( *m_itActiveDSOMap ).second;
-							}
-							else
-							{
-								candidates = getShadeOpMethods(&strFunc);
-								if( candidates == NULL )
-								{
-									AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader,
-										"\"" << strName().c_str() << "\": No DSO found for "
-										"external shadeop: \"" << strFunc.c_str() << "\"\n");
-								}
-								m_ActiveDSOMap[strFunc]=candidates;
-							};
-
-							// pick out the return type
-							*pFile >> strRetType;
-							m_itTypeIdMap = m_TypeIdMap.find( strRetType[1] );
-							if (m_itTypeIdMap != m_TypeIdMap.end())
-							{
-								RetType = (*m_itTypeIdMap).second;
-							}
-							else
-							{
-								//error, we dont know this return type
-								AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader, "\""
-									<< strName() << "\": Invalid return type in call to external"
-									" shadeop: \"" << strFunc << "\" : \"" << strRetType << "\"");
-							}
-
-							*pFile >> strArgTypes;
-							for ( TqUint x=1; x < strArgTypes.length()-1; x++ )
-							{
-								m_itTypeIdMap = m_TypeIdMap.find( strArgTypes[x] )
-								                ;
-								if ( m_itTypeIdMap != m_TypeIdMap.end() )
-								{
-									ArgTypes.push_back( ( *m_itTypeIdMap ).second );
-								}
-								else
-								{
-									// Error, unknown arg type
-									AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader,
-										"\"" << strName() << "\": Invalid argument type in call "
-										"to external shadeop: \"" << strFunc << "\" : \""
-										<< strArgTypes[x] << "\"");
-								}
-
-							}
-
-							//Now we need to find a good candidate.
-							std::list<SqDSOExternalCall*>::iterator candidate;
-							candidate = candidates->begin();
-							while (candidate !=candidates->end())
-							{
-								// Do we have a match
-								if ((*candidate)->return_type == RetType &&
-								                        (*candidate)->arg_types == ArgTypes) break;
-								candidate++;
-							}
-
-							// If we are looking for a void return type but have not
-							// found an exact match, we will take the first match with
-							// suitable arguments and force the return value to be
-							// discarded.
-							if(candidate == candidates->end() && RetType == type_void)
-							{
-								candidate = candidates->begin()
-								            ;
-								while (candidate !=candidates->end())
-								{
-									// Do we have a match
-									if ( (*candidate)->arg_types == ArgTypes)
-									{
-										CqString strProto = strPrototype(&strFunc, (*candidate));
-										Aqsis::log() << info << "\"" << strName().c_str() << "\": Using non-void DSO shadeop:  \"" << strProto.c_str() << "\"" <<
-										"\"" << strName().c_str() << "\": In place of requested void shadeop: \"" << strFunc.c_str() << "\"" <<
-										"\"" << strName().c_str() << "\": If this is not the operation you intended you should force the correct shadeop in your shader source." << std::endl;
-										break;
-									}
-									candidate++;
-								}
-							}
-
-							if(candidate == candidates->end())
-							{
-								Aqsis::log() << error << "\"" << strName()
-									<< "\": No candidate found for call to external shadeop: \""
-									<< strFunc << "\"" << strName() << "\": Perhaps you need some casts?"
-									<< "\"" << strName() << "\": The following candidates are in you current DSO path:\n";
-								candidate = candidates->begin();
-								while (candidate !=candidates->end())
-								{
-									CqString strProto = strPrototype(&strFunc, (*candidate));
-									Aqsis::log() << info << "\"" << strName().c_str() << "\": \t" << strProto.c_str() << std::endl;
-									candidate++;
-								}
+							case type_invalid:
+								GetToken( token, 255, pFile );
+								operand.kind = SqSlxOperand::Variable;
+								operand.value = program.addString( token );
+								break;
+							case type_float:
+								( *pFile ) >> std::ws;
+								operand.kind = SqSlxOperand::Float;
+								( *pFile ) >> operand.floatVal;
+								break;
+							case type_integer:
+								( *pFile ) >> std::ws;
+								operand.kind = SqSlxOperand::Integer;
+								( *pFile ) >> operand.value;
+								break;
+							case type_string:
+								operand.kind = SqSlxOperand::String;
+								operand.value = program.addString( GetString( pFile ) );
+								break;
+							default:
 								AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader,
-									"External shadeop not found");
-							}
-
-							if(!(*candidate)->initialised )
-							{
-								// We have an initialiser we have not run yet
-								if((*candidate)->init)
-								{
-									// WARNING: future bug on x86_64 if threading is implemented:
-									//
-									// The first (int) parameter to the initialiser should be a _unique_ thread identifier.
-									// Casting to a smaller type (on x86_64, sizeof(int) < sizeof(void*) ) makes the result
-									// possibly non-unique per thread.
-									(*candidate)->initData =
-									    ((*candidate)->init)(static_cast<int>(reinterpret_cast<ptrdiff_t>(this)),NULL);
-								}
-								(*candidate)->initialised = true;
-							}
-
-							AddCommand( &CqShaderVM::SO_external, pProgramArea );
-							AddDSOExternalCall( (*candidate),pProgramArea );
-
-							break;
+									"Unknown literal type");
 						}
+						pSegment->operands.push_back( operand );
+					}
+					pSegment->instructions.push_back( instr );
+					break;
+				}
+			}
+		}
+		( *pFile ) >> std::ws;
+	}
+}
 
-						if ( m_TransTable[ i ].m_hash == htoken)
-						{
-							// If the opcodes command pointer is 0, just ignore this opcode.
-							if ( m_TransTable[ i ].m_pCommand == 0 )
-								break;
 
-							// If this is an 'illuminate' or 'solar' statement, then we can safely say this
-							// is not an ambient light.
-							if( &CqShaderVM::SO_illuminate == m_TransTable[ i ].m_pCommand ||
-							        &CqShaderVM::SO_illuminate2 == m_TransTable[ i ].m_pCommand ||
-							        &CqShaderVM::SO_solar == m_TransTable[ i ].m_pCommand ||
-							        &CqShaderVM::SO_solar2 == m_TransTable[ i ].m_pCommand )
-								m_fAmbient = false;
-
-							// Add this opcode to the program segment.
-							AddCommand( m_TransTable[ i ].m_pCommand, pProgramArea );
-
-							// Process this opcodes parameters.
-							TqInt p;
-							for ( p = 0; p < m_TransTable[ i ].m_cParams; p++ )
-							{
-								if ( m_TransTable[ i ].m_aParamTypes[ p ] == type_invalid )
-								{
-									GetToken( token, 255, pFile );
-									TqInt iVar;
-									if ( ( iVar = FindLocalVarIndex( token ) ) >= 0 )
-										AddVariable( iVar, pProgramArea );
-									else if ( ( iVar = StdEnv->FindStandardVarIndex( token ) ) >= 0 )
-										AddVariable( iVar | 0x8000, pProgramArea );
-									else
-										// TODO: Report error.
-										AddVariable( 0, pProgramArea );
-								}
-								else
-								{
-									switch ( m_TransTable[ i ].m_aParamTypes[ p ] )
-									{
-										case type_float:
-											{
-												( *pFile ) >> std::ws;
-												TqFloat f;
-												( *pFile ) >> f;
-												AddFloat( f, pProgramArea );
-											}
-											break;
-										case type_integer:
-											{
-												( *pFile ) >> std::ws;
-												TqInt i;
-												( *pFile ) >> i;
-												AddInteger( i, pProgramArea );
-											}
-											break;
-										case type_string:
-											{
-												CqString s = GetString(pFile);
-												AddString( s.c_str(), pProgramArea );
-											}
-											break;
-										default:
-											AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader,
-												"Unknown literal type");
-									}
-								}
-							}
-							break;
-						}
-					}
-					if ( i == m_cTransSize )
+//---------------------------------------------------------------------
+/** Bind a parsed program to this shader, creating its variables and
+ * translating the instructions into bytecodes.
+ */
+
+void CqShaderVM::LoadProgram( const CqSlxProgram& program )
+{
+	m_Type = program.type;
+	m_Uses = program.uses;
+
+	for ( std::vector<SqSlxVariable>::const_iterator var = program.variables.begin();
+	        var != program.variables.end(); ++var )
+	{
+		const char* name = program.strings[ var->name ].c_str();
+		if ( var->arrayLength >= 0 )
+			AddLocalVariable( CreateVariableArray( var->type, var->varClass, name,
+			                                       var->arrayLength, var->storage ) );
+		else
+			AddLocalVariable( CreateVariable( var->type, var->varClass, name, var->storage ) );
+	}
+
+	// Resolve each distinct opcode name once.
+	std::vector<TqInt> opcodes( program.opcodes.size() );
+	for ( TqUint i = 0; i < opcodes.size(); i++ )
+	{
+		const std::string& name = program.strings[ program.opcodes[ i ] ];
+		opcodes[ i ] = FindOpcode( name );
+		if ( opcodes[ i ] < 0 )
+		{
+			AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader,
+				"Invalid opcode found: " << name);
+		}
+	}
+
+	CqShaderExecEnv StdEnv( m_pRenderContext );
+	LoadSegment( program, program.init, opcodes, StdEnv, &m_ProgramInit );
+	LoadSegment( program, program.code, opcodes, StdEnv, &m_Program );
+
+	// Fuse common instruction sequences into superinstructions, unless
+	// disabled with Option "shading" "superinstructions" [0].
+	const TqInt* fuseOpt = m_pRenderContext ?
+		m_pRenderContext->GetIntegerOption( "shading", "superinstructions" ) : 0;
+	if ( !fuseOpt || fuseOpt[ 0 ] != 0 )
+		FuseSuperinstructions( m_Program );
+}
+
+
+//---------------------------------------------------------------------
+/** Translate the instructions of one segment into bytecodes, and complete
+ * the label jump statements.
+ */
+
+void CqShaderVM::LoadSegment( const CqSlxProgram& program, const SqSlxSegment& segment,
+		const std::vector<TqInt>& opcodes, CqShaderExecEnv& stdEnv,
+		std::vector<UsProgramElement>* pProgramArea )
+{
+	std::vector<TqInt>	aLabels;
+	// Positions of the label operands of the jump instructions.
+	std::vector<TqInt>	aJumps;
+	// Variable indices resolved so far, indexed by string pool position.
+	std::vector<TqInt>	varIndices( program.strings.size(), -1 );
+
+	for ( std::vector<SqSlxInstruction>::const_iterator instr = segment.instructions.begin();
+	        instr != segment.instructions.end(); ++instr )
+	{
+		if ( instr->kind == SqSlxInstruction::Label )
+		{
+			if ( static_cast<TqInt>( aLabels.size() ) < instr->index + 1 )
+				aLabels.resize( instr->index + 1, -1 );
+			aLabels[ instr->index ] = pProgramArea->size();
+			AddCommand( &CqShaderVM::SO_nop, pProgramArea );
+			continue;
+		}
+		if ( instr->kind == SqSlxInstruction::External )
+		{
+			const SqSlxExternal& ext = program.externals[ instr->index ];
+			SqDSOExternalCall* pCall = ResolveExternal( program.strings[ ext.name ],
+				program.strings[ ext.returnType ], program.strings[ ext.argTypes ] );
+			AddCommand( &CqShaderVM::SO_external, pProgramArea );
+			AddDSOExternalCall( pCall, pProgramArea );
+			continue;
+		}
+
+		const SqOpCodeTrans& trans = m_TransTable[ opcodes[ instr->index ] ];
+		// If the opcodes command pointer is 0, just ignore this opcode.
+		if ( trans.m_pCommand == 0 )
+			continue;
+		if ( instr->numOperands != trans.m_cParams )
+		{
+			AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader,
+				"Wrong number of parameters for opcode: " << trans.m_strName);
+		}
+
+		// If this is an 'illuminate' or 'solar' statement, then we can safely say this
+		// is not an ambient light.
+		if( &CqShaderVM::SO_illuminate == trans.m_pCommand ||
+		        &CqShaderVM::SO_illuminate2 == trans.m_pCommand ||
+		        &CqShaderVM::SO_solar == trans.m_pCommand ||
+		        &CqShaderVM::SO_solar2 == trans.m_pCommand )
+			m_fAmbient = false;
+
+		// Add this opcode to the program segment.
+		AddCommand( trans.m_pCommand, pProgramArea );
+		if ( trans.m_pCommand == &CqShaderVM::SO_jnz ||
+		        trans.m_pCommand == &CqShaderVM::SO_jmp ||
+		        trans.m_pCommand == &CqShaderVM::SO_jz ||
+		        trans.m_pCommand == &CqShaderVM::SO_RS_JZ ||
+		        trans.m_pCommand == &CqShaderVM::SO_S_JZ )
+			aJumps.push_back( pProgramArea->size() );
+
+		// Process this opcodes parameters.
+		for ( TqInt p = 0; p < trans.m_cParams; p++ )
+		{
+			const SqSlxOperand& operand = segment.operands[ instr->firstOperand + p ];
+			SqSlxOperand::EqKind expectedKind = SqSlxOperand::Variable;
+			switch ( trans.m_aParamTypes[ p ] )
+			{
+				case type_invalid:
+					expectedKind = SqSlxOperand::Variable;
+					break;
+				case type_float:
+					expectedKind = SqSlxOperand::Float;
+					break;
+				case type_integer:
+					expectedKind = SqSlxOperand::Integer;
+					break;
+				case type_string:
+					expectedKind = SqSlxOperand::String;
+					break;
+				default:
+					AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader,
+						"Unknown literal type");
+			}
+			if ( operand.kind != expectedKind )
+			{
+				AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader,
+					"Invalid parameter for opcode: " << trans.m_strName);
+			}
+			switch ( operand.kind )
+			{
+				case SqSlxOperand::Variable:
+				{
+					TqInt& iVar = varIndices[ operand.value ];
+					if ( iVar < 0 )
 					{
-						// If we have not found the opcode, throw an error.
-						AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader,
-							"Invalid opcode found: " << token);
+						const char* name = program.strings[ operand.value ].c_str();
+						if ( ( iVar = FindLocalVarIndex( name ) ) < 0 )
+						{
+							if ( ( iVar = stdEnv.FindStandardVarIndex( name ) ) >= 0 )
+								iVar |= 0x8000;
+							else
+								// TODO: Report error.
+								iVar = 0;
+						}
 					}
+					AddVariable( iVar, pProgramArea );
+					break;
+				}
+				case SqSlxOperand::Float:
+					AddFloat( operand.floatVal, pProgramArea );
+					break;
+				case SqSlxOperand::Integer:
+					AddInteger( operand.value, pProgramArea );
+					break;
+				case SqSlxOperand::String:
+					AddString( program.strings[ operand.value ].c_str(), pProgramArea );
 					break;
 			}
 		}
-		( *pFile ) >> std::ws;
 	}
+
 	// Now we need to complete any label jump statements.
-	i = 0;
-	while ( i < m_Program.size() )
+	for ( std::vector<TqInt>::const_iterator jump = aJumps.begin();
+	        jump != aJumps.end(); ++jump )
 	{
-		UsProgramElement E = m_Program[ i++ ]
-		                     ;
-		if ( E.m_Command == &CqShaderVM::SO_jnz ||
-		        E.m_Command == &CqShaderVM::SO_jmp ||
-		        E.m_Command == &CqShaderVM::SO_jz ||
-		        E.m_Command == &CqShaderVM::SO_RS_JZ ||
-		        E.m_Command == &CqShaderVM::SO_S_JZ)
+		UsProgramElement& E = ( *pProgramArea )[ *jump ];
+		TqInt label = static_cast<TqInt>( E.m_FloatVal );
+		if ( label < 0 || label >= static_cast<TqInt>( aLabels.size() ) || aLabels[ label ] < 0 )
 		{
-			SqLabel lab;
-			lab.m_Offset = aLabels[ static_cast<unsigned int>( m_Program[ i ].m_FloatVal ) ];
-			lab.m_pAddress = &m_Program[ lab.m_Offset ];
-			m_Program[ i ].m_Label = lab;
-			i++;
+			AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader,
+				"Jump to undefined label " << label);
+		}
+		SqLabel lab;
+		lab.m_Offset = aLabels[ label ];
+		lab.m_pAddress = &( *pProgramArea )[ lab.m_Offset ];
+		E.m_Label = lab;
+	}
+}
+
+
+//---------------------------------------------------------------------
+/** Find the DSO shadeop to use for a call to an external function, running
+ * its initialiser if this is the first use.
+ */
+
+SqDSOExternalCall* CqShaderVM::ResolveExternal( const CqString& strFunc,
+		const CqString& strRetType, const CqString& strArgTypes )
+{
+	EqVariableType RetType;
+	std::list<EqVariableType> ArgTypes;
+	// The DSO interfaces take non-const names.
+	CqString strFuncName = strFunc;
+
+	std::list<SqDSOExternalCall*> *candidates = NULL;
+	m_itActiveDSOMap = m_ActiveDSOMap.find( strFunc );
+	if( m_itActiveDSOMap != m_ActiveDSOMap.end() )
+	{
+		candidates = ( *m_itActiveDSOMap ).second;
+	}
+	else
+	{
+		candidates = getShadeOpMethods(&strFuncName);
+		if( candidates == NULL )
+		{
+			AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader,
+				"\"" << strName().c_str() << "\": No DSO found for "
+				"external shadeop: \"" << strFunc.c_str() << "\"\n");
+		}
+		m_ActiveDSOMap[strFunc]=candidates;
+	};
+
+	// pick out the return type
+	if ( strRetType.length() > 1 )
+		m_itTypeIdMap = m_TypeIdMap.find( strRetType[1] );
+	else
+		m_itTypeIdMap = m_TypeIdMap.end();
+	if (m_itTypeIdMap != m_TypeIdMap.end())
+	{
+		RetType = (*m_itTypeIdMap).second;
+	}
+	else
+	{
+		//error, we dont know this return type
+		AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader, "\""
+			<< strName() << "\": Invalid return type in call to external"
+			" shadeop: \"" << strFunc << "\" : \"" << strRetType << "\"");
+	}
+
+	for ( TqUint x=1; x + 1 < strArgTypes.length(); x++ )
+	{
+		m_itTypeIdMap = m_TypeIdMap.find( strArgTypes[x] );
+		if ( m_itTypeIdMap != m_TypeIdMap.end() )
+		{
+			ArgTypes.push_back( ( *m_itTypeIdMap ).second );
 		}
 		else
 		{
-			// Find the command so that we can skip the parameters
-			TqInt j;
-			for ( j = 0; j < m_cTransSize; j++ )
+			// Error, unknown arg type
+			AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader,
+				"\"" << strName() << "\": Invalid argument type in call "
+				"to external shadeop: \"" << strFunc << "\" : \""
+				<< strArgTypes[x] << "\"");
+		}
+
+	}
+
+	//Now we need to find a good candidate.
+	std::list<SqDSOExternalCall*>::iterator candidate;
+	candidate = candidates->begin();
+	while (candidate !=candidates->end())
+	{
+		// Do we have a match
+		if ((*candidate)->return_type == RetType &&
+		                        (*candidate)->arg_types == ArgTypes) break;
+		candidate++;
+	}
+
+	// If we are looking for a void return type but have not
+	// found an exact match, we will take the first match with
+	// suitable arguments and force the return value to be
+	// discarded.
+	if(candidate == candidates->end() && RetType == type_void)
+	{
+		candidate = candidates->begin()
+		            ;
+		while (candidate !=candidates->end())
+		{
+			// Do we have a match
+			if ( (*candidate)->arg_types == ArgTypes)
 			{
-				if ( m_TransTable[ j ].m_pCommand == E.m_Command )
-				{
-					i += m_TransTable[ j ].m_cParams;
-					break;
-				}
+				CqString strProto = strPrototype(&strFuncName, (*candidate));
+				Aqsis::log() << info << "\"" << strName().c_str() << "\": Using non-void DSO shadeop:  \"" << strProto.c_str() << "\"" <<
+				"\"" << strName().c_str() << "\": In place of requested void shadeop: \"" << strFunc.c_str() << "\"" <<
+				"\"" << strName().c_str() << "\": If this is not the operation you intended you should force the correct shadeop in your shader source." << std::endl;
+				break;
 			}
+			candidate++;
 		}
 	}
+
+	if(candidate == candidates->end())
+	{
+		Aqsis::log() << error << "\"" << strName()
+			<< "\": No candidate found for call to external shadeop: \""
+			<< strFunc << "\"" << strName() << "\": Perhaps you need some casts?"
+			<< "\"" << strName() << "\": The following candidates are in you current DSO path:\n";
+		candidate = candidates->begin();
+		while (candidate !=candidates->end())
+		{
+			CqString strProto = strPrototype(&strFuncName, (*candidate));
+			Aqsis::log() << info << "\"" << strName().c_str() << "\": \t" << strProto.c_str() << std::endl;
+			candidate++;
+		}
+		AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader,
+			"External shadeop not found");
+	}
+
+	if(!(*candidate)->initialised )
+	{
+		// We have an initialiser we have not run yet
+		if((*candidate)->init)
+		{
+			// WARNING: future bug on x86_64 if threading is implemented:
+			//
+			// The first (int) parameter to the initialiser should be a _unique_ thread identifier.
+			// Casting to a smaller type (on x86_64, sizeof(int) < sizeof(void*) ) makes the result
+			// possibly non-unique per thread.
+			(*candidate)->initData =
+			    ((*candidate)->init)(static_cast<int>(reinterpret_cast<ptrdiff_t>(this)),NULL);
+		}
+		(*candidate)->initialised = true;
+	}
+	return *candidate;
 }
 
 CqString CqShaderVM::GetString(std::istream* pFile)
@@ -1554,9 +1889,9 @@ void CqShaderVM::Execute(IqShaderExecEnv* pEnv)
 		pE = &ReadNext();
 		( this->*pE->m_Command ) ();
 	}
-	// Check that the stack is empty.
+	// Check that the stack is empty.  The entries are kept allocated for the
+	// next execution.
 	assert( m_iTop == 0 );
-	m_Stack.clear();
 }
 
 
@@ -1588,9 +1923,9 @@ void CqShaderVM::ExecuteInit()
 		pE = &ReadNext();
 		( this->*pE->m_Command ) ();
 	}
-	// Check that the stack is empty.
+	// Check that the stack is empty.  The entries are kept allocated for the
+	// next execution.
 	assert( m_iTop == 0 );
-	m_Stack.clear();
 
 	m_pEnv = pOldEnv;
 }
@@ -1771,19 +2106,19 @@ void CqShaderVM::InitialiseParameters( )
 			count = pArray->ArrayLength();
 		}
 
-		CqString strSpace = m_StoredArguments[i].m_strSpace;
-		CqString _strSpace( "shader" );
-		if ( strSpace.compare( "" ) != 0 )
-			_strSpace = strSpace;
+		const CqString& strSpace = m_StoredArguments[i].m_strSpace;
 		CqMatrix pointTrans;
 		CqMatrix vectorTrans;
 		CqMatrix normalTrans;
 
 		if (getTransform())
 		{
-			m_pRenderContext ->matSpaceToSpace( _strSpace.c_str(), "current", getTransform(), getTransform(), m_pRenderContext->Time(), pointTrans );
-			m_pRenderContext ->matVSpaceToSpace( _strSpace.c_str(), "current", getTransform(), getTransform(), m_pRenderContext->Time(), vectorTrans );
-			m_pRenderContext ->matNSpaceToSpace( _strSpace.c_str(), "current", getTransform(), getTransform(), m_pRenderContext->Time(), normalTrans );
+			TqInt space = Space_Shader;
+			if ( strSpace.compare( "" ) != 0 )
+				space = m_pRenderContext->spaceHandle( strSpace.c_str() );
+			m_pRenderContext ->matSpaceToSpace( space, Space_Camera, getTransform(), getTransform(), m_pRenderContext->Time(), pointTrans );
+			m_pRenderContext ->matVSpaceToSpace( space, Space_Camera, getTransform(), getTransform(), m_pRenderContext->Time(), vectorTrans );
+			m_pRenderContext ->matNSpaceToSpace( space, Space_Camera, getTransform(), getTransform(), m_pRenderContext->Time(), normalTrans );
 		}
 
 		while ( count-- > 0 )
@@ -1931,89 +2266,14 @@ const std::vector<IqShaderData*>& CqShaderVM::GetArguments() const
 //---------------------------------------------------------------------
 /**
  *  Shutdown the engine, releasing any static data it may hold on to during it's lifetime..
+ *
+ *  Temporary variables are pooled per thread; this frees those of the calling
+ *  thread, while other threads free theirs when they exit.
  */
 
 void CqShaderVM::ShutdownShaderEngine()
 {
-	// Free any temporary variables in the buckets.
-	while( !m_UFPool.empty() )
-	{
-		delete(m_UFPool.front());
-		m_UFPool.pop_front();
-	}
-	while( !m_VFPool.empty() )
-	{
-		delete(m_VFPool.front());
-		m_VFPool.pop_front();
-	}
-
-	while( !m_UPPool.empty() )
-	{
-		delete(m_UPPool.front());
-		m_UPPool.pop_front();
-	}
-	while( !m_VPPool.empty() )
-	{
-		delete(m_VPPool.front());
-		m_VPPool.pop_front();
-	}
-
-	while( !m_USPool.empty() )
-	{
-		delete(m_USPool.front());
-		m_USPool.pop_front();
-	}
-	while( !m_VSPool.empty() )
-	{
-		delete(m_VSPool.front());
-		m_VSPool.pop_front();
-	}
-
-	while( !m_UCPool.empty() )
-	{
-		delete(m_UCPool.front());
-		m_UCPool.pop_front();
-	}
-	while( !m_VCPool.empty() )
-	{
-		delete(m_VCPool.front());
-		m_VCPool.pop_front();
-	}
-
-	while( !m_UNPool.empty() )
-	{
-		delete(m_UNPool.front());
-		m_UNPool.pop_front();
-	}
-	while( !m_VNPool.empty() )
-	{
-		delete(m_VNPool.front());
-		m_VNPool.pop_front();
-	}
-
-	while( !m_UVPool.empty() )
-	{
-		delete(m_UVPool.front());
-		m_UVPool.pop_front();
-	}
-	while( !m_VVPool.empty() )
-	{
-		delete(m_VVPool.front());
-		m_VVPool.pop_front();
-	}
-
-	while( !m_UMPool.empty() )
-	{
-		delete(m_UMPool.front());
-		m_UMPool.pop_front();
-	}
-	while( !m_VMPool.empty() )
-	{
-		delete(m_VMPool.front());
-		m_VMPool.pop_front();
-	}
+	ClearTempPools();
 }
-
-
 } // namespace Aqsis
 //---------------------------------------------------------------------
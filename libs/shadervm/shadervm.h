@@ -50,6 +50,7 @@
 #include 	"dsoshadeops.h"
 #include	<aqsis/core/itransform.h>
 #include	"shadervm_common.h"
+#include	"slxprogram.h"
 
 
 namespace Aqsis {
@@ -205,6 +206,13 @@ class AQSIS_SHADERVM_SHARE CqShaderVM : public CqShaderStack, public IqShader, p
 		 */
 		CqShaderVM&	operator=( const CqShaderVM& From );
 
+		/** \brief Parse a shader program in the ascii slx format.
+		 *
+		 * \throw XqBadShader If the program was compiled with a different
+		 *   version of aqsis, or can't be parsed.
+		 */
+		static void ParseProgram( std::istream* pFile, CqSlxProgram& program );
+
 	private:
 		/** \brief Load a compiled shader program from the given stream
 		 *
@@ -212,6 +220,12 @@ class AQSIS_SHADERVM_SHARE CqShaderVM : public CqShaderStack, public IqShader, p
 		 *   version of aqsis, or is invalid in any other way.
 		 */
 		void	LoadProgram( std::istream* pFile );
+		/** \brief Bind a parsed shader program to this shader.
+		 *
+		 * \throw XqBadShader If the program refers to unknown opcodes or
+		 *   external shadeops.
+		 */
+		void	LoadProgram( const CqSlxProgram& program );
 		void	Execute( IqShaderExecEnv* pEnv );
 		void	ExecuteInit();
 
@@ -219,6 +233,24 @@ class AQSIS_SHADERVM_SHARE CqShaderVM : public CqShaderStack, public IqShader, p
 		friend boost::shared_ptr<IqShader> createShaderVM(
 				IqRenderer* renderContext, std::istream& programFile,
 				const std::string& dsoPath);
+		friend boost::shared_ptr<IqShader> createShaderVM(
+				IqRenderer* renderContext, const std::string& programPath,
+				const std::string& dsoPath, const std::string& cacheDir);
+
+		/// Translate the opcodes and operands of one program segment.
+		void	LoadSegment( const CqSlxProgram& program, const SqSlxSegment& segment,
+				const std::vector<TqInt>& opcodes, CqShaderExecEnv& stdEnv,
+				std::vector<UsProgramElement>* pProgramArea );
+		/** \brief Find the DSO shadeop matching a call to an external function.
+		 *
+		 * \param strFunc - function name.
+		 * \param strRetType - quoted return type code, as written in the slx file.
+		 * \param strArgTypes - quoted argument type codes.
+		 */
+		SqDSOExternalCall* ResolveExternal( const CqString& strFunc,
+				const CqString& strRetType, const CqString& strArgTypes );
+		/// Find an opcode in the translation table by name, or return -1.
+		static TqInt FindOpcode( const std::string& name );
 
 		struct SqArgumentRecord
 		{
@@ -331,7 +363,7 @@ class AQSIS_SHADERVM_SHARE CqShaderVM : public CqShaderStack, public IqShader, p
 					return ( m );
 			return ( -1 );
 		}
-		void	GetToken( char* token, TqInt l, std::istream* pFile );
+		static void	GetToken( char* token, TqInt l, std::istream* pFile );
 
 		/** Add a command to the program data area.
 		 * \param pCommand Pointer to the opcode function.
@@ -692,6 +724,59 @@ class AQSIS_SHADERVM_SHARE CqShaderVM : public CqShaderStack, public IqShader, p
 		void	SO_rayinfo();
 		void	SO_bake3d();
 		void	SO_texture3d();
+
+		// Fused superinstructions, see superinstructions.cpp.  SO_fused_*
+		// replace "pushv B; pushv A; op; pop R", SO_fusedts_* replace
+		// "pushv B; pushv A; op" and SO_fusedfs_* replace "pushv A; op; pop R".
+		void	SO_fused_addff();
+		void	SO_fused_subff();
+		void	SO_fused_mulff();
+		void	SO_fused_divff();
+		void	SO_fused_addpp();
+		void	SO_fused_subpp();
+		void	SO_fused_addcc();
+		void	SO_fused_subcc();
+		void	SO_fused_mulcc();
+		void	SO_fused_divcc();
+		void	SO_fusedts_addff();
+		void	SO_fusedts_subff();
+		void	SO_fusedts_mulff();
+		void	SO_fusedts_divff();
+		void	SO_fusedts_addpp();
+		void	SO_fusedts_subpp();
+		void	SO_fusedts_addcc();
+		void	SO_fusedts_subcc();
+		void	SO_fusedts_mulcc();
+		void	SO_fusedts_divcc();
+		void	SO_fusedfs_addff();
+		void	SO_fusedfs_subff();
+		void	SO_fusedfs_mulff();
+		void	SO_fusedfs_divff();
+		void	SO_fusedfs_addpp();
+		void	SO_fusedfs_subpp();
+		void	SO_fusedfs_addcc();
+		void	SO_fusedfs_subcc();
+		void	SO_fusedfs_mulcc();
+		void	SO_fusedfs_divcc();
+		/** \brief Compute "pushv B; pushv A; op; pop R" as R = A op B in one go.
+		 *
+		 * Falls back to executing the original instructions if the
+		 * variables aren't of the expected types and sizes.
+		 */
+		template<typename T, typename OpT>
+		void	FusedBinaryOp( const OpT& op );
+		/// Compute "pushv B; pushv A; op", leaving A op B on the stack.
+		template<typename T, typename OpT>
+		void	FusedBinaryOpToStack( const OpT& op );
+		/// Compute "pushv A; op; pop R", with B on top of the stack.
+		template<typename T, typename OpT>
+		void	FusedBinaryOpFromStack( const OpT& op );
+		/** \brief Replace common instruction sequences with superinstructions.
+		 *
+		 * \param program - program to modify in place.  The program length
+		 *                  and label offsets are unchanged.
+		 */
+		void	FuseSuperinstructions( std::vector<UsProgramElement>& program );
       
 		static	SqOpCodeTrans	m_TransTable[];		///< Static opcode translation table.
 		static	TqInt	m_cTransSize;		///< Size of translation table.
@@ -32,8 +32,6 @@
 
 namespace Aqsis {
 
-DECLARE_SHADERSTACK_TEMPS
-
 void CqShaderVM::SO_nop()
 {}
 
@@ -0,0 +1,278 @@
+// Aqsis
+// Copyright (C) 1997 - 2001, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+/** \file
+ *
+ * \brief Unit tests for the binary slx format and the shader program caches.
+ */
+
+#include "slxprogram.h"
+
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <aqsis/shadervm/ishader.h>
+#include <aqsis/slcomp/icodegen.h>
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/auto_unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(shadervm_tests)
+
+using namespace Aqsis;
+namespace boostfs = boost::filesystem;
+
+namespace {
+
+// Directory in the current directory which is removed with its contents on
+// destruction.
+class TempDir
+{
+	public:
+		TempDir()
+		{
+			for(int i = 0;; ++i)
+			{
+				std::ostringstream name;
+				name << "aqsis_shadervm_tmpdir_" << i;
+				m_path = name.str();
+				if(!boostfs::exists(m_path))
+					break;
+			}
+			boostfs::create_directory(m_path);
+		}
+		~TempDir()
+		{
+			boostfs::remove_all(m_path);
+		}
+		std::string file(const std::string& name) const
+		{
+			return (m_path / name).string();
+		}
+		const boostfs::path& path() const
+		{
+			return m_path;
+		}
+	private:
+		boostfs::path m_path;
+};
+
+// An ascii surface shader program with a single float parameter.
+std::string asciiProgram(const std::string& paramName)
+{
+	std::ostringstream prog;
+	prog << "surface\n"
+		<< "AQSIS_V " << AQSIS_XSTR(AQSIS_SLX_VERSION) << "\n"
+		<< "\n\nsegment Data\n\nUSES 0\n\n"
+		<< "param uniform  float " << paramName << "\n"
+		<< "varying  float tmp\n"
+		<< "\n\nsegment Init\n"
+		<< "\tpushif 0.5\n\tpop " << paramName << "\n"
+		<< "\n\nsegment Code\n"
+		<< "\tpushv " << paramName << "\n\tpushif 2\n\tmulff\n\tpop tmp\n"
+		<< ":0\n\tpushis \"a string\"\n\tdrop\n";
+	return prog.str();
+}
+
+std::string binaryProgram(const std::string& paramName)
+{
+	std::istringstream in(asciiProgram(paramName));
+	std::ostringstream out;
+	writeBinaryShaderProgram(in, out);
+	return out.str();
+}
+
+void writeFile(const std::string& fileName, const std::string& contents)
+{
+	std::ofstream file(fileName.c_str(),
+			std::ios::out | std::ios::binary | std::ios::trunc);
+	file << contents;
+}
+
+std::string readFile(const std::string& fileName)
+{
+	std::ifstream file(fileName.c_str(), std::ios::in | std::ios::binary);
+	return std::string(std::istreambuf_iterator<char>(file),
+			std::istreambuf_iterator<char>());
+}
+
+// Names of the files in a directory.
+std::vector<std::string> listDir(const boostfs::path& dir)
+{
+	std::vector<std::string> names;
+	for(boostfs::directory_iterator i(dir), end; i != end; ++i)
+		names.push_back(i->path().string());
+	return names;
+}
+
+// Check that a shader was loaded from asciiProgram(paramName).
+void checkShader(const boost::shared_ptr<IqShader>& shader,
+		const std::string& paramName)
+{
+	BOOST_REQUIRE(shader);
+	BOOST_CHECK_EQUAL(shader->Type(), Type_Surface);
+	// The arguments are all the shader's local variables.
+	const std::vector<IqShaderData*>& args = shader->GetArguments();
+	BOOST_REQUIRE_EQUAL(args.size(), 2U);
+	BOOST_CHECK_EQUAL(std::string(args[0]->strName()), paramName);
+	BOOST_CHECK_EQUAL(args[0]->Type(), type_float);
+	BOOST_CHECK_EQUAL(args[0]->Class(), class_uniform);
+	BOOST_CHECK_EQUAL(std::string(args[1]->strName()), "tmp");
+	BOOST_CHECK(shader->FindArgument(paramName));
+}
+
+} // unnamed namespace
+
+BOOST_AUTO_TEST_CASE(slxprogram_binary_roundtrip_test)
+{
+	std::string data = binaryProgram("Kd");
+	BOOST_REQUIRE(CqSlxProgram::isBinary(data.data(), data.size()));
+	std::string ascii = asciiProgram("Kd");
+	BOOST_CHECK(!CqSlxProgram::isBinary(ascii.data(), ascii.size()));
+
+	CqSlxProgram program;
+	program.readBinary(data.data(), data.size());
+	BOOST_CHECK_EQUAL(program.type, Type_Surface);
+	BOOST_CHECK_EQUAL(program.uses, 0);
+
+	BOOST_REQUIRE_EQUAL(program.variables.size(), 2U);
+	BOOST_CHECK_EQUAL(program.strings[program.variables[0].name], "Kd");
+	BOOST_CHECK_EQUAL(program.variables[0].storage, IqShaderData::Parameter);
+	BOOST_CHECK_EQUAL(program.variables[0].varClass, class_uniform);
+	BOOST_CHECK_EQUAL(program.strings[program.variables[1].name], "tmp");
+	BOOST_CHECK_EQUAL(program.variables[1].storage, IqShaderData::Temporary);
+	BOOST_CHECK_EQUAL(program.variables[1].arrayLength, -1);
+
+	BOOST_REQUIRE_EQUAL(program.init.instructions.size(), 2U);
+	const SqSlxInstruction& push = program.init.instructions[0];
+	BOOST_CHECK_EQUAL(push.kind, SqSlxInstruction::Opcode);
+	BOOST_CHECK_EQUAL(program.strings[program.opcodes[push.index]], "pushif");
+	BOOST_REQUIRE_EQUAL(push.numOperands, 1);
+	const SqSlxOperand& pushArg = program.init.operands[push.firstOperand];
+	BOOST_CHECK_EQUAL(pushArg.kind, SqSlxOperand::Float);
+	BOOST_CHECK_EQUAL(pushArg.floatVal, 0.5f);
+
+	// pushv, pushif, mulff, pop, label, pushis, drop
+	BOOST_REQUIRE_EQUAL(program.code.instructions.size(), 7U);
+	BOOST_CHECK_EQUAL(program.code.instructions[4].kind, SqSlxInstruction::Label);
+	BOOST_CHECK_EQUAL(program.code.instructions[4].index, 0);
+	const SqSlxInstruction& pushStr = program.code.instructions[5];
+	BOOST_REQUIRE_EQUAL(pushStr.numOperands, 1);
+	const SqSlxOperand& strArg = program.code.operands[pushStr.firstOperand];
+	BOOST_CHECK_EQUAL(strArg.kind, SqSlxOperand::String);
+	BOOST_CHECK_EQUAL(program.strings[strArg.value], "a string");
+
+	// Writing the program again gives identical data.
+	std::ostringstream out;
+	program.writeBinary(out);
+	BOOST_CHECK(out.str() == data);
+}
+
+BOOST_AUTO_TEST_CASE(slxprogram_binary_truncated_test)
+{
+	std::string data = binaryProgram("Kd");
+	size_t sizes[] = { data.size() - 1, data.size() / 2, 12, 4, 0 };
+	for(int i = 0; i < 5; ++i)
+	{
+		CqSlxProgram program;
+		BOOST_CHECK_THROW(program.readBinary(data.data(), sizes[i]), XqBadShader);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(createShaderVM_ascii_binary_test)
+{
+	TempDir dir;
+	writeFile(dir.file("ascii.slx"), asciiProgram("Kd"));
+	writeFile(dir.file("binary.slx"), binaryProgram("Kd"));
+	checkShader(createShaderVM(0, dir.file("ascii.slx"), ""), "Kd");
+	checkShader(createShaderVM(0, dir.file("binary.slx"), ""), "Kd");
+
+	std::string data = binaryProgram("Kd");
+	writeFile(dir.file("truncated.slx"), data.substr(0, data.size() - 1));
+	BOOST_CHECK_THROW(createShaderVM(0, dir.file("truncated.slx"), ""),
+			XqBadShader);
+	BOOST_CHECK_THROW(createShaderVM(0, dir.file("missing.slx"), ""),
+			XqBadShader);
+}
+
+BOOST_AUTO_TEST_CASE(createShaderVM_program_cache_test)
+{
+	TempDir dir;
+	std::string fileName = dir.file("cached.slx");
+	writeFile(fileName, asciiProgram("Kd"));
+	std::time_t modTime = boostfs::last_write_time(fileName);
+	checkShader(createShaderVM(0, fileName, ""), "Kd");
+
+	// While the modification time is unchanged the file isn't read again,
+	// even if it's been replaced by something unloadable.
+	writeFile(fileName, "surface\nAQSIS_V 0\n");
+	boostfs::last_write_time(fileName, modTime);
+	checkShader(createShaderVM(0, fileName, ""), "Kd");
+
+	// Once it changes the file is parsed again.
+	boostfs::last_write_time(fileName, modTime + 10);
+	BOOST_CHECK_THROW(createShaderVM(0, fileName, ""), XqBadShader);
+	writeFile(fileName, asciiProgram("Ks"));
+	boostfs::last_write_time(fileName, modTime + 20);
+	checkShader(createShaderVM(0, fileName, ""), "Ks");
+}
+
+BOOST_AUTO_TEST_CASE(createShaderVM_binary_cache_test)
+{
+	TempDir dir;
+	TempDir cacheDir;
+	std::string fileName = dir.file("shader.slx");
+	writeFile(fileName, asciiProgram("Kd"));
+	checkShader(createShaderVM(0, fileName, "", cacheDir.path().string()), "Kd");
+
+	// A binary translation is left in the cache, and nothing else.
+	std::vector<std::string> cached = listDir(cacheDir.path());
+	BOOST_REQUIRE_EQUAL(cached.size(), 1U);
+	std::string cacheFile = cached[0];
+	BOOST_CHECK_EQUAL(cacheFile.substr(cacheFile.size() - 5), ".slxb");
+	BOOST_CHECK(readFile(cacheFile) == binaryProgram("Kd"));
+
+	// The translation is used in place of parsing when the same program is
+	// seen again.  Substitute a different program to show it's being read.
+	std::time_t modTime = boostfs::last_write_time(fileName);
+	writeFile(cacheFile, binaryProgram("Ks"));
+	boostfs::last_write_time(fileName, modTime + 10);
+	checkShader(createShaderVM(0, fileName, "", cacheDir.path().string()), "Ks");
+
+	// A stale or corrupt translation is ignored, and replaced.
+	std::string data = binaryProgram("Kd");
+	writeFile(cacheFile, data.substr(0, data.size() / 2));
+	boostfs::last_write_time(fileName, modTime + 20);
+	checkShader(createShaderVM(0, fileName, "", cacheDir.path().string()), "Kd");
+	BOOST_CHECK(readFile(cacheFile) == binaryProgram("Kd"));
+	BOOST_CHECK_EQUAL(listDir(cacheDir.path()).size(), 1U);
+
+	// A changed program gets a translation of its own.
+	writeFile(fileName, asciiProgram("Ka"));
+	boostfs::last_write_time(fileName, modTime + 30);
+	checkShader(createShaderVM(0, fileName, "", cacheDir.path().string()), "Ka");
+	BOOST_CHECK_EQUAL(listDir(cacheDir.path()).size(), 2U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,375 @@
+// Aqsis
+// Copyright (C) 1997 - 2001, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+/** \file
+		\brief Implements the binary file format for compiled shader programs.
+*/
+
+#include	"slxprogram.h"
+
+#include	<cstring>
+#include	<ostream>
+
+#include	<aqsis/slcomp/icodegen.h>
+
+namespace Aqsis {
+
+//------------------------------------------------------------------------------
+// Binary format
+//
+// All integers are 32 bit little endian, and floats are stored as the bits of
+// an IEEE single.  Strings are a length followed by the characters.  The
+// file consists of:
+//
+//   magic, binary layout version, AQSIS_SLX_VERSION
+//   shader type, uses
+//   string pool:  count, strings
+//   variables:    count, (type, class, storage, array length, name)...
+//   opcodes:      count, names...
+//   externals:    count, (name, return type, argument types)...
+//   init segment, code segment:
+//      instruction count, (kind, index, operand count)...
+//      operand count, (kind, value)...
+
+namespace {
+
+const char slxMagic[8] = { '\x89', 'S', 'L', 'X', '\r', '\n', '\x1a', '\n' };
+/// Version of the binary layout, independent of the VM instruction set.
+const TqUint32 slxBinaryVersion = 1;
+
+void writeUint( std::ostream& out, TqUint32 value )
+{
+	char buf[4];
+	buf[0] = static_cast<char>( value & 0xff );
+	buf[1] = static_cast<char>( ( value >> 8 ) & 0xff );
+	buf[2] = static_cast<char>( ( value >> 16 ) & 0xff );
+	buf[3] = static_cast<char>( ( value >> 24 ) & 0xff );
+	out.write( buf, 4 );
+}
+
+void writeInt( std::ostream& out, TqInt value )
+{
+	writeUint( out, static_cast<TqUint32>( value ) );
+}
+
+void writeFloat( std::ostream& out, TqFloat value )
+{
+	TqUint32 bits;
+	std::memcpy( &bits, &value, 4 );
+	writeUint( out, bits );
+}
+
+void writeString( std::ostream& out, const std::string& str )
+{
+	writeUint( out, str.size() );
+	out.write( str.data(), str.size() );
+}
+
+void writeSegment( std::ostream& out, const SqSlxSegment& segment )
+{
+	writeUint( out, segment.instructions.size() );
+	for ( std::vector<SqSlxInstruction>::const_iterator i = segment.instructions.begin();
+	        i != segment.instructions.end(); ++i )
+	{
+		writeInt( out, i->kind );
+		writeInt( out, i->index );
+		writeInt( out, i->numOperands );
+	}
+	writeUint( out, segment.operands.size() );
+	for ( std::vector<SqSlxOperand>::const_iterator i = segment.operands.begin();
+	        i != segment.operands.end(); ++i )
+	{
+		writeInt( out, i->kind );
+		if ( i->kind == SqSlxOperand::Float )
+			writeFloat( out, i->floatVal );
+		else
+			writeInt( out, i->value );
+	}
+}
+
+/// Sequential reader for a block of binary program data.
+class CqSlxReader
+{
+	public:
+		CqSlxReader( const char* data, TqInt size )
+			: m_pos( reinterpret_cast<const unsigned char*>( data ) ),
+			m_end( m_pos + size )
+		{ }
+
+		TqUint32 readUint()
+		{
+			require( 4 );
+			TqUint32 value = m_pos[0] | ( m_pos[1] << 8 ) | ( m_pos[2] << 16 )
+				| ( static_cast<TqUint32>( m_pos[3] ) << 24 );
+			m_pos += 4;
+			return value;
+		}
+		TqInt readInt()
+		{
+			return static_cast<TqInt>( readUint() );
+		}
+		TqFloat readFloat()
+		{
+			TqUint32 bits = readUint();
+			TqFloat value;
+			std::memcpy( &value, &bits, 4 );
+			return value;
+		}
+		/// Read a count of items which each take at least itemSize bytes.
+		TqInt readCount( TqInt itemSize )
+		{
+			TqUint32 count = readUint();
+			if ( count > static_cast<TqUint32>( m_end - m_pos ) / itemSize )
+				fail();
+			return count;
+		}
+		std::string readString()
+		{
+			TqInt len = readCount( 1 );
+			std::string str( reinterpret_cast<const char*>( m_pos ), len );
+			m_pos += len;
+			return str;
+		}
+		/// Read a string pool index, checking it against the pool size.
+		TqInt readIndex( TqInt poolSize )
+		{
+			TqInt index = readInt();
+			if ( index < 0 || index >= poolSize )
+				fail();
+			return index;
+		}
+		void readSegment( SqSlxSegment& segment, TqInt poolSize )
+		{
+			TqInt numInstructions = readCount( 12 );
+			segment.instructions.resize( numInstructions );
+			TqInt totalOperands = 0;
+			for ( TqInt i = 0; i < numInstructions; ++i )
+			{
+				SqSlxInstruction& instr = segment.instructions[i];
+				instr.kind = static_cast<SqSlxInstruction::EqKind>( readInt() );
+				instr.index = readInt();
+				instr.numOperands = readInt();
+				if ( instr.numOperands < 0 )
+					fail();
+				instr.firstOperand = totalOperands;
+				totalOperands += instr.numOperands;
+			}
+			TqInt numOperands = readCount( 8 );
+			if ( numOperands != totalOperands )
+				fail();
+			segment.operands.resize( numOperands );
+			for ( TqInt i = 0; i < numOperands; ++i )
+			{
+				SqSlxOperand& op = segment.operands[i];
+				op.kind = static_cast<SqSlxOperand::EqKind>( readInt() );
+				switch ( op.kind )
+				{
+					case SqSlxOperand::Float:
+						op.floatVal = readFloat();
+						break;
+					case SqSlxOperand::Integer:
+						op.value = readInt();
+						break;
+					case SqSlxOperand::String:
+					case SqSlxOperand::Variable:
+						op.value = readIndex( poolSize );
+						break;
+					default:
+						fail();
+				}
+			}
+		}
+		void require( TqInt n )
+		{
+			if ( m_end - m_pos < n )
+				fail();
+		}
+		void fail()
+		{
+			AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader,
+				"Truncated or corrupt binary shader program");
+		}
+
+	private:
+		const unsigned char* m_pos;
+		const unsigned char* m_end;
+};
+
+} // unnamed namespace
+
+
+//------------------------------------------------------------------------------
+// CqSlxProgram implementation
+
+CqSlxProgram::CqSlxProgram()
+	: type( Type_Surface ),
+	uses( 0xFFFFFFFF ),
+	strings(),
+	variables(),
+	opcodes(),
+	externals(),
+	init(),
+	code(),
+	m_stringIndices(),
+	m_opcodeIndices()
+{ }
+
+TqInt CqSlxProgram::addString( const std::string& str )
+{
+	std::map<std::string, TqInt>::const_iterator pos = m_stringIndices.find( str );
+	if ( pos != m_stringIndices.end() )
+		return pos->second;
+	TqInt index = strings.size();
+	strings.push_back( str );
+	m_stringIndices[str] = index;
+	return index;
+}
+
+TqInt CqSlxProgram::addOpcode( const std::string& name )
+{
+	TqInt nameIndex = addString( name );
+	std::map<TqInt, TqInt>::const_iterator pos = m_opcodeIndices.find( nameIndex );
+	if ( pos != m_opcodeIndices.end() )
+		return pos->second;
+	TqInt index = opcodes.size();
+	opcodes.push_back( nameIndex );
+	m_opcodeIndices[nameIndex] = index;
+	return index;
+}
+
+bool CqSlxProgram::isBinary( const char* data, TqInt size )
+{
+	return size >= static_cast<TqInt>( sizeof( slxMagic ) )
+		&& std::memcmp( data, slxMagic, sizeof( slxMagic ) ) == 0;
+}
+
+void CqSlxProgram::readBinary( const char* data, TqInt size )
+{
+	if ( !isBinary( data, size ) )
+	{
+		AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader,
+			"Not a binary shader program");
+	}
+	CqSlxReader in( data + sizeof( slxMagic ), size - sizeof( slxMagic ) );
+	TqUint32 binaryVersion = in.readUint();
+	TqUint32 slxVersion = in.readUint();
+	if ( binaryVersion != slxBinaryVersion || slxVersion != AQSIS_SLX_VERSION )
+	{
+		AQSIS_THROW_XQERROR(XqBadShader, EqE_NoShader,
+			"Incompatible binary shader version " << slxVersion << "."
+			<< binaryVersion << " found (expected version " << AQSIS_SLX_VERSION
+			<< "." << slxBinaryVersion << ").  Please recompile.");
+	}
+	type = static_cast<EqShaderType>( in.readInt() );
+	uses = in.readInt();
+
+	TqInt numStrings = in.readCount( 4 );
+	strings.resize( numStrings );
+	for ( TqInt i = 0; i < numStrings; ++i )
+		strings[i] = in.readString();
+
+	TqInt numVariables = in.readCount( 20 );
+	variables.resize( numVariables );
+	for ( TqInt i = 0; i < numVariables; ++i )
+	{
+		SqSlxVariable& var = variables[i];
+		var.type = static_cast<EqVariableType>( in.readInt() );
+		var.varClass = static_cast<EqVariableClass>( in.readInt() );
+		var.storage = static_cast<IqShaderData::EqStorage>( in.readInt() );
+		var.arrayLength = in.readInt();
+		var.name = in.readIndex( numStrings );
+	}
+
+	TqInt numOpcodes = in.readCount( 4 );
+	opcodes.resize( numOpcodes );
+	for ( TqInt i = 0; i < numOpcodes; ++i )
+		opcodes[i] = in.readIndex( numStrings );
+
+	TqInt numExternals = in.readCount( 12 );
+	externals.resize( numExternals );
+	for ( TqInt i = 0; i < numExternals; ++i )
+	{
+		externals[i].name = in.readIndex( numStrings );
+		externals[i].returnType = in.readIndex( numStrings );
+		externals[i].argTypes = in.readIndex( numStrings );
+	}
+
+	in.readSegment( init, numStrings );
+	in.readSegment( code, numStrings );
+
+	// Check the instruction table references; operands were checked as they
+	// were read.
+	const SqSlxSegment* segments[] = { &init, &code };
+	for ( TqInt s = 0; s < 2; ++s )
+	{
+		const std::vector<SqSlxInstruction>& instrs = segments[s]->instructions;
+		for ( std::vector<SqSlxInstruction>::const_iterator i = instrs.begin();
+		        i != instrs.end(); ++i )
+		{
+			if ( ( i->kind == SqSlxInstruction::Opcode && ( i->index < 0 || i->index >= numOpcodes ) )
+			        || ( i->kind == SqSlxInstruction::External && ( i->index < 0 || i->index >= numExternals ) )
+			        || ( i->kind == SqSlxInstruction::Label && i->index < 0 )
+			        || i->kind > SqSlxInstruction::External )
+				in.fail();
+		}
+	}
+	m_stringIndices.clear();
+	m_opcodeIndices.clear();
+}
+
+void CqSlxProgram::writeBinary( std::ostream& out ) const
+{
+	out.write( slxMagic, sizeof( slxMagic ) );
+	writeUint( out, slxBinaryVersion );
+	writeUint( out, AQSIS_SLX_VERSION );
+	writeInt( out, type );
+	writeInt( out, uses );
+
+	writeUint( out, strings.size() );
+	for ( std::vector<std::string>::const_iterator i = strings.begin(); i != strings.end(); ++i )
+		writeString( out, *i );
+
+	writeUint( out, variables.size() );
+	for ( std::vector<SqSlxVariable>::const_iterator i = variables.begin(); i != variables.end(); ++i )
+	{
+		writeInt( out, i->type );
+		writeInt( out, i->varClass );
+		writeInt( out, i->storage );
+		writeInt( out, i->arrayLength );
+		writeInt( out, i->name );
+	}
+
+	writeUint( out, opcodes.size() );
+	for ( std::vector<TqInt>::const_iterator i = opcodes.begin(); i != opcodes.end(); ++i )
+		writeInt( out, *i );
+
+	writeUint( out, externals.size() );
+	for ( std::vector<SqSlxExternal>::const_iterator i = externals.begin(); i != externals.end(); ++i )
+	{
+		writeInt( out, i->name );
+		writeInt( out, i->returnType );
+		writeInt( out, i->argTypes );
+	}
+
+	writeSegment( out, init );
+	writeSegment( out, code );
+}
+
+} // namespace Aqsis
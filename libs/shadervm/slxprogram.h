@@ -0,0 +1,158 @@
+// Aqsis
+// Copyright (C) 1997 - 2001, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+/** \file
+		\brief Declares the parsed form of a compiled shader program, and its
+		binary file format.
+*/
+
+//? Is slxprogram.h included already?
+#ifndef SLXPROGRAM_H_INCLUDED
+#define SLXPROGRAM_H_INCLUDED 1
+
+#include	<iosfwd>
+#include	<map>
+#include	<string>
+#include	<vector>
+
+#include	<aqsis/aqsis.h>
+
+#include	<aqsis/shadervm/ishader.h>
+#include	<aqsis/shadervm/ishaderdata.h>
+
+namespace Aqsis {
+
+//----------------------------------------------------------------------
+/** \struct SqSlxOperand
+ * An operand of an instruction in a shader program.
+ */
+struct SqSlxOperand
+{
+	enum EqKind
+	{
+		Float,
+		Integer,
+		String,		///< value is an index into the string pool.
+		Variable	///< value is the string pool index of the variable name.
+	};
+
+	EqKind	kind;
+	union
+	{
+		TqFloat	floatVal;
+		TqInt	value;
+	};
+};
+
+//----------------------------------------------------------------------
+/** \struct SqSlxInstruction
+ * An instruction in a shader program.  The operands follow each other in
+ * the operand array of the segment.
+ */
+struct SqSlxInstruction
+{
+	enum EqKind
+	{
+		Opcode,		///< index is the position of the opcode name in CqSlxProgram::opcodes.
+		Label,		///< index is the label number.
+		External	///< index is the position in CqSlxProgram::externals.
+	};
+
+	EqKind	kind;
+	TqInt	index;
+	TqInt	firstOperand;
+	TqInt	numOperands;
+};
+
+/// A sequence of instructions; either the initialisation or main code.
+struct SqSlxSegment
+{
+	std::vector<SqSlxInstruction>	instructions;
+	std::vector<SqSlxOperand>	operands;
+};
+
+/// A call to a DSO shadeop, with string pool indices of its signature.
+struct SqSlxExternal
+{
+	TqInt	name;
+	TqInt	returnType;
+	TqInt	argTypes;
+};
+
+/// A shader variable, declared in the data segment.
+struct SqSlxVariable
+{
+	EqVariableType	type;
+	EqVariableClass	varClass;
+	IqShaderData::EqStorage	storage;
+	TqInt	arrayLength;	///< Length of an array, or -1 for non-arrays.
+	TqInt	name;			///< String pool index of the name.
+};
+
+//----------------------------------------------------------------------
+/** \class CqSlxProgram
+ * A compiled shader program with its opcodes, variables and literals
+ * gathered into tables, but not yet bound to any particular shader instance.
+ *
+ * Names are kept as strings so that the program can be stored on disk
+ * independently of the layout of the VM opcode table; a program only needs
+ * each distinct opcode and variable name resolved once when it's loaded.
+ */
+class AQSIS_SHADERVM_SHARE CqSlxProgram
+{
+	public:
+		CqSlxProgram();
+
+		/// Add a string to the pool, returning its index.
+		TqInt addString( const std::string& str );
+		/// Add an opcode name, returning its index in the opcodes table.
+		TqInt addOpcode( const std::string& name );
+
+		/** \brief Read a program in binary form.
+		 *
+		 * \throw XqBadShader if the data is truncated, or was written by an
+		 *   incompatible version of aqsis.
+		 */
+		void readBinary( const char* data, TqInt size );
+		/// Write the program in binary form.
+		void writeBinary( std::ostream& out ) const;
+
+		/// Determine whether some data holds a program in binary form.
+		static bool isBinary( const char* data, TqInt size );
+
+		EqShaderType	type;
+		TqInt	uses;
+		std::vector<std::string>	strings;	///< String pool.
+		std::vector<SqSlxVariable>	variables;
+		std::vector<TqInt>	opcodes;	///< String pool indices of opcode names.
+		std::vector<SqSlxExternal>	externals;
+		SqSlxSegment	init;
+		SqSlxSegment	code;
+
+	private:
+		/// Index of each string in the pool; only needed while building.
+		std::map<std::string, TqInt>	m_stringIndices;
+		/// Index of each opcode in the opcodes table.
+		std::map<TqInt, TqInt>	m_opcodeIndices;
+};
+
+} // namespace Aqsis
+
+#endif	// !SLXPROGRAM_H_INCLUDED
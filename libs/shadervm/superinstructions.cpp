@@ -0,0 +1,432 @@
+// Aqsis
+// Copyright (C) 1997 - 2001, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+/** \file
+		\brief Fused superinstructions for the shader virtual machine.
+
+		The shader compiler emits simple arithmetic assignments like
+		"R = A + B" as the four instruction sequence
+
+		    pushv B
+		    pushv A
+		    addff
+		    pop R
+
+		which goes through the stack with two temporaries and runs two
+		masked loops over the grid.  FuseSuperinstructions() replaces the
+		first instruction of such sequences with a single fused command which
+		computes the result directly into R in one loop, without the running
+		state test per element when all shading points are running.  The rest
+		of the sequence is left in place, so label offsets are unchanged, and
+		the fused command falls back to executing the original sequence
+		whenever it meets a case it can't handle.
+
+		Larger expressions keep intermediate results on the stack, so two
+		shorter forms are fused as well:
+
+		    pushv B             pushv A
+		    pushv A             op
+		    op                  pop R
+
+		The first leaves A op B on the stack for a later instruction, and the
+		second takes B from the stack.  Between them, "R = A*B + C" and the
+		like run as two loops rather than five.
+*/
+
+#include "shadervm.h"
+
+namespace Aqsis {
+
+namespace {
+
+//------------------------------------------------------------------------------
+// Operators for the fused instructions.  These use the same operators on the
+// same types as the OpABRS based ops they replace.
+struct SqFusedAdd
+{
+	template<typename T>
+	T operator()(const T& a, const T& b) const { return a + b; }
+};
+struct SqFusedSub
+{
+	template<typename T>
+	T operator()(const T& a, const T& b) const { return a - b; }
+};
+struct SqFusedMul
+{
+	template<typename T>
+	T operator()(const T& a, const T& b) const { return a * b; }
+};
+struct SqFusedDiv
+{
+	template<typename T>
+	T operator()(const T& a, const T& b) const { return a / b; }
+};
+
+/// Operand access for a varying operand.
+template<typename T>
+struct SqVaryingArg
+{
+	const T* p;
+	SqVaryingArg(const IqShaderData* var) { var->GetValuePtr(p); }
+	const T& operator[](TqInt i) const { return p[i]; }
+};
+
+/// Operand access for a uniform operand, broadcast to all shading points.
+template<typename T>
+struct SqUniformArg
+{
+	T v;
+	SqUniformArg(const IqShaderData* var) { var->GetValue(v); }
+	const T& operator[](TqInt) const { return v; }
+};
+
+/** \brief Run a fused binary op over the grid, r[i] = a[i] op b[i].
+ *
+ * When every shading point is running the loop has no per element test, so
+ * the compiler is free to vectorise it.
+ */
+template<typename T, typename ArgA, typename ArgB, typename OpT>
+inline void fusedKernel(T* r, const ArgA& a, const ArgB& b, TqInt n,
+		const CqBitVector& runningState, bool allRunning, const OpT& op)
+{
+	if(allRunning)
+	{
+		for(TqInt i = 0; i < n; ++i)
+			r[i] = op(a[i], b[i]);
+	}
+	else
+	{
+		for(TqInt i = 0; i < n; ++i)
+		{
+			if(runningState.Value(i))
+				r[i] = op(a[i], b[i]);
+		}
+	}
+}
+
+/// Check whether a variable has a storage type compatible with T.
+template<typename T>
+bool fusedTypeOk(EqVariableType type);
+template<>
+inline bool fusedTypeOk<TqFloat>(EqVariableType type)
+{
+	return type == type_float;
+}
+template<>
+inline bool fusedTypeOk<CqVector3D>(EqVariableType type)
+{
+	return type == type_point || type == type_vector || type == type_normal;
+}
+template<>
+inline bool fusedTypeOk<CqColor>(EqVariableType type)
+{
+	return type == type_color;
+}
+
+/** \brief Check whether a variable can be used directly by a fused op.
+ *
+ * The variable must be a non-array of the right type, and either uniform or
+ * varying over exactly the current shading points.
+ */
+template<typename T>
+inline bool fusedOperandOk(const IqShaderData* var, TqUint shadingPointCount)
+{
+	return fusedTypeOk<T>(var->Type()) && !var->isArray()
+		&& (var->Size() == 1 || var->Size() == shadingPointCount);
+}
+
+/// Type of the stack temporary holding the result of an op on T.
+template<typename T>
+EqVariableType fusedResultType();
+template<>
+inline EqVariableType fusedResultType<TqFloat>()
+{
+	return type_float;
+}
+template<>
+inline EqVariableType fusedResultType<CqVector3D>()
+{
+	return type_point;
+}
+template<>
+inline EqVariableType fusedResultType<CqColor>()
+{
+	return type_color;
+}
+
+/** \brief Compute r = a op b over the grid for already checked operands.
+ *
+ * pR must be varying if either of pA or pB is.
+ */
+template<typename T, typename OpT>
+void fusedEvaluate(IqShaderData* pA, IqShaderData* pB, IqShaderData* pR,
+		IqShaderExecEnv* pEnv, const OpT& op)
+{
+	if(!pEnv->IsRunning())
+		return;
+
+	bool fAVar = pA->Size() > 1;
+	bool fBVar = pB->Size() > 1;
+	if(pR->Size() <= 1)
+	{
+		// Everything is uniform.
+		T vA, vB;
+		pA->GetValue( vA );
+		pB->GetValue( vB );
+		pR->SetValue( op(vA, vB) );
+		return;
+	}
+
+	T* r = 0;
+	pR->GetValuePtr( r );
+	TqUint ext = pEnv->shadingPointCount();
+	const CqBitVector& RS = pEnv->RunningState();
+	bool allRunning = static_cast<TqUint>(RS.Count()) >= ext;
+	if(fAVar && fBVar)
+		fusedKernel(r, SqVaryingArg<T>(pA), SqVaryingArg<T>(pB), ext, RS, allRunning, op);
+	else if(fAVar)
+		fusedKernel(r, SqVaryingArg<T>(pA), SqUniformArg<T>(pB), ext, RS, allRunning, op);
+	else if(fBVar)
+		fusedKernel(r, SqUniformArg<T>(pA), SqVaryingArg<T>(pB), ext, RS, allRunning, op);
+	else
+		fusedKernel(r, SqUniformArg<T>(pA), SqUniformArg<T>(pB), ext, RS, allRunning, op);
+}
+
+/// Table of fusable arithmetic commands and their fused replacements.
+struct SqFusableOp
+{
+	void (CqShaderVM::*op)();
+	void (CqShaderVM::*fused)();			///< pushv B; pushv A; op; pop R
+	void (CqShaderVM::*fusedToStack)();		///< pushv B; pushv A; op
+	void (CqShaderVM::*fusedFromStack)();	///< pushv A; op; pop R
+};
+
+/// Find the entry for an arithmetic command in a table of fusable ops.
+inline const SqFusableOp* findFusableOp(const SqFusableOp* ops, TqInt numOps,
+		void (CqShaderVM::*cmd)())
+{
+	for(TqInt i = 0; i < numOps; ++i)
+	{
+		if(ops[i].op == cmd)
+			return &ops[i];
+	}
+	return 0;
+}
+
+} // unnamed namespace
+
+
+//------------------------------------------------------------------------------
+template<typename T, typename OpT>
+void CqShaderVM::FusedBinaryOp(const OpT& op)
+{
+	// m_PC points just past the replaced pushv.  The operands of the original
+	// sequence are at fixed offsets from here:
+	//   [0] B   [1] pushv   [2] A   [3] op   [4] pop   [5] R
+	IqShaderData* pB = GetVar( m_PC[0].m_iVariable );
+	IqShaderData* pA = GetVar( m_PC[2].m_iVariable );
+	IqShaderData* pR = GetVar( m_PC[5].m_iVariable );
+
+	TqUint ext = m_pEnv->shadingPointCount();
+	if( !fusedOperandOk<T>(pA, ext) || !fusedOperandOk<T>(pB, ext)
+		|| !fusedOperandOk<T>(pR, ext)
+		|| ( (pA->Size() > 1 || pB->Size() > 1) && pR->Size() <= 1 ) )
+	{
+		// Not something we can handle directly; execute the original
+		// sequence, starting with the pushv which we replaced.
+		SO_pushv();
+		return;
+	}
+
+	// Skip the rest of the original sequence.
+	m_PC += 6;
+	m_PO += 6;
+
+	fusedEvaluate<T>(pA, pB, pR, m_pEnv, op);
+}
+
+template<typename T, typename OpT>
+void CqShaderVM::FusedBinaryOpToStack(const OpT& op)
+{
+	// As for FusedBinaryOp, but without the pop:
+	//   [0] B   [1] pushv   [2] A   [3] op
+	IqShaderData* pB = GetVar( m_PC[0].m_iVariable );
+	IqShaderData* pA = GetVar( m_PC[2].m_iVariable );
+
+	TqUint ext = m_pEnv->shadingPointCount();
+	if( !fusedOperandOk<T>(pA, ext) || !fusedOperandOk<T>(pB, ext) )
+	{
+		SO_pushv();
+		return;
+	}
+	m_PC += 4;
+	m_PO += 4;
+
+	// The result goes in a stack temporary, exactly as the op would make it.
+	bool fVarying = pA->Size() > 1 || pB->Size() > 1;
+	IqShaderData* pResult = GetNextTemp( fusedResultType<T>(),
+			fVarying ? class_varying : class_uniform );
+	pResult->SetSize( m_shadingPointCount );
+	fusedEvaluate<T>(pA, pB, pResult, m_pEnv, op);
+	Push( pResult );
+}
+
+template<typename T, typename OpT>
+void CqShaderVM::FusedBinaryOpFromStack(const OpT& op)
+{
+	// Here B is already on the stack, and m_PC points past the pushv of A:
+	//   [0] A   [1] op   [2] pop   [3] R
+	IqShaderData* pA = GetVar( m_PC[0].m_iVariable );
+	IqShaderData* pR = GetVar( m_PC[3].m_iVariable );
+	IqShaderData* pB = m_iTop > 0 ? m_Stack[ m_iTop - 1 ].m_Data : 0;
+
+	TqUint ext = m_pEnv->shadingPointCount();
+	if( !pB || !fusedOperandOk<T>(pA, ext) || !fusedOperandOk<T>(pB, ext)
+		|| !fusedOperandOk<T>(pR, ext)
+		|| ( (pA->Size() > 1 || pB->Size() > 1) && pR->Size() <= 1 ) )
+	{
+		SO_pushv();
+		return;
+	}
+	m_PC += 4;
+	m_PO += 4;
+
+	bool fVarying = false;
+	SqStackEntry entryB = Pop( fVarying );
+	fusedEvaluate<T>(pA, pB, pR, m_pEnv, op);
+	Release( entryB );
+}
+
+// Each fusable op has a fused command for each of the three forms.
+#define	FUSED_OP(name, T, OpT) \
+	void CqShaderVM::SO_fused_##name() \
+	{ \
+		FusedBinaryOp<T>(OpT()); \
+	} \
+	void CqShaderVM::SO_fusedts_##name() \
+	{ \
+		FusedBinaryOpToStack<T>(OpT()); \
+	} \
+	void CqShaderVM::SO_fusedfs_##name() \
+	{ \
+		FusedBinaryOpFromStack<T>(OpT()); \
+	}
+
+FUSED_OP(addff, TqFloat, SqFusedAdd)
+FUSED_OP(subff, TqFloat, SqFusedSub)
+FUSED_OP(mulff, TqFloat, SqFusedMul)
+FUSED_OP(divff, TqFloat, SqFusedDiv)
+FUSED_OP(addpp, CqVector3D, SqFusedAdd)
+FUSED_OP(subpp, CqVector3D, SqFusedSub)
+FUSED_OP(addcc, CqColor, SqFusedAdd)
+FUSED_OP(subcc, CqColor, SqFusedSub)
+FUSED_OP(mulcc, CqColor, SqFusedMul)
+FUSED_OP(divcc, CqColor, SqFusedDiv)
+
+#undef FUSED_OP
+
+
+//------------------------------------------------------------------------------
+void CqShaderVM::FuseSuperinstructions( std::vector<UsProgramElement>& program )
+{
+	// mulpp and divpp are left out since they're special cased as
+	// component-wise operations rather than the vector operators.
+	static const SqFusableOp fusableOps[] = {
+#		define FUSABLE_OP(name) { &CqShaderVM::SO_##name, &CqShaderVM::SO_fused_##name, \
+			&CqShaderVM::SO_fusedts_##name, &CqShaderVM::SO_fusedfs_##name }
+		FUSABLE_OP(addff),
+		FUSABLE_OP(subff),
+		FUSABLE_OP(mulff),
+		FUSABLE_OP(divff),
+		FUSABLE_OP(addpp),
+		FUSABLE_OP(subpp),
+		FUSABLE_OP(addcc),
+		FUSABLE_OP(subcc),
+		FUSABLE_OP(mulcc),
+		FUSABLE_OP(divcc),
+#		undef FUSABLE_OP
+	};
+	const TqInt numFusableOps = sizeof(fusableOps)/sizeof(fusableOps[0]);
+
+	// Jump targets are always SO_nop instructions emitted for the labels, so
+	// a run of instructions without a nop can't be jumped into part way.
+	//
+	// Each form is matched at a pushv, and the longest match wins.  Each
+	// pattern is checked only at instruction boundaries, so operand slots
+	// are never mistaken for commands.
+	TqInt size = program.size();
+	TqInt i = 0;
+	while(i < size)
+	{
+		void (CqShaderVM::*cmd)() = program[i].m_Command;
+		if(cmd == &CqShaderVM::SO_pushv)
+		{
+			TqInt seqLen = 0;
+			if(i + 5 <= size && program[i+2].m_Command == &CqShaderVM::SO_pushv)
+			{
+				// pushv B; pushv A; op [; pop R]
+				const SqFusableOp* fop = findFusableOp(fusableOps, numFusableOps,
+						program[i+4].m_Command);
+				if(fop)
+				{
+					if(i + 7 <= size && program[i+5].m_Command == &CqShaderVM::SO_pop)
+					{
+						program[i].m_Command = fop->fused;
+						seqLen = 7;
+					}
+					else
+					{
+						program[i].m_Command = fop->fusedToStack;
+						seqLen = 5;
+					}
+				}
+			}
+			else if(i + 5 <= size)
+			{
+				// pushv A; op; pop R
+				const SqFusableOp* fop = findFusableOp(fusableOps, numFusableOps,
+						program[i+2].m_Command);
+				if(fop && program[i+3].m_Command == &CqShaderVM::SO_pop)
+				{
+					program[i].m_Command = fop->fusedFromStack;
+					seqLen = 5;
+				}
+			}
+			if(seqLen > 0)
+			{
+				i += seqLen;
+				continue;
+			}
+		}
+		// Skip the instruction and its parameters.
+		++i;
+		for(TqInt j = 0; j < m_cTransSize; ++j)
+		{
+			if(m_TransTable[j].m_pCommand == cmd)
+			{
+				i += m_TransTable[j].m_cParams;
+				break;
+			}
+		}
+	}
+}
+
+} // namespace Aqsis
@@ -0,0 +1,268 @@
+// Aqsis
+// Copyright (C) 1997 - 2001, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+/** \file
+ *
+ * \brief Unit tests checking that fused superinstructions give the same
+ * results as the instruction sequences they replace.
+ */
+
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#include <aqsis/core/irenderer.h>
+#include <aqsis/math/color.h>
+#include <aqsis/math/vector3d.h>
+#include <aqsis/shadervm/ishader.h>
+#include <aqsis/shadervm/ishaderdata.h>
+#include <aqsis/shadervm/ishaderexecenv.h>
+#include <aqsis/slcomp/icodegen.h>
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/auto_unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(superinstructions_tests)
+
+using namespace Aqsis;
+
+namespace {
+
+// Render context which only knows Option "shading" "superinstructions".
+class CqFuseOptionRenderer : public IqRenderer
+{
+	public:
+		CqFuseOptionRenderer(TqInt fuse) : m_fuse(fuse) {}
+
+		virtual	bool matSpaceToSpace(const char*, const char*, const IqTransform*, const IqTransform*, TqFloat, CqMatrix&) { return false; }
+		virtual	bool matVSpaceToSpace(const char*, const char*, const IqTransform*, const IqTransform*, TqFloat, CqMatrix&) { return false; }
+		virtual	bool matNSpaceToSpace(const char*, const char*, const IqTransform*, const IqTransform*, TqFloat, CqMatrix&) { return false; }
+		virtual	TqInt spaceHandle(const char*) { return -1; }
+		virtual	bool matSpaceToSpace(TqInt, TqInt, const IqTransform*, const IqTransform*, TqFloat, CqMatrix&) { return false; }
+		virtual	bool matVSpaceToSpace(TqInt, TqInt, const IqTransform*, const IqTransform*, TqFloat, CqMatrix&) { return false; }
+		virtual	bool matNSpaceToSpace(TqInt, TqInt, const IqTransform*, const IqTransform*, TqFloat, CqMatrix&) { return false; }
+
+		virtual	const TqFloat* GetFloatOption(const char*, const char*) const { return 0; }
+		virtual	const TqInt* GetIntegerOption(const char* strName, const char* strParam) const
+		{
+			if(std::strcmp(strName, "shading") == 0
+				&& std::strcmp(strParam, "superinstructions") == 0)
+				return &m_fuse;
+			return 0;
+		}
+		virtual	const CqString* GetStringOption(const char*, const char*) const { return 0; }
+		virtual	const CqVector3D* GetPointOption(const char*, const char*) const { return 0; }
+		virtual	const CqColor* GetColorOption(const char*, const char*) const { return 0; }
+		virtual	TqFloat* GetFloatOptionWrite(const char*, const char*) { return 0; }
+		virtual	TqInt* GetIntegerOptionWrite(const char*, const char*) { return 0; }
+		virtual	CqString* GetStringOptionWrite(const char*, const char*) { return 0; }
+		virtual	CqVector3D* GetPointOptionWrite(const char*, const char*) { return 0; }
+		virtual	CqColor* GetColorOptionWrite(const char*, const char*) { return 0; }
+
+		virtual	void PrintString(const char*) {}
+		virtual	IqTextureCache& textureCache() { return *static_cast<IqTextureCache*>(0); }
+		virtual	IqTextureMapOld* GetEnvironmentMap(const CqString&) { return 0; }
+		virtual	IqTextureMapOld* GetOcclusionMap(const CqString&) { return 0; }
+		virtual	IqTextureMapOld* GetLatLongMap(const CqString&) { return 0; }
+		virtual	IqRaytrace* pRaytracer() const { return 0; }
+		virtual	TqInt cullLights(const CqVector3D&, const CqVector3D&, const IqLightsource**, TqInt) const { return 0; }
+		virtual	bool GetBasisMatrix(CqMatrix&, const CqString&) { return false; }
+		virtual TqInt RegisterOutputData(const char*) { return -1; }
+		virtual TqInt OutputDataIndex(const char*) { return -1; }
+		virtual TqInt OutputDataSamples(const char*) { return 0; }
+		virtual	void SetCurrentFrame(TqInt) {}
+		virtual	TqInt CurrentFrame() const { return 0; }
+		virtual	TqFloat Time() const { return 0; }
+		virtual	bool IsWorldBegin() const { return true; }
+	private:
+		TqInt m_fuse;
+};
+
+const TqInt uGridRes = 5;
+const TqInt vGridRes = 4;
+const TqInt numPoints = (uGridRes+1)*(vGridRes+1);
+
+/* A surface shader program using each form of fusable sequence, on uniform
+ * and varying operands, with all or only some shading points running.  The
+ * code is as aqsl would generate it for
+ *
+ *   a = s;  b = t + 1;  p = point(s, t, 1);  q = point(t, 1, s);
+ *   x = color(s, 1, t);  y = color(1, t + 1, 2);
+ *   r1 = a + b;  r2 = a - u;  r3 = a*b + c;  r4 = c + a*b;  r5 = r1 + a;
+ *   r8 = a - b*c;
+ *   ur = u*u;  rp = p - q;  rp2 = q + (p - q);  rc = x*y;  rc2 = x/y - x;
+ *   if(a > 0.5) { r6 = a/b;  r7 = c + b*a;  rc3 = x + y; }
+ */
+std::string testProgram()
+{
+	std::ostringstream prog;
+	prog << "surface\n"
+		<< "AQSIS_V " << AQSIS_XSTR(AQSIS_SLX_VERSION) << "\n"
+		<< "\n\nsegment Data\n\n"
+		<< "USES " << ((1 << EnvVars_s) | (1 << EnvVars_t)) << "\n\n"
+		<< "param uniform  float u\n"
+		<< "param uniform  float c\n"
+		<< "uniform  float ur\n"
+		<< "varying  float a\n"
+		<< "varying  float b\n"
+		<< "varying  float r1\n"
+		<< "varying  float r2\n"
+		<< "varying  float r3\n"
+		<< "varying  float r4\n"
+		<< "varying  float r5\n"
+		<< "varying  float r6\n"
+		<< "varying  float r7\n"
+		<< "varying  float r8\n"
+		<< "varying  point p\n"
+		<< "varying  point q\n"
+		<< "varying  point rp\n"
+		<< "varying  point rp2\n"
+		<< "varying  color x\n"
+		<< "varying  color y\n"
+		<< "varying  color rc\n"
+		<< "varying  color rc2\n"
+		<< "varying  color rc3\n"
+		<< "\n\nsegment Init\n"
+		<< "\tpushif 0.75\n\tpop u\n"
+		<< "\tpushif 3\n\tpop c\n"
+		<< "\n\nsegment Code\n"
+		// Results which are only set for some points need a value elsewhere.
+		<< "\tpushif -1\n\tpop r6\n"
+		<< "\tpushif -1\n\tpop r7\n"
+		<< "\tpushif -1\n\tsetfc\n\tpop rc3\n"
+		// Inputs
+		<< "\tpushv s\n\tpop a\n"
+		<< "\tpushif 1\n\tpushv t\n\taddff\n\tpop b\n"
+		<< "\tpushif 1\n\tpushv t\n\tpushv s\n\tsettp\n\tpop p\n"
+		<< "\tpushv s\n\tpushif 1\n\tpushv t\n\tsettp\n\tpop q\n"
+		<< "\tpushv t\n\tpushif 1\n\tpushv s\n\tsettc\n\tpop x\n"
+		<< "\tpushif 2\n\tpushv b\n\tpushif 1\n\tsettc\n\tpop y\n"
+		// r1 = a + b
+		<< "\tpushv b\n\tpushv a\n\taddff\n\tpop r1\n"
+		// r2 = a - u
+		<< "\tpushv u\n\tpushv a\n\tsubff\n\tpop r2\n"
+		// r3 = a*b + c
+		<< "\tpushv c\n\tpushv b\n\tpushv a\n\tmulff\n\taddff\n\tpop r3\n"
+		// r4 = c + a*b
+		<< "\tpushv b\n\tpushv a\n\tmulff\n\tpushv c\n\taddff\n\tpop r4\n"
+		// r5 = r1 + a, reading and writing the same variable
+		<< "\tpushv a\n\tpushv r1\n\taddff\n\tpop r1\n"
+		<< "\tpushv r1\n\tpop r5\n"
+		// r8 = a - b*c
+		<< "\tpushv c\n\tpushv b\n\tmulff\n\tpushv a\n\tsubff\n\tpop r8\n"
+		// ur = u*u
+		<< "\tpushv u\n\tpushv u\n\tmulff\n\tpop ur\n"
+		// rp = p - q;  rp2 = q + (p - q)
+		<< "\tpushv q\n\tpushv p\n\tsubpp\n\tpop rp\n"
+		<< "\tpushv q\n\tpushv p\n\tsubpp\n\tpushv q\n\taddpp\n\tpop rp2\n"
+		// rc = x*y;  rc2 = x/y - x
+		<< "\tpushv y\n\tpushv x\n\tmulcc\n\tpop rc\n"
+		<< "\tpushv x\n\tpushv y\n\tpushv x\n\tdivcc\n\tsubcc\n\tpop rc2\n"
+		// if(a > 0.5)
+		<< "\tS_CLEAR\n\tpushif 0.5\n\tpushv a\n\tgtff\n\tS_GET\n"
+		<< "\tRS_PUSH\n\tRS_GET\n\tRS_JZ 0\n"
+		<< "\tpushv b\n\tpushv a\n\tdivff\n\tpop r6\n"
+		<< "\tpushv a\n\tpushv b\n\tmulff\n\tpushv c\n\taddff\n\tpop r7\n"
+		<< "\tpushv y\n\tpushv x\n\taddcc\n\tpop rc3\n"
+		<< ":0\n\tRS_POP\n";
+	return prog.str();
+}
+
+// Values of a shader variable at each shading point.
+template<typename T>
+std::vector<T> values(IqShader& shader, const char* name)
+{
+	IqShaderData* var = shader.FindArgument(name);
+	BOOST_REQUIRE(var);
+	std::vector<T> vals;
+	for(TqInt i = 0; i < numPoints; ++i)
+	{
+		T v;
+		var->GetValue(v, var->Size() > 1 ? i : 0);
+		vals.push_back(v);
+	}
+	return vals;
+}
+
+/* Run the test program, with superinstructions enabled or not.  The shader
+ * is returned so that its variables can be inspected.
+ */
+boost::shared_ptr<IqShader> runProgram(TqInt fuse)
+{
+	CqFuseOptionRenderer renderer(fuse);
+	std::istringstream programFile(testProgram());
+	boost::shared_ptr<IqShader> shader = createShaderVM(&renderer, programFile, "");
+	shader->InitialiseParameters();
+
+	boost::shared_ptr<IqShaderExecEnv> env = IqShaderExecEnv::create(&renderer);
+	env->Initialise(uGridRes, vGridRes, uGridRes*vGridRes, numPoints, false,
+			IqAttributesPtr(), IqTransformPtr(), shader.get(),
+			(1 << EnvVars_s) | (1 << EnvVars_t));
+	env->s()->Initialise(numPoints);
+	env->t()->Initialise(numPoints);
+	for(TqInt i = 0; i < numPoints; ++i)
+	{
+		env->s()->SetFloat(0.37f*i - 1.5f, i);
+		env->t()->SetFloat(0.11f*i + 0.5f, i);
+	}
+	shader->Initialise(uGridRes, vGridRes, numPoints, env.get());
+	shader->Evaluate(env.get());
+	return shader;
+}
+
+template<typename T>
+void checkSameValues(IqShader& fused, IqShader& unfused, const char* name)
+{
+	BOOST_TEST_MESSAGE("checking " << name);
+	std::vector<T> fusedVals = values<T>(fused, name);
+	std::vector<T> unfusedVals = values<T>(unfused, name);
+	for(TqInt i = 0; i < numPoints; ++i)
+		BOOST_CHECK_EQUAL(fusedVals[i], unfusedVals[i]);
+}
+
+} // unnamed namespace
+
+BOOST_AUTO_TEST_CASE(superinstructions_same_results_test)
+{
+	boost::shared_ptr<IqShader> fused = runProgram(1);
+	boost::shared_ptr<IqShader> unfused = runProgram(0);
+
+	const char* floatVars[] = { "r1", "r2", "r3", "r4", "r5", "r6", "r7", "r8", "ur" };
+	for(int i = 0; i < 9; ++i)
+		checkSameValues<TqFloat>(*fused, *unfused, floatVars[i]);
+	checkSameValues<CqVector3D>(*fused, *unfused, "rp");
+	checkSameValues<CqVector3D>(*fused, *unfused, "rp2");
+	checkSameValues<CqColor>(*fused, *unfused, "rc");
+	checkSameValues<CqColor>(*fused, *unfused, "rc2");
+	checkSameValues<CqColor>(*fused, *unfused, "rc3");
+
+	// Spot check the unfused results against the expressions themselves.
+	std::vector<TqFloat> r3 = values<TqFloat>(*unfused, "r3");
+	std::vector<TqFloat> r6 = values<TqFloat>(*unfused, "r6");
+	for(TqInt i = 0; i < numPoints; ++i)
+	{
+		TqFloat a = 0.37f*i - 1.5f;
+		TqFloat b = 0.11f*i + 0.5f + 1;
+		BOOST_CHECK_CLOSE(r3[i], a*b + 3, 1e-4);
+		BOOST_CHECK_EQUAL(r6[i], a > 0.5f ? a/b : -1.0f);
+	}
+	BOOST_CHECK_EQUAL(values<TqFloat>(*unfused, "ur")[0], 0.75f*0.75f);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
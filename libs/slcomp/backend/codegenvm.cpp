@@ -43,6 +43,7 @@ void CqCodeGenVM::OutputTree( IqParseNode* pNode, std::string strOutName )
 	CqCodeGenOutput V( &DG, strOutName );
 	pNode->Accept( DG );
 	pNode->Accept( V );
+	m_outputFileName = V.strOutName();
 }
 
 
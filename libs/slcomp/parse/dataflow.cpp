@@ -0,0 +1,952 @@
+// Aqsis
+// Copyright (C) 1997 - 2001, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+/** \file
+		\brief Implements the dataflow optimisations run over the body of a
+		shader once it has been typechecked.
+
+		The passes work on the parse tree rather than the generated VM code,
+		so that each one can rely on the structure of the shader; a statement
+		list is executed in order, and only loops, conditionals and the light
+		constructs change the set of shading points an instruction runs on.
+		Local shader variables which might be touched by anything other than
+		the nodes in the shader body (local functions, extern declarations,
+		output arguments and message passing) are left well alone.
+*/
+
+#include	<aqsis/aqsis.h>
+
+#include	<cctype>
+#include	<cstring>
+#include	<map>
+#include	<set>
+#include	<sstream>
+#include	<string>
+#include	<vector>
+
+#include	"parsenode.h"
+#include	"funcdef.h"
+#include	"vardef.h"
+
+namespace Aqsis {
+
+namespace {
+
+/// Standard functions with no side effects, whose result depends only on
+/// their arguments.
+const char* const gPureFunctions[] =
+    {
+        "radians", "degrees", "sin", "asin", "cos", "acos", "tan", "atan",
+        "pow", "exp", "sqrt", "inversesqrt", "log", "mod", "abs", "sign",
+        "min", "max", "clamp", "floor", "ceil", "round", "step",
+        "smoothstep", "mix", "xcomp", "ycomp", "zcomp", "comp", "length",
+        "normalize", "distance", "ptlined", "reflect", "refract",
+        "transform", "vtransform", "ntransform", "ctransform", "mtransform",
+        "rotate", "scale", "translate", "determinant", "spline", "concat",
+        "match",
+        0
+    };
+
+/// A variable, identified by its type and index.
+typedef std::pair<TqInt, TqUint> TqVarKey;
+
+TqVarKey VarKey( const SqVarRef& ref )
+{
+	return ( TqVarKey( ref.m_Type, ref.m_Index ) );
+}
+
+CqParseNode* ParentOf( const CqParseNode* pNode )
+{
+	return ( static_cast<CqParseNode*>( pNode->pParent() ) );
+}
+
+bool IsPureFunction( CqParseNode* pNode )
+{
+	const IqFuncDef* pFunc = static_cast<CqParseNodeFunctionCall*>( pNode ) ->pFuncDef();
+	if ( pFunc == 0 || pFunc->fLocal() )
+		return ( false );
+	// Arithmetic operators are calls to the standard "operator" functions.
+	if ( std::strncmp( pFunc->strName(), "operator", 8 ) == 0 )
+		return ( true );
+	for ( const char* const* pName = gPureFunctions; *pName != 0; ++pName )
+	{
+		if ( std::strcmp( *pName, pFunc->strName() ) == 0 )
+			return ( true );
+	}
+	return ( false );
+}
+
+/// Output arguments are marked by an upper case type in the parameter string.
+bool HasOutputArguments( const IqFuncDef* pFunc )
+{
+	for ( const char* pType = pFunc->strParams(); *pType != 0; ++pType )
+	{
+		if ( std::isupper( *pType ) )
+			return ( true );
+	}
+	return ( false );
+}
+
+bool IsLightConstruct( TqInt type )
+{
+	return ( type == ParseNode_IlluminateConstruct ||
+	         type == ParseNode_IlluminanceConstruct ||
+	         type == ParseNode_SolarConstruct ||
+	         type == ParseNode_GatherConstruct );
+}
+
+/// Determine if a node is a list of statements, executed in order.
+bool IsStatementList( const CqParseNode* pNode )
+{
+	if ( pNode->NodeType() != ParseNode_Base )
+		return ( false );
+	const CqParseNode* pParent = ParentOf( pNode );
+	if ( pParent == 0 )
+		return ( true );
+	switch ( pParent->NodeType() )
+	{
+			case ParseNode_Base:
+			return ( IsStatementList( pParent ) );
+			case ParseNode_Shader:
+			// The second child is the list of shader parameters.
+			return ( pParent->pFirstChild() == pNode );
+			case ParseNode_WhileConstruct:
+			case ParseNode_Conditional:
+			return ( pParent->pFirstChild() != pNode );
+			case ParseNode_IlluminateConstruct:
+			case ParseNode_IlluminanceConstruct:
+			case ParseNode_SolarConstruct:
+			case ParseNode_GatherConstruct:
+			// The light constructs keep any arguments in a list ahead of the body.
+			return ( pParent->pFirstChild() != pNode || pNode->pNext() == 0 );
+			default:
+			return ( false );
+	}
+}
+
+/// Determine if a node is a statement which can be removed from the tree.
+bool IsStatement( const CqParseNode* pNode )
+{
+	const CqParseNode* pParent = ParentOf( pNode );
+	if ( pParent == 0 )
+		return ( false );
+	if ( IsStatementList( pParent ) )
+		return ( true );
+	TqInt type = pParent->NodeType();
+	if ( type == ParseNode_WhileConstruct || type == ParseNode_Conditional )
+		return ( pParent->pFirstChild() != pNode );
+	if ( IsLightConstruct( type ) )
+		return ( pParent->pFirstChild() != pNode || pNode->pNext() == 0 );
+	return ( false );
+}
+
+/// Remove a statement from the tree, leaving an empty statement if it's the
+/// body of a loop or conditional.
+void RemoveStatement( CqParseNode* pNode )
+{
+	if ( IsStatementList( ParentOf( pNode ) ) )
+		pNode->UnLink();
+	else
+		pNode->ReplaceWith( new CqParseNode() );
+	pNode->DeleteChildren();
+	delete( pNode );
+}
+
+/// Replace a node with another, deleting the old one.
+void ReplaceNode( CqParseNode* pOld, CqParseNode* pNew )
+{
+	pNew->SetPos( pOld->LineNo(), pOld->strFileName() );
+	pOld->ReplaceWith( pNew );
+	pOld->DeleteChildren();
+	delete( pOld );
+}
+
+/// Determine if an expression can be evaluated without side effects.
+bool IsPure( CqParseNode* pNode )
+{
+	switch ( pNode->NodeType() )
+	{
+			case ParseNode_Variable:
+			case ParseNode_ArrayVariable:
+			case ParseNode_ConstantFloat:
+			case ParseNode_ConstantString:
+			case ParseNode_MathOp:
+			case ParseNode_RelationalOp:
+			case ParseNode_UnaryOp:
+			case ParseNode_LogicalOp:
+			case ParseNode_TypeCast:
+			case ParseNode_Triple:
+			case ParseNode_SixteenTuple:
+			case ParseNode_ConditionalExpression:
+			break;
+			case ParseNode_FunctionCall:
+			if ( !IsPureFunction( pNode ) )
+				return ( false );
+			break;
+			default:
+			return ( false );
+	}
+	for ( CqParseNode* pChild = pNode->pFirstChild(); pChild != 0; pChild = pChild->pNext() )
+	{
+		if ( !IsPure( pChild ) )
+			return ( false );
+	}
+	return ( true );
+}
+
+bool ContainsLoopMod( const CqParseNode* pNode )
+{
+	if ( pNode->NodeType() == ParseNode_LoopMod )
+		return ( true );
+	for ( CqParseNode* pChild = pNode->pFirstChild(); pChild != 0; pChild = pChild->pNext() )
+	{
+		if ( ContainsLoopMod( pChild ) )
+			return ( true );
+	}
+	return ( false );
+}
+
+/// Number of operations needed to evaluate an expression.
+TqInt Cost( const CqParseNode* pNode )
+{
+	TqInt type = pNode->NodeType();
+	if ( type == ParseNode_Variable || type == ParseNode_ConstantFloat || type == ParseNode_ConstantString )
+		return ( 0 );
+	TqInt cost = 1;
+	for ( CqParseNode* pChild = pNode->pFirstChild(); pChild != 0; pChild = pChild->pNext() )
+		cost += Cost( pChild );
+	return ( cost );
+}
+
+/// Build a string which is equal for structurally identical expressions.
+void ExpressionKey( CqParseNode* pNode, std::ostream& out )
+{
+	out << pNode->NodeType() << ':' << pNode->ResType();
+	switch ( pNode->NodeType() )
+	{
+			case ParseNode_Variable:
+			case ParseNode_ArrayVariable:
+			{
+				SqVarRef ref = static_cast<CqParseNodeVariable*>( pNode ) ->VarRef();
+				out << ':' << ref.m_Type << ':' << ref.m_Index;
+				break;
+			}
+			case ParseNode_ConstantFloat:
+			{
+				TqFloat value = 0;
+				pNode->FloatConstValue( value );
+				out << ':' << value;
+				break;
+			}
+			case ParseNode_ConstantString:
+			{
+				std::string value = static_cast<CqParseNodeStringConst*>( pNode ) ->strValue();
+				out << ':' << value.size() << ':' << value;
+				break;
+			}
+			case ParseNode_MathOp:
+			case ParseNode_RelationalOp:
+			case ParseNode_UnaryOp:
+			case ParseNode_LogicalOp:
+			out << ':' << static_cast<CqParseNodeOp*>( pNode ) ->Operator();
+			break;
+			case ParseNode_TypeCast:
+			out << ':' << static_cast<CqParseNodeCast*>( pNode ) ->CastTo();
+			break;
+			case ParseNode_FunctionCall:
+			{
+				const IqFuncDef* pFunc = static_cast<CqParseNodeFunctionCall*>( pNode ) ->pFuncDef();
+				out << ':' << pFunc->strVMName() << ':' << pFunc->strParams();
+				break;
+			}
+			default:
+			break;
+	}
+	out << '(';
+	for ( CqParseNode* pChild = pNode->pFirstChild(); pChild != 0; pChild = pChild->pNext() )
+	{
+		ExpressionKey( pChild, out );
+		out << ',';
+	}
+	out << ')';
+}
+
+void VariablesRead( const CqParseNode* pNode, std::set<TqVarKey>& vars )
+{
+	TqInt type = pNode->NodeType();
+	if ( type == ParseNode_Variable || type == ParseNode_ArrayVariable )
+		vars.insert( VarKey( static_cast<const CqParseNodeVariable*>( pNode ) ->VarRef() ) );
+	for ( CqParseNode* pChild = pNode->pFirstChild(); pChild != 0; pChild = pChild->pNext() )
+		VariablesRead( pChild, vars );
+}
+
+/// Find the variables written by a statement, returning false if it might
+/// write to variables other than through assignments.
+bool VariablesWritten( CqParseNode* pNode, std::set<TqVarKey>& vars )
+{
+	switch ( pNode->NodeType() )
+	{
+			case ParseNode_VariableAssign:
+			case ParseNode_ArrayVariableAssign:
+			vars.insert( VarKey( static_cast<CqParseNodeVariable*>( pNode ) ->VarRef() ) );
+			break;
+			case ParseNode_FunctionCall:
+			if ( !IsPureFunction( pNode ) )
+				return ( false );
+			break;
+			case ParseNode_UnresolvedCall:
+			case ParseNode_MessagePassingFunction:
+			case ParseNode_IlluminateConstruct:
+			case ParseNode_IlluminanceConstruct:
+			case ParseNode_SolarConstruct:
+			case ParseNode_GatherConstruct:
+			return ( false );
+			default:
+			break;
+	}
+	for ( CqParseNode* pChild = pNode->pFirstChild(); pChild != 0; pChild = pChild->pNext() )
+	{
+		if ( !VariablesWritten( pChild, vars ) )
+			return ( false );
+	}
+	return ( true );
+}
+
+/// Flatten nested statement lists into the sequence of statements executed.
+void FlattenStatements( CqParseNode* pList, std::vector<CqParseNode*>& statements )
+{
+	for ( CqParseNode* pChild = pList->pFirstChild(); pChild != 0; pChild = pChild->pNext() )
+	{
+		if ( IsStatementList( pChild ) )
+			FlattenStatements( pChild, statements );
+		else
+			statements.push_back( pChild );
+	}
+}
+
+
+//----------------------------------------------------------------------
+/** \struct SqVarUsage
+ * How a local variable is used in the body of the shader.
+ */
+struct SqVarUsage
+{
+	SqVarUsage() : m_Reads( 0 ), m_FirstRead( -1 ), m_fAliased( false )
+	{}
+
+	TqInt	m_Reads;		///< Number of nodes reading the variable.
+	TqInt	m_FirstRead;	///< Position of the first read, in tree order.
+	bool	m_fAliased;		///< The variable might be accessed outside the shader body.
+	std::vector<CqParseNode*>	m_aReads;
+	std::vector<CqParseNodeAssign*>	m_aAssigns;
+	std::vector<TqInt>	m_aAssignPositions;
+};
+
+//----------------------------------------------------------------------
+/** \struct SqCommonExpression
+ * Occurrences of an expression which all evaluate to the same value.
+ */
+struct SqCommonExpression
+{
+	SqCommonExpression() : m_Cost( 0 )
+	{}
+
+	TqInt	m_Cost;
+	std::set<TqVarKey>	m_aReads;
+	std::vector<CqParseNode*>	m_aOccurrences;
+	/// The statement holding each occurrence.
+	std::vector<CqParseNode*>	m_aStatements;
+
+	TqInt	Saving() const
+	{
+		return ( m_Cost * ( static_cast<TqInt>( m_aOccurrences.size() ) - 1 ) );
+	}
+};
+
+typedef std::map<std::string, SqCommonExpression>	TqExpressionMap;
+
+
+//----------------------------------------------------------------------
+/** \class CqDataflowOptimiser
+ * Optimisations over the body of a shader which need to know where
+ * variables are set and used.  Each pass returns true if it changed the
+ * tree, after which the usage must be gathered again with Analyse().
+ */
+class CqDataflowOptimiser
+{
+	public:
+		CqDataflowOptimiser( CqParseNode* pCode ) : m_pCode( pCode ), m_Position( 0 )
+		{}
+
+		void	Analyse();
+		bool	PropagateConstants();
+		bool	RemoveDeadCode();
+		bool	EliminateCommonSubexpression();
+		void	DemoteToUniform();
+
+	private:
+		void	Gather( CqParseNode* pNode );
+		void	MarkAliased( const SqVarRef& ref );
+		void	MarkAllAliased( CqParseNode* pNode );
+		void	MarkArgumentsAliased( CqParseNode* pCall );
+		bool	IsCandidate( TqUint index ) const;
+		bool	IsUnconditional( CqParseNode* pNode ) const;
+		bool	IsVarying( CqParseNode* pNode ) const;
+		bool	InVaryingContext( CqParseNode* pNode ) const;
+		void	FindCommonExpressions( CqParseNode* pNode );
+		void	CollectExpressions( CqParseNode* pNode, CqParseNode* pStatement, TqExpressionMap& available );
+		void	Retire( TqExpressionMap& available, const TqVarKey* pVar );
+
+		CqParseNode*	m_pCode;
+		TqInt	m_Position;
+		std::vector<SqVarUsage>	m_aUsage;
+		std::vector<CqParseNode*>	m_aDrops;
+		std::vector<bool>	m_aUniform;
+		SqCommonExpression	m_Best;
+};
+
+
+void CqDataflowOptimiser::Analyse()
+{
+	m_aUsage.assign( gLocalVars.size(), SqVarUsage() );
+	m_aDrops.clear();
+	m_aUniform.assign( gLocalVars.size(), false );
+	m_Position = 0;
+
+	// Local functions are expanded inline, and may refer to any variable in
+	// an enclosing scope.
+	for ( TqUint i = 0; i < gLocalFuncs.size(); i++ )
+	{
+		if ( gLocalFuncs[ i ].pDefNode() )
+			MarkAllAliased( gLocalFuncs[ i ].pDefNode() );
+		if ( gLocalFuncs[ i ].pArgs() )
+			MarkAllAliased( gLocalFuncs[ i ].pArgs() );
+	}
+	for ( TqUint i = 0; i < gLocalVars.size(); i++ )
+	{
+		if ( gLocalVars[ i ].fExtern() )
+		{
+			m_aUsage[ i ].m_fAliased = true;
+			MarkAliased( gLocalVars[ i ].vrExtern() );
+		}
+	}
+
+	Gather( m_pCode );
+}
+
+
+void CqDataflowOptimiser::Gather( CqParseNode* pNode )
+{
+	switch ( pNode->NodeType() )
+	{
+			case ParseNode_Variable:
+			case ParseNode_ArrayVariable:
+			{
+				SqVarRef ref = static_cast<CqParseNodeVariable*>( pNode ) ->VarRef();
+				if ( ref.m_Type == VarTypeLocal && ref.m_Index < m_aUsage.size() )
+				{
+					SqVarUsage& usage = m_aUsage[ ref.m_Index ];
+					if ( usage.m_Reads++ == 0 )
+						usage.m_FirstRead = m_Position;
+					usage.m_aReads.push_back( pNode );
+				}
+				break;
+			}
+			case ParseNode_VariableAssign:
+			case ParseNode_ArrayVariableAssign:
+			{
+				SqVarRef ref = static_cast<CqParseNodeVariable*>( pNode ) ->VarRef();
+				if ( ref.m_Type == VarTypeLocal && ref.m_Index < m_aUsage.size() )
+				{
+					SqVarUsage& usage = m_aUsage[ ref.m_Index ];
+					usage.m_aAssigns.push_back( static_cast<CqParseNodeAssign*>( pNode ) );
+					usage.m_aAssignPositions.push_back( m_Position );
+				}
+				break;
+			}
+			case ParseNode_MessagePassingFunction:
+			MarkAliased( static_cast<CqParseNodeCommFunction*>( pNode ) ->VarRef() );
+			break;
+			case ParseNode_FunctionCall:
+			{
+				// Local functions are passed their arguments by reference.
+				const IqFuncDef* pFunc = static_cast<CqParseNodeFunctionCall*>( pNode ) ->pFuncDef();
+				if ( pFunc == 0 || pFunc->fLocal() || HasOutputArguments( pFunc ) )
+					MarkArgumentsAliased( pNode );
+				break;
+			}
+			case ParseNode_UnresolvedCall:
+			MarkArgumentsAliased( pNode );
+			break;
+			case ParseNode_GatherConstruct:
+			// gather() writes its results to the variables in its argument list.
+			MarkAllAliased( pNode->pFirstChild() );
+			break;
+			case ParseNode_DiscardResult:
+			m_aDrops.push_back( pNode );
+			break;
+			default:
+			break;
+	}
+	m_Position++;
+
+	for ( CqParseNode* pChild = pNode->pFirstChild(); pChild != 0; pChild = pChild->pNext() )
+		Gather( pChild );
+}
+
+
+void CqDataflowOptimiser::MarkAliased( const SqVarRef& ref )
+{
+	if ( ref.m_Type == VarTypeLocal && ref.m_Index < m_aUsage.size() )
+		m_aUsage[ ref.m_Index ].m_fAliased = true;
+}
+
+
+void CqDataflowOptimiser::MarkAllAliased( CqParseNode* pNode )
+{
+	if ( pNode->IsVariableRef() )
+		MarkAliased( static_cast<CqParseNodeVariable*>( pNode ) ->VarRef() );
+	for ( CqParseNode* pChild = pNode->pFirstChild(); pChild != 0; pChild = pChild->pNext() )
+		MarkAllAliased( pChild );
+}
+
+
+void CqDataflowOptimiser::MarkArgumentsAliased( CqParseNode* pCall )
+{
+	for ( CqParseNode* pArg = pCall->pFirstChild(); pArg != 0; pArg = pArg->pNext() )
+	{
+		if ( pArg->IsVariableRef() )
+			MarkAliased( static_cast<CqParseNodeVariable*>( pArg ) ->VarRef() );
+	}
+}
+
+
+/// Only local, non-array variables which are private to the shader body are
+/// transformed.
+bool CqDataflowOptimiser::IsCandidate( TqUint index ) const
+{
+	const CqVarDef& var = gLocalVars[ index ];
+	return ( !m_aUsage[ index ].m_fAliased && !var.fExtern() &&
+	         ( var.Type() & ( Type_Param | Type_Output | Type_Array ) ) == 0 );
+}
+
+
+/// Determine if a statement is executed exactly once, on every shading point.
+bool CqDataflowOptimiser::IsUnconditional( CqParseNode* pNode ) const
+{
+	for ( CqParseNode* pParent = ParentOf( pNode ); pParent != 0; pParent = ParentOf( pParent ) )
+	{
+		if ( !IsStatementList( pParent ) )
+			return ( false );
+		if ( pParent == m_pCode )
+			return ( true );
+	}
+	return ( false );
+}
+
+
+/// Determine if an expression might have a different value on each shading
+/// point, taking variables found to be uniform so far into account.
+bool CqDataflowOptimiser::IsVarying( CqParseNode* pNode ) const
+{
+	switch ( pNode->NodeType() )
+	{
+			case ParseNode_Variable:
+			case ParseNode_ArrayVariable:
+			case ParseNode_VariableAssign:
+			case ParseNode_ArrayVariableAssign:
+			{
+				SqVarRef ref = static_cast<CqParseNodeVariable*>( pNode ) ->VarRef();
+				if ( ref.m_Type == VarTypeLocal && ref.m_Index < m_aUniform.size() && m_aUniform[ ref.m_Index ] )
+					break;
+				const CqVarDef* pVar = CqVarDef::GetVariablePtr( ref );
+				if ( pVar == 0 || ( pVar->Type() & Type_Uniform ) == 0 )
+					return ( true );
+				break;
+			}
+			case ParseNode_ConstantFloat:
+			case ParseNode_ConstantString:
+			return ( false );
+			case ParseNode_MathOp:
+			case ParseNode_RelationalOp:
+			case ParseNode_UnaryOp:
+			case ParseNode_LogicalOp:
+			case ParseNode_TypeCast:
+			case ParseNode_Triple:
+			case ParseNode_SixteenTuple:
+			case ParseNode_ConditionalExpression:
+			break;
+			case ParseNode_FunctionCall:
+			if ( !IsPureFunction( pNode ) )
+				return ( true );
+			break;
+			default:
+			return ( true );
+	}
+	for ( CqParseNode* pChild = pNode->pFirstChild(); pChild != 0; pChild = pChild->pNext() )
+	{
+		if ( IsVarying( pChild ) )
+			return ( true );
+	}
+	return ( false );
+}
+
+
+/// Determine if a node might be executed on only some of the shading points.
+bool CqDataflowOptimiser::InVaryingContext( CqParseNode* pNode ) const
+{
+	for ( CqParseNode* pChild = pNode; pChild != m_pCode; pChild = ParentOf( pChild ) )
+	{
+		CqParseNode* pParent = ParentOf( pChild );
+		if ( pParent == 0 )
+			break;
+		switch ( pParent->NodeType() )
+		{
+				case ParseNode_Conditional:
+				case ParseNode_ConditionalExpression:
+				if ( pChild != pParent->pFirstChild() && IsVarying( pParent->pFirstChild() ) )
+					return ( true );
+				break;
+				case ParseNode_WhileConstruct:
+				// A break or continue can stop the loop on some points only.
+				if ( IsVarying( pParent->pFirstChild() ) || ContainsLoopMod( pParent ) )
+					return ( true );
+				break;
+				case ParseNode_IlluminateConstruct:
+				case ParseNode_IlluminanceConstruct:
+				case ParseNode_SolarConstruct:
+				case ParseNode_GatherConstruct:
+				return ( true );
+				default:
+				break;
+		}
+	}
+	return ( false );
+}
+
+
+/// Replace reads of variables which are assigned a constant once, ahead of
+/// all their uses.
+bool CqDataflowOptimiser::PropagateConstants()
+{
+	bool fChanged = false;
+	for ( TqUint i = 0; i < m_aUsage.size(); i++ )
+	{
+		SqVarUsage& usage = m_aUsage[ i ];
+		if ( !IsCandidate( i ) || usage.m_aAssigns.size() != 1 || usage.m_Reads == 0 )
+			continue;
+		if ( ( gLocalVars[ i ].Type() & Type_Mask ) != Type_Float )
+			continue;
+
+		CqParseNodeAssign* pAssign = usage.m_aAssigns[ 0 ];
+		TqFloat value;
+		if ( !pAssign->fDiscardResult() || pAssign->pFirstChild() == 0 ||
+		        !pAssign->pFirstChild() ->FloatConstValue( value ) )
+			continue;
+		if ( usage.m_FirstRead < usage.m_aAssignPositions[ 0 ] || !IsUnconditional( pAssign ) )
+			continue;
+
+		for ( TqUint j = 0; j < usage.m_aReads.size(); j++ )
+			ReplaceNode( usage.m_aReads[ j ], new CqParseNodeFloatConst( value ) );
+		fChanged = true;
+	}
+	return ( fChanged );
+}
+
+
+/// Remove assignments to variables which are never read, and discarded
+/// results of expressions without side effects.
+bool CqDataflowOptimiser::RemoveDeadCode()
+{
+	bool fChanged = false;
+	for ( TqUint i = 0; i < m_aUsage.size(); i++ )
+	{
+		SqVarUsage& usage = m_aUsage[ i ];
+		if ( !IsCandidate( i ) || usage.m_Reads != 0 )
+			continue;
+		for ( TqUint j = 0; j < usage.m_aAssigns.size(); j++ )
+		{
+			CqParseNodeAssign* pAssign = usage.m_aAssigns[ j ];
+			if ( pAssign->fDiscardResult() && IsStatement( pAssign ) &&
+			        pAssign->pFirstChild() != 0 && IsPure( pAssign->pFirstChild() ) )
+			{
+				RemoveStatement( pAssign );
+				fChanged = true;
+			}
+		}
+	}
+	for ( TqUint i = 0; i < m_aDrops.size(); i++ )
+	{
+		CqParseNode* pDrop = m_aDrops[ i ];
+		if ( IsStatement( pDrop ) && pDrop->pFirstChild() != 0 && IsPure( pDrop->pFirstChild() ) )
+		{
+			RemoveStatement( pDrop );
+			fChanged = true;
+		}
+	}
+	return ( fChanged );
+}
+
+
+/// Find the expression repeated within a sequence of statements whose
+/// removal saves the most work, and evaluate it once into a new temporary.
+bool CqDataflowOptimiser::EliminateCommonSubexpression()
+{
+	m_Best = SqCommonExpression();
+	FindCommonExpressions( m_pCode );
+	// Reusing a value costs a copy into the temporary.
+	if ( m_Best.Saving() < 2 )
+		return ( false );
+
+	CqParseNode* pFirst = m_Best.m_aOccurrences[ 0 ];
+	std::ostringstream strName;
+	strName << "cse::" << gLocalVars.size();
+	CqVarDef def( ( pFirst->ResType() & Type_Mask ) | Type_Varying, strName.str().c_str() );
+	SqVarRef ref;
+	ref.m_Type = VarTypeLocal;
+	ref.m_Index = CqVarDef::AddVariable( def );
+
+	CqParseNode* pAssign = new CqParseNodeAssign( ref );
+	pAssign->SetPos( pFirst->LineNo(), pFirst->strFileName() );
+	pAssign->NoDup();
+	pAssign->InsertBefore( m_Best.m_aStatements[ 0 ] );
+	for ( TqUint i = 0; i < m_Best.m_aOccurrences.size(); i++ )
+	{
+		CqParseNode* pOccurrence = m_Best.m_aOccurrences[ i ];
+		CqParseNode* pRead = new CqParseNodeVariable( ref );
+		if ( i == 0 )
+		{
+			pRead->SetPos( pOccurrence->LineNo(), pOccurrence->strFileName() );
+			pOccurrence->ReplaceWith( pRead );
+			pAssign->AddLastChild( pOccurrence );
+		}
+		else
+			ReplaceNode( pOccurrence, pRead );
+	}
+	return ( true );
+}
+
+
+void CqDataflowOptimiser::FindCommonExpressions( CqParseNode* pNode )
+{
+	// Each sequence of statements is started from its outermost list.
+	if ( IsStatementList( pNode ) &&
+	        ( pNode == m_pCode || !IsStatementList( ParentOf( pNode ) ) ) )
+	{
+		std::vector<CqParseNode*> statements;
+		FlattenStatements( pNode, statements );
+
+		TqExpressionMap available;
+		for ( TqUint i = 0; i < statements.size(); i++ )
+		{
+			CqParseNode* pStatement = statements[ i ];
+			CqParseNode* pExpr = 0;
+			if ( pStatement->NodeType() == ParseNode_VariableAssign &&
+			        static_cast<CqParseNodeAssign*>( pStatement ) ->fDiscardResult() )
+				pExpr = pStatement->pFirstChild();
+			else if ( pStatement->NodeType() == ParseNode_DiscardResult )
+				pExpr = pStatement->pFirstChild();
+
+			if ( pExpr != 0 && IsPure( pExpr ) )
+			{
+				CollectExpressions( pExpr, pStatement, available );
+				if ( pStatement->NodeType() == ParseNode_VariableAssign )
+				{
+					TqVarKey var = VarKey( static_cast<CqParseNodeAssign*>( pStatement ) ->VarRef() );
+					Retire( available, &var );
+				}
+			}
+			else
+			{
+				std::set<TqVarKey> written;
+				if ( VariablesWritten( pStatement, written ) )
+				{
+					for ( std::set<TqVarKey>::iterator var = written.begin(); var != written.end(); ++var )
+						Retire( available, &*var );
+				}
+				else
+					Retire( available, 0 );
+			}
+		}
+		Retire( available, 0 );
+	}
+
+	for ( CqParseNode* pChild = pNode->pFirstChild(); pChild != 0; pChild = pChild->pNext() )
+		FindCommonExpressions( pChild );
+}
+
+
+void CqDataflowOptimiser::CollectExpressions( CqParseNode* pNode, CqParseNode* pStatement, TqExpressionMap& available )
+{
+	// Only the condition of a ?: is evaluated on every point.
+	if ( pNode->NodeType() == ParseNode_ConditionalExpression )
+	{
+		if ( pNode->pFirstChild() )
+			CollectExpressions( pNode->pFirstChild(), pStatement, available );
+	}
+	else
+	{
+		for ( CqParseNode* pChild = pNode->pFirstChild(); pChild != 0; pChild = pChild->pNext() )
+			CollectExpressions( pChild, pStatement, available );
+	}
+
+	TqInt cost = Cost( pNode );
+	TqInt type = pNode->ResType();
+	if ( cost == 0 || ( type & Type_Array ) != 0 )
+		return;
+	switch ( type & Type_Mask )
+	{
+			case Type_Float:
+			case Type_Point:
+			case Type_String:
+			case Type_Color:
+			case Type_Normal:
+			case Type_Vector:
+			case Type_Matrix:
+			break;
+			default:
+			return;
+	}
+
+	std::ostringstream key;
+	key.precision( 9 );
+	ExpressionKey( pNode, key );
+	SqCommonExpression& expr = available[ key.str() ];
+	if ( expr.m_aOccurrences.empty() )
+	{
+		expr.m_Cost = cost;
+		VariablesRead( pNode, expr.m_aReads );
+	}
+	expr.m_aOccurrences.push_back( pNode );
+	expr.m_aStatements.push_back( pStatement );
+}
+
+
+/// Stop tracking the expressions which read a variable, or all expressions
+/// if pVar is null, keeping the best candidate seen so far.
+void CqDataflowOptimiser::Retire( TqExpressionMap& available, const TqVarKey* pVar )
+{
+	TqExpressionMap::iterator expr = available.begin();
+	while ( expr != available.end() )
+	{
+		if ( pVar == 0 || expr->second.m_aReads.count( *pVar ) != 0 )
+		{
+			if ( expr->second.Saving() > m_Best.Saving() )
+				m_Best = expr->second;
+			available.erase( expr++ );
+		}
+		else
+			++expr;
+	}
+}
+
+
+/// Make local variables uniform when every value assigned to them is the
+/// same over all shading points.
+void CqDataflowOptimiser::DemoteToUniform()
+{
+	for ( TqUint i = 0; i < m_aUsage.size(); i++ )
+	{
+		m_aUniform[ i ] = IsCandidate( i ) && !m_aUsage[ i ].m_aAssigns.empty() &&
+		                  ( gLocalVars[ i ].Type() & Type_Varying ) != 0;
+	}
+
+	// Demoting one variable can allow others to follow, so repeat until
+	// nothing changes.
+	bool fChanged = true;
+	while ( fChanged )
+	{
+		fChanged = false;
+		for ( TqUint i = 0; i < m_aUsage.size(); i++ )
+		{
+			if ( !m_aUniform[ i ] )
+				continue;
+			const std::vector<CqParseNodeAssign*>& assigns = m_aUsage[ i ].m_aAssigns;
+			for ( TqUint j = 0; j < assigns.size(); j++ )
+			{
+				CqParseNode* pValue = assigns[ j ] ->pFirstChild();
+				if ( pValue == 0 || IsVarying( pValue ) || InVaryingContext( assigns[ j ] ) )
+				{
+					m_aUniform[ i ] = false;
+					fChanged = true;
+					break;
+				}
+			}
+		}
+	}
+
+	for ( TqUint i = 0; i < m_aUniform.size(); i++ )
+	{
+		if ( m_aUniform[ i ] )
+			gLocalVars[ i ].SetType( ( gLocalVars[ i ].Type() & ~Type_Varying ) | Type_Uniform );
+	}
+}
+
+} // unnamed namespace
+
+
+///---------------------------------------------------------------------
+/// OptimiseDataflow
+/// Run the dataflow optimisations over the body of the shader in the tree.
+
+void OptimiseDataflow( CqParseNode* pTree )
+{
+	// The shader is either the root of the tree, or follows the function
+	// definitions ahead of it in the file.
+	CqParseNode* pShader = pTree;
+	if ( pShader != 0 && pShader->NodeType() != ParseNode_Shader )
+	{
+		pShader = pTree->pFirstChild();
+		while ( pShader != 0 && pShader->NodeType() != ParseNode_Shader )
+			pShader = pShader->pNext();
+	}
+	if ( pShader == 0 || pShader->pFirstChild() == 0 ||
+	        pShader->pFirstChild() ->NodeType() != ParseNode_Base )
+		return;
+
+	CqParseNode* pCode = pShader->pFirstChild();
+	CqDataflowOptimiser optimiser( pCode );
+
+	// Constant propagation leaves dead stores behind and can make further
+	// expressions constant, so alternate the two until neither does anything.
+	bool fChanged = true;
+	while ( fChanged )
+	{
+		optimiser.Analyse();
+		fChanged = optimiser.PropagateConstants();
+		if ( fChanged )
+			pCode->Optimise();
+		optimiser.Analyse();
+		if ( optimiser.RemoveDeadCode() )
+			fChanged = true;
+	}
+
+	for ( ;; )
+	{
+		optimiser.Analyse();
+		if ( !optimiser.EliminateCommonSubexpression() )
+			break;
+	}
+
+	optimiser.Analyse();
+	optimiser.DemoteToUniform();
+}
+
+} // namespace Aqsis
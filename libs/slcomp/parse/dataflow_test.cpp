@@ -0,0 +1,303 @@
+// Aqsis
+// Copyright (C) 1997 - 2001, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+/** \file
+ *
+ * \brief Unit tests for constant folding and the dataflow optimisations.
+ *
+ * Each shader is compiled with and without the optimisations, and the
+ * generated VM code compared.
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+#include <aqsis/slcomp/icodegen.h>
+#include <aqsis/slcomp/libslparse.h>
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/auto_unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(dataflow_tests)
+
+using namespace Aqsis;
+
+namespace {
+
+// Compile a shader, returning the slx code generated for it.
+std::string compile(const std::string& source, bool optimise)
+{
+	SetOptimiseDataflow(optimise);
+	ResetParser();
+	std::istringstream in(source);
+	std::ostringstream errors;
+	bool parsed = Parse(in, "dataflow_test", errors);
+	SetOptimiseDataflow(true);
+	BOOST_REQUIRE_MESSAGE(parsed, errors.str());
+
+	const char* fileName = "aqsis_dataflow_test.slx";
+	CqCodeGenVM codeGenerator;
+	codeGenerator.OutputTree(GetParseTree(), fileName);
+	std::ifstream file(fileName);
+	std::string slx = std::string(std::istreambuf_iterator<char>(file),
+			std::istreambuf_iterator<char>());
+	file.close();
+	std::remove(fileName);
+	return slx;
+}
+
+// The part of a compiled shader between "segment <name>" and the next
+// segment.
+std::string segment(const std::string& slx, const std::string& name)
+{
+	std::string::size_type start = slx.find("segment " + name);
+	if(start == std::string::npos)
+		return "";
+	std::string::size_type end = slx.find("segment ", start + 1);
+	return slx.substr(start, end == std::string::npos ? end : end - start);
+}
+
+// Number of lines of a segment which are exactly the given instruction.
+int countInstructions(const std::string& code, const std::string& instruction)
+{
+	int count = 0;
+	std::istringstream lines(code);
+	std::string line;
+	while(std::getline(lines, line))
+	{
+		if(line == "\t" + instruction)
+			++count;
+	}
+	return count;
+}
+
+bool declares(const std::string& slx, const std::string& declaration)
+{
+	std::istringstream lines(segment(slx, "Data"));
+	std::string line;
+	while(std::getline(lines, line))
+	{
+		if(line == declaration)
+			return true;
+	}
+	return false;
+}
+
+} // unnamed namespace
+
+BOOST_AUTO_TEST_CASE(dataflow_constant_folding_test)
+{
+	std::string source =
+		"surface test()\n"
+		"{\n"
+		"	Ci = color(1 + 2 * 3 - 8 / 4 + -(1));\n"
+		"}\n";
+	std::string code = segment(compile(source, true), "Code");
+	BOOST_CHECK_EQUAL(countInstructions(code, "pushif 4"), 1);
+	BOOST_CHECK_EQUAL(countInstructions(code, "mulff"), 0);
+	BOOST_CHECK_EQUAL(countInstructions(code, "addff"), 0);
+	BOOST_CHECK_EQUAL(countInstructions(code, "divff"), 0);
+
+	std::string unoptimised = segment(compile(source, false), "Code");
+	BOOST_CHECK_EQUAL(countInstructions(unoptimised, "mulff"), 1);
+	BOOST_CHECK_EQUAL(countInstructions(unoptimised, "addff"), 2);
+	BOOST_CHECK_EQUAL(countInstructions(unoptimised, "divff"), 1);
+}
+
+BOOST_AUTO_TEST_CASE(dataflow_division_by_zero_test)
+{
+	// Left for the VM, which doesn't give the IEEE result.
+	std::string code = segment(compile(
+		"surface test()\n"
+		"{\n"
+		"	Ci = color(1 / 0);\n"
+		"}\n", true), "Code");
+	BOOST_CHECK_EQUAL(countInstructions(code, "divff"), 1);
+}
+
+BOOST_AUTO_TEST_CASE(dataflow_constant_condition_test)
+{
+	// Relations are folded with their operands in the order written.
+	std::string source =
+		"surface test()\n"
+		"{\n"
+		"	float x = 0;\n"
+		"	if(2 < 3)\n"
+		"		x = s;\n"
+		"	if(2 > 3)\n"
+		"		x = t;\n"
+		"	if(1 <= 1 && 2 >= 3)\n"
+		"		x = u;\n"
+		"	while(2 == 3)\n"
+		"		x = v;\n"
+		"	Ci = color(x);\n"
+		"}\n";
+	std::string code = segment(compile(source, true), "Code");
+	BOOST_CHECK_EQUAL(countInstructions(code, "pushv s"), 1);
+	BOOST_CHECK_EQUAL(countInstructions(code, "pushv t"), 0);
+	BOOST_CHECK_EQUAL(countInstructions(code, "pushv u"), 0);
+	BOOST_CHECK_EQUAL(countInstructions(code, "pushv v"), 0);
+	BOOST_CHECK(code.find("RS_JZ") == std::string::npos);
+
+	std::string unoptimised = segment(compile(source, false), "Code");
+	BOOST_CHECK_EQUAL(countInstructions(unoptimised, "pushv t"), 1);
+	BOOST_CHECK_EQUAL(countInstructions(unoptimised, "pushv u"), 1);
+	BOOST_CHECK_EQUAL(countInstructions(unoptimised, "pushv v"), 1);
+}
+
+BOOST_AUTO_TEST_CASE(dataflow_constant_propagation_test)
+{
+	std::string source =
+		"surface test()\n"
+		"{\n"
+		"	float k = 3;\n"
+		"	float a = k * 2 + 1;\n"
+		"	Ci = color(a * s);\n"
+		"}\n";
+	// k is replaced by its value everywhere, and its assignment removed;
+	// then a can be propagated and removed in turn.
+	std::string slx = compile(source, true);
+	std::string code = segment(slx, "Code");
+	BOOST_CHECK_EQUAL(countInstructions(code, "pushif 7"), 1);
+	BOOST_CHECK_EQUAL(countInstructions(code, "pop k"), 0);
+	BOOST_CHECK_EQUAL(countInstructions(code, "pop a"), 0);
+	BOOST_CHECK_EQUAL(countInstructions(code, "mulff"), 1);
+	BOOST_CHECK(!declares(slx, "varying  float k"));
+
+	std::string unoptimised = compile(source, false);
+	BOOST_CHECK_EQUAL(countInstructions(segment(unoptimised, "Code"), "pop k"), 1);
+	BOOST_CHECK(declares(unoptimised, "varying  float k"));
+}
+
+BOOST_AUTO_TEST_CASE(dataflow_conditional_assignment_test)
+{
+	// A value assigned under a condition isn't propagated.
+	std::string code = segment(compile(
+		"surface test()\n"
+		"{\n"
+		"	float k;\n"
+		"	if(s > 0.5)\n"
+		"		k = 3;\n"
+		"	Ci = color(k);\n"
+		"}\n", true), "Code");
+	BOOST_CHECK_EQUAL(countInstructions(code, "pop k"), 1);
+	BOOST_CHECK_EQUAL(countInstructions(code, "pushv k"), 1);
+}
+
+BOOST_AUTO_TEST_CASE(dataflow_dead_code_test)
+{
+	std::string source =
+		"surface test()\n"
+		"{\n"
+		"	float unused = s * t;\n"
+		"	float used = sin(s);\n"
+		"	cos(t);\n"
+		"	Ci = color(used);\n"
+		"}\n";
+	std::string code = segment(compile(source, true), "Code");
+	BOOST_CHECK_EQUAL(countInstructions(code, "pop unused"), 0);
+	BOOST_CHECK_EQUAL(countInstructions(code, "mulff"), 0);
+	BOOST_CHECK_EQUAL(countInstructions(code, "cos"), 0);
+	BOOST_CHECK_EQUAL(countInstructions(code, "sin"), 1);
+
+	std::string unoptimised = segment(compile(source, false), "Code");
+	BOOST_CHECK_EQUAL(countInstructions(unoptimised, "pop unused"), 1);
+	BOOST_CHECK_EQUAL(countInstructions(unoptimised, "mulff"), 1);
+	BOOST_CHECK_EQUAL(countInstructions(unoptimised, "cos"), 1);
+}
+
+BOOST_AUTO_TEST_CASE(dataflow_side_effects_kept_test)
+{
+	// Calls which aren't known to be pure are kept even if their result
+	// isn't used.
+	std::string code = segment(compile(
+		"surface test()\n"
+		"{\n"
+		"	float unused = random();\n"
+		"	printf(\"%f\\n\", s);\n"
+		"	Ci = color(s);\n"
+		"}\n", true), "Code");
+	BOOST_CHECK_EQUAL(countInstructions(code, "frandom"), 1);
+	BOOST_CHECK_EQUAL(countInstructions(code, "pop unused"), 1);
+	BOOST_CHECK_EQUAL(countInstructions(code, "printf"), 1);
+}
+
+BOOST_AUTO_TEST_CASE(dataflow_common_subexpression_test)
+{
+	std::string source =
+		"surface test()\n"
+		"{\n"
+		"	float a = (s * t + 1) * 2;\n"
+		"	float b = (s * t + 1) * 3;\n"
+		"	Ci = color(a + b);\n"
+		"}\n";
+	std::string code = segment(compile(source, true), "Code");
+	BOOST_CHECK_EQUAL(countInstructions(code, "mulff"), 3);
+	BOOST_CHECK_EQUAL(countInstructions(code, "addff"), 2);
+
+	std::string unoptimised = segment(compile(source, false), "Code");
+	BOOST_CHECK_EQUAL(countInstructions(unoptimised, "mulff"), 4);
+	BOOST_CHECK_EQUAL(countInstructions(unoptimised, "addff"), 3);
+}
+
+BOOST_AUTO_TEST_CASE(dataflow_common_subexpression_invalidated_test)
+{
+	// The expression must be evaluated again once a variable it reads has
+	// been written.
+	std::string code = segment(compile(
+		"surface test()\n"
+		"{\n"
+		"	float a = (s * t + 1) * 2;\n"
+		"	s = 0.5;\n"
+		"	float b = (s * t + 1) * 3;\n"
+		"	Ci = color(a + b);\n"
+		"}\n", true), "Code");
+	BOOST_CHECK_EQUAL(countInstructions(code, "mulff"), 4);
+	BOOST_CHECK_EQUAL(countInstructions(code, "addff"), 3);
+}
+
+BOOST_AUTO_TEST_CASE(dataflow_uniform_demotion_test)
+{
+	std::string source =
+		"surface test(float Kd = 1;)\n"
+		"{\n"
+		"	float u = Kd * 2;\n"
+		"	float w = u + Kd;\n"
+		"	float v = Kd;\n"
+		"	if(s > 0.5)\n"
+		"		v = 2;\n"
+		"	float x = s;\n"
+		"	Ci = color(u * w * v * x);\n"
+		"}\n";
+	std::string slx = compile(source, true);
+	BOOST_CHECK(declares(slx, "uniform  float u"));
+	BOOST_CHECK(declares(slx, "uniform  float w"));
+	// Assigned under a varying condition, or from a varying value.
+	BOOST_CHECK(declares(slx, "varying  float v"));
+	BOOST_CHECK(declares(slx, "varying  float x"));
+
+	std::string unoptimised = compile(source, false);
+	BOOST_CHECK(declares(unoptimised, "varying  float u"));
+	BOOST_CHECK(declares(unoptimised, "varying  float w"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
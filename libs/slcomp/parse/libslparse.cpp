@@ -49,6 +49,7 @@ std::istream* ParseInputStream = &std::cin;
 CqString ParseStreamName = "stdin";
 std::ostream* ParseErrorStream = &Aqsis::log();
 TqInt ParseLineNumber;
+bool ParseOptimiseDataflow = true;
 
 bool Parse( std::istream& InputStream, const std::string& StreamName, std::ostream& ErrorStream )
 {
@@ -81,6 +82,8 @@ bool Parse( std::istream& InputStream, const std::string& StreamName, std::ostre
 		return false;
 	}
 	Optimise();
+	if ( ParseOptimiseDataflow )
+		OptimiseDataflow( ParseTreePointer );
 
 	std::vector<CqVarDef>::iterator iv;
 	for ( iv = gLocalVars.begin(); iv != gLocalVars.end(); iv++ )
@@ -90,6 +93,11 @@ bool Parse( std::istream& InputStream, const std::string& StreamName, std::ostre
 	return true;
 }
 
+void SetOptimiseDataflow( bool enable )
+{
+	ParseOptimiseDataflow = enable;
+}
+
 void ResetParser()
 {
 	ParseInputStream = &std::cin;
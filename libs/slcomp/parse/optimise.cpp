@@ -7,6 +7,9 @@
 ////---------------------------------------------------------------------
 
 #include	<aqsis/aqsis.h>
+
+#include	<cstring>
+
 #include	"parsenode.h"
 
 namespace Aqsis {
@@ -30,14 +33,88 @@ bool CqParseNode::Optimise()
 }
 
 
+///---------------------------------------------------------------------
+/// CqParseNode::FloatConstValue
+/// Get the value of this node if it is a float constant.
+
+bool CqParseNode::FloatConstValue( TqFloat& Value ) const
+{
+	if ( NodeType() != IqParseNodeConstantFloat::m_ID )
+		return ( false );
+	Value = static_cast<const CqParseNodeFloatConst*>( this ) ->Value();
+	return ( true );
+}
+
+
+///---------------------------------------------------------------------
+/// FoldToConstant
+/// Replace an operator node with the constant it evaluates to.
+
+static bool FoldToConstant( CqParseNode* pNode, TqFloat Value )
+{
+	CqParseNode* pConst = new CqParseNodeFloatConst( Value );
+	pConst->SetPos( pNode->LineNo(), pNode->strFileName() );
+	pNode->ReplaceWith( pConst );
+	pNode->DeleteChildren();
+	delete( pNode );
+	return ( true );
+}
+
+
+///---------------------------------------------------------------------
+/// FloatConstOperands
+/// Get the values of the operands of a node, if they are all float constants
+/// and constant folding is enabled.
+
+static bool FloatConstOperands( const CqParseNode* pNode, TqFloat* pValues, TqInt Count )
+{
+	if ( !ParseOptimiseDataflow )
+		return ( false );
+	const CqParseNode* pChild = pNode->pFirstChild();
+	for ( TqInt i = 0; i < Count; i++ )
+	{
+		if ( pChild == 0 || !pChild->FloatConstValue( pValues[ i ] ) )
+			return ( false );
+		pChild = pChild->pNext();
+	}
+	return ( pChild == 0 );
+}
+
+
 ///---------------------------------------------------------------------
 /// CqParseNodeFunction:Call:Optimise
 /// Optimise a function definition, basically optimise the parameters.
+/// Arithmetic operators are calls to the standard operator functions once
+/// typechecked, so fold those on float constants here.
 
 bool CqParseNodeFunctionCall::Optimise()
 {
 	CqParseNode::Optimise();
 
+	const IqFuncDef* pFunc = pFuncDef();
+	if ( pFunc == 0 || pFunc->fLocal() )
+		return ( false );
+	const char* strVMName = pFunc->strVMName();
+
+	TqFloat aValues[ 2 ];
+	if ( std::strcmp( strVMName, "negf" ) == 0 )
+	{
+		if ( !FloatConstOperands( this, aValues, 1 ) )
+			return ( false );
+		return ( FoldToConstant( this, -aValues[ 0 ] ) );
+	}
+
+	if ( !FloatConstOperands( this, aValues, 2 ) )
+		return ( false );
+	if ( std::strcmp( strVMName, "addff" ) == 0 )
+		return ( FoldToConstant( this, aValues[ 0 ] + aValues[ 1 ] ) );
+	if ( std::strcmp( strVMName, "subff" ) == 0 )
+		return ( FoldToConstant( this, aValues[ 0 ] - aValues[ 1 ] ) );
+	if ( std::strcmp( strVMName, "mulff" ) == 0 )
+		return ( FoldToConstant( this, aValues[ 0 ] * aValues[ 1 ] ) );
+	// Leave division by zero for the VM to deal with at runtime.
+	if ( std::strcmp( strVMName, "divff" ) == 0 && aValues[ 1 ] != 0.0f )
+		return ( FoldToConstant( this, aValues[ 0 ] / aValues[ 1 ] ) );
 	return ( false );
 }
 
@@ -117,5 +194,145 @@ bool CqParseNodeCast::Optimise()
 	return ( false );
 }
 
+
+///---------------------------------------------------------------------
+/// CqParseNodeRelOp::Optimise
+/// Fold comparisons of constant operands.
+
+bool CqParseNodeRelOp::Optimise()
+{
+	CqParseNode::Optimise();
+
+	// The parser adds the operands to a relation in reverse, right hand
+	// side first.
+	TqFloat aOperands[ 2 ];
+	if ( !FloatConstOperands( this, aOperands, 2 ) )
+		return ( false );
+	TqFloat aValues[ 2 ] = { aOperands[ 1 ], aOperands[ 0 ] };
+
+	bool fResult;
+	switch ( m_Operator )
+	{
+			case Op_EQ:
+			fResult = aValues[ 0 ] == aValues[ 1 ];
+			break;
+			case Op_NE:
+			fResult = aValues[ 0 ] != aValues[ 1 ];
+			break;
+			case Op_L:
+			fResult = aValues[ 0 ] < aValues[ 1 ];
+			break;
+			case Op_G:
+			fResult = aValues[ 0 ] > aValues[ 1 ];
+			break;
+			case Op_GE:
+			fResult = aValues[ 0 ] >= aValues[ 1 ];
+			break;
+			case Op_LE:
+			fResult = aValues[ 0 ] <= aValues[ 1 ];
+			break;
+			default:
+			return ( false );
+	}
+	return ( FoldToConstant( this, fResult ? 1.0f : 0.0f ) );
+}
+
+
+///---------------------------------------------------------------------
+/// CqParseNodeUnaryOp::Optimise
+/// Fold unary operations on a constant operand.
+
+bool CqParseNodeUnaryOp::Optimise()
+{
+	CqParseNode::Optimise();
+
+	TqFloat Value;
+	if ( !FloatConstOperands( this, &Value, 1 ) )
+		return ( false );
+
+	switch ( m_Operator )
+	{
+			case Op_Plus:
+			return ( FoldToConstant( this, Value ) );
+			case Op_Neg:
+			return ( FoldToConstant( this, -Value ) );
+			case Op_LogicalNot:
+			return ( FoldToConstant( this, Value == 0.0f ? 1.0f : 0.0f ) );
+			default:
+			return ( false );
+	}
+}
+
+
+///---------------------------------------------------------------------
+/// CqParseNodeLogicalOp::Optimise
+/// Fold logical operations on constant operands.
+
+bool CqParseNodeLogicalOp::Optimise()
+{
+	CqParseNode::Optimise();
+
+	TqFloat aValues[ 2 ];
+	if ( !FloatConstOperands( this, aValues, 2 ) )
+		return ( false );
+
+	bool fResult;
+	switch ( m_Operator )
+	{
+			case Op_LogAnd:
+			fResult = aValues[ 0 ] != 0.0f && aValues[ 1 ] != 0.0f;
+			break;
+			case Op_LogOr:
+			fResult = aValues[ 0 ] != 0.0f || aValues[ 1 ] != 0.0f;
+			break;
+			default:
+			return ( false );
+	}
+	return ( FoldToConstant( this, fResult ? 1.0f : 0.0f ) );
+}
+
+
+///---------------------------------------------------------------------
+/// CqParseNodeConditional::Optimise
+/// Replace a conditional on a constant with the branch it selects.
+
+bool CqParseNodeConditional::Optimise()
+{
+	CqParseNode::Optimise();
+
+	TqFloat Value;
+	if ( !ParseOptimiseDataflow || m_pChild == 0 || !m_pChild->FloatConstValue( Value ) )
+		return ( false );
+
+	CqParseNode* pBranch = m_pChild->pNext();
+	if ( Value == 0.0f && pBranch != 0 )
+		pBranch = pBranch->pNext();
+	if ( pBranch == 0 )
+		pBranch = new CqParseNode();
+	ReplaceWith( pBranch );
+	DeleteChildren();
+	delete( this );
+	return ( true );
+}
+
+
+///---------------------------------------------------------------------
+/// CqParseNodeWhileConstruct::Optimise
+/// Remove a loop whose condition is always false.
+
+bool CqParseNodeWhileConstruct::Optimise()
+{
+	CqParseNode::Optimise();
+
+	TqFloat Value;
+	if ( !ParseOptimiseDataflow || m_pChild == 0 || !m_pChild->FloatConstValue( Value ) || Value != 0.0f )
+		return ( false );
+
+	ReplaceWith( new CqParseNode() );
+	DeleteChildren();
+	delete( this );
+	return ( true );
+}
+
 } // namespace Aqsis
 //---------------------------------------------------------------------
@@ -177,6 +177,33 @@ class CqParseNode : public CqListEntry<CqParseNode>, public IqParseNode
 			CqListEntry<CqParseNode>::UnLink();
 			m_pParent = 0;
 		}
+		/// Link this node into the tree as the sibling before pN.
+		void	InsertBefore( CqParseNode* pN )
+		{
+			UnLink();
+			if ( pN->pPrevious() != 0 )
+				LinkAfter( pN->pPrevious() );
+			else if ( pN->m_pParent != 0 )
+				pN->m_pParent->AddFirstChild( this );
+		}
+		/// Put pN in the place of this node in the tree, leaving this node unlinked.
+		void	ReplaceWith( CqParseNode* pN )
+		{
+			pN->InsertBefore( this );
+			UnLink();
+		}
+		/// Delete all children of this node, and their children in turn.
+		void	DeleteChildren()
+		{
+			while ( m_pChild != 0 )
+			{
+				CqParseNode* pChild = m_pChild;
+				m_pChild = pChild->pNext();
+				pChild->m_pParent = 0;
+				pChild->DeleteChildren();
+				delete( pChild );
+			}
+		}
 		void	ClearChild()
 		{
 			m_pChild = 0;
@@ -231,6 +258,7 @@ class CqParseNode : public CqListEntry<CqParseNode>, public IqParseNode
 		}
 
 		CqParseNodeShader* pShaderNode();
+		bool	FloatConstValue( TqFloat& Value ) const;
 
 		static	const char*	TypeIdentifier( int Type );
 		static	TqInt	TypeFromIdentifier( char Id );
@@ -914,6 +942,7 @@ class CqParseNodeRelOp : public CqParseNodeOp, public IqParseNodeRelationalOp
 
 
 
+		virtual	bool	Optimise();
 		virtual	CqParseNode*	Clone( CqParseNode* pParent = 0 )
 		{
 			CqParseNodeRelOp * pNew = new CqParseNodeRelOp( *this );
@@ -974,6 +1003,7 @@ class CqParseNodeUnaryOp : public CqParseNodeOp, public IqParseNodeUnaryOp
 
 
 		virtual	TqInt	TypeCheck( TqInt* pTypes, TqInt Count, bool& needsCast, bool CheckOnly );
+		virtual	bool	Optimise();
 		virtual	CqParseNode*	Clone( CqParseNode* pParent = 0 )
 		{
 			CqParseNodeUnaryOp * pNew = new CqParseNodeUnaryOp( *this );
@@ -1037,6 +1067,7 @@ class CqParseNodeLogicalOp : public CqParseNodeOp, public IqParseNodeLogicalOp
 
 
 
+		virtual	bool	Optimise();
 		virtual	CqParseNode*	Clone( CqParseNode* pParent = 0 )
 		{
 			CqParseNodeLogicalOp * pNew = new CqParseNodeLogicalOp( *this );
@@ -1284,6 +1315,7 @@ class CqParseNodeWhileConstruct : public CqParseNode, public IqParseNodeWhileCon
 		}
 
 
+		virtual	bool	Optimise();
 		virtual	CqParseNode*	Clone( CqParseNode* pParent = 0 )
 		{
 			CqParseNodeWhileConstruct * pNew = new CqParseNodeWhileConstruct( *this );
@@ -1610,6 +1642,7 @@ class CqParseNodeConditional : public CqParseNode, public IqParseNodeConditional
 		}
 
 
+		virtual	bool	Optimise();
 		virtual	CqParseNode*	Clone( CqParseNode* pParent = 0 )
 		{
 			CqParseNodeConditional * pNew = new CqParseNodeConditional( *this );
@@ -2062,6 +2095,11 @@ class CqParseNodeTextureNameWithChannel : public CqParseNode
 };
 
 
+/// Run the dataflow optimisations over the body of the shader in a parse tree.
+void	OptimiseDataflow( CqParseNode* pTree );
+/// Whether constant folding and the dataflow optimisations are enabled.
+extern bool ParseOptimiseDataflow;
+
 //-----------------------------------------------------------------------
 
 } // namespace Aqsis
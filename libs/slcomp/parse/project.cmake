@@ -35,6 +35,7 @@ endif()
 
 # Create source list variables
 set(parse_srcs
+	dataflow.cpp
 	funcdef.cpp
 	libslparse.cpp
 	optimise.cpp
@@ -54,5 +55,10 @@ set(parse_hdrs
 set(parse_hdrs ${parse_hdrs} ${_parser_hpp_name})
 make_absolute(parse_hdrs ${parse_SOURCE_DIR})
 
+set(parse_test_srcs
+	dataflow_test.cpp
+)
+make_absolute(parse_test_srcs ${parse_SOURCE_DIR})
+
 include_directories(${parse_SOURCE_DIR})
 include_directories(${parse_BINARY_DIR})
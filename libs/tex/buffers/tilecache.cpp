@@ -0,0 +1,175 @@
+// Aqsis
+// Copyright (C) 2001, Paul C. Gregory and the other authors and contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the software's owners nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// (This is the New BSD license)
+
+/** \file
+ *
+ * \brief Implementation of the global texture tile cache.
+ */
+
+#include <aqsis/tex/buffers/tilecache.h>
+
+namespace Aqsis {
+
+//------------------------------------------------------------------------------
+// CqCachedTile
+
+namespace {
+
+/// Guards the reference counts of all tiles.  This is always taken after the
+/// cache mutex when both are needed, since evictions drop references.
+boost::mutex& tileRefMutex()
+{
+	static boost::mutex mutex;
+	return mutex;
+}
+
+} // unnamed namespace
+
+CqCachedTile::~CqCachedTile()
+{ }
+
+TqUint CqCachedTile::refCount() const
+{
+	boost::mutex::scoped_lock lock(tileRefMutex());
+	return m_refCount;
+}
+
+void intrusive_ptr_add_ref(const CqCachedTile* tile)
+{
+	boost::mutex::scoped_lock lock(tileRefMutex());
+	++tile->m_refCount;
+}
+
+void intrusive_ptr_release(const CqCachedTile* tile)
+{
+	bool lastRef = false;
+	{
+		boost::mutex::scoped_lock lock(tileRefMutex());
+		lastRef = --tile->m_refCount == 0;
+	}
+	if(lastRef)
+		delete tile;
+}
+
+//------------------------------------------------------------------------------
+// CqTileCache
+
+const std::size_t CqTileCache::defaultMaxMemory = std::size_t(8192)*1024;
+
+CqTileCache& CqTileCache::instance()
+{
+	static CqTileCache cache;
+	return cache;
+}
+
+CqTileCache::CqTileCache()
+	: m_head(0),
+	m_tail(0),
+	m_maxMemory(defaultMaxMemory),
+	m_stats(),
+	m_mutex()
+{ }
+
+void CqTileCache::setMaxMemory(std::size_t maxMemory)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_maxMemory = maxMemory;
+	evictToLimit(0);
+}
+
+std::size_t CqTileCache::maxMemory() const
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_maxMemory;
+}
+
+void CqTileCache::insert(CqCachedTile* tile, IqTileCacheOwner* owner,
+		TqInt slot, std::size_t memSize)
+{
+	assert(!tile->isCached());
+	tile->m_owner = owner;
+	tile->m_slot = slot;
+	tile->m_memSize = memSize;
+	linkFront(tile);
+	++m_stats.misses;
+	m_stats.memoryUsed += memSize;
+	if(m_stats.memoryUsed > m_stats.peakMemoryUsed)
+		m_stats.peakMemoryUsed = m_stats.memoryUsed;
+	// Don't throw away the tile we've just been asked to hold, even though
+	// only the owner refers to it so far.
+	evictToLimit(tile);
+}
+
+SqTileCacheStats CqTileCache::stats() const
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_stats;
+}
+
+void CqTileCache::remove(CqCachedTile* tile)
+{
+	if(!tile->isCached())
+		return;
+	unlink(tile);
+	m_stats.memoryUsed -= tile->m_memSize;
+	tile->m_owner = 0;
+}
+
+void CqTileCache::resetStats()
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_stats.hits = 0;
+	m_stats.misses = 0;
+	m_stats.evictions = 0;
+	m_stats.peakMemoryUsed = m_stats.memoryUsed;
+}
+
+void CqTileCache::evictToLimit(const CqCachedTile* keep)
+{
+	CqCachedTile* tile = m_tail;
+	while(tile && m_stats.memoryUsed > m_maxMemory)
+	{
+		CqCachedTile* next = tile->m_lruPrev;
+		// A tile referenced by anything except its owner is in use, and
+		// hence pinned.
+		if(tile != keep && tile->refCount() == 1)
+		{
+			IqTileCacheOwner* owner = tile->m_owner;
+			TqInt slot = tile->m_slot;
+			remove(tile);
+			++m_stats.evictions;
+			// Dropping the owner's reference frees the tile.
+			owner->evictTile(slot);
+		}
+		tile = next;
+	}
+}
+
+} // namespace Aqsis
@@ -0,0 +1,204 @@
+// Aqsis
+// Copyright (C) 2001, Paul C. Gregory and the other authors and contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the software's owners nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// (This is the New BSD license)
+
+/** \file
+ *
+ * \brief Unit tests for the texture tile cache
+ */
+
+#include <aqsis/tex/buffers/tilecache.h>
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/auto_unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(tilecache_tests)
+
+using namespace Aqsis;
+
+namespace {
+
+struct TestTile : public CqCachedTile
+{ };
+
+typedef boost::intrusive_ptr<TestTile> TestTilePtr;
+
+// Minimal tile container which registers its tiles with a cache.
+struct TestTileOwner : public IqTileCacheOwner
+{
+	CqTileCache& cache;
+	std::vector<TestTilePtr> tiles;
+
+	TestTileOwner(CqTileCache& cache, TqInt numTiles)
+		: cache(cache),
+		tiles(numTiles)
+	{ }
+	~TestTileOwner()
+	{
+		boost::mutex::scoped_lock lock(cache.mutex());
+		for(TqInt i = 0; i < static_cast<TqInt>(tiles.size()); ++i)
+			if(tiles[i])
+				cache.remove(tiles[i].get());
+	}
+	TestTilePtr getTile(TqInt i)
+	{
+		boost::mutex::scoped_lock lock(cache.mutex());
+		if(tiles[i])
+			cache.touch(tiles[i].get());
+		else
+		{
+			tiles[i] = new TestTile();
+			cache.insert(tiles[i].get(), this, i, 100);
+		}
+		return tiles[i];
+	}
+	virtual void evictTile(TqInt slot)
+	{
+		tiles[slot].reset();
+	}
+};
+
+// Read tiles from an owner in a pattern which depends on the seed, holding
+// on to some of them for a while.
+void readTiles(TestTileOwner& owner, TqInt seed)
+{
+	TqInt numTiles = owner.tiles.size();
+	std::vector<TestTilePtr> held;
+	for(TqInt i = 0; i < 20000; ++i)
+	{
+		TestTilePtr tile = owner.getTile((i*seed + i/7) % numTiles);
+		if(i % 5 == 0)
+			held.push_back(tile);
+		if(held.size() > 3)
+			held.erase(held.begin());
+	}
+}
+
+} // unnamed namespace
+
+BOOST_AUTO_TEST_CASE(CqTileCache_lru_eviction_test)
+{
+	CqTileCache cache;
+	cache.setMaxMemory(250);
+	TestTileOwner owner(cache, 3);
+
+	owner.getTile(0);
+	owner.getTile(1);
+	// Tile 0 becomes most recently used, so tile 1 goes when 2 is loaded.
+	owner.getTile(0);
+	owner.getTile(2);
+
+	BOOST_CHECK(owner.tiles[0]);
+	BOOST_CHECK(!owner.tiles[1]);
+	BOOST_CHECK(owner.tiles[2]);
+
+	const SqTileCacheStats& stats = cache.stats();
+	BOOST_CHECK_EQUAL(stats.hits, 1U);
+	BOOST_CHECK_EQUAL(stats.misses, 3U);
+	BOOST_CHECK_EQUAL(stats.evictions, 1U);
+	BOOST_CHECK_EQUAL(stats.memoryUsed, 200U);
+	BOOST_CHECK_EQUAL(stats.peakMemoryUsed, 300U);
+}
+
+BOOST_AUTO_TEST_CASE(CqTileCache_pinning_test)
+{
+	CqTileCache cache;
+	cache.setMaxMemory(150);
+	TestTileOwner owner(cache, 3);
+
+	// Holding a reference to tile 0 pins it, so tile 1 is evicted instead.
+	TestTilePtr pinned = owner.getTile(0);
+	owner.getTile(1);
+	owner.getTile(2);
+
+	BOOST_CHECK(owner.tiles[0]);
+	BOOST_CHECK(!owner.tiles[1]);
+	BOOST_CHECK(owner.tiles[2]);
+	// Both remaining tiles are needed, so the limit is exceeded for now.
+	BOOST_CHECK_EQUAL(cache.stats().memoryUsed, 200U);
+
+	// Once unpinned, lowering the limit evicts the old tile.
+	pinned.reset();
+	cache.setMaxMemory(100);
+	BOOST_CHECK(!owner.tiles[0]);
+	BOOST_CHECK(owner.tiles[2]);
+	BOOST_CHECK_EQUAL(cache.stats().evictions, 2U);
+}
+
+BOOST_AUTO_TEST_CASE(CqTileCache_remove_test)
+{
+	CqTileCache cache;
+	{
+		TestTileOwner owner(cache, 2);
+		owner.getTile(0);
+		owner.getTile(1);
+		BOOST_CHECK_EQUAL(cache.stats().memoryUsed, 200U);
+	}
+	BOOST_CHECK_EQUAL(cache.stats().memoryUsed, 0U);
+	BOOST_CHECK_EQUAL(cache.stats().evictions, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(CqTileCache_threaded_test)
+{
+	CqTileCache cache;
+	cache.setMaxMemory(1000);
+	TestTileOwner owner1(cache, 50);
+	TestTileOwner owner2(cache, 50);
+	{
+		boost::thread_group threads;
+		for(TqInt i = 0; i < 4; ++i)
+		{
+			threads.create_thread(boost::bind(&readTiles,
+						boost::ref(i % 2 ? owner1 : owner2), 2*i + 3));
+		}
+		threads.join_all();
+	}
+	// Nothing is pinned once the threads have finished, so the cache can be
+	// brought back under its limit, and the memory count matches the tiles
+	// held.
+	cache.setMaxMemory(1000);
+	SqTileCacheStats stats = cache.stats();
+	BOOST_CHECK(stats.memoryUsed <= 1000U);
+	std::size_t numHeld = 0;
+	for(TqInt i = 0; i < 50; ++i)
+	{
+		numHeld += owner1.tiles[i] ? 1 : 0;
+		numHeld += owner2.tiles[i] ? 1 : 0;
+	}
+	BOOST_CHECK_EQUAL(stats.memoryUsed, 100*numHeld);
+	BOOST_CHECK_EQUAL(stats.hits + stats.misses, 80000U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
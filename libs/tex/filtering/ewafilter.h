@@ -42,6 +42,10 @@
 
 #include <vector>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <aqsis/math/math.h>
 #include <aqsis/tex/buffers/filtersupport.h>
 #include <aqsis/math/matrix2d.h>
@@ -93,6 +97,31 @@ class CqEwaFilter
 		 *            don't have to)
 		 */
 		TqFloat operator()(TqFloat x, TqFloat y) const;
+		/** \brief Narrow a span of a raster row to the part inside the cutoff.
+		 *
+		 * The span [startX,endX) is clipped to a range which covers all the
+		 * pixels of row y with nonzero weight.  The clipped range is
+		 * conservative, and may still contain a few pixels with zero weight
+		 * at either end.
+		 *
+		 * \param y - raster row
+		 * \param startX, endX - span to be clipped.
+		 * \return false if the clipped span is empty.
+		 */
+		bool rowSpan(TqInt y, TqInt& startX, TqInt& endX) const;
+		/** \brief Evaluate the filter at consecutive pixels along a row.
+		 *
+		 * This gives the same weights as operator() at the positions
+		 * (startX,y), (startX+1,y), ..., (endX-1,y).  With SSE2 the weights
+		 * are computed four at a time; otherwise the quadratic form is
+		 * evaluated incrementally by forward differences, so each weight
+		 * costs two additions and a table lookup.
+		 *
+		 * \param y - raster row
+		 * \param startX, endX - span of pixels to evaluate the filter at.
+		 * \param weights - output array of length endX-startX.
+		 */
+		void rowWeights(TqInt y, TqInt startX, TqInt endX, TqFloat* weights) const;
 		/// Get the extent of the filter in integer raster coordinates.
 		SqFilterSupport support() const;
 
@@ -233,6 +262,8 @@ class CqEwaFilterFactory
 
 		/// Get the width of the filter along the minor axis of the ellipse
 		TqFloat minorAxisWidth() const;
+		/// Get the filter center in base texture raster coordinates.
+		const CqVector2D& filterCenter() const;
 	private:
 		/** \brief Compute and cache EWA filter coefficients
 		 *
@@ -359,6 +390,11 @@ inline TqFloat CqEwaFilterFactory::minorAxisWidth() const
 	return m_minorAxisWidth;
 }
 
+inline const CqVector2D& CqEwaFilterFactory::filterCenter() const
+{
+	return m_filterCenter;
+}
+
 
 //------------------------------------------------------------------------------
 namespace detail {
@@ -410,6 +446,30 @@ class CqNegExpTable
 			TqFloat interp = xRescaled - index;
 			return (1-interp)*m_values[index] + interp*m_values[index+1];
 		}
+#ifdef __SSE2__
+		/// Look up approximate exp(-x) for four values x >= 0 at once.
+		__m128 operator()(__m128 x) const
+		{
+			__m128 inRange = _mm_cmplt_ps(x, _mm_set1_ps(m_rangeMax));
+			// Out of range values look up the first entry, and are zeroed
+			// afterward.
+			__m128 xRescaled = _mm_mul_ps(_mm_and_ps(x, inRange),
+					_mm_set1_ps(m_invRes));
+			// x >= 0, so truncation is the same as lfloor().
+			__m128i index = _mm_cvttps_epi32(xRescaled);
+			__m128 interp = _mm_sub_ps(xRescaled, _mm_cvtepi32_ps(index));
+			// The table lookups themselves have to be done one at a time.
+			TqInt i[4];
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(i), index);
+			const TqFloat* v = &m_values[0];
+			__m128 v0 = _mm_setr_ps(v[i[0]], v[i[1]], v[i[2]], v[i[3]]);
+			__m128 v1 = _mm_setr_ps(v[i[0]+1], v[i[1]+1], v[i[2]+1], v[i[3]+1]);
+			__m128 result = _mm_add_ps(
+					_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(1), interp), v0),
+					_mm_mul_ps(interp, v1));
+			return _mm_and_ps(result, inRange);
+		}
+#endif
 };
 extern CqNegExpTable negExpTable;
 
@@ -441,6 +501,70 @@ inline TqFloat CqEwaFilter::operator()(TqFloat x, TqFloat y) const
 	return 0;
 }
 
+inline bool CqEwaFilter::rowSpan(TqInt y, TqInt& startX, TqInt& endX) const
+{
+	TqFloat a = m_quadForm.a;
+	if(!(a > 0))
+		return startX < endX;
+	// Solve Q(x,y) = logEdgeWeight for x to find where the row crosses the
+	// edge of the filter ellipse.
+	TqFloat dy = y - m_filterCenter.y();
+	TqFloat bdy = (m_quadForm.b + m_quadForm.c)*dy;
+	TqFloat disc = bdy*bdy - 4*a*(m_quadForm.d*dy*dy - m_logEdgeWeight);
+	if(disc <= 0)
+		return false;
+	TqFloat sqrtDisc = std::sqrt(disc);
+	TqFloat inv2a = 0.5f/a;
+	// Round outward so that rounding error can't lose any edge pixels.
+	startX = max<TqInt>(startX, lfloor(m_filterCenter.x() + (-bdy - sqrtDisc)*inv2a));
+	endX = min<TqInt>(endX, lceil(m_filterCenter.x() + (-bdy + sqrtDisc)*inv2a) + 1);
+	return startX < endX;
+}
+
+inline void CqEwaFilter::rowWeights(TqInt y, TqInt startX, TqInt endX,
+		TqFloat* weights) const
+{
+	TqFloat dx = startX - m_filterCenter.x();
+	TqFloat dy = y - m_filterCenter.y();
+	TqFloat a = m_quadForm.a;
+	TqFloat bdy = (m_quadForm.b + m_quadForm.c)*dy;
+	TqFloat ddy = m_quadForm.d*dy*dy;
+	const TqInt numWeights = endX - startX;
+	TqInt i = 0;
+#ifdef __SSE2__
+	// Four weights at a time, evaluating Q directly for each pixel.
+	const __m128 a4 = _mm_set1_ps(a);
+	const __m128 bdy4 = _mm_set1_ps(bdy);
+	const __m128 ddy4 = _mm_set1_ps(ddy);
+	const __m128 logEdgeWeight4 = _mm_set1_ps(m_logEdgeWeight);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 four = _mm_set1_ps(4);
+	__m128 dx4 = _mm_setr_ps(dx, dx + 1, dx + 2, dx + 3);
+	for(; i + 4 <= numWeights; i += 4)
+	{
+		__m128 q4 = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(a4, dx4),
+						bdy4), dx4), ddy4);
+		__m128 inside = _mm_cmplt_ps(q4, logEdgeWeight4);
+		__m128 w = detail::negExpTable(_mm_max_ps(q4, zero));
+		_mm_storeu_ps(weights + i, _mm_and_ps(w, inside));
+		dx4 = _mm_add_ps(dx4, four);
+	}
+	dx += i;
+#endif
+	// Q and its first and second forward differences along the row.
+	TqFloat q = (a*dx + bdy)*dx + ddy;
+	TqFloat dq = a*(2*dx + 1) + bdy;
+	const TqFloat ddq = 2*a;
+	for(; i < numWeights; ++i)
+	{
+		// Rounding in the differences can push q just below zero at the
+		// filter center, which the table doesn't allow for.
+		weights[i] = q < m_logEdgeWeight ? detail::negExpTable(max(q, 0.0f)) : 0;
+		q += dq;
+		dq += ddq;
+	}
+}
+
 inline SqFilterSupport CqEwaFilter::support() const
 {
 	TqFloat detQ = m_quadForm.det();
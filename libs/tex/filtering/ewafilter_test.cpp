@@ -0,0 +1,119 @@
+// Aqsis
+// Copyright (C) 2001, Paul C. Gregory and the other authors and contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the software's owners nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// (This is the New BSD license)
+
+/** \file
+ *
+ * \brief Unit tests for EWA filter weights.
+ */
+#include "ewafilter.h"
+
+#include <vector>
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/auto_unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(ewafilter_tests)
+
+using namespace Aqsis;
+
+// Check that the row-wise weights agree with the per-pixel weights over the
+// whole support.
+void checkRowWeights(const CqEwaFilter& filter)
+{
+	SqFilterSupport support = filter.support();
+	std::vector<TqFloat> weights(support.sx.range());
+	for(TqInt y = support.sy.start; y < support.sy.end; ++y)
+	{
+		TqInt startX = support.sx.start;
+		TqInt endX = support.sx.end;
+		bool inSpan = filter.rowSpan(y, startX, endX);
+		if(inSpan)
+			filter.rowWeights(y, startX, endX, &weights[0]);
+		for(TqInt x = support.sx.start; x < support.sx.end; ++x)
+		{
+			TqFloat expected = filter(x, y);
+			TqFloat w = (inSpan && x >= startX && x < endX) ? weights[x-startX] : 0;
+			if(expected == 0)
+				BOOST_CHECK_EQUAL(w, 0);
+			else
+				BOOST_CHECK_SMALL(w - expected, 1e-4f);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(CqEwaFilter_rowWeights_test)
+{
+	// Isotropic filter
+	checkRowWeights(CqEwaFilter(SqMatrix2D(0.3, 0, 0, 0.3),
+				CqVector2D(10.3, 5.7), 4));
+	// Long thin filter at an angle to the raster axes.
+	checkRowWeights(CqEwaFilter(SqMatrix2D(0.05, 0.09, 0.09, 0.2),
+				CqVector2D(20.5, 31.1), 4));
+	// Small filter which touches only a few pixels.
+	checkRowWeights(CqEwaFilter(SqMatrix2D(5, 1, 1, 3),
+				CqVector2D(0.2, -0.6), 4));
+}
+
+BOOST_AUTO_TEST_CASE(CqEwaFilter_rowWeights_partial_test)
+{
+	// Spans of every length up to a few multiples of the SIMD width, at
+	// several offsets, agree with the per-pixel weights.
+	CqEwaFilter filter(SqMatrix2D(0.02, 0.01, 0.01, 0.03),
+			CqVector2D(10.3, 5.7), 4);
+	std::vector<TqFloat> weights(16);
+	for(TqInt startX = 0; startX < 5; ++startX)
+	{
+		for(TqInt len = 0; len <= 13; ++len)
+		{
+			filter.rowWeights(6, startX, startX + len, &weights[0]);
+			for(TqInt i = 0; i < len; ++i)
+			{
+				TqFloat expected = filter(startX + i, 6);
+				BOOST_CHECK_SMALL(weights[i] - expected, 1e-4f);
+			}
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(CqEwaFilter_rowSpan_test)
+{
+	CqEwaFilter filter(SqMatrix2D(1, 0, 0, 1), CqVector2D(0, 0), 4);
+	// The filter edge is at radius 2.
+	TqInt startX = -100;
+	TqInt endX = 100;
+	BOOST_CHECK(filter.rowSpan(0, startX, endX));
+	BOOST_CHECK(startX <= -1 && startX >= -3);
+	BOOST_CHECK(endX >= 2 && endX <= 4);
+	startX = -100;
+	endX = 100;
+	BOOST_CHECK(!filter.rowSpan(3, startX, endX));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
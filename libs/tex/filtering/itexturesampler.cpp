@@ -80,6 +80,15 @@ void IqTextureSampler::sample(const SqSampleQuad& sampleQuad,
 	sample(SqSamplePllgram(sampleQuad), sampleOpts, outSamps);
 }
 
+void IqTextureSampler::sampleGrid(const SqSamplePllgram* samplePllgrams,
+		TqInt numPllgrams, const CqTextureSampleOptions& sampleOpts,
+		TqFloat* outSamps) const
+{
+	TqInt numChans = sampleOpts.numChannels();
+	for(TqInt i = 0; i < numPllgrams; ++i)
+		sample(samplePllgrams[i], sampleOpts, outSamps + i*numChans);
+}
+
 const CqTextureSampleOptions& IqTextureSampler::defaultSampleOptions() const
 {
 	static const CqTextureSampleOptions defaultOptions;
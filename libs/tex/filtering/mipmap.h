@@ -40,6 +40,7 @@
 
 #include <aqsis/aqsis.h>
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -119,10 +120,84 @@ class CqMipmap
 		void applyFilter(const FilterFactoryT& filterFactory,
 				const CqTextureSampleOptions& sampleOpts, TqFloat* outSamps);
 
+		/** \brief Apply a batch of filters to the mipmap.
+		 *
+		 * The results are the same as calling applyFilter() for each filter
+		 * in turn.  However, levels are chosen for all the filters up front,
+		 * and the filtering is then ordered by mipmap level and by texture
+		 * tile, so that each level and tile is visited in one run rather
+		 * than once per filter.
+		 *
+		 * \param filterFactories - array of filter factories.  As well as the
+		 *            requirements of applyFilter(), the factories must
+		 *            provide filterFactory.filterCenter().
+		 * \param numFilters - length of the filterFactories array
+		 * \param sampleOpts - Sample options structure, shared by all filters.
+		 * \param outSamps - Output variable - filtered samples for filter i
+		 *            will be placed at outSamps[i*sampleOpts.numChannels()]
+		 */
+		template<typename FilterFactoryT>
+		void applyFilterBatch(const FilterFactoryT* filterFactories,
+				TqInt numFilters, const CqTextureSampleOptions& sampleOpts,
+				TqFloat* outSamps);
+
 	private:
+		/// A filter waiting to be applied by applyFilterBatch()
+		struct SqBatchEntry
+		{
+			/// Mipmap level to filter over
+			TqInt level;
+			/// Texture tile containing the filter center, in row-major order.
+			TqInt tile;
+			/// Index of the filter factory
+			TqInt filterIndex;
+			/// Index of the filter results in the output array
+			TqInt outIndex;
+
+			SqBatchEntry(TqInt level, TqInt tile, TqInt filterIndex,
+					TqInt outIndex);
+			/// Order by level, then by tile.
+			bool operator<(const SqBatchEntry& rhs) const;
+		};
+
 		/// Initialize all mipmap levels
 		void initLevels();
 
+		/** \brief Choose the mipmap level to filter over.
+		 *
+		 * \param filterFactory - factory for the filter to be applied.
+		 * \param sampleOpts - sample options structure
+		 * \param levelInterp - output variable: the weight with which the
+		 *            result from the next smaller level should be mixed in,
+		 *            or 0 if no interpolation between levels is needed.
+		 * \return the level to filter over.
+		 */
+		template<typename FilterFactoryT>
+		TqInt selectLevel(const FilterFactoryT& filterFactory,
+				const CqTextureSampleOptions& sampleOpts,
+				TqFloat& levelInterp) const;
+
+		/** \brief Apply a sorted run of batch entries.
+		 *
+		 * \param entries - entries to filter, sorted by level and tile.
+		 * \param filterFactories - factories indexed by the entries
+		 * \param sampleOpts - sample options structure
+		 * \param outSamps - results for each entry are placed at
+		 *            outSamps[entry.outIndex*sampleOpts.numChannels()]
+		 */
+		template<typename FilterFactoryT>
+		void filterBatch(const std::vector<SqBatchEntry>& entries,
+				const FilterFactoryT* filterFactories,
+				const CqTextureSampleOptions& sampleOpts,
+				TqFloat* outSamps) const;
+
+		/** \brief Compute the tile of a level which a filter is centered in.
+		 *
+		 * \param level - mipmap level
+		 * \param filterCenter - filter center in level 0 raster coordinates.
+		 */
+		TqInt centerTile(TqInt level, const CqVector2D& filterCenter) const;
+
 		/** \brief Filter the given mipmap level into a sample array.
 		 *
 		 * \param level - mipmap level to filter over.
@@ -134,6 +209,15 @@ class CqMipmap
 		template<typename FilterFactoryT>
 		void filterLevel(TqInt level, const FilterFactoryT& filterFactory,
 				const CqTextureSampleOptions& sampleOpts, TqFloat* outSamps) const;
+		/** \brief Filter the given mipmap level, which has already been fetched.
+		 *
+		 * \param levelBuf - buffer for the mipmap level, as from getLevel(level)
+		 * \see filterLevel() for the remaining parameters.
+		 */
+		template<typename FilterFactoryT>
+		void filterLevel(TqInt level, const TextureBufferT& levelBuf,
+				const FilterFactoryT& filterFactory,
+				const CqTextureSampleOptions& sampleOpts, TqFloat* outSamps) const;
 
 		/** \brief Get the buffer for a given level.
 		 *
@@ -164,6 +248,8 @@ class CqMipmap
 		TqInt m_height0;
 		/// Default texture sampling options for the set of mipmap levels.
 		CqTextureSampleOptions m_defaultSampleOptions;
+		/// Tile size of the texture file
+		SqTileInfo m_tileInfo;
 };
 
 
@@ -212,6 +298,29 @@ inline SqLevelTrans::SqLevelTrans(TqFloat xScale, TqFloat xOffset,
 { }
 
 
+//------------------------------------------------------------------------------
+// CqMipmap::SqBatchEntry
+template<typename TextureBufferT>
+inline CqMipmap<TextureBufferT>::SqBatchEntry::SqBatchEntry(TqInt level,
+		TqInt tile, TqInt filterIndex, TqInt outIndex)
+	: level(level),
+	tile(tile),
+	filterIndex(filterIndex),
+	outIndex(outIndex)
+{ }
+
+template<typename TextureBufferT>
+inline bool CqMipmap<TextureBufferT>::SqBatchEntry::operator<(
+		const SqBatchEntry& rhs) const
+{
+	if(level != rhs.level)
+		return level < rhs.level;
+	if(tile != rhs.tile)
+		return tile < rhs.tile;
+	return filterIndex < rhs.filterIndex;
+}
+
+
 //------------------------------------------------------------------------------
 // CqMipmap
 template<typename TextureBufferT>
@@ -222,9 +331,11 @@ CqMipmap<TextureBufferT>::CqMipmap(
 	m_levelTransforms(),
 	m_width0(0),
 	m_height0(0),
-	m_defaultSampleOptions()
+	m_defaultSampleOptions(),
+	m_tileInfo()
 {
 	assert(m_texFile);
+	m_tileInfo = m_texFile->tileInfo();
 	initLevels();
 	m_defaultSampleOptions.fillFromFileHeader(m_texFile->header());
 }
@@ -257,6 +368,83 @@ template<typename TextureBufferT>
 template<typename FilterFactoryT>
 void CqMipmap<TextureBufferT>::applyFilter(const FilterFactoryT& filterFactory,
 		const CqTextureSampleOptions& sampleOpts, TqFloat* outSamps)
+{
+	TqFloat levelInterp = 0;
+	TqInt level = selectLevel(filterFactory, sampleOpts, levelInterp);
+
+	filterLevel(level, filterFactory, sampleOpts, outSamps);
+
+	// Sometimes we might want to interpolate between the filtered result
+	// already computed above and the next lower mipmap level.  We do that now
+	// if necessary.
+	if(levelInterp > 0)
+	{
+		// Filter second level into tmpSamps.
+		CqAutoBuffer<TqFloat, 16> tmpSamps(sampleOpts.numChannels());
+		filterLevel(level+1, filterFactory, sampleOpts, tmpSamps.get());
+
+		// Mix outSamps and tmpSamps.
+		for(TqInt i = 0; i < sampleOpts.numChannels(); ++i)
+			outSamps[i] = (1-levelInterp) * outSamps[i] + levelInterp*tmpSamps[i];
+	}
+	// Debug - colourise mipmap level selection.
+	// outSamps[level%sampleOpts.numCahnnels()] += 0.1;
+}
+
+template<typename TextureBufferT>
+template<typename FilterFactoryT>
+void CqMipmap<TextureBufferT>::applyFilterBatch(
+		const FilterFactoryT* filterFactories, TqInt numFilters,
+		const CqTextureSampleOptions& sampleOpts, TqFloat* outSamps)
+{
+	const TqInt numChans = sampleOpts.numChannels();
+	// Choose the levels for all the filters.  Filters which need
+	// interpolation also get an entry for the next smaller level.
+	std::vector<SqBatchEntry> entries;
+	entries.reserve(numFilters);
+	std::vector<SqBatchEntry> lerpEntries;
+	std::vector<TqFloat> levelInterps;
+	for(TqInt i = 0; i < numFilters; ++i)
+	{
+		const FilterFactoryT& factory = filterFactories[i];
+		TqFloat levelInterp = 0;
+		TqInt level = selectLevel(factory, sampleOpts, levelInterp);
+		entries.push_back(SqBatchEntry(level,
+					centerTile(level, factory.filterCenter()), i, i));
+		if(levelInterp > 0)
+		{
+			lerpEntries.push_back(SqBatchEntry(level+1,
+					centerTile(level+1, factory.filterCenter()), i,
+					lerpEntries.size()));
+			levelInterps.push_back(levelInterp);
+		}
+	}
+
+	std::sort(entries.begin(), entries.end());
+	filterBatch(entries, filterFactories, sampleOpts, outSamps);
+
+	if(!lerpEntries.empty())
+	{
+		// Filter the second levels, then mix them in as in applyFilter().
+		std::vector<TqFloat> tmpSamps(lerpEntries.size()*numChans);
+		std::sort(lerpEntries.begin(), lerpEntries.end());
+		filterBatch(lerpEntries, filterFactories, sampleOpts, &tmpSamps[0]);
+		for(typename std::vector<SqBatchEntry>::const_iterator
+				e = lerpEntries.begin(), end = lerpEntries.end(); e != end; ++e)
+		{
+			TqFloat levelInterp = levelInterps[e->outIndex];
+			TqFloat* out = outSamps + e->filterIndex*numChans;
+			const TqFloat* tmp = &tmpSamps[e->outIndex*numChans];
+			for(TqInt i = 0; i < numChans; ++i)
+				out[i] = (1-levelInterp)*out[i] + levelInterp*tmp[i];
+		}
+	}
+}
+
+template<typename TextureBufferT>
+template<typename FilterFactoryT>
+TqInt CqMipmap<TextureBufferT>::selectLevel(const FilterFactoryT& filterFactory,
+		const CqTextureSampleOptions& sampleOpts, TqFloat& levelInterp) const
 {
 	// Select mipmap level to use.
 	//
@@ -284,11 +472,7 @@ void CqMipmap<TextureBufferT>::applyFilter(const FilterFactoryT& filterFactory,
 	TqFloat levelCts = log2(filterFactory.minorAxisWidth()/minFilterWidth);
 	TqInt level = clamp<TqInt>(lfloor(levelCts), 0, numLevels()-1);
 
-	filterLevel(level, filterFactory, sampleOpts, outSamps);
-
-	// Sometimes we might want to interpolate between the filtered result
-	// already computed above and the next lower mipmap level.  We do that now
-	// if necessary.
+	levelInterp = 0;
 	if( ( sampleOpts.lerp() == Lerp_Always
 		|| (sampleOpts.lerp() == Lerp_Auto && blurRatio > 0.2) )
 		&& level < numLevels()-1 && levelCts > 0)
@@ -310,22 +494,52 @@ void CqMipmap<TextureBufferT>::applyFilter(const FilterFactoryT& filterFactory,
 		// Since this extra interpolation isn't really needed for small amounts
 		// of blur, we only do the interpolation when the blur ratio is large
 		// enough to make it worthwhile.
-
-		// Filter second level into tmpSamps.
-		CqAutoBuffer<TqFloat, 16> tmpSamps(sampleOpts.numChannels());
-		filterLevel(level+1, filterFactory, sampleOpts, tmpSamps.get());
-
-		// Mix outSamps and tmpSamps.
-		TqFloat levelInterp = levelCts - level;
+		levelInterp = levelCts - level;
 		// We square levelInterp here in order to bias the interpolation toward
 		// the higher resolution mipmap level, since the filtered result on the
 		// higher level is more accurate.
 		levelInterp *= levelInterp;
-		for(TqInt i = 0; i < sampleOpts.numChannels(); ++i)
-			outSamps[i] = (1-levelInterp) * outSamps[i] + levelInterp*tmpSamps[i];
 	}
-	// Debug - colourise mipmap level selection.
-	// outSamps[level%sampleOpts.numCahnnels()] += 0.1;
+	return level;
+}
+
+template<typename TextureBufferT>
+template<typename FilterFactoryT>
+void CqMipmap<TextureBufferT>::filterBatch(
+		const std::vector<SqBatchEntry>& entries,
+		const FilterFactoryT* filterFactories,
+		const CqTextureSampleOptions& sampleOpts, TqFloat* outSamps) const
+{
+	const TqInt numChans = sampleOpts.numChannels();
+	const TextureBufferT* levelBuf = 0;
+	TqInt currLevel = -1;
+	for(typename std::vector<SqBatchEntry>::const_iterator e = entries.begin(),
+			end = entries.end(); e != end; ++e)
+	{
+		// Entries are sorted by level, so each level is fetched only once.
+		if(e->level != currLevel)
+		{
+			currLevel = e->level;
+			levelBuf = &getLevel(currLevel);
+		}
+		filterLevel(currLevel, *levelBuf, filterFactories[e->filterIndex],
+				sampleOpts, outSamps + e->outIndex*numChans);
+	}
+}
+
+template<typename TextureBufferT>
+TqInt CqMipmap<TextureBufferT>::centerTile(TqInt level,
+		const CqVector2D& filterCenter) const
+{
+	const SqLevelTrans& trans = levelTrans(level);
+	TqInt levelWidth = m_texFile->width(level);
+	TqInt levelHeight = m_texFile->height(level);
+	TqInt x = clamp<TqInt>(lfloor(trans.xScale*(filterCenter.x() + trans.xOffset)),
+			0, levelWidth-1);
+	TqInt y = clamp<TqInt>(lfloor(trans.yScale*(filterCenter.y() + trans.yOffset)),
+			0, levelHeight-1);
+	TqInt widthInTiles = (levelWidth-1)/m_tileInfo.width + 1;
+	return (y/m_tileInfo.height)*widthInTiles + x/m_tileInfo.width;
 }
 
 template<typename TextureBufferT>
@@ -422,6 +636,16 @@ template<typename FilterFactoryT>
 void CqMipmap<TextureBufferT>::filterLevel(
 		TqInt level, const FilterFactoryT& filterFactory,
 		const CqTextureSampleOptions& sampleOpts, TqFloat* outSamps) const
+{
+	filterLevel(level, getLevel(level), filterFactory, sampleOpts, outSamps);
+}
+
+template<typename TextureBufferT>
+template<typename FilterFactoryT>
+void CqMipmap<TextureBufferT>::filterLevel(
+		TqInt level, const TextureBufferT& levelBuf,
+		const FilterFactoryT& filterFactory,
+		const CqTextureSampleOptions& sampleOpts, TqFloat* outSamps) const
 {
 	// Create filter weights for chosen level.
 	const SqLevelTrans& trans = levelTrans(level);
@@ -448,12 +672,21 @@ void CqMipmap<TextureBufferT>::filterLevel(
 		support = intersect(support, SqFilterSupport(cx-10, cx+11, cy-10, cy+11));
 	}
 	// filter the texture
-	filterTexture(
-		accumulator,
-		getLevel(level),
-		support,
-		SqWrapModes(sampleOpts.sWrapMode(), sampleOpts.tWrapMode())
-	);
+	if(support.inRange(0, levelBuf.width(), 0, levelBuf.height()))
+	{
+		// No wrapping needed; only visit the parts of each row which lie
+		// inside the filter ellipse.
+		filterTextureRows(accumulator, weights, levelBuf, support);
+	}
+	else
+	{
+		filterTexture(
+			accumulator,
+			levelBuf,
+			support,
+			SqWrapModes(sampleOpts.sWrapMode(), sampleOpts.tWrapMode())
+		);
+	}
 }
 
 } // namespace Aqsis
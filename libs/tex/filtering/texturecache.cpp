@@ -102,6 +102,16 @@ void CqTextureCache::flush()
 	m_texFileCache.clear();
 }
 
+void CqTextureCache::invalidate(const char* name)
+{
+	TqUlong hash = CqString::hash(name);
+	m_textureCache.erase(hash);
+	m_environmentCache.erase(hash);
+	m_shadowCache.erase(hash);
+	m_occlusionCache.erase(hash);
+	m_texFileCache.erase(hash);
+}
+
 const CqTexFileHeader* CqTextureCache::textureInfo(const char* name)
 {
 	boost::shared_ptr<IqTiledTexInputFile> file;
@@ -40,6 +40,8 @@
 
 #include <aqsis/aqsis.h>
 
+#include <vector>
+
 #include <boost/shared_ptr.hpp>
 
 #include "ewafilter.h"
@@ -65,6 +67,9 @@ class AQSIS_TEX_SHARE CqTextureSampler : public IqTextureSampler
 		// from IqTextureSampler
 		virtual void sample(const SqSamplePllgram& samplePllgram,
 				const CqTextureSampleOptions& sampleOpts, TqFloat* outSamps) const;
+		virtual void sampleGrid(const SqSamplePllgram* samplePllgrams,
+				TqInt numPllgrams, const CqTextureSampleOptions& sampleOpts,
+				TqFloat* outSamps) const;
 		virtual const CqTextureSampleOptions& defaultSampleOptions() const;
 	private:
 		boost::shared_ptr<LevelCacheT> m_levels;
@@ -101,6 +106,37 @@ void CqTextureSampler<LevelCacheT>::sample(const SqSamplePllgram& samplePllgram,
 	m_levels->applyFilter(ewaFactory, sampleOpts, outSamps);
 }
 
+template<typename LevelCacheT>
+void CqTextureSampler<LevelCacheT>::sampleGrid(
+		const SqSamplePllgram* samplePllgrams, TqInt numPllgrams,
+		const CqTextureSampleOptions& sampleOpts, TqFloat* outSamps) const
+{
+	if(numPllgrams <= 0)
+		return;
+	// The parts of the filter setup which depend only on the sample options
+	// are shared by the whole batch.
+	const SqMatrix2D blurVariance = ewaBlurMatrix(sampleOpts.sBlur(),
+			sampleOpts.tBlur());
+	const TqFloat logEdgeWeight = -sampleOpts.logTruncAmount();
+	const bool sPeriodic = sampleOpts.sWrapMode() == WrapMode_Periodic;
+	const bool tPeriodic = sampleOpts.tWrapMode() == WrapMode_Periodic;
+	const TqInt width0 = m_levels->width0();
+	const TqInt height0 = m_levels->height0();
+
+	std::vector<CqEwaFilterFactory> factories;
+	factories.reserve(numPllgrams);
+	for(TqInt i = 0; i < numPllgrams; ++i)
+	{
+		SqSamplePllgram pllgram(samplePllgrams[i]);
+		pllgram.scaleWidth(sampleOpts.sWidth(), sampleOpts.tWidth());
+		pllgram.remapPeriodic(sPeriodic, tPeriodic);
+		factories.push_back(CqEwaFilterFactory(pllgram, width0, height0,
+				blurVariance, logEdgeWeight));
+	}
+
+	m_levels->applyFilterBatch(&factories[0], numPllgrams, sampleOpts, outSamps);
+}
+
 template<typename LevelCacheT>
 const CqTextureSampleOptions&
 CqTextureSampler<LevelCacheT>::defaultSampleOptions() const
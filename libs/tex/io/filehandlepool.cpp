@@ -0,0 +1,140 @@
+// Aqsis
+// Copyright (C) 2001, Paul C. Gregory and the other authors and contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the software's owners nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// (This is the New BSD license)
+
+/** \file
+ *
+ * \brief Implementation of the global texture file handle pool.
+ */
+
+#include <aqsis/tex/io/filehandlepool.h>
+
+#include <aqsis/math/math.h>
+
+namespace Aqsis {
+
+//------------------------------------------------------------------------------
+// CqPooledFile
+
+CqPooledFile::~CqPooledFile()
+{
+	if(m_isOpen)
+		CqFileHandlePool::instance().fileClosed(this);
+}
+
+//------------------------------------------------------------------------------
+// CqFileHandlePool
+
+const TqInt CqFileHandlePool::defaultMaxOpenFiles = 256;
+
+CqFileHandlePool& CqFileHandlePool::instance()
+{
+	static CqFileHandlePool pool;
+	return pool;
+}
+
+CqFileHandlePool::CqFileHandlePool()
+	: m_lru(),
+	m_maxOpenFiles(defaultMaxOpenFiles),
+	m_stats(),
+	m_mutex()
+{ }
+
+void CqFileHandlePool::setMaxOpenFiles(TqInt maxOpenFiles)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_maxOpenFiles = max(maxOpenFiles, 1);
+	closeToLimit();
+}
+
+TqInt CqFileHandlePool::maxOpenFiles() const
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_maxOpenFiles;
+}
+
+void CqFileHandlePool::fileOpened(CqPooledFile* file)
+{
+	assert(!file->m_isOpen);
+	m_lru.push_front(file);
+	file->m_lruPos = m_lru.begin();
+	file->m_isOpen = true;
+	++m_stats.opens;
+	if(file->m_hasBeenOpened)
+		++m_stats.reopens;
+	file->m_hasBeenOpened = true;
+	++m_stats.numOpen;
+	if(m_stats.numOpen > m_stats.peakOpen)
+		m_stats.peakOpen = m_stats.numOpen;
+	// The new file is at the front, so it's never the one closed here.
+	closeToLimit();
+}
+
+void CqFileHandlePool::fileClosed(CqPooledFile* file)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	removeFile(file);
+}
+
+SqFileHandlePoolStats CqFileHandlePool::stats() const
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_stats;
+}
+
+void CqFileHandlePool::resetStats()
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_stats.opens = 0;
+	m_stats.reopens = 0;
+	m_stats.closes = 0;
+	m_stats.peakOpen = m_stats.numOpen;
+}
+
+void CqFileHandlePool::closeToLimit()
+{
+	while(m_stats.numOpen > m_maxOpenFiles)
+	{
+		CqPooledFile* oldest = m_lru.back();
+		removeFile(oldest);
+		++m_stats.closes;
+		oldest->closeFile();
+	}
+}
+
+void CqFileHandlePool::removeFile(CqPooledFile* file)
+{
+	if(!file->m_isOpen)
+		return;
+	m_lru.erase(file->m_lruPos);
+	file->m_isOpen = false;
+	--m_stats.numOpen;
+}
+
+} // namespace Aqsis
@@ -0,0 +1,117 @@
+// Aqsis
+// Copyright (C) 2001, Paul C. Gregory and the other authors and contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the software's owners nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// (This is the New BSD license)
+
+/** \file
+ *
+ * \brief Unit tests for the texture file handle pool
+ */
+
+#include <aqsis/tex/io/filehandlepool.h>
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/auto_unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(filehandlepool_tests)
+
+using namespace Aqsis;
+
+namespace {
+
+// Pooled file which just records whether it's open.
+class TestFile : public CqPooledFile
+{
+	public:
+		TestFile(CqFileHandlePool& pool)
+			: m_pool(pool)
+		{ }
+		~TestFile()
+		{
+			m_pool.fileClosed(this);
+		}
+		void read()
+		{
+			boost::mutex::scoped_lock lock(m_pool.mutex());
+			if(isOpen())
+				m_pool.touch(this);
+			else
+				m_pool.fileOpened(this);
+		}
+	private:
+		virtual void closeFile() {}
+		CqFileHandlePool& m_pool;
+};
+
+} // unnamed namespace
+
+BOOST_AUTO_TEST_CASE(CqFileHandlePool_lru_close_test)
+{
+	CqFileHandlePool pool;
+	pool.setMaxOpenFiles(2);
+	TestFile f1(pool), f2(pool), f3(pool);
+
+	f1.read();
+	f2.read();
+	// f1 becomes most recently used, so f2 is closed when f3 is opened.
+	f1.read();
+	f3.read();
+	BOOST_CHECK(f1.isOpen());
+	BOOST_CHECK(!f2.isOpen());
+	BOOST_CHECK(f3.isOpen());
+
+	// Reading from f2 again reopens it, closing f1.
+	f2.read();
+	BOOST_CHECK(!f1.isOpen());
+	BOOST_CHECK(f2.isOpen());
+
+	const SqFileHandlePoolStats& stats = pool.stats();
+	BOOST_CHECK_EQUAL(stats.opens, 4);
+	BOOST_CHECK_EQUAL(stats.reopens, 1);
+	BOOST_CHECK_EQUAL(stats.closes, 2);
+	BOOST_CHECK_EQUAL(stats.numOpen, 2);
+	BOOST_CHECK_EQUAL(stats.peakOpen, 3);
+}
+
+BOOST_AUTO_TEST_CASE(CqFileHandlePool_setMaxOpenFiles_test)
+{
+	CqFileHandlePool pool;
+	TestFile f1(pool), f2(pool), f3(pool);
+	f1.read();
+	f2.read();
+	f3.read();
+	BOOST_CHECK_EQUAL(pool.stats().numOpen, 3);
+
+	pool.setMaxOpenFiles(1);
+	BOOST_CHECK(!f1.isOpen());
+	BOOST_CHECK(!f2.isOpen());
+	BOOST_CHECK(f3.isOpen());
+	BOOST_CHECK_EQUAL(pool.stats().closes, 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,4 +1,5 @@
 set(io_srcs
+	filehandlepool.cpp
 	itexinputfile.cpp
 	itexoutputfile.cpp
 	itiledtexinputfile.cpp
@@ -36,6 +37,7 @@ make_absolute(io_hdrs ${io_SOURCE_DIR})
 include_directories(${io_SOURCE_DIR})
 
 set(io_test_srcs
+	filehandlepool_test.cpp
 	magicnumber_test.cpp
 	texfileheader_test.cpp
 	tiffdirhandle_test.cpp
@@ -44,7 +44,8 @@
 namespace Aqsis {
 
 CqTiledTiffInputFile::CqTiledTiffInputFile(const boostfs::path& fileName)
-	: m_headers(),
+	: m_fileName(fileName),
+	m_headers(),
 	m_fileHandle(new CqTiffFileHandle(fileName, "r")),
 	m_numDirs(m_fileHandle->numDirectories()),
 	m_tileInfo(0,0),
@@ -99,11 +100,14 @@ CqTiledTiffInputFile::CqTiledTiffInputFile(const boostfs::path& fileName)
 		// interface a bit.
 		m_headers.push_back(tmpHeader);
 	}
+	CqFileHandlePool& pool = CqFileHandlePool::instance();
+	boost::mutex::scoped_lock lock(pool.mutex());
+	pool.fileOpened(this);
 }
 
 boostfs::path CqTiledTiffInputFile::fileName() const
 {
-	return m_fileHandle->fileName();
+	return m_fileName;
 }
 
 EqImageFileType CqTiledTiffInputFile::fileType() const
@@ -144,6 +148,20 @@ TqInt CqTiledTiffInputFile::height(TqInt index) const
 void CqTiledTiffInputFile::readTileImpl(TqUint8* buffer, TqInt x, TqInt y,
 		TqInt subImageIdx, const SqTileInfo tileSize) const
 {
+	CqFileHandlePool& pool = CqFileHandlePool::instance();
+	// Hold the pool's lock for the whole read, so that the file can't be
+	// closed underneath us, or reopened by another thread at the same time.
+	boost::mutex::scoped_lock lock(pool.mutex());
+	// Casting away const is fine here; the pool only tracks whether the
+	// underlying file is open, which isn't part of the logical state.
+	CqPooledFile* pooledFile = const_cast<CqTiledTiffInputFile*>(this);
+	if(m_fileHandle)
+		pool.touch(pooledFile);
+	else
+	{
+		m_fileHandle.reset(new CqTiffFileHandle(m_fileName, "r"));
+		pool.fileOpened(pooledFile);
+	}
 	CqTiffDirHandle dirHandle(m_fileHandle, subImageIdx);
 	if((x+1)*m_tileInfo.width > m_widths[subImageIdx]
 			|| (y+1)*m_tileInfo.height > m_heights[subImageIdx])
@@ -170,4 +188,9 @@ void CqTiledTiffInputFile::readTileImpl(TqUint8* buffer, TqInt x, TqInt y,
 	}
 }
 
+void CqTiledTiffInputFile::closeFile()
+{
+	m_fileHandle.reset();
+}
+
 } // namespace Aqsis
@@ -42,6 +42,7 @@
 
 #include <vector>
 
+#include <aqsis/tex/io/filehandlepool.h>
 #include <aqsis/tex/io/itiledtexinputfile.h>
 #include "tiffdirhandle.h"
 
@@ -59,8 +60,13 @@ namespace Aqsis {
  *   - The pixel format is directly addressable (8, 16, 32 bits per channel)
  *   - Pixel channels are stored interleaved rather than "planar"
  *   - Probably misc. other restrictions (see tiffdirhandle.cpp)
+ *
+ * All header data is read up front, so the underlying TIFF file may be closed
+ * by the global CqFileHandlePool at any time; it's reopened when the next tile
+ * is read.
  */
-class AQSIS_TEX_SHARE CqTiledTiffInputFile : public IqTiledTexInputFile
+class AQSIS_TEX_SHARE CqTiledTiffInputFile : public IqTiledTexInputFile,
+	private CqPooledFile
 {
 	public:
 		/** \brief Open a tiled TIFF file and setup the input interface.
@@ -81,11 +87,15 @@ class AQSIS_TEX_SHARE CqTiledTiffInputFile : public IqTiledTexInputFile
 	private:
 		virtual void readTileImpl(TqUint8* buffer, TqInt tileX, TqInt tileY,
 				TqInt subImageIdx, const SqTileInfo tileSize) const;
+		// Inherited from CqPooledFile
+		virtual void closeFile();
 
+		/// Name of the underlying file
+		boostfs::path m_fileName;
 		/// Header information
 		std::vector<boost::shared_ptr<CqTexFileHeader> > m_headers;
-		/// Handle to the underlying TIFF structure.
-		boost::shared_ptr<CqTiffFileHandle> m_fileHandle;
+		/// Handle to the underlying TIFF structure; null when closed.
+		mutable boost::shared_ptr<CqTiffFileHandle> m_fileHandle;
 		/// Number of directories in the TIFF file.
 		tdir_t m_numDirs;
 		/// Tile information
@@ -40,6 +40,8 @@
 
 #include <aqsis/aqsis.h>
 
+#include <vector>
+
 #include <boost/shared_ptr.hpp>
 
 #include <aqsis/math/math.h>
@@ -166,6 +168,60 @@ bool CqDownsampleIterator<ArrayT>::operator!=(const CqDownsampleIterator<ArrayT>
 
 namespace detail {
 
+/** \brief Downsample a band of rows via a nonseperable convolution.
+ *
+ * Output rows are independent, so they're computed in parallel when OpenMP
+ * is available.  Each thread positions its own copy of the filter.
+ *
+ * \param srcBuf - input texture buffer.  Row i of srcBuf holds row
+ *                 i + srcOffsetY of the source image.
+ * \param srcOffsetY - source image row held in the first row of srcBuf.
+ * \param mipmapRatio - scale factor for the new file (2 for normal mipmapping)
+ * \param filterWeights - precomputed kernel of filter weights
+ * \param wrapModes - specify how the texture will be wrapped at the edges.
+ * \param destBuf - output buffer.  Row i of destBuf receives output row
+ *                  i + destStartY.
+ * \param destStartY - first output row to compute
+ * \param destEndY - one past the last output row to compute
+ */
+template<typename ArrayT>
+void downsampleRows(const ArrayT& srcBuf, TqInt srcOffsetY,
+		TqInt mipmapRatio, const CqCachedFilter& filterWeights,
+		const SqWrapModes& wrapModes, ArrayT& destBuf, TqInt destStartY,
+		TqInt destEndY)
+{
+	const TqInt destWidth = destBuf.width();
+	const TqInt numChannels = srcBuf.numChannels();
+	const TqInt filterOffsetX = (filterWeights.width()-1) / 2;
+	const TqInt filterOffsetY = (filterWeights.height()-1) / 2;
+	// Rows are filtered in parallel when built with OpenMP (see the
+	// AQSIS_USE_OPENMP build option), and serially otherwise.
+#	ifdef _OPENMP
+#	pragma omp parallel
+#	endif
+	{
+		CqCachedFilter weights(filterWeights);
+		std::vector<TqFloat> accumBuf(numChannels);
+#		ifdef _OPENMP
+#		pragma omp for
+#		endif
+		for(TqInt y = destStartY; y < destEndY; ++y)
+		{
+			for(TqInt x = 0; x < destWidth; ++x)
+			{
+				// Filter the source buffer to get the channels for a single
+				// pixel in the destination buffer.
+				weights.setSupportTopLeft(mipmapRatio*x - filterOffsetX,
+						mipmapRatio*y - filterOffsetY - srcOffsetY);
+				CqSampleAccum<CqCachedFilter> accumulator(weights, 0,
+						numChannels, &accumBuf[0]);
+				filterTexture(accumulator, srcBuf, weights.support(), wrapModes);
+				destBuf.setPixel(x, y - destStartY, &accumBuf[0]);
+			}
+		}
+	}
+}
+
 /** \brief Downsample a buffer for mipmapping via a nonseperable convolution.
  *
  * Nonseperable convolution is the most general way of forming a weighted
@@ -186,23 +242,8 @@ boost::shared_ptr<ArrayT> downsampleNonseperable(
 	TqInt newHeight = lceil(TqFloat(srcBuf.height())/mipmapRatio);
 	TqInt numChannels = srcBuf.numChannels();
 	boost::shared_ptr<ArrayT> destBuf(new ArrayT(newWidth, newHeight, numChannels));
-	TqInt filterOffsetX = (filterWeights.width()-1) / 2;
-	TqInt filterOffsetY = (filterWeights.height()-1) / 2;
-	std::vector<TqFloat> accumBuf(numChannels);
-	// Loop over pixels in the output image.
-	for(TqInt y = 0; y < newHeight; ++y)
-	{
-		for(TqInt x = 0; x < newWidth; ++x)
-		{
-			// Filter the source buffer to get the channels for a single pixel
-			// in the destination buffer.
-			filterWeights.setSupportTopLeft(2*x-filterOffsetX, 2*y-filterOffsetY);
-			CqSampleAccum<CqCachedFilter> accumulator(filterWeights, 0, numChannels, &accumBuf[0]);
-			filterTexture(accumulator, srcBuf, filterWeights.support(),
-					SqWrapModes(wrapModes.sWrap, wrapModes.tWrap));
-			destBuf->setPixel(x, y, &accumBuf[0]);
-		}
-	}
+	downsampleRows(srcBuf, 0, mipmapRatio, filterWeights, wrapModes, *destBuf,
+			0, newHeight);
 	return destBuf;
 }
 
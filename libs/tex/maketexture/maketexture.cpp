@@ -48,6 +48,7 @@
 #include <aqsis/util/logging.h>
 #include "magicnumber.h"
 #include "downsample.h"
+#include "streamdownsample.h"
 #include <aqsis/tex/buffers/texturebuffer.h>
 #include <aqsis/tex/texexception.h>
 #include <aqsis/version.h>
@@ -172,6 +173,135 @@ void createMipmap(const TexSrcT& texSrc, const EqChannelType chanType,
 	}
 }
 
+/** \brief Create a mipmap from a file, streaming levels which are too large.
+ *
+ * Levels larger than the memory limit are downsampled a band at a time with
+ * downsampleStreamed().  The intermediate levels are kept in temporary files
+ * until they're small enough to hold in memory, at which point the usual
+ * in-memory downsampling takes over.
+ *
+ * ChannelT is the pixel component type used for mipmapping, and FileChannelT
+ * the pixel component type in the input file.
+ *
+ * \param inFile - input file from which the data should be read
+ * \param outFile - output file for the mipmapped data
+ * \param filterInfo - information about which filter type and size to use
+ * \param wrapModes - specifies how the texture will be wrapped at the edges.
+ * \param memoryLimit - approximate limit on memory use in bytes.
+ */
+template<typename ChannelT, typename FileChannelT>
+void createMipmapStreamed(const IqTexInputFile& inFile,
+		IqMultiTexOutputFile& outFile, const SqFilterInfo& filterInfo,
+		const SqWrapModes& wrapModes, TqDouble memoryLimit)
+{
+	const TqInt numChannels = inFile.header().channelList().numChannels();
+	TqInt width = inFile.header().width();
+	TqInt height = inFile.header().height();
+	boost::shared_ptr<CqRowSource<ChannelT> > src(
+			new CqFileRowSource<ChannelT, FileChannelT>(inFile,
+				streamEdgeRows(filterInfo, width, height)));
+	while(true)
+	{
+		// Size the bands so that the source rows under them use around a
+		// quarter of the memory limit.
+		TqDouble rowBytes = TqDouble(width)*numChannels*sizeof(ChannelT);
+		TqInt bandHeight = max(1, static_cast<TqInt>(
+					min(memoryLimit/(8*rowBytes), TqDouble(height))));
+		TqInt newWidth = lceil(TqFloat(width)/2);
+		TqInt newHeight = lceil(TqFloat(height)/2);
+		TqDouble newBytes = TqDouble(newWidth)*newHeight*numChannels*sizeof(ChannelT);
+		if(newBytes <= memoryLimit/2)
+		{
+			// The next level fits in memory; finish off as usual.
+			CqBufferRowSink<ChannelT> sink(newWidth, newHeight, numChannels);
+			downsampleStreamed(*src, outFile, filterInfo, wrapModes,
+					bandHeight, sink);
+			boost::shared_ptr<CqTextureBuffer<ChannelT> > buf = sink.buffer();
+			outFile.newSubImage(newWidth, newHeight);
+			downsampleToFile(buf, outFile, filterInfo, wrapModes);
+			return;
+		}
+		boost::shared_ptr<CqTempRowFile<ChannelT> > nextLevel(
+				new CqTempRowFile<ChannelT>(newWidth, newHeight, numChannels,
+					streamEdgeRows(filterInfo, newWidth, newHeight)));
+		downsampleStreamed(*src, outFile, filterInfo, wrapModes, bandHeight,
+				*nextLevel);
+		nextLevel->finishWriting();
+		outFile.newSubImage(newWidth, newHeight);
+		src = nextLevel;
+		width = newWidth;
+		height = newHeight;
+	}
+}
+
+/** \brief Create a mipmap from an input file and save it to a file.
+ *
+ * Textures which fit comfortably within the memory limit are mipmapped in
+ * memory with createMipmap(); larger ones are streamed.
+ *
+ * \param inFile - input file from which the data should be read
+ * \param outFile - output file into which texture data will be placed.
+ * \param filterInfo - information about mipmap downsampling filter type and size
+ * \param wrapModes - specify how texture will be wrapped at edges during
+ *            downsampling.
+ * \param paramList - parameter list containing the optional "memorylimit"
+ *            in megabytes.
+ */
+void createMipmapFromFile(const IqTexInputFile& inFile,
+		IqMultiTexOutputFile& outFile, const SqFilterInfo& filterInfo,
+		const SqWrapModes& wrapModes, const CqRiParamList& paramList)
+{
+	const CqTexFileHeader& header = inFile.header();
+	const EqChannelType chanType = header.channelList().sharedChannelType();
+	TqDouble memoryLimit = 1024.0*1024.0
+		* max(1.0f, paramList.find<TqFloat>("memorylimit", 1024));
+	// Half data is converted to float for mipmapping.
+	TqInt bytesPerPixel = chanType == Channel_Float16
+		? 2*header.channelList().bytesPerPixel()
+		: header.channelList().bytesPerPixel();
+	// Mipmapping in memory holds the image and the next level, which is a
+	// quarter of the size.
+	if(1.25*header.width()*header.height()*bytesPerPixel <= memoryLimit)
+	{
+		createMipmap(inFile, chanType, outFile, filterInfo, wrapModes);
+		return;
+	}
+	switch(chanType)
+	{
+		case Channel_Float32:
+			createMipmapStreamed<TqFloat,TqFloat>(inFile, outFile, filterInfo, wrapModes, memoryLimit);
+			break;
+		case Channel_Unsigned32:
+			createMipmapStreamed<TqUint32,TqUint32>(inFile, outFile, filterInfo, wrapModes, memoryLimit);
+			break;
+		case Channel_Signed32:
+			createMipmapStreamed<TqInt32,TqInt32>(inFile, outFile, filterInfo, wrapModes, memoryLimit);
+			break;
+		case Channel_Unsigned16:
+			createMipmapStreamed<TqUint16,TqUint16>(inFile, outFile, filterInfo, wrapModes, memoryLimit);
+			break;
+		case Channel_Signed16:
+			createMipmapStreamed<TqInt16,TqInt16>(inFile, outFile, filterInfo, wrapModes, memoryLimit);
+			break;
+		case Channel_Unsigned8:
+			createMipmapStreamed<TqUint8,TqUint8>(inFile, outFile, filterInfo, wrapModes, memoryLimit);
+			break;
+		case Channel_Signed8:
+			createMipmapStreamed<TqInt8,TqInt8>(inFile, outFile, filterInfo, wrapModes, memoryLimit);
+			break;
+		case Channel_Float16:
+#			ifdef USE_OPENEXR
+			createMipmapStreamed<TqFloat,half>(inFile, outFile, filterInfo, wrapModes, memoryLimit);
+#			else
+			assert(0 && "Compiled without OpenEXR support");
+#			endif
+			break;
+		default:
+			AQSIS_THROW_XQERROR(XqBadTexture, EqE_Limit,
+				"Cannot create mipmap for input channel types");
+	}
+}
+
 /** Copy pixels of one texture buffer onto part of another.
  */
 template<typename ChannelT>
@@ -363,8 +493,7 @@ void makeTexture(const boostfs::path& inFileName, const boostfs::path& outFileNa
 		= IqMultiTexOutputFile::open(outFileName, ImageFile_Tiff, header);
 
 	// Create mipmap, saving to the output file.
-	createMipmap(*inFile, inFile->header().channelList().sharedChannelType(),
-			*outFile, filterInfo, wrapModes);
+	createMipmapFromFile(*inFile, *outFile, filterInfo, wrapModes, paramList);
 }
 
 
@@ -429,8 +558,7 @@ void makeLatLongEnvironment(const boostfs::path& inFileName,
 		= IqMultiTexOutputFile::open(outFileName, ImageFile_Tiff, header);
 
 	// Create mipmap, saving to the output file.
-	createMipmap(*inFile, inFile->header().channelList().sharedChannelType(),
-			*outFile, filterInfo, wrapModes);
+	createMipmapFromFile(*inFile, *outFile, filterInfo, wrapModes, paramList);
 }
 
 
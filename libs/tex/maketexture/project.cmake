@@ -8,8 +8,14 @@ set(maketexture_hdrs
 	bake.h
 	cachedfilter.h
 	downsample.h
+	streamdownsample.h
 )
 make_absolute(maketexture_hdrs ${maketexture_SOURCE_DIR})
 
+set(maketexture_test_srcs
+	streamdownsample_test.cpp
+)
+make_absolute(maketexture_test_srcs ${maketexture_SOURCE_DIR})
+
 include_directories(${maketexture_SOURCE_DIR})
 
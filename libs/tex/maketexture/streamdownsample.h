@@ -0,0 +1,572 @@
+// Aqsis
+// Copyright (C) 2001, Paul C. Gregory and the other authors and contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the software's owners nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// (This is the New BSD license)
+
+/** \file
+ *
+ * \brief Mipmap downsampling for images which are too large to hold in memory.
+ *
+ * \author Chris Foster  [chris42f _at_ gmail.com]
+ */
+
+#ifndef STREAMDOWNSAMPLE_H_INCLUDED
+#define STREAMDOWNSAMPLE_H_INCLUDED
+
+#include <aqsis/aqsis.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include <aqsis/math/math.h>
+#include "cachedfilter.h"
+#include "downsample.h"
+#include <aqsis/tex/io/itexinputfile.h>
+#include <aqsis/tex/io/itexoutputfile.h>
+#include <aqsis/tex/buffers/texturebuffer.h>
+#include <aqsis/tex/filtering/wrapmode.h>
+#include <aqsis/util/exception.h>
+
+namespace Aqsis
+{
+
+//------------------------------------------------------------------------------
+/** \brief A source of image rows which must be read in order.
+ *
+ * Streamed downsampling reads each image level once from top to bottom.  The
+ * only exception is near the top and bottom edges, where the wrap mode may
+ * pull in rows from the opposite edge; a copy of these "edge rows" is kept by
+ * the source so they can be accessed at any time.
+ */
+template<typename ChannelT>
+class CqRowSource
+{
+	public:
+		/** \brief Construct a row source
+		 *
+		 * \param width, height - image dimensions
+		 * \param numChannels - number of channels per pixel
+		 * \param numEdgeRows - number of rows at the top and bottom of the
+		 *                      image to keep for edgeRow().
+		 */
+		CqRowSource(TqInt width, TqInt height, TqInt numChannels,
+				TqInt numEdgeRows);
+		virtual ~CqRowSource() {}
+
+		/// Get the image width
+		TqInt width() const;
+		/// Get the image height
+		TqInt height() const;
+		/// Get the number of channels per pixel
+		TqInt numChannels() const;
+
+		/** \brief Read the next rows of the image.
+		 *
+		 * \param numRows - number of rows to read
+		 * \param rows - buffer for the rows; it's resized as necessary.
+		 */
+		virtual void readRows(TqInt numRows, CqTextureBuffer<ChannelT>& rows) = 0;
+		/** \brief Get one of the rows near the top or bottom edge.
+		 *
+		 * \param row - image row, which must be within numEdgeRows of the
+		 *              top or bottom of the image.
+		 */
+		const ChannelT* edgeRow(TqInt row) const;
+
+	protected:
+		/** \brief Keep copies of any edge rows among the given rows.
+		 *
+		 * \param rows - buffer of rows from the image
+		 * \param startRow - image row held by the first row of the buffer
+		 * \param numRows - number of rows of the buffer to look at.
+		 */
+		void saveEdgeRows(const CqTextureBuffer<ChannelT>& rows,
+				TqInt startRow, TqInt numRows);
+
+	private:
+		TqInt m_width;
+		TqInt m_height;
+		TqInt m_numChannels;
+		TqInt m_numEdgeRows;
+		std::vector<ChannelT> m_topRows;
+		std::vector<ChannelT> m_bottomRows;
+};
+
+
+/// Interface for consumers of downsampled rows.
+template<typename ChannelT>
+class IqRowSink
+{
+	public:
+		/** \brief Append rows to the end of the image.
+		 *
+		 * \param rows - buffer holding the rows
+		 * \param numRows - number of rows at the top of the buffer to use.
+		 */
+		virtual void writeRows(const CqTextureBuffer<ChannelT>& rows,
+				TqInt numRows) = 0;
+		virtual ~IqRowSink() {}
+};
+
+
+/** \brief Row source reading from a texture input file.
+ *
+ * FileChannelT is the channel type in the file, which is converted to
+ * ChannelT as it's read.
+ */
+template<typename ChannelT, typename FileChannelT>
+class CqFileRowSource : public CqRowSource<ChannelT>
+{
+	public:
+		/** \brief Construct a row source for the given file
+		 *
+		 * The edge rows are read up front, which leaves the file positioned
+		 * at the first row.
+		 */
+		CqFileRowSource(const IqTexInputFile& file, TqInt numEdgeRows);
+		virtual void readRows(TqInt numRows, CqTextureBuffer<ChannelT>& rows);
+	private:
+		void readFileRows(TqInt startRow, TqInt numRows,
+				CqTextureBuffer<ChannelT>& rows) const;
+
+		const IqTexInputFile& m_file;
+		TqInt m_nextRow;
+};
+
+
+/** \brief Temporary file holding an intermediate mipmap level.
+ *
+ * Rows are written with writeRows() in order, after which finishWriting()
+ * must be called before reading them back in order with readRows().  The file
+ * is removed when the object is destroyed.
+ */
+template<typename ChannelT>
+class CqTempRowFile : public CqRowSource<ChannelT>, public IqRowSink<ChannelT>
+{
+	public:
+		CqTempRowFile(TqInt width, TqInt height, TqInt numChannels,
+				TqInt numEdgeRows);
+		virtual ~CqTempRowFile();
+
+		virtual void writeRows(const CqTextureBuffer<ChannelT>& rows,
+				TqInt numRows);
+		/// Switch from writing rows to reading them.
+		void finishWriting();
+		virtual void readRows(TqInt numRows, CqTextureBuffer<ChannelT>& rows);
+	private:
+		std::FILE* m_file;
+		TqInt m_rowsWritten;
+};
+
+
+/// Row sink collecting the rows into a texture buffer.
+template<typename ChannelT>
+class CqBufferRowSink : public IqRowSink<ChannelT>
+{
+	public:
+		CqBufferRowSink(TqInt width, TqInt height, TqInt numChannels);
+		virtual void writeRows(const CqTextureBuffer<ChannelT>& rows,
+				TqInt numRows);
+		/// Get the buffer holding the rows
+		const boost::shared_ptr<CqTextureBuffer<ChannelT> >& buffer() const;
+	private:
+		boost::shared_ptr<CqTextureBuffer<ChannelT> > m_buf;
+		TqInt m_rowsWritten;
+};
+
+
+/** \brief Number of edge rows needed to stream-downsample an image.
+ *
+ * \param filterInfo - downsampling filter type and size
+ * \param width, height - dimensions of the image to be downsampled.
+ */
+TqInt streamEdgeRows(const SqFilterInfo& filterInfo, TqInt width, TqInt height);
+
+/** \brief Downsample an image to the next mipmap level, one band at a time.
+ *
+ * The result is the same as downsample(), but only a band of bandHeight
+ * output rows and the source rows under it are held in memory at once.  As
+ * the source rows are read they're also copied to outFile, so src should be
+ * the image level which outFile is currently accepting.  Source rows are
+ * read in multiples of the output tile height so that they can be written
+ * directly.
+ *
+ * \param src - source of the image to be downsampled.
+ * \param outFile - output file receiving the source image.
+ * \param filterInfo - information about which filter type and size to use
+ * \param wrapModes - specifies how the texture will be wrapped at the edges.
+ * \param bandHeight - number of output rows to compute at a time
+ * \param dest - destination for the downsampled image.
+ */
+template<typename ChannelT>
+void downsampleStreamed(CqRowSource<ChannelT>& src, IqTexOutputFile& outFile,
+		const SqFilterInfo& filterInfo, const SqWrapModes& wrapModes,
+		TqInt bandHeight, IqRowSink<ChannelT>& dest);
+
+
+//==============================================================================
+// Implementation details
+//==============================================================================
+// CqRowSource implementation
+template<typename ChannelT>
+CqRowSource<ChannelT>::CqRowSource(TqInt width, TqInt height,
+		TqInt numChannels, TqInt numEdgeRows)
+	: m_width(width),
+	m_height(height),
+	m_numChannels(numChannels),
+	m_numEdgeRows(min(numEdgeRows, height)),
+	m_topRows(m_numEdgeRows*width*numChannels),
+	m_bottomRows(m_numEdgeRows*width*numChannels)
+{ }
+
+template<typename ChannelT>
+inline TqInt CqRowSource<ChannelT>::width() const
+{
+	return m_width;
+}
+
+template<typename ChannelT>
+inline TqInt CqRowSource<ChannelT>::height() const
+{
+	return m_height;
+}
+
+template<typename ChannelT>
+inline TqInt CqRowSource<ChannelT>::numChannels() const
+{
+	return m_numChannels;
+}
+
+template<typename ChannelT>
+inline const ChannelT* CqRowSource<ChannelT>::edgeRow(TqInt row) const
+{
+	TqInt rowLen = m_width*m_numChannels;
+	if(row < m_numEdgeRows)
+		return &m_topRows[row*rowLen];
+	assert(row >= m_height - m_numEdgeRows && row < m_height);
+	return &m_bottomRows[(row - (m_height - m_numEdgeRows))*rowLen];
+}
+
+template<typename ChannelT>
+void CqRowSource<ChannelT>::saveEdgeRows(const CqTextureBuffer<ChannelT>& rows,
+		TqInt startRow, TqInt numRows)
+{
+	TqInt rowLen = m_width*m_numChannels;
+	TqInt bottomStart = m_height - m_numEdgeRows;
+	for(TqInt i = 0; i < numRows; ++i)
+	{
+		TqInt row = startRow + i;
+		const ChannelT* rowData = rows.value(0, i);
+		if(row < m_numEdgeRows)
+			std::copy(rowData, rowData + rowLen, &m_topRows[row*rowLen]);
+		if(row >= bottomStart)
+			std::copy(rowData, rowData + rowLen,
+					&m_bottomRows[(row - bottomStart)*rowLen]);
+	}
+}
+
+
+//------------------------------------------------------------------------------
+// CqFileRowSource implementation
+
+namespace detail {
+
+/// Read rows from a file, converting them to ChannelT.
+template<typename ChannelT, typename FileChannelT>
+struct SqFileRowReader
+{
+	static void read(const IqTexInputFile& file, TqInt startRow,
+			TqInt numRows, CqTextureBuffer<ChannelT>& rows)
+	{
+		CqTextureBuffer<FileChannelT> fileRows;
+		file.readPixels(fileRows, startRow, numRows);
+		rows = fileRows;
+	}
+};
+
+/// Read rows from a file with no conversion.
+template<typename ChannelT>
+struct SqFileRowReader<ChannelT, ChannelT>
+{
+	static void read(const IqTexInputFile& file, TqInt startRow,
+			TqInt numRows, CqTextureBuffer<ChannelT>& rows)
+	{
+		file.readPixels(rows, startRow, numRows);
+	}
+};
+
+} // namespace detail
+
+template<typename ChannelT, typename FileChannelT>
+CqFileRowSource<ChannelT, FileChannelT>::CqFileRowSource(
+		const IqTexInputFile& file, TqInt numEdgeRows)
+	: CqRowSource<ChannelT>(file.header().width(), file.header().height(),
+			file.header().channelList().numChannels(), numEdgeRows),
+	m_file(file),
+	m_nextRow(0)
+{
+	TqInt height = this->height();
+	numEdgeRows = min(numEdgeRows, height);
+	CqTextureBuffer<ChannelT> rows;
+	readFileRows(0, numEdgeRows, rows);
+	this->saveEdgeRows(rows, 0, numEdgeRows);
+	readFileRows(height - numEdgeRows, numEdgeRows, rows);
+	this->saveEdgeRows(rows, height - numEdgeRows, numEdgeRows);
+}
+
+template<typename ChannelT, typename FileChannelT>
+void CqFileRowSource<ChannelT, FileChannelT>::readRows(TqInt numRows,
+		CqTextureBuffer<ChannelT>& rows)
+{
+	readFileRows(m_nextRow, numRows, rows);
+	m_nextRow += numRows;
+}
+
+template<typename ChannelT, typename FileChannelT>
+void CqFileRowSource<ChannelT, FileChannelT>::readFileRows(TqInt startRow,
+		TqInt numRows, CqTextureBuffer<ChannelT>& rows) const
+{
+	detail::SqFileRowReader<ChannelT, FileChannelT>::read(m_file, startRow,
+			numRows, rows);
+}
+
+
+//------------------------------------------------------------------------------
+// CqTempRowFile implementation
+template<typename ChannelT>
+CqTempRowFile<ChannelT>::CqTempRowFile(TqInt width, TqInt height,
+		TqInt numChannels, TqInt numEdgeRows)
+	: CqRowSource<ChannelT>(width, height, numChannels, numEdgeRows),
+	m_file(std::tmpfile()),
+	m_rowsWritten(0)
+{
+	if(!m_file)
+		AQSIS_THROW_XQERROR(XqInternal, EqE_System,
+				"Could not open temporary file for mipmap level");
+}
+
+template<typename ChannelT>
+CqTempRowFile<ChannelT>::~CqTempRowFile()
+{
+	std::fclose(m_file);
+}
+
+template<typename ChannelT>
+void CqTempRowFile<ChannelT>::writeRows(const CqTextureBuffer<ChannelT>& rows,
+		TqInt numRows)
+{
+	assert(m_rowsWritten + numRows <= this->height());
+	std::size_t numVals = std::size_t(numRows)*this->width()*this->numChannels();
+	if(std::fwrite(rows.value(0,0), sizeof(ChannelT), numVals, m_file) != numVals)
+		AQSIS_THROW_XQERROR(XqInternal, EqE_System,
+				"Could not write mipmap level to temporary file");
+	this->saveEdgeRows(rows, m_rowsWritten, numRows);
+	m_rowsWritten += numRows;
+}
+
+template<typename ChannelT>
+void CqTempRowFile<ChannelT>::finishWriting()
+{
+	assert(m_rowsWritten == this->height());
+	std::rewind(m_file);
+}
+
+template<typename ChannelT>
+void CqTempRowFile<ChannelT>::readRows(TqInt numRows,
+		CqTextureBuffer<ChannelT>& rows)
+{
+	rows.resize(this->width(), numRows, this->numChannels());
+	std::size_t numVals = std::size_t(numRows)*this->width()*this->numChannels();
+	if(std::fread(rows.value(0,0), sizeof(ChannelT), numVals, m_file) != numVals)
+		AQSIS_THROW_XQERROR(XqInternal, EqE_System,
+				"Could not read mipmap level from temporary file");
+}
+
+
+//------------------------------------------------------------------------------
+// CqBufferRowSink implementation
+template<typename ChannelT>
+CqBufferRowSink<ChannelT>::CqBufferRowSink(TqInt width, TqInt height,
+		TqInt numChannels)
+	: m_buf(new CqTextureBuffer<ChannelT>(width, height, numChannels)),
+	m_rowsWritten(0)
+{ }
+
+template<typename ChannelT>
+void CqBufferRowSink<ChannelT>::writeRows(const CqTextureBuffer<ChannelT>& rows,
+		TqInt numRows)
+{
+	assert(m_rowsWritten + numRows <= m_buf->height());
+	TqInt numVals = numRows*m_buf->width()*m_buf->numChannels();
+	std::copy(rows.value(0,0), rows.value(0,0) + numVals,
+			m_buf->value(0, m_rowsWritten));
+	m_rowsWritten += numRows;
+}
+
+template<typename ChannelT>
+inline const boost::shared_ptr<CqTextureBuffer<ChannelT> >&
+CqBufferRowSink<ChannelT>::buffer() const
+{
+	return m_buf;
+}
+
+
+//------------------------------------------------------------------------------
+// free functions implementation
+
+namespace detail {
+
+/** \brief Find the image row standing in for a row outside the image.
+ *
+ * Periodic wrapping is used for WrapMode_Trunc, as in filterTexture().
+ *
+ * \return The wrapped row, or -1 if the row is black.
+ */
+inline TqInt wrapRow(TqInt row, TqInt height, EqWrapMode wrapMode)
+{
+	if(row >= 0 && row < height)
+		return row;
+	switch(wrapMode)
+	{
+		case WrapMode_Black:
+			return -1;
+		case WrapMode_Clamp:
+			return clamp(row, 0, height-1);
+		default:
+			row %= height;
+			return row < 0 ? row + height : row;
+	}
+}
+
+/// Channel value which converts to zero, for black rows.
+template<typename ChannelT>
+inline ChannelT blackValue()
+{
+	return std::numeric_limits<ChannelT>::is_integer
+		? std::numeric_limits<ChannelT>::min() : ChannelT(0);
+}
+
+} // namespace detail
+
+inline TqInt streamEdgeRows(const SqFilterInfo& filterInfo, TqInt width,
+		TqInt height)
+{
+	CqCachedFilter weights(filterInfo, width % 2 != 0, height % 2 != 0, 0.5f);
+	return min(weights.height(), height);
+}
+
+template<typename ChannelT>
+void downsampleStreamed(CqRowSource<ChannelT>& src, IqTexOutputFile& outFile,
+		const SqFilterInfo& filterInfo, const SqWrapModes& wrapModes,
+		TqInt bandHeight, IqRowSink<ChannelT>& dest)
+{
+	const TqInt width = src.width();
+	const TqInt height = src.height();
+	const TqInt numChannels = src.numChannels();
+	const TqInt rowLen = width*numChannels;
+	const TqInt newWidth = lceil(TqFloat(width)/2);
+	const TqInt newHeight = lceil(TqFloat(height)/2);
+
+	CqCachedFilter weights(filterInfo, width % 2 != 0, height % 2 != 0, 0.5f);
+	const TqInt filterOffsetY = (weights.height()-1) / 2;
+	TqInt chunkHeight = 1;
+	if(const SqTileInfo* tileInfo = outFile.header().findPtr<Attr::TileInfo>())
+		chunkHeight = tileInfo->height;
+
+	// Source rows [rowsStart, nextRow) which have been read and may still be
+	// needed.
+	CqTextureBuffer<ChannelT> rows;
+	TqInt rowsStart = 0;
+	TqInt nextRow = 0;
+	CqTextureBuffer<ChannelT> chunk;
+	CqTextureBuffer<ChannelT> window;
+	CqTextureBuffer<ChannelT> destRows(newWidth, bandHeight, numChannels);
+	const ChannelT black = detail::blackValue<ChannelT>();
+	for(TqInt destStart = 0; destStart < newHeight; destStart += bandHeight)
+	{
+		const TqInt destEnd = min(destStart + bandHeight, newHeight);
+		// Source rows covered by the filter supports for the band.
+		const TqInt srcStart = 2*destStart - filterOffsetY;
+		const TqInt srcEnd = 2*(destEnd-1) - filterOffsetY + weights.height();
+		// Read up to the end of the band, rounded up to a whole chunk.
+		TqInt readEnd = min(height,
+				chunkHeight*((min(srcEnd, height) + chunkHeight - 1)/chunkHeight));
+		if(readEnd > nextRow)
+		{
+			src.readRows(readEnd - nextRow, chunk);
+			outFile.writePixels(chunk);
+			// Append the chunk to the retained rows, dropping any which are
+			// above the band.
+			TqInt keepStart = clamp(srcStart, rowsStart, nextRow);
+			CqTextureBuffer<ChannelT> newRows(width, readEnd - keepStart,
+					numChannels);
+			if(keepStart < nextRow)
+				std::copy(rows.value(0, keepStart - rowsStart),
+						rows.value(0, 0) + (nextRow - rowsStart)*rowLen,
+						newRows.value(0, 0));
+			std::copy(chunk.value(0, 0), chunk.value(0, 0) + chunk.height()*rowLen,
+					newRows.value(0, nextRow - keepStart));
+			rows = newRows;
+			rowsStart = keepStart;
+			nextRow = readEnd;
+		}
+		// Gather the rows under the band, resolving rows outside the image
+		// with the vertical wrap mode.
+		window.resize(width, srcEnd - srcStart, numChannels);
+		for(TqInt row = srcStart; row < srcEnd; ++row)
+		{
+			ChannelT* windowRow = window.value(0, row - srcStart);
+			TqInt srcRow = detail::wrapRow(row, height, wrapModes.tWrap);
+			if(srcRow < 0)
+				std::fill(windowRow, windowRow + rowLen, black);
+			else if(srcRow >= rowsStart && srcRow < nextRow)
+				std::copy(rows.value(0, srcRow - rowsStart),
+						rows.value(0, srcRow - rowsStart) + rowLen, windowRow);
+			else
+				std::copy(src.edgeRow(srcRow), src.edgeRow(srcRow) + rowLen,
+						windowRow);
+		}
+		detail::downsampleRows(window, srcStart, 2, weights, wrapModes,
+				destRows, destStart, destEnd);
+		dest.writeRows(destRows, destEnd - destStart);
+	}
+	// Pass the rest of the source image through to the output file.
+	if(nextRow < height)
+	{
+		src.readRows(height - nextRow, chunk);
+		outFile.writePixels(chunk);
+	}
+}
+
+} // namespace Aqsis
+
+#endif // STREAMDOWNSAMPLE_H_INCLUDED
@@ -0,0 +1,179 @@
+// Aqsis
+// Copyright (C) 2001, Paul C. Gregory and the other authors and contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the software's owners nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// (This is the New BSD license)
+
+/** \file
+ *
+ * \brief Unit tests for streamed mipmap downsampling.
+ */
+
+#include "streamdownsample.h"
+
+#include <cmath>
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/auto_unit_test.hpp>
+
+#include <aqsis/tex/io/itexoutputfile.h>
+
+BOOST_AUTO_TEST_SUITE(streamdownsample_tests)
+
+using namespace Aqsis;
+
+namespace {
+
+// Gaussian filter, as RiGaussianFilter.
+RtFloat gaussianFilter(RtFloat x, RtFloat y, RtFloat xWidth, RtFloat yWidth)
+{
+	x *= 2/xWidth;
+	y *= 2/yWidth;
+	return std::exp(-2*(x*x + y*y));
+}
+
+// Row source reading from a buffer held in memory.
+class CqMemoryRowSource : public CqRowSource<TqFloat>
+{
+	public:
+		CqMemoryRowSource(const CqTextureBuffer<TqFloat>& buf, TqInt numEdgeRows)
+			: CqRowSource<TqFloat>(buf.width(), buf.height(),
+					buf.numChannels(), numEdgeRows),
+			m_buf(buf),
+			m_nextRow(0)
+		{
+			saveEdgeRows(m_buf, 0, m_buf.height());
+		}
+		virtual void readRows(TqInt numRows, CqTextureBuffer<TqFloat>& rows)
+		{
+			BOOST_REQUIRE(m_nextRow + numRows <= m_buf.height());
+			TqInt rowLen = m_buf.width()*m_buf.numChannels();
+			rows.resize(m_buf.width(), numRows, m_buf.numChannels());
+			std::copy(m_buf.value(0, m_nextRow),
+					m_buf.value(0, m_nextRow) + numRows*rowLen, rows.value(0, 0));
+			m_nextRow += numRows;
+		}
+	private:
+		const CqTextureBuffer<TqFloat>& m_buf;
+		TqInt m_nextRow;
+};
+
+// Output file which just counts the rows written to it.
+class CqNullOutputFile : public IqTexOutputFile
+{
+	public:
+		CqNullOutputFile(TqInt width, TqInt height, TqInt tileHeight)
+			: m_header(),
+			m_currentLine(0)
+		{
+			m_header.setWidth(width);
+			m_header.setHeight(height);
+			m_header.set<Attr::TileInfo>(SqTileInfo(16, tileHeight));
+		}
+		virtual boostfs::path fileName() const { return "null"; }
+		virtual EqImageFileType fileType() { return ImageFile_Unknown; }
+		virtual const CqTexFileHeader& header() const { return m_header; }
+		virtual TqInt currentLine() const { return m_currentLine; }
+	protected:
+		virtual void writePixelsImpl(const CqMixedImageBuffer& buffer)
+		{
+			m_currentLine += buffer.height();
+		}
+	private:
+		CqTexFileHeader m_header;
+		TqInt m_currentLine;
+};
+
+// Make an image with some structure at all scales.
+CqTextureBuffer<TqFloat> testImage(TqInt width, TqInt height, TqInt numChannels)
+{
+	CqTextureBuffer<TqFloat> buf(width, height, numChannels);
+	for(TqInt y = 0; y < height; ++y)
+		for(TqInt x = 0; x < width; ++x)
+			for(TqInt c = 0; c < numChannels; ++c)
+				buf.value(x, y)[c] = std::sin(0.7f*x + 1.3f*y + c)
+					+ ((x/3 + y/2) % 2);
+	return buf;
+}
+
+// Check that streamed downsampling gives the same result as downsample()
+void checkStreamedDownsample(TqInt width, TqInt height,
+		const SqFilterInfo& filterInfo, const SqWrapModes& wrapModes,
+		TqInt bandHeight, TqInt tileHeight)
+{
+	const TqInt numChannels = 2;
+	CqTextureBuffer<TqFloat> srcBuf = testImage(width, height, numChannels);
+	boost::shared_ptr<CqTextureBuffer<TqFloat> > expected
+		= downsample(srcBuf, filterInfo, wrapModes);
+
+	CqMemoryRowSource src(srcBuf, streamEdgeRows(filterInfo, width, height));
+	CqNullOutputFile outFile(width, height, tileHeight);
+	CqBufferRowSink<TqFloat> sink(expected->width(), expected->height(),
+			numChannels);
+	downsampleStreamed(src, outFile, filterInfo, wrapModes, bandHeight, sink);
+
+	// The source image should be passed through to the output file.
+	BOOST_CHECK_EQUAL(outFile.currentLine(), height);
+	const CqTextureBuffer<TqFloat>& result = *sink.buffer();
+	BOOST_REQUIRE_EQUAL(result.width(), expected->width());
+	BOOST_REQUIRE_EQUAL(result.height(), expected->height());
+	for(TqInt y = 0; y < result.height(); ++y)
+		for(TqInt x = 0; x < result.width(); ++x)
+			for(TqInt c = 0; c < numChannels; ++c)
+				BOOST_CHECK_CLOSE(result.value(x, y)[c],
+						expected->value(x, y)[c], 1e-4f);
+}
+
+} // unnamed namespace
+
+BOOST_AUTO_TEST_CASE(downsampleStreamed_periodic_test)
+{
+	// A band of 3 output rows covers 6 source rows, which isn't a multiple
+	// of the filter width.
+	SqFilterInfo filterInfo(gaussianFilter, 5, 5);
+	SqWrapModes wrapModes(WrapMode_Periodic, WrapMode_Periodic);
+	checkStreamedDownsample(32, 32, filterInfo, wrapModes, 3, 4);
+}
+
+BOOST_AUTO_TEST_CASE(downsampleStreamed_odd_size_test)
+{
+	// Odd dimensions use the odd-sized filter kernels.
+	SqFilterInfo filterInfo(gaussianFilter, 4, 4);
+	SqWrapModes wrapModes(WrapMode_Black, WrapMode_Black);
+	checkStreamedDownsample(23, 19, filterInfo, wrapModes, 5, 3);
+}
+
+BOOST_AUTO_TEST_CASE(downsampleStreamed_clamp_test)
+{
+	SqFilterInfo filterInfo(gaussianFilter, 3, 3);
+	SqWrapModes wrapModes(WrapMode_Clamp, WrapMode_Clamp);
+	checkStreamedDownsample(17, 26, filterInfo, wrapModes, 1, 1);
+	// A band covering the whole image.
+	checkStreamedDownsample(17, 26, filterInfo, wrapModes, 100, 8);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -46,6 +46,7 @@
 
 #include	<aqsis/slcomp/libslparse.h>
 #include	<aqsis/slcomp/icodegen.h>
+#include	<aqsis/shadervm/ishader.h>
 #include	<aqsis/util/argparse.h>
 
 #include	<aqsis/version.h>
@@ -69,6 +70,8 @@ ArgParse::apstringvec g_undefines; // Filled in with strings to pass to the prep
 ArgParse::apstring g_backendName = "slx"; /// Name for the comipler backend.
 
 bool g_dumpsl = 0;
+bool g_binary = false;
+bool g_nodataflow = false;
 bool g_cl_no_color = false;
 bool g_cl_syslog = false;
 ArgParse::apint g_cl_verbose = 1;
@@ -78,6 +81,21 @@ void version( std::ostream& Stream )
 	Stream << "aqsl version " << AQSIS_VERSION_STR_FULL << std::endl << "compiled " << __DATE__ << " " << __TIME__ << std::endl;
 }
 
+/** Replace a compiled shader in the ascii slx format with its binary form.
+ */
+void convertToBinary( const std::string& fileName )
+{
+	std::ostringstream binary;
+	{
+		std::ifstream asciiFile( fileName.c_str() );
+		writeBinaryShaderProgram( asciiFile, binary );
+	}
+	std::ofstream binaryFile( fileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+	binaryFile << binary.str();
+	if ( !binaryFile )
+		Aqsis::log() << error << "Could not write binary shader \"" << fileName << "\"" << std::endl;
+}
+
 
 /** Process the sl file from stdin and produce an slx bytestream.
  */
@@ -102,6 +120,8 @@ int main( int argc, const char** argv )
 	ap.argFlag( "nocolor", "\aDisable colored output", &g_cl_no_color );
 	ap.alias( "nocolor" , "nc" );
 	ap.argFlag( "d", "\adump sl data", &g_dumpsl );
+	ap.argFlag( "binary", "\aWrite the compiled shader in the binary slx format, which loads faster (slx backend only)", &g_binary );
+	ap.argFlag( "nodataflow", "\aDisable constant folding and the dataflow optimisations", &g_nodataflow );
 	ap.argInt( "verbose", "=integer\aSet log output level\n"
 			   "\a0 = errors\n"
 			   "\a1 = warnings (default)\n"
@@ -155,6 +175,8 @@ int main( int argc, const char** argv )
 		std::auto_ptr<std::streambuf> use_syslog( new Aqsis::syslog_buf(Aqsis::log()) );
 #endif	// AQSIS_SYSTEM_POSIX
 
+	SetOptimiseDataflow( !g_nodataflow );
+
 	if ( ap.leftovers().size() == 0 )
 	{
 		std::cout << ap.usagemsg();
@@ -272,7 +294,12 @@ int main( int argc, const char** argv )
 						dumpfile.close();
   
 					if ( Parse( preprocessed, e->c_str(), Aqsis::log() ) )
+					{
 						codeGenerator->OutputTree( GetParseTree(), g_stroutname );
+						CqCodeGenVM* vmGenerator = dynamic_cast<CqCodeGenVM*>( codeGenerator.get() );
+						if ( g_binary && vmGenerator )
+							convertToBinary( vmGenerator->outputFileName() );
+					}
 					else
 						error = true;
 				}
@@ -0,0 +1,368 @@
+// Aqsis
+// Copyright (C) 1997 - 2001, Paul C. Gregory
+//
+// Contact: pgregory@aqsis.org
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+/** \file
+ *
+ * \brief Display driver writing deep OpenEXR images.
+ *
+ * The renderer sends this display the depth sorted fragments of each pixel
+ * (see PkDspyFlagsWantsDeepData in ndspy.h), which are written as the
+ * samples of a deep scanline OpenEXR file.  The images can be composited
+ * with other deep images, for example separately rendered volumes or
+ * holdouts, without rendering again.  For example:
+ *
+ *     Display "beauty.exr" "deepexr" "rgbaz"
+ *
+ * Deep compositing tools expect the "A" and "Z" channels, so "rgbaz" is the
+ * usual mode.  Colour and opacity are stored premultiplied by coverage.
+ *
+ * Parameters:
+ *   "exrpixeltype" - "half" (the default) or "float"; the type used for all
+ *                    channels but "Z", which is always float.
+ *   "exrcompression" - "none", "rle" or "zips" (the default).  Deep images
+ *                    only support single line compression schemes.
+ */
+
+#include <aqsis/aqsis.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <OpenEXR/ImfDeepScanLineOutputFile.h>
+#include <OpenEXR/ImfDeepFrameBuffer.h>
+#include <OpenEXR/ImfChannelList.h>
+#include <OpenEXR/ImfMatrixAttribute.h>
+#include <OpenEXR/ImfPartType.h>
+
+#include <aqsis/ri/ndspy.h>
+#include "dspyhlpr.h"
+
+#define DspyError(a,b,c) printf(b,c)
+
+using namespace Imath;
+using namespace Imf;
+
+namespace {
+
+/// A deep image being written.
+class CqDeepExrImage
+{
+	public:
+		CqDeepExrImage(const std::string& fileName, const Header& header,
+				TqInt numChannels);
+
+		/** \brief Write the next scanline.
+		 *
+		 * \param counts - number of fragments for each pixel in the line
+		 * \param values - fragment values, numChannels per fragment
+		 */
+		void writeLine(const PtDspyUnsigned32* counts, const PtDspyFloat32* values);
+		/// Fill in any scanlines which never arrived with empty pixels.
+		void finish();
+
+		TqInt nextLine() const;
+		const Header& header() const;
+
+	private:
+		DeepScanLineOutputFile m_file;
+		TqInt m_width;
+		TqInt m_xMin;
+		TqInt m_numChannels;
+		TqInt m_nextLine;
+		TqInt m_endLine;
+		std::vector<unsigned int> m_counts;
+		/// Pointers to the first value of each pixel, one array per channel.
+		std::vector<std::vector<const PtDspyFloat32*> > m_pointers;
+};
+
+CqDeepExrImage::CqDeepExrImage(const std::string& fileName, const Header& header,
+		TqInt numChannels)
+	: m_file(fileName.c_str(), header),
+	m_width(header.dataWindow().max.x - header.dataWindow().min.x + 1),
+	m_xMin(header.dataWindow().min.x),
+	m_numChannels(numChannels),
+	m_nextLine(header.dataWindow().min.y),
+	m_endLine(header.dataWindow().max.y + 1),
+	m_counts(m_width),
+	m_pointers(numChannels, std::vector<const PtDspyFloat32*>(m_width))
+{ }
+
+void CqDeepExrImage::writeLine(const PtDspyUnsigned32* counts, const PtDspyFloat32* values)
+{
+	// Point the channel slices at the fragment values for this line.  The
+	// values of a fragment are interleaved, so consecutive samples of a
+	// channel are numChannels floats apart.
+	const PtDspyFloat32* pixelValues = values;
+	for(TqInt x = 0; x < m_width; ++x)
+	{
+		m_counts[x] = counts[x];
+		for(TqInt c = 0; c < m_numChannels; ++c)
+			m_pointers[c][x] = counts[x] > 0 ? pixelValues + c : 0;
+		if(counts[x] > 0)
+			pixelValues += counts[x]*m_numChannels;
+	}
+
+	// The slices address the single line buffer for every y, hence the zero
+	// y strides.
+	DeepFrameBuffer frameBuffer;
+	frameBuffer.insertSampleCountSlice(Slice(UINT,
+				reinterpret_cast<char*>(&m_counts[0] - m_xMin),
+				sizeof(unsigned int), 0));
+	const ChannelList& channels = m_file.header().channels();
+	TqInt c = 0;
+	for(ChannelList::ConstIterator chan = channels.begin(); chan != channels.end(); ++chan, ++c)
+	{
+		frameBuffer.insert(chan.name(), DeepSlice(FLOAT,
+					reinterpret_cast<char*>(&m_pointers[c][0] - m_xMin),
+					sizeof(const PtDspyFloat32*), 0,
+					m_numChannels*sizeof(PtDspyFloat32)));
+	}
+	m_file.setFrameBuffer(frameBuffer);
+	m_file.writePixels(1);
+	++m_nextLine;
+}
+
+void CqDeepExrImage::finish()
+{
+	std::vector<PtDspyUnsigned32> emptyCounts(m_width, 0);
+	while(m_nextLine < m_endLine)
+		writeLine(&emptyCounts[0], 0);
+}
+
+TqInt CqDeepExrImage::nextLine() const
+{
+	return m_nextLine;
+}
+
+const Header& CqDeepExrImage::header() const
+{
+	return m_file.header();
+}
+
+/** \brief Map a display format name onto an OpenEXR channel name.
+ *
+ * The standard "r", "g", "b", "a" and "z" names become the upper case deep
+ * EXR channel names; anything else is used as is.
+ */
+std::string channelName(const char* formatName)
+{
+	std::string name = formatName;
+	if(name.size() == 1 && name.find_first_of("rgbaz") != std::string::npos)
+		name[0] = name[0] - 'a' + 'A';
+	return name;
+}
+
+} // unnamed namespace
+
+
+extern "C" {
+
+PtDspyError DspyImageOpen(PtDspyImageHandle* image,
+		const char* drivername,
+		const char* filename,
+		int width,
+		int height,
+		int paramCount,
+		const UserParameter* parameters,
+		int formatCount,
+		PtDspyDevFormat* format,
+		PtFlagStuff* flagstuff)
+{
+	try
+	{
+		Header header(width, height);
+		header.setType(DEEPSCANLINE);
+		header.lineOrder() = INCREASING_Y;
+
+		// Data and display windows
+		Box2i& dataWindow = header.dataWindow();
+		int n = 2;
+		DspyFindIntsInParamList("origin", &n, &dataWindow.min.x, paramCount, parameters);
+		dataWindow.max.x = dataWindow.min.x + width - 1;
+		dataWindow.max.y = dataWindow.min.y + height - 1;
+		Box2i& displayWindow = header.displayWindow();
+		n = 2;
+		if(DspyFindIntsInParamList("OriginalSize", &n, &displayWindow.max.x,
+					paramCount, parameters) == PkDspyErrorNone)
+		{
+			displayWindow.max.x -= 1;
+			displayWindow.max.y -= 1;
+		}
+
+		// Camera matrices, so that compositing tools can place the samples
+		// in space.
+		M44f NP, Nl;
+		if(DspyFindMatrixInParamList("NP", &NP[0][0], paramCount, parameters) == PkDspyErrorNone)
+			header.insert("worldToNDC", M44fAttribute(NP));
+		if(DspyFindMatrixInParamList("Nl", &Nl[0][0], paramCount, parameters) == PkDspyErrorNone)
+			header.insert("worldToCamera", M44fAttribute(Nl));
+
+		char* comp = 0;
+		header.compression() = ZIPS_COMPRESSION;
+		DspyFindStringInParamList("exrcompression", &comp, paramCount, parameters);
+		if(comp)
+		{
+			if(!strcmp(comp, "none"))
+				header.compression() = NO_COMPRESSION;
+			else if(!strcmp(comp, "rle"))
+				header.compression() = RLE_COMPRESSION;
+			else if(strcmp(comp, "zips"))
+			{
+				std::string msg = std::string("Unsupported exrcompression \"")
+					+ comp + "\" for deep image " + filename;
+				DspyError("deepexr display driver", "%s\n", msg.c_str());
+				return PkDspyErrorBadParams;
+			}
+		}
+
+		PixelType pixelType = HALF;
+		char* ptype = 0;
+		DspyFindStringInParamList("exrpixeltype", &ptype, paramCount, parameters);
+		if(ptype && !strcmp(ptype, "float"))
+			pixelType = FLOAT;
+
+		// The channel list is held sorted by name, and the fragment values
+		// must be in the same order, so sort the formats to match.
+		for(int i = 1; i < formatCount; ++i)
+		{
+			for(int j = i; j > 0 && channelName(format[j].name) < channelName(format[j-1].name); --j)
+				std::swap(format[j], format[j-1]);
+		}
+		for(int i = 0; i < formatCount; ++i)
+		{
+			std::string name = channelName(format[i].name);
+			header.channels().insert(name.c_str(),
+					Channel(name == "Z" ? FLOAT : pixelType));
+			format[i].type = PkDspyFloat32 | PkDspyByteOrderNative;
+		}
+
+		*image = new CqDeepExrImage(filename, header, formatCount);
+		flagstuff->flags |= PkDspyFlagsWantsScanLineOrder | PkDspyFlagsWantsDeepData;
+	}
+	catch(const std::exception& e)
+	{
+		DspyError("deepexr display driver", "%s\n", e.what());
+		return PkDspyErrorUndefined;
+	}
+	return PkDspyErrorNone;
+}
+
+PtDspyError DspyImageData(PtDspyImageHandle image,
+		int xmin,
+		int xmaxplus1,
+		int ymin,
+		int ymaxplus1,
+		int entrysize,
+		const unsigned char* data)
+{
+	CqDeepExrImage* deepImage = reinterpret_cast<CqDeepExrImage*>(image);
+	const Box2i& dataWindow = deepImage->header().dataWindow();
+	// Lines arrive in raster space, while columns are relative to the crop
+	// window.
+	if(xmin != 0 || xmaxplus1 != dataWindow.max.x - dataWindow.min.x + 1
+		|| ymin < deepImage->nextLine())
+		return PkDspyErrorBadParams;
+	try
+	{
+		// Lines which never arrived are left empty.
+		std::vector<PtDspyUnsigned32> emptyCounts(xmaxplus1, 0);
+		while(deepImage->nextLine() < ymin)
+			deepImage->writeLine(&emptyCounts[0], 0);
+
+		const unsigned char* lineData = data;
+		for(int y = ymin; y < ymaxplus1; ++y)
+		{
+			// Each line is a block of counts, followed by the fragments.
+			const PtDspyUnsigned32* counts = reinterpret_cast<const PtDspyUnsigned32*>(lineData);
+			TqInt numFragments = 0;
+			for(int x = 0; x < xmaxplus1; ++x)
+				numFragments += counts[x];
+			const PtDspyFloat32* values = reinterpret_cast<const PtDspyFloat32*>(
+					lineData + xmaxplus1*sizeof(PtDspyUnsigned32));
+			deepImage->writeLine(counts, values);
+			lineData += xmaxplus1*sizeof(PtDspyUnsigned32) + numFragments*entrysize;
+		}
+	}
+	catch(const std::exception& e)
+	{
+		DspyError("deepexr display driver", "%s\n", e.what());
+		return PkDspyErrorUndefined;
+	}
+	return PkDspyErrorNone;
+}
+
+PtDspyError DspyImageClose(PtDspyImageHandle image)
+{
+	CqDeepExrImage* deepImage = reinterpret_cast<CqDeepExrImage*>(image);
+	PtDspyError result = PkDspyErrorNone;
+	try
+	{
+		deepImage->finish();
+	}
+	catch(const std::exception& e)
+	{
+		DspyError("deepexr display driver", "%s\n", e.what());
+		result = PkDspyErrorUndefined;
+	}
+	delete deepImage;
+	return result;
+}
+
+PtDspyError DspyImageQuery(PtDspyImageHandle image,
+		PtDspyQueryType querytype,
+		size_t datalen,
+		void* data)
+{
+	if(datalen == 0 || !data)
+		return PkDspyErrorBadParams;
+	switch(querytype)
+	{
+		case PkOverwriteQuery:
+		{
+			PtDspyOverwriteInfo overwriteInfo;
+			overwriteInfo.overwrite = 1;
+			overwriteInfo.interactive = 0;
+			memcpy(data, &overwriteInfo, std::min(datalen, sizeof(overwriteInfo)));
+			break;
+		}
+		case PkSizeQuery:
+		{
+			PtDspySizeInfo sizeInfo;
+			sizeInfo.width = 640;
+			sizeInfo.height = 480;
+			sizeInfo.aspectRatio = 1.0f;
+			if(image)
+			{
+				const Box2i& dataWindow = reinterpret_cast<CqDeepExrImage*>(image)->header().dataWindow();
+				sizeInfo.width = dataWindow.max.x - dataWindow.min.x + 1;
+				sizeInfo.height = dataWindow.max.y - dataWindow.min.y + 1;
+			}
+			memcpy(data, &sizeInfo, std::min(datalen, sizeof(sizeInfo)));
+			break;
+		}
+		default:
+			return PkDspyErrorUnsupported;
+	}
+	return PkDspyErrorNone;
+}
+
+} // extern "C"
@@ -356,7 +356,7 @@ static void splitNode(V3f P, float maxSolidAngle, int dataSize,
             // Leaf node: simply render each child point.
             for(int i = 0; i < node->npoints; ++i)
             {
-                const float* data = &node->data[i*dataSize];
+                const float* data = &node->data()[i*dataSize];
                 V3f p = V3f(data[0], data[1], data[2]);
                 V3f n = V3f(data[3], data[4], data[5]);
                 float r = data[6];
@@ -369,7 +369,7 @@ static void splitNode(V3f P, float maxSolidAngle, int dataSize,
             // Interior node: render each non-null child.
             for(int i = 0; i < 8; ++i)
             {
-                DiffusePointOctree::Node* child = node->children[i];
+                const DiffusePointOctree::Node* child = node->child(i);
                 if(!child)
                     continue;
                 splitNode(P, maxSolidAngle, dataSize, child);
@@ -60,6 +60,7 @@ ArgParse::apfloat g_width = -1.0;
 ArgParse::apstring g_compress = "none";
 ArgParse::apfloat g_quality = 70.0;
 ArgParse::apfloat g_bake = 128.0;
+ArgParse::apfloat g_memoryLimit = 1024.0;
 
 
 void version( std::ostream& Stream )
@@ -73,6 +74,7 @@ int main( int argc, const char** argv )
 	ArgParse ap;
 	RtFilterFunc filterfunc;
 	float bake;
+	float memoryLimit;
 
 	ap.usageHeader( ArgParse::apstring( "Usage: " ) + argv[ 0 ] + " [options] infile outfile" );
 	ap.argFlag( "help", "\aPrint this help and exit", &g_help );
@@ -104,6 +106,7 @@ int main( int argc, const char** argv )
 	ap.alias( "width", "filterwidth" );
 	ap.argFloat( "quality", "=float\a[>=1.0f && <= 100.0f] (default: %default)", &g_quality );
 	ap.argFloat( "bake", "=float\a[>=2.0f && <= 2048.0f] (default: %default)", &g_bake );
+	ap.argFloat( "memorylimit", "=float\aapproximate memory limit for mipmapping in MB; larger\n\atextures are mipmapped a band at a time [>=1.0f] (default: %default)", &g_memoryLimit );
 	ap.argString( "resize", "=string\a[up|down|round|up-|down-|round-] (default: %default)\n\aNot used, for BMRT compatibility only!", &g_resize );
 
 
@@ -219,8 +222,13 @@ int main( int argc, const char** argv )
 	if ( g_bake > 2048.0f )
 		g_bake = 2048.0;
 
+	/* protect the memory limit */
+	if ( g_memoryLimit < 1.0f )
+		g_memoryLimit = 1.0;
+
 	char *compression = ( char * ) g_compress.c_str();
 	float quality = ( float ) g_quality;
+	memoryLimit = ( float ) g_memoryLimit;
 
 
 	std::auto_ptr<std::streambuf> show_level( new Aqsis::show_level_buf(Aqsis::log()) );
@@ -295,7 +303,7 @@ int main( int argc, const char** argv )
 		        ( char* ) g_compress.c_str() );
 
 		RiMakeLatLongEnvironment( ( char* ) ap.leftovers() [ 0 ].c_str(), ( char* ) ap.leftovers() [ 1 ].c_str(), filterfunc,
-		                          ( float ) g_swidth, ( float ) g_twidth, "compression", &compression, "quality", &quality, RI_NULL );
+		                          ( float ) g_swidth, ( float ) g_twidth, "compression", &compression, "quality", &quality, "float memorylimit", &memoryLimit, RI_NULL );
 	}
 	else
 	{
@@ -314,7 +322,8 @@ int main( int argc, const char** argv )
 
 		RiMakeTexture( ( char* ) ap.leftovers() [ 0 ].c_str(), ( char* ) ap.leftovers() [ 1 ].c_str(),
 		               ( char* ) g_swrap.c_str(), ( char* ) g_twrap.c_str(), filterfunc,
-		               ( float ) g_swidth, ( float ) g_twidth, "compression", &compression, "quality", &quality, "float bake", &bake, RI_NULL );
+		               ( float ) g_swidth, ( float ) g_twidth, "compression", &compression, "quality", &quality, "float bake", &bake,
+		               "float memorylimit", &memoryLimit, RI_NULL );
 	}
 
 	RiEnd();